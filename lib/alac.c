@@ -0,0 +1,405 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "alac.h"
+
+#define ALAC_ELEMENT_SCE 0       /* single channel element */
+#define ALAC_ELEMENT_CPE 1       /* channel pair element */
+#define ALAC_ELEMENT_END 7
+#define RICE_THRESHOLD 8         /* longer unary prefixes escape to a verbatim value */
+#define MAX_LPC_ORDER 32
+
+struct alac_s {
+    int frame_length;
+    int bit_depth;
+    int pb;                      /* rice history multiplier */
+    int mb;                      /* initial rice history */
+    int kb;                      /* maximum rice parameter */
+    int channels;
+    int32_t *residuals[ALAC_MAX_CHANNELS];
+    int32_t *samples[ALAC_MAX_CHANNELS];
+    uint16_t *extra_bits[ALAC_MAX_CHANNELS];
+};
+
+/* big-endian (MSB first) bit reader; reading past the end returns zeros and sets overrun */
+typedef struct bitreader_s {
+    const unsigned char *data;
+    int size;                    /* in bits */
+    int pos;
+    bool overrun;
+} bitreader_t;
+
+static uint32_t
+read_bits(bitreader_t *br, int n)
+{
+    uint32_t value = 0;
+    if (br->pos + n > br->size) {
+        br->overrun = true;
+        br->pos = br->size;
+        return 0;
+    }
+    if (n > 0 && (br->pos >> 3) + 8 <= (br->size >> 3)) {
+        /* fast path: n <= 32 bits from an unaligned 64-bit big-endian load */
+        const unsigned char *p = br->data + (br->pos >> 3);
+        uint64_t bits = ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) | ((uint64_t) p[2] << 40) |
+                        ((uint64_t) p[3] << 32) | ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) |
+                        ((uint64_t) p[6] << 8) | (uint64_t) p[7];
+        bits <<= (br->pos & 7);
+        br->pos += n;
+        return (uint32_t) (bits >> (64 - n));
+    }
+    while (n > 0) {
+        int avail = 8 - (br->pos & 7);
+        int take = (n < avail ? n : avail);
+        unsigned int byte = br->data[br->pos >> 3];
+        value = (value << take) | ((byte >> (avail - take)) & ((1U << take) - 1));
+        br->pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+static uint32_t
+peek_bits(bitreader_t *br, int n)
+{
+    int pos = br->pos;
+    uint32_t value = (br->pos + n > br->size ? 0 : read_bits(br, n));
+    br->pos = pos;
+    return value;
+}
+
+static int32_t
+sign_extend(uint32_t value, int bits)
+{
+    int shift = 32 - bits;
+    return ((int32_t) (value << shift)) >> shift;
+}
+
+static int
+sign_only(int32_t value)
+{
+    return (value > 0) - (value < 0);
+}
+
+static int
+log2_floor(uint32_t value)
+{
+    int n = 0;
+    while (value >>= 1) {
+        n++;
+    }
+    return n;
+}
+
+static uint32_t
+decode_scalar(bitreader_t *br, int k, int bps)
+{
+    uint32_t x = 0;
+    if (br->pos + RICE_THRESHOLD + 1 <= br->size) {
+        /* unary prefix: up to 9 ones, ended by a zero (not present after 9 ones) */
+        uint32_t prefix = peek_bits(br, RICE_THRESHOLD + 1);
+        while (x <= RICE_THRESHOLD && (prefix & (1U << (RICE_THRESHOLD - x)))) {
+            x++;
+        }
+        br->pos += (x > RICE_THRESHOLD ? x : x + 1);
+    } else {
+        while (x <= RICE_THRESHOLD && read_bits(br, 1)) {
+            x++;
+        }
+    }
+    if (x > RICE_THRESHOLD) {
+        return read_bits(br, bps);
+    }
+    if (k != 1) {
+        uint32_t extra = peek_bits(br, k);
+        x = (x << k) - x;
+        if (extra > 1) {
+            x += extra - 1;
+            br->pos += k;
+        } else {
+            br->pos += k - 1;
+        }
+        if (br->pos > br->size) {
+            br->overrun = true;
+            br->pos = br->size;
+        }
+    }
+    return x;
+}
+
+static int
+rice_decompress(alac_t *alac, bitreader_t *br, int32_t *out, int n, int bps, uint32_t history_mult)
+{
+    uint32_t history = (uint32_t) alac->mb;
+    uint32_t sign_modifier = 0;
+    for (int i = 0; i < n; i++) {
+        if (br->overrun) {
+            return -1;
+        }
+        int k = log2_floor((history >> 9) + 3);
+        k = (k > alac->kb ? alac->kb : k);
+        uint32_t x = decode_scalar(br, k, bps) + sign_modifier;
+        sign_modifier = 0;
+        out[i] = (int32_t) (x >> 1) ^ -(int32_t) (x & 1);
+
+        if (x > 0xffff) {
+            history = 0xffff;
+        } else {
+            history += x * history_mult - ((history * history_mult) >> 9);
+        }
+
+        /* a run of zero residuals */
+        if (history < 128 && i + 1 < n) {
+            k = 7 - log2_floor(history) + ((history + 16) >> 6);
+            k = (k > alac->kb ? alac->kb : k);
+            uint32_t block_size = decode_scalar(br, k, 16);
+            if (block_size > 0) {
+                if (block_size >= (uint32_t) (n - i)) {
+                    return -1;
+                }
+                memset(&out[i + 1], 0, block_size * sizeof(int32_t));
+                i += block_size;
+            }
+            if (block_size <= 0xffff) {
+                sign_modifier = 1;
+            }
+            history = 0;
+        }
+    }
+    return (br->overrun ? -1 : 0);
+}
+
+/* adaptive FIR prediction: out[i] = prediction from the previous order+1 samples + residual */
+static void
+lpc_predict(const int32_t *residuals, int32_t *out, int n, int bps, int16_t *coefs, int order, int quant)
+{
+    out[0] = residuals[0];
+    if (n <= 1) {
+        return;
+    }
+    if (order == 0) {
+        memcpy(&out[1], &residuals[1], (n - 1) * sizeof(int32_t));
+        return;
+    }
+    if (order == 31) {
+        for (int i = 1; i < n; i++) {
+            out[i] = sign_extend((uint32_t) out[i - 1] + (uint32_t) residuals[i], bps);
+        }
+        return;
+    }
+    int i;
+    for (i = 1; i <= order && i < n; i++) {
+        out[i] = sign_extend((uint32_t) out[i - 1] + (uint32_t) residuals[i], bps);
+    }
+    for (; i < n; i++) {
+        const int32_t *pred = &out[i - order];
+        int32_t d = out[i - order - 1];
+        uint32_t sum = 0;
+        uint32_t error = (uint32_t) residuals[i];
+        for (int j = 0; j < order; j++) {
+            sum += (uint32_t) (pred[j] - d) * (uint32_t) (int32_t) coefs[j];
+        }
+        int32_t val = (int32_t) (((int64_t) (int32_t) sum + (1LL << (quant - 1))) >> quant);
+        out[i] = sign_extend((uint32_t) val + (uint32_t) d + error, bps);
+
+        /* adapt the coefficients in the direction that reduces the error */
+        int error_sign = sign_only((int32_t) error);
+        if (error_sign) {
+            for (int j = 0; j < order && (int32_t) (error * (uint32_t) error_sign) > 0; j++) {
+                int32_t diff = d - pred[j];
+                int sign = sign_only(diff) * error_sign;
+                coefs[j] -= sign;
+                diff *= sign;
+                error -= (uint32_t) (diff >> quant) * (uint32_t) (j + 1);
+            }
+        }
+    }
+}
+
+static int
+decode_element(alac_t *alac, bitreader_t *br, int channel, int channels, int *frame_samples)
+{
+    int16_t coefs[ALAC_MAX_CHANNELS][MAX_LPC_ORDER];
+    int prediction_type[ALAC_MAX_CHANNELS], order[ALAC_MAX_CHANNELS], quant[ALAC_MAX_CHANNELS];
+    int history_mult[ALAC_MAX_CHANNELS];
+    int shift = 0, weight = 0;
+    int n = alac->frame_length;
+
+    if (channel + channels > alac->channels) {
+        return -1;
+    }
+    read_bits(br, 4);                           /* element instance tag */
+    read_bits(br, 12);                          /* unused */
+    bool has_size = read_bits(br, 1);
+    int extra_bits = (int) read_bits(br, 2) << 3;
+    bool compressed = !read_bits(br, 1);
+    if (has_size) {
+        uint32_t samples = read_bits(br, 32);
+        if (samples == 0 || samples > (uint32_t) alac->frame_length) {
+            return -1;
+        }
+        n = (int) samples;
+    }
+    if (*frame_samples && *frame_samples != n) {
+        return -1;
+    }
+    *frame_samples = n;
+    int bps = alac->bit_depth - extra_bits + channels - 1;
+    if (bps < 1 || bps > 32) {
+        return -1;
+    }
+
+    if (compressed) {
+        shift = (int) read_bits(br, 8);
+        weight = (int) read_bits(br, 8);
+        for (int ch = 0; ch < channels; ch++) {
+            prediction_type[ch] = (int) read_bits(br, 4);
+            quant[ch] = (int) read_bits(br, 4);
+            history_mult[ch] = (int) read_bits(br, 3);
+            order[ch] = (int) read_bits(br, 5);
+            if (!quant[ch] || order[ch] >= n) {
+                return -1;
+            }
+            for (int i = order[ch] - 1; i >= 0; i--) {
+                coefs[ch][i] = (int16_t) read_bits(br, 16);
+            }
+        }
+        if (extra_bits) {
+            for (int i = 0; i < n; i++) {
+                for (int ch = 0; ch < channels; ch++) {
+                    alac->extra_bits[channel + ch][i] = (uint16_t) read_bits(br, extra_bits);
+                }
+            }
+        }
+        for (int ch = 0; ch < channels; ch++) {
+            int32_t *residuals = alac->residuals[channel + ch];
+            if (rice_decompress(alac, br, residuals, n, bps, (uint32_t) (history_mult[ch] * alac->pb / 4)) < 0) {
+                return -1;
+            }
+            if (prediction_type[ch] == 15) {
+                /* two passes: first-order, then the transmitted coefficients */
+                lpc_predict(residuals, residuals, n, bps, NULL, 31, 0);
+            } else if (prediction_type[ch] != 0) {
+                return -1;
+            }
+            lpc_predict(residuals, alac->samples[channel + ch], n, bps, coefs[ch], order[ch], quant[ch]);
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            for (int ch = 0; ch < channels; ch++) {
+                alac->samples[channel + ch][i] = sign_extend(read_bits(br, alac->bit_depth), alac->bit_depth);
+            }
+        }
+        extra_bits = 0;
+    }
+    if (br->overrun) {
+        return -1;
+    }
+
+    if (channels == 2 && weight) {
+        /* channel 0 was coded as u = right + weighted (left - right), channel 1 as v = left - right */
+        int32_t *ch0 = alac->samples[channel], *ch1 = alac->samples[channel + 1];
+        for (int i = 0; i < n; i++) {
+            int32_t right = ch0[i] - (((int32_t) ((uint32_t) ch1[i] * (uint32_t) weight)) >> shift);
+            ch0[i] = ch1[i] + right;
+            ch1[i] = right;
+        }
+    }
+    if (extra_bits) {
+        for (int ch = 0; ch < channels; ch++) {
+            for (int i = 0; i < n; i++) {
+                alac->samples[channel + ch][i] = (int32_t) (((uint32_t) alac->samples[channel + ch][i] << extra_bits) |
+                                                            alac->extra_bits[channel + ch][i]);
+            }
+        }
+    }
+    return 0;
+}
+
+alac_t *
+alac_init(int frame_length, int bit_depth, int pb, int mb, int kb, int channels)
+{
+    if (frame_length <= 0 || frame_length > 16384 || bit_depth != 16 || channels < 1 || channels > ALAC_MAX_CHANNELS) {
+        return NULL;
+    }
+    alac_t *alac = calloc(1, sizeof(alac_t));
+    if (!alac) {
+        return NULL;
+    }
+    alac->frame_length = frame_length;
+    alac->bit_depth = bit_depth;
+    alac->pb = pb;
+    alac->mb = mb;
+    alac->kb = kb;
+    alac->channels = channels;
+    for (int ch = 0; ch < channels; ch++) {
+        alac->residuals[ch] = malloc(frame_length * sizeof(int32_t));
+        alac->samples[ch] = malloc(frame_length * sizeof(int32_t));
+        alac->extra_bits[ch] = malloc(frame_length * sizeof(uint16_t));
+        if (!alac->residuals[ch] || !alac->samples[ch] || !alac->extra_bits[ch]) {
+            alac_destroy(alac);
+            return NULL;
+        }
+    }
+    return alac;
+}
+
+int
+alac_decode_frame(alac_t *alac, const unsigned char *data, int len, int16_t *pcm, int max_samples)
+{
+    bitreader_t br = { data, len * 8, 0, false };
+    int channel = 0;
+    int samples = 0;
+    while (br.size - br.pos >= 3) {
+        int element = (int) read_bits(&br, 3);
+        if (element == ALAC_ELEMENT_END) {
+            break;
+        }
+        if (element != ALAC_ELEMENT_SCE && element != ALAC_ELEMENT_CPE) {
+            return -1;
+        }
+        int channels = (element == ALAC_ELEMENT_CPE ? 2 : 1);
+        if (decode_element(alac, &br, channel, channels, &samples) < 0) {
+            return -1;
+        }
+        channel += channels;
+    }
+    if (channel != alac->channels || samples > max_samples) {
+        return -1;
+    }
+    for (int i = 0; i < samples; i++) {
+        for (int ch = 0; ch < alac->channels; ch++) {
+            *pcm++ = (int16_t) alac->samples[ch][i];
+        }
+    }
+    return samples;
+}
+
+void
+alac_destroy(alac_t *alac)
+{
+    if (alac) {
+        for (int ch = 0; ch < ALAC_MAX_CHANNELS; ch++) {
+            free(alac->residuals[ch]);
+            free(alac->samples[ch]);
+            free(alac->extra_bits[ch]);
+        }
+        free(alac);
+    }
+}
@@ -0,0 +1,42 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Decoder for the Apple Lossless (ALAC) frames of AirPlay audio (ct = 2), for the
+ * native audio path that plays audio without GStreamer: adaptive Golomb-Rice coded
+ * residuals, an adaptive FIR predictor and stereo decorrelation, following the
+ * published ALAC format (Apple's open-source reference decoder).
+ */
+
+#ifndef ALAC_H
+#define ALAC_H
+
+#include <stdint.h>
+
+#define ALAC_MAX_CHANNELS 2
+
+typedef struct alac_s alac_t;
+
+/* parameters of the ALAC magic cookie (ALACSpecificConfig); AirPlay uses  *
+ * frame_length 352, bit_depth 16, pb 40, mb 10, kb 14, two channels.     *
+ * Only 16-bit audio with one or two channels is supported.               */
+alac_t *alac_init(int frame_length, int bit_depth, int pb, int mb, int kb, int channels);
+
+/* decodes one frame to interleaved 16-bit PCM (pcm has room for max_samples per channel); *
+ * returns the number of samples per channel, or -1 if the frame is invalid                 */
+int alac_decode_frame(alac_t *alac, const unsigned char *data, int len, int16_t *pcm, int max_samples);
+void alac_destroy(alac_t *alac);
+
+#endif //ALAC_H
@@ -0,0 +1,142 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "av_sync.h"
+#include "threads.h"
+#include "metrics.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define AV_SYNC_DRIFT_INTERVAL SECOND_IN_NSECS   /* between updates of the drift estimate */
+#define AV_SYNC_DRIFT_GAIN     8                 /* 1/gain of each new drift measurement is applied */
+
+struct av_sync_s {
+    logger_t *logger;
+    mutex_handle_t mutex;
+
+    bool started;
+    int64_t offset;              /* applied offset, local - remote */
+    int64_t error;               /* target offset - applied offset, at the last update */
+    uint64_t last_update;        /* monotonic time */
+
+    /* drift of the applied offset, measured every AV_SYNC_DRIFT_INTERVAL */
+    int64_t drift_offset;
+    uint64_t drift_time;
+    int64_t drift_ppb;
+    uint64_t steps;
+};
+
+static uint64_t
+av_sync_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+av_sync_t *
+av_sync_init(logger_t *logger)
+{
+    av_sync_t *av_sync = calloc(1, sizeof(av_sync_t));
+    if (!av_sync) {
+        return NULL;
+    }
+    av_sync->logger = logger;
+    MUTEX_CREATE(av_sync->mutex);
+    return av_sync;
+}
+
+void
+av_sync_reset(av_sync_t *av_sync)
+{
+    MUTEX_LOCK(av_sync->mutex);
+    if (av_sync->started) {
+        logger_log(av_sync->logger, LOGGER_DEBUG, "av_sync: drift %.3f ppm, %llu step corrections",
+                   (double) av_sync->drift_ppb / 1000.0, (unsigned long long) av_sync->steps);
+    }
+    av_sync->started = false;
+    av_sync->error = 0;
+    av_sync->drift_ppb = 0;
+    av_sync->steps = 0;
+    MUTEX_UNLOCK(av_sync->mutex);
+}
+
+uint64_t
+av_sync_convert(av_sync_t *av_sync, uint64_t local_time, uint64_t remote_time)
+{
+    int64_t target = (int64_t) (local_time - remote_time);
+    uint64_t now = av_sync_get_nsecs();
+    int64_t offset;
+    MUTEX_LOCK(av_sync->mutex);
+    if (!av_sync->started) {
+        av_sync->started = true;
+        av_sync->offset = target;
+        av_sync->drift_offset = target;
+        av_sync->drift_time = now;
+    } else {
+        int64_t error = target - av_sync->offset;
+        if (error > AV_SYNC_STEP_THRESHOLD || error < -AV_SYNC_STEP_THRESHOLD) {
+            logger_log(av_sync->logger, LOGGER_INFO, "av_sync: offset error %.1f ms is too large to slew: stepped",
+                       (double) error / 1000000.0);
+            av_sync->offset = target;
+            av_sync->drift_offset = target;
+            av_sync->drift_time = now;
+            av_sync->steps++;
+        } else {
+            /* both streams update the offset: the slew is limited by the time since the last update */
+            int64_t max_slew = (int64_t) ((now - av_sync->last_update) * AV_SYNC_MAX_SLEW_PPM / 1000000);
+            if (error > max_slew) {
+                error = max_slew;
+            } else if (error < -max_slew) {
+                error = -max_slew;
+            }
+            av_sync->offset += error;
+        }
+        av_sync->error = target - av_sync->offset;
+        if (now - av_sync->drift_time >= AV_SYNC_DRIFT_INTERVAL) {
+            int64_t drift = (av_sync->offset - av_sync->drift_offset) * (int64_t) SECOND_IN_NSECS /
+                            (int64_t) (now - av_sync->drift_time);
+            av_sync->drift_ppb += (drift - av_sync->drift_ppb) / AV_SYNC_DRIFT_GAIN;
+            av_sync->drift_offset = av_sync->offset;
+            av_sync->drift_time = now;
+            metrics_set(METRICS_AV_SYNC_DRIFT, av_sync->drift_ppb);
+            metrics_set(METRICS_AV_SYNC_ERROR, av_sync->error);
+        }
+    }
+    av_sync->last_update = now;
+    offset = av_sync->offset;
+    MUTEX_UNLOCK(av_sync->mutex);
+    return (uint64_t) ((int64_t) remote_time + offset);
+}
+
+void
+av_sync_get_state(av_sync_t *av_sync, int64_t *drift_ppb, int64_t *error)
+{
+    MUTEX_LOCK(av_sync->mutex);
+    *drift_ppb = av_sync->drift_ppb;
+    *error = av_sync->error;
+    MUTEX_UNLOCK(av_sync->mutex);
+}
+
+void
+av_sync_destroy(av_sync_t *av_sync)
+{
+    if (av_sync) {
+        MUTEX_DESTROY(av_sync->mutex);
+        free(av_sync);
+    }
+}
@@ -0,0 +1,55 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Audio/video sync engine, one per client session: maps the client (remote) timestamps of audio
+ * and video to local time with an offset that follows the NTP (or PTP) clock discipline and the
+ * rtp sync of the audio stream continuously, instead of a one-shot offset from the first packet.
+ * Changes in the offset are slewed at a bounded rate, so timestamps never jump (and audio is
+ * only skewed, never cut); only large errors, e.g. after a clock step, are corrected at once.
+ */
+
+#ifndef AV_SYNC_H
+#define AV_SYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#define AV_SYNC_MAX_SLEW_PPM   500                 /* maximum rate of change of the applied offset */
+#define AV_SYNC_STEP_THRESHOLD (250ll * 1000000ll) /* nsecs: larger errors are corrected in one step */
+
+typedef struct av_sync_s av_sync_t;
+
+av_sync_t *av_sync_init(logger_t *logger);
+void av_sync_reset(av_sync_t *av_sync);
+
+/* local_time is the local time that the clock discipline gives for remote_time; returns   *
+ * the local (slewed) time at which the frame with timestamp remote_time should be played  */
+uint64_t av_sync_convert(av_sync_t *av_sync, uint64_t local_time, uint64_t remote_time);
+
+/* current drift of the applied offset (ppb), and its remaining error (nsecs) */
+void av_sync_get_state(av_sync_t *av_sync, int64_t *drift_ppb, int64_t *error);
+void av_sync_destroy(av_sync_t *av_sync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //AV_SYNC_H
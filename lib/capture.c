@@ -0,0 +1,438 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "capture.h"
+#include "threads.h"
+
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_WRITE_BUFFER (1024 * 1024)
+#define CAPTURE_MAX_PENDING (64 * 1024 * 1024)   /* bytes not yet written: the capture stops beyond this */
+#define CAPTURE_ALIGN(len) (((len) + 7) & ~7)
+
+typedef struct capture_trailer_s {
+    char magic[8];
+    uint64_t index_offset;
+    uint64_t count;
+} capture_trailer_t;
+
+/* records are appended to "pending" by the receive threads, and written to the file by the writer *
+ * thread, which swaps it with "writing": slow storage never blocks reception                         */
+struct capture_s {
+    logger_t *logger;
+    FILE *file;
+    char *filename;
+    uint64_t offset;
+    uint64_t *index;
+    uint64_t count;
+    uint64_t max_count;
+    int failed;
+    unsigned char *pending;
+    size_t pending_len;
+    size_t pending_size;
+    unsigned char *writing;
+    size_t writing_size;
+    int running;
+    int writer_waiting;
+    thread_handle_t thread;
+    mutex_handle_t mutex;
+    cond_handle_t cond;
+};
+
+struct capture_reader_s {
+    unsigned char *map;
+    size_t size;
+    const uint64_t *index;
+    uint64_t *scanned_index;
+    int count;
+};
+
+static const unsigned char zero_pad[8] = { 0 };
+
+static uint64_t
+capture_get_local_time()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    return ((uint64_t) time.tv_sec) * 1000000000ULL + (uint64_t) time.tv_nsec;
+}
+
+static THREAD_RETVAL
+capture_writer_thread(void *arg)
+{
+    capture_t *capture = arg;
+    MUTEX_LOCK(capture->mutex);
+    while (capture->running || capture->pending_len) {
+        if (!capture->pending_len) {
+            capture->writer_waiting = 1;
+            pthread_cond_wait(&capture->cond, &capture->mutex);
+            capture->writer_waiting = 0;
+            continue;
+        }
+        unsigned char *data = capture->pending;
+        size_t len = capture->pending_len;
+        size_t size = capture->pending_size;
+        capture->pending = capture->writing;
+        capture->pending_size = capture->writing_size;
+        capture->pending_len = 0;
+        capture->writing = data;
+        capture->writing_size = size;
+        MUTEX_UNLOCK(capture->mutex);
+        bool written = (fwrite(data, 1, len, capture->file) == len);
+        MUTEX_LOCK(capture->mutex);
+        if (!written && !capture->failed) {
+            logger_log(capture->logger, LOGGER_ERR, "writing to capture file %s failed, capture stopped", capture->filename);
+            capture->failed = 1;
+        }
+    }
+    MUTEX_UNLOCK(capture->mutex);
+    return 0;
+}
+
+/* the file is only readable by the user (it holds the stream keys) */
+static FILE *
+capture_create_file(const char *filename)
+{
+#ifdef _WIN32
+    return fopen(filename, "wb");
+#else
+    int fd = open(filename, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(filename);
+    }
+    return file;
+#endif
+}
+
+capture_t *
+capture_open(logger_t *logger, const char *dir, int id)
+{
+    capture_t *capture;
+    char stamp[32];
+    time_t now = time(NULL);
+    assert(logger && dir);
+
+    capture = calloc(1, sizeof(capture_t));
+    if (!capture) {
+        return NULL;
+    }
+    capture->logger = logger;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    size_t len = strlen(dir) + strlen(stamp) + strlen(CAPTURE_SUFFIX) + 32;
+    capture->filename = malloc(len);
+    if (!capture->filename) {
+        free(capture);
+        return NULL;
+    }
+    snprintf(capture->filename, len, "%s/uxplay-%s-%d%s", dir, stamp, id, CAPTURE_SUFFIX);
+    capture->file = capture_create_file(capture->filename);
+    if (!capture->file) {
+        logger_log(logger, LOGGER_ERR, "could not create capture file %s: %s", capture->filename, strerror(errno));
+        free(capture->filename);
+        free(capture);
+        return NULL;
+    }
+    setvbuf(capture->file, NULL, _IOFBF, CAPTURE_WRITE_BUFFER);
+
+    unsigned char header[CAPTURE_HEADER_SIZE] = { 0 };
+    uint32_t version = CAPTURE_VERSION;
+    memcpy(header, CAPTURE_MAGIC, 8);
+    memcpy(header + 8, &version, sizeof(version));
+    fwrite(header, 1, sizeof(header), capture->file);
+    capture->offset = CAPTURE_HEADER_SIZE;
+    MUTEX_CREATE(capture->mutex);
+    COND_CREATE(capture->cond);
+    capture->running = 1;
+    THREAD_CREATE(capture->thread, capture_writer_thread, capture);
+    if (!capture->thread) {
+        logger_log(logger, LOGGER_ERR, "could not start the capture writer thread");
+        COND_DESTROY(capture->cond);
+        MUTEX_DESTROY(capture->mutex);
+        fclose(capture->file);
+        remove(capture->filename);
+        free(capture->filename);
+        free(capture);
+        return NULL;
+    }
+    logger_log(logger, LOGGER_INFO, "capturing session to %s", capture->filename);
+    return capture;
+}
+
+int
+capture_write(capture_t *capture, capture_type_t type, const void *data, int len, const void *data2, int len2)
+{
+    capture_record_t record;
+    if (!capture) {
+        return -1;
+    }
+    if (!data) len = 0;
+    if (!data2) len2 = 0;
+    record.type = (uint32_t) type;
+    record.len = (uint32_t) (len + len2);
+    record.time = capture_get_local_time();
+    int padding = CAPTURE_ALIGN(record.len) - record.len;
+
+    MUTEX_LOCK(capture->mutex);
+    if (capture->failed) {
+        MUTEX_UNLOCK(capture->mutex);
+        return -1;
+    }
+    if (capture->count == capture->max_count) {
+        uint64_t max_count = (capture->max_count ? 2 * capture->max_count : 4096);
+        uint64_t *index = realloc(capture->index, max_count * sizeof(uint64_t));
+        if (!index) {
+            capture->failed = 1;
+            MUTEX_UNLOCK(capture->mutex);
+            return -1;
+        }
+        capture->index = index;
+        capture->max_count = max_count;
+    }
+    size_t record_size = sizeof(record) + record.len + padding;
+    if (capture->pending_len + record_size > CAPTURE_MAX_PENDING) {
+        logger_log(capture->logger, LOGGER_ERR, "capture file %s cannot be written fast enough, capture stopped",
+                   capture->filename);
+        capture->failed = 1;
+        MUTEX_UNLOCK(capture->mutex);
+        return -1;
+    }
+    if (capture->pending_len + record_size > capture->pending_size) {
+        size_t size = (capture->pending_size ? capture->pending_size : CAPTURE_WRITE_BUFFER);
+        while (size < capture->pending_len + record_size) {
+            size *= 2;
+        }
+        unsigned char *pending = realloc(capture->pending, size);
+        if (!pending) {
+            capture->failed = 1;
+            MUTEX_UNLOCK(capture->mutex);
+            return -1;
+        }
+        capture->pending = pending;
+        capture->pending_size = size;
+    }
+    unsigned char *ptr = capture->pending + capture->pending_len;
+    memcpy(ptr, &record, sizeof(record));
+    ptr += sizeof(record);
+    if (len) {
+        memcpy(ptr, data, len);
+        ptr += len;
+    }
+    if (len2) {
+        memcpy(ptr, data2, len2);
+        ptr += len2;
+    }
+    memcpy(ptr, zero_pad, padding);
+    capture->pending_len += record_size;
+    if (capture->writer_waiting) {
+        COND_SIGNAL(capture->cond);
+    }
+    capture->index[capture->count++] = capture->offset;
+    capture->offset += sizeof(record) + CAPTURE_ALIGN(record.len);
+    MUTEX_UNLOCK(capture->mutex);
+    return 0;
+}
+
+void
+capture_close(capture_t *capture)
+{
+    if (!capture) {
+        return;
+    }
+    /* the writer thread writes the pending records, then exits */
+    MUTEX_LOCK(capture->mutex);
+    capture->running = 0;
+    COND_SIGNAL(capture->cond);
+    MUTEX_UNLOCK(capture->mutex);
+    THREAD_JOIN(capture->thread);
+    if (!capture->failed) {
+        capture_trailer_t trailer;
+        memcpy(trailer.magic, CAPTURE_INDEX_MAGIC, 8);
+        trailer.index_offset = capture->offset;
+        trailer.count = capture->count;
+        if (capture->count) {
+            fwrite(capture->index, sizeof(uint64_t), capture->count, capture->file);
+        }
+        fwrite(&trailer, sizeof(trailer), 1, capture->file);
+    }
+    fclose(capture->file);
+    logger_log(capture->logger, LOGGER_INFO, "capture %s closed: %llu records, %llu bytes", capture->filename,
+               (unsigned long long) capture->count, (unsigned long long) capture->offset);
+    COND_DESTROY(capture->cond);
+    MUTEX_DESTROY(capture->mutex);
+    free(capture->pending);
+    free(capture->writing);
+    free(capture->index);
+    free(capture->filename);
+    free(capture);
+}
+
+/* finds the records of a capture that has no index (the writer did not close it) */
+static int
+capture_reader_scan(capture_reader_t *reader)
+{
+    uint64_t offset = CAPTURE_HEADER_SIZE;
+    int max_count = 0;
+    while (offset + sizeof(capture_record_t) <= reader->size) {
+        const capture_record_t *record = (const capture_record_t *) (reader->map + offset);
+        uint64_t next = offset + sizeof(capture_record_t) + CAPTURE_ALIGN((uint64_t) record->len);
+        if (record->type < CAPTURE_MIRROR_SETUP || record->type > CAPTURE_TIMING || next > reader->size) {
+            break;
+        }
+        if (reader->count == max_count) {
+            max_count = (max_count ? 2 * max_count : 4096);
+            uint64_t *index = realloc(reader->scanned_index, max_count * sizeof(uint64_t));
+            if (!index) {
+                return -1;
+            }
+            reader->scanned_index = index;
+        }
+        reader->scanned_index[reader->count++] = offset;
+        offset = next;
+    }
+    reader->index = reader->scanned_index;
+    return 0;
+}
+
+capture_reader_t *
+capture_reader_open(const char *filename)
+{
+    capture_reader_t *reader = calloc(1, sizeof(capture_reader_t));
+    if (!reader) {
+        return NULL;
+    }
+#ifdef _WIN32
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        free(reader);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    reader->size = (size_t) ftell(file);
+    fseek(file, 0, SEEK_SET);
+    reader->map = malloc(reader->size ? reader->size : 1);
+    if (!reader->map || fread(reader->map, 1, reader->size, file) != reader->size) {
+        fclose(file);
+        free(reader->map);
+        free(reader);
+        return NULL;
+    }
+    fclose(file);
+#else
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        free(reader);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < CAPTURE_HEADER_SIZE) {
+        close(fd);
+        free(reader);
+        return NULL;
+    }
+    reader->size = (size_t) st.st_size;
+    reader->map = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED) {
+        free(reader);
+        return NULL;
+    }
+    madvise(reader->map, reader->size, MADV_SEQUENTIAL);
+#endif
+    if (reader->size < CAPTURE_HEADER_SIZE || memcmp(reader->map, CAPTURE_MAGIC, 8)) {
+        capture_reader_close(reader);
+        return NULL;
+    }
+
+    /* use the index if the capture was closed cleanly */
+    if (reader->size >= CAPTURE_HEADER_SIZE + sizeof(capture_trailer_t)) {
+        capture_trailer_t trailer;
+        memcpy(&trailer, reader->map + reader->size - sizeof(trailer), sizeof(trailer));
+        if (!memcmp(trailer.magic, CAPTURE_INDEX_MAGIC, 8) && trailer.count < (uint64_t) INT32_MAX &&
+            trailer.index_offset + trailer.count * sizeof(uint64_t) + sizeof(trailer) == reader->size) {
+            reader->index = (const uint64_t *) (reader->map + trailer.index_offset);
+            reader->count = (int) trailer.count;
+            for (int i = 0; i < reader->count; i++) {
+                if (reader->index[i] + sizeof(capture_record_t) > trailer.index_offset) {
+                    reader->index = NULL;
+                    reader->count = 0;
+                    break;
+                }
+            }
+        }
+    }
+    if (!reader->index && capture_reader_scan(reader) < 0) {
+        capture_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int
+capture_reader_get_count(capture_reader_t *reader)
+{
+    assert(reader);
+    return reader->count;
+}
+
+const capture_record_t *
+capture_reader_get(capture_reader_t *reader, int i, const unsigned char **data)
+{
+    assert(reader);
+    if (i < 0 || i >= reader->count) {
+        return NULL;
+    }
+    const capture_record_t *record = (const capture_record_t *) (reader->map + reader->index[i]);
+    if (reader->index[i] + sizeof(capture_record_t) + record->len > reader->size) {
+        return NULL;
+    }
+    if (data) {
+        *data = reader->map + reader->index[i] + sizeof(capture_record_t);
+    }
+    return record;
+}
+
+void
+capture_reader_close(capture_reader_t *reader)
+{
+    if (reader) {
+#ifdef _WIN32
+        free(reader->map);
+#else
+        munmap(reader->map, reader->size);
+#endif
+        free(reader->scanned_index);
+        free(reader);
+    }
+}
@@ -0,0 +1,84 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Session capture files, for offline replay (uxplay-replay) of the raw, still encrypted,
+ * mirror video, audio and timing packets received from a client, together with the
+ * stream keys.  A capture is a sequence of 8-byte aligned records, each with the local
+ * time it was received, followed by an index of record offsets written when the capture
+ * is closed.  Captures are read through a memory map; a capture without an index (not
+ * closed cleanly) is indexed by scanning its records.  Values are in host byte order.
+ * Captures hold the stream keys (anyone who can read one can decrypt the session), so
+ * they are created readable by their owner only (mode 0600).  Records are written to
+ * the file by a writer thread, so that slow storage does not hold up reception.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#define CAPTURE_MAGIC "UXPCAP01"
+#define CAPTURE_INDEX_MAGIC "UXPCAPIX"
+#define CAPTURE_SUFFIX ".uxcap"
+
+typedef enum capture_type_e {
+    CAPTURE_MIRROR_SETUP = 1,     /* capture_mirror_setup_t */
+    CAPTURE_AUDIO_SETUP,          /* capture_audio_setup_t */
+    CAPTURE_MIRROR,               /* mirror TCP packet: 128 byte header + payload */
+    CAPTURE_AUDIO,                /* audio data UDP packet */
+    CAPTURE_AUDIO_CONTROL,        /* audio control UDP packet (sync, resent audio) */
+    CAPTURE_TIMING                /* NTP timing response from the client */
+} capture_type_t;
+
+typedef struct capture_record_s {
+    uint32_t type;
+    uint32_t len;                 /* bytes of data following the record */
+    uint64_t time;                /* local (CLOCK_REALTIME) nsecs of reception */
+} capture_record_t;
+
+typedef struct capture_mirror_setup_s {
+    unsigned char aeskey[16];
+    uint64_t stream_connection_id;
+    uint8_t h265;
+    uint8_t reserved[7];
+} capture_mirror_setup_t;
+
+typedef struct capture_audio_setup_s {
+    unsigned char aeskey[16];
+    unsigned char aesiv[16];
+    uint32_t sr;
+    uint8_t ct;
+    uint8_t reserved[3];
+} capture_audio_setup_t;
+
+typedef struct capture_s capture_t;
+typedef struct capture_reader_s capture_reader_t;
+
+/* creates dir/uxplay-<date>-<time>-<id>.uxcap (mode 0600, not replacing an existing file) */
+capture_t *capture_open(logger_t *logger, const char *dir, int id);
+/* appends a record holding data followed by data2 (one of them may be NULL) to the data to be written; *
+ * safe to call from any thread                                                                        */
+int capture_write(capture_t *capture, capture_type_t type, const void *data, int len, const void *data2, int len2);
+void capture_close(capture_t *capture);
+
+capture_reader_t *capture_reader_open(const char *filename);
+int capture_reader_get_count(capture_reader_t *reader);
+/* returns record i (in order of reception), and its data */
+const capture_record_t *capture_reader_get(capture_reader_t *reader, int i, const unsigned char **data);
+void capture_reader_close(capture_reader_t *reader);
+
+#endif //CAPTURE_H
@@ -112,28 +112,12 @@ void aes_destroy(aes_ctx_t *ctx) {
     }
 }
 
-void aes_reset(aes_ctx_t *ctx, const EVP_CIPHER *type, aes_direction_t direction) {
-    uint8_t key[AES_128_BLOCK_SIZE], iv[AES_128_BLOCK_SIZE]; 
-    memcpy(key, ctx->key, AES_128_BLOCK_SIZE);
-    memcpy(iv, ctx->iv, AES_128_BLOCK_SIZE);
-
-    if (!EVP_CIPHER_CTX_reset(ctx->cipher_ctx)) {
+/* restarts the cipher at the initial IV: the cipher and expanded key schedule are kept,   *
+ * so this is cheap enough to be done for every packet (as in raop_buffer_decrypt)         */
+void aes_reset(aes_ctx_t *ctx, aes_direction_t direction) {
+    if (!EVP_CipherInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, ctx->iv, (direction == AES_ENCRYPT ? 1 : 0))) {
         handle_error(__func__);
     }
-
-    if (direction == AES_ENCRYPT) {
-        if (!EVP_EncryptInit_ex(ctx->cipher_ctx, type, NULL, key, iv)) {
-            handle_error(__func__);
-        }
-    } else {
-        if (!EVP_DecryptInit_ex(ctx->cipher_ctx, type, NULL, key, iv)) {
-            handle_error(__func__);
-        }
-    }
-
-    memcpy(ctx->key, key, AES_128_BLOCK_SIZE);
-    memcpy(ctx->iv, iv, AES_128_BLOCK_SIZE);
-    EVP_CIPHER_CTX_set_padding(ctx->cipher_ctx, 0);
 }
 
 // AES CTR
@@ -158,7 +142,7 @@ void aes_ctr_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
 }
 
 void aes_ctr_reset(aes_ctx_t *ctx) {
-    aes_reset(ctx, EVP_aes_128_ctr(), AES_ENCRYPT);
+    aes_reset(ctx, AES_ENCRYPT);
 }
 
 void aes_ctr_destroy(aes_ctx_t *ctx) {
@@ -182,7 +166,7 @@ void aes_cbc_decrypt(aes_ctx_t *ctx, const uint8_t *in, uint8_t *out, int len) {
 }
 
 void aes_cbc_reset(aes_ctx_t *ctx) {
-    aes_reset(ctx, EVP_aes_128_cbc(), ctx->direction);
+    aes_reset(ctx, ctx->direction);
 }
 
 void aes_cbc_destroy(aes_ctx_t *ctx) {
@@ -267,85 +251,132 @@ void x25519_derive_secret(unsigned char secret[X25519_KEY_SIZE], const x25519_ke
     EVP_PKEY_CTX_free(pctx);
 }
 
-// GCM AES 128
+// AEAD (GCM AES 128, ChaCha20-Poly1305)
 
-int gcm_encrypt(const unsigned char *plaintext, int plaintext_len, unsigned char *ciphertext,
-                unsigned char *key, unsigned char *iv, unsigned char *tag)
-{
-    EVP_CIPHER_CTX *ctx;
+struct aead_ctx_s {
+    EVP_CIPHER_CTX *cipher_ctx;
+    aes_direction_t direction;
+};
 
-    int len;
-    
-    int ciphertext_len;
+/* the cipher, key and nonce length are set up once: each packet only sets a new nonce */
+aead_ctx_t *aead_init(aead_cipher_t cipher, const unsigned char *key, aes_direction_t direction) {
+    const EVP_CIPHER *type = (cipher == AEAD_CHACHA20_POLY1305 ? EVP_chacha20_poly1305() : EVP_aes_128_gcm());
+    int ivlen = (cipher == AEAD_CHACHA20_POLY1305 ? CHACHA_NONCE_SIZE : GCM_IV_SIZE);
+    int enc = (direction == AES_ENCRYPT ? 1 : 0);
+    aead_ctx_t *ctx = malloc(sizeof(aead_ctx_t));
+    assert(ctx != NULL);
+    ctx->cipher_ctx = EVP_CIPHER_CTX_new();
+    assert(ctx->cipher_ctx != NULL);
+    ctx->direction = direction;
 
-    if(!(ctx = EVP_CIPHER_CTX_new()))
-      handle_error(__func__);
+    if (!EVP_CipherInit_ex(ctx->cipher_ctx, type, NULL, NULL, NULL, enc))
+        handle_error(__func__);
 
-    if(1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL))
+    if (!EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_AEAD_SET_IVLEN, ivlen, NULL))
         handle_error(__func__);
 
-    if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, 16, NULL))
+    if (!EVP_CipherInit_ex(ctx->cipher_ctx, NULL, NULL, key, NULL, enc))
         handle_error(__func__);
 
-    if(1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv))
+    return ctx;
+}
+
+int aead_encrypt(aead_ctx_t *ctx, const unsigned char *nonce, const unsigned char *aad, int aad_len,
+                 const unsigned char *plaintext, int plaintext_len, unsigned char *ciphertext, unsigned char *tag)
+{
+    int len;
+    int ciphertext_len;
+    assert(ctx->direction == AES_ENCRYPT);
+
+    if (!EVP_EncryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, nonce))
+        handle_error(__func__);
+
+    if (aad_len > 0 && !EVP_EncryptUpdate(ctx->cipher_ctx, NULL, &len, aad, aad_len))
         handle_error(__func__);
 
-    if(1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
+    if (!EVP_EncryptUpdate(ctx->cipher_ctx, ciphertext, &len, plaintext, plaintext_len))
         handle_error(__func__);
     ciphertext_len = len;
 
-    if(1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
+    if (!EVP_EncryptFinal_ex(ctx->cipher_ctx, ciphertext + len, &len))
         handle_error(__func__);
     ciphertext_len += len;
 
-    if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag))
+    if (!EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_SIZE, tag))
         handle_error(__func__);
 
-    EVP_CIPHER_CTX_free(ctx);
-
     return ciphertext_len;
 }
 
-int gcm_decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
-                unsigned char *key, unsigned char *iv, unsigned char *tag)
+/* returns the plaintext length, or -1 if the data is not authenticated (this is not treated as a fatal error) */
+int aead_decrypt(aead_ctx_t *ctx, const unsigned char *nonce, const unsigned char *aad, int aad_len,
+                 const unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
+                 const unsigned char *tag)
 {
-    EVP_CIPHER_CTX *ctx;
     int len;
     int plaintext_len;
-    int ret;
-    
-    if(!(ctx = EVP_CIPHER_CTX_new()))
-        handle_error(__func__);
-
-    if(!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL))
-        handle_error(__func__);
+    assert(ctx->direction == AES_DECRYPT);
 
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, 16, NULL))
+    if (!EVP_DecryptInit_ex(ctx->cipher_ctx, NULL, NULL, NULL, nonce))
         handle_error(__func__);
 
-    if(!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
+    if (aad_len > 0 && !EVP_DecryptUpdate(ctx->cipher_ctx, NULL, &len, aad, aad_len))
         handle_error(__func__);
 
-    if(!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
+    if (!EVP_DecryptUpdate(ctx->cipher_ctx, plaintext, &len, ciphertext, ciphertext_len))
         handle_error(__func__);
     plaintext_len = len;
 
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag))
+    if (!EVP_CIPHER_CTX_ctrl(ctx->cipher_ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_SIZE, (void *) tag))
         handle_error(__func__);
 
-    ret = EVP_DecryptFinal_ex(ctx, plaintext + len, &len);
+    if (EVP_DecryptFinal_ex(ctx->cipher_ctx, plaintext + len, &len) > 0) {
+        return plaintext_len + len;
+    }
+    return -1;
+}
 
-    EVP_CIPHER_CTX_free(ctx);
-    
-    if(ret > 0) {
-        /* Success */
-        plaintext_len += len;
-        return plaintext_len;
-    } else {
+void aead_destroy(aead_ctx_t *ctx) {
+    if (ctx) {
+        EVP_CIPHER_CTX_free(ctx->cipher_ctx);
+        free(ctx);
+    }
+}
+
+// GCM AES 128 (single use)
+
+int gcm_encrypt(const unsigned char *plaintext, int plaintext_len, unsigned char *ciphertext,
+                unsigned char *key, unsigned char *iv, unsigned char *tag)
+{
+    aead_ctx_t *ctx = aead_init(AEAD_AES_128_GCM, key, AES_ENCRYPT);
+    int ciphertext_len = aead_encrypt(ctx, iv, NULL, 0, plaintext, plaintext_len, ciphertext, tag);
+    aead_destroy(ctx);
+    return ciphertext_len;
+}
+
+int gcm_decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
+                unsigned char *key, unsigned char *iv, unsigned char *tag)
+{
+    aead_ctx_t *ctx = aead_init(AEAD_AES_128_GCM, key, AES_DECRYPT);
+    int plaintext_len = aead_decrypt(ctx, iv, NULL, 0, ciphertext, ciphertext_len, plaintext, tag);
+    aead_destroy(ctx);
+    if (plaintext_len < 0) {
         /* Verify failed */
 	printf("failed\n");
-        return -1;
     }
+    return plaintext_len;
+}
+
+// ChaCha20-Poly1305 (single use)
+
+int chacha20_poly1305_decrypt(const unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
+                              const unsigned char *key, const unsigned char *nonce, const unsigned char *aad,
+                              int aad_len, const unsigned char *tag)
+{
+    aead_ctx_t *ctx = aead_init(AEAD_CHACHA20_POLY1305, key, AES_DECRYPT);
+    int plaintext_len = aead_decrypt(ctx, nonce, aad, aad_len, ciphertext, ciphertext_len, plaintext, tag);
+    aead_destroy(ctx);
+    return plaintext_len;
 }
 
 // ED25519
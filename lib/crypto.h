@@ -71,12 +71,37 @@ void pk_to_base64(const unsigned char *pk, int pk_len, char *pk_base64, int len)
   
 void x25519_derive_secret(unsigned char secret[X25519_KEY_SIZE], const x25519_key_t *ours, const x25519_key_t *theirs);
 
+// AEAD: a context holds the cipher and key, and is reused with a new nonce for each packet
+
+#define AEAD_TAG_SIZE 16
+#define GCM_IV_SIZE 16
+#define CHACHA_NONCE_SIZE 12
+
+typedef enum aead_cipher_e { AEAD_AES_128_GCM, AEAD_CHACHA20_POLY1305 } aead_cipher_t;
+
+typedef struct aead_ctx_s aead_ctx_t;
+
+aead_ctx_t *aead_init(aead_cipher_t cipher, const unsigned char *key, aes_direction_t direction);
+int aead_encrypt(aead_ctx_t *ctx, const unsigned char *nonce, const unsigned char *aad, int aad_len,
+                 const unsigned char *plaintext, int plaintext_len, unsigned char *ciphertext, unsigned char *tag);
+int aead_decrypt(aead_ctx_t *ctx, const unsigned char *nonce, const unsigned char *aad, int aad_len,
+                 const unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
+                 const unsigned char *tag);
+void aead_destroy(aead_ctx_t *ctx);
+
 // GCM AES 128
 
 int gcm_encrypt(const unsigned char *plaintext, int plaintext_len, unsigned char *ciphertext,
                 unsigned char *key, unsigned char *iv, unsigned char *tag);
 int gcm_decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
                 unsigned char *key, unsigned char *iv, unsigned char *tag);
+// ChaCha20-Poly1305 (AEAD, 12 byte nonce, 16 byte tag)
+
+#define CHACHA_KEY_SIZE 32
+
+int chacha20_poly1305_decrypt(const unsigned char *ciphertext, int ciphertext_len, unsigned char *plaintext,
+                              const unsigned char *key, const unsigned char *nonce, const unsigned char *aad,
+                              int aad_len, const unsigned char *tag);
 // ED25519
 
 #define ED25519_KEY_SIZE 32
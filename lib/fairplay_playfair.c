@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdbool.h>
 
 #include "fairplay.h"
 #include "playfair/playfair.h"
@@ -31,6 +32,10 @@ struct fairplay_s {
 
     unsigned char keymsg[164];
     unsigned int keymsglen;
+
+    /* derived from keymsg at the first decrypt, and reused by later SETUPs of the connection */
+    playfair_session_t session;
+    bool session_valid;
 };
 
 fairplay_t *
@@ -62,6 +67,7 @@ fairplay_setup(fairplay_t *fp, const unsigned char req[16], unsigned char res[14
     mode = req[14];
     memcpy(res, reply_message[mode], 142);
     fp->keymsglen = 0;
+    fp->session_valid = false;
     return 0;
 }
 
@@ -75,8 +81,11 @@ fairplay_handshake(fairplay_t *fp, const unsigned char req[164], unsigned char r
         return -1;
     }
 
-    memcpy(fp->keymsg, req, 164);
-    fp->keymsglen = 164;
+    if (fp->keymsglen != 164 || memcmp(fp->keymsg, req, 164)) {
+        memcpy(fp->keymsg, req, 164);
+        fp->keymsglen = 164;
+        fp->session_valid = false;
+    }
 
     memcpy(res, fp_header, 12);
     memcpy(res + 12, req + 144, 20);
@@ -90,7 +99,11 @@ fairplay_decrypt(fairplay_t *fp, const unsigned char input[72], unsigned char ou
         return -1;
     }
 
-    playfair_decrypt(fp->keymsg, (unsigned char *) input, output);
+    if (!fp->session_valid) {
+        playfair_session_init(fp->keymsg, &fp->session);
+        fp->session_valid = true;
+    }
+    playfair_session_decrypt(&fp->session, (unsigned char *) input, output);
     return 0;
 }
 
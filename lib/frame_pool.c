@@ -0,0 +1,214 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "frame_pool.h"
+#include "threads.h"
+
+/* size classes are powers of two from 512 bytes (P-frames, SPS+PPS) to 4MB (large IDR frames); *
+ * larger requests are passed through to malloc/free.  Up to FRAME_POOL_MAX_CACHED free blocks  *
+ * of each size class are kept for reuse, the rest are returned to the heap.                    */
+#define FRAME_POOL_MIN_SHIFT 9
+#define FRAME_POOL_MAX_SHIFT 22
+#define FRAME_POOL_CLASSES (FRAME_POOL_MAX_SHIFT - FRAME_POOL_MIN_SHIFT + 1)
+#define FRAME_POOL_MAX_CACHED 4
+#define FRAME_POOL_UNPOOLED (-1)
+
+/* block header (must fit in FRAME_HEADER_SIZE, which keeps the returned data 16-byte aligned) */
+#define FRAME_HEADER_SIZE 32
+typedef struct frame_block_s {
+    struct frame_block_s *next;
+    int size_class;
+    size_t size;
+} frame_block_t;
+
+struct frame_pool_s {
+    logger_t *logger;
+    mutex_handle_t mutex;
+
+    frame_block_t *free_list[FRAME_POOL_CLASSES];
+    int free_count[FRAME_POOL_CLASSES];
+
+    /* statistics */
+    uint64_t allocs;
+    uint64_t hits;
+    size_t bytes_in_use;
+    size_t peak_bytes;
+    size_t bytes_cached;
+};
+
+static int
+frame_pool_size_class(size_t size)
+{
+    int size_class = 0;
+    size_t class_size = ((size_t) 1) << FRAME_POOL_MIN_SHIFT;
+    while (class_size < size) {
+        class_size <<= 1;
+        size_class++;
+    }
+    return (size_class < FRAME_POOL_CLASSES ? size_class : FRAME_POOL_UNPOOLED);
+}
+
+frame_pool_t *
+frame_pool_init(logger_t *logger)
+{
+    frame_pool_t *frame_pool = calloc(1, sizeof(frame_pool_t));
+    if (!frame_pool) {
+        return NULL;
+    }
+    frame_pool->logger = logger;
+    MUTEX_CREATE(frame_pool->mutex);
+    return frame_pool;
+}
+
+void *
+frame_pool_alloc(frame_pool_t *frame_pool, size_t size)
+{
+    frame_block_t *block = NULL;
+    int size_class = frame_pool_size_class(size);
+    size_t block_size = size;
+    assert(frame_pool);
+
+    if (size_class != FRAME_POOL_UNPOOLED) {
+        block_size = ((size_t) 1) << (size_class + FRAME_POOL_MIN_SHIFT);
+    }
+
+    MUTEX_LOCK(frame_pool->mutex);
+    frame_pool->allocs++;
+    if (size_class != FRAME_POOL_UNPOOLED && frame_pool->free_list[size_class]) {
+        block = frame_pool->free_list[size_class];
+        frame_pool->free_list[size_class] = block->next;
+        frame_pool->free_count[size_class]--;
+        frame_pool->bytes_cached -= block_size;
+        frame_pool->hits++;
+    }
+    MUTEX_UNLOCK(frame_pool->mutex);
+
+    if (!block) {
+        block = (frame_block_t *) malloc(FRAME_HEADER_SIZE + block_size);
+        if (!block) {
+            return NULL;
+        }
+        block->size_class = size_class;
+        block->size = block_size;
+    }
+    block->next = NULL;
+
+    MUTEX_LOCK(frame_pool->mutex);
+    frame_pool->bytes_in_use += block_size;
+    if (frame_pool->bytes_in_use > frame_pool->peak_bytes) {
+        frame_pool->peak_bytes = frame_pool->bytes_in_use;
+    }
+    MUTEX_UNLOCK(frame_pool->mutex);
+    return (void *) (((unsigned char *) block) + FRAME_HEADER_SIZE);
+}
+
+void
+frame_pool_free(frame_pool_t *frame_pool, void *ptr)
+{
+    frame_block_t *block;
+    assert(frame_pool);
+    if (!ptr) {
+        return;
+    }
+    block = (frame_block_t *) (((unsigned char *) ptr) - FRAME_HEADER_SIZE);
+
+    MUTEX_LOCK(frame_pool->mutex);
+    frame_pool->bytes_in_use -= block->size;
+    if (block->size_class != FRAME_POOL_UNPOOLED &&
+        frame_pool->free_count[block->size_class] < FRAME_POOL_MAX_CACHED) {
+        block->next = frame_pool->free_list[block->size_class];
+        frame_pool->free_list[block->size_class] = block;
+        frame_pool->free_count[block->size_class]++;
+        frame_pool->bytes_cached += block->size;
+        block = NULL;
+    }
+    MUTEX_UNLOCK(frame_pool->mutex);
+
+    if (block) {
+        free(block);
+    }
+}
+
+void
+frame_pool_log_stats(frame_pool_t *frame_pool)
+{
+    assert(frame_pool);
+    MUTEX_LOCK(frame_pool->mutex);
+    double hit_rate = (frame_pool->allocs ? 100.0 * frame_pool->hits / frame_pool->allocs : 0.0);
+    logger_log(frame_pool->logger, LOGGER_DEBUG, "frame_pool: %llu allocations, hit rate %.1f%%, "
+               "peak %zu bytes in use, %zu bytes in use, %zu bytes cached",
+               (unsigned long long) frame_pool->allocs, hit_rate, frame_pool->peak_bytes,
+               frame_pool->bytes_in_use, frame_pool->bytes_cached);
+    MUTEX_UNLOCK(frame_pool->mutex);
+}
+
+void
+frame_pool_get_footprint(frame_pool_t *frame_pool, size_t *in_use, size_t *cached)
+{
+    assert(frame_pool);
+    MUTEX_LOCK(frame_pool->mutex);
+    *in_use = frame_pool->bytes_in_use;
+    *cached = frame_pool->bytes_cached;
+    MUTEX_UNLOCK(frame_pool->mutex);
+}
+
+size_t
+frame_pool_trim(frame_pool_t *frame_pool)
+{
+    frame_block_t *blocks = NULL;
+    size_t released;
+    assert(frame_pool);
+    MUTEX_LOCK(frame_pool->mutex);
+    for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+        while (frame_pool->free_list[i]) {
+            frame_block_t *block = frame_pool->free_list[i];
+            frame_pool->free_list[i] = block->next;
+            block->next = blocks;
+            blocks = block;
+        }
+        frame_pool->free_count[i] = 0;
+    }
+    released = frame_pool->bytes_cached;
+    frame_pool->bytes_cached = 0;
+    MUTEX_UNLOCK(frame_pool->mutex);
+
+    while (blocks) {
+        frame_block_t *block = blocks;
+        blocks = block->next;
+        free(block);
+    }
+    return released;
+}
+
+void
+frame_pool_destroy(frame_pool_t *frame_pool)
+{
+    if (frame_pool) {
+        frame_pool_log_stats(frame_pool);
+        for (int i = 0; i < FRAME_POOL_CLASSES; i++) {
+            while (frame_pool->free_list[i]) {
+                frame_block_t *block = frame_pool->free_list[i];
+                frame_pool->free_list[i] = block->next;
+                free(block);
+            }
+        }
+        MUTEX_DESTROY(frame_pool->mutex);
+        free(frame_pool);
+    }
+}
@@ -0,0 +1,39 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Pool allocator for mirror-mode video frame buffers, with power-of-two size
+ * classes; freed blocks are kept for reuse by later frames (and sessions).
+ */
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stddef.h>
+#include "logger.h"
+
+typedef struct frame_pool_s frame_pool_t;
+
+frame_pool_t *frame_pool_init(logger_t *logger);
+void *frame_pool_alloc(frame_pool_t *frame_pool, size_t size);
+void frame_pool_free(frame_pool_t *frame_pool, void *ptr);
+void frame_pool_log_stats(frame_pool_t *frame_pool);
+/* bytes in frames currently allocated, and in free blocks kept for reuse */
+void frame_pool_get_footprint(frame_pool_t *frame_pool, size_t *in_use, size_t *cached);
+/* returns the cached free blocks to the heap; returns the number of bytes released */
+size_t frame_pool_trim(frame_pool_t *frame_pool);
+void frame_pool_destroy(frame_pool_t *frame_pool);
+
+#endif //FRAME_POOL_H
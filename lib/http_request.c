@@ -19,39 +19,118 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "http_request.h"
 #include "llhttp/llhttp.h"
 
+/* the url, headers and body of a request are stored as slices of a single arena *
+ * buffer that grows geometrically; slices are offsets (the arena may move) to    *
+ * NUL-terminated strings, and a slice is extended in place when llhttp delivers  *
+ * it in several chunks (it is always the last one in the arena when this occurs). *
+ * At most HTTP_BODY_MAX_RESERVE bytes of a body are reserved from its announced  *
+ * Content-Length: the rest is allocated as it arrives.  Larger requests than     *
+ * HTTP_REQUEST_MAX_SIZE (which keeps the int slices valid) are rejected.        */
+#define HTTP_ARENA_INITIAL_SIZE 1024
+#define HTTP_HEADERS_INITIAL_SIZE 16
+#define HTTP_BODY_MAX_RESERVE (256 * 1024)
+#define HTTP_REQUEST_MAX_SIZE (32 * 1024 * 1024)
+
+typedef struct http_slice_s {
+    int offset;
+    int len;
+} http_slice_t;
+
 struct http_request_s {
     llhttp_t parser;
     llhttp_settings_t parser_settings;
 
+    char *arena;
+    size_t arena_size;
+    size_t arena_len;
+
     const char *method;
-    char *url;
+    http_slice_t url;
     char protocol[9];
 
-    char **headers;
+    http_slice_t *headers;
+    int headers_alloc;
     int headers_size;
     int headers_index;
 
-    char *data;
-    int datalen;
+    http_slice_t data;
 
     int complete;
 };
 
+/* returns -1 (with a parser error) if the request would exceed HTTP_REQUEST_MAX_SIZE, or on allocation failure */
+static int
+http_request_reserve(http_request_t *request, size_t length)
+{
+    if (length > HTTP_REQUEST_MAX_SIZE - request->arena_len) {
+        llhttp_set_error_reason(&request->parser, "request too large");
+        return -1;
+    }
+    size_t needed = request->arena_len + length;
+    if (needed <= request->arena_size) {
+        return 0;
+    }
+    size_t size = (request->arena_size ? request->arena_size : HTTP_ARENA_INITIAL_SIZE);
+    while (size < needed) {
+        size *= 2;
+    }
+    if (size > HTTP_REQUEST_MAX_SIZE) {
+        size = HTTP_REQUEST_MAX_SIZE;
+    }
+    char *arena = realloc(request->arena, size);
+    if (!arena) {
+        llhttp_set_error_reason(&request->parser, "out of memory");
+        return -1;
+    }
+    request->arena = arena;
+    request->arena_size = size;
+    return 0;
+}
+
+/* start a new slice (if slice->len < 0), or extend it, with a NUL-terminated copy of at[0 : length]; *
+ * returns HPE_USER (stopping the parser) if there is no room                                          */
+static int
+http_request_append(http_request_t *request, http_slice_t *slice, const char *at, size_t length)
+{
+    if (slice->len < 0) {
+        if (http_request_reserve(request, length + 1) < 0) {
+            return HPE_USER;
+        }
+        slice->offset = (int) request->arena_len;
+        slice->len = 0;
+    } else {
+        assert((size_t) slice->offset + slice->len + 1 == request->arena_len);
+        if (http_request_reserve(request, length) < 0) {    /* the terminating NUL is overwritten */
+            return HPE_USER;
+        }
+        request->arena_len--;
+    }
+    memcpy(request->arena + request->arena_len, at, length);
+    request->arena_len += length;
+    request->arena[request->arena_len++] = '\0';
+    slice->len += (int) length;
+    return 0;
+}
+
+static const char *
+http_request_get_slice(http_request_t *request, const http_slice_t *slice)
+{
+    return (slice->len < 0 ? NULL : request->arena + slice->offset);
+}
+
 static int
 on_url(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
-    int urllen = request->url ? strlen(request->url) : 0;
-
-    request->url = realloc(request->url, urllen+length+1);
-    assert(request->url);
 
-    request->url[urllen] = '\0';
-    strncat(request->url, at, length);
+    if (http_request_append(request, &request->url, at, length)) {
+        return HPE_USER;
+    }
 
     strncpy(request->protocol, at + length + 1, 8);
 
@@ -70,27 +149,22 @@ on_header_field(llhttp_t *parser, const char *at, size_t length)
 
     /* Allocate space for new field-value pair */
     if (request->headers_index == request->headers_size) {
+        if (request->headers_size == request->headers_alloc) {
+            int headers_alloc = (request->headers_alloc ? 2 * request->headers_alloc : HTTP_HEADERS_INITIAL_SIZE);
+            http_slice_t *headers = realloc(request->headers, headers_alloc * sizeof(http_slice_t));
+            if (!headers) {
+                llhttp_set_error_reason(parser, "out of memory");
+                return HPE_USER;
+            }
+            request->headers = headers;
+            request->headers_alloc = headers_alloc;
+        }
         request->headers_size += 2;
-        request->headers = realloc(request->headers,
-                                   request->headers_size*sizeof(char*));
-        assert(request->headers);
-        request->headers[request->headers_index] = NULL;
-        request->headers[request->headers_index+1] = NULL;
+        request->headers[request->headers_index].len = -1;
+        request->headers[request->headers_index + 1].len = -1;
     }
 
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
-    }
-    assert(request->headers[request->headers_index]);
-
-    strncat(request->headers[request->headers_index], at, length);
-    return 0;
+    return http_request_append(request, &request->headers[request->headers_index], at, length);
 }
 
 static int
@@ -103,18 +177,24 @@ on_header_value(llhttp_t *parser, const char *at, size_t length)
         request->headers_index++;
     }
 
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
-    }
-    assert(request->headers[request->headers_index]);
+    return http_request_append(request, &request->headers[request->headers_index], at, length);
+}
+
+static int
+on_headers_complete(llhttp_t *parser)
+{
+    http_request_t *request = parser->data;
 
-    strncat(request->headers[request->headers_index], at, length);
+    /* reserve space for (the start of) the body in advance, so small bodies are not reallocated as they arrive */
+    if (parser->content_length >= HTTP_REQUEST_MAX_SIZE) {
+        return -1;    /* too large: the parser fails with HPE_CB_HEADERS_COMPLETE */
+    }
+    if (parser->content_length > 0) {
+        size_t reserve = (size_t) parser->content_length + 1;
+        if (http_request_reserve(request, (reserve < HTTP_BODY_MAX_RESERVE ? reserve : HTTP_BODY_MAX_RESERVE)) < 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -123,12 +203,7 @@ on_body(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    request->data = realloc(request->data, request->datalen+length);
-    assert(request->data);
-
-    memcpy(request->data+request->datalen, at, length);
-    request->datalen += length;
-    return 0;
+    return http_request_append(request, &request->data, at, length);
 }
 
 static int
@@ -150,11 +225,14 @@ http_request_init(void)
     if (!request) {
         return NULL;
     }
+    request->url.len = -1;
+    request->data.len = -1;
 
     llhttp_settings_init(&request->parser_settings);
     request->parser_settings.on_url = &on_url;
     request->parser_settings.on_header_field = &on_header_field;
     request->parser_settings.on_header_value = &on_header_value;
+    request->parser_settings.on_headers_complete = &on_headers_complete;
     request->parser_settings.on_body = &on_body;
     request->parser_settings.on_message_complete = &on_message_complete;
 
@@ -167,19 +245,20 @@ http_request_init(void)
 void
 http_request_destroy(http_request_t *request)
 {
-    int i;
-
     if (request) {
-        free(request->url);
-        for (i=0; i<request->headers_size; i++) {
-            free(request->headers[i]);
-        }
         free(request->headers);
-        free(request->data);
+        free(request->arena);
         free(request);
     }
 }
 
+size_t
+http_request_get_footprint(http_request_t *request)
+{
+    assert(request);
+    return sizeof(http_request_t) + request->arena_size + request->headers_alloc * sizeof(http_slice_t);
+}
+
 int
 http_request_add_data(http_request_t *request, const char *data, int datalen)
 {
@@ -234,7 +313,7 @@ const char *
 http_request_get_url(http_request_t *request)
 {
     assert(request);
-    return request->url;
+    return http_request_get_slice(request, &request->url);
 }
 
 const char *
@@ -252,8 +331,9 @@ http_request_get_header(http_request_t *request, const char *name)
     assert(request);
 
     for (i=0; i<request->headers_size; i+=2) {
-        if (!strcmp(request->headers[i], name)) {
-            return request->headers[i+1];
+        const char *field = http_request_get_slice(request, &request->headers[i]);
+        if (field && !strcmp(field, name)) {
+            return http_request_get_slice(request, &request->headers[i+1]);
         }
     }
     return NULL;
@@ -265,9 +345,9 @@ http_request_get_data(http_request_t *request, int *datalen)
     assert(request);
 
     if (datalen) {
-        *datalen = request->datalen;
+        *datalen = (request->data.len < 0 ? 0 : request->data.len);
     }
-    return request->data;
+    return http_request_get_slice(request, &request->data);
 }
 
 int 
@@ -279,7 +359,7 @@ http_request_get_header_string(http_request_t *request, char **header_str)
     }
     int len = 0;
     for (int i = 0; i < request->headers_size; i++) {
-        len += strlen(request->headers[i]);
+        len += (request->headers[i].len < 0 ? 0 : request->headers[i].len);
         if (i%2 == 0) {
             len += 2;
         } else {
@@ -292,8 +372,9 @@ http_request_get_header_string(http_request_t *request, char **header_str)
     char *p = str;
     int n = len + 1;
     for (int i = 0; i < request->headers_size; i++) {
-        int hlen = strlen(request->headers[i]); 
-        snprintf(p, n, "%s", request->headers[i]);
+        const char *header = http_request_get_slice(request, &request->headers[i]);
+        int hlen = (header ? request->headers[i].len : 0);
+        snprintf(p, n, "%s", (header ? header : ""));
         n -= hlen;
         p += hlen;
         if (i%2 == 0) {
@@ -15,6 +15,8 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
+#include <stddef.h>
+
 typedef struct http_request_s http_request_t;
 
 
@@ -32,6 +34,8 @@ const char *http_request_get_protocol(http_request_t *request);
 const char *http_request_get_header(http_request_t *request, const char *name);
 const char *http_request_get_data(http_request_t *request, int *datalen);
 int http_request_get_header_string(http_request_t *request, char **header_str);
+/* bytes allocated for the request (parser state, header and body storage) */
+size_t http_request_get_footprint(http_request_t *request);
 
 void http_request_destroy(http_request_t *request);
 
@@ -20,8 +20,15 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 
 #include "httpd.h"
+#include "thread_config.h"
+#include "httpd_poll.h"
+#include "socket_tuning.h"
 #include "netutils.h"
 #include "http_request.h"
 #include "compat.h"
@@ -34,9 +41,25 @@ struct http_connection_s {
     void *user_data;
     connection_type_t type;
     http_request_t *request;
+
+    /* worker pool: a request of this connection is being handled, so its socket is not polled */
+    bool busy;
+    bool remove_pending;   /* removal was requested while busy */
+    bool disconnect;       /* the handler asked for the connection to be closed */
 };
 typedef struct http_connection_s http_connection_t;
 
+#define HTTPD_MAX_WORKERS 8
+#define HTTPD_HANDLER_STATS 32
+
+/* handler latency, by method and url path */
+typedef struct httpd_handler_stats_s {
+    char name[48];
+    uint64_t count;
+    uint64_t total_nsecs;
+    uint64_t max_nsecs;
+} httpd_handler_stats_t;
+
 struct httpd_s {
     logger_t *logger;
     httpd_callbacks_t callbacks;
@@ -49,16 +72,47 @@ struct httpd_s {
     /* These variables only edited mutex locked */
     int running;
     int joined;
+    int drop_connections;     /* httpd_drop_connections was called */
     thread_handle_t thread;
     mutex_handle_t run_mutex;
 
     /* Server fds for accepting connections */
     int server_fd4;
     int server_fd6;
+
+    /* event backend (epoll, kqueue or select) used by httpd_thread */
+    httpd_poll_t *poll;
+    bool accepting;
+
+    /* protects the connection table (connected, user_data, type), which handlers read */
+    mutex_handle_t conn_mutex;
+
+    /* worker pool (0 workers: requests are handled in httpd_thread).  Complete requests are *
+     * queued with their connection taken out of the poll set, so requests on a connection  *
+     * are handled in order; finished connections are queued back, and wake httpd_thread    */
+    int num_workers;
+    bool workers_running;
+    thread_handle_t workers[HTTPD_MAX_WORKERS];
+    mutex_handle_t work_mutex;
+    cond_handle_t work_cond;
+    http_connection_t **work_queue;
+    int work_head;
+    int work_count;
+    http_connection_t **done_queue;
+    int done_count;
+    int wake_fds[2];
+    /* serializes the first requests of new connections, which claim a session (see raop.c) */
+    mutex_handle_t new_conn_mutex;
+
+    mutex_handle_t stats_mutex;
+    httpd_handler_stats_t handler_stats[HTTPD_HANDLER_STATS];
+    size_t request_peak_bytes;    /* largest footprint of a handled request */
 };
 
 int
 httpd_set_connection_type (httpd_t *httpd, void *user_data, connection_type_t type) {
+    int ret = -1;
+    MUTEX_LOCK(httpd->conn_mutex);
     for (int i = 0; i < httpd->max_connections; i++) {
         http_connection_t *connection = &httpd->connections[i];
 	if (!connection->connected) {
@@ -66,15 +120,27 @@ httpd_set_connection_type (httpd_t *httpd, void *user_data, connection_type_t ty
         }
         if (connection->user_data == user_data) {
             connection->type = type;
-            return i;
+            ret = i;
+            break;
         }
     }
-    return -1;
+    MUTEX_UNLOCK(httpd->conn_mutex);
+    return ret;
 }
   
+size_t
+httpd_get_footprint(httpd_t *httpd, size_t *request_peak) {
+    size_t bytes = sizeof(httpd_t) + httpd->max_connections * (sizeof(http_connection_t) + 2 * sizeof(http_connection_t *));
+    MUTEX_LOCK(httpd->stats_mutex);
+    *request_peak = httpd->request_peak_bytes;
+    MUTEX_UNLOCK(httpd->stats_mutex);
+    return bytes;
+}
+
 int
 httpd_count_connection_type (httpd_t *httpd, connection_type_t type) {
     int count = 0;
+    MUTEX_LOCK(httpd->conn_mutex);
     for (int i = 0; i < httpd->max_connections; i++) {
         http_connection_t *connection = &httpd->connections[i];
         if (!connection->connected) {
@@ -84,10 +150,13 @@ httpd_count_connection_type (httpd_t *httpd, connection_type_t type) {
             count++;
         }
     }
+    MUTEX_UNLOCK(httpd->conn_mutex);
     return count;
 }
 
 #define MAX_CONNECTIONS 12  /* value used in AppleTV 3*/
+#define MAX_CONNECTIONS_LIMIT 256
+#define HTTPD_POLL_MAX_TAGS 16
 httpd_t *
 httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int nohold)
 {
@@ -120,9 +189,68 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int nohold)
     httpd->running = 0;
     httpd->joined = 1;
 
+    MUTEX_CREATE(httpd->conn_mutex);
+    MUTEX_CREATE(httpd->work_mutex);
+    COND_CREATE(httpd->work_cond);
+    MUTEX_CREATE(httpd->new_conn_mutex);
+    MUTEX_CREATE(httpd->stats_mutex);
+    httpd->wake_fds[0] = httpd->wake_fds[1] = -1;
+
     return httpd;
 }
 
+int
+httpd_set_workers(httpd_t *httpd, int num_workers)
+{
+    assert(httpd);
+    if (num_workers < 0 || num_workers > HTTPD_MAX_WORKERS) {
+        return -1;
+    }
+#ifdef _WIN32
+    /* httpd_thread can only be woken by sockets here */
+    if (num_workers) {
+        logger_log(httpd->logger, LOGGER_WARNING, "the httpd worker pool is not available on Windows");
+        return -1;
+    }
+#endif
+    /* can only be changed while the http daemon is stopped */
+    MUTEX_LOCK(httpd->run_mutex);
+    if (httpd->running || !httpd->joined) {
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -1;
+    }
+    httpd->num_workers = num_workers;
+    MUTEX_UNLOCK(httpd->run_mutex);
+    return 0;
+}
+
+int
+httpd_set_max_connections(httpd_t *httpd, int max_connections)
+{
+    http_connection_t *connections;
+    assert(httpd);
+
+    if (max_connections < 2 || max_connections > MAX_CONNECTIONS_LIMIT) {
+        return -1;
+    }
+    /* can only be changed while the http daemon is stopped */
+    MUTEX_LOCK(httpd->run_mutex);
+    if (httpd->running || !httpd->joined) {
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -1;
+    }
+    connections = calloc(max_connections, sizeof(http_connection_t));
+    if (!connections) {
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -1;
+    }
+    free(httpd->connections);
+    httpd->connections = connections;
+    httpd->max_connections = max_connections;
+    MUTEX_UNLOCK(httpd->run_mutex);
+    return 0;
+}
+
 void
 httpd_destroy(httpd_t *httpd)
 {
@@ -130,6 +258,11 @@ httpd_destroy(httpd_t *httpd)
         httpd_stop(httpd);
 
         free(httpd->connections);
+        MUTEX_DESTROY(httpd->conn_mutex);
+        MUTEX_DESTROY(httpd->work_mutex);
+        COND_DESTROY(httpd->work_cond);
+        MUTEX_DESTROY(httpd->new_conn_mutex);
+        MUTEX_DESTROY(httpd->stats_mutex);
         free(httpd);
     }
 }
@@ -137,16 +270,25 @@ httpd_destroy(httpd_t *httpd)
 static void
 httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
 {
+    if (connection->busy) {
+        /* a worker is using the connection: it will be removed when the worker is done */
+        connection->remove_pending = true;
+        return;
+    }
     if (connection->request) {
         http_request_destroy(connection->request);
         connection->request = NULL;
     }
     httpd->callbacks.conn_destroy(connection->user_data);
+    httpd_poll_remove(httpd->poll, connection->socket_fd);
     shutdown(connection->socket_fd, SHUT_WR);
     closesocket(connection->socket_fd);
+    MUTEX_LOCK(httpd->conn_mutex);
     connection->connected = 0;
     connection->user_data = NULL;
     connection->type = CONNECTION_TYPE_UNKNOWN;
+    MUTEX_UNLOCK(httpd->conn_mutex);
+    connection->remove_pending = false;
     httpd->open_connections--;
 }
 
@@ -163,7 +305,7 @@ httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len
         }
     }
     if (i == httpd->max_connections) {
-        /* This code should never be reached, we do not select server_fds when full */
+        /* This code should never be reached, we do not poll server_fds when full */
         logger_log(httpd->logger, LOGGER_INFO, "Max connections reached");
         return -1;
     }
@@ -173,11 +315,19 @@ httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len
         return -1;
     }
 
+    if (httpd_poll_add(httpd->poll, fd, &httpd->connections[i]) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error adding socket %d to httpd %s event backend", fd,
+                   httpd_poll_get_backend());
+        httpd->callbacks.conn_destroy(user_data);
+        return -1;
+    }
     httpd->open_connections++;
+    MUTEX_LOCK(httpd->conn_mutex);
     httpd->connections[i].socket_fd = fd;
     httpd->connections[i].connected = 1;
     httpd->connections[i].user_data = user_data;
     httpd->connections[i].type = CONNECTION_TYPE_UNKNOWN;   //should not be necessary ...
+    MUTEX_UNLOCK(httpd->conn_mutex);
     return 0;
 }
 
@@ -210,6 +360,7 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
 
     logger_log(httpd->logger, LOGGER_INFO, "Accepted %s client on socket %d",
                (is_ipv6 ? "IPv6"  : "IPv4"), fd);
+    socket_tuning_apply(httpd->logger, fd, SOCKET_PROFILE_RTSP, 0);
     local = netutils_get_address(&local_saddr, &local_len, &local_zone_id);
     remote = netutils_get_address(&remote_saddr, &remote_len, &remote_zone_id);
     assert (local_zone_id == remote_zone_id);
@@ -238,182 +389,416 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
     return 1;
 }
 
+static void
+httpd_set_accepting(httpd_t *httpd, bool accepting)
+{
+    if (httpd->accepting == accepting) {
+        return;
+    }
+    /* server fds are only polled while there is room for new connections */
+    httpd->accepting = accepting;
+    if (httpd->server_fd4 != -1) {
+        if (accepting) {
+            httpd_poll_add(httpd->poll, httpd->server_fd4, &httpd->server_fd4);
+        } else {
+            httpd_poll_remove(httpd->poll, httpd->server_fd4);
+        }
+    }
+    if (httpd->server_fd6 != -1) {
+        if (accepting) {
+            httpd_poll_add(httpd->poll, httpd->server_fd6, &httpd->server_fd6);
+        } else {
+            httpd_poll_remove(httpd->poll, httpd->server_fd6);
+        }
+    }
+}
+
+static uint64_t
+httpd_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * 1000000000ULL + (uint64_t) time.tv_nsec;
+}
+
+static void
+httpd_record_handler_latency(httpd_t *httpd, const char *method, const char *url, uint64_t nsecs)
+{
+    char name[sizeof(((httpd_handler_stats_t *) NULL)->name)];
+    size_t path_len = (url ? strcspn(url, "?") : 0);
+    snprintf(name, sizeof(name), "%s %.*s", (method ? method : "?"), (int) path_len, (url ? url : ""));
+    MUTEX_LOCK(httpd->stats_mutex);
+    for (int i = 0; i < HTTPD_HANDLER_STATS; i++) {
+        httpd_handler_stats_t *stats = &httpd->handler_stats[i];
+        if (stats->count && strcmp(stats->name, name)) {
+            continue;
+        }
+        if (!stats->count) {
+            memcpy(stats->name, name, sizeof(name));
+        }
+        stats->count++;
+        stats->total_nsecs += nsecs;
+        stats->max_nsecs = (nsecs > stats->max_nsecs ? nsecs : stats->max_nsecs);
+        break;
+    }
+    MUTEX_UNLOCK(httpd->stats_mutex);
+}
+
+static void
+httpd_log_handler_stats(httpd_t *httpd)
+{
+    MUTEX_LOCK(httpd->stats_mutex);
+    for (int i = 0; i < HTTPD_HANDLER_STATS && httpd->handler_stats[i].count; i++) {
+        httpd_handler_stats_t *stats = &httpd->handler_stats[i];
+        logger_log(httpd->logger, LOGGER_INFO, "httpd handler %s: %llu requests, mean %.3f ms, max %.3f ms",
+                   stats->name, (unsigned long long) stats->count,
+                   (double) stats->total_nsecs / (1000000.0 * stats->count), (double) stats->max_nsecs / 1000000.0);
+    }
+    memset(httpd->handler_stats, 0, sizeof(httpd->handler_stats));
+    MUTEX_UNLOCK(httpd->stats_mutex);
+}
+
+/* runs the handler for the complete request of a connection and sends the response; *
+ * returns true if the handler asked for the connection to be closed                 */
+static bool
+httpd_handle_request(httpd_t *httpd, http_connection_t *connection)
+{
+    http_response_t *response = NULL;
+    bool disconnect = false;
+    uint64_t start = httpd_get_nsecs();
+
+    // Callback the received data to raop
+    httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
+    httpd_record_handler_latency(httpd, http_request_get_method(connection->request),
+                                 http_request_get_url(connection->request), httpd_get_nsecs() - start);
+    size_t request_bytes = http_request_get_footprint(connection->request);
+    MUTEX_LOCK(httpd->stats_mutex);
+    if (request_bytes > httpd->request_peak_bytes) {
+        httpd->request_peak_bytes = request_bytes;
+    }
+    MUTEX_UNLOCK(httpd->stats_mutex);
+    http_request_destroy(connection->request);
+    connection->request = NULL;
+
+    if (response) {
+        const char *data;
+        int datalen;
+        int written;
+        int ret;
+
+        /* Get response data and datalen */
+        data = http_response_get_data(response, &datalen);
+
+        written = 0;
+        while (written < datalen) {
+            ret = send(connection->socket_fd, data+written, datalen-written, 0);
+            if (ret == -1) {
+                logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
+                break;
+            }
+            written += ret;
+        }
+        disconnect = http_response_get_disconnect(response);
+    } else {
+        logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
+    }
+    http_response_destroy(response);
+    return disconnect;
+}
+
+static void
+httpd_read_connection(httpd_t *httpd, http_connection_t *connection, bool logger_debug)
+{
+    char buffer[1024];
+    int i = (int) (connection - httpd->connections);
+    int ret;
+
+    /* If not in the middle of request, allocate one */
+    if (!connection->request) {
+        connection->request = http_request_init();
+        assert(connection->request);
+    }
+
+    logger_log(httpd->logger, LOGGER_DEBUG, "httpd receiving on socket %d, connection %d", connection->socket_fd, i);
+    ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
+    if (ret == 0) {
+        logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
+        httpd_remove_connection(httpd, connection);
+        return;
+    }
+
+    /* Parse HTTP request from data read from connection */
+    http_request_add_data(connection->request, buffer, ret);
+    if (http_request_has_error(connection->request)) {
+        logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s (%s)", http_request_get_error_name(connection->request),
+                   http_request_get_error_description(connection->request));
+        httpd_remove_connection(httpd, connection);
+        return;
+    }
+
+    /* If request is finished, process and deallocate */
+    if (http_request_is_complete(connection->request)) {
+        if (logger_debug) {
+            const char *method = http_request_get_method(connection->request);
+            const char *url = http_request_get_url(connection->request);
+            const char *protocol = http_request_get_protocol(connection->request);
+            logger_log(httpd->logger, LOGGER_INFO, "httpd request received on socket %d, connection %d, "
+                       "method = %s, url = %s, protocol = %s", connection->socket_fd, i, method, url, protocol);
+        }
+        if (httpd->num_workers) {
+            /* stop polling the connection until a worker has handled the request */
+            httpd_poll_remove(httpd->poll, connection->socket_fd);
+            connection->busy = true;
+            MUTEX_LOCK(httpd->work_mutex);
+            httpd->work_queue[(httpd->work_head + httpd->work_count) % httpd->max_connections] = connection;
+            httpd->work_count++;
+            COND_SIGNAL(httpd->work_cond);
+            MUTEX_UNLOCK(httpd->work_mutex);
+        } else if (httpd_handle_request(httpd, connection)) {
+            logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+            httpd_remove_connection(httpd, connection);
+        }
+    } else {
+        logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
+    }
+}
+
+/* connections handed back by the workers are polled again, or removed */
+static void
+httpd_collect_done_connections(httpd_t *httpd)
+{
+    char buf[64];
+    while (read(httpd->wake_fds[0], buf, sizeof(buf)) == sizeof(buf)) {
+        ;
+    }
+    MUTEX_LOCK(httpd->work_mutex);
+    int done_count = httpd->done_count;
+    http_connection_t *done[MAX_CONNECTIONS_LIMIT];
+    memcpy(done, httpd->done_queue, done_count * sizeof(http_connection_t *));
+    httpd->done_count = 0;
+    MUTEX_UNLOCK(httpd->work_mutex);
+
+    for (int i = 0; i < done_count; i++) {
+        http_connection_t *connection = done[i];
+        connection->busy = false;
+        if (connection->disconnect) {
+            logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+        }
+        if (connection->remove_pending || connection->disconnect) {
+            connection->disconnect = false;
+            httpd_remove_connection(httpd, connection);
+        } else if (httpd_poll_add(httpd->poll, connection->socket_fd, connection) == -1) {
+            logger_log(httpd->logger, LOGGER_ERR, "Error adding socket %d to httpd %s event backend",
+                       connection->socket_fd, httpd_poll_get_backend());
+            httpd_remove_connection(httpd, connection);
+        }
+    }
+}
+
+static THREAD_RETVAL
+httpd_worker_thread(void *arg)
+{
+    httpd_t *httpd = arg;
+    thread_config_apply(THREAD_CLASS_HTTPD, "uxplay-httpd-w", httpd->logger);
+
+    MUTEX_LOCK(httpd->work_mutex);
+    while (1) {
+        while (httpd->workers_running && !httpd->work_count) {
+            pthread_cond_wait(&httpd->work_cond, &httpd->work_mutex);
+        }
+        if (!httpd->work_count) {
+            break;
+        }
+        http_connection_t *connection = httpd->work_queue[httpd->work_head];
+        httpd->work_head = (httpd->work_head + 1) % httpd->max_connections;
+        httpd->work_count--;
+        MUTEX_UNLOCK(httpd->work_mutex);
+
+        /* requests of not-yet-identified connections may claim a session: one at a time */
+        bool new_connection = (connection->type == CONNECTION_TYPE_UNKNOWN);
+        if (new_connection) {
+            MUTEX_LOCK(httpd->new_conn_mutex);
+        }
+        bool disconnect = httpd_handle_request(httpd, connection);
+        if (new_connection) {
+            MUTEX_UNLOCK(httpd->new_conn_mutex);
+        }
+
+        MUTEX_LOCK(httpd->work_mutex);
+        connection->disconnect = disconnect;
+        httpd->done_queue[httpd->done_count++] = connection;
+        if (write(httpd->wake_fds[1], "", 1) < 0) {
+            /* the pipe is full, so httpd_thread is already being woken */
+        }
+    }
+    MUTEX_UNLOCK(httpd->work_mutex);
+    return 0;
+}
+
+static int
+httpd_start_workers(httpd_t *httpd)
+{
+    if (!httpd->num_workers) {
+        return 0;
+    }
+#ifdef _WIN32
+    return -1;
+#else
+    httpd->work_queue = calloc(httpd->max_connections, sizeof(http_connection_t *));
+    httpd->done_queue = calloc(httpd->max_connections, sizeof(http_connection_t *));
+    if (!httpd->work_queue || !httpd->done_queue || pipe(httpd->wake_fds) == -1) {
+        free(httpd->work_queue);
+        free(httpd->done_queue);
+        httpd->work_queue = httpd->done_queue = NULL;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(httpd->wake_fds[i], F_SETFL, fcntl(httpd->wake_fds[i], F_GETFL) | O_NONBLOCK);
+    }
+    httpd_poll_add(httpd->poll, httpd->wake_fds[0], &httpd->wake_fds);
+    httpd->work_head = httpd->work_count = httpd->done_count = 0;
+    httpd->workers_running = true;
+    for (int i = 0; i < httpd->num_workers; i++) {
+        THREAD_CREATE(httpd->workers[i], httpd_worker_thread, httpd);
+    }
+    return 0;
+#endif
+}
+
+/* waits for the requests being handled; queued requests are dropped */
+static void
+httpd_stop_workers(httpd_t *httpd)
+{
+    if (!httpd->work_queue) {
+        return;
+    }
+    MUTEX_LOCK(httpd->work_mutex);
+    for (int i = 0; i < httpd->work_count; i++) {
+        http_connection_t *connection = httpd->work_queue[(httpd->work_head + i) % httpd->max_connections];
+        connection->disconnect = true;
+        httpd->done_queue[httpd->done_count++] = connection;
+    }
+    httpd->work_count = 0;
+    httpd->workers_running = false;
+    pthread_cond_broadcast(&httpd->work_cond);
+    MUTEX_UNLOCK(httpd->work_mutex);
+    for (int i = 0; i < httpd->num_workers; i++) {
+        THREAD_JOIN(httpd->workers[i]);
+    }
+    httpd_collect_done_connections(httpd);
+    httpd_poll_remove(httpd->poll, httpd->wake_fds[0]);
+    close(httpd->wake_fds[0]);
+    close(httpd->wake_fds[1]);
+    httpd->wake_fds[0] = httpd->wake_fds[1] = -1;
+    free(httpd->work_queue);
+    free(httpd->done_queue);
+    httpd->work_queue = httpd->done_queue = NULL;
+}
+
+static void
+httpd_remove_all_connections(httpd_t *httpd)
+{
+    for (int i = 0; i < httpd->max_connections; i++) {
+        http_connection_t *connection = &httpd->connections[i];
+
+        if (!connection->connected) {
+            continue;
+        }
+        logger_log(httpd->logger, LOGGER_INFO, "Removing connection for socket %d", connection->socket_fd);
+        httpd_remove_connection(httpd, connection);
+    }
+}
+
 static THREAD_RETVAL
 httpd_thread(void *arg)
 {
     httpd_t *httpd = arg;
-    char buffer[1024];
+    void *tags[HTTPD_POLL_MAX_TAGS];
     int i;
     bool logger_debug = (logger_get_level(httpd->logger) >= LOGGER_DEBUG);
     
     assert(httpd);
+    thread_config_apply(THREAD_CLASS_HTTPD, "uxplay-httpd", httpd->logger);
+    logger_log(httpd->logger, LOGGER_DEBUG, "httpd using %s event backend, max connections %d, %d worker threads",
+               httpd_poll_get_backend(), httpd->max_connections, httpd->num_workers);
+    if (httpd_start_workers(httpd) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "httpd could not start its worker threads, handling requests itself");
+        httpd->num_workers = 0;
+    }
 
     while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds=0;
         int ret;
+        bool accept4 = false, accept6 = false;
 
+        bool drop;
         MUTEX_LOCK(httpd->run_mutex);
         if (!httpd->running) {
             MUTEX_UNLOCK(httpd->run_mutex);
             break;
         }
+        drop = httpd->drop_connections;
         MUTEX_UNLOCK(httpd->run_mutex);
-
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 1;
-        tv.tv_usec = 5000;
-
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (httpd->open_connections < httpd->max_connections) {
-            if (httpd->server_fd4 != -1) {
-                FD_SET(httpd->server_fd4, &rfds);
-                if (nfds <= httpd->server_fd4) {
-                    nfds = httpd->server_fd4+1;
-                }
-            }
-            if (httpd->server_fd6 != -1) {
-                FD_SET(httpd->server_fd6, &rfds);
-                if (nfds <= httpd->server_fd6) {
-                    nfds = httpd->server_fd6+1;
-                }
-            }
-        }
-        for (i=0; i<httpd->max_connections; i++) {
-            int socket_fd;
-            if (!httpd->connections[i].connected) {
-                continue;
-            }
-            socket_fd = httpd->connections[i].socket_fd;
-            FD_SET(socket_fd, &rfds);
-            if (nfds <= socket_fd) {
-                nfds = socket_fd+1;
-            }
+        if (drop) {
+            httpd_remove_all_connections(httpd);
+            MUTEX_LOCK(httpd->run_mutex);
+            httpd->drop_connections = 0;
+            MUTEX_UNLOCK(httpd->run_mutex);
         }
 
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
+        httpd_set_accepting(httpd, httpd->open_connections < httpd->max_connections);
+
+        /* Timeout (for checking httpd->running) is 1.005 secs */
+        ret = httpd_poll_wait(httpd->poll, tags, HTTPD_POLL_MAX_TAGS, 1005);
         if (ret == 0) {
             /* Timeout happened */
             continue;
         } else if (ret == -1) {
-            logger_log(httpd->logger, LOGGER_ERR, "httpd error in select");
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error in %s", httpd_poll_get_backend());
             break;
         }
 
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd4 != -1 && FD_ISSET(httpd->server_fd4, &rfds)) {
+        /* handle requests on existing connections before accepting new ones, which may reuse their slots */
+        for (i = 0; i < ret; i++) {
+            if (tags[i] == &httpd->server_fd4) {
+                accept4 = true;
+            } else if (tags[i] == &httpd->server_fd6) {
+                accept6 = true;
+            } else if (tags[i] == &httpd->wake_fds) {
+                httpd_collect_done_connections(httpd);
+            } else {
+                http_connection_t *connection = (http_connection_t *) tags[i];
+                if (connection->connected) {
+                    httpd_read_connection(httpd, connection, logger_debug);
+                }
+            }
+        }
+
+        if (accept4 && httpd->open_connections < httpd->max_connections) {
             ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
             if (ret == -1) {
                 logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv4");
                 break;
-            } else if (ret == 0) {
-                continue;
             }
         }
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd6 != -1 && FD_ISSET(httpd->server_fd6, &rfds)) {
+        if (accept6 && httpd->open_connections < httpd->max_connections) {
             ret = httpd_accept_connection(httpd, httpd->server_fd6, 1);
             if (ret == -1) {
                 logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv6");
                 break;
-            } else if (ret == 0) {
-                continue;
-            }
-        }
-        for (i=0; i<httpd->max_connections; i++) {
-            http_connection_t *connection = &httpd->connections[i];
-
-            if (!connection->connected) {
-                continue;
-            }
-            if (!FD_ISSET(connection->socket_fd, &rfds)) {
-                continue;
-            }
-
-            /* If not in the middle of request, allocate one */
-            if (!connection->request) {
-                connection->request = http_request_init();
-                assert(connection->request);
-            }
-
-            logger_log(httpd->logger, LOGGER_DEBUG, "httpd receiving on socket %d, connection %d", connection->socket_fd, i);
-            ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
-            if (ret == 0) {
-                logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
-                httpd_remove_connection(httpd, connection);
-                continue;
-            }
-
-            /* Parse HTTP request from data read from connection */
-            http_request_add_data(connection->request, buffer, ret);
-            if (http_request_has_error(connection->request)) {
-                logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s", http_request_get_error_name(connection->request));
-                httpd_remove_connection(httpd, connection);
-                continue;
-            }
-
-            /* If request is finished, process and deallocate */
-            if (http_request_is_complete(connection->request)) {
-                http_response_t *response = NULL;
-                // Callback the received data to raop
-		if (logger_debug) {
-                    const char *method = http_request_get_method(connection->request);
-                    const char *url = http_request_get_url(connection->request);
-                    const char *protocol = http_request_get_protocol(connection->request);
-                    logger_log(httpd->logger, LOGGER_INFO, "httpd request received on socket %d, connection %d, "
-			       "method = %s, url = %s, protocol = %s", connection->socket_fd, i, method, url, protocol);
-                }
-                httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
-                http_request_destroy(connection->request);
-                connection->request = NULL;
-
-                if (response) {
-                    const char *data;
-                    int datalen;
-                    int written;
-                    int ret;
-
-                    /* Get response data and datalen */
-                    data = http_response_get_data(response, &datalen);
-
-                    written = 0;
-                    while (written < datalen) {
-                        ret = send(connection->socket_fd, data+written, datalen-written, 0);
-                        if (ret == -1) {
-                            logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
-                            break;
-                        }
-                        written += ret;
-                    }
-
-                    if (http_response_get_disconnect(response)) {
-                        logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
-                        httpd_remove_connection(httpd, connection);
-                    }
-                } else {
-                    logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
-                }
-                http_response_destroy(response);
-            } else {
-                logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
             }
         }
     }
 
-    /* Remove all connections that are still connected */
-    for (i=0; i<httpd->max_connections; i++) {
-        http_connection_t *connection = &httpd->connections[i];
+    httpd_stop_workers(httpd);
+    httpd_log_handler_stats(httpd);
 
-        if (!connection->connected) {
-            continue;
-        }
-        logger_log(httpd->logger, LOGGER_INFO, "Removing connection for socket %d", connection->socket_fd);
-        httpd_remove_connection(httpd, connection);
-    }
+    /* Remove all connections that are still connected */
+    httpd_remove_all_connections(httpd);
 
     /* Close server sockets since they are not used any more */
+    httpd_set_accepting(httpd, false);
+    httpd_poll_destroy(httpd->poll);
+    httpd->poll = NULL;
     if (httpd->server_fd4 != -1) {
         shutdown(httpd->server_fd4, SHUT_RDWR);
         closesocket(httpd->server_fd4);
@@ -478,9 +863,21 @@ httpd_start(httpd_t *httpd, unsigned short *port)
     }
     logger_log(httpd->logger, LOGGER_INFO, "Initialized server socket(s)");
 
+    /* room for the server sockets and all connections */
+    httpd->poll = httpd_poll_init(httpd->max_connections + 2);
+    if (!httpd->poll) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error initializing httpd %s event backend", httpd_poll_get_backend());
+        closesocket(httpd->server_fd4);
+        closesocket(httpd->server_fd6);
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -1;
+    }
+    httpd->accepting = false;
+
     /* Set values correctly and create new thread */
     httpd->running = 1;
     httpd->joined = 0;
+    httpd->drop_connections = 0;
     THREAD_CREATE(httpd->thread, httpd_thread, httpd);
     MUTEX_UNLOCK(httpd->run_mutex);
 
@@ -520,3 +917,38 @@ httpd_stop(httpd_t *httpd)
     httpd->joined = 1;
     MUTEX_UNLOCK(httpd->run_mutex);
 }
+
+/* removes all client connections (and their sessions), but the server keeps running on its      *
+ * listening sockets.  The connections belong to httpd_thread, which is woken to remove them; the *
+ * caller (which must not be a request handler) waits for this, for at most timeout_ms.           */
+int
+httpd_drop_connections(httpd_t *httpd, int timeout_ms)
+{
+    int waited = 0;
+    assert(httpd);
+
+    MUTEX_LOCK(httpd->run_mutex);
+    if (!httpd->running) {
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -1;
+    }
+    httpd->drop_connections = 1;
+    if (httpd->wake_fds[1] != -1 && write(httpd->wake_fds[1], "", 1) < 0) {
+        logger_log(httpd->logger, LOGGER_DEBUG, "httpd_drop_connections: could not wake the httpd thread");
+    }
+    MUTEX_UNLOCK(httpd->run_mutex);
+    while (1) {
+        int drop;
+        MUTEX_LOCK(httpd->run_mutex);
+        drop = httpd->drop_connections && httpd->running;
+        MUTEX_UNLOCK(httpd->run_mutex);
+        if (!drop) {
+            return 0;
+        }
+        if (waited >= timeout_ms) {
+            return -1;
+        }
+        sleepms(10);
+        waited += 10;
+    }
+}
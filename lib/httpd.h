@@ -37,13 +37,20 @@ typedef struct httpd_callbacks_s httpd_callbacks_t;
 
 int httpd_set_connection_type (httpd_t *http, void *user_data, connection_type_t type);
 int httpd_count_connection_type (httpd_t *http, connection_type_t type);
+/* bytes used by the connection table and queues; request_peak: largest request handled so far */
+size_t httpd_get_footprint(httpd_t *httpd, size_t *request_peak);
 
 httpd_t *httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int  nohold);
+int httpd_set_max_connections(httpd_t *httpd, int max_connections);
+/* handle requests on up to num_workers (0 - 8) threads; 0: in the httpd thread (default) */
+int httpd_set_workers(httpd_t *httpd, int num_workers);
 
 int httpd_is_running(httpd_t *httpd);
 
 int httpd_start(httpd_t *httpd, unsigned short *port);
 void httpd_stop(httpd_t *httpd);
+/* returns -1 if the connections were not all removed within timeout_ms */
+int httpd_drop_connections(httpd_t *httpd, int timeout_ms);
 
 void httpd_destroy(httpd_t *httpd);
 
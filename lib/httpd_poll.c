@@ -0,0 +1,203 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+
+#include "httpd_poll.h"
+#include "compat.h"
+
+#if defined(__linux__)
+#define HTTPD_POLL_EPOLL
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#define HTTPD_POLL_KQUEUE
+#include <sys/event.h>
+#endif
+
+#define HTTPD_POLL_MAX_EVENTS 16
+
+typedef struct httpd_poll_fd_s {
+    int fd;
+    void *tag;
+} httpd_poll_fd_t;
+
+struct httpd_poll_s {
+    /* registered sockets (needed to build the fd_set for select) */
+    httpd_poll_fd_t *fds;
+    int num_fds;
+    int max_fds;
+#if defined(HTTPD_POLL_EPOLL) || defined(HTTPD_POLL_KQUEUE)
+    int poll_fd;
+#endif
+};
+
+const char *
+httpd_poll_get_backend(void)
+{
+#if defined(HTTPD_POLL_EPOLL)
+    return "epoll";
+#elif defined(HTTPD_POLL_KQUEUE)
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
+
+httpd_poll_t *
+httpd_poll_init(int max_fds)
+{
+    httpd_poll_t *httpd_poll;
+    assert(max_fds > 0);
+
+    httpd_poll = calloc(1, sizeof(httpd_poll_t));
+    if (!httpd_poll) {
+        return NULL;
+    }
+    httpd_poll->fds = calloc(max_fds, sizeof(httpd_poll_fd_t));
+    if (!httpd_poll->fds) {
+        free(httpd_poll);
+        return NULL;
+    }
+    httpd_poll->max_fds = max_fds;
+#if defined(HTTPD_POLL_EPOLL)
+    httpd_poll->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(HTTPD_POLL_KQUEUE)
+    httpd_poll->poll_fd = kqueue();
+#endif
+#if defined(HTTPD_POLL_EPOLL) || defined(HTTPD_POLL_KQUEUE)
+    if (httpd_poll->poll_fd == -1) {
+        free(httpd_poll->fds);
+        free(httpd_poll);
+        return NULL;
+    }
+#endif
+    return httpd_poll;
+}
+
+int
+httpd_poll_add(httpd_poll_t *httpd_poll, int fd, void *tag)
+{
+    assert(httpd_poll);
+    if (httpd_poll->num_fds == httpd_poll->max_fds) {
+        return -1;
+    }
+#if defined(HTTPD_POLL_EPOLL)
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.ptr = tag;
+    if (epoll_ctl(httpd_poll->poll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return -1;
+    }
+#elif defined(HTTPD_POLL_KQUEUE)
+    struct kevent event;
+    EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, tag);
+    if (kevent(httpd_poll->poll_fd, &event, 1, NULL, 0, NULL) == -1) {
+        return -1;
+    }
+#endif
+    httpd_poll->fds[httpd_poll->num_fds].fd = fd;
+    httpd_poll->fds[httpd_poll->num_fds].tag = tag;
+    httpd_poll->num_fds++;
+    return 0;
+}
+
+void
+httpd_poll_remove(httpd_poll_t *httpd_poll, int fd)
+{
+    assert(httpd_poll);
+    for (int i = 0; i < httpd_poll->num_fds; i++) {
+        if (httpd_poll->fds[i].fd != fd) {
+            continue;
+        }
+#if defined(HTTPD_POLL_EPOLL)
+        epoll_ctl(httpd_poll->poll_fd, EPOLL_CTL_DEL, fd, NULL);
+#elif defined(HTTPD_POLL_KQUEUE)
+        struct kevent event;
+        EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        kevent(httpd_poll->poll_fd, &event, 1, NULL, 0, NULL);
+#endif
+        httpd_poll->fds[i] = httpd_poll->fds[--httpd_poll->num_fds];
+        return;
+    }
+}
+
+int
+httpd_poll_wait(httpd_poll_t *httpd_poll, void **tags, int max_tags, int timeout_ms)
+{
+    int ret;
+    assert(httpd_poll && tags && max_tags > 0);
+#if defined(HTTPD_POLL_EPOLL)
+    struct epoll_event events[HTTPD_POLL_MAX_EVENTS];
+    if (max_tags > HTTPD_POLL_MAX_EVENTS) {
+        max_tags = HTTPD_POLL_MAX_EVENTS;
+    }
+    ret = epoll_wait(httpd_poll->poll_fd, events, max_tags, timeout_ms);
+    for (int i = 0; i < ret; i++) {
+        tags[i] = events[i].data.ptr;
+    }
+#elif defined(HTTPD_POLL_KQUEUE)
+    struct kevent events[HTTPD_POLL_MAX_EVENTS];
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+    if (max_tags > HTTPD_POLL_MAX_EVENTS) {
+        max_tags = HTTPD_POLL_MAX_EVENTS;
+    }
+    ret = kevent(httpd_poll->poll_fd, NULL, 0, events, max_tags, &timeout);
+    for (int i = 0; i < ret; i++) {
+        tags[i] = events[i].udata;
+    }
+#else
+    fd_set rfds;
+    struct timeval tv;
+    int nfds = 0;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    FD_ZERO(&rfds);
+    for (int i = 0; i < httpd_poll->num_fds; i++) {
+        FD_SET(httpd_poll->fds[i].fd, &rfds);
+        if (nfds <= httpd_poll->fds[i].fd) {
+            nfds = httpd_poll->fds[i].fd + 1;
+        }
+    }
+    ret = select(nfds, &rfds, NULL, NULL, &tv);
+    if (ret > 0) {
+        ret = 0;
+        for (int i = 0; i < httpd_poll->num_fds && ret < max_tags; i++) {
+            if (FD_ISSET(httpd_poll->fds[i].fd, &rfds)) {
+                tags[ret++] = httpd_poll->fds[i].tag;
+            }
+        }
+    }
+#endif
+    if (ret == -1 && errno == EINTR) {
+        return 0;
+    }
+    return ret;
+}
+
+void
+httpd_poll_destroy(httpd_poll_t *httpd_poll)
+{
+    if (httpd_poll) {
+#if defined(HTTPD_POLL_EPOLL) || defined(HTTPD_POLL_KQUEUE)
+        close(httpd_poll->poll_fd);
+#endif
+        free(httpd_poll->fds);
+        free(httpd_poll);
+    }
+}
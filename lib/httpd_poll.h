@@ -0,0 +1,37 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Readiness notification for the httpd sockets: epoll (Linux), kqueue (BSD, macOS),
+ * or select() as the fallback.  Each registered socket carries an opaque tag that is
+ * returned by httpd_poll_wait() when the socket is readable.
+ */
+
+#ifndef HTTPD_POLL_H
+#define HTTPD_POLL_H
+
+typedef struct httpd_poll_s httpd_poll_t;
+
+httpd_poll_t *httpd_poll_init(int max_fds);
+const char *httpd_poll_get_backend(void);
+int httpd_poll_add(httpd_poll_t *httpd_poll, int fd, void *tag);
+void httpd_poll_remove(httpd_poll_t *httpd_poll, int fd);
+
+/* waits up to timeout_ms for readable sockets, storing up to max_tags of their tags; *
+ * returns the number of tags stored, 0 on timeout or interruption, -1 on error       */
+int httpd_poll_wait(httpd_poll_t *httpd_poll, void **tags, int max_tags, int timeout_ms);
+void httpd_poll_destroy(httpd_poll_t *httpd_poll);
+
+#endif //HTTPD_POLL_H
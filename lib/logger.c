@@ -19,17 +19,47 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
 
 #include "logger.h"
 #include "compat.h"
 
+#define LOGGER_BUFFER_SIZE 4096
+
+/* async logging: messages are formatted by the calling thread directly into a slot of a bounded *
+ * lock-free (multi-producer, single-consumer) ring, and delivered (callback or stderr output) by *
+ * the logger thread.  Each slot's sequence number tells producers and the consumer whose turn   *
+ * it is (D. Vyukov's bounded queue).                                                             */
+#define LOGGER_RING_SLOTS 128   /* power of 2 */
+#define LOGGER_IDLE_WAIT_MS 100
+
+typedef struct logger_slot_s {
+	atomic_size_t sequence;
+	int level;
+	char msg[LOGGER_BUFFER_SIZE];
+} logger_slot_t;
+
 struct logger_s {
-	mutex_handle_t lvl_mutex;
 	mutex_handle_t cb_mutex;
 
-	int level;
+	atomic_int level;
 	void *cls;
 	logger_callback_t callback;
+
+	/* async logging */
+	atomic_bool async;
+	logger_slot_t *ring;
+	atomic_size_t enqueue_pos;
+	size_t dequeue_pos;
+	atomic_bool consumer_idle;
+	int running;
+	mutex_handle_t async_mutex;
+	cond_handle_t async_cond;
+	thread_handle_t thread;
+	atomic_ullong overflows;   /* messages that waited for space in the ring */
 };
 
 logger_t *
@@ -38,10 +68,12 @@ logger_init()
 	logger_t *logger = calloc(1, sizeof(logger_t));
 	assert(logger);
 
-	MUTEX_CREATE(logger->lvl_mutex);
 	MUTEX_CREATE(logger->cb_mutex);
+	MUTEX_CREATE(logger->async_mutex);
+	COND_CREATE(logger->async_cond);
 
-	logger->level = LOGGER_WARNING;
+	atomic_init(&logger->level, LOGGER_WARNING);
+	atomic_init(&logger->async, false);
 	logger->callback = NULL;
 	return logger;
 }
@@ -49,8 +81,10 @@ logger_init()
 void
 logger_destroy(logger_t *logger)
 {
-	MUTEX_DESTROY(logger->lvl_mutex);
+	logger_set_async(logger, false);
 	MUTEX_DESTROY(logger->cb_mutex);
+	MUTEX_DESTROY(logger->async_mutex);
+	COND_DESTROY(logger->async_cond);
 	free(logger);
 }
 
@@ -59,22 +93,21 @@ logger_set_level(logger_t *logger, int level)
 {
 	assert(logger);
 
-	MUTEX_LOCK(logger->lvl_mutex);
-	logger->level = level;
-	MUTEX_UNLOCK(logger->lvl_mutex);
+	atomic_store_explicit(&logger->level, level, memory_order_relaxed);
 }
 
 int
 logger_get_level(logger_t *logger)
 {
-        int level;   
-        assert(logger);
+	assert(logger);
 
-	MUTEX_LOCK(logger->lvl_mutex);
-	level = logger->level;
-	MUTEX_UNLOCK(logger->lvl_mutex);
+	return atomic_load_explicit(&logger->level, memory_order_relaxed);
+}
 
-        return level;
+bool
+logger_is_enabled(logger_t *logger, int level)
+{
+	return level <= atomic_load_explicit(&logger->level, memory_order_relaxed);
 }
 
 void
@@ -118,24 +151,9 @@ logger_utf8_to_local(const char *str)
 	return ret;
 }
 
-void
-logger_log(logger_t *logger, int level, const char *fmt, ...)
+static void
+logger_deliver(logger_t *logger, int level, const char *buffer)
 {
-	char buffer[4096];
-	va_list ap;
-
-	MUTEX_LOCK(logger->lvl_mutex);
-	if (level > logger->level) {
-		MUTEX_UNLOCK(logger->lvl_mutex);
-		return;
-	}
-	MUTEX_UNLOCK(logger->lvl_mutex);
-
-	buffer[sizeof(buffer)-1] = '\0';
-	va_start(ap, fmt);
-	vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
-	va_end(ap);
-
 	MUTEX_LOCK(logger->cb_mutex);
 	if (logger->callback) {
 		logger->callback(logger->cls, level, buffer);
@@ -153,3 +171,182 @@ logger_log(logger_t *logger, int level, const char *fmt, ...)
 	}
 }
 
+/* returns a slot claimed for writing, or NULL if the ring is full */
+static logger_slot_t *
+logger_ring_claim(logger_t *logger)
+{
+	size_t pos = atomic_load_explicit(&logger->enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		logger_slot_t *slot = &logger->ring[pos & (LOGGER_RING_SLOTS - 1)];
+		size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&logger->enqueue_pos, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed)) {
+				return slot;
+			}
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&logger->enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+/* makes a claimed slot (at position sequence - 1) visible to the logger thread */
+static void
+logger_ring_publish(logger_t *logger, logger_slot_t *slot, size_t sequence)
+{
+	atomic_store_explicit(&slot->sequence, sequence, memory_order_release);
+	if (atomic_load_explicit(&logger->consumer_idle, memory_order_seq_cst)) {
+		MUTEX_LOCK(logger->async_mutex);
+		COND_SIGNAL(logger->async_cond);
+		MUTEX_UNLOCK(logger->async_mutex);
+	}
+}
+
+static bool
+logger_ring_ready(logger_t *logger)
+{
+	logger_slot_t *slot = &logger->ring[logger->dequeue_pos & (LOGGER_RING_SLOTS - 1)];
+	return atomic_load_explicit(&slot->sequence, memory_order_acquire) == logger->dequeue_pos + 1;
+}
+
+/* delivers the queued messages; returns the number delivered */
+static int
+logger_ring_drain(logger_t *logger)
+{
+	int count = 0;
+	for (;;) {
+		logger_slot_t *slot = &logger->ring[logger->dequeue_pos & (LOGGER_RING_SLOTS - 1)];
+		if (!logger_ring_ready(logger)) {
+			return count;
+		}
+		logger_deliver(logger, slot->level, slot->msg);
+		atomic_store_explicit(&slot->sequence, logger->dequeue_pos + LOGGER_RING_SLOTS, memory_order_release);
+		logger->dequeue_pos++;
+		count++;
+	}
+}
+
+static THREAD_RETVAL
+logger_thread(void *arg)
+{
+	logger_t *logger = (logger_t *) arg;
+	MUTEX_LOCK(logger->async_mutex);
+	while (logger->running) {
+		MUTEX_UNLOCK(logger->async_mutex);
+		int count = logger_ring_drain(logger);
+		MUTEX_LOCK(logger->async_mutex);
+		if (count || !logger->running) {
+			continue;
+		}
+		/* producers signal only when the consumer is idle, so check again after becoming idle */
+		atomic_store_explicit(&logger->consumer_idle, true, memory_order_seq_cst);
+		if (logger_ring_ready(logger)) {
+			atomic_store_explicit(&logger->consumer_idle, false, memory_order_seq_cst);
+			continue;
+		}
+		struct timespec wait_time;
+		clock_gettime(CLOCK_REALTIME, &wait_time);
+		wait_time.tv_nsec += LOGGER_IDLE_WAIT_MS * 1000000L;
+		if (wait_time.tv_nsec >= 1000000000L) {
+			wait_time.tv_sec++;
+			wait_time.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&logger->async_cond, &logger->async_mutex, &wait_time);
+		atomic_store_explicit(&logger->consumer_idle, false, memory_order_seq_cst);
+	}
+	MUTEX_UNLOCK(logger->async_mutex);
+	logger_ring_drain(logger);
+	return 0;
+}
+
+int
+logger_set_async(logger_t *logger, bool async)
+{
+	assert(logger);
+
+	if (async == atomic_load(&logger->async)) {
+		return 0;
+	}
+	if (async) {
+		logger->ring = calloc(LOGGER_RING_SLOTS, sizeof(logger_slot_t));
+		if (!logger->ring) {
+			return -1;
+		}
+		for (size_t i = 0; i < LOGGER_RING_SLOTS; i++) {
+			atomic_init(&logger->ring[i].sequence, i);
+		}
+		atomic_init(&logger->enqueue_pos, 0);
+		logger->dequeue_pos = 0;
+		atomic_init(&logger->consumer_idle, false);
+		atomic_init(&logger->overflows, 0);
+		logger->running = 1;
+		THREAD_CREATE(logger->thread, logger_thread, logger);
+		if (!logger->thread) {
+			logger->running = 0;
+			free(logger->ring);
+			logger->ring = NULL;
+			return -1;
+		}
+		atomic_store(&logger->async, true);
+		return 0;
+	}
+	/* messages being written while async logging stops are delivered by the final drain, *
+	 * so callers must not log concurrently with this call                                */
+	atomic_store(&logger->async, false);
+	MUTEX_LOCK(logger->async_mutex);
+	logger->running = 0;
+	COND_SIGNAL(logger->async_cond);
+	MUTEX_UNLOCK(logger->async_mutex);
+	THREAD_JOIN(logger->thread);
+	unsigned long long overflows = atomic_load(&logger->overflows);
+	if (overflows) {
+		char buffer[128];
+		snprintf(buffer, sizeof(buffer), "logger: %llu messages waited for space in the async ring", overflows);
+		logger_deliver(logger, LOGGER_DEBUG, buffer);
+	}
+	free(logger->ring);
+	logger->ring = NULL;
+	return 0;
+}
+
+void
+logger_log(logger_t *logger, int level, const char *fmt, ...)
+{
+	char buffer[LOGGER_BUFFER_SIZE];
+	va_list ap;
+
+	if (!logger_is_enabled(logger, level)) {
+		return;
+	}
+
+	if (atomic_load_explicit(&logger->async, memory_order_acquire)) {
+		logger_slot_t *slot = logger_ring_claim(logger);
+		if (!slot && !pthread_equal(pthread_self(), logger->thread)) {
+			/* ring full: wait for the logger thread (keeping the order of messages), as with sync logging */
+			atomic_fetch_add_explicit(&logger->overflows, 1, memory_order_relaxed);
+			while (!(slot = logger_ring_claim(logger))) {
+				sched_yield();
+			}
+		}
+		if (slot) {
+			size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed) + 1;
+			slot->level = level;
+			slot->msg[sizeof(slot->msg)-1] = '\0';
+			va_start(ap, fmt);
+			vsnprintf(slot->msg, sizeof(slot->msg)-1, fmt, ap);
+			va_end(ap);
+			logger_ring_publish(logger, slot, sequence);
+			return;
+		}
+		/* ring full, and logged from the callback (in the logger thread): deliver it directly */
+	}
+
+	buffer[sizeof(buffer)-1] = '\0';
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
+	va_end(ap);
+	logger_deliver(logger, level, buffer);
+}
@@ -22,6 +22,8 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+
 /* Define syslog style log levels */
 #define LOGGER_EMERG       0       /* system is unusable */
 #define LOGGER_ALERT       1       /* action must be taken immediately */
@@ -43,8 +45,20 @@ void logger_set_level(logger_t *logger, int level);
 int logger_get_level(logger_t *logger);
 void logger_set_callback(logger_t *logger, logger_callback_t callback, void *cls);
 
+/* a single atomic load: messages above the level are dropped without taking any lock */
+bool logger_is_enabled(logger_t *logger, int level);
+
+/* async logging: messages are queued in a lock-free ring and delivered by a background thread, *
+ * so that logging (e.g. with -d) does not block the streaming threads on console output.  It    *
+ * must be switched off (or the logger destroyed) only when no other thread is logging.           */
+int logger_set_async(logger_t *logger, bool async);
+
 void logger_log(logger_t *logger, int level, const char *fmt, ...);
 
+/* logger_log() that evaluates its arguments only if the level is enabled, for hot paths */
+#define LOGGER_LOG(logger, level, ...) \
+	do { if (logger_is_enabled((logger), (level))) logger_log((logger), (level), __VA_ARGS__); } while (0)
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,338 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "metrics.h"
+#include "netutils.h"
+#include "compat.h"
+
+#define METRICS_PREFIX "uxplay"
+#define METRICS_BUFFER_SIZE 8192
+#define METRICS_CACHE_LINE 64
+
+typedef struct metrics_metadata_s {
+    const char *name;
+    const char *help;
+} metrics_metadata_t;
+
+static const metrics_metadata_t counter_metadata[METRICS_COUNTERS] = {
+    { "video_frames_total", "Mirror video frames received" },
+    { "video_bytes_total", "Mirror video payload bytes received" },
+    { "video_frames_dropped_total", "Mirror video frames dropped by the video queue" },
+    { "video_qos_dropped_total", "Video buffers reported dropped by GStreamer QoS" },
+    { "video_late_dropped_total", "Late video frames dropped before decoding" },
+    { "video_judder_total", "Video frames shown for more or fewer vblanks than their duration, or dropped (-pace)" },
+    { "audio_packets_total", "Audio packets received" },
+    { "audio_bytes_total", "Audio payload bytes received" },
+    { "audio_packets_late_total", "Audio packets that arrived too late to be played" },
+    { "audio_packets_lost_total", "Audio packets never received" },
+    { "audio_packets_recovered_total", "Audio packets received after a resend request" },
+    { "audio_resend_requests_total", "Audio packet resend requests sent to the client" },
+    { "audio_resend_packets_total", "Missing audio packets asked for in resend requests" },
+    { "audio_frames_rendered_total", "Audio frames pushed to the audio renderer" },
+    { "ntp_syncs_total", "NTP timing exchanges completed with the client" },
+};
+
+static const metrics_metadata_t gauge_metadata[METRICS_GAUGES] = {
+    { "ntp_offset_seconds", "Offset of the client clock from the local clock" },
+    { "ntp_delay_seconds", "NTP round-trip delay" },
+    { "ntp_dispersion_seconds", "NTP dispersion" },
+    { "ntp_drift_ppm", "Estimated drift of the client clock relative to the local clock" },
+    { "video_queue_depth", "Mirror video frames waiting to be rendered" },
+    { "client_fps", "Video frame rate reported by the client" },
+    { "client_bitrate_bits", "Video bitrate (bits/sec) reported by the client" },
+    { "client_encode_latency_seconds", "Video encoding time reported by the client" },
+    { "video_relaunch_seconds", "Time taken to prepare the video renderer for a new connection" },
+    { "first_frame_latency_seconds", "Time from client connection to the first video frame" },
+    { "audio_buffered_seconds", "Buffered (AirPlay 2) audio waiting to be played" },
+    { "audio_level_db", "RMS level (dB) of the loudest rendered audio channel" },
+    { "av_sync_drift_ppm", "Drift of the client timestamps relative to local time, as followed by A/V sync" },
+    { "av_sync_error_seconds", "A/V sync offset error not yet slewed out" },
+    { "audio_resend_rtt_seconds", "Smoothed time from an audio resend request to the resent packet" },
+    { "video_resume_seconds", "Time from resuming a paused stream with released resources to its first displayed frame" },
+    { "reconnect_seconds", "Time from a connection reset to the next client connection" },
+};
+
+/* gauges are stored as integers: scale converts them to the exported units */
+static const double gauge_scale[METRICS_GAUGES] = { 1e-9, 1e-9, 1e-9, 1e-3, 1.0, 1e-3, 1.0, 1e-9, 1e-9, 1e-9, 1e-9, 1e-2,
+                                                    1e-3, 1e-9, 1e-9, 1e-9, 1e-9 };
+
+/* each value has its own cache line, so threads updating different metrics do not contend */
+typedef struct metrics_value_s {
+    _Alignas(METRICS_CACHE_LINE) atomic_ullong value;
+} metrics_value_t;
+
+static metrics_value_t counters[METRICS_COUNTERS];
+static metrics_value_t gauges[METRICS_GAUGES];
+static atomic_bool enabled = false;
+
+static logger_t *metrics_logger = NULL;
+static int http_fd = -1;
+static int statsd_fd = -1;
+static struct sockaddr_storage statsd_addr;
+static socklen_t statsd_addrlen = 0;
+static int metrics_interval = 0;
+static int metrics_running = 0;
+static thread_handle_t metrics_thread;
+static mutex_handle_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cond_handle_t metrics_cond = PTHREAD_COND_INITIALIZER;
+
+bool
+metrics_enabled(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+void
+metrics_add(metrics_counter_t counter, uint64_t value)
+{
+    if (!metrics_enabled()) {
+        return;
+    }
+    assert(counter < METRICS_COUNTERS);
+    atomic_fetch_add_explicit(&counters[counter].value, value, memory_order_relaxed);
+}
+
+void
+metrics_set(metrics_gauge_t gauge, int64_t value)
+{
+    if (!metrics_enabled()) {
+        return;
+    }
+    assert(gauge < METRICS_GAUGES);
+    atomic_store_explicit(&gauges[gauge].value, (unsigned long long) value, memory_order_relaxed);
+}
+
+static double
+gauge_value(int i)
+{
+    int64_t value = (int64_t) atomic_load_explicit(&gauges[i].value, memory_order_relaxed);
+    return (double) value * gauge_scale[i];
+}
+
+/* Prometheus text exposition format */
+static int
+metrics_format_prometheus(char *buf, int size)
+{
+    int len = 0;
+    for (int i = 0; i < METRICS_COUNTERS && len < size; i++) {
+        len += snprintf(buf + len, size - len, "# HELP %s_%s %s\n# TYPE %s_%s counter\n%s_%s %llu\n",
+                        METRICS_PREFIX, counter_metadata[i].name, counter_metadata[i].help,
+                        METRICS_PREFIX, counter_metadata[i].name, METRICS_PREFIX, counter_metadata[i].name,
+                        atomic_load_explicit(&counters[i].value, memory_order_relaxed));
+    }
+    for (int i = 0; i < METRICS_GAUGES && len < size; i++) {
+        len += snprintf(buf + len, size - len, "# HELP %s_%s %s\n# TYPE %s_%s gauge\n%s_%s %.9g\n",
+                        METRICS_PREFIX, gauge_metadata[i].name, gauge_metadata[i].help,
+                        METRICS_PREFIX, gauge_metadata[i].name, METRICS_PREFIX, gauge_metadata[i].name,
+                        gauge_value(i));
+    }
+    return (len < size ? len : size - 1);
+}
+
+static void
+metrics_serve_http(void)
+{
+    char request[1024];
+    char body[METRICS_BUFFER_SIZE];
+    char header[256];
+    int fd = accept(http_fd, NULL, NULL);
+    if (fd == -1) {
+        return;
+    }
+    /* allow a slow client at most one second to send its request */
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+    int ret = recv(fd, request, sizeof(request) - 1, 0);
+    if (ret > 0) {
+        request[ret] = '\0';
+        int body_len = 0;
+        const char *status = "404 Not Found";
+        if (!strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET / ", 6)) {
+            status = "200 OK";
+            body_len = metrics_format_prometheus(body, sizeof(body));
+        }
+        int header_len = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %d\r\nConnection: close\r\n\r\n", status, body_len);
+        send(fd, header, header_len, 0);
+        if (body_len) {
+            send(fd, body, body_len, 0);
+        }
+    }
+    closesocket(fd);
+}
+
+/* StatsD: counters are pushed as the increment since the last push */
+static void
+metrics_push_statsd(uint64_t *last)
+{
+    char buf[1400];
+    int len = 0;
+    for (int i = 0; i < METRICS_COUNTERS + METRICS_GAUGES; i++) {
+        char line[128];
+        int line_len;
+        if (i < METRICS_COUNTERS) {
+            uint64_t value = atomic_load_explicit(&counters[i].value, memory_order_relaxed);
+            line_len = snprintf(line, sizeof(line), "%s.%s:%llu|c\n", METRICS_PREFIX, counter_metadata[i].name,
+                                (unsigned long long) (value - last[i]));
+            last[i] = value;
+        } else {
+            int j = i - METRICS_COUNTERS;
+            line_len = snprintf(line, sizeof(line), "%s.%s:%.9g|g\n", METRICS_PREFIX, gauge_metadata[j].name,
+                                gauge_value(j));
+        }
+        /* keep datagrams below a typical MTU */
+        if (len + line_len > (int) sizeof(buf)) {
+            sendto(statsd_fd, buf, len, 0, (struct sockaddr *) &statsd_addr, statsd_addrlen);
+            len = 0;
+        }
+        memcpy(buf + len, line, line_len);
+        len += line_len;
+    }
+    if (len) {
+        sendto(statsd_fd, buf, len, 0, (struct sockaddr *) &statsd_addr, statsd_addrlen);
+    }
+}
+
+static THREAD_RETVAL
+metrics_thread_func(void *arg)
+{
+    uint64_t last[METRICS_COUNTERS] = { 0 };
+    time_t next_push = time(NULL) + metrics_interval;
+    while (1) {
+        MUTEX_LOCK(metrics_mutex);
+        int running = metrics_running;
+        MUTEX_UNLOCK(metrics_mutex);
+        if (!running) {
+            break;
+        }
+        if (http_fd != -1) {
+            /* wake at least every 100 msec to check for metrics_stop */
+            struct timeval tv = { 0, 100000 };
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            FD_SET(http_fd, &rfds);
+            if (select(http_fd + 1, &rfds, NULL, NULL, &tv) > 0) {
+                metrics_serve_http();
+            }
+        } else {
+            struct timespec wait_time;
+            MUTEX_LOCK(metrics_mutex);
+            clock_gettime(CLOCK_REALTIME, &wait_time);
+            wait_time.tv_sec += 1;
+            if (metrics_running) {
+                pthread_cond_timedwait(&metrics_cond, &metrics_mutex, &wait_time);
+            }
+            MUTEX_UNLOCK(metrics_mutex);
+        }
+        if (statsd_fd != -1 && time(NULL) >= next_push) {
+            metrics_push_statsd(last);
+            next_push += metrics_interval;
+        }
+    }
+    return 0;
+}
+
+static int
+metrics_init_statsd(const char *host, unsigned short port)
+{
+    struct addrinfo hints, *result;
+    char service[8];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        logger_log(metrics_logger, LOGGER_ERR, "metrics: could not resolve StatsD host %s", host);
+        return -1;
+    }
+    statsd_fd = socket(result->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (statsd_fd != -1) {
+        memcpy(&statsd_addr, result->ai_addr, result->ai_addrlen);
+        statsd_addrlen = (socklen_t) result->ai_addrlen;
+    }
+    freeaddrinfo(result);
+    if (statsd_fd == -1) {
+        logger_log(metrics_logger, LOGGER_ERR, "metrics: could not create StatsD socket");
+        return -1;
+    }
+    logger_log(metrics_logger, LOGGER_INFO, "metrics: pushing to StatsD at %s:%u every %d secs", host, port,
+               metrics_interval);
+    return 0;
+}
+
+int
+metrics_start(logger_t *logger, unsigned short http_port, const char *statsd_host,
+              unsigned short statsd_port, int interval_secs)
+{
+    assert(logger && interval_secs > 0);
+    if (metrics_enabled()) {
+        return 0;
+    }
+    metrics_logger = logger;
+    metrics_interval = interval_secs;
+    if (http_port) {
+        unsigned short port = http_port;
+        http_fd = netutils_init_socket(&port, 0, 0);
+        if (http_fd == -1 || listen(http_fd, 4) == -1) {
+            logger_log(logger, LOGGER_ERR, "metrics: could not listen on TCP port %u", http_port);
+            if (http_fd != -1) {
+                closesocket(http_fd);
+                http_fd = -1;
+            }
+            return -1;
+        }
+        logger_log(logger, LOGGER_INFO, "metrics: serving Prometheus metrics at http://<host>:%u/metrics", port);
+    }
+    if (statsd_host && metrics_init_statsd(statsd_host, statsd_port) < 0) {
+        if (http_fd != -1) {
+            closesocket(http_fd);
+            http_fd = -1;
+        }
+        return -1;
+    }
+    metrics_running = 1;
+    atomic_store(&enabled, true);
+    THREAD_CREATE(metrics_thread, metrics_thread_func, NULL);
+    return 0;
+}
+
+void
+metrics_stop(void)
+{
+    if (!metrics_enabled()) {
+        return;
+    }
+    MUTEX_LOCK(metrics_mutex);
+    metrics_running = 0;
+    COND_SIGNAL(metrics_cond);
+    MUTEX_UNLOCK(metrics_mutex);
+    THREAD_JOIN(metrics_thread);
+    atomic_store(&enabled, false);
+    if (http_fd != -1) {
+        closesocket(http_fd);
+        http_fd = -1;
+    }
+    if (statsd_fd != -1) {
+        closesocket(statsd_fd);
+        statsd_fd = -1;
+    }
+}
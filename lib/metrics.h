@@ -0,0 +1,88 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Process-wide performance counters and gauges for fleet monitoring.  The streaming threads
+ * and renderers update them with relaxed atomic operations only (no locks).  When started,
+ * an exporter thread serves them in the Prometheus text format on a small HTTP endpoint
+ * (GET /metrics), and/or pushes them to a StatsD server over UDP at a fixed interval.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#define METRICS_DEFAULT_INTERVAL 10   /* seconds between StatsD pushes */
+
+typedef enum metrics_counter_e {
+    METRICS_VIDEO_FRAMES,             /* mirror video frames received */
+    METRICS_VIDEO_BYTES,
+    METRICS_VIDEO_FRAMES_DROPPED,     /* dropped by the mirror video queue */
+    METRICS_VIDEO_QOS_DROPPED,        /* reported dropped in GStreamer QoS messages */
+    METRICS_VIDEO_LATE_DROPPED,       /* late frames dropped before decoding (-latedrop) */
+    METRICS_VIDEO_JUDDER,             /* frames shown for more or fewer vblanks than their duration (-pace) */
+    METRICS_AUDIO_PACKETS,            /* audio packets received */
+    METRICS_AUDIO_BYTES,
+    METRICS_AUDIO_PACKETS_LATE,
+    METRICS_AUDIO_PACKETS_LOST,
+    METRICS_AUDIO_PACKETS_RECOVERED,
+    METRICS_AUDIO_RESEND_REQUESTS,
+    METRICS_AUDIO_RESEND_PACKETS,     /* missing packets asked for in resend requests */
+    METRICS_AUDIO_FRAMES_RENDERED,    /* audio frames pushed to the audio renderer */
+    METRICS_NTP_SYNCS,
+    METRICS_COUNTERS
+} metrics_counter_t;
+
+typedef enum metrics_gauge_e {
+    METRICS_NTP_OFFSET,               /* nsecs, remote - local clock */
+    METRICS_NTP_DELAY,                /* nsecs */
+    METRICS_NTP_DISPERSION,           /* nsecs */
+    METRICS_NTP_DRIFT,                /* ppb: client clock rate relative to the local clock */
+    METRICS_VIDEO_QUEUE_DEPTH,        /* frames waiting for the delivery thread */
+    METRICS_CLIENT_FPS,               /* millis: reported by the client */
+    METRICS_CLIENT_BITRATE,           /* bits/sec: reported by the client */
+    METRICS_CLIENT_ENCODE_LATENCY,    /* nsecs: reported by the client */
+    METRICS_VIDEO_RELAUNCH_TIME,      /* nsecs: preparing the video renderer for a new connection */
+    METRICS_FIRST_FRAME_LATENCY,      /* nsecs: client connection to first video frame */
+    METRICS_AUDIO_BUFFERED,           /* nsecs: buffered (AirPlay 2) audio waiting to be played */
+    METRICS_AUDIO_LEVEL,              /* millibels: RMS level of the loudest audio channel */
+    METRICS_AV_SYNC_DRIFT,            /* ppb: rate at which the A/V sync offset is being slewed */
+    METRICS_AV_SYNC_ERROR,            /* nsecs: A/V sync offset error not yet slewed out */
+    METRICS_AUDIO_RESEND_RTT,         /* nsecs: smoothed time from a resend request to the resent packet */
+    METRICS_VIDEO_RESUME_TIME,        /* nsecs: resume after a released pause, to the first frame displayed */
+    METRICS_RECONNECT_TIME,           /* nsecs: connection reset to the next client connection */
+    METRICS_GAUGES
+} metrics_gauge_t;
+
+/* http_port = 0: no HTTP endpoint; statsd_host = NULL: no StatsD push */
+int metrics_start(logger_t *logger, unsigned short http_port, const char *statsd_host,
+                  unsigned short statsd_port, int interval_secs);
+bool metrics_enabled(void);
+void metrics_add(metrics_counter_t counter, uint64_t value);
+void metrics_set(metrics_gauge_t gauge, int64_t value);
+void metrics_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //METRICS_H
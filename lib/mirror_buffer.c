@@ -27,12 +27,15 @@
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <time.h>
 
 struct mirror_buffer_s {
     logger_t *logger;
     aes_ctx_t *aes_ctx;
-    int nextDecryptCount;
-    uint8_t og[16];
+    /* decryption throughput statistics */
+    uint64_t frames_decrypted;
+    uint64_t bytes_decrypted;
+    uint64_t decrypt_nsecs;
     /* audio aes key is used in a hash for the video aes key and iv */
     unsigned char aeskey_audio[RAOP_AESKEY_LEN];
 };
@@ -78,46 +81,41 @@ mirror_buffer_init(logger_t *logger, const unsigned char *aeskey)
     }
     memcpy(mirror_buffer->aeskey_audio, aeskey, RAOP_AESKEY_LEN);
     mirror_buffer->logger = logger;
-    mirror_buffer->nextDecryptCount = 0;
     return mirror_buffer;
 }
 
+static uint64_t
+mirror_buffer_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
 void mirror_buffer_decrypt(mirror_buffer_t *mirror_buffer, unsigned char* input, unsigned char* output, int inputLen) {
-    // Start decrypting
-    if (mirror_buffer->nextDecryptCount > 0) {//mirror_buffer->nextDecryptCount = 10
-        for (int i = 0; i < mirror_buffer->nextDecryptCount; i++) {
-            output[i] = (input[i] ^ mirror_buffer->og[(16 - mirror_buffer->nextDecryptCount) + i]);
-        }
-    }
-    // Handling encrypted bytes
-    int encryptlen = ((inputLen - mirror_buffer->nextDecryptCount) / 16) * 16;
-    // Aes decryption
-    aes_ctr_start_fresh_block(mirror_buffer->aes_ctx);
-    aes_ctr_decrypt(mirror_buffer->aes_ctx, input + mirror_buffer->nextDecryptCount,
-                    input + mirror_buffer->nextDecryptCount, encryptlen);
-    // Copy to output
-    memcpy(output + mirror_buffer->nextDecryptCount, input + mirror_buffer->nextDecryptCount, encryptlen);
-    // int outputlength = mirror_buffer->nextDecryptCount + encryptlen;
-    // Processing remaining length
-    int restlen = (inputLen - mirror_buffer->nextDecryptCount) % 16;
-    int reststart = inputLen - restlen;
-    mirror_buffer->nextDecryptCount = 0;
-    if (restlen > 0) {
-        memset(mirror_buffer->og, 0, 16);
-        memcpy(mirror_buffer->og, input + reststart, restlen);
-        aes_ctr_decrypt(mirror_buffer->aes_ctx, mirror_buffer->og, mirror_buffer->og, 16);
-        for (int j = 0; j < restlen; j++) {
-            output[reststart + j] = mirror_buffer->og[j];
-        }
-        //outputlength += restlen;
-        mirror_buffer->nextDecryptCount = 16 - restlen;// Difference 16-6=10 bytes
-    }
+    /* The video stream is a single continuous AES-CTR keystream: a partial 16-byte block at the  *
+     * end of one packet is completed by the first bytes of the next.  The EVP CTR cipher carries *
+     * this keystream tail itself, so the whole payload is decrypted directly into output (which  *
+     * may be the same as input) by one call, using the hardware AES (AES-NI, ARMv8 crypto) path  *
+     * selected by the crypto library.                                                            */
+    uint64_t start = mirror_buffer_get_nsecs();
+    aes_ctr_decrypt(mirror_buffer->aes_ctx, input, output, inputLen);
+    mirror_buffer->decrypt_nsecs += mirror_buffer_get_nsecs() - start;
+    mirror_buffer->bytes_decrypted += (uint64_t) inputLen;
+    mirror_buffer->frames_decrypted++;
 }
 
 void
 mirror_buffer_destroy(mirror_buffer_t *mirror_buffer)
 {
     if (mirror_buffer) {
+        if (mirror_buffer->frames_decrypted && mirror_buffer->decrypt_nsecs) {
+            double mbytes_per_sec = (1000.0 * mirror_buffer->bytes_decrypted) / mirror_buffer->decrypt_nsecs;
+            logger_log(mirror_buffer->logger, LOGGER_DEBUG, "mirror_buffer: decrypted %" PRIu64 " frames (%" PRIu64
+                       " bytes, average %" PRIu64 " bytes/frame) at %.1f MB/s", mirror_buffer->frames_decrypted,
+                       mirror_buffer->bytes_decrypted, mirror_buffer->bytes_decrypted / mirror_buffer->frames_decrypted,
+                       mbytes_per_sec);
+        }
         aes_ctr_destroy(mirror_buffer->aes_ctx);
         free(mirror_buffer);
     }
@@ -0,0 +1,180 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "mirror_queue.h"
+#include "threads.h"
+
+struct mirror_queue_s {
+    mirror_queue_entry_t *entries;
+    unsigned int depth;
+
+    /* head is only written by the producer, tail only by the consumer; *
+     * both increase monotonically (entry index = count % depth).       */
+    atomic_uint head;
+    atomic_uint tail;
+
+    /* tail value when the consumer finished its last frame */
+    atomic_uint done;
+
+    /* consumer sleeps here when the queue is empty, producer in drain(); each side only *
+     * signals when the other has announced that it is about to sleep                   */
+    atomic_bool consumer_idle;
+    atomic_bool producer_waiting;
+    mutex_handle_t wait_mutex;
+    cond_handle_t wait_cond;
+};
+
+mirror_queue_t *
+mirror_queue_init(int depth)
+{
+    mirror_queue_t *mirror_queue;
+    assert(depth > 0 && depth <= MIRROR_QUEUE_MAX_DEPTH);
+
+    mirror_queue = calloc(1, sizeof(mirror_queue_t));
+    if (!mirror_queue) {
+        return NULL;
+    }
+    mirror_queue->entries = calloc(depth, sizeof(mirror_queue_entry_t));
+    if (!mirror_queue->entries) {
+        free(mirror_queue);
+        return NULL;
+    }
+    mirror_queue->depth = (unsigned int) depth;
+    atomic_init(&mirror_queue->head, 0);
+    atomic_init(&mirror_queue->tail, 0);
+    atomic_init(&mirror_queue->done, 0);
+    atomic_init(&mirror_queue->consumer_idle, false);
+    atomic_init(&mirror_queue->producer_waiting, false);
+    MUTEX_CREATE(mirror_queue->wait_mutex);
+    COND_CREATE(mirror_queue->wait_cond);
+    return mirror_queue;
+}
+
+static void
+mirror_queue_get_wait_time(struct timespec *wait_time, int timeout_ms)
+{
+    clock_gettime(CLOCK_REALTIME, wait_time);
+    wait_time->tv_sec += timeout_ms / 1000;
+    wait_time->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (wait_time->tv_nsec >= 1000000000) {
+        wait_time->tv_sec++;
+        wait_time->tv_nsec -= 1000000000;
+    }
+}
+
+bool
+mirror_queue_push(mirror_queue_t *mirror_queue, const mirror_queue_entry_t *entry)
+{
+    unsigned int head = atomic_load_explicit(&mirror_queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&mirror_queue->tail, memory_order_acquire);
+    if (head - tail == mirror_queue->depth) {
+        return false;
+    }
+    mirror_queue->entries[head % mirror_queue->depth] = *entry;
+    atomic_store_explicit(&mirror_queue->head, head + 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&mirror_queue->consumer_idle, memory_order_seq_cst)) {
+        mirror_queue_wake(mirror_queue);
+    }
+    return true;
+}
+
+bool
+mirror_queue_pop(mirror_queue_t *mirror_queue, mirror_queue_entry_t *entry, int timeout_ms)
+{
+    unsigned int tail = atomic_load_explicit(&mirror_queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&mirror_queue->head, memory_order_acquire);
+    if (head == tail) {
+        struct timespec wait_time;
+        mirror_queue_get_wait_time(&wait_time, timeout_ms);
+        MUTEX_LOCK(mirror_queue->wait_mutex);
+        /* the producer signals only when the consumer is idle, so check again after becoming idle */
+        atomic_store_explicit(&mirror_queue->consumer_idle, true, memory_order_seq_cst);
+        head = atomic_load_explicit(&mirror_queue->head, memory_order_seq_cst);
+        if (head == tail) {
+            pthread_cond_timedwait(&mirror_queue->wait_cond, &mirror_queue->wait_mutex, &wait_time);
+            head = atomic_load_explicit(&mirror_queue->head, memory_order_acquire);
+        }
+        atomic_store_explicit(&mirror_queue->consumer_idle, false, memory_order_relaxed);
+        MUTEX_UNLOCK(mirror_queue->wait_mutex);
+        if (head == tail) {
+            return false;
+        }
+    }
+    *entry = mirror_queue->entries[tail % mirror_queue->depth];
+    atomic_store_explicit(&mirror_queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void
+mirror_queue_done(mirror_queue_t *mirror_queue)
+{
+    unsigned int tail = atomic_load_explicit(&mirror_queue->tail, memory_order_relaxed);
+    atomic_store_explicit(&mirror_queue->done, tail, memory_order_seq_cst);
+    if (atomic_load_explicit(&mirror_queue->producer_waiting, memory_order_seq_cst) &&
+        tail == atomic_load_explicit(&mirror_queue->head, memory_order_acquire)) {
+        mirror_queue_wake(mirror_queue);
+    }
+}
+
+unsigned int
+mirror_queue_count(mirror_queue_t *mirror_queue)
+{
+    return atomic_load_explicit(&mirror_queue->head, memory_order_relaxed) -
+           atomic_load_explicit(&mirror_queue->tail, memory_order_relaxed);
+}
+
+bool
+mirror_queue_drain(mirror_queue_t *mirror_queue, int timeout_ms)
+{
+    struct timespec wait_time;
+    bool drained;
+    unsigned int head = atomic_load_explicit(&mirror_queue->head, memory_order_relaxed);
+    mirror_queue_get_wait_time(&wait_time, timeout_ms);
+    MUTEX_LOCK(mirror_queue->wait_mutex);
+    atomic_store_explicit(&mirror_queue->producer_waiting, true, memory_order_seq_cst);
+    while (!(drained = (atomic_load_explicit(&mirror_queue->done, memory_order_seq_cst) == head))) {
+        if (pthread_cond_timedwait(&mirror_queue->wait_cond, &mirror_queue->wait_mutex, &wait_time)) {
+            drained = (atomic_load_explicit(&mirror_queue->done, memory_order_acquire) == head);
+            break;
+        }
+    }
+    atomic_store_explicit(&mirror_queue->producer_waiting, false, memory_order_relaxed);
+    MUTEX_UNLOCK(mirror_queue->wait_mutex);
+    return drained;
+}
+
+void
+mirror_queue_wake(mirror_queue_t *mirror_queue)
+{
+    MUTEX_LOCK(mirror_queue->wait_mutex);
+    pthread_cond_broadcast(&mirror_queue->wait_cond);
+    MUTEX_UNLOCK(mirror_queue->wait_mutex);
+}
+
+void
+mirror_queue_destroy(mirror_queue_t *mirror_queue)
+{
+    if (mirror_queue) {
+        COND_DESTROY(mirror_queue->wait_cond);
+        MUTEX_DESTROY(mirror_queue->wait_mutex);
+        free(mirror_queue->entries);
+        free(mirror_queue);
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Bounded single-producer single-consumer queue of video frames, passing frames from
+ * the mirror receive thread to the video delivery thread.  Pushing never blocks: it
+ * fails if the queue is full.  Only a wakeup of a consumer that found the queue empty (or of a
+ * producer waiting in drain) takes a mutex.
+ */
+
+#ifndef MIRROR_QUEUE_H
+#define MIRROR_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stream.h"
+
+#define MIRROR_QUEUE_DEFAULT_DEPTH 0    /* frames are delivered from the receive thread unless a depth is set */
+#define MIRROR_QUEUE_MAX_DEPTH 64
+
+typedef struct {
+    h264_decode_struct frame;
+    unsigned int generation;   /* frames from before a codec/format change are stale */
+    uint64_t queued;           /* monotonic time (nsecs) when the frame was queued */
+} mirror_queue_entry_t;
+
+typedef struct mirror_queue_s mirror_queue_t;
+
+mirror_queue_t *mirror_queue_init(int depth);
+bool mirror_queue_push(mirror_queue_t *mirror_queue, const mirror_queue_entry_t *entry);
+
+/* waits up to timeout_ms for a frame; returns false if there was none */
+bool mirror_queue_pop(mirror_queue_t *mirror_queue, mirror_queue_entry_t *entry, int timeout_ms);
+
+/* consumer: marks the frame returned by the last pop as fully processed */
+void mirror_queue_done(mirror_queue_t *mirror_queue);
+
+/* number of queued frames (approximate if called while the consumer is popping) */
+unsigned int mirror_queue_count(mirror_queue_t *mirror_queue);
+
+/* producer: waits up to timeout_ms until all queued frames have been processed */
+bool mirror_queue_drain(mirror_queue_t *mirror_queue, int timeout_ms);
+/* wakes the consumer (and a draining producer) unconditionally, e.g. when stopping */
+void mirror_queue_wake(mirror_queue_t *mirror_queue);
+void mirror_queue_destroy(mirror_queue_t *mirror_queue);
+
+#endif //MIRROR_QUEUE_H
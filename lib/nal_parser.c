@@ -0,0 +1,138 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "nal_parser.h"
+
+static const unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+void
+nal_index_init(nal_index_t *nal_index, bool h265)
+{
+    assert(nal_index);
+    nal_index->count = 0;
+    nal_index->indexed = 0;
+    nal_index->keyframe = false;
+    nal_index->h265 = h265;
+}
+
+void
+nal_index_add(nal_index_t *nal_index, int offset, int size, unsigned char nal_header)
+{
+    unsigned char nal_type, ref_idc;
+    if (nal_index->h265) {
+        /* h265 nal_unit_type 16-21 are IRAP pictures; even VCL types < 16 are sub-layer non-reference pictures */
+        nal_type = (nal_header >> 1) & 0x3f;
+        ref_idc = ((nal_type < 16 && !(nal_type & 0x01)) ? 0 : 1);
+        if (nal_type >= 16 && nal_type <= 21) {
+            nal_index->keyframe = true;
+        }
+    } else {
+        nal_type = nal_header & 0x1f;
+        ref_idc = nal_header >> 5;
+        if (nal_type == 5) {
+            nal_index->keyframe = true;
+        }
+    }
+    if (nal_index->indexed < NAL_INDEX_MAX) {
+        nal_unit_info_t *nal = &(nal_index->nal[nal_index->indexed++]);
+        nal->offset = offset;
+        nal->size = size;
+        nal->type = nal_type;
+        nal->ref_idc = ref_idc;
+    }
+    nal_index->count++;
+}
+
+int
+nal_parser_avcc_to_annexb(unsigned char *data, int start, int len, nal_index_t *nal_index)
+{
+    int pos = start;
+    assert(data && nal_index);
+
+    while (pos < len) {
+        if (pos + 4 > len) {
+            return NAL_PARSER_INVALID;
+        }
+        uint32_t nal_size = ((uint32_t) data[pos] << 24) | ((uint32_t) data[pos + 1] << 16) |
+                            ((uint32_t) data[pos + 2] << 8) | (uint32_t) data[pos + 3];
+        if (nal_size < 2 || nal_size > (uint32_t) (len - pos - 4)) {
+            return NAL_PARSER_INVALID;
+        }
+        memcpy(data + pos, nal_start_code, 4);
+        pos += 4;
+        unsigned char nal_header = data[pos];
+        /* first bit of h264 and h265 nalu MUST be 0 ("forbidden_zero_bit") */
+        if (nal_header & 0x80) {
+            return NAL_PARSER_INVALID;
+        }
+        /* h265 VCL NAL headers: 0x28 0x01 (IDR, type 20),  0x02 0x01 (non-IDR, type 1) */
+        if (!nal_index->h265 && data[pos + 1] == 0x01 && (nal_header == 0x28 || nal_header == 0x02)) {
+            return NAL_PARSER_H265;
+        }
+        nal_index_add(nal_index, pos, (int) nal_size, nal_header);
+        pos += (int) nal_size;
+    }
+    return NAL_PARSER_OK;
+}
+
+int
+nal_parser_parse_hvcc(const unsigned char *data, int len, nal_unit_info_t params[3])
+{
+    /* hvcC: 22 byte header, numOfArrays, then arrays of                    *
+     * {array_completeness|nal_type, numNalus[2], {nalUnitLength[2], nal}}  */
+    int found = 0;
+    int pos = 23;
+    if (len < pos || data[0] != 0x01) {
+        return -1;
+    }
+    int num_arrays = data[22];
+    if (num_arrays == 0 || num_arrays > 8) {
+        return -1;
+    }
+    for (int i = 0; i < num_arrays; i++) {
+        if (pos + 3 > len) {
+            return -1;
+        }
+        unsigned char nal_type = data[pos] & 0x3f;
+        int num_nalus = (data[pos + 1] << 8) | data[pos + 2];
+        pos += 3;
+        if (num_nalus == 0 || nal_type < 32 || nal_type > 40) {
+            return -1;
+        }
+        for (int j = 0; j < num_nalus; j++) {
+            if (pos + 2 > len) {
+                return -1;
+            }
+            int nal_size = (data[pos] << 8) | data[pos + 1];
+            pos += 2;
+            if (nal_size < 2 || pos + nal_size > len) {
+                return -1;
+            }
+            /* keep the first VPS (32), SPS (33), PPS (34) */
+            if (nal_type >= 32 && nal_type <= 34 && j == 0) {
+                params[nal_type - 32].offset = pos;
+                params[nal_type - 32].size = nal_size;
+                params[nal_type - 32].type = nal_type;
+                params[nal_type - 32].ref_idc = 1;
+                found |= (1 << (nal_type - 32));
+            }
+            pos += nal_size;
+        }
+    }
+    return (found == 0x07 ? 0 : -1);
+}
@@ -0,0 +1,44 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Single-pass, in-place conversion of AirPlay (AVCC-like, 4-byte big-endian length
+ * prefixed) video NAL units to the Annex-B byte-stream format, producing an index
+ * of the NAL units found.
+ */
+
+#ifndef NAL_PARSER_H
+#define NAL_PARSER_H
+
+#include "stream.h"
+
+#define NAL_PARSER_OK 0
+#define NAL_PARSER_INVALID (-1)
+#define NAL_PARSER_H265 1
+
+void nal_index_init(nal_index_t *nal_index, bool h265);
+void nal_index_add(nal_index_t *nal_index, int offset, int size, unsigned char nal_header);
+
+/* converts data[start: len] in place, appending its NAL units to nal_index;      *
+ * returns NAL_PARSER_OK, NAL_PARSER_INVALID (e.g. failed decryption) or          *
+ * NAL_PARSER_H265 if h265 VCL NAL units are found when h264 is expected          */
+int nal_parser_avcc_to_annexb(unsigned char *data, int start, int len, nal_index_t *nal_index);
+
+/* finds the VPS, SPS and PPS NAL units in a HEVCDecoderConfigurationRecord ("hvcC"): *
+ * returns 0 and fills params[3] (offsets into data) if all three are found,          *
+ * otherwise -1.                                                                      */
+int nal_parser_parse_hvcc(const unsigned char *data, int len, nal_unit_info_t params[3]);
+
+#endif //NAL_PARSER_H
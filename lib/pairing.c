@@ -24,6 +24,7 @@
 #include "pairing.h"
 #include "crypto.h"
 #include "srp.h"
+#include "threads.h"
 
 #define SALT_KEY "Pair-Verify-AES-Key"
 #define SALT_IV "Pair-Verify-AES-IV"
@@ -33,10 +34,49 @@ typedef struct srp_s {
     unsigned char verifier[SRP_VERIFIER_SIZE];
     unsigned char session_key[SRP_SESSION_KEY_SIZE];
     unsigned char private_key[SRP_PRIVATE_KEY_SIZE];
+    unsigned char public_base[SRP_PK_SIZE];       /* g^private_key */
 } srp_t;
 
+typedef struct srp_ephemeral_s {
+    unsigned char private_key[SRP_PRIVATE_KEY_SIZE];
+    unsigned char public_base[SRP_PK_SIZE];
+} srp_ephemeral_t;
+
+typedef struct srp_cache_entry_s {
+    char username[SRP_USERNAME_SIZE + 1];
+    unsigned char salt[SRP_SALT_SIZE];
+    unsigned char verifier[SRP_VERIFIER_SIZE];
+} srp_cache_entry_t;
+
 struct pairing_s {
     ed25519_key_t *ed;
+
+    /* ephemeral x25519 keys for pair-verify, generated ahead of time by the key pool thread */
+    x25519_key_t *ecdh_pool[PAIRING_KEY_POOL_SIZE];
+    int ecdh_pool_count;
+    /* SRP ephemeral keys for pair-setup-pin, also generated by the key pool thread, once enabled */
+    srp_ephemeral_t srp_pool[PAIRING_SRP_POOL_SIZE];
+    int srp_pool_count;
+    bool srp_pool_enabled;
+    bool ecdh_pool_running;
+    thread_handle_t ecdh_pool_thread;
+    mutex_handle_t ecdh_pool_mutex;
+    cond_handle_t ecdh_pool_cond;
+
+    /* long-term keys of clients that completed a pin-registered pair-verify (round robin) */
+    unsigned char verified[PAIRING_VERIFIED_CACHE_SIZE][ED25519_KEY_SIZE];
+    int verified_count;
+    int verified_next;
+    mutex_handle_t verified_mutex;
+
+    /* salts and verifiers computed for the current pin, by client username (round robin) */
+    srp_cache_entry_t srp_cache[PAIRING_SRP_CACHE_SIZE];
+    int srp_cache_count;
+    int srp_cache_next;
+    char srp_cache_pin[8];
+    mutex_handle_t srp_cache_mutex;
+
+    pairing_stats_t stats;
 };
 
 typedef enum {
@@ -47,6 +87,7 @@ typedef enum {
 } status_t;
 
 struct pairing_session_s {
+    pairing_t *pairing;
     status_t status;
 
     ed25519_key_t *ed_ours;
@@ -83,6 +124,152 @@ derive_key_internal(pairing_session_t *session, const unsigned char *salt, unsig
     return 0;
 }
 
+static int
+srp_ephemeral_generate(srp_ephemeral_t *ephemeral)
+{
+    if (get_random_bytes(ephemeral->private_key, SRP_PRIVATE_KEY_SIZE) < 1) {
+        return -1;
+    }
+    return srp_create_server_ephemeral_base(SRP_NG, ephemeral->private_key, SRP_PRIVATE_KEY_SIZE,
+                                            ephemeral->public_base, SRP_PK_SIZE, NULL, NULL);
+}
+
+static THREAD_RETVAL
+ecdh_pool_thread(void *arg)
+{
+    pairing_t *pairing = (pairing_t *) arg;
+    MUTEX_LOCK(pairing->ecdh_pool_mutex);
+    while (pairing->ecdh_pool_running) {
+        bool srp_needed = (pairing->srp_pool_enabled && pairing->srp_pool_count < PAIRING_SRP_POOL_SIZE);
+        if (pairing->ecdh_pool_count == PAIRING_KEY_POOL_SIZE && !srp_needed) {
+            pthread_cond_wait(&pairing->ecdh_pool_cond, &pairing->ecdh_pool_mutex);
+            continue;
+        }
+        if (pairing->ecdh_pool_count == PAIRING_KEY_POOL_SIZE) {
+            srp_ephemeral_t ephemeral;
+            MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+            int ret = srp_ephemeral_generate(&ephemeral);
+            MUTEX_LOCK(pairing->ecdh_pool_mutex);
+            if (ret < 0) {
+                break;
+            }
+            if (pairing->srp_pool_count < PAIRING_SRP_POOL_SIZE) {
+                pairing->srp_pool[pairing->srp_pool_count++] = ephemeral;
+            }
+            memset(&ephemeral, 0, sizeof(ephemeral));
+            continue;
+        }
+        MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+        x25519_key_t *key = x25519_key_generate();
+        MUTEX_LOCK(pairing->ecdh_pool_mutex);
+        if (!key) {
+            break;
+        }
+        if (pairing->ecdh_pool_count < PAIRING_KEY_POOL_SIZE) {
+            pairing->ecdh_pool[pairing->ecdh_pool_count++] = key;
+        } else {
+            x25519_key_destroy(key);
+        }
+    }
+    MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+    return 0;
+}
+
+/* takes a pregenerated key from the pool, or generates one if the pool is empty */
+static x25519_key_t *
+pairing_take_ecdh_key(pairing_t *pairing)
+{
+    x25519_key_t *key = NULL;
+    MUTEX_LOCK(pairing->ecdh_pool_mutex);
+    if (pairing->ecdh_pool_count > 0) {
+        key = pairing->ecdh_pool[--pairing->ecdh_pool_count];
+        pairing->ecdh_pool[pairing->ecdh_pool_count] = NULL;
+        pairing->stats.keypool_hits++;
+        COND_SIGNAL(pairing->ecdh_pool_cond);
+    } else {
+        pairing->stats.keypool_misses++;
+    }
+    MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+    return (key ? key : x25519_key_generate());
+}
+
+/* takes a pregenerated SRP ephemeral key from the pool, or generates one if the pool is empty */
+static int
+pairing_take_srp_ephemeral(pairing_t *pairing, srp_ephemeral_t *ephemeral)
+{
+    bool found = false;
+    MUTEX_LOCK(pairing->ecdh_pool_mutex);
+    if (pairing->srp_pool_count > 0) {
+        srp_ephemeral_t *pooled = &pairing->srp_pool[--pairing->srp_pool_count];
+        *ephemeral = *pooled;
+        memset(pooled, 0, sizeof(srp_ephemeral_t));
+        found = true;
+        pairing->stats.srp_pool_hits++;
+        COND_SIGNAL(pairing->ecdh_pool_cond);
+    } else {
+        pairing->stats.srp_pool_misses++;
+    }
+    MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+    return (found ? 0 : srp_ephemeral_generate(ephemeral));
+}
+
+void
+pairing_enable_srp_pool(pairing_t *pairing)
+{
+    assert(pairing);
+    MUTEX_LOCK(pairing->ecdh_pool_mutex);
+    if (!pairing->srp_pool_enabled) {
+        pairing->srp_pool_enabled = true;
+        COND_SIGNAL(pairing->ecdh_pool_cond);
+    }
+    MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+}
+
+/* looks up the salt and verifier of a client for this pin; the cache is cleared when the pin changes */
+static bool
+pairing_get_srp_verifier(pairing_t *pairing, const char *username, const char *pin,
+                         unsigned char *salt, unsigned char *verifier)
+{
+    bool found = false;
+    MUTEX_LOCK(pairing->srp_cache_mutex);
+    pairing->stats.srp_verifier_lookups++;
+    if (strncmp(pairing->srp_cache_pin, pin, sizeof(pairing->srp_cache_pin))) {
+        memset(pairing->srp_cache, 0, sizeof(pairing->srp_cache));
+        pairing->srp_cache_count = 0;
+        pairing->srp_cache_next = 0;
+        strncpy(pairing->srp_cache_pin, pin, sizeof(pairing->srp_cache_pin) - 1);
+    }
+    for (int i = 0; i < pairing->srp_cache_count; i++) {
+        if (!strcmp(pairing->srp_cache[i].username, username)) {
+            memcpy(salt, pairing->srp_cache[i].salt, SRP_SALT_SIZE);
+            memcpy(verifier, pairing->srp_cache[i].verifier, SRP_VERIFIER_SIZE);
+            pairing->stats.srp_verifier_hits++;
+            found = true;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(pairing->srp_cache_mutex);
+    return found;
+}
+
+static void
+pairing_add_srp_verifier(pairing_t *pairing, const char *username, const char *pin,
+                         const unsigned char *salt, const unsigned char *verifier)
+{
+    MUTEX_LOCK(pairing->srp_cache_mutex);
+    if (!strncmp(pairing->srp_cache_pin, pin, sizeof(pairing->srp_cache_pin))) {
+        srp_cache_entry_t *entry = &pairing->srp_cache[pairing->srp_cache_next];
+        strncpy(entry->username, username, SRP_USERNAME_SIZE);
+        memcpy(entry->salt, salt, SRP_SALT_SIZE);
+        memcpy(entry->verifier, verifier, SRP_VERIFIER_SIZE);
+        pairing->srp_cache_next = (pairing->srp_cache_next + 1) % PAIRING_SRP_CACHE_SIZE;
+        if (pairing->srp_cache_count < PAIRING_SRP_CACHE_SIZE) {
+            pairing->srp_cache_count++;
+        }
+    }
+    MUTEX_UNLOCK(pairing->srp_cache_mutex);
+}
+
 pairing_t *
 pairing_init_generate(const char *device_id, const char *keyfile, int *result)
 {
@@ -95,9 +282,58 @@ pairing_init_generate(const char *device_id, const char *keyfile, int *result)
 
     pairing->ed = ed25519_key_generate(device_id, keyfile, result);
 
+    MUTEX_CREATE(pairing->verified_mutex);
+    MUTEX_CREATE(pairing->srp_cache_mutex);
+    MUTEX_CREATE(pairing->ecdh_pool_mutex);
+    COND_CREATE(pairing->ecdh_pool_cond);
+    pairing->ecdh_pool_running = true;
+    THREAD_CREATE(pairing->ecdh_pool_thread, ecdh_pool_thread, pairing);
+    if (!pairing->ecdh_pool_thread) {
+        /* keys will be generated on demand */
+        pairing->ecdh_pool_running = false;
+    }
+
     return pairing;
 }
 
+bool
+pairing_is_verified_client(pairing_t *pairing, const unsigned char pk[ED25519_KEY_SIZE])
+{
+    bool found = false;
+    assert(pairing);
+    MUTEX_LOCK(pairing->verified_mutex);
+    pairing->stats.verified_lookups++;
+    for (int i = 0; i < pairing->verified_count; i++) {
+        if (!memcmp(pairing->verified[i], pk, ED25519_KEY_SIZE)) {
+            found = true;
+            pairing->stats.verified_hits++;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(pairing->verified_mutex);
+    return found;
+}
+
+void
+pairing_get_stats(pairing_t *pairing, pairing_stats_t *stats)
+{
+    assert(pairing && stats);
+    MUTEX_LOCK(pairing->verified_mutex);
+    stats->verified_lookups = pairing->stats.verified_lookups;
+    stats->verified_hits = pairing->stats.verified_hits;
+    MUTEX_UNLOCK(pairing->verified_mutex);
+    MUTEX_LOCK(pairing->ecdh_pool_mutex);
+    stats->keypool_hits = pairing->stats.keypool_hits;
+    stats->keypool_misses = pairing->stats.keypool_misses;
+    stats->srp_pool_hits = pairing->stats.srp_pool_hits;
+    stats->srp_pool_misses = pairing->stats.srp_pool_misses;
+    MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+    MUTEX_LOCK(pairing->srp_cache_mutex);
+    stats->srp_verifier_lookups = pairing->stats.srp_verifier_lookups;
+    stats->srp_verifier_hits = pairing->stats.srp_verifier_hits;
+    MUTEX_UNLOCK(pairing->srp_cache_mutex);
+}
+
 void
 pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE])
 {
@@ -134,6 +370,7 @@ pairing_session_init(pairing_t *pairing)
 
     session->ed_ours = ed25519_key_copy(pairing->ed);
 
+    session->pairing = pairing;
     session->status = STATUS_INITIAL;
     session->srp = NULL;
     session->pair_setup = false;
@@ -173,7 +410,7 @@ pairing_session_handshake(pairing_session_t *session, const unsigned char ecdh_k
     session->ecdh_theirs = x25519_key_from_raw(ecdh_key);
     session->ed_theirs = ed25519_key_from_raw(ed_key);
 
-    session->ecdh_ours = x25519_key_generate();
+    session->ecdh_ours = pairing_take_ecdh_key(session->pairing);
 
     x25519_derive_secret(session->ecdh_secret, session->ecdh_ours, session->ecdh_theirs);
 
@@ -263,6 +500,28 @@ pairing_session_finish(pairing_session_t *session, const unsigned char signature
     return 0;
 }
 
+void
+pairing_session_add_verified_client(pairing_session_t *session)
+{
+    assert(session);
+    if (session->status != STATUS_FINISHED) {
+        return;
+    }
+    pairing_t *pairing = session->pairing;
+    unsigned char pk[ED25519_KEY_SIZE];
+    ed25519_key_get_raw(pk, session->ed_theirs);
+    if (pairing_is_verified_client(pairing, pk)) {
+        return;
+    }
+    MUTEX_LOCK(pairing->verified_mutex);
+    memcpy(pairing->verified[pairing->verified_next], pk, ED25519_KEY_SIZE);
+    pairing->verified_next = (pairing->verified_next + 1) % PAIRING_VERIFIED_CACHE_SIZE;
+    if (pairing->verified_count < PAIRING_VERIFIED_CACHE_SIZE) {
+        pairing->verified_count++;
+    }
+    MUTEX_UNLOCK(pairing->verified_mutex);
+}
+
 void
 pairing_session_destroy(pairing_session_t *session)
 {
@@ -284,6 +543,22 @@ void
 pairing_destroy(pairing_t *pairing)
 {
     if (pairing) {
+        if (pairing->ecdh_pool_running) {
+            MUTEX_LOCK(pairing->ecdh_pool_mutex);
+            pairing->ecdh_pool_running = false;
+            COND_SIGNAL(pairing->ecdh_pool_cond);
+            MUTEX_UNLOCK(pairing->ecdh_pool_mutex);
+            THREAD_JOIN(pairing->ecdh_pool_thread);
+        }
+        for (int i = 0; i < pairing->ecdh_pool_count; i++) {
+            x25519_key_destroy(pairing->ecdh_pool[i]);
+        }
+        memset(pairing->srp_pool, 0, sizeof(pairing->srp_pool));
+        memset(pairing->srp_cache, 0, sizeof(pairing->srp_cache));
+        MUTEX_DESTROY(pairing->ecdh_pool_mutex);
+        COND_DESTROY(pairing->ecdh_pool_cond);
+        MUTEX_DESTROY(pairing->srp_cache_mutex);
+        MUTEX_DESTROY(pairing->verified_mutex);
         ed25519_key_destroy(pairing->ed);
         free(pairing);
     }
@@ -323,34 +598,49 @@ srp_new_user(pairing_session_t *session, pairing_t *pairing, const char *device_
         return -2;
     }
 
-    get_random_bytes(session->srp->private_key, SRP_PRIVATE_KEY_SIZE);
-    
+    srp_ephemeral_t ephemeral;
+    if (pairing_take_srp_ephemeral(pairing, &ephemeral) < 0) {
+        return -2;
+    }
+    memcpy(session->srp->private_key, ephemeral.private_key, SRP_PRIVATE_KEY_SIZE);
+    memcpy(session->srp->public_base, ephemeral.public_base, SRP_PK_SIZE);
+    memset(&ephemeral, 0, sizeof(ephemeral));
+
     const unsigned char *srp_b = session->srp->private_key;
     unsigned char * srp_B;
-    unsigned char * srp_s;
-    unsigned char * srp_v;
     int len_b = SRP_PRIVATE_KEY_SIZE;
     int len_B;
-    int len_s;
-    int len_v;
-    srp_create_salted_verification_key(SRP_SHA, SRP_NG, device_id,
-                                       (const unsigned char *) pin, strlen (pin),
-                                       (const unsigned char **) &srp_s, &len_s,
-                                       (const unsigned char **) &srp_v, &len_v,
-                                       NULL, NULL);
-    if (len_s != SRP_SALT_SIZE || len_v != SRP_VERIFIER_SIZE) {
-        return -3;
-    }
 
-    memcpy(session->srp->salt, srp_s, SRP_SALT_SIZE);
-    memcpy(session->srp->verifier, srp_v, SRP_VERIFIER_SIZE);
+    /* the verifier only changes with the pin (or the client), so is reused while they are the same */
+    if (!pairing_get_srp_verifier(pairing, device_id, pin, session->srp->salt, session->srp->verifier)) {
+        unsigned char * srp_s = NULL;
+        unsigned char * srp_v = NULL;
+        int len_s = 0;
+        int len_v = 0;
+        srp_create_salted_verification_key(SRP_SHA, SRP_NG, device_id,
+                                           (const unsigned char *) pin, strlen (pin),
+                                           (const unsigned char **) &srp_s, &len_s,
+                                           (const unsigned char **) &srp_v, &len_v,
+                                           NULL, NULL);
+        if (len_s != SRP_SALT_SIZE || len_v != SRP_VERIFIER_SIZE) {
+            free(srp_s);
+            free(srp_v);
+            return -3;
+        }
+        memcpy(session->srp->salt, srp_s, SRP_SALT_SIZE);
+        memcpy(session->srp->verifier, srp_v, SRP_VERIFIER_SIZE);
+        free(srp_s);
+        free(srp_v);
+        pairing_add_srp_verifier(pairing, device_id, pin, session->srp->salt, session->srp->verifier);
+    }
 
     *salt = (char *) session->srp->salt;
-    *len_salt = len_s;
+    *len_salt = SRP_SALT_SIZE;
 
     srp_create_server_ephemeral_key(SRP_SHA, SRP_NG,
-                                    srp_v, len_v,
+                                    session->srp->verifier, SRP_VERIFIER_SIZE,
                                     srp_b, len_b,
+                                    session->srp->public_base, SRP_PK_SIZE,
                                     (const unsigned char **) &srp_B, &len_B,
                                     NULL, NULL, 1);
 
@@ -377,6 +667,7 @@ srp_validate_proof(pairing_session_t *session, pairing_t *pairing, const unsigne
                                                     (const unsigned char *) session->srp->verifier, SRP_VERIFIER_SIZE,
                                                     A, len_A,
                                                     b, len_b,
+                                                    session->srp->public_base, SRP_PK_SIZE,
                                                     &B, &len_B, NULL, NULL, 1);
 
     srp_verifier_verify_session(verifier, proof, &M2);
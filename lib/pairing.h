@@ -33,11 +33,31 @@
 #define GCM_AUTHTAG_SIZE 16
 #define SHA512_KEY_LENGTH 64
 
+#define PAIRING_KEY_POOL_SIZE 4         /* pregenerated pair-verify x25519 keys */
+#define PAIRING_VERIFIED_CACHE_SIZE 32  /* remembered pin-registered clients */
+#define PAIRING_SRP_POOL_SIZE 2         /* pregenerated pair-setup-pin SRP ephemeral keys */
+#define PAIRING_SRP_CACHE_SIZE 8        /* SRP verifiers for the current pin, by client */
+
 typedef struct pairing_s pairing_t;
 typedef struct pairing_session_s pairing_session_t;
 
+typedef struct pairing_stats_s {
+    unsigned long verified_lookups;
+    unsigned long verified_hits;
+    unsigned long keypool_hits;
+    unsigned long keypool_misses;
+    unsigned long srp_pool_hits;
+    unsigned long srp_pool_misses;
+    unsigned long srp_verifier_lookups;
+    unsigned long srp_verifier_hits;
+} pairing_stats_t;
+
 pairing_t *pairing_init_generate(const char *device_id, const char *keyfile, int *result);
 void pairing_get_public_key(pairing_t *pairing, unsigned char public_key[ED25519_KEY_SIZE]);
+bool pairing_is_verified_client(pairing_t *pairing, const unsigned char pk[ED25519_KEY_SIZE]);
+void pairing_get_stats(pairing_t *pairing, pairing_stats_t *stats);
+/* starts pregenerating SRP ephemeral keys for pair-setup-pin (when a pin will be used) */
+void pairing_enable_srp_pool(pairing_t *pairing);
 
 pairing_session_t *pairing_session_init(pairing_t *pairing);
 void pairing_session_set_setup_status(pairing_session_t *session);
@@ -48,6 +68,8 @@ int pairing_session_get_public_key(pairing_session_t *session, unsigned char ecd
 int random_pin();
 int pairing_session_get_signature(pairing_session_t *session, unsigned char signature[PAIRING_SIG_SIZE]);
 int pairing_session_finish(pairing_session_t *session, const unsigned char signature[PAIRING_SIG_SIZE]);
+/* after pairing_session_finish(), remembers the client key so later pair-verify can skip the check_register callback */
+void pairing_session_add_verified_client(pairing_session_t *session);
 void pairing_session_destroy(pairing_session_t *session);
 
 void pairing_destroy(pairing_t *pairing);
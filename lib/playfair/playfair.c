@@ -10,18 +10,21 @@ void x_xor(unsigned char* in, unsigned char* out, int blocks);
 
 extern unsigned char default_sap[];
 
-void playfair_decrypt(unsigned char* message3, unsigned char* cipherText, unsigned char* keyOut)
+void playfair_session_init(unsigned char* message3, playfair_session_t* session)
+{
+	unsigned char sapKey[16];
+	generate_session_key(default_sap, message3, sapKey);
+	generate_key_schedule(sapKey, session->key_schedule);
+}
+
+void playfair_session_decrypt(playfair_session_t* session, unsigned char* cipherText, unsigned char* keyOut)
 {
 	unsigned char* chunk1 = &cipherText[16];
 	unsigned char* chunk2 = &cipherText[56];
 	int i;
 	unsigned char blockIn[16];
-	unsigned char sapKey[16];
-	uint32_t key_schedule[11][4];
-	generate_session_key(default_sap, message3, sapKey);	
-	generate_key_schedule(sapKey, key_schedule);
 	z_xor(chunk2, blockIn, 1);
-	cycle(blockIn, key_schedule);
+	cycle(blockIn, session->key_schedule);
 	for (i = 0; i < 16; i++) {
 		keyOut[i] = blockIn[i] ^ chunk1[i];
 	}
@@ -29,3 +32,9 @@ void playfair_decrypt(unsigned char* message3, unsigned char* cipherText, unsign
 	z_xor(keyOut, keyOut, 1);
 }
 
+void playfair_decrypt(unsigned char* message3, unsigned char* cipherText, unsigned char* keyOut)
+{
+	playfair_session_t session;
+	playfair_session_init(message3, &session);
+	playfair_session_decrypt(&session, cipherText, keyOut);
+}
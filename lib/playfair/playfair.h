@@ -1,6 +1,16 @@
 #ifndef PLAYFAIR_H
 #define PLAYFAIR_H
 
+#include <stdint.h>
+
+/* the key schedule derived from message3 (fp-setup message 3), which can be reused for every */
+/* key decrypted with the same message3                                                       */
+typedef struct playfair_session_s {
+	uint32_t key_schedule[11][4];
+} playfair_session_t;
+
 void playfair_decrypt(unsigned char* message3, unsigned char* cipherText, unsigned char* keyOut);
+void playfair_session_init(unsigned char* message3, playfair_session_t* session);
+void playfair_session_decrypt(playfair_session_t* session, unsigned char* cipherText, unsigned char* keyOut);
 
 #endif
@@ -39,14 +39,21 @@ void sap_hash(unsigned char* blockIn, unsigned char* keyOut)
       buffer1[i] = in_byte;
    }
    // Next a scrambling
+   // We have to do unsigned, 32-bit modulo, or we get the wrong indices: the indices
+   // ((i-155) & 0xffffffff) % 210 etc. are stepped instead of divided, starting from their
+   // values at i = 0 (101, 199, 33), and restarting at 0 when i - 155 (etc.) reaches 0
+   unsigned int xi = 101, yi = 199, zi = 33, wi = 0;
    for (i = 0; i < 840; i++)
    {
-      // We have to do unsigned, 32-bit modulo, or we get the wrong indices
-      x = buffer1[((i-155) & 0xffffffff) % 210];
-      y = buffer1[((i-57) & 0xffffffff) % 210];
-      z = buffer1[((i-13) & 0xffffffff) % 210];
-      w = buffer1[(i & 0xffffffff) % 210];
-      buffer1[i % 210] = (rol8(y, 5) + (rol8(z, 3) ^ w) - rol8(x,7)) & 0xff;
+      x = buffer1[xi];
+      y = buffer1[yi];
+      z = buffer1[zi];
+      w = buffer1[wi];
+      buffer1[wi] = (rol8(y, 5) + (rol8(z, 3) ^ w) - rol8(x,7)) & 0xff;
+      xi = (i + 1 == 155 || xi == 209) ? 0 : xi + 1;
+      yi = (i + 1 == 57 || yi == 209) ? 0 : yi + 1;
+      zi = (i + 1 == 13 || zi == 209) ? 0 : zi + 1;
+      wi = (wi == 209) ? 0 : wi + 1;
    }
    printf("Garbling...\n");
    // I have no idea what this is doing (yet), but it gives the right output
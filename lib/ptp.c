@@ -0,0 +1,106 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include "ptp.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+
+static uint64_t
+ptp_get_be(const unsigned char *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static void
+ptp_put_be(unsigned char *data, int bytes, uint64_t value)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        data[i] = (unsigned char) (value & 0xff);
+        value >>= 8;
+    }
+}
+
+int
+ptp_parse_header(const unsigned char *data, int len, ptp_header_t *header)
+{
+    assert(data && header);
+    if (len < PTP_HEADER_LEN) {
+        return -1;
+    }
+    header->message_type = data[0] & 0x0f;
+    header->version = data[1] & 0x0f;
+    header->length = (unsigned short) ptp_get_be(data + 2, 2);
+    if (header->version != 2 || header->length < PTP_HEADER_LEN || header->length > len) {
+        return -1;
+    }
+    header->domain = data[4];
+    header->flags = (unsigned short) ptp_get_be(data + 6, 2);
+    header->correction = ((int64_t) ptp_get_be(data + 8, 8)) >> 16;
+    header->clock_id = ptp_get_be(data + 20, 8);
+    header->port_number = (unsigned short) ptp_get_be(data + 28, 2);
+    header->sequence_id = (unsigned short) ptp_get_be(data + 30, 2);
+    return 0;
+}
+
+int
+ptp_get_timestamp(const unsigned char *data, int len, uint64_t *nsecs)
+{
+    /* 48 bit seconds, 32 bit nanoseconds */
+    if (len < PTP_HEADER_LEN + 10) {
+        return -1;
+    }
+    uint64_t seconds = ptp_get_be(data + PTP_HEADER_LEN, 6);
+    uint64_t nanoseconds = ptp_get_be(data + PTP_HEADER_LEN + 6, 4);
+    if (nanoseconds >= SECOND_IN_NSECS) {
+        return -1;
+    }
+    *nsecs = seconds * SECOND_IN_NSECS + nanoseconds;
+    return 0;
+}
+
+int
+ptp_get_requesting_port(const unsigned char *data, int len, uint64_t *clock_id, unsigned short *port_number)
+{
+    if (len < PTP_HEADER_LEN + 20) {
+        return -1;
+    }
+    *clock_id = ptp_get_be(data + PTP_HEADER_LEN + 10, 8);
+    *port_number = (unsigned short) ptp_get_be(data + PTP_HEADER_LEN + 18, 2);
+    return 0;
+}
+
+int
+ptp_build_delay_req(unsigned char *data, unsigned char domain, uint64_t clock_id, unsigned short sequence_id)
+{
+    memset(data, 0, PTP_DELAY_REQ_LEN);
+    data[0] = PTP_DELAY_REQ;
+    data[1] = 2;
+    ptp_put_be(data + 2, 2, PTP_DELAY_REQ_LEN);
+    data[4] = domain;
+    ptp_put_be(data + 20, 8, clock_id);
+    ptp_put_be(data + 28, 2, 1);
+    ptp_put_be(data + 30, 2, sequence_id);
+    data[32] = 0x01;   /* controlField: Delay_Req */
+    data[33] = 0x7f;   /* logMessageInterval */
+    /* the originTimestamp is left at zero: the transmit time is taken locally */
+    return PTP_DELAY_REQ_LEN;
+}
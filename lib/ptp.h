@@ -0,0 +1,67 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * IEEE 1588 (PTPv2) message encoding/decoding, for the PTP timing used by AirPlay 2
+ * clients: UxPlay acts as a PTP slave, using the master's two-step Sync/Follow_Up
+ * messages and its own Delay_Req / Delay_Resp exchanges.
+ */
+
+#ifndef PTP_H
+#define PTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PTP_EVENT_PORT    319
+#define PTP_GENERAL_PORT  320
+
+#define PTP_SYNC          0x0
+#define PTP_DELAY_REQ     0x1
+#define PTP_FOLLOW_UP     0x8
+#define PTP_DELAY_RESP    0x9
+#define PTP_ANNOUNCE      0xb
+#define PTP_SIGNALING     0xc
+
+#define PTP_FLAG_TWO_STEP 0x0200
+
+#define PTP_HEADER_LEN     34
+#define PTP_DELAY_REQ_LEN  44
+
+typedef struct ptp_header_s {
+    unsigned char message_type;
+    unsigned char version;
+    unsigned short length;
+    unsigned char domain;
+    unsigned short flags;
+    int64_t correction;           /* nsecs (the 2^-16 nsec fraction is dropped) */
+    uint64_t clock_id;            /* sourcePortIdentity */
+    unsigned short port_number;
+    unsigned short sequence_id;
+} ptp_header_t;
+
+/* returns 0 if data[len] starts with a valid PTPv2 header, otherwise -1 */
+int ptp_parse_header(const unsigned char *data, int len, ptp_header_t *header);
+
+/* the timestamp that starts the body of Sync, Follow_Up and Delay_Resp messages, in nsecs */
+int ptp_get_timestamp(const unsigned char *data, int len, uint64_t *nsecs);
+
+/* the requestingPortIdentity of a Delay_Resp message */
+int ptp_get_requesting_port(const unsigned char *data, int len, uint64_t *clock_id, unsigned short *port_number);
+
+/* writes a Delay_Req message to data (at least PTP_DELAY_REQ_LEN bytes); returns its length */
+int ptp_build_delay_req(unsigned char *data, unsigned char domain, uint64_t clock_id, unsigned short sequence_id);
+
+#endif //PTP_H
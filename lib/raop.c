@@ -30,8 +30,20 @@
 #include "netutils.h"
 #include "logger.h"
 #include "compat.h"
+#include "threads.h"
+#include "utils.h"
 #include "raop_rtp_mirror.h"
 #include "raop_ntp.h"
+#include "raop_buffered.h"
+#include "frame_pool.h"
+#include "mirror_queue.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "capture.h"
+#include "session_loop.h"
+
+/* raop_drop_connections: longest wait for sessions to end (teardown joins their threads) */
+#define RAOP_DROP_TIMEOUT_MS 2000
 
 struct raop_s {
     /* Callbacks for audio and video */
@@ -55,23 +67,69 @@ struct raop_s {
 
     /* configurable plist items: width, height, refreshRate, maxFPS, overscanned *
      * also clientFPSdata, which controls whether video stream info received     *
-     * from the client is shown on terminal monitor.                             */
+     * from the client is shown on terminal monitor, and h265, which allows     *
+     * h265 mirror video to be accepted.                                         */
     uint16_t width;
     uint16_t height;
     uint8_t refreshRate;
     uint8_t maxFPS;
     uint8_t overscanned;
     uint8_t clientFPSdata;
+    uint8_t h265;
+
+    /* accept clients that request PTP (AirPlay 2) timing, and buffered audio streams */
+    uint8_t ptp;
+    uint8_t buffered_audio;
 
     int audio_delay_micros;
     int max_ntp_timeouts;
 
+    /* audio jitter buffer latency limits (0: use defaults) */
+    int audio_buffer_min_ms;
+    int audio_buffer_max_ms;
+
+    /* audio data socket tuning: SO_RCVBUF (bytes), SO_BUSY_POLL (usecs) (0: use defaults) */
+    int audio_rcvbuf;
+    int audio_busy_poll;
+
+    /* depth of the queue between the mirror receive and video delivery threads (0: no queue) */
+    int video_queue_depth;
+
+    /* receive the mirror video stream with io_uring */
+    bool mirror_io_uring;
+
+    /* run each session's NTP, audio and mirror sockets on one event-loop thread */
+    bool session_loop;
+
      /* for temporary storage of pin during pair-pin start */
      unsigned short pin;
      bool use_pin;
   
      /* public key as string */
      char pk_str[2*ED25519_KEY_SIZE + 1];
+
+     /* video frame buffers, reused across mirror sessions */
+     frame_pool_t *frame_pool;
+
+     /* concurrent client sessions (default 1), the session slots in use, and the CPUs *
+      * that each session's media threads run on (0: not pinned)                      */
+     int max_sessions;
+     bool session_used[RAOP_MAX_SESSIONS];
+     uint64_t session_cpus[RAOP_MAX_SESSIONS];
+     mutex_handle_t session_mutex;
+
+     /* serialized /info response, valid until the configuration changes */
+     char *info_cache;
+     int info_cache_len;
+     uint64_t info_features;
+     uint64_t info_requests;
+     uint64_t info_builds;
+     mutex_handle_t info_mutex;
+
+     /* if set, each client session is captured to a file in this directory (capture_count is *
+      * guarded by session_mutex)                                                              */
+     char *capture_dir;
+     int capture_count;
 };
 
 struct raop_conn_s {
@@ -79,6 +137,7 @@ struct raop_conn_s {
     raop_ntp_t *raop_ntp;
     raop_rtp_t *raop_rtp;
     raop_rtp_mirror_t *raop_rtp_mirror;
+    raop_buffered_t *raop_buffered;
     fairplay_t *fairplay;
     pairing_session_t *session;
 
@@ -93,6 +152,25 @@ struct raop_conn_s {
     connection_type_t connection_type; 
 
     bool have_active_remote;
+
+    /* session capture (raop_set_capture_dir), with the stream keys from the first SETUP */
+    capture_t *capture;
+    unsigned char capture_aeskey[RAOP_AESKEY_LEN];
+    unsigned char capture_aesiv[RAOP_AESIV_LEN];
+
+    /* pair-verify of a pin-registered client: start time (monotonic nsecs) */
+    bool pair_verify_registered;
+    uint64_t pair_verify_start;
+
+    /* pair-setup-pin: server processing time of the SRP steps (nsecs) */
+    uint64_t pair_setup_nsecs;
+
+    /* session slot of this client (-1: none), and its copy of the callbacks (with the session's cls) */
+    int session_id;
+    raop_callbacks_t callbacks;
+
+    /* event loop for the NTP, audio and mirror sockets (raop->session_loop), created at the first SETUP */
+    session_loop_t *session_loop;
 };
 typedef struct raop_conn_s raop_conn_t;
 
@@ -113,6 +191,7 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
     conn->raop_rtp = NULL;
     conn->raop_rtp_mirror = NULL;
     conn->raop_ntp = NULL;
+    conn->raop_buffered = NULL;
     conn->fairplay = fairplay_init(raop->logger);
 
     if (!conn->fairplay) {
@@ -149,6 +228,9 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
     conn->connection_type = CONNECTION_TYPE_UNKNOWN;
 
     conn->have_active_remote = false;
+
+    conn->session_id = -1;
+    memcpy(&conn->callbacks, &raop->callbacks, sizeof(raop_callbacks_t));
     
     if (raop->callbacks.conn_init) {
         raop->callbacks.conn_init(raop->callbacks.cls);
@@ -157,6 +239,50 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
     return conn;
 }
 
+/* assigns a free session slot to a new client connection; returns false if all are in use */
+static bool
+conn_session_init(raop_conn_t *conn) {
+    raop_t *raop = conn->raop;
+    MUTEX_LOCK(raop->session_mutex);
+    for (int i = 0; i < raop->max_sessions; i++) {
+        if (!raop->session_used[i]) {
+            raop->session_used[i] = true;
+            conn->session_id = i;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(raop->session_mutex);
+    if (conn->session_id < 0) {
+        return false;
+    }
+    if (raop->callbacks.session_init) {
+        void *session_cls = raop->callbacks.session_init(raop->callbacks.cls, conn->session_id);
+        if (session_cls) {
+            conn->callbacks.cls = session_cls;
+        }
+    }
+    if (raop->max_sessions > 1) {
+        logger_log(raop->logger, LOGGER_INFO, "client connection assigned to session %d", conn->session_id);
+    }
+    return true;
+}
+
+static void
+conn_session_destroy(raop_conn_t *conn) {
+    raop_t *raop = conn->raop;
+    if (conn->session_id < 0) {
+        return;
+    }
+    if (raop->callbacks.session_destroy) {
+        raop->callbacks.session_destroy(raop->callbacks.cls, conn->session_id);
+    }
+    MUTEX_LOCK(raop->session_mutex);
+    raop->session_used[conn->session_id] = false;
+    MUTEX_UNLOCK(raop->session_mutex);
+    conn->session_id = -1;
+    conn->callbacks.cls = raop->callbacks.cls;
+}
+
 static void
 conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     char *response_data = NULL;
@@ -171,7 +297,8 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     const char *cseq = http_request_get_header(request, "CSeq");
 
     if (conn->connection_type == CONNECTION_TYPE_UNKNOWN) {
-        if (httpd_count_connection_type(conn->raop->httpd, CONNECTION_TYPE_RAOP)) {
+        if (httpd_count_connection_type(conn->raop->httpd, CONNECTION_TYPE_RAOP) >= conn->raop->max_sessions ||
+            !conn_session_init(conn)) {
             char ipaddr[40];
             utils_ipaddress_to_string(conn->remotelen, conn->remote, conn->zone_id, ipaddr, (int) (sizeof(ipaddr)));
             logger_log(conn->raop->logger, LOGGER_WARNING, "rejecting new connection request from %s", ipaddr);	  
@@ -186,9 +313,9 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
         const char *active_remote = http_request_get_header(request, "Active-Remote");
         if (active_remote) {
             conn->have_active_remote = true;
-            if (conn->raop->callbacks.export_dacp) {
+            if (conn->callbacks.export_dacp) {
                 const char *dacp_id = http_request_get_header(request, "DACP-ID");
-                conn->raop->callbacks.export_dacp(conn->raop->callbacks.cls, active_remote, dacp_id);
+                conn->callbacks.export_dacp(conn->callbacks.cls, active_remote, dacp_id);
             }
         }
     }
@@ -272,13 +399,36 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
         handler = &raop_handler_flush;
     } else if (!strcmp(method, "TEARDOWN")) {
         handler = &raop_handler_teardown;
+    } else if (!strcmp(method, "SETPEERS")) {
+        handler = &raop_handler_setpeers;
+    } else if (!strcmp(method, "SETRATEANCHORTIME")) {
+        handler = &raop_handler_setrateanchortime;
+    } else if (!strcmp(method, "FLUSHBUFFERED")) {
+        handler = &raop_handler_flushbuffered;
     } else {
         logger_log(conn->raop->logger, LOGGER_INFO, "Unhandled Client Request: %s %s", method, url);
     }
 
-    if (handler != NULL) {
+    uint64_t trace_start = (handler ? trace_begin() : 0);
+    if (handler == &raop_handler_setup && conn->session_id >= 0 && conn->raop->session_cpus[conn->session_id]) {
+        /* the media threads started by SETUP inherit the CPU affinity of this thread */
+        uint64_t cpu_mask = 0;
+        bool restore = (utils_get_thread_affinity(&cpu_mask) == 0);
+        if (utils_set_thread_affinity(conn->raop->session_cpus[conn->session_id])) {
+            logger_log(conn->raop->logger, LOGGER_WARNING, "failed to set the CPU affinity of session %d", conn->session_id);
+        }
+        handler(conn, request, *response, &response_data, &response_datalen);
+        if (restore) {
+            utils_set_thread_affinity(cpu_mask);
+        }
+    } else if (handler != NULL) {
         handler(conn, request, *response, &response_data, &response_datalen);
     }
+    if (trace_start) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s %s", method, url);
+        trace_span("rtsp", name, trace_start, conn->session_id);
+    }
     finish:;
     http_response_add_header(*response, "Server", "AirTunes/"GLOBAL_VERSION);
     http_response_add_header(*response, "CSeq", cseq);    
@@ -341,13 +491,19 @@ conn_destroy(void *ptr) {
         /* This is done in case TEARDOWN was not called */
         raop_rtp_mirror_destroy(conn->raop_rtp_mirror);
     }
+    if (conn->raop_buffered) {
+        raop_buffered_destroy(conn->raop_buffered);
+    }
     if (conn->raop_ntp) {
         raop_ntp_destroy(conn->raop_ntp);
     }
+    session_loop_destroy(conn->session_loop);
+    capture_close(conn->capture);
 
-    if (conn->raop->callbacks.video_flush) {
-        conn->raop->callbacks.video_flush(conn->raop->callbacks.cls);
+    if (conn->callbacks.video_flush) {
+        conn->callbacks.video_flush(conn->callbacks.cls);
     }
+    conn_session_destroy(conn);
 
     free(conn->local);
     free(conn->remote);
@@ -382,6 +538,13 @@ raop_init(raop_callbacks_t *callbacks) {
     /* Initialize the logger */
     raop->logger = logger_init();
 
+    raop->frame_pool = frame_pool_init(raop->logger);
+    if (!raop->frame_pool) {
+        logger_destroy(raop->logger);
+        free(raop);
+        return NULL;
+    }
+
     /* Copy callbacks structure */
     memcpy(&raop->callbacks, callbacks, sizeof(raop_callbacks_t));
 
@@ -406,9 +569,24 @@ raop_init(raop_callbacks_t *callbacks) {
     /* initialize switch for display of client's streaming data records */    
     raop->clientFPSdata = 0;
 
+    /* h265 video is not accepted unless enabled */
+    raop->h265 = 0;
+
+    /* PTP timing is not accepted unless enabled */
+    raop->ptp = 0;
+    raop->buffered_audio = 0;
+
+    raop->video_queue_depth = MIRROR_QUEUE_DEFAULT_DEPTH;
+
     raop->max_ntp_timeouts = 0;
     raop->audio_delay_micros = 250000;
 
+    raop->max_sessions = 1;
+    MUTEX_CREATE(raop->session_mutex);
+
+    raop->info_cache = NULL;
+    MUTEX_CREATE(raop->info_mutex);
+
     return raop;
 }
 
@@ -466,6 +644,16 @@ raop_destroy(raop_t *raop) {
         raop_stop(raop);
         pairing_destroy(raop->pairing);
         httpd_destroy(raop->httpd);
+        frame_pool_destroy(raop->frame_pool);
+        MUTEX_DESTROY(raop->session_mutex);
+        if (raop->info_requests) {
+            logger_log(raop->logger, LOGGER_DEBUG, "/info: %llu requests, %llu served from the cached response",
+                       (unsigned long long) raop->info_requests,
+                       (unsigned long long) (raop->info_requests - raop->info_builds));
+        }
+        free(raop->info_cache);
+        MUTEX_DESTROY(raop->info_mutex);
+        free(raop->capture_dir);
         logger_destroy(raop->logger);
         free(raop);
 
@@ -488,11 +676,22 @@ raop_set_log_level(raop_t *raop, int level) {
     logger_set_level(raop->logger, level);
 }
 
+static void
+raop_invalidate_info(raop_t *raop) {
+    MUTEX_LOCK(raop->info_mutex);
+    free(raop->info_cache);
+    raop->info_cache = NULL;
+    MUTEX_UNLOCK(raop->info_mutex);
+}
+
 int raop_set_plist(raop_t *raop, const char *plist_item, const int value) {
     int retval = 0;
     assert(raop);
     assert(plist_item);
-    
+    /* may be called at runtime (e.g. -adaptive): the values read by raop_info_build are stored, *
+     * and the /info cache is invalidated, under info_mutex, so no stale response is cached      */
+    MUTEX_LOCK(raop->info_mutex);
+
     if (strcmp(plist_item, "width") == 0) {
         raop->width = (uint16_t) value;
         if ((int) raop->width != value) retval = 1;
@@ -511,6 +710,15 @@ int raop_set_plist(raop_t *raop, const char *plist_item, const int value) {
     } else if (strcmp(plist_item, "clientFPSdata") == 0) {
         raop->clientFPSdata = (value ? 1 : 0);
         if ((int) raop->clientFPSdata  != value) retval = 1;
+    } else if (strcmp(plist_item, "h265") == 0) {
+        raop->h265 = (value ? 1 : 0);
+        if ((int) raop->h265  != value) retval = 1;
+    } else if (strcmp(plist_item, "ptp") == 0) {
+        raop->ptp = (value ? 1 : 0);
+        if ((int) raop->ptp  != value) retval = 1;
+    } else if (strcmp(plist_item, "buffered_audio") == 0) {
+        raop->buffered_audio = (value ? 1 : 0);
+        if ((int) raop->buffered_audio  != value) retval = 1;
     } else if (strcmp(plist_item, "max_ntp_timeouts") == 0) {
         raop->max_ntp_timeouts = (value > 0 ? value : 0);
         if (raop->max_ntp_timeouts != value) retval = 1;
@@ -519,15 +727,66 @@ int raop_set_plist(raop_t *raop, const char *plist_item, const int value) {
             raop->audio_delay_micros = value;
         }
         if (raop->audio_delay_micros != value) retval = 1;
+    } else if (strcmp(plist_item, "audio_buffer_min_ms") == 0) {
+        raop->audio_buffer_min_ms = (value > 0 && value <= 3000 ? value : 0);
+        if (raop->audio_buffer_min_ms != value) retval = 1;
+    } else if (strcmp(plist_item, "audio_buffer_max_ms") == 0) {
+        raop->audio_buffer_max_ms = (value > 0 && value <= 3000 ? value : 0);
+        if (raop->audio_buffer_max_ms != value) retval = 1;
+    } else if (strcmp(plist_item, "video_queue_depth") == 0) {
+        raop->video_queue_depth = (value < 0 ? 0 : (value > MIRROR_QUEUE_MAX_DEPTH ? MIRROR_QUEUE_MAX_DEPTH : value));
+        if (raop->video_queue_depth != value) retval = 1;
+    } else if (strcmp(plist_item, "mirror_io_uring") == 0) {
+        raop->mirror_io_uring = (value != 0);
+    } else if (strcmp(plist_item, "session_loop") == 0) {
+        raop->session_loop = (value != 0);
+    } else if (strcmp(plist_item, "audio_rcvbuf") == 0) {
+        raop->audio_rcvbuf = (value > 0 ? value : 0);
+        if (raop->audio_rcvbuf != value) retval = 1;
+    } else if (strcmp(plist_item, "audio_busy_poll") == 0) {
+        raop->audio_busy_poll = (value > 0 ? value : 0);
+        if (raop->audio_busy_poll != value) retval = 1;
+    } else if (strcmp(plist_item, "max_connections") == 0) {
+        /* maximum number of simultaneous http connections (default 12), must be set before raop_start */
+        if (!raop->httpd || httpd_set_max_connections(raop->httpd, value)) {
+            retval = 1;
+        }
+    } else if (strcmp(plist_item, "httpd_workers") == 0) {
+        /* threads handling RTSP requests (0: the httpd thread itself), must be set before raop_start */
+        if (!raop->httpd || httpd_set_workers(raop->httpd, value)) {
+            retval = 1;
+        }
+    } else if (strcmp(plist_item, "max_sessions") == 0) {
+        /* concurrent client sessions (1 - RAOP_MAX_SESSIONS), each with its own media streams */
+        raop->max_sessions = (value < 1 ? 1 : (value > RAOP_MAX_SESSIONS ? RAOP_MAX_SESSIONS : value));
+        if (raop->max_sessions != value) retval = 1;
     } else if (strcmp(plist_item, "pin") == 0) {
         raop->pin = value;
         raop->use_pin = true;
+        if (raop->pairing) {
+            pairing_enable_srp_pool(raop->pairing);
+        }
     } else {
         retval = -1;
-    }	  
+    }
+    free(raop->info_cache);
+    raop->info_cache = NULL;
+    MUTEX_UNLOCK(raop->info_mutex);
     return retval;
 }
 
+void
+raop_set_video_offer(raop_t *raop, int width, int height, int max_fps) {
+    assert(raop);
+    MUTEX_LOCK(raop->info_mutex);
+    raop->width = (uint16_t) width;
+    raop->height = (uint16_t) height;
+    raop->maxFPS = (uint8_t) max_fps;
+    free(raop->info_cache);
+    raop->info_cache = NULL;
+    MUTEX_UNLOCK(raop->info_mutex);
+}
+
 void
 raop_set_port(raop_t *raop, unsigned short port) {
     assert(raop);
@@ -549,6 +808,17 @@ raop_set_tcp_ports(raop_t *raop, unsigned short tcp[2]) {
     raop->port = tcp[1];
 }
 
+/* media threads of session session_id are run on the CPUs in cpu_mask (Linux only; 0: no restriction) */
+int
+raop_set_session_cpus(raop_t *raop, int session_id, uint64_t cpu_mask) {
+    assert(raop);
+    if (session_id < 0 || session_id >= RAOP_MAX_SESSIONS) {
+        return -1;
+    }
+    raop->session_cpus[session_id] = cpu_mask;
+    return 0;
+}
+
 unsigned short
 raop_get_port(raop_t *raop) {
     assert(raop);
@@ -561,6 +831,26 @@ raop_get_callback_cls(raop_t *raop) {
     return raop->callbacks.cls;
 }
 
+void
+raop_get_memory(raop_t *raop, raop_memory_t *memory) {
+    assert(raop && memory);
+    frame_pool_get_footprint(raop->frame_pool, &memory->frame_pool_in_use, &memory->frame_pool_cached);
+    memory->httpd = httpd_get_footprint(raop->httpd, &memory->httpd_request_peak);
+}
+
+size_t
+raop_trim_memory(raop_t *raop) {
+    assert(raop);
+    return frame_pool_trim(raop->frame_pool);
+}
+
+int
+raop_set_log_async(raop_t *raop, bool async) {
+    assert(raop);
+
+    return logger_set_async(raop->logger, async);
+}
+
 void
 raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls) {
     assert(raop);
@@ -568,11 +858,19 @@ raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls) {
     logger_set_callback(raop->logger, callback, cls);
 }
 
+void
+raop_set_capture_dir(raop_t *raop, const char *dir) {
+    assert(raop);
+    free(raop->capture_dir);
+    raop->capture_dir = (dir ? strdup(dir) : NULL);
+}
+
 void
 raop_set_dnssd(raop_t *raop, dnssd_t *dnssd) {
     assert(dnssd);
     dnssd_set_pk(dnssd, raop->pk_str);
     raop->dnssd = dnssd;
+    raop_invalidate_info(raop);
 }
 
 
@@ -588,3 +886,9 @@ raop_stop(raop_t *raop) {
     assert(raop);
     httpd_stop(raop->httpd);
 }
+
+int
+raop_drop_connections(raop_t *raop) {
+    assert(raop);
+    return httpd_drop_connections(raop->httpd, RAOP_DROP_TIMEOUT_MS);
+}
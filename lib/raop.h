@@ -18,6 +18,8 @@
 #ifndef RAOP_H
 #define RAOP_H
 
+#include <stddef.h>
+
 #include "dnssd.h"
 #include "stream.h"
 #include "raop_ntp.h"
@@ -34,6 +36,8 @@ extern "C" {
 
 typedef struct raop_s raop_t;
 
+#define RAOP_MAX_SESSIONS 8
+
 typedef void (*raop_log_callback_t)(void *cls, int level, const char *msg);
 
 struct raop_callbacks_s {
@@ -63,8 +67,31 @@ struct raop_callbacks_s {
     void  (*register_client) (void *cls, const char *device_id, const char *pk_str, const char *name);
     bool  (*check_register) (void *cls, const char *pk_str);
     void  (*export_dacp) (void *cls, const char *active_remote, const char *dacp_id);
+    /* Optional: set both to receive and decrypt video directly into renderer-owned buffers (zero-copy) */
+    void* (*video_get_buffer) (void *cls, int size, unsigned char **data);
+    void  (*video_release_buffer) (void *cls, void *buffer);
+    /* Optional: called when the codec (h264 or h265) of the mirror stream is announced by the client */
+    void  (*video_set_codec) (void *cls, video_codec_t codec);
+    /* Optional: called with the properties parsed from the SPS of the mirror stream, before its first keyframe */
+    void  (*video_set_format) (void *cls, const video_sps_info_t *info);
+    /* Optional: called at SETUP of the mirror video stream, before it starts */
+    void  (*video_setup) (void *cls);
+    /* Optional: called with each video streaming performance report sent by the client */
+    void  (*video_report_stats) (void *cls, const client_video_stats_t *stats);
+    /* Optional: called when a client connection is assigned session slot session_id (0 to max_sessions - 1). *
+     * The returned pointer replaces cls in all further callbacks for that client (NULL: keep cls).         */
+    void* (*session_init) (void *cls, int session_id);
+    void  (*session_destroy) (void *cls, int session_id);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
+
+/* memory used by the server (bytes) */
+typedef struct raop_memory_s {
+    size_t frame_pool_in_use;      /* mirror video frames allocated */
+    size_t frame_pool_cached;      /* free mirror frame buffers kept for reuse */
+    size_t httpd;                  /* connection table and work queues */
+    size_t httpd_request_peak;     /* largest request handled */
+} raop_memory_t;
 raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const char *remote,
                           int remote_addr_len, unsigned short timing_rport, timing_protocol_t *time_protocol);
 
@@ -72,15 +99,25 @@ RAOP_API raop_t *raop_init(raop_callbacks_t *callbacks);
 RAOP_API int raop_init2(raop_t *raop, int nohold, const char *device_id, const char *keyfile);
 RAOP_API void raop_set_log_level(raop_t *raop, int level);
 RAOP_API void raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls);
+RAOP_API int raop_set_log_async(raop_t *raop, bool async);
 RAOP_API int raop_set_plist(raop_t *raop, const char *plist_item, const int value);
+/* sets the display width, height and maxFPS offered in /info together (clients never see a mix) */
+RAOP_API void raop_set_video_offer(raop_t *raop, int width, int height, int max_fps);
 RAOP_API void raop_set_port(raop_t *raop, unsigned short port);
 RAOP_API void raop_set_udp_ports(raop_t *raop, unsigned short port[3]);
 RAOP_API void raop_set_tcp_ports(raop_t *raop, unsigned short port[2]);
+RAOP_API void raop_set_capture_dir(raop_t *raop, const char *dir);
+RAOP_API int raop_set_session_cpus(raop_t *raop, int session_id, uint64_t cpu_mask);
 RAOP_API unsigned short raop_get_port(raop_t *raop);
 RAOP_API void *raop_get_callback_cls(raop_t *raop);
+RAOP_API void raop_get_memory(raop_t *raop, raop_memory_t *memory);
+/* releases cached buffers; returns the number of bytes released */
+RAOP_API size_t raop_trim_memory(raop_t *raop);
 RAOP_API int raop_start(raop_t *raop, unsigned short *port);
 RAOP_API int raop_is_running(raop_t *raop);
 RAOP_API void raop_stop(raop_t *raop);
+/* ends all client sessions, but keeps the server (and its listening sockets) running */
+RAOP_API int raop_drop_connections(raop_t *raop);
 RAOP_API void raop_set_dnssd(raop_t *raop, dnssd_t *dnssd);
 RAOP_API void raop_destroy(raop_t *raop);
 
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "raop_buffer.h"
 #include "raop_rtp.h"
@@ -32,21 +33,58 @@
 #include "global.h"
 #include "utils.h"
 #include "byteutils.h"
-
-#define RAOP_BUFFER_LENGTH 32
+#include "metrics.h"
+
+/* The buffer has RAOP_BUFFER_LENGTH slots, but its "depth" (how many packets may be queued  *
+ * behind a missing one while waiting for its resend) adapts between min_depth and max_depth *
+ * to the measured inter-arrival jitter (RFC 3550) and loss rate.  The default depth limits  *
+ * can be replaced by minimum and maximum latencies (converted using the packet duration).   */
+#define SECOND_IN_NSECS 1000000000UL
+
+#define RAOP_BUFFER_LENGTH 256     /* must divide 65536 */
+#define RAOP_BUFFER_MIN_DEPTH 32   /* fixed buffer length used previously */
+#define RAOP_BUFFER_MAX_DEPTH 64
+#define RAOP_BUFFER_WINDOW 256     /* packets between depth adaptations */
+#define RAOP_BUFFER_REORDER 2      /* packets by which a missing packet must be overtaken before a resend request */
+
+/* Resend (NACK) scheduling: a missing packet is asked for once it has been missing for a hold-off    *
+ * (twice the jitter, but at most half the resend round-trip time), and again if it has not arrived  *
+ * after a retransmission timeout (RFC 6298, from measured request -> resent packet times), up to     *
+ * RAOP_NACK_MAX_TRIES times.  Missing packets separated by at most RAOP_NACK_COALESCE received ones  *
+ * share one request, and no request is made for a packet that would be given up (dequeued as lost)  *
+ * before a resend could arrive.                                                                      */
+#define RAOP_NACK_MAX_TRIES 3
+#define RAOP_NACK_COALESCE 2
+#define RAOP_NACK_MAX_REQUESTS 4                  /* requests per raop_buffer_handle_resends call */
+#define RAOP_NACK_INITIAL_RTT (20 * 1000000LL)    /* nsecs */
+#define RAOP_NACK_MIN_RTO (10 * 1000000LL)
+
+/* decrypted payloads are stored in a preallocated slab of RAOP_BUFFER_LENGTH fixed-size slots (AAC-ELD and *
+ * ALAC packets are typically well below this size); a larger payload uses a per-entry heap buffer, which is *
+ * kept for reuse.  Dequeued payloads are lent to the caller, not handed off.                             */
+#define RAOP_BUFFER_SLOT_SIZE 2048
 
 typedef struct {
     /* Data available */
     int filled;
 
+    /* resend state of this (missing) seqnum: found missing at missing_time, then resend_requested *
+     * requests made (the latest at missing_time); resend_expired: no (further) request is useful   */
+    int missing;
+    int resend_requested;
+    int resend_expired;
+    uint64_t missing_time;
+
     /* RTP header */
     unsigned short seqnum;
     uint64_t rtp_timestamp;
     uint64_t ntp_timestamp;
 
-    /* Payload data */
+    /* Payload data (in slab, or oversize_data) */
     unsigned int payload_size;
-    void *payload_data;
+    unsigned char *payload_data;
+    unsigned char *oversize_data;
+    unsigned int oversize_len;
 } raop_buffer_entry_t;
 
 struct raop_buffer_s {
@@ -61,8 +99,54 @@ struct raop_buffer_s {
 
     /* RTP buffer entries */
     raop_buffer_entry_t entries[RAOP_BUFFER_LENGTH];
+    unsigned char *slab;
+
+    /* adaptive depth */
+    int depth;
+    int min_depth;
+    int max_depth;
+    int min_latency_ms;
+    int max_latency_ms;
+    int window_count;
+    int window_lost;
+
+    /* jitter measurement: nsecs per rtp tick, and estimated packet duration */
+    double rtp_clock_rate;
+    double packet_nsecs;
+    double jitter_nsecs;
+    bool have_transit;
+    uint64_t last_arrival;
+    uint64_t last_rtp_timestamp;
+    unsigned short last_arrival_seqnum;
+
+    /* counters */
+    uint64_t received;
+    uint64_t late;
+    uint64_t lost;
+    uint64_t recovered;
+    uint64_t resend_requests;
+    uint64_t resend_packets;
+    uint64_t resend_expired;
+
+    /* resend round-trip time estimate (RFC 6298 smoothed RTT and variation) */
+    double srtt_nsecs;
+    double rttvar_nsecs;
 };
 
+static short
+seqnum_cmp(unsigned short s1, unsigned short s2)
+{
+    return (s1 - s2);
+}
+
+static uint64_t
+raop_buffer_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
 raop_buffer_t *
 raop_buffer_init(logger_t *logger,
                  const unsigned char *aeskey,
@@ -75,6 +159,11 @@ raop_buffer_init(logger_t *logger,
     if (!raop_buffer) {
         return NULL;
     }
+    raop_buffer->slab = malloc(RAOP_BUFFER_LENGTH * RAOP_BUFFER_SLOT_SIZE);
+    if (!raop_buffer->slab) {
+        free(raop_buffer);
+        return NULL;
+    }
     raop_buffer->logger = logger;
     // Need to be initialized internally
     raop_buffer->aes_ctx = aes_cbc_init(aeskey, aesiv, AES_DECRYPT);
@@ -83,36 +172,167 @@ raop_buffer_init(logger_t *logger,
         raop_buffer_entry_t *entry = &raop_buffer->entries[i];
         entry->payload_data = NULL;
         entry->payload_size = 0;
+        entry->oversize_data = NULL;
+        entry->oversize_len = 0;
     }
 
     raop_buffer->is_empty = 1;
 
+    raop_buffer->min_depth = RAOP_BUFFER_MIN_DEPTH;
+    raop_buffer->max_depth = RAOP_BUFFER_MAX_DEPTH;
+    raop_buffer->depth = RAOP_BUFFER_MIN_DEPTH;
+
+    raop_buffer->srtt_nsecs = RAOP_NACK_INITIAL_RTT;
+    raop_buffer->rttvar_nsecs = RAOP_NACK_INITIAL_RTT / 2;
+
     return raop_buffer;
 }
 
+static void
+raop_buffer_update_depth_limits(raop_buffer_t *raop_buffer)
+{
+    int min_depth = RAOP_BUFFER_MIN_DEPTH;
+    int max_depth = RAOP_BUFFER_MAX_DEPTH;
+    if (raop_buffer->packet_nsecs > 0) {
+        double packet_msecs = raop_buffer->packet_nsecs / 1000000.0;
+        if (raop_buffer->min_latency_ms) {
+            min_depth = (int) (raop_buffer->min_latency_ms / packet_msecs + 0.5);
+        }
+        if (raop_buffer->max_latency_ms) {
+            max_depth = (int) (raop_buffer->max_latency_ms / packet_msecs + 0.5);
+        }
+    }
+    if (max_depth > RAOP_BUFFER_LENGTH) max_depth = RAOP_BUFFER_LENGTH;
+    if (min_depth < 1) min_depth = 1;
+    if (min_depth > max_depth) min_depth = max_depth;
+    raop_buffer->min_depth = min_depth;
+    raop_buffer->max_depth = max_depth;
+    if (raop_buffer->depth < min_depth) raop_buffer->depth = min_depth;
+    if (raop_buffer->depth > max_depth) raop_buffer->depth = max_depth;
+}
+
 void
-raop_buffer_destroy(raop_buffer_t *raop_buffer)
+raop_buffer_set_latency(raop_buffer_t *raop_buffer, int min_latency_ms, int max_latency_ms)
+{
+    assert(raop_buffer);
+    raop_buffer->min_latency_ms = (min_latency_ms > 0 ? min_latency_ms : 0);
+    raop_buffer->max_latency_ms = (max_latency_ms > 0 ? max_latency_ms : 0);
+    raop_buffer_update_depth_limits(raop_buffer);
+}
+
+void
+raop_buffer_set_rtp_clock_rate(raop_buffer_t *raop_buffer, double rtp_clock_rate)
+{
+    assert(raop_buffer);
+    raop_buffer->rtp_clock_rate = rtp_clock_rate;
+    raop_buffer->have_transit = false;
+}
+
+void
+raop_buffer_get_stats(raop_buffer_t *raop_buffer, raop_buffer_stats_t *stats)
 {
+    assert(raop_buffer && stats);
+    stats->depth = raop_buffer->depth;
+    stats->min_depth = raop_buffer->min_depth;
+    stats->max_depth = raop_buffer->max_depth;
+    stats->jitter_ms = raop_buffer->jitter_nsecs / 1000000.0;
+    stats->packet_ms = raop_buffer->packet_nsecs / 1000000.0;
+    stats->received = raop_buffer->received;
+    stats->late = raop_buffer->late;
+    stats->lost = raop_buffer->lost;
+    stats->recovered = raop_buffer->recovered;
+    stats->resend_requests = raop_buffer->resend_requests;
+    stats->resend_packets = raop_buffer->resend_packets;
+    stats->resend_expired = raop_buffer->resend_expired;
+    stats->resend_rtt_ms = raop_buffer->srtt_nsecs / 1000000.0;
+    stats->footprint = sizeof(raop_buffer_t) + RAOP_BUFFER_LENGTH * RAOP_BUFFER_SLOT_SIZE;
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
-        raop_buffer_entry_t *entry = &raop_buffer->entries[i];
-        if (entry->payload_data != NULL) {
-            free(entry->payload_data);
+        stats->footprint += raop_buffer->entries[i].oversize_len;
+    }
+}
+
+static void
+raop_buffer_clear_resend(raop_buffer_entry_t *entry)
+{
+    entry->missing = 0;
+    entry->resend_requested = 0;
+    entry->resend_expired = 0;
+}
+
+/* RFC 6298, from packets that arrived after a single request (Karn's algorithm) */
+static void
+raop_buffer_update_rtt(raop_buffer_t *raop_buffer, uint64_t rtt)
+{
+    double err = (double) rtt - raop_buffer->srtt_nsecs;
+    raop_buffer->srtt_nsecs += err / 8.0;
+    raop_buffer->rttvar_nsecs += ((err < 0 ? -err : err) - raop_buffer->rttvar_nsecs) / 4.0;
+    metrics_set(METRICS_AUDIO_RESEND_RTT, (int64_t) raop_buffer->srtt_nsecs);
+}
+
+/* called every RAOP_BUFFER_WINDOW dequeued packets */
+static void
+raop_buffer_adapt_depth(raop_buffer_t *raop_buffer)
+{
+    int depth = raop_buffer->depth;
+    raop_buffer_update_depth_limits(raop_buffer);
+    if (raop_buffer->window_lost) {
+        /* packets were lost while waiting for resends: wait longer */
+        depth += (depth / 4 > 2 ? depth / 4 : 2);
+    } else if (raop_buffer->packet_nsecs > 0) {
+        /* enough depth to cover four times the jitter, shrink slowly */
+        int target = (int) (4.0 * raop_buffer->jitter_nsecs / raop_buffer->packet_nsecs) + RAOP_BUFFER_REORDER;
+        if (target > depth) {
+            depth = target;
+        } else if (target < depth) {
+            depth--;
+        }
+    }
+    if (depth < raop_buffer->min_depth) depth = raop_buffer->min_depth;
+    if (depth > raop_buffer->max_depth) depth = raop_buffer->max_depth;
+    if (depth != raop_buffer->depth) {
+        logger_log(raop_buffer->logger, LOGGER_DEBUG, "raop_buffer depth %d -> %d packets (jitter %.2f ms, %d lost"
+                   " in last %d packets)", raop_buffer->depth, depth, raop_buffer->jitter_nsecs / 1000000.0,
+                   raop_buffer->window_lost, raop_buffer->window_count);
+        raop_buffer->depth = depth;
+    }
+    raop_buffer->window_count = 0;
+    raop_buffer->window_lost = 0;
+}
+
+/* RFC 3550 interarrival jitter, from packets received in sequence */
+static void
+raop_buffer_update_jitter(raop_buffer_t *raop_buffer, unsigned short seqnum, uint64_t rtp_timestamp)
+{
+    uint64_t arrival = raop_buffer_get_nsecs();
+    if (raop_buffer->rtp_clock_rate > 0 && raop_buffer->have_transit) {
+        double rtp_elapsed = raop_buffer->rtp_clock_rate * (double) ((int64_t) (rtp_timestamp - raop_buffer->last_rtp_timestamp));
+        double d = (double) ((int64_t) (arrival - raop_buffer->last_arrival)) - rtp_elapsed;
+        if (d < 0) d = -d;
+        raop_buffer->jitter_nsecs += (d - raop_buffer->jitter_nsecs) / 16.0;
+        if (seqnum_cmp(seqnum, raop_buffer->last_arrival_seqnum) == 1 && rtp_elapsed > 0) {
+            raop_buffer->packet_nsecs = rtp_elapsed;
         }
     }
+    raop_buffer->last_arrival = arrival;
+    raop_buffer->last_rtp_timestamp = rtp_timestamp;
+    raop_buffer->last_arrival_seqnum = seqnum;
+    raop_buffer->have_transit = true;
+}
 
+void
+raop_buffer_destroy(raop_buffer_t *raop_buffer)
+{
     if (raop_buffer) {
+        for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
+            free(raop_buffer->entries[i].oversize_data);
+        }
         aes_cbc_destroy(raop_buffer->aes_ctx);
+        free(raop_buffer->slab);
         free(raop_buffer);
     }
 
 }
 
-static short
-seqnum_cmp(unsigned short s1, unsigned short s2)
-{
-    return (s1 - s2);
-}
-
 int
 raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned char* output, unsigned int payload_size, unsigned int *outputlen)
 {
@@ -189,6 +409,8 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
 
     /* If this packet is too late, just skip it */
     if (!raop_buffer->is_empty && seqnum_cmp(seqnum, raop_buffer->first_seqnum) < 0) {
+        raop_buffer->late++;
+        metrics_add(METRICS_AUDIO_PACKETS_LATE, 1);
         return 0;
     }
 
@@ -203,6 +425,18 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
         /* Packet resend, we can safely ignore */
         return 0;
     }
+    if (entry->resend_requested && seqnum_cmp(entry->seqnum, seqnum) == 0) {
+        raop_buffer->recovered++;
+        metrics_add(METRICS_AUDIO_PACKETS_RECOVERED, 1);
+        if (entry->resend_requested == 1) {
+            raop_buffer_update_rtt(raop_buffer, raop_buffer_get_nsecs() - entry->missing_time);
+        }
+    }
+    raop_buffer_clear_resend(entry);
+    raop_buffer->received++;
+    if (raop_buffer->is_empty || seqnum_cmp(seqnum, raop_buffer->last_seqnum) > 0) {
+        raop_buffer_update_jitter(raop_buffer, seqnum, *rtp_timestamp);
+    }
 
     /* Update the raop_buffer entry header */
     entry->seqnum = seqnum;
@@ -210,7 +444,17 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     entry->ntp_timestamp = *ntp_timestamp;
     entry->filled = 1;
 
-    entry->payload_data = malloc(payload_size);
+    if (payload_size <= RAOP_BUFFER_SLOT_SIZE) {
+        entry->payload_data = raop_buffer->slab + (seqnum % RAOP_BUFFER_LENGTH) * RAOP_BUFFER_SLOT_SIZE;
+    } else {
+        if (entry->oversize_len < (unsigned int) payload_size) {
+            free(entry->oversize_data);
+            entry->oversize_data = malloc(payload_size);
+            assert(entry->oversize_data);
+            entry->oversize_len = payload_size;
+        }
+        entry->payload_data = entry->oversize_data;
+    }
     int decrypt_ret = raop_buffer_decrypt(raop_buffer, data, entry->payload_data, payload_size, &entry->payload_size);
     assert(decrypt_ret >= 0);
     assert(entry->payload_size <= payload_size);
@@ -244,17 +488,24 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     if (no_resend) {
         /* If we do no resends, always return the first entry */
     } else if (!entry->filled) {
-        /* Check how much we have space left in the buffer */
-        if (entry_count < RAOP_BUFFER_LENGTH) {
+        /* Check how many packets are queued behind the missing one */
+        if (entry_count < raop_buffer->depth) {
             /* Return nothing and hope resend gets on time */
             return NULL;
         }
-        /* Risk of buffer overrun, return empty buffer */
+        /* Waited long enough, give up on this packet */
     }
 
     /* Update buffer and validate entry */
     raop_buffer->first_seqnum += 1;
+    if (++raop_buffer->window_count >= RAOP_BUFFER_WINDOW) {
+        raop_buffer_adapt_depth(raop_buffer);
+    }
     if (!entry->filled) {
+        raop_buffer_clear_resend(entry);
+        raop_buffer->lost++;
+        metrics_add(METRICS_AUDIO_PACKETS_LOST, 1);
+        raop_buffer->window_lost++;
         return NULL;
     }
     entry->filled = 0;
@@ -265,30 +516,93 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     *seqnum = entry->seqnum;
     *length = entry->payload_size;
     entry->payload_size = 0;
-    void* data = entry->payload_data;
-    entry->payload_data = NULL;
-    return data;
+    return entry->payload_data;
+}
+
+static void
+raop_buffer_send_resend(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque,
+                        unsigned short start, unsigned short end, int packets)
+{
+    unsigned short count = end - start + 1;
+    LOGGER_LOG(raop_buffer->logger, LOGGER_DEBUG, "raop_buffer_handle_resends request seqnum=%u count=%u (%d missing)"
+               " (first_seqnum=%u last seqnum=%u)", start, count, packets, raop_buffer->first_seqnum,
+               raop_buffer->last_seqnum);
+    resend_cb(opaque, start, count);
+    raop_buffer->resend_requests++;
+    raop_buffer->resend_packets += packets;
+    metrics_add(METRICS_AUDIO_RESEND_REQUESTS, 1);
+    metrics_add(METRICS_AUDIO_RESEND_PACKETS, packets);
 }
 
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque) {
     assert(raop_buffer);
     assert(resend_cb);
 
-    if (seqnum_cmp(raop_buffer->first_seqnum, raop_buffer->last_seqnum) < 0) {
-        int seqnum, count;
-        logger_log(raop_buffer->logger, LOGGER_DEBUG, "raop_buffer_handle_resends first_seqnum=%u last seqnum=%u",
-                   raop_buffer->first_seqnum, raop_buffer->last_seqnum);
-        for (seqnum = raop_buffer->first_seqnum; seqnum_cmp(seqnum, raop_buffer->last_seqnum) < 0; seqnum++) {
-            raop_buffer_entry_t *entry = &raop_buffer->entries[seqnum % RAOP_BUFFER_LENGTH];
-            if (entry->filled) {
-                break;
+    /* only consider missing packets that have been overtaken by RAOP_BUFFER_REORDER packets */
+    unsigned short last = raop_buffer->last_seqnum - (RAOP_BUFFER_REORDER - 1);
+    if (raop_buffer->is_empty || seqnum_cmp(raop_buffer->first_seqnum, last) >= 0) {
+        return;
+    }
+
+    uint64_t now = raop_buffer_get_nsecs();
+    double rto = raop_buffer->srtt_nsecs + 4.0 * raop_buffer->rttvar_nsecs;
+    if (rto < RAOP_NACK_MIN_RTO) rto = RAOP_NACK_MIN_RTO;
+    double hold = 2.0 * raop_buffer->jitter_nsecs;
+    if (hold > raop_buffer->srtt_nsecs / 2.0) hold = raop_buffer->srtt_nsecs / 2.0;
+
+    unsigned short seqnum, start = 0, end = 0;
+    int packets = 0, skipped = 0, requests = 0;
+    for (seqnum = raop_buffer->first_seqnum; seqnum_cmp(seqnum, last) < 0; seqnum++) {
+        raop_buffer_entry_t *entry = &raop_buffer->entries[seqnum % RAOP_BUFFER_LENGTH];
+        bool wanted = false;
+        if (!entry->filled) {
+            if (!entry->missing || entry->seqnum != seqnum) {
+                entry->seqnum = seqnum;
+                raop_buffer_clear_resend(entry);
+                entry->missing = 1;
+                entry->missing_time = now;
+            }
+            double waited = (double) (now - entry->missing_time);
+            if (entry->resend_expired) {
+                /* given up */
+            } else if (entry->resend_requested ? waited < rto : waited < hold) {
+                /* in flight, or may still arrive out of order */
+            } else if (entry->resend_requested >= RAOP_NACK_MAX_TRIES) {
+                entry->resend_expired = 1;
+            } else {
+                /* the packet is dequeued as lost when depth packets are queued from it onwards */
+                int remaining = seqnum_cmp(seqnum, raop_buffer->last_seqnum) + raop_buffer->depth - 1;
+                if (raop_buffer->packet_nsecs > 0 && remaining * raop_buffer->packet_nsecs < raop_buffer->srtt_nsecs) {
+                    entry->resend_expired = 1;
+                    raop_buffer->resend_expired++;
+                } else {
+                    wanted = true;
+                }
+            }
+        }
+        if (!wanted) {
+            if (packets && ++skipped > RAOP_NACK_COALESCE) {
+                raop_buffer_send_resend(raop_buffer, resend_cb, opaque, start, end, packets);
+                packets = 0;
+                requests++;
             }
+            continue;
         }
-        if (seqnum_cmp(seqnum, raop_buffer->first_seqnum) == 0) {
-            return;
+        if (!packets) {
+            if (requests == RAOP_NACK_MAX_REQUESTS) {
+                /* the remaining gaps are requested on a later call */
+                break;
+            }
+            start = seqnum;
         }
-        count = seqnum_cmp(seqnum, raop_buffer->first_seqnum);
-        resend_cb(opaque, raop_buffer->first_seqnum, count);
+        end = seqnum;
+        packets++;
+        skipped = 0;
+        entry->resend_requested++;
+        entry->missing_time = now;
+    }
+    if (packets) {
+        raop_buffer_send_resend(raop_buffer, resend_cb, opaque, start, end, packets);
     }
 }
 
@@ -296,12 +610,9 @@ void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq) {
     assert(raop_buffer);
 
     for (int i = 0; i < RAOP_BUFFER_LENGTH; i++) {
-        if (raop_buffer->entries[i].payload_data) {
-            free(raop_buffer->entries[i].payload_data);
-            raop_buffer->entries[i].payload_data = NULL;   
-            raop_buffer->entries[i].payload_size = 0;
-        }
+        raop_buffer->entries[i].payload_size = 0;
         raop_buffer->entries[i].filled = 0;
+        raop_buffer_clear_resend(&raop_buffer->entries[i]);
     }
     if (next_seq < 0 || next_seq > 0xffff) {
         raop_buffer->is_empty = 1;
@@ -25,13 +25,34 @@ typedef struct raop_buffer_s raop_buffer_t;
 
 typedef int (*raop_resend_cb_t)(void *opaque, unsigned short seqno, unsigned short count);
 
+typedef struct raop_buffer_stats_s {
+    int depth;              /* current jitter buffer depth (packets) */
+    int min_depth;
+    int max_depth;
+    double jitter_ms;       /* RFC 3550 interarrival jitter */
+    double packet_ms;       /* audio packet duration */
+    uint64_t received;
+    uint64_t late;          /* arrived after their slot was dequeued */
+    uint64_t lost;          /* never arrived */
+    uint64_t recovered;     /* arrived after a resend request */
+    uint64_t resend_requests;
+    uint64_t resend_packets;  /* missing packets asked for (each request may cover several) */
+    uint64_t resend_expired;  /* not asked for (again): a resend could not arrive in time */
+    double resend_rtt_ms;     /* smoothed time from a request to the resent packet */
+    size_t footprint;         /* bytes allocated (entries, payload slab, oversize payloads) */
+} raop_buffer_stats_t;
+
 raop_buffer_t *raop_buffer_init(logger_t *logger,
                                 const unsigned char *aeskey,
                                 const unsigned char *aesiv);
 int raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t *ntp_timestamp, uint64_t *rtp_timestamp, int use_seqnum);
+/* the returned payload belongs to raop_buffer, and is only valid until the next raop_buffer_enqueue or flush */
 void *raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *ntp_timestamp, uint64_t *rtp_timestamp, unsigned short *seqnum, int no_resend);
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque);
 void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq);
+void raop_buffer_set_latency(raop_buffer_t *raop_buffer, int min_latency_ms, int max_latency_ms);
+void raop_buffer_set_rtp_clock_rate(raop_buffer_t *raop_buffer, double rtp_clock_rate);
+void raop_buffer_get_stats(raop_buffer_t *raop_buffer, raop_buffer_stats_t *stats);
 
 int raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned char* output,
                         unsigned int datalen, unsigned int *outputlen);
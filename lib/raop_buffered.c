@@ -0,0 +1,503 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#ifdef _WIN32
+#define CAST (char *)
+#else
+#define CAST
+#endif
+
+#include "raop_buffered.h"
+#include "thread_config.h"
+#include "netutils.h"
+#include "compat.h"
+#include "threads.h"
+#include "crypto.h"
+#include "stream.h"
+#include "metrics.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define MSEC_IN_NSECS   1000000ULL
+
+#define RAOP_BUFFERED_SAMPLE_RATE 44100
+#define RAOP_BUFFERED_FRAMES      1024     /* about 24 seconds of 1024-sample AAC-LC frames */
+#define RAOP_BUFFERED_FRAME_MAX   2048     /* bytes, after decryption */
+#define RAOP_BUFFERED_RX_SIZE     65536    /* packet lengths are 16 bit */
+#define RAOP_BUFFERED_HEADER_LEN  12       /* RTP header */
+#define RAOP_BUFFERED_TRAILER_LEN 24       /* 16 byte Poly1305 tag, 8 byte nonce */
+#define RAOP_BUFFERED_LEAD        (200 * MSEC_IN_NSECS)   /* frames are delivered this far ahead of time */
+#define RAOP_BUFFERED_MAX_LATE    (20 * MSEC_IN_NSECS)    /* later frames are dropped */
+#define RAOP_BUFFERED_POLL        (20 * MSEC_IN_NSECS)    /* maximum wait in the receive loop */
+
+typedef struct raop_buffered_frame_s {
+    uint32_t seqnum;       /* 24 bit */
+    uint32_t rtp_time;
+    int len;
+    unsigned char data[RAOP_BUFFERED_FRAME_MAX];
+} raop_buffered_frame_t;
+
+struct raop_buffered_s {
+    logger_t *logger;
+    raop_callbacks_t callbacks;
+    raop_ntp_t *ntp;
+    aead_ctx_t *aead_ctx;
+    unsigned char ct;
+    int use_ipv6;
+
+    thread_handle_t thread;
+    mutex_handle_t run_mutex;
+    int running;
+    int joined;
+
+    int lsock;
+    unsigned short data_lport;
+
+    /* ring buffer of decrypted frames: only accessed by the receive thread */
+    raop_buffered_frame_t *frames;
+    int head;
+    int count;
+    unsigned char *rx;
+    int rx_len;
+    bool discard_until_valid;
+    uint32_t discard_until;
+
+    /* set by SETRATEANCHORTIME and FLUSHBUFFERED, applied by the receive thread */
+    mutex_handle_t state_mutex;
+    bool playing;
+    bool anchor_valid;
+    uint32_t anchor_rtp;
+    uint64_t anchor_time;
+    bool flush_pending;
+    bool flush_has_from;
+    uint32_t flush_from;
+    uint32_t flush_until;
+};
+
+/* sequence numbers are 24 bit: true if a comes before b */
+static bool
+seq_before(uint32_t a, uint32_t b)
+{
+    return ((int32_t) ((a - b) << 8)) < 0;
+}
+
+raop_buffered_t *
+raop_buffered_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+                   const unsigned char *key, int use_ipv6, unsigned char ct)
+{
+    raop_buffered_t *raop_buffered;
+    assert(logger && callbacks && ntp && key);
+
+    raop_buffered = calloc(1, sizeof(raop_buffered_t));
+    if (!raop_buffered) {
+        return NULL;
+    }
+    raop_buffered->frames = calloc(RAOP_BUFFERED_FRAMES, sizeof(raop_buffered_frame_t));
+    raop_buffered->rx = malloc(RAOP_BUFFERED_RX_SIZE);
+    if (!raop_buffered->frames || !raop_buffered->rx) {
+        free(raop_buffered->frames);
+        free(raop_buffered->rx);
+        free(raop_buffered);
+        return NULL;
+    }
+    raop_buffered->logger = logger;
+    memcpy(&raop_buffered->callbacks, callbacks, sizeof(raop_callbacks_t));
+    raop_buffered->ntp = ntp;
+    raop_buffered->aead_ctx = aead_init(AEAD_CHACHA20_POLY1305, key, AES_DECRYPT);
+    raop_buffered->use_ipv6 = use_ipv6;
+    raop_buffered->ct = ct;
+    raop_buffered->lsock = -1;
+    raop_buffered->running = 0;
+    raop_buffered->joined = 1;
+    MUTEX_CREATE(raop_buffered->run_mutex);
+    MUTEX_CREATE(raop_buffered->state_mutex);
+    return raop_buffered;
+}
+
+int
+raop_buffered_get_buffer_size(raop_buffered_t *raop_buffered)
+{
+    return RAOP_BUFFERED_FRAMES * RAOP_BUFFERED_FRAME_MAX;
+}
+
+void
+raop_buffered_set_anchor(raop_buffered_t *raop_buffered, bool playing, uint32_t rtp_time, uint64_t network_time)
+{
+    assert(raop_buffered);
+    MUTEX_LOCK(raop_buffered->state_mutex);
+    bool was_playing = raop_buffered->playing;
+    raop_buffered->playing = playing;
+    if (playing) {
+        raop_buffered->anchor_rtp = rtp_time;
+        raop_buffered->anchor_time = network_time;
+        raop_buffered->anchor_valid = true;
+    }
+    MUTEX_UNLOCK(raop_buffered->state_mutex);
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered %s, anchor rtp_time %u at %8.6f", (playing ? "play" : "pause"),
+               rtp_time, (double) network_time / SECOND_IN_NSECS);
+    /* drop the audio already passed to the renderer */
+    if (was_playing && !playing && raop_buffered->callbacks.audio_flush) {
+        raop_buffered->callbacks.audio_flush(raop_buffered->callbacks.cls);
+    }
+}
+
+void
+raop_buffered_flush(raop_buffered_t *raop_buffered, bool has_from, uint32_t from_seq, uint32_t until_seq)
+{
+    assert(raop_buffered);
+    MUTEX_LOCK(raop_buffered->state_mutex);
+    raop_buffered->flush_pending = true;
+    raop_buffered->flush_has_from = has_from;
+    raop_buffered->flush_from = from_seq & 0xffffff;
+    raop_buffered->flush_until = until_seq & 0xffffff;
+    MUTEX_UNLOCK(raop_buffered->state_mutex);
+    if (raop_buffered->callbacks.audio_flush) {
+        raop_buffered->callbacks.audio_flush(raop_buffered->callbacks.cls);
+    }
+}
+
+/* removes the frames in the flushed range from the ring, keeping the order of the others */
+static void
+raop_buffered_apply_flush(raop_buffered_t *raop_buffered, bool has_from, uint32_t from, uint32_t until)
+{
+    int kept = 0;
+    int flushed = 0;
+    for (int i = 0; i < raop_buffered->count; i++) {
+        raop_buffered_frame_t *frame = &raop_buffered->frames[(raop_buffered->head + i) % RAOP_BUFFERED_FRAMES];
+        bool flush = seq_before(frame->seqnum, until) && (!has_from || !seq_before(frame->seqnum, from));
+        if (flush) {
+            flushed++;
+            continue;
+        }
+        if (kept != i) {
+            raop_buffered_frame_t *dest = &raop_buffered->frames[(raop_buffered->head + kept) % RAOP_BUFFERED_FRAMES];
+            dest->seqnum = frame->seqnum;
+            dest->rtp_time = frame->rtp_time;
+            dest->len = frame->len;
+            memcpy(dest->data, frame->data, frame->len);
+        }
+        kept++;
+    }
+    raop_buffered->count = kept;
+    /* frames in the flushed range that are still on their way must also be discarded */
+    raop_buffered->discard_until_valid = true;
+    raop_buffered->discard_until = until;
+    if (kept) {
+        raop_buffered_frame_t *last = &raop_buffered->frames[(raop_buffered->head + kept - 1) % RAOP_BUFFERED_FRAMES];
+        if (!seq_before(last->seqnum, until)) {
+            raop_buffered->discard_until_valid = false;
+        }
+    }
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered flushed %d frames, until seqnum %u", flushed, until);
+}
+
+/* decrypts an audio packet (without its length prefix) into the ring; returns false if it is invalid */
+static bool
+raop_buffered_add_packet(raop_buffered_t *raop_buffered, const unsigned char *packet, int len)
+{
+    unsigned char nonce[12] = { 0 };
+    if (len < RAOP_BUFFERED_HEADER_LEN + RAOP_BUFFERED_TRAILER_LEN ||
+        len - RAOP_BUFFERED_HEADER_LEN - RAOP_BUFFERED_TRAILER_LEN > RAOP_BUFFERED_FRAME_MAX) {
+        return false;
+    }
+    uint32_t seqnum = ((uint32_t) packet[1] << 16) | ((uint32_t) packet[2] << 8) | packet[3];
+    uint32_t rtp_time = ((uint32_t) packet[4] << 24) | ((uint32_t) packet[5] << 16) | ((uint32_t) packet[6] << 8) | packet[7];
+    if (raop_buffered->discard_until_valid) {
+        if (seq_before(seqnum, raop_buffered->discard_until)) {
+            return true;
+        }
+        raop_buffered->discard_until_valid = false;
+    }
+
+    /* nonce: 4 zero bytes, then the last 8 bytes of the packet; the aad is the rtp timestamp and ssrc */
+    memcpy(nonce + 4, packet + len - 8, 8);
+    const unsigned char *tag = packet + len - RAOP_BUFFERED_TRAILER_LEN;
+    int ciphertext_len = len - RAOP_BUFFERED_HEADER_LEN - RAOP_BUFFERED_TRAILER_LEN;
+    raop_buffered_frame_t *frame = &raop_buffered->frames[(raop_buffered->head + raop_buffered->count) % RAOP_BUFFERED_FRAMES];
+    int frame_len = aead_decrypt(raop_buffered->aead_ctx, nonce, packet + 4, 8,
+                                 packet + RAOP_BUFFERED_HEADER_LEN, ciphertext_len, frame->data, tag);
+    if (frame_len < 0) {
+        return false;
+    }
+    frame->seqnum = seqnum;
+    frame->rtp_time = rtp_time;
+    frame->len = frame_len;
+    raop_buffered->count++;
+    metrics_add(METRICS_AUDIO_PACKETS, 1);
+    metrics_add(METRICS_AUDIO_BYTES, len);
+    return true;
+}
+
+/* moves the complete packets received in rx into the ring, while it has space */
+static void
+raop_buffered_parse_rx(raop_buffered_t *raop_buffered, uint64_t *received, uint64_t *invalid)
+{
+    /* each packet has a 16 bit big-endian length prefix (which counts itself) */
+    int pos = 0;
+    while (raop_buffered->count < RAOP_BUFFERED_FRAMES && raop_buffered->rx_len - pos >= 2) {
+        int packet_len = (raop_buffered->rx[pos] << 8) | raop_buffered->rx[pos + 1];
+        if (packet_len < 2) {
+            logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered invalid packet length %d", packet_len);
+            pos = raop_buffered->rx_len;
+            break;
+        }
+        if (raop_buffered->rx_len - pos < packet_len) {
+            break;
+        }
+        if (raop_buffered_add_packet(raop_buffered, raop_buffered->rx + pos + 2, packet_len - 2)) {
+            (*received)++;
+        } else {
+            (*invalid)++;
+        }
+        pos += packet_len;
+    }
+    if (pos) {
+        memmove(raop_buffered->rx, raop_buffered->rx + pos, raop_buffered->rx_len - pos);
+        raop_buffered->rx_len -= pos;
+    }
+}
+
+static THREAD_RETVAL
+raop_buffered_thread(void *arg)
+{
+    raop_buffered_t *raop_buffered = arg;
+    assert(raop_buffered);
+    thread_config_apply(THREAD_CLASS_AUDIO, "uxplay-buffered", raop_buffered->logger);
+    int csock = -1;
+    uint64_t received = 0, late = 0, invalid = 0, underruns = 0;
+    int max_count = 0;
+    bool delivering = false;
+
+    while (1) {
+        MUTEX_LOCK(raop_buffered->run_mutex);
+        if (!raop_buffered->running) {
+            MUTEX_UNLOCK(raop_buffered->run_mutex);
+            break;
+        }
+        MUTEX_UNLOCK(raop_buffered->run_mutex);
+
+        MUTEX_LOCK(raop_buffered->state_mutex);
+        bool playing = raop_buffered->playing && raop_buffered->anchor_valid;
+        uint32_t anchor_rtp = raop_buffered->anchor_rtp;
+        uint64_t anchor_time = raop_buffered->anchor_time;
+        bool flush = raop_buffered->flush_pending;
+        bool flush_has_from = raop_buffered->flush_has_from;
+        uint32_t flush_from = raop_buffered->flush_from;
+        uint32_t flush_until = raop_buffered->flush_until;
+        raop_buffered->flush_pending = false;
+        MUTEX_UNLOCK(raop_buffered->state_mutex);
+        if (flush) {
+            raop_buffered_apply_flush(raop_buffered, flush_has_from, flush_from, flush_until);
+        }
+
+        /* pass the frames that are due to the renderer */
+        uint64_t wait = RAOP_BUFFERED_POLL;
+        while (playing && raop_buffered->count) {
+            raop_buffered_frame_t *frame = &raop_buffered->frames[raop_buffered->head];
+            int64_t elapsed = (int64_t) (int32_t) (frame->rtp_time - anchor_rtp) * (int64_t) SECOND_IN_NSECS / RAOP_BUFFERED_SAMPLE_RATE;
+            uint64_t remote_time = (uint64_t) ((int64_t) anchor_time + elapsed);
+            uint64_t local_time = raop_ntp_convert_remote_time(raop_buffered->ntp, remote_time);
+            uint64_t now = raop_ntp_get_local_time(raop_buffered->ntp);
+            if (local_time > now + RAOP_BUFFERED_LEAD) {
+                uint64_t due = local_time - RAOP_BUFFERED_LEAD - now;
+                wait = (due < wait ? due : wait);
+                break;
+            }
+            if (local_time + RAOP_BUFFERED_MAX_LATE < now) {
+                late++;
+                metrics_add(METRICS_AUDIO_PACKETS_LATE, 1);
+            } else {
+                audio_decode_struct audio_data;
+                audio_data.rtp_time = frame->rtp_time;
+                audio_data.seqnum = (unsigned short) (frame->seqnum & 0xffff);
+                audio_data.data_len = frame->len;
+                audio_data.data = frame->data;
+                audio_data.ct = raop_buffered->ct;
+                audio_data.ntp_time_remote = remote_time;
+                audio_data.ntp_time_local = local_time;
+                audio_data.sync_status = 1;
+                raop_buffered->callbacks.audio_process(raop_buffered->callbacks.cls, raop_buffered->ntp, &audio_data);
+            }
+            delivering = true;
+            raop_buffered->head = (raop_buffered->head + 1) % RAOP_BUFFERED_FRAMES;
+            raop_buffered->count--;
+        }
+        if (playing && delivering && !raop_buffered->count) {
+            underruns++;
+            delivering = false;
+        }
+        if (raop_buffered->count) {
+            raop_buffered_frame_t *first = &raop_buffered->frames[raop_buffered->head];
+            raop_buffered_frame_t *last = &raop_buffered->frames[(raop_buffered->head + raop_buffered->count - 1) % RAOP_BUFFERED_FRAMES];
+            metrics_set(METRICS_AUDIO_BUFFERED, (int64_t) (last->rtp_time - first->rtp_time) * (int64_t) SECOND_IN_NSECS /
+                        RAOP_BUFFERED_SAMPLE_RATE);
+        } else {
+            metrics_set(METRICS_AUDIO_BUFFERED, 0);
+        }
+
+        /* packets left in rx while the ring was full: the client may have stopped sending (end of track, *
+         * long prebuffer), so they must not wait for the next recv                                      */
+        if (csock != -1 && raop_buffered->rx_len) {
+            raop_buffered_parse_rx(raop_buffered, &received, &invalid);
+        }
+
+        /* receive more frames while there is space in the ring (otherwise TCP flow control holds the client back) */
+        fd_set rfds;
+        struct timeval tv;
+        int nfds;
+        tv.tv_sec = 0;
+        tv.tv_usec = (long) (wait / 1000);
+        FD_ZERO(&rfds);
+        bool full = (raop_buffered->count == RAOP_BUFFERED_FRAMES);
+        if (csock == -1) {
+            FD_SET(raop_buffered->lsock, &rfds);
+            nfds = raop_buffered->lsock + 1;
+        } else if (!full) {
+            FD_SET(csock, &rfds);
+            nfds = csock + 1;
+        } else {
+            nfds = 0;
+        }
+        int ret = (nfds ? select(nfds, &rfds, NULL, NULL, &tv) : 0);
+        if (!nfds) {
+            struct timespec sleep_time = { 0, (long) wait };
+            nanosleep(&sleep_time, NULL);
+        }
+        if (ret == -1) {
+            logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered error in select");
+            break;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        if (csock == -1) {
+            struct sockaddr_storage saddr;
+            socklen_t saddrlen = sizeof(saddr);
+            csock = accept(raop_buffered->lsock, (struct sockaddr *) &saddr, &saddrlen);
+            if (csock == -1) {
+                logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered error in accept %d %s", errno, strerror(errno));
+                break;
+            }
+            raop_buffered->rx_len = 0;
+            logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered accepted audio connection");
+            continue;
+        }
+
+        ret = recv(csock, CAST (raop_buffered->rx + raop_buffered->rx_len), RAOP_BUFFERED_RX_SIZE - raop_buffered->rx_len, 0);
+        if (ret <= 0) {
+            logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered audio connection closed");
+            closesocket(csock);
+            csock = -1;
+            continue;
+        }
+        raop_buffered->rx_len += ret;
+        raop_buffered_parse_rx(raop_buffered, &received, &invalid);
+        if (raop_buffered->count > max_count) {
+            max_count = raop_buffered->count;
+        }
+    }
+
+    if (csock != -1) {
+        closesocket(csock);
+    }
+
+    struct timespec cpu_time = { 0, 0 };
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time);
+    logger_log(raop_buffered->logger, LOGGER_INFO, "raop_buffered audio: frames received %llu, late %llu, invalid %llu;"
+               " underruns %llu; buffered up to %d frames (%.1f s); thread CPU time %.3f s",
+               (unsigned long long) received, (unsigned long long) late, (unsigned long long) invalid,
+               (unsigned long long) underruns, max_count, (double) max_count * 1024 / RAOP_BUFFERED_SAMPLE_RATE,
+               (double) cpu_time.tv_sec + (double) cpu_time.tv_nsec / SECOND_IN_NSECS);
+
+    MUTEX_LOCK(raop_buffered->run_mutex);
+    raop_buffered->running = 0;
+    MUTEX_UNLOCK(raop_buffered->run_mutex);
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered exiting thread");
+    return 0;
+}
+
+void
+raop_buffered_start(raop_buffered_t *raop_buffered, unsigned short *data_lport)
+{
+    assert(raop_buffered && data_lport);
+    MUTEX_LOCK(raop_buffered->run_mutex);
+    if (raop_buffered->running || !raop_buffered->joined) {
+        MUTEX_UNLOCK(raop_buffered->run_mutex);
+        return;
+    }
+    unsigned short port = *data_lport;
+    int lsock = netutils_init_socket(&port, raop_buffered->use_ipv6, 0);
+    if (lsock == -1 || listen(lsock, 1) < 0) {
+        logger_log(raop_buffered->logger, LOGGER_ERR, "raop_buffered initializing audio data socket failed");
+        if (lsock != -1) closesocket(lsock);
+        MUTEX_UNLOCK(raop_buffered->run_mutex);
+        return;
+    }
+    raop_buffered->lsock = lsock;
+    raop_buffered->data_lport = port;
+    *data_lport = port;
+    raop_buffered->head = 0;
+    raop_buffered->count = 0;
+    raop_buffered->rx_len = 0;
+    raop_buffered->discard_until_valid = false;
+    logger_log(raop_buffered->logger, LOGGER_DEBUG, "raop_buffered local audio data port TCP %d", port);
+
+    raop_buffered->running = 1;
+    raop_buffered->joined = 0;
+    THREAD_CREATE(raop_buffered->thread, raop_buffered_thread, raop_buffered);
+    MUTEX_UNLOCK(raop_buffered->run_mutex);
+}
+
+void
+raop_buffered_stop(raop_buffered_t *raop_buffered)
+{
+    assert(raop_buffered);
+    MUTEX_LOCK(raop_buffered->run_mutex);
+    if (!raop_buffered->running || raop_buffered->joined) {
+        MUTEX_UNLOCK(raop_buffered->run_mutex);
+        return;
+    }
+    raop_buffered->running = 0;
+    MUTEX_UNLOCK(raop_buffered->run_mutex);
+
+    THREAD_JOIN(raop_buffered->thread);
+    if (raop_buffered->lsock != -1) {
+        closesocket(raop_buffered->lsock);
+        raop_buffered->lsock = -1;
+    }
+    metrics_set(METRICS_AUDIO_BUFFERED, 0);
+
+    MUTEX_LOCK(raop_buffered->run_mutex);
+    raop_buffered->joined = 1;
+    MUTEX_UNLOCK(raop_buffered->run_mutex);
+}
+
+void
+raop_buffered_destroy(raop_buffered_t *raop_buffered)
+{
+    if (raop_buffered) {
+        raop_buffered_stop(raop_buffered);
+        MUTEX_DESTROY(raop_buffered->run_mutex);
+        MUTEX_DESTROY(raop_buffered->state_mutex);
+        free(raop_buffered->frames);
+        free(raop_buffered->rx);
+        aead_destroy(raop_buffered->aead_ctx);
+        free(raop_buffered);
+    }
+}
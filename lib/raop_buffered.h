@@ -0,0 +1,49 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Receiver for AirPlay 2 "buffered" audio (stream type 103): AAC-LC frames, encrypted with
+ * ChaCha20-Poly1305, sent over TCP well ahead of their presentation time.  Frames are held
+ * in a ring buffer (back-pressure on the TCP connection limits the amount buffered) and
+ * passed to the audio_process callback shortly before the time given by the anchor set by
+ * SETRATEANCHORTIME.
+ */
+
+#ifndef RAOP_BUFFERED_H
+#define RAOP_BUFFERED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+#include "raop_ntp.h"
+#include "raop.h"
+
+typedef struct raop_buffered_s raop_buffered_t;
+
+raop_buffered_t *raop_buffered_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
+                                    const unsigned char *key, int use_ipv6, unsigned char ct);
+void raop_buffered_start(raop_buffered_t *raop_buffered, unsigned short *data_lport);
+int raop_buffered_get_buffer_size(raop_buffered_t *raop_buffered);
+
+/* SETRATEANCHORTIME: rate 0 pauses; network_time is in remote clock (PTP) nsecs */
+void raop_buffered_set_anchor(raop_buffered_t *raop_buffered, bool playing, uint32_t rtp_time, uint64_t network_time);
+
+/* FLUSHBUFFERED: discards frames with sequence numbers from from_seq (if has_from), up to until_seq */
+void raop_buffered_flush(raop_buffered_t *raop_buffered, bool has_from, uint32_t from_seq, uint32_t until_seq);
+
+void raop_buffered_stop(raop_buffered_t *raop_buffered);
+void raop_buffered_destroy(raop_buffered_t *raop_buffered);
+
+#endif //RAOP_BUFFERED_H
@@ -25,17 +25,15 @@
 #include <plist/plist.h>
 #define AUDIO_SAMPLE_RATE 44100   /* all supported AirPlay audio format use this sample rate */
 #define SECOND_IN_USECS 1000000
+#define SECOND_IN_NSECS 1000000000ULL
 
 typedef void (*raop_handler_t)(raop_conn_t *, http_request_t *,
                                http_response_t *, char **, int *);
 
+/* builds the serialized /info response for the current configuration */
 static void
-raop_handler_info(raop_conn_t *conn,
-                  http_request_t *request, http_response_t *response,
-                  char **response_data, int *response_datalen)
+raop_info_build(raop_conn_t *conn, char **response_data, int *response_datalen)
 {
-    assert(conn->raop->dnssd);
-
     plist_t res_node = plist_new_dict();
 
     /* deviceID is the physical hardware address, and will not change */
@@ -166,16 +164,49 @@ raop_handler_info(raop_conn_t *conn,
 
     plist_to_bin(res_node, response_data, (uint32_t *) response_datalen);
     plist_free(res_node);
-    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
     free(pk);
     free(hw_addr);
 }
 
+/* clients poll /info while the AirPlay picker is open: the serialized response is cached, and   *
+ * rebuilt only after the configuration changes (raop_set_plist, raop_set_dnssd, or new features) */
+static void
+raop_handler_info(raop_conn_t *conn,
+                  http_request_t *request, http_response_t *response,
+                  char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    assert(raop->dnssd);
+    uint64_t features = dnssd_get_airplay_features(raop->dnssd);
+
+    MUTEX_LOCK(raop->info_mutex);
+    if (!raop->info_cache || raop->info_features != features) {
+        free(raop->info_cache);
+        raop->info_cache = NULL;
+        raop_info_build(conn, &raop->info_cache, &raop->info_cache_len);
+        raop->info_features = features;
+        raop->info_builds++;
+        logger_log(raop->logger, LOGGER_DEBUG, "built /info response (%d bytes)", raop->info_cache_len);
+    }
+    raop->info_requests++;
+    if (raop->info_cache) {
+        *response_data = malloc(raop->info_cache_len);
+        if (*response_data) {
+            memcpy(*response_data, raop->info_cache, raop->info_cache_len);
+            *response_datalen = raop->info_cache_len;
+        }
+    }
+    MUTEX_UNLOCK(raop->info_mutex);
+    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+}
+
 static void
 raop_handler_pairpinstart(raop_conn_t *conn,
                           http_request_t *request, http_response_t *response,
                           char **response_data, int *response_datalen) {
     logger_log(conn->raop->logger, LOGGER_INFO, "client sent PAIR-PIN-START request");
+    /* prepare SRP keys for pair-setup-pin while the pin is being entered */
+    pairing_enable_srp_pool(conn->raop->pairing);
     int pin_4;
     if (conn->raop->pin > 9999) {
         pin_4 = conn->raop->pin % 10000;
@@ -189,8 +220,8 @@ raop_handler_pairpinstart(raop_conn_t *conn,
     }
     char pin[6];
     snprintf(pin, 5, "%04u", pin_4);
-    if (conn->raop->callbacks.display_pin) {
-         conn->raop->callbacks.display_pin(conn->raop->callbacks.cls, pin);
+    if (conn->callbacks.display_pin) {
+         conn->callbacks.display_pin(conn->callbacks.cls, pin);
     }
     logger_log(conn->raop->logger, LOGGER_INFO, "*** CLIENT MUST NOW ENTER PIN = \"%s\" AS AIRPLAY PASSWORD", pin);
     *response_data = NULL;
@@ -207,6 +238,7 @@ raop_handler_pairsetup_pin(raop_conn_t *conn,
     int request_datalen = 0;
     bool data_is_plist = false;
     bool logger_debug = (logger_get_level(conn->raop->logger) >= LOGGER_DEBUG);
+    uint64_t start = telemetry_get_nsecs();
     request_data = http_request_get_data(request, &request_datalen);
     logger_log(conn->raop->logger, LOGGER_INFO, "client requested pair-setup-pin, datalen = %d", request_datalen);
     if (request_datalen > 0) {
@@ -271,7 +303,15 @@ raop_handler_pairsetup_pin(raop_conn_t *conn,
         plist_dict_set_item(res_root_node, "salt", res_salt_node);
         plist_to_bin(res_root_node, response_data, (uint32_t*) response_datalen);
         plist_free(res_root_node);
+        free((char *) pk);
         http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+        conn->pair_setup_nsecs = telemetry_get_nsecs() - start;
+        pairing_stats_t stats;
+        pairing_get_stats(conn->raop->pairing, &stats);
+        logger_log(conn->raop->logger, LOGGER_INFO, "pair-setup-pin (step 1): SRP salt and public key ready in %.3f msecs "
+                   "(verifier cache %lu/%lu hits, SRP key pool %lu/%lu hits)", (double) conn->pair_setup_nsecs / 1000000.0,
+                   stats.srp_verifier_hits, stats.srp_verifier_lookups, stats.srp_pool_hits,
+                   stats.srp_pool_hits + stats.srp_pool_misses);
 	return;
     } else if (PLIST_IS_DATA(req_pk_node) && PLIST_IS_DATA(req_proof_node)) {
         /* this is the second part of pair-setup-pin request */
@@ -309,6 +349,10 @@ raop_handler_pairsetup_pin(raop_conn_t *conn,
         plist_to_bin(res_root_node, response_data, (uint32_t*) response_datalen);
         plist_free(res_root_node);
         http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+        uint64_t nsecs = telemetry_get_nsecs() - start;
+        logger_log(conn->raop->logger, LOGGER_INFO, "pair-setup-pin (step 2): client proof validated in %.3f msecs",
+                   (double) nsecs / 1000000.0);
+        conn->pair_setup_nsecs += nsecs;
 	return;
     } else if (PLIST_IS_DATA(req_epk_node) && PLIST_IS_DATA(req_authtag_node)) {
         /* this is the third part of pair-setup-pin request */
@@ -342,6 +386,11 @@ raop_handler_pairsetup_pin(raop_conn_t *conn,
         } else {
             logger_log(conn->raop->logger, LOGGER_DEBUG, "pair-pin-setup success\n");
         }
+        conn->pair_setup_nsecs += telemetry_get_nsecs() - start;
+        telemetry_record(TELEMETRY_PAIR_SETUP, conn->pair_setup_nsecs);
+        logger_log(conn->raop->logger, LOGGER_INFO, "pair-setup-pin completed: %.3f msecs of server processing",
+                   (double) conn->pair_setup_nsecs / 1000000.0);
+        conn->pair_setup_nsecs = 0;
         pairing_session_set_setup_status(conn->session);
         plist_t res_root_node = plist_new_dict();
         plist_t res_epk_node = plist_new_data((const char *) epk, 32);
@@ -415,6 +464,8 @@ raop_handler_pairverify(raop_conn_t *conn,
                 logger_log(conn->raop->logger, LOGGER_ERR, "Invalid pair-verify data");
                 return;
             }
+            conn->pair_verify_start = telemetry_get_nsecs();
+            conn->pair_verify_registered = false;
             /* We can fall through these errors, the result will just be garbage... */
             if (pairing_session_handshake(conn->session, data + 4, data + 4 + X25519_KEY_SIZE)) {
                 logger_log(conn->raop->logger, LOGGER_ERR, "Error initializing pair-verify handshake");
@@ -427,17 +478,18 @@ raop_handler_pairverify(raop_conn_t *conn,
             }
             if (register_check) {
                 bool registered_client = true;
-		if (conn->raop->callbacks.check_register) {
-		    const unsigned char *pk = data + 4 + X25519_KEY_SIZE;
+                const unsigned char *pk = data + 4 + X25519_KEY_SIZE;
+		if (conn->callbacks.check_register && !pairing_is_verified_client(conn->raop->pairing, pk)) {
 		    char *pk64;
 		    ed25519_pk_to_base64(pk, &pk64);
-                    registered_client = conn->raop->callbacks.check_register(conn->raop->callbacks.cls, pk64);
+                    registered_client = conn->callbacks.check_register(conn->callbacks.cls, pk64);
 		    free (pk64);
                 }
 
                 if (!registered_client) {
                     return;
                 }
+                conn->pair_verify_registered = true;
             }
             *response_data = malloc(sizeof(public_key) + sizeof(signature));
             if (*response_data) {
@@ -460,6 +512,20 @@ raop_handler_pairverify(raop_conn_t *conn,
                 return;
             }
             logger_log(conn->raop->logger, LOGGER_DEBUG, "pair-verify: signature is verified");	    
+            if (conn->pair_verify_registered) {
+                pairing_session_add_verified_client(conn->session);
+            }
+            if (conn->pair_verify_start) {
+                uint64_t nsecs = telemetry_get_nsecs() - conn->pair_verify_start;
+                pairing_stats_t stats;
+                pairing_get_stats(conn->raop->pairing, &stats);
+                telemetry_record(TELEMETRY_PAIR_VERIFY, nsecs);
+                logger_log(conn->raop->logger, LOGGER_DEBUG, "pair-verify completed in %.3f msecs "
+                           "(known-client cache %lu/%lu hits, x25519 key pool %lu/%lu hits)", (double) nsecs / 1000000.0,
+                           stats.verified_hits, stats.verified_lookups, stats.keypool_hits,
+                           stats.keypool_hits + stats.keypool_misses);
+                conn->pair_verify_start = 0;
+            }
             http_response_add_header(response, "Content-Type", "application/octet-stream");
             break;
     }
@@ -568,17 +634,17 @@ raop_handler_setup(raop_conn_t *conn,
         plist_get_string_val(req_model_node, &model);  
         plist_t req_name_node = plist_dict_get_item(req_root_node, "name");
         plist_get_string_val(req_name_node, &name);  
-	if (conn->raop->callbacks.report_client_request) {
-            conn->raop->callbacks.report_client_request(conn->raop->callbacks.cls, deviceID, model, name, &admit_client);
+	if (conn->callbacks.report_client_request) {
+            conn->callbacks.report_client_request(conn->callbacks.cls, deviceID, model, name, &admit_client);
         }
-	if (admit_client && deviceID && name && conn->raop->callbacks.register_client) {
+	if (admit_client && deviceID && name && conn->callbacks.register_client) {
             bool pending_registration;
             char *client_device_id;
             char *client_pk;   /* encoded as null-terminated  base64 string*/
             access_client_session_data(conn->session, &client_device_id, &client_pk, &pending_registration);
             if (pending_registration) {
                 if (client_pk && !strcmp(deviceID, client_device_id)) { 
-                    conn->raop->callbacks.register_client(conn->raop->callbacks.cls, client_device_id, client_pk, name); 
+                    conn->callbacks.register_client(conn->callbacks.cls, client_device_id, client_pk, name); 
 		}
 	    }
             if (client_pk) {
@@ -698,12 +764,14 @@ raop_handler_setup(raop_conn_t *conn,
              int string_len = strlen(timing_protocol);
              if (strncmp(timing_protocol, "NTP", string_len) == 0) {
                  time_protocol = NTP;
+             } else if (strncmp(timing_protocol, "PTP", string_len) == 0 && conn->raop->ptp) {
+                 time_protocol = PTP;
              } else if (strncmp(timing_protocol, "None", string_len) == 0) {
                  time_protocol = TP_NONE;
              } else {
                  time_protocol = TP_OTHER;
              }
-             if (time_protocol != NTP) {
+             if (time_protocol != NTP && time_protocol != PTP) {
                  logger_log(conn->raop->logger, LOGGER_ERR, "Client specified timingProtocol=%s,"
                             " but timingProtocol= NTP is required here", timing_protocol);
              }
@@ -721,7 +789,7 @@ raop_handler_setup(raop_conn_t *conn,
         }
         if (timing_rport) {
             logger_log(conn->raop->logger, LOGGER_DEBUG, "timing_rport = %llu", timing_rport);
-        } else {
+        } else if (time_protocol != PTP) {
             logger_log(conn->raop->logger, LOGGER_ERR, "Client did not supply timing_rport,"
                        " may be using unsupported AirPlay2 \"Remote Control\" protocol");
         }
@@ -740,18 +808,69 @@ raop_handler_setup(raop_conn_t *conn,
                        conn->remotelen, conn->zone_id, str, remote);
             free(str);
         }
-        conn->raop_ntp = raop_ntp_init(conn->raop->logger, &conn->raop->callbacks, remote,
+        if (conn->raop->capture_dir && !conn->capture) {
+            MUTEX_LOCK(conn->raop->session_mutex);   /* (SETUPs of different sessions may run in parallel) */
+            int capture_count = conn->raop->capture_count++;
+            MUTEX_UNLOCK(conn->raop->session_mutex);
+            conn->capture = capture_open(conn->raop->logger, conn->raop->capture_dir, capture_count);
+        }
+        conn->raop_ntp = raop_ntp_init(conn->raop->logger, &conn->callbacks, remote,
                                        conn->remotelen, (unsigned short) timing_rport, &time_protocol);
-        raop_ntp_start(conn->raop_ntp, &timing_lport, conn->raop->max_ntp_timeouts);
-        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->raop->callbacks, conn->raop_ntp,
+        if (conn->raop_ntp && conn->capture) {
+            raop_ntp_set_capture(conn->raop_ntp, conn->capture);
+        }
+        if (conn->raop->session_loop && !conn->session_loop) {
+            conn->session_loop = session_loop_init(conn->raop->logger);
+        }
+        if (conn->raop_ntp && conn->session_loop) {
+            raop_ntp_set_session_loop(conn->raop_ntp, conn->session_loop);
+        }
+        bool timing_failed = (raop_ntp_start(conn->raop_ntp, &timing_lport, conn->raop->max_ntp_timeouts) < 0);
+        if (timing_failed) {
+            logger_log(conn->raop->logger, LOGGER_ERR, "Timing not initialized at SETUP, playing will fail!");
+            http_response_set_disconnect(response, 1);
+        } else {
+            /* PTP falls back to NTP if the PTP ports could not be opened */
+            time_protocol = raop_ntp_get_time_protocol(conn->raop_ntp);
+        }
+        conn->raop_rtp = raop_rtp_init(conn->raop->logger, &conn->callbacks, conn->raop_ntp,
                                        remote, conn->remotelen, aeskey, aesiv);
-        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->raop->callbacks,
-                                                     conn->raop_ntp, remote, conn->remotelen, aeskey);
+        if (conn->capture) {
+            /* the keys are needed by uxplay-replay, and are kept until the audio and mirror streams are set up */
+            memcpy(conn->capture_aeskey, aeskey, sizeof(conn->capture_aeskey));
+            memcpy(conn->capture_aesiv, aesiv, sizeof(conn->capture_aesiv));
+        }
+        if (conn->raop_rtp) {
+            raop_rtp_set_buffer_latency(conn->raop_rtp, conn->raop->audio_buffer_min_ms,
+                                        conn->raop->audio_buffer_max_ms);
+            raop_rtp_set_socket_options(conn->raop_rtp, conn->raop->audio_rcvbuf, conn->raop->audio_busy_poll);
+            if (conn->session_loop) {
+                raop_rtp_set_session_loop(conn->raop_rtp, conn->session_loop);
+            }
+        }
+        conn->raop_rtp_mirror = raop_rtp_mirror_init(conn->raop->logger, &conn->callbacks,
+                                                     conn->raop_ntp, remote, conn->remotelen, aeskey,
+                                                     conn->raop->frame_pool);
 
         plist_t res_event_port_node = plist_new_uint(conn->raop->port);
-        plist_t res_timing_port_node = plist_new_uint(timing_lport);
-        plist_dict_set_item(res_root_node, "timingPort", res_timing_port_node);
         plist_dict_set_item(res_root_node, "eventPort", res_event_port_node);
+        if (timing_failed) {
+            /* (no timing information is offered) */
+        } else if (time_protocol == PTP) {
+            /* PTP uses the standard ports 319 and 320: identify this receiver as a timing peer */
+            char local[40];
+            plist_t res_timing_peer_info_node = plist_new_dict();
+            plist_t res_addresses_node = plist_new_array();
+            if (utils_ipaddress_to_string(conn->locallen, conn->local, conn->zone_id, local, (int) sizeof(local))) {
+                plist_array_append_item(res_addresses_node, plist_new_string(local));
+                plist_dict_set_item(res_timing_peer_info_node, "ID", plist_new_string(local));
+            }
+            plist_dict_set_item(res_timing_peer_info_node, "Addresses", res_addresses_node);
+            plist_dict_set_item(res_root_node, "timingPeerInfo", res_timing_peer_info_node);
+        } else {
+            plist_t res_timing_port_node = plist_new_uint(timing_lport);
+            plist_dict_set_item(res_root_node, "timingPort", res_timing_port_node);
+        }
 
         logger_log(conn->raop->logger, LOGGER_DEBUG, "eport = %d, tport = %d", conn->raop->port, timing_lport);
     }
@@ -780,8 +899,25 @@ raop_handler_setup(raop_conn_t *conn,
                                " key and iv): %llu", stream_connection_id);
 
                     if (conn->raop_rtp_mirror) {
+                        if (conn->callbacks.video_setup) {
+                            conn->callbacks.video_setup(conn->callbacks.cls);
+                        }
                         raop_rtp_mirror_init_aes(conn->raop_rtp_mirror, &stream_connection_id);
-                        raop_rtp_mirror_start(conn->raop_rtp_mirror, &dport, conn->raop->clientFPSdata);
+                        raop_rtp_mirror_set_queue_depth(conn->raop_rtp_mirror, conn->raop->video_queue_depth);
+                        raop_rtp_mirror_set_io_uring(conn->raop_rtp_mirror, conn->raop->mirror_io_uring);
+                        if (conn->session_loop) {
+                            raop_rtp_mirror_set_session_loop(conn->raop_rtp_mirror, conn->session_loop);
+                        }
+                        if (conn->capture) {
+                            capture_mirror_setup_t setup = { 0 };
+                            memcpy(setup.aeskey, conn->capture_aeskey, sizeof(setup.aeskey));
+                            setup.stream_connection_id = stream_connection_id;
+                            setup.h265 = conn->raop->h265;
+                            capture_write(conn->capture, CAPTURE_MIRROR_SETUP, &setup, sizeof(setup), NULL, 0);
+                            raop_rtp_mirror_set_capture(conn->raop_rtp_mirror, conn->capture);
+                        }
+                        raop_rtp_mirror_start(conn->raop_rtp_mirror, &dport, conn->raop->clientFPSdata,
+                                              conn->raop->h265);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "Mirroring initialized successfully");
                     } else {
                         logger_log(conn->raop->logger, LOGGER_ERR, "Mirroring not initialized at SETUP, playing will fail!");
@@ -812,7 +948,7 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_get_uint_val(req_stream_ct_node, &uint_val);
                     ct = (unsigned char) uint_val;
 
-                    if (conn->raop->callbacks.audio_get_format) {
+                    if (conn->callbacks.audio_get_format) {
 		        /* get additional audio format parameters  */
                         uint64_t audioFormat;
                         unsigned short spf;
@@ -843,10 +979,19 @@ raop_handler_setup(raop_conn_t *conn,
                             usingScreen = false;
                         }
 
-                        conn->raop->callbacks.audio_get_format(conn->raop->callbacks.cls, &ct, &spf, &usingScreen, &isMedia, &audioFormat);
+                        conn->callbacks.audio_get_format(conn->callbacks.cls, &ct, &spf, &usingScreen, &isMedia, &audioFormat);
                     }
 
                     if (conn->raop_rtp) {
+                        if (conn->capture) {
+                            capture_audio_setup_t setup = { 0 };
+                            memcpy(setup.aeskey, conn->capture_aeskey, sizeof(setup.aeskey));
+                            memcpy(setup.aesiv, conn->capture_aesiv, sizeof(setup.aesiv));
+                            setup.ct = ct;
+                            setup.sr = sr;
+                            capture_write(conn->capture, CAPTURE_AUDIO_SETUP, &setup, sizeof(setup), NULL, 0);
+                            raop_rtp_set_capture(conn->raop_rtp, conn->capture);
+                        }
                         raop_rtp_start_audio(conn->raop_rtp, &remote_cport, &cport, &dport, &ct, &sr);
                         logger_log(conn->raop->logger, LOGGER_DEBUG, "RAOP initialized success");
                     } else {
@@ -863,6 +1008,70 @@ raop_handler_setup(raop_conn_t *conn,
                     plist_dict_set_item(res_stream_node, "type", res_stream_type_node);
                     plist_array_append_item(res_streams_node, res_stream_node);
 
+                    break;
+                } case 103: {
+                    // Buffered (AirPlay 2) audio, over TCP
+                    unsigned short dport = 0;
+                    unsigned char ct = 4;   /* AAC-LC */
+                    uint64_t uint_val = 0;
+                    char *shk = NULL;
+                    uint64_t shk_len = 0;
+
+                    plist_t req_stream_ct_node = plist_dict_get_item(req_stream_node, "ct");
+                    if (req_stream_ct_node) {
+                        plist_get_uint_val(req_stream_ct_node, &uint_val);
+                        ct = (unsigned char) uint_val;
+                    }
+                    plist_t req_stream_shk_node = plist_dict_get_item(req_stream_node, "shk");
+                    if (req_stream_shk_node) {
+                        plist_get_data_val(req_stream_shk_node, &shk, &shk_len);
+                    }
+                    if (!conn->raop->buffered_audio || !conn->raop_ntp || !shk || shk_len != CHACHA_KEY_SIZE) {
+                        logger_log(conn->raop->logger, LOGGER_ERR, "SETUP of buffered audio stream (type 103) failed%s",
+                                   (conn->raop->buffered_audio ? "" : ": buffered audio is not enabled"));
+                        free(shk);
+                        http_response_set_disconnect(response, 1);
+                        break;
+                    }
+
+                    if (conn->callbacks.audio_get_format) {
+                        uint64_t audioFormat = 0;
+                        unsigned short spf = 1024;
+                        bool isMedia = true;
+                        bool usingScreen = false;
+                        plist_t req_stream_spf_node = plist_dict_get_item(req_stream_node, "spf");
+                        if (req_stream_spf_node) {
+                            plist_get_uint_val(req_stream_spf_node, &uint_val);
+                            spf = (unsigned short) uint_val;
+                        }
+                        plist_t req_stream_audio_format_node = plist_dict_get_item(req_stream_node, "audioFormat");
+                        if (req_stream_audio_format_node) {
+                            plist_get_uint_val(req_stream_audio_format_node, &audioFormat);
+                        }
+                        conn->callbacks.audio_get_format(conn->callbacks.cls, &ct, &spf, &usingScreen, &isMedia, &audioFormat);
+                    }
+
+                    if (conn->raop_buffered) {
+                        raop_buffered_destroy(conn->raop_buffered);
+                    }
+                    conn->raop_buffered = raop_buffered_init(conn->raop->logger, &conn->callbacks, conn->raop_ntp,
+                                                             (unsigned char *) shk, (conn->remotelen == 16), ct);
+                    free(shk);
+                    if (conn->raop_buffered) {
+                        raop_buffered_start(conn->raop_buffered, &dport);
+                        logger_log(conn->raop->logger, LOGGER_DEBUG, "buffered audio initialized successfully");
+                    } else {
+                        logger_log(conn->raop->logger, LOGGER_ERR, "buffered audio not initialized at SETUP, playing will fail!");
+                        http_response_set_disconnect(response, 1);
+                        break;
+                    }
+
+                    plist_t res_stream_node = plist_new_dict();
+                    plist_dict_set_item(res_stream_node, "dataPort", plist_new_uint(dport));
+                    plist_dict_set_item(res_stream_node, "type", plist_new_uint(103));
+                    plist_dict_set_item(res_stream_node, "audioBufferSize",
+                                        plist_new_uint(raop_buffered_get_buffer_size(conn->raop_buffered)));
+                    plist_array_append_item(res_streams_node, res_stream_node);
                     break;
                 }
 
@@ -1018,15 +1227,128 @@ raop_handler_flush(raop_conn_t *conn,
     }
 }
 
+static void
+raop_handler_setpeers(raop_conn_t *conn,
+                      http_request_t *request, http_response_t *response,
+                      char **response_data, int *response_datalen)
+{
+    /* the PTP timing peers (IP address strings) of a PTP session: only these (and the client) *
+     * are accepted as the master clock                                                         */
+    const char *data;
+    int data_len;
+    data = http_request_get_data(request, &data_len);
+    plist_t req_root_node = NULL;
+    plist_from_bin(data, data_len, &req_root_node);
+    if (PLIST_IS_ARRAY(req_root_node)) {
+        int count = plist_array_get_size(req_root_node);
+        char **peers = (count > 0 ? calloc(count, sizeof(char *)) : NULL);
+        int n_peers = 0;
+        for (int i = 0; peers && i < count; i++) {
+            char *peer = NULL;
+            plist_get_string_val(plist_array_get_item(req_root_node, i), &peer);
+            if (peer) {
+                logger_log(conn->raop->logger, LOGGER_DEBUG, "SETPEERS: PTP timing peer %s", peer);
+                peers[n_peers++] = peer;
+            }
+        }
+        if (conn->raop_ntp) {
+            raop_ntp_set_ptp_peers(conn->raop_ntp, (const char **) peers, n_peers);
+        } else {
+            logger_log(conn->raop->logger, LOGGER_WARNING, "SETPEERS received before the timing SETUP");
+        }
+        for (int i = 0; i < n_peers; i++) {
+            free(peers[i]);
+        }
+        free(peers);
+    } else {
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "SETPEERS: no peer list received");
+    }
+    if (req_root_node) {
+        plist_free(req_root_node);
+    }
+}
+
+static uint64_t
+raop_handler_get_uint(plist_t dict_node, const char *key)
+{
+    uint64_t val = 0;
+    plist_t node = plist_dict_get_item(dict_node, key);
+    if (node && plist_get_node_type(node) == PLIST_REAL) {
+        double real_val = 0.0;
+        plist_get_real_val(node, &real_val);
+        val = (uint64_t) real_val;
+    } else if (node) {
+        plist_get_uint_val(node, &val);
+    }
+    return val;
+}
+
+static void
+raop_handler_setrateanchortime(raop_conn_t *conn,
+                               http_request_t *request, http_response_t *response,
+                               char **response_data, int *response_datalen)
+{
+    /* start (rate 1) or pause (rate 0) buffered audio: rtpTime plays at networkTime (PTP clock) */
+    const char *data;
+    int data_len;
+    data = http_request_get_data(request, &data_len);
+    plist_t req_root_node = NULL;
+    plist_from_bin(data, data_len, &req_root_node);
+    if (!req_root_node) {
+        logger_log(conn->raop->logger, LOGGER_ERR, "SETRATEANCHORTIME: no plist received");
+        return;
+    }
+    uint64_t rate = raop_handler_get_uint(req_root_node, "rate");
+    uint64_t rtp_time = raop_handler_get_uint(req_root_node, "rtpTime");
+    uint64_t secs = raop_handler_get_uint(req_root_node, "networkTimeSecs");
+    uint64_t frac = raop_handler_get_uint(req_root_node, "networkTimeFrac");
+    plist_free(req_root_node);
+
+    /* networkTimeFrac is a 64 bit binary fraction of a second */
+    uint64_t network_time = secs * SECOND_IN_NSECS + (((frac >> 32) * SECOND_IN_NSECS) >> 32);
+    if (conn->raop_buffered) {
+        raop_buffered_set_anchor(conn->raop_buffered, (rate != 0), (uint32_t) rtp_time, network_time);
+    } else {
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "SETRATEANCHORTIME without a buffered audio stream");
+    }
+}
+
+static void
+raop_handler_flushbuffered(raop_conn_t *conn,
+                           http_request_t *request, http_response_t *response,
+                           char **response_data, int *response_datalen)
+{
+    const char *data;
+    int data_len;
+    data = http_request_get_data(request, &data_len);
+    plist_t req_root_node = NULL;
+    plist_from_bin(data, data_len, &req_root_node);
+    if (!req_root_node) {
+        logger_log(conn->raop->logger, LOGGER_ERR, "FLUSHBUFFERED: no plist received");
+        return;
+    }
+    bool has_from = (plist_dict_get_item(req_root_node, "flushFromSeq") != NULL);
+    uint64_t from_seq = raop_handler_get_uint(req_root_node, "flushFromSeq");
+    uint64_t until_seq = raop_handler_get_uint(req_root_node, "flushUntilSeq");
+    plist_free(req_root_node);
+    logger_log(conn->raop->logger, LOGGER_DEBUG, "FLUSHBUFFERED from %lld until %llu", (has_from ? (long long) from_seq : -1LL),
+               until_seq);
+    if (conn->raop_buffered) {
+        raop_buffered_flush(conn->raop_buffered, has_from, (uint32_t) from_seq, (uint32_t) until_seq);
+    } else {
+        logger_log(conn->raop->logger, LOGGER_WARNING, "buffered audio not initialized at FLUSHBUFFERED");
+    }
+}
+
 static void
 raop_handler_teardown(raop_conn_t *conn,
                       http_request_t *request, http_response_t *response,
                       char **response_data, int *response_datalen)
 {
-    /* get the teardown request type(s):  (type 96, 110, or none) */
+    /* get the teardown request type(s):  (type 96, 103, 110, or none) */
     const char *data;
     int data_len;
-    bool teardown_96 = false, teardown_110 = false;
+    bool teardown_96 = false, teardown_110 = false, teardown_103 = false;
     data = http_request_get_data(request, &data_len);
     plist_t req_root_node = NULL;
     plist_from_bin(data, data_len, &req_root_node);
@@ -1046,14 +1368,21 @@ raop_handler_teardown(raop_conn_t *conn,
             plist_get_uint_val(req_stream_type_node, &val);
             if (val == 96) {
                 teardown_96 = true;
+            } else if (val == 103) {
+                teardown_103 = true;
             } else if (val == 110) { 
 	        teardown_110 = true;
             }
         }
     }
     plist_free(req_root_node);
-    if (conn->raop->callbacks.conn_teardown) {
-        conn->raop->callbacks.conn_teardown(conn->raop->callbacks.cls, &teardown_96, &teardown_110);
+    if (teardown_103 && conn->raop_buffered) {
+        raop_buffered_destroy(conn->raop_buffered);
+        conn->raop_buffered = NULL;
+        teardown_96 = true;   /* for conn_teardown, an audio stream */
+    }
+    if (conn->callbacks.conn_teardown) {
+        conn->callbacks.conn_teardown(conn->callbacks.cls, &teardown_96, &teardown_110);
     }
     logger_log(conn->raop->logger, LOGGER_DEBUG, "TEARDOWN request,  96=%d, 110=%d", teardown_96, teardown_110);
   
@@ -1079,5 +1408,9 @@ raop_handler_teardown(raop_conn_t *conn,
             raop_rtp_mirror_destroy(conn->raop_rtp_mirror);
             conn->raop_rtp_mirror = NULL;
         }
+        if (conn->raop_buffered) {
+            raop_buffered_destroy(conn->raop_buffered);
+            conn->raop_buffered = NULL;
+        }
     }	
 }
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <stdatomic.h>
 #ifdef _WIN32
 #define CAST (char *)
 #else
@@ -36,6 +37,12 @@
 #include "netutils.h"
 #include "byteutils.h"
 #include "utils.h"
+#include "metrics.h"
+#include "trace.h"
+#include "ptp.h"
+#include "thread_config.h"
+#include "socket_tuning.h"
+#include "session_loop.h"
 
 #define SECOND_IN_NSECS 1000000000UL
 #define RAOP_NTP_DATA_COUNT   8
@@ -47,6 +54,23 @@
 
 #define RAOP_NTP_CLOCK_BASE (2208988800ull << 32)
 
+#define RAOP_NTP_POLL_INTERVAL_SECS 3
+#define RAOP_NTP_REPLY_TIMEOUT (300ull * 1000000ull)  // nsecs, as SO_RCVTIMEO of the timing socket
+
+// Clock discipline (all times in nsecs)
+#define RAOP_NTP_STEP_THRESHOLD   (128ll * 1000000ll)       // larger offset errors step the clock
+#define RAOP_NTP_PLL_GAIN         4                         // 1/gain of each offset error is applied
+#define RAOP_NTP_FLL_GAIN         8                         // 1/gain of each frequency error is applied
+#define RAOP_NTP_MAX_DRIFT_PPB    500000ll                  // 500 PPM
+// PTP slave
+#define RAOP_PTP_DELAY_REQ_INTERVAL (1ull * SECOND_IN_NSECS)  // between Delay_Req messages
+#define RAOP_PTP_DELAY_RESP_TIMEOUT (4ull * SECOND_IN_NSECS)  // after this, use one-way (Sync) samples
+#define RAOP_PTP_MASTER_TIMEOUT     (3ull * SECOND_IN_NSECS)  // then accept a different master clock
+#define RAOP_PTP_SAMPLE_INTERVAL    (1ull * SECOND_IN_NSECS)  // minimum interval between one-way samples
+#define RAOP_PTP_MAX_PEERS          8                         // SETPEERS addresses kept
+
+#define RAOP_NTP_MAX_EXTRAPOLATION (60ll * (int64_t) SECOND_IN_NSECS) // after this, stop extrapolating the drift
+
 typedef struct raop_ntp_data_s {
     uint64_t time; // The local wall clock time at time of ntp packet arrival
     uint64_t dispersion;
@@ -58,6 +82,9 @@ struct raop_ntp_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
 
+    /* timing responses are recorded here if set */
+    capture_t *capture;
+
     int max_ntp_timeouts;
 
     thread_handle_t thread;
@@ -66,15 +93,32 @@ struct raop_ntp_s {
     mutex_handle_t wait_mutex;
     cond_handle_t wait_cond;
 
+    // Clock filter: the last RAOP_NTP_DATA_COUNT samples, with the indexes of those with
+    // the smallest and largest delay maintained as samples are added
     raop_ntp_data_t data[RAOP_NTP_DATA_COUNT];
     int data_index;
-
-    // The clock sync params are periodically updated to the AirPlay client's NTP clock
-    mutex_handle_t sync_params_mutex;
+    int best_index;
+    int worst_index;
+    uint64_t filter_dispersion;
+    uint64_t filter_time;
+
+    // The clock sync params are periodically updated to the AirPlay client's NTP clock:
+    // the offset (remote - local) at local time sync_epoch, drifting at sync_drift ppb.
+    // They are only accessed by raop_ntp_thread, which publishes them in sync_snapshot
     int64_t sync_offset;
+    int64_t sync_drift;
+    uint64_t sync_epoch;
+    bool sync_valid;
     int64_t sync_dispersion;
     int64_t sync_delay;
 
+    // Seqlock (sync_seq is odd while an update is in progress) protecting the published
+    // offset, drift and epoch: readers on the audio and video threads never block, and
+    // retry if they might have seen a partial update.  The 64-bit values are atomics so
+    // that they cannot be torn on 32-bit platforms
+    atomic_uint sync_seq;
+    atomic_llong sync_snapshot[3];
+
     // Socket address of the AirPlay client
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
@@ -93,25 +137,190 @@ struct raop_ntp_s {
     // UDP socket
     int tsock;
 
+    // PTP event (319) and general (320) message sockets
+    int ptp_esock;
+    int ptp_gsock;
+
+    // PTP timing peers (from SETPEERS): only the client and these may act as the master clock
+    struct sockaddr_storage ptp_peers[RAOP_PTP_MAX_PEERS];
+    int ptp_peer_count;
+
     timing_protocol_t time_protocol;
+
+    // NTP polling state (raop_ntp_thread, or the session loop callbacks)
+    uint64_t send_time;
+    uint64_t trace_send;       /* trace_begin() when the request was sent */
+    uint64_t last_used_time;
+    int timeout_counter;
+    bool awaiting_reply;
+    // kernel receive timestamps: delay until the response was read (scheduler latency)
+    uint64_t rx_stamped;
+    uint64_t rx_wakeup_total;
+    uint64_t rx_wakeup_max;
+
+    // if set, NTP polling runs on this session loop (with its timers) instead of raop_ntp_thread
+    session_loop_t *session_loop;
+    int poll_timer;
+    int reply_timer;
 };
 
 
 /*
- * Used for sorting the data array by delay
+ * Adds a sample to the clock filter, replacing the oldest one.  The minimum and maximum
+ * delay samples only need to be searched for again when one of them is the sample replaced.
+ * The filter dispersion weights each sample by 2^-(1 + age), where age is its position
+ * counting from the newest sample, and grows at RAOP_NTP_PHI_PPM as samples get older
  */
-static int
-raop_ntp_compare(const void* av, const void* bv)
+static void
+raop_ntp_filter_add(raop_ntp_t *raop_ntp, const raop_ntp_data_t *sample)
 {
-    const raop_ntp_data_t* a = (const raop_ntp_data_t*)av;
-    const raop_ntp_data_t* b = (const raop_ntp_data_t*)bv;
-    if (a->delay < b->delay) {
-        return -1;
-    } else if(a->delay > b->delay) {
-        return 1;
+    int index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
+    raop_ntp->data_index = index;
+    raop_ntp->data[index] = *sample;
+
+    if (index == raop_ntp->best_index || index == raop_ntp->worst_index) {
+        raop_ntp->best_index = index;
+        raop_ntp->worst_index = index;
+        for (int i = 0; i < RAOP_NTP_DATA_COUNT; i++) {
+            if (raop_ntp->data[i].delay < raop_ntp->data[raop_ntp->best_index].delay) {
+                raop_ntp->best_index = i;
+            }
+            if (raop_ntp->data[i].delay > raop_ntp->data[raop_ntp->worst_index].delay) {
+                raop_ntp->worst_index = i;
+            }
+        }
     } else {
-        return 0;
+        if (sample->delay < raop_ntp->data[raop_ntp->best_index].delay) {
+            raop_ntp->best_index = index;
+        }
+        if (sample->delay > raop_ntp->data[raop_ntp->worst_index].delay) {
+            raop_ntp->worst_index = index;
+        }
     }
+
+    uint64_t aging = (sample->time - raop_ntp->filter_time) * RAOP_NTP_PHI_PPM / SECOND_IN_NSECS;
+    raop_ntp->filter_dispersion = (raop_ntp->filter_dispersion + aging) / 2 + sample->dispersion / 2;
+    raop_ntp->filter_time = sample->time;
+}
+
+typedef struct raop_ntp_sync_s {
+    int64_t offset;
+    int64_t drift;
+    uint64_t epoch;
+} raop_ntp_sync_t;
+
+static void
+raop_ntp_sync_publish(raop_ntp_t *raop_ntp)
+{
+    unsigned int seq = atomic_load_explicit(&raop_ntp->sync_seq, memory_order_relaxed);
+    atomic_store_explicit(&raop_ntp->sync_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&raop_ntp->sync_snapshot[0], raop_ntp->sync_offset, memory_order_relaxed);
+    atomic_store_explicit(&raop_ntp->sync_snapshot[1], raop_ntp->sync_drift, memory_order_relaxed);
+    atomic_store_explicit(&raop_ntp->sync_snapshot[2], (long long) raop_ntp->sync_epoch, memory_order_relaxed);
+    atomic_store_explicit(&raop_ntp->sync_seq, seq + 2, memory_order_release);
+}
+
+static void
+raop_ntp_sync_read(raop_ntp_t *raop_ntp, raop_ntp_sync_t *sync)
+{
+    unsigned int seq;
+    do {
+        seq = atomic_load_explicit(&raop_ntp->sync_seq, memory_order_acquire);
+        sync->offset = atomic_load_explicit(&raop_ntp->sync_snapshot[0], memory_order_relaxed);
+        sync->drift = atomic_load_explicit(&raop_ntp->sync_snapshot[1], memory_order_relaxed);
+        sync->epoch = (uint64_t) atomic_load_explicit(&raop_ntp->sync_snapshot[2], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&raop_ntp->sync_seq, memory_order_relaxed));
+}
+
+/*
+ * The clock offset at local_time, extrapolated from the last update of the sync params
+ */
+static int64_t
+raop_ntp_extrapolate(int64_t offset, int64_t drift, uint64_t epoch, uint64_t local_time)
+{
+    int64_t elapsed = (int64_t) (local_time - epoch);
+    if (elapsed > RAOP_NTP_MAX_EXTRAPOLATION) {
+        elapsed = RAOP_NTP_MAX_EXTRAPOLATION;
+    } else if (elapsed < -RAOP_NTP_MAX_EXTRAPOLATION) {
+        elapsed = -RAOP_NTP_MAX_EXTRAPOLATION;
+    }
+    return offset + drift * elapsed / (int64_t) SECOND_IN_NSECS;
+}
+
+/*
+ * Clock discipline (only called by raop_ntp_thread): a new filtered offset measured at local
+ * time "time" corrects the extrapolated offset by a fraction of the error (phase-locked loop),
+ * and the drift by a fraction of the error divided by the time since the last update
+ * (frequency-locked loop).  Errors larger than RAOP_NTP_STEP_THRESHOLD step the clock.
+ * Returns the correction made to the offset at "time".
+ */
+static int64_t
+raop_ntp_discipline(raop_ntp_t *raop_ntp, int64_t offset, uint64_t time)
+{
+    if (!raop_ntp->sync_valid) {
+        raop_ntp->sync_offset = offset;
+        raop_ntp->sync_drift = 0;
+        raop_ntp->sync_epoch = time;
+        raop_ntp->sync_valid = true;
+        return offset;
+    }
+    int64_t predicted = raop_ntp_extrapolate(raop_ntp->sync_offset, raop_ntp->sync_drift, raop_ntp->sync_epoch, time);
+    int64_t error = offset - predicted;
+    int64_t interval = (int64_t) (time - raop_ntp->sync_epoch);
+    if (error > RAOP_NTP_STEP_THRESHOLD || error < -RAOP_NTP_STEP_THRESHOLD || interval <= 0) {
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp clock step %lld nsecs", (long long) error);
+        raop_ntp->sync_offset = offset;
+        raop_ntp->sync_drift = 0;
+        raop_ntp->sync_epoch = time;
+        return error;
+    }
+    raop_ntp->sync_offset = predicted + error / RAOP_NTP_PLL_GAIN;
+    raop_ntp->sync_drift += error * (int64_t) SECOND_IN_NSECS / interval / RAOP_NTP_FLL_GAIN;
+    if (raop_ntp->sync_drift > RAOP_NTP_MAX_DRIFT_PPB) {
+        raop_ntp->sync_drift = RAOP_NTP_MAX_DRIFT_PPB;
+    } else if (raop_ntp->sync_drift < -RAOP_NTP_MAX_DRIFT_PPB) {
+        raop_ntp->sync_drift = -RAOP_NTP_MAX_DRIFT_PPB;
+    }
+    raop_ntp->sync_epoch = time;
+    return error / RAOP_NTP_PLL_GAIN;
+}
+
+/*
+ * Adds a new timing sample (from NTP or PTP) to the clock filter, and disciplines and publishes
+ * the clock if the filter has selected a sample not used previously
+ */
+static void
+raop_ntp_update(raop_ntp_t *raop_ntp, const raop_ntp_data_t *sample, uint64_t *last_used_time)
+{
+    raop_ntp_filter_add(raop_ntp, sample);
+
+    // The minimum delay sample gives the best offset estimate; only use each sample once
+    const raop_ntp_data_t *best = &raop_ntp->data[raop_ntp->best_index];
+    int64_t offset = best->offset;
+    int64_t delay = raop_ntp->data[raop_ntp->worst_index].delay;
+    uint64_t dispersion = raop_ntp->filter_dispersion;
+    int64_t correction = 0;
+
+    if (best->time > *last_used_time) {
+        correction = raop_ntp_discipline(raop_ntp, offset, best->time);
+        *last_used_time = best->time;
+        raop_ntp_sync_publish(raop_ntp);
+    }
+    offset = raop_ntp_extrapolate(raop_ntp->sync_offset, raop_ntp->sync_drift, raop_ntp->sync_epoch, sample->time);
+    int64_t drift = raop_ntp->sync_drift;
+    raop_ntp->sync_dispersion = dispersion;
+    raop_ntp->sync_delay = delay;
+
+    metrics_add(METRICS_NTP_SYNCS, 1);
+    metrics_set(METRICS_NTP_OFFSET, offset);
+    metrics_set(METRICS_NTP_DELAY, delay);
+    /* dispersion is in 32.32 fixed-point seconds */
+    metrics_set(METRICS_NTP_DISPERSION, (int64_t) ((dispersion >> 16) * SECOND_IN_NSECS >> 16));
+    metrics_set(METRICS_NTP_DRIFT, drift);
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld, drift = %lld ppb",
+               (long long) correction, (long long) drift);
 }
 
 static int
@@ -164,6 +373,9 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const c
 
     raop_ntp->running = 0;
     raop_ntp->joined = 1;
+    raop_ntp->tsock = -1;
+    raop_ntp->ptp_esock = -1;
+    raop_ntp->ptp_gsock = -1;
 
     uint64_t time = raop_ntp_get_local_time(raop_ntp);
 
@@ -173,15 +385,25 @@ raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const c
         raop_ntp->data[i].dispersion = RAOP_NTP_MAX_DISP;
         raop_ntp->data[i].time      = time;
     }
+    raop_ntp->best_index = 0;
+    raop_ntp->worst_index = 0;
+    raop_ntp->filter_dispersion = RAOP_NTP_MAX_DISP;
+    raop_ntp->filter_time = time;
 
     raop_ntp->sync_delay = 0;
     raop_ntp->sync_dispersion = 0;
     raop_ntp->sync_offset = 0;
+    raop_ntp->sync_drift = 0;
+    raop_ntp->sync_epoch = time;
+    raop_ntp->sync_valid = false;
+    atomic_init(&raop_ntp->sync_seq, 0);
+    atomic_init(&raop_ntp->sync_snapshot[0], 0);
+    atomic_init(&raop_ntp->sync_snapshot[1], 0);
+    atomic_init(&raop_ntp->sync_snapshot[2], (long long) time);
 
     MUTEX_CREATE(raop_ntp->run_mutex);
     MUTEX_CREATE(raop_ntp->wait_mutex);
     COND_CREATE(raop_ntp->wait_cond);
-    MUTEX_CREATE(raop_ntp->sync_params_mutex);
     return raop_ntp;
 }
 
@@ -193,7 +415,6 @@ raop_ntp_destroy(raop_ntp_t *raop_ntp)
         MUTEX_DESTROY(raop_ntp->run_mutex);
         MUTEX_DESTROY(raop_ntp->wait_mutex);
         COND_DESTROY(raop_ntp->wait_cond);
-        MUTEX_DESTROY(raop_ntp->sync_params_mutex);
         free(raop_ntp);
     }
 }
@@ -202,6 +423,16 @@ unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp) {
     return raop_ntp->timing_lport;
 }
 
+void raop_ntp_set_capture(raop_ntp_t *raop_ntp, capture_t *capture) {
+    assert(raop_ntp);
+    raop_ntp->capture = capture;
+}
+
+void raop_ntp_set_session_loop(raop_ntp_t *raop_ntp, session_loop_t *session_loop) {
+    assert(raop_ntp);
+    raop_ntp->session_loop = session_loop;
+}
+
 static int
 raop_ntp_init_socket(raop_ntp_t *raop_ntp, int use_ipv6)
 {
@@ -217,10 +448,11 @@ raop_ntp_init_socket(raop_ntp_t *raop_ntp, int use_ipv6)
 
     struct timeval tv;
     tv.tv_sec = 0;
-    tv.tv_usec = 300000;
+    tv.tv_usec = RAOP_NTP_REPLY_TIMEOUT / 1000;
     if (setsockopt(tsock, SOL_SOCKET, SO_RCVTIMEO, CAST &tv, sizeof(tv)) < 0) {
         goto sockets_cleanup;
     }
+    socket_tuning_apply(raop_ntp->logger, tsock, SOCKET_PROFILE_TIMING, 0);
 
     /* Set socket descriptors */
     raop_ntp->tsock = tsock;
@@ -258,22 +490,144 @@ raop_ntp_flush_socket(int fd)
     }
 }
 
+static const unsigned char raop_ntp_request[32] = {
+    0x80, 0xd2, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/*
+ * NTP polling is split into non-blocking steps, run either by raop_ntp_thread or by the callbacks
+ * of a session loop: send a request, then process the response or the response timeout.
+ */
+
+/* returns false if the request could not be sent */
+static bool
+raop_ntp_send_request(raop_ntp_t *raop_ntp)
+{
+    unsigned char request[sizeof(raop_ntp_request)];
+    memcpy(request, raop_ntp_request, sizeof(request));
+
+    // Flush the socket in case a super delayed response arrived or something
+    raop_ntp_flush_socket(raop_ntp->tsock);
+
+    // Send request
+    raop_ntp->send_time = raop_ntp_get_local_time(raop_ntp);
+    raop_ntp->trace_send = trace_begin();
+    byteutils_put_ntp_timestamp(request, 24, raop_ntp->send_time);
+    int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
+                          (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
+    if (logger_get_level(raop_ntp->logger) >= LOGGER_DEBUG) {
+        char *str = utils_data_to_string(request, sizeof(request), 16);
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send time type_t=%d packetlen = %d, now = %8.6f\n%s",
+                   request[1] &~0x80, sizeof(request), (double) raop_ntp->send_time / SECOND_IN_NSECS, str);
+        free(str);
+    }
+    if (send_len < 0) {
+        int sock_err = SOCKET_GET_ERROR();
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request. Error %d:%s",
+                 sock_err, strerror(sock_err));
+        return false;
+    }
+    return true;
+}
+
+/* no response to the last request: returns true when the client is no longer responding */
+static bool
+raop_ntp_response_timeout(raop_ntp_t *raop_ntp)
+{
+    char time[30];
+    raop_ntp->timeout_counter++;
+    trace_instant("ntp", "timeout", raop_ntp->timeout_counter);
+    int level = (raop_ntp->timeout_counter == 1 ? LOGGER_DEBUG : LOGGER_ERR);
+    ntp_timestamp_to_time(raop_ntp->send_time, time, sizeof(time));
+    logger_log(raop_ntp->logger, level, "raop_ntp receive timeout %d (limit %d) (request sent %s)",
+               raop_ntp->timeout_counter, raop_ntp->max_ntp_timeouts, time);
+    return (raop_ntp->timeout_counter == raop_ntp->max_ntp_timeouts);
+}
+
+static void
+raop_ntp_process_response(raop_ntp_t *raop_ntp, unsigned char *response, int response_len, uint64_t rx_time)
+{
+    raop_ntp_data_t sample;
+
+    //local time of the server when the NTP response packet returns
+    //(when the kernel received it, if receive timestamps are available)
+    int64_t t3 = (int64_t) raop_ntp_get_local_time(raop_ntp);
+    if (rx_time && rx_time <= (uint64_t) t3) {
+        uint64_t wakeup = (uint64_t) t3 - rx_time;
+        raop_ntp->rx_wakeup_total += wakeup;
+        raop_ntp->rx_wakeup_max = (wakeup > raop_ntp->rx_wakeup_max ? wakeup : raop_ntp->rx_wakeup_max);
+        raop_ntp->rx_stamped++;
+        t3 = (int64_t) rx_time;
+    }
+    raop_ntp->timeout_counter = 0;
+    if (raop_ntp->capture) {
+        capture_write(raop_ntp->capture, CAPTURE_TIMING, response, response_len, NULL, 0);
+    }
+
+    // Local time of the server when the NTP request packet leaves the server
+    int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
+
+    // Local time of the client when the NTP request packet arrives at the client
+    int64_t t1 = (int64_t) raop_remote_timestamp_to_nano_seconds(raop_ntp, byteutils_get_long_be(response, 16));
+
+    // Local time of the client when the response message leaves the client
+    int64_t t2 = (int64_t) raop_remote_timestamp_to_nano_seconds(raop_ntp, byteutils_get_long_be(response, 24));
+
+    if (logger_get_level(raop_ntp->logger) >= LOGGER_DEBUG) {
+        char *str = utils_data_to_string(response, response_len, 16);
+        logger_log(raop_ntp->logger, LOGGER_DEBUG,
+                   "raop_ntp receive time type_t=%d packetlen = %d, now = %8.6f t1 = %8.6f, t2 = %8.6f\n%s",
+                   response[1] &~0x80, response_len, (double) t3 / SECOND_IN_NSECS, (double) t1 / SECOND_IN_NSECS,
+                   (double) t2 / SECOND_IN_NSECS, str);
+        free(str);
+    }
+    // The iOS client device sends its time in  seconds relative to an arbitrary Epoch (the last boot).
+    // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970.
+    // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
+
+    sample.time = t3;
+    sample.offset     = ((t1 - t0) + (t2 - t3)) / 2;
+    sample.delay      = ((t3 - t0) - (t2 - t1));
+    sample.dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / SECOND_IN_NSECS;
+    raop_ntp_update(raop_ntp, &sample, &raop_ntp->last_used_time);
+    /* arg: the round-trip delay (usecs) */
+    trace_span("ntp", "exchange", raop_ntp->trace_send, sample.delay / 1000);
+}
+
+static void
+raop_ntp_log_stats(raop_ntp_t *raop_ntp)
+{
+    if (raop_ntp->rx_stamped) {
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp used %llu kernel receive timestamps: thread wakeup"
+                   " latency mean %.3f ms, max %.3f ms", (unsigned long long) raop_ntp->rx_stamped,
+                   (double) raop_ntp->rx_wakeup_total / (1000000.0 * raop_ntp->rx_stamped),
+                   (double) raop_ntp->rx_wakeup_max / 1000000.0);
+    }
+}
+
+static void
+raop_ntp_reset_poll_state(raop_ntp_t *raop_ntp)
+{
+    raop_ntp->last_used_time = 0;
+    raop_ntp->timeout_counter = 0;
+    raop_ntp->rx_stamped = 0;
+    raop_ntp->rx_wakeup_total = 0;
+    raop_ntp->rx_wakeup_max = 0;
+    raop_ntp->awaiting_reply = false;
+}
+
 static THREAD_RETVAL
 raop_ntp_thread(void *arg)
 {
     raop_ntp_t *raop_ntp = arg;
     assert(raop_ntp);
+    thread_config_apply(THREAD_CLASS_NTP, "uxplay-ntp", raop_ntp->logger);
     unsigned char response[128];
     int response_len;
-    unsigned char request[32] = {0x80, 0xd2, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-    };
-    raop_ntp_data_t data_sorted[RAOP_NTP_DATA_COUNT];
-    const unsigned  two_pow_n[RAOP_NTP_DATA_COUNT] = {2, 4, 8, 16, 32, 64, 128, 256};
-    int timeout_counter = 0;
     bool conn_reset = false;
-    bool logger_debug = (logger_get_level(raop_ntp->logger) >= LOGGER_DEBUG);
-      
+    raop_ntp_reset_poll_state(raop_ntp);
+
     while (1) {
         MUTEX_LOCK(raop_ntp->run_mutex);
         if (!raop_ntp->running) {
@@ -282,93 +636,17 @@ raop_ntp_thread(void *arg)
         }
         MUTEX_UNLOCK(raop_ntp->run_mutex);
 
-        // Flush the socket in case a super delayed response arrived or something
-        raop_ntp_flush_socket(raop_ntp->tsock);
-
-        // Send request
-        uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
-        byteutils_put_ntp_timestamp(request, 24, send_time);
-        int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
-                              (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
-        if (logger_debug) {
-            char *str = utils_data_to_string(request, sizeof(request), 16);
-            logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send time type_t=%d packetlen = %d, now = %8.6f\n%s",
-                       request[1] &~0x80, sizeof(request), (double) send_time / SECOND_IN_NSECS, str);
-            free(str);
-        }
-        if (send_len < 0) {
-            int sock_err = SOCKET_GET_ERROR();
-            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request. Error %d:%s",
-                     sock_err, strerror(sock_err));
-        } else {
+        if (raop_ntp_send_request(raop_ntp)) {
             // Read response
-            response_len = recvfrom(raop_ntp->tsock, (char *)response, sizeof(response), 0, NULL, NULL);
+            uint64_t rx_time = 0;
+            response_len = socket_recv_timestamped(raop_ntp->tsock, response, sizeof(response), 0, &rx_time);
             if (response_len < 0) {
-                timeout_counter++;
-                char time[30];
-                int level = (timeout_counter == 1 ? LOGGER_DEBUG : LOGGER_ERR);
-                ntp_timestamp_to_time(send_time, time, sizeof(time));
-                logger_log(raop_ntp->logger, level, "raop_ntp receive timeout %d (limit %d) (request sent %s)",
-                           timeout_counter, raop_ntp->max_ntp_timeouts, time);
-                if (timeout_counter ==  raop_ntp->max_ntp_timeouts) {
+                if (raop_ntp_response_timeout(raop_ntp)) {
                     conn_reset = true;   /* client is no longer responding */
                     break;
                 }
-	    } else {
-                //local time of the server when the NTP response packet returns
-                int64_t t3 = (int64_t) raop_ntp_get_local_time(raop_ntp);
-                timeout_counter = 0;
-
-                // Local time of the server when the NTP request packet leaves the server
-                int64_t t0 = (int64_t) byteutils_get_ntp_timestamp(response, 8);
-
-                // Local time of the client when the NTP request packet arrives at the client
-                int64_t t1 = (int64_t) raop_remote_timestamp_to_nano_seconds(raop_ntp, byteutils_get_long_be(response, 16));
-
-                // Local time of the client when the response message leaves the client
-                int64_t t2 = (int64_t) raop_remote_timestamp_to_nano_seconds(raop_ntp, byteutils_get_long_be(response, 24));
-
-                if (logger_debug) {
-                    char *str = utils_data_to_string(response, response_len, 16);                   
-                    logger_log(raop_ntp->logger, LOGGER_DEBUG,
-                               "raop_ntp receive time type_t=%d packetlen = %d, now = %8.6f t1 = %8.6f, t2 = %8.6f\n%s",
-                               response[1] &~0x80, response_len, (double) t3 / SECOND_IN_NSECS, (double) t1 / SECOND_IN_NSECS,
-                               (double) t2 / SECOND_IN_NSECS, str); 
-                    free(str);
-                }
-		// The iOS client device sends its time in  seconds relative to an arbitrary Epoch (the last boot).
-                // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970.
-                // This means we have to expect some rather huge offset, but its growth or shrink over time should be small.
-
-                raop_ntp->data_index = (raop_ntp->data_index + 1) % RAOP_NTP_DATA_COUNT;
-                raop_ntp->data[raop_ntp->data_index].time = t3;
-                raop_ntp->data[raop_ntp->data_index].offset     = ((t1 - t0) + (t2 - t3)) / 2;
-                raop_ntp->data[raop_ntp->data_index].delay      = ((t3 - t0) - (t2 - t1));
-                raop_ntp->data[raop_ntp->data_index].dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO +  (t3 - t0) * RAOP_NTP_PHI_PPM / SECOND_IN_NSECS;
-
-                // Sort by delay
-                memcpy(data_sorted, raop_ntp->data, sizeof(data_sorted));
-                qsort(data_sorted, RAOP_NTP_DATA_COUNT, sizeof(data_sorted[0]), raop_ntp_compare);
-
-                uint64_t dispersion = 0ull;
-                int64_t offset = data_sorted[0].offset;
-                int64_t delay = data_sorted[RAOP_NTP_DATA_COUNT - 1].delay;
-
-                // Calculate dispersion
-                for(int i = 0; i < RAOP_NTP_DATA_COUNT; ++i) {
-                    unsigned long long disp = raop_ntp->data[i].dispersion + (t3 - raop_ntp->data[i].time) * RAOP_NTP_PHI_PPM / SECOND_IN_NSECS;
-                    dispersion += disp / two_pow_n[i];
-                }
-
-                MUTEX_LOCK(raop_ntp->sync_params_mutex);
-
-                int64_t correction = offset - raop_ntp->sync_offset;
-                raop_ntp->sync_offset = offset;
-                raop_ntp->sync_dispersion = dispersion;
-                raop_ntp->sync_delay = delay;
-                MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld", correction);
+            } else {
+                raop_ntp_process_response(raop_ntp, response, response_len, rx_time);
             }
         }
 
@@ -376,7 +654,7 @@ raop_ntp_thread(void *arg)
         struct timespec wait_time;
         MUTEX_LOCK(raop_ntp->wait_mutex);
         clock_gettime(CLOCK_REALTIME, &wait_time);
-        wait_time.tv_sec += 3;
+        wait_time.tv_sec += RAOP_NTP_POLL_INTERVAL_SECS;
         pthread_cond_timedwait(&raop_ntp->wait_cond, &raop_ntp->wait_mutex, &wait_time);
         MUTEX_UNLOCK(raop_ntp->wait_mutex);
     }
@@ -386,15 +664,383 @@ raop_ntp_thread(void *arg)
     raop_ntp->running = false;
     MUTEX_UNLOCK(raop_ntp->run_mutex);
 
+    raop_ntp_log_stats(raop_ntp);
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp exiting thread");
     if (conn_reset && raop_ntp->callbacks.conn_reset) {
         const bool video_reset = false;   /* leave "frozen video" in place */
-        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, timeout_counter, video_reset);
+        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, raop_ntp->timeout_counter, video_reset);
+    }
+    return 0;
+}
+
+/* session loop: stops polling (on the loop thread, or before the socket is closed) */
+static void
+raop_ntp_loop_detach(raop_ntp_t *raop_ntp)
+{
+    session_loop_remove_socket(raop_ntp->session_loop, raop_ntp->tsock);
+    session_loop_remove_timer(raop_ntp->session_loop, raop_ntp->poll_timer);
+    session_loop_remove_timer(raop_ntp->session_loop, raop_ntp->reply_timer);
+    raop_ntp_log_stats(raop_ntp);
+}
+
+static void
+raop_ntp_loop_poll(void *cls, int fd)
+{
+    raop_ntp_t *raop_ntp = cls;
+    if (raop_ntp_send_request(raop_ntp)) {
+        raop_ntp->awaiting_reply = true;
+        session_loop_arm_timer(raop_ntp->session_loop, raop_ntp->reply_timer, RAOP_NTP_REPLY_TIMEOUT);
+    } else {
+        session_loop_arm_timer(raop_ntp->session_loop, raop_ntp->poll_timer, RAOP_NTP_POLL_INTERVAL_SECS * SECOND_IN_NSECS);
+    }
+}
+
+static void
+raop_ntp_loop_receive(void *cls, int fd)
+{
+    raop_ntp_t *raop_ntp = cls;
+    unsigned char response[128];
+    uint64_t rx_time = 0;
+    int response_len = socket_recv_timestamped(fd, response, sizeof(response), 0, &rx_time);
+    if (response_len < 0 || !raop_ntp->awaiting_reply) {
+        return;   /* a late response is discarded, as by the flush before each request */
+    }
+    raop_ntp->awaiting_reply = false;
+    session_loop_disarm_timer(raop_ntp->session_loop, raop_ntp->reply_timer);
+    raop_ntp_process_response(raop_ntp, response, response_len, rx_time);
+    session_loop_arm_timer(raop_ntp->session_loop, raop_ntp->poll_timer, RAOP_NTP_POLL_INTERVAL_SECS * SECOND_IN_NSECS);
+}
+
+static void
+raop_ntp_loop_reply_timeout(void *cls, int fd)
+{
+    raop_ntp_t *raop_ntp = cls;
+    raop_ntp->awaiting_reply = false;
+    if (!raop_ntp_response_timeout(raop_ntp)) {
+        session_loop_arm_timer(raop_ntp->session_loop, raop_ntp->poll_timer, RAOP_NTP_POLL_INTERVAL_SECS * SECOND_IN_NSECS);
+        return;
+    }
+
+    /* client is no longer responding */
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    raop_ntp->running = false;
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
+    raop_ntp_loop_detach(raop_ntp);
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped polling on the session loop");
+    if (raop_ntp->callbacks.conn_reset) {
+        const bool video_reset = false;   /* leave "frozen video" in place */
+        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, raop_ntp->timeout_counter, video_reset);
+    }
+}
+
+/* mutex locked: returns -1 if the socket and timers could not be added to the session loop */
+static int
+raop_ntp_loop_attach(raop_ntp_t *raop_ntp)
+{
+    session_loop_t *session_loop = raop_ntp->session_loop;
+    raop_ntp_reset_poll_state(raop_ntp);
+    raop_ntp->poll_timer = session_loop_add_timer(session_loop, raop_ntp_loop_poll, raop_ntp);
+    raop_ntp->reply_timer = session_loop_add_timer(session_loop, raop_ntp_loop_reply_timeout, raop_ntp);
+    if (raop_ntp->poll_timer == -1 || raop_ntp->reply_timer == -1 ||
+        session_loop_add_socket(session_loop, raop_ntp->tsock, raop_ntp_loop_receive, raop_ntp) == -1) {
+        if (raop_ntp->poll_timer != -1) session_loop_remove_timer(session_loop, raop_ntp->poll_timer);
+        if (raop_ntp->reply_timer != -1) session_loop_remove_timer(session_loop, raop_ntp->reply_timer);
+        return -1;
     }
+    session_loop_arm_timer(session_loop, raop_ntp->poll_timer, 0);
     return 0;
 }
 
+static int
+raop_ntp_init_ptp_sockets(raop_ntp_t *raop_ntp, int use_ipv6)
+{
+    assert(raop_ntp);
+    unsigned short eport = PTP_EVENT_PORT;
+    unsigned short gport = PTP_GENERAL_PORT;
+    raop_ntp->ptp_esock = netutils_init_socket(&eport, use_ipv6, 1);
+    raop_ntp->ptp_gsock = netutils_init_socket(&gport, use_ipv6, 1);
+    if (raop_ntp->ptp_esock == -1 || raop_ntp->ptp_gsock == -1) {
+        logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp could not open the PTP ports UDP %d and %d: they may be in use"
+                   " by another PTP service, or need privileges (e.g., CAP_NET_BIND_SERVICE on Linux)",
+                   PTP_EVENT_PORT, PTP_GENERAL_PORT);
+        if (raop_ntp->ptp_esock != -1) closesocket(raop_ntp->ptp_esock);
+        if (raop_ntp->ptp_gsock != -1) closesocket(raop_ntp->ptp_gsock);
+        raop_ntp->ptp_esock = -1;
+        raop_ntp->ptp_gsock = -1;
+        return -1;
+    }
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp local PTP sockets %d port UDP %d, %d port UDP %d",
+               raop_ntp->ptp_esock, eport, raop_ntp->ptp_gsock, gport);
+    return 0;
+}
+
+/* compares the host parts only (an IPv4 address may be received as IPv4-mapped IPv6) */
+static bool
+raop_ntp_same_host(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    const unsigned char *addr[2];
+    int addr_len[2];
+    const struct sockaddr_storage *saddr[2] = { a, b };
+    for (int i = 0; i < 2; i++) {
+        if (saddr[i]->ss_family == AF_INET) {
+            addr[i] = (const unsigned char *) &((const struct sockaddr_in *) saddr[i])->sin_addr;
+            addr_len[i] = 4;
+        } else if (saddr[i]->ss_family == AF_INET6) {
+            addr[i] = (const unsigned char *) &((const struct sockaddr_in6 *) saddr[i])->sin6_addr;
+            addr_len[i] = 16;
+            static const unsigned char v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+            if (!memcmp(addr[i], v4_mapped, sizeof(v4_mapped))) {
+                addr[i] += sizeof(v4_mapped);
+                addr_len[i] = 4;
+            }
+        } else {
+            return false;
+        }
+    }
+    return (addr_len[0] == addr_len[1] && !memcmp(addr[0], addr[1], addr_len[0]));
+}
+
+/* PTP messages are only accepted from the client, or a timing peer it announced with SETPEERS */
+static bool
+raop_ntp_is_ptp_peer(raop_ntp_t *raop_ntp, const struct sockaddr_storage *saddr)
+{
+    bool found = raop_ntp_same_host(saddr, &raop_ntp->remote_saddr);
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    for (int i = 0; !found && i < raop_ntp->ptp_peer_count; i++) {
+        found = raop_ntp_same_host(saddr, &raop_ntp->ptp_peers[i]);
+    }
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
+    return found;
+}
+
 void
+raop_ntp_set_ptp_peers(raop_ntp_t *raop_ntp, const char **peers, int count)
+{
+    assert(raop_ntp);
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    raop_ntp->ptp_peer_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (raop_ntp->ptp_peer_count == RAOP_PTP_MAX_PEERS) {
+            logger_log(raop_ntp->logger, LOGGER_WARNING, "raop_ntp only the first %d PTP timing peers are used",
+                       RAOP_PTP_MAX_PEERS);
+            break;
+        }
+        struct sockaddr_storage *peer = &raop_ntp->ptp_peers[raop_ntp->ptp_peer_count];
+        if (netutils_parse_address(AF_INET, peers[i], peer, sizeof(*peer)) < 0 &&
+            netutils_parse_address(AF_INET6, peers[i], peer, sizeof(*peer)) < 0) {
+            logger_log(raop_ntp->logger, LOGGER_WARNING, "raop_ntp invalid PTP timing peer address %s", peers[i]);
+            continue;
+        }
+        raop_ntp->ptp_peer_count++;
+    }
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
+}
+
+/*
+ * PTP slave: the offset of the master clock is measured from its (one- or two-step) Sync
+ * messages (t1 = master transmit time, t2 = local receive time) combined with the Delay_Resp
+ * replies to our Delay_Req messages (t3 = local transmit time, t4 = master receive time).
+ * If the master does not answer Delay_Req messages, one-way samples from the Sync messages
+ * alone are used, corrected by the last measured path delay (if any).  Messages from hosts other
+ * than the client and its SETPEERS timing peers are ignored, so that no other host on the network
+ * can become the master clock.
+ */
+static THREAD_RETVAL
+raop_ntp_ptp_thread(void *arg)
+{
+    raop_ntp_t *raop_ntp = arg;
+    assert(raop_ntp);
+    thread_config_apply(THREAD_CLASS_NTP, "uxplay-ptp", raop_ntp->logger);
+    unsigned char packet[128];
+    unsigned char request[PTP_DELAY_REQ_LEN];
+    ptp_header_t header;
+    raop_ntp_data_t sample;
+    uint64_t last_used_time = 0;
+    int esock = raop_ntp->ptp_esock;   /* raop_ntp_stop closes (and resets) the sockets */
+    int gsock = raop_ntp->ptp_gsock;
+    uint64_t clock_id = ((uint64_t) rand() << 32) ^ raop_ntp_get_local_time(raop_ntp);
+    uint64_t timeout = (uint64_t) raop_ntp->max_ntp_timeouts * 3 * SECOND_IN_NSECS;
+    bool conn_reset = false;
+
+    // The master clock, and the state of the Sync/Follow_Up and Delay_Req/Delay_Resp exchanges
+    uint64_t master_id = 0;
+    unsigned char master_domain = 0;
+    uint64_t master_seen = raop_ntp_get_local_time(raop_ntp);
+    struct sockaddr_storage master_saddr;
+    socklen_t master_saddr_len = 0;
+    unsigned short sync_seq = 0;
+    bool sync_pending = false;
+    bool have_sync = false;
+    int64_t sync_correction = 0;
+    uint64_t t1 = 0, t2 = 0, t3 = 0, t4 = 0;
+    unsigned short delay_req_seq = 0;
+    bool delay_req_pending = false;
+    uint64_t last_delay_resp = 0;
+    uint64_t last_one_way = 0;
+    int64_t path_delay = 0;
+    uint64_t rejected = 0;
+
+    while (1) {
+        MUTEX_LOCK(raop_ntp->run_mutex);
+        if (!raop_ntp->running) {
+            MUTEX_UNLOCK(raop_ntp->run_mutex);
+            break;
+        }
+        MUTEX_UNLOCK(raop_ntp->run_mutex);
+
+        if (raop_ntp_get_local_time(raop_ntp) - master_seen > timeout) {
+            logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp no PTP Sync messages received for %d seconds",
+                       raop_ntp->max_ntp_timeouts * 3);
+            conn_reset = true;   /* client is no longer responding */
+            break;
+        }
+
+        fd_set rfds;
+        struct timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        FD_ZERO(&rfds);
+        FD_SET(esock, &rfds);
+        FD_SET(gsock, &rfds);
+        int nfds = (esock > gsock ? esock : gsock) + 1;
+        if (select(nfds, &rfds, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            int sock = (i == 0 ? esock : gsock);
+            if (!FD_ISSET(sock, &rfds)) {
+                continue;
+            }
+            struct sockaddr_storage saddr;
+            socklen_t saddr_len = sizeof(saddr);
+            int len = recvfrom(sock, (char *) packet, sizeof(packet), 0, (struct sockaddr *) &saddr, &saddr_len);
+            uint64_t now = raop_ntp_get_local_time(raop_ntp);
+            if (len < 0 || ptp_parse_header(packet, len, &header) < 0) {
+                continue;
+            }
+            if (header.message_type != PTP_SYNC && header.message_type != PTP_FOLLOW_UP &&
+                header.message_type != PTP_DELAY_RESP) {
+                continue;   /* Announce, Signaling, ... */
+            }
+            if (!raop_ntp_is_ptp_peer(raop_ntp, &saddr)) {
+                if (!rejected++) {
+                    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp ignoring PTP messages from a host that is "
+                               "not a timing peer (clock %016llx)", (unsigned long long) header.clock_id);
+                }
+                continue;
+            }
+
+            if (header.message_type == PTP_SYNC) {
+                if (header.clock_id != master_id && (master_id == 0 || now - master_seen > RAOP_PTP_MASTER_TIMEOUT)) {
+                    logger_log(raop_ntp->logger, LOGGER_INFO, "raop_ntp using PTP master clock %016llx (domain %d)",
+                               (unsigned long long) header.clock_id, header.domain);
+                    master_id = header.clock_id;
+                    master_domain = header.domain;
+                    have_sync = false;
+                    delay_req_pending = false;
+                    last_delay_resp = 0;
+                }
+                if (header.clock_id != master_id) {
+                    continue;
+                }
+                master_seen = now;
+                memcpy(&master_saddr, &saddr, saddr_len);
+                master_saddr_len = saddr_len;
+                if (master_saddr.ss_family == AF_INET6) {
+                    ((struct sockaddr_in6 *) &master_saddr)->sin6_port = htons(PTP_EVENT_PORT);
+                } else {
+                    ((struct sockaddr_in *) &master_saddr)->sin_port = htons(PTP_EVENT_PORT);
+                }
+                sync_seq = header.sequence_id;
+                sync_correction = header.correction;
+                t2 = now;
+                if (header.flags & PTP_FLAG_TWO_STEP) {
+                    sync_pending = true;
+                    continue;
+                }
+                if (ptp_get_timestamp(packet, len, &t1) < 0) {
+                    continue;
+                }
+                t1 += sync_correction;
+            } else if (header.message_type == PTP_FOLLOW_UP) {
+                if (header.clock_id != master_id || !sync_pending || header.sequence_id != sync_seq) {
+                    continue;
+                }
+                sync_pending = false;
+                if (ptp_get_timestamp(packet, len, &t1) < 0) {
+                    continue;
+                }
+                t1 += sync_correction + header.correction;
+            } else if (header.message_type == PTP_DELAY_RESP) {
+                uint64_t requesting_id;
+                unsigned short requesting_port;
+                if (header.clock_id != master_id || !delay_req_pending || header.sequence_id != delay_req_seq ||
+                    ptp_get_requesting_port(packet, len, &requesting_id, &requesting_port) < 0 ||
+                    requesting_id != clock_id || ptp_get_timestamp(packet, len, &t4) < 0) {
+                    continue;
+                }
+                delay_req_pending = false;
+                if (!have_sync) {
+                    continue;
+                }
+                t4 -= header.correction;
+                last_delay_resp = now;
+                sample.time = now;
+                sample.offset = (((int64_t) t1 - (int64_t) t2) + ((int64_t) t4 - (int64_t) t3)) / 2;
+                sample.delay = ((int64_t) t2 - (int64_t) t1) + ((int64_t) t4 - (int64_t) t3);
+                sample.dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO + (now - t2) * RAOP_NTP_PHI_PPM / SECOND_IN_NSECS;
+                path_delay = sample.delay / 2;
+                raop_ntp_update(raop_ntp, &sample, &last_used_time);
+                continue;
+            } else {
+                continue;   /* Announce, Signaling, ... */
+            }
+
+            // A Sync (and Follow_Up) from the master has been received
+            have_sync = true;
+            if (delay_req_pending && now - t3 > RAOP_PTP_DELAY_RESP_TIMEOUT) {
+                delay_req_pending = false;
+            }
+            if (!delay_req_pending && now - t3 >= RAOP_PTP_DELAY_REQ_INTERVAL) {
+                int request_len = ptp_build_delay_req(request, master_domain, clock_id, ++delay_req_seq);
+                t3 = raop_ntp_get_local_time(raop_ntp);
+                if (sendto(esock, (char *) request, request_len, 0,
+                           (struct sockaddr *) &master_saddr, master_saddr_len) == request_len) {
+                    delay_req_pending = true;
+                }
+            }
+            if (now - last_delay_resp > RAOP_PTP_DELAY_RESP_TIMEOUT && now - last_one_way >= RAOP_PTP_SAMPLE_INTERVAL) {
+                // The delay is not measured: use the one-way delay implied by the current offset
+                int64_t one_way_delay = (int64_t) t2 - (int64_t) t1 + raop_ntp->sync_offset;
+                last_one_way = now;
+                sample.time = now;
+                sample.offset = (int64_t) t1 - (int64_t) t2 + path_delay;
+                sample.delay = 2 * (one_way_delay > 0 ? one_way_delay : -one_way_delay);
+                sample.dispersion = RAOP_NTP_R_RHO + RAOP_NTP_S_RHO;
+                raop_ntp_update(raop_ntp, &sample, &last_used_time);
+            }
+        }
+    }
+
+    // Ensure running reflects the actual state
+    MUTEX_LOCK(raop_ntp->run_mutex);
+    raop_ntp->running = false;
+    MUTEX_UNLOCK(raop_ntp->run_mutex);
+
+    if (rejected) {
+        logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp ignored %llu PTP messages from other hosts",
+                   (unsigned long long) rejected);
+    }
+    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp exiting PTP thread");
+    if (conn_reset && raop_ntp->callbacks.conn_reset) {
+        const bool video_reset = false;   /* leave "frozen video" in place */
+        raop_ntp->callbacks.conn_reset(raop_ntp->callbacks.cls, raop_ntp->max_ntp_timeouts, video_reset);
+    }
+    return 0;
+}
+
+int
 raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_timeouts)
 {
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp starting time");
@@ -409,7 +1055,7 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_t
     MUTEX_LOCK(raop_ntp->run_mutex);
     if (raop_ntp->running || !raop_ntp->joined) {
         MUTEX_UNLOCK(raop_ntp->run_mutex);
-        return;
+        return 0;
     }
 
     /* Initialize ports and sockets */
@@ -417,19 +1063,52 @@ raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_t
         use_ipv6 = 1;
     }
     //use_ipv6 = 0;
+    if (raop_ntp->time_protocol == PTP) {
+        if (raop_ntp_init_ptp_sockets(raop_ntp, use_ipv6) < 0) {
+            if (!raop_ntp->timing_rport) {
+                logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp PTP timing is unavailable, and the client"
+                           " did not supply an NTP timing port: audio/video sync is not possible");
+                MUTEX_UNLOCK(raop_ntp->run_mutex);
+                return -1;
+            }
+            logger_log(raop_ntp->logger, LOGGER_WARNING, "raop_ntp PTP timing is unavailable, falling back to"
+                       " NTP timing with the client's timing port %u", raop_ntp->timing_rport);
+            raop_ntp->time_protocol = NTP;
+        } else {
+            raop_ntp->running = 1;
+            raop_ntp->joined = 0;
+            raop_ntp->session_loop = NULL;   /* (not used for PTP) */
+            THREAD_CREATE(raop_ntp->thread, raop_ntp_ptp_thread, raop_ntp);
+            MUTEX_UNLOCK(raop_ntp->run_mutex);
+            return 0;
+        }
+    }
     if (raop_ntp_init_socket(raop_ntp, use_ipv6) < 0) {
         logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp initializing timing socket failed");
         MUTEX_UNLOCK(raop_ntp->run_mutex);
-        return;
+        return -1;
     }
     *timing_lport = raop_ntp->timing_lport;
 
-    /* Create the thread and initialize running values */
+    /* Create the thread (unless polling on the session loop) and initialize running values */
     raop_ntp->running = 1;
     raop_ntp->joined = 0;
-    
-    THREAD_CREATE(raop_ntp->thread, raop_ntp_thread, raop_ntp);
+
+    if (raop_ntp->session_loop && raop_ntp_loop_attach(raop_ntp) < 0) {
+        logger_log(raop_ntp->logger, LOGGER_WARNING, "raop_ntp could not poll on the session loop, using a thread");
+        raop_ntp->session_loop = NULL;
+    }
+    if (!raop_ntp->session_loop) {
+        THREAD_CREATE(raop_ntp->thread, raop_ntp_thread, raop_ntp);
+    }
     MUTEX_UNLOCK(raop_ntp->run_mutex);
+    return 0;
+}
+
+timing_protocol_t
+raop_ntp_get_time_protocol(raop_ntp_t *raop_ntp)
+{
+    return raop_ntp->time_protocol;
 }
 
 void
@@ -449,6 +1128,10 @@ raop_ntp_stop(raop_ntp_t *raop_ntp)
 
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopping time thread");
 
+    if (raop_ntp->session_loop && raop_ntp->tsock != -1) {
+        raop_ntp_loop_detach(raop_ntp);
+    }
+
     MUTEX_LOCK(raop_ntp->wait_mutex);
     COND_SIGNAL(raop_ntp->wait_cond);
     MUTEX_UNLOCK(raop_ntp->wait_mutex);
@@ -457,8 +1140,18 @@ raop_ntp_stop(raop_ntp_t *raop_ntp)
         closesocket(raop_ntp->tsock);
         raop_ntp->tsock = -1;
     }
+    if (raop_ntp->ptp_esock != -1) {
+        closesocket(raop_ntp->ptp_esock);
+        raop_ntp->ptp_esock = -1;
+    }
+    if (raop_ntp->ptp_gsock != -1) {
+        closesocket(raop_ntp->ptp_gsock);
+        raop_ntp->ptp_gsock = -1;
+    }
 
-    THREAD_JOIN(raop_ntp->thread);
+    if (!raop_ntp->session_loop) {
+        THREAD_JOIN(raop_ntp->thread);
+    }
 
     logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp stopped time thread");
 
@@ -501,19 +1194,22 @@ uint64_t raop_ntp_get_local_time(raop_ntp_t *raop_ntp) {
  * Returns the current time in nano seconds according to the remote wall clock.
  */
 uint64_t raop_ntp_get_remote_time(raop_ntp_t *raop_ntp) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    int64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
-    return (uint64_t) ((int64_t) raop_ntp_get_local_time(raop_ntp) + offset);
+    raop_ntp_sync_t sync;
+    uint64_t local_time = raop_ntp_get_local_time(raop_ntp);
+    raop_ntp_sync_read(raop_ntp, &sync);
+    int64_t offset = raop_ntp_extrapolate(sync.offset, sync.drift, sync.epoch, local_time);
+    return (uint64_t) ((int64_t) local_time + offset);
 }
 
 /**
  * Returns the local wall clock time in nano seconds for the given point in remote clock time
  */
 uint64_t raop_ntp_convert_remote_time(raop_ntp_t *raop_ntp, uint64_t remote_time) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    int64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+    raop_ntp_sync_t sync;
+    raop_ntp_sync_read(raop_ntp, &sync);
+    /* the drift correction is evaluated at the approximate local time remote_time - offset */
+    uint64_t local_time = (uint64_t) ((int64_t) remote_time - sync.offset);
+    int64_t offset = raop_ntp_extrapolate(sync.offset, sync.drift, sync.epoch, local_time);
     return (uint64_t) ((int64_t) remote_time - offset);
 }
 
@@ -521,8 +1217,8 @@ uint64_t raop_ntp_convert_remote_time(raop_ntp_t *raop_ntp, uint64_t remote_time
  * Returns the remote wall clock time in nano seconds for the given point in local clock time
  */
 uint64_t raop_ntp_convert_local_time(raop_ntp_t *raop_ntp, uint64_t local_time) {
-    MUTEX_LOCK(raop_ntp->sync_params_mutex);
-    int64_t offset = raop_ntp->sync_offset;
-    MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+    raop_ntp_sync_t sync;
+    raop_ntp_sync_read(raop_ntp, &sync);
+    int64_t offset = raop_ntp_extrapolate(sync.offset, sync.drift, sync.epoch, local_time);
     return (uint64_t) ((int64_t) local_time + offset);
 }
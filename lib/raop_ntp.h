@@ -22,17 +22,33 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "logger.h"
+#include "capture.h"
+#include "session_loop.h"
 
 typedef struct raop_ntp_s raop_ntp_t;
 
-typedef enum timing_protocol_e { NTP, TP_NONE, TP_OTHER, TP_UNSPECIFIED } timing_protocol_t;
+typedef enum timing_protocol_e { NTP, TP_NONE, TP_OTHER, TP_UNSPECIFIED, PTP } timing_protocol_t;
 
-void raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_timeouts);
+/* returns -1 if timing could not be started; PTP timing falls back to NTP if its ports cannot be *
+ * opened and the client supplied a timing port (see raop_ntp_get_time_protocol)                 */
+int raop_ntp_start(raop_ntp_t *raop_ntp, unsigned short *timing_lport, int max_ntp_timeouts);
+
+timing_protocol_t raop_ntp_get_time_protocol(raop_ntp_t *raop_ntp);
 
 void raop_ntp_stop(raop_ntp_t *raop_ntp);
 
 unsigned short raop_ntp_get_port(raop_ntp_t *raop_ntp);
 
+void raop_ntp_set_capture(raop_ntp_t *raop_ntp, capture_t *capture);
+
+/* poll the client's NTP clock on session_loop instead of a thread (must be set before raop_ntp_start; *
+ * PTP timing still uses its own thread)                                                               */
+void raop_ntp_set_session_loop(raop_ntp_t *raop_ntp, session_loop_t *session_loop);
+
+/* the PTP timing peers (IP address strings, from SETPEERS) that, besides the client, may be the *
+ * master clock; replaces any previous list                                                      */
+void raop_ntp_set_ptp_peers(raop_ntp_t *raop_ntp, const char **peers, int count);
+
 void raop_ntp_destroy(raop_ntp_t *raop_rtp);
 
 uint64_t raop_ntp_timestamp_to_nano_seconds(uint64_t ntp_timestamp, bool account_for_epoch_diff);
@@ -15,6 +15,10 @@
  * modified by fduncanh 2021-2023
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE    /* for recvmmsg */
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,6 +36,12 @@
 #include "mirror_buffer.h"
 #include "stream.h"
 #include "utils.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "metrics.h"
+#include "thread_config.h"
+#include "socket_tuning.h"
+#include "session_loop.h"
 
 #define NO_FLUSH (-42)
 
@@ -39,11 +49,49 @@
 #define RAOP_RTP_SYNC_DATA_COUNT 8
 #define SEC SECOND_IN_NSECS
 
+/* audio data packets are received in batches of up to RAOP_RTP_BATCH_SIZE (using recvmmsg on Linux) */
+#define RAOP_RTP_BATCH_SIZE 16
+#define RAOP_RTP_BATCH_LOG_INTERVAL 5000
+
 #define DELAY_AAC  0.275  //empirical, matches audio latency of about -0.25 sec after first clock sync event
 
 /* note: it is unclear what will happen in the unlikely event that this code is running at the time of the unix-time 
  * epoch event on 2038-01-19 at 3:14:08 UTC ! (but Apple will surely have removed AirPlay "legacy pairing" by then!) */
 
+typedef struct raop_rtp_batch_s {
+    unsigned char *buffers;    /* RAOP_RTP_BATCH_SIZE buffers of RAOP_PACKET_LEN bytes */
+    int lengths[RAOP_RTP_BATCH_SIZE];
+    uint64_t rx_times[RAOP_RTP_BATCH_SIZE];   /* kernel receive timestamps (0: none) */
+#if defined(__linux__)
+    struct mmsghdr msgs[RAOP_RTP_BATCH_SIZE];
+    struct iovec iovecs[RAOP_RTP_BATCH_SIZE];
+    union {
+        char buf[SOCKET_RX_TIME_CONTROL_LEN];
+        struct cmsghdr align;
+    } controls[RAOP_RTP_BATCH_SIZE];
+#endif
+    /* statistics */
+    uint64_t batches;
+    uint64_t packets;
+    int max_packets;
+} raop_rtp_batch_t;
+
+/* audio receive state kept between raop_rtp_udp_control and raop_rtp_udp_data calls */
+typedef struct raop_rtp_udp_state_s {
+    bool got_remote_control_saddr;
+    bool no_resend;
+    raop_rtp_batch_t *batch;
+
+    /* for initial rtp to ntp conversions */
+    bool have_synced;
+    bool no_data_yet;
+    int rtp_count;
+    double sync_adjustment;
+    unsigned short seqnum1, seqnum2;
+    uint64_t last_arrival_local;
+    uint64_t last_arrival_rtp;
+} raop_rtp_udp_state_t;
+
 typedef struct raop_rtp_sync_data_s {
     uint64_t ntp_time;  // The local wall clock time (unix time in usec) at the time of rtp_time
     uint64_t rtp_time;   // The remote rtp clock time corresponding to ntp_time
@@ -53,6 +101,9 @@ struct raop_rtp_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
 
+    /* received packets are recorded here if set */
+    capture_t *capture;
+
     // Time and sync
     raop_ntp_t *ntp;
     double rtp_clock_rate;
@@ -119,6 +170,16 @@ struct raop_rtp_s {
 
     /* audio compression type: ct = 2 (ALAC), ct = 8 (AAC_ELD) (ct = 4 would be AAC-MAIN) */
     unsigned char ct;
+
+    /* optional socket tuning (0: system defaults) */
+    int rcvbuf_size;
+    int busy_poll_usecs;
+
+    raop_rtp_udp_state_t udp;
+
+    /* if set, the sockets are read on this session loop instead of raop_rtp_thread_udp */
+    session_loop_t *session_loop;
+    int events_timer;
 };
 
 static int
@@ -197,6 +258,35 @@ raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp, co
 }
 
 
+void
+raop_rtp_set_socket_options(raop_rtp_t *raop_rtp, int rcvbuf_size, int busy_poll_usecs)
+{
+    assert(raop_rtp);
+    raop_rtp->rcvbuf_size = rcvbuf_size;
+    raop_rtp->busy_poll_usecs = busy_poll_usecs;
+}
+
+void
+raop_rtp_set_session_loop(raop_rtp_t *raop_rtp, session_loop_t *session_loop)
+{
+    assert(raop_rtp);
+    raop_rtp->session_loop = session_loop;
+}
+
+void
+raop_rtp_set_capture(raop_rtp_t *raop_rtp, capture_t *capture)
+{
+    assert(raop_rtp);
+    raop_rtp->capture = capture;
+}
+
+void
+raop_rtp_set_buffer_latency(raop_rtp_t *raop_rtp, int min_latency_ms, int max_latency_ms)
+{
+    assert(raop_rtp);
+    raop_buffer_set_latency(raop_rtp->buffer, min_latency_ms, max_latency_ms);
+}
+
 void
 raop_rtp_destroy(raop_rtp_t *raop_rtp)
 {
@@ -225,7 +315,8 @@ raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short cou
     addr = (struct sockaddr *)&raop_rtp->control_saddr;
     addrlen = raop_rtp->control_saddr_len;
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    trace_instant("audio", "resend request", seqnum);
     ourseqnum = raop_rtp->control_seqnum++;
 
     /* Fill the request buffer */
@@ -260,6 +351,18 @@ raop_rtp_init_sockets(raop_rtp_t *raop_rtp, int use_ipv6)
         goto sockets_cleanup;
     }
 
+    socket_tuning_apply(raop_rtp->logger, dsock, SOCKET_PROFILE_AUDIO_DATA, raop_rtp->rcvbuf_size);
+    socket_tuning_apply(raop_rtp->logger, csock, SOCKET_PROFILE_AUDIO_CONTROL, 0);
+#ifdef SO_BUSY_POLL
+    if (raop_rtp->busy_poll_usecs > 0) {
+        int busy_poll = raop_rtp->busy_poll_usecs;
+        if (setsockopt(dsock, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) == -1) {
+            logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp could not set SO_BUSY_POLL = %d usecs"
+                       " (this may require CAP_NET_ADMIN)", busy_poll);
+        }
+    }
+#endif
+
     /* Set socket descriptors */
     raop_rtp->csock = csock;
     raop_rtp->dsock = dsock;
@@ -441,36 +544,462 @@ uint64_t rtp64_time (raop_rtp_t *raop_rtp, const uint32_t *rtp32) {
     return  raop_rtp->rtp_time;
 }
 
-static THREAD_RETVAL
-raop_rtp_thread_udp(void *arg)
+static raop_rtp_batch_t *
+raop_rtp_batch_init()
 {
-    raop_rtp_t *raop_rtp = arg;
-    unsigned char packet[RAOP_PACKET_LEN];
-    unsigned int packetlen;
-    struct sockaddr_storage saddr;
-    socklen_t saddrlen;
-    bool got_remote_control_saddr = false;
+    raop_rtp_batch_t *batch = calloc(1, sizeof(raop_rtp_batch_t));
+    if (!batch) {
+        return NULL;
+    }
+    batch->buffers = malloc(RAOP_RTP_BATCH_SIZE * RAOP_PACKET_LEN);
+    if (!batch->buffers) {
+        free(batch);
+        return NULL;
+    }
+#if defined(__linux__)
+    for (int i = 0; i < RAOP_RTP_BATCH_SIZE; i++) {
+        batch->iovecs[i].iov_base = batch->buffers + i * RAOP_PACKET_LEN;
+        batch->iovecs[i].iov_len = RAOP_PACKET_LEN;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_control = batch->controls[i].buf;
+    }
+#endif
+    return batch;
+}
 
-    /* for initial rtp to ntp conversions */    
-    bool have_synced = false;
-    bool no_data_yet = true;
-    unsigned char no_data_marker[] = {0x00, 0x68, 0x34, 0x00 };
-    int rtp_count = 0;
-    double sync_adjustment = 0;
-    unsigned short seqnum1 = 0, seqnum2 = 0;
+static void
+raop_rtp_batch_destroy(raop_rtp_batch_t *batch)
+{
+    if (batch) {
+        free(batch->buffers);
+        free(batch);
+    }
+}
+
+/* receive the packets waiting on a readable socket; returns their number, or -1 on error */
+static int
+raop_rtp_batch_receive(raop_rtp_batch_t *batch, int sock)
+{
+    int count = 0;
+#if defined(__linux__)
+    for (int i = 0; i < RAOP_RTP_BATCH_SIZE; i++) {
+        batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->controls[i].buf);
+    }
+    count = recvmmsg(sock, batch->msgs, RAOP_RTP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    if (count == -1) {
+        return ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1);
+    }
+    for (int i = 0; i < count; i++) {
+        batch->lengths[i] = (int) batch->msgs[i].msg_len;
+        batch->rx_times[i] = socket_msg_rx_time(&batch->msgs[i].msg_hdr);
+    }
+#else
+    /* fallback: recvfrom until the socket is drained (one packet per batch on Windows) */
+    while (count < RAOP_RTP_BATCH_SIZE) {
+        int flags = 0;
+#ifndef _WIN32
+        if (count) {
+            flags = MSG_DONTWAIT;
+        }
+#endif
+        int len = socket_recv_timestamped(sock, batch->buffers + count * RAOP_PACKET_LEN, RAOP_PACKET_LEN, flags,
+                                          &batch->rx_times[count]);
+        if (len < 0) {
+            break;
+        }
+        batch->lengths[count++] = len;
+#ifdef _WIN32
+        break;
+#endif
+    }
+#endif
+    if (count > 0) {
+        batch->batches++;
+        batch->packets += count;
+        if (count > batch->max_packets) {
+            batch->max_packets = count;
+        }
+    }
+    return count;
+}
+
+static void
+raop_rtp_batch_log_stats(raop_rtp_t *raop_rtp, raop_rtp_batch_t *batch)
+{
+    if (batch->batches) {
+        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio data batch receive: %llu packets in %llu batches, "
+                   "average %.2f, max %d packets per batch", (unsigned long long) batch->packets,
+                   (unsigned long long) batch->batches, (double) batch->packets / batch->batches, batch->max_packets);
+    }
+}
+
+/*
+ * The audio receive logic is split into non-blocking steps, run either by raop_rtp_thread_udp or by the
+ * callbacks of a session loop: raop_rtp_udp_begin when streaming starts, raop_rtp_udp_control and
+ * raop_rtp_udp_data for a readable control or data socket, and raop_rtp_udp_end when it stops.
+ */
+
+static void
+raop_rtp_udp_begin(raop_rtp_t *raop_rtp)
+{
+    raop_rtp_udp_state_t *udp = &raop_rtp->udp;
+
+    /* for initial rtp to ntp conversions */
+    udp->got_remote_control_saddr = false;
+    udp->have_synced = false;
+    udp->no_data_yet = true;
+    udp->rtp_count = 0;
+    udp->sync_adjustment = 0;
+    udp->seqnum1 = 0;
+    udp->seqnum2 = 0;
+    udp->last_arrival_local = 0;
+    udp->last_arrival_rtp = 0;
 
-    assert(raop_rtp);
-    bool logger_debug = (logger_get_level(raop_rtp->logger) >= LOGGER_DEBUG);
     raop_rtp->ntp_start_time = raop_ntp_get_local_time(raop_rtp->ntp);
     raop_rtp->rtp_clock_started = false;
     for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; i++) {
         raop_rtp->sync_data[i].ntp_time = 0;
     }
 
-    int no_resend = (raop_rtp->control_rport == 0); /* true when control_rport is not set */
+    udp->no_resend = (raop_rtp->control_rport == 0); /* true when control_rport is not set */
+
+    udp->batch = raop_rtp_batch_init();
+    assert(udp->batch);
 
     logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp start_time = %8.6f (raop_rtp audio)",
                ((double) raop_rtp->ntp_start_time) / SEC);
+}
+
+/* the control socket is readable */
+static void
+raop_rtp_udp_control(raop_rtp_t *raop_rtp)
+{
+    raop_rtp_udp_state_t *udp = &raop_rtp->udp;
+    unsigned char control_packet[RAOP_PACKET_LEN];
+    unsigned char *packet = NULL;
+    unsigned int packetlen;
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen;
+    bool logger_debug = (logger_get_level(raop_rtp->logger) >= LOGGER_DEBUG);
+
+    packet = control_packet;
+    if (udp->got_remote_control_saddr== false) {
+        saddrlen = sizeof(saddr);
+        packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(control_packet), 0,
+                             (struct sockaddr *)&saddr, &saddrlen);
+        if (packetlen > 0) {
+            memcpy(&raop_rtp->control_saddr, &saddr, saddrlen);
+            raop_rtp->control_saddr_len = saddrlen;
+            udp->got_remote_control_saddr = true;
+        }
+    } else {
+        packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(control_packet), 0, NULL, NULL);
+    }
+    if ((int) packetlen <= 0) {
+        return;   /* nothing was waiting (non-blocking socket) */
+    }
+    if (raop_rtp->capture) {
+        capture_write(raop_rtp->capture, CAPTURE_AUDIO_CONTROL, packet, packetlen, NULL, 0);
+    }
+    int type_c = packet[1] & ~0x80;
+    LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "\nraop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
+
+    if (type_c == 0x56 && packetlen >= 8) {
+        /* Handle resent data packet, which begins at offset 4 of these packets */
+        unsigned char *resent_packet =  &packet[4];
+        unsigned int resent_packetlen = packetlen - 4;
+        unsigned short seqnum = byteutils_get_short_be(resent_packet, 2);
+        if (resent_packetlen >= 12) {
+            uint32_t timestamp = byteutils_get_int_be(resent_packet, 4);
+            uint64_t rtp_time = rtp64_time(raop_rtp, &timestamp);
+	    uint64_t ntp_time = 0;
+	    if (udp->have_synced) {
+                ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
+	    }
+            LOGGER_LOG(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp resent audio packet: seqnum=%u", seqnum);
+            int result = raop_buffer_enqueue(raop_rtp->buffer, resent_packet, resent_packetlen, &ntp_time, &rtp_time, 1);
+            assert(result >= 0);
+        } else if (logger_debug) {
+            /* type_c = 0x56 packets  with length 8 have been reported */
+            char *str = utils_data_to_string(packet, packetlen, 16);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
+                       packetlen, seqnum, str);
+            free (str);
+        }
+    } else if (type_c == 0x54 && packetlen >= 20) {
+        /* packet[0] = 0x90 (first sync ?) or 0x80 (subsequent ones)
+         * packet[1] = 0xd4,  (0xd4 && ~0x80 = type 0x54)
+         * packet[2:3] = 0x00 0x04
+         * packet[4:7] : sync_rtp (big-endian uint32_t)
+         * packet[8:15]: remote ntp timestamp (big-endian uint64_t)  
+         * packet[16:20]: next_rtp (big-endian uint32_t)
+         * next_rtp = sync_rtp + 7497 =  441 *  17 (0.17 sec) for AAC-ELD
+         * next_rtp = sync_rtp + 77175  = 441 * 175 (1.75 sec) for ALAC */
+
+        // The unit for the rtp clock is 1 / sample rate = 1 / 44100
+        uint32_t sync_rtp = byteutils_get_int_be(packet, 4);
+        uint64_t sync_rtp64 = rtp64_time(raop_rtp, &sync_rtp);
+        if (udp->have_synced == false) {
+            logger_log(raop_rtp->logger, LOGGER_DEBUG, "first audio rtp sync");
+            udp->have_synced = true;
+        }
+        uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
+        uint64_t sync_ntp_remote = raop_remote_timestamp_to_nano_seconds(raop_rtp->ntp, sync_ntp_raw);
+        if (logger_debug) {
+            uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
+            char *str = utils_data_to_string(packet, packetlen, 20);
+            logger_log(raop_rtp->logger, LOGGER_DEBUG,
+                       "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f\nts_client = %8.6f sync_rtp=%u\n%s",
+                       (double) sync_ntp_remote / SEC, (double) sync_ntp_local / SEC,
+                       (double) raop_rtp->ntp_start_time / SEC, (double) sync_ntp_remote / SEC, sync_rtp, str);
+            free(str);
+        }
+        raop_rtp_sync_clock(raop_rtp, &sync_ntp_remote, &sync_rtp64);		
+    } else if (logger_debug) {
+        char *str = utils_data_to_string(packet, packetlen, 16);
+        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n%s", str);
+        free(str);
+    }
+}
+
+/* rtp audio data packets:
+ * packet[0] 0x80
+ * packet[1] 0x60 = 96
+ * packet[2:3] seqnum (big-endian unsigned short)
+ * packet[4:7] rtp timestamp (big-endian unsigned int)
+ * packet[8:11] 0x00 0x00 0x00 0x00
+ * packet[12:packetlen - 1] encrypted audio payload
+ * For (AAC-ELD only), the payload of initial packets at the start of
+ * the stream may be replaced by a 4-byte "no_data_marker" 0x00 0x68 0x34 0x00 */
+
+/* consecutive AAC-ELD rtp timestamps differ by spf = 480
+ * consecutive ALAC rtp timestamps differ by spf = 352
+ * both have PCM uncompressed sampling rate = 441000 Hz */
+
+/* clock time in microseconds advances at (rtp_timestamp * 1000000)/44100 between frames */
+
+/* every AAC-ELD packet is sent three times:  0  0 1  0 1 2  1 2 3  2 3 4 ... 
+ * (after decoding AAC-ELD into PCM, the sound frame is three times bigger)
+ * ALAC packets are sent once only  0 1 2 3 4 5  ...  */
+
+/* When the AAC-ELD audio stream starts, the initial packets are length-16 packets with
+ * a four-byte "no_data_marker" 0x00 0x68 0x34 0x00 replacing the payload.
+ * The 12-byte packetheader contains  a secnum and rtp_timestamp, and each  packets is sent
+ * three times; the secnum and rtp_timestamp increment according to the same pattern as 
+ * AAC-ELD packets with audio content.*/
+
+ /* When the ALAC audio stream starts, the initial packets are length-44 packets with 
+  * the same 32-byte encrypted payload which after decryption is the beginning of a
+  * 32-byte ALAC packet, presumably with format information, but not actual audio data.
+  * The secnum and rtp_timestamp in the packet header increment according to the same
+  * pattern as ALAC packets with audio content */	
+
+ /* The first ALAC packet with data seems to be decoded just before the first sync event
+  * so its dequeuing should be delayed until the first rtp sync has occurred */
+
+/* the data socket is readable: returns -1 on error */
+static int
+raop_rtp_udp_data(raop_rtp_t *raop_rtp)
+{
+    raop_rtp_udp_state_t *udp = &raop_rtp->udp;
+    static const unsigned char no_data_marker[] = {0x00, 0x68, 0x34, 0x00 };
+    unsigned char *packet = NULL;
+    unsigned int packetlen;
+    bool logger_debug = (logger_get_level(raop_rtp->logger) >= LOGGER_DEBUG);
+
+    // Receiving audio data here
+    int batch_count = raop_rtp_batch_receive(udp->batch, raop_rtp->dsock);
+    if (batch_count == -1) {
+        logger_log(raop_rtp->logger, LOGGER_ERR, "raop_rtp error receiving audio data");
+        return -1;
+    }
+    if (logger_debug && batch_count && udp->batch->batches % RAOP_RTP_BATCH_LOG_INTERVAL == 0) {
+        raop_rtp_batch_log_stats(raop_rtp, udp->batch);
+    }
+    bool telemetry = telemetry_enabled();
+    uint64_t receive_time = (telemetry ? raop_ntp_get_local_time(raop_rtp->ntp) : 0);
+    for (int n = 0; n < batch_count; n++) {
+        packet = udp->batch->buffers + n * RAOP_PACKET_LEN;
+        packetlen = (unsigned int) udp->batch->lengths[n];
+        if (raop_rtp->capture) {
+            capture_write(raop_rtp->capture, CAPTURE_AUDIO, packet, packetlen, NULL, 0);
+        }
+        // rtp payload type
+        //int type_d = packet[1] & ~0x80;
+        //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
+    
+        if (packetlen < 12)  {
+            if (logger_debug) {
+                char *str = utils_data_to_string(packet, packetlen, 16);
+                logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s",
+                           packet[1] & ~0x80, packetlen, str);
+                free (str);
+            }
+            continue;
+        }
+
+        uint32_t rtp_timestamp =  byteutils_get_int_be(packet, 4);
+        uint64_t rtp_time = rtp64_time(raop_rtp, &rtp_timestamp);
+        uint64_t ntp_time = 0;
+
+        if (raop_rtp->ct == 2 && packetlen == 44)  continue;   /* ignore the ALAC packets with format information only. */
+
+        if (udp->have_synced) {
+            ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
+        } else if (packetlen == 16 && memcmp(packet + 12, no_data_marker, 4) == 0) {
+            /* use the special "no_data"  packet to help determine an initial offset before the first rtp sync. 
+             * until the first rtp sync occurs, we don't know the exact client ntp timestamp that matches the client rtp timestamp */
+            if (udp->no_data_yet) {
+                int64_t sync_ntp =  ((int64_t) raop_ntp_get_local_time(raop_rtp->ntp)) - ((int64_t) raop_rtp->ntp_start_time) ;
+                int64_t sync_rtp = ((int64_t) rtp_time) - ((int64_t) raop_rtp->rtp_start_time);
+                unsigned short seqnum = byteutils_get_short_be(packet, 2);
+                if  (udp->rtp_count == 0) {
+                    udp->sync_adjustment =  ((double) sync_ntp); 
+                    udp->rtp_count = 1;
+                    udp->seqnum1 = seqnum;
+                    udp->seqnum2 = seqnum;
+                }
+                if (udp->seqnum2 != seqnum) {  /* for AAC-ELD  only use copy 1 of the 3 copies of each  frame */
+                    udp->rtp_count++;
+                    udp->sync_adjustment += (((double) sync_ntp) - raop_rtp->rtp_clock_rate * sync_rtp - udp->sync_adjustment) / udp->rtp_count;
+                }
+                udp->seqnum2 = udp->seqnum1;
+                udp->seqnum1 = seqnum;
+            }
+            continue;
+        } else {
+            udp->no_data_yet = false;
+        }
+        uint64_t stage_start = 0;
+        /* the packets of a batch share the receive time: without their kernel timestamps (same clock), *
+         * only the arrival time of a packet received alone is meaningful                                */
+        uint64_t arrival_local = udp->batch->rx_times[n];
+        if (!arrival_local && batch_count == 1) {
+            arrival_local = receive_time;
+        }
+        if (telemetry) {
+            if (arrival_local) {
+                /* jitter: difference between inter-arrival and rtp timestamp intervals (first copy of each frame) */
+                if (udp->last_arrival_local && rtp_time > udp->last_arrival_rtp) {
+                    int64_t jitter = ((int64_t) (arrival_local - udp->last_arrival_local)) -
+                                     (int64_t) (raop_rtp->rtp_clock_rate * (rtp_time - udp->last_arrival_rtp));
+                    telemetry_record(TELEMETRY_AUDIO_JITTER, (uint64_t) (jitter < 0 ? -jitter : jitter));
+                }
+                if (rtp_time > udp->last_arrival_rtp) {
+                    udp->last_arrival_local = arrival_local;
+                    udp->last_arrival_rtp = rtp_time;
+                }
+            }
+            stage_start = telemetry_get_nsecs();
+        }
+        uint64_t trace_start = trace_begin();
+        int result = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, &ntp_time, &rtp_time, 1);
+        trace_span("audio", "enqueue", trace_start, packetlen);
+        assert(result >= 0);
+        metrics_add(METRICS_AUDIO_PACKETS, 1);
+        metrics_add(METRICS_AUDIO_BYTES, packetlen);
+        if (telemetry) {
+            telemetry_record(TELEMETRY_AUDIO_DECRYPT, telemetry_get_nsecs() - stage_start);
+        }
+
+        if (raop_rtp->ct == 2 && !udp->have_synced) {
+            /* in ALAC Audio-only  mode wait until the first sync before dequeing */
+            continue;
+        } else {
+        // Render continuous buffer entries
+            void *payload = NULL;
+            unsigned int payload_size;
+            unsigned short seqnum;
+            uint64_t rtp64_timestamp;
+            uint64_t ntp_timestamp;
+
+            while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &ntp_timestamp, &rtp64_timestamp, &seqnum, udp->no_resend))) {
+                audio_decode_struct audio_data; 
+                audio_data.rtp_time = rtp64_timestamp;
+                audio_data.seqnum = seqnum;
+                audio_data.data_len = payload_size;
+                audio_data.data = payload;
+                audio_data.ct = raop_rtp->ct;
+                if (udp->have_synced) {
+                    if (ntp_timestamp == 0) {
+                        ntp_timestamp = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp64_timestamp));
+                    }
+                    audio_data.ntp_time_remote = ntp_timestamp;
+                    audio_data.ntp_time_local  = raop_ntp_convert_remote_time(raop_rtp->ntp, audio_data.ntp_time_remote);
+                    audio_data.sync_status = 1;
+                } else {
+                    double elapsed_time =  raop_rtp->rtp_clock_rate * (rtp64_timestamp - raop_rtp->rtp_start_time) + udp->sync_adjustment
+                        + DELAY_AAC * SECOND_IN_NSECS; 
+                    audio_data.ntp_time_local = raop_rtp->ntp_start_time + (uint64_t) elapsed_time;
+                    audio_data.ntp_time_remote = raop_ntp_convert_local_time(raop_rtp->ntp, audio_data.ntp_time_local);
+                    audio_data.sync_status = 0;
+                }
+                if (telemetry) {
+                    /* how far ahead of its presentation time the audio frame is delivered (0 if late) */
+                    uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+                    telemetry_record(TELEMETRY_AUDIO_LEAD, (audio_data.ntp_time_local > ntp_now ?
+                                                            audio_data.ntp_time_local - ntp_now : 0));
+                    stage_start = telemetry_get_nsecs();
+                }
+                trace_start = trace_begin();
+                raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &audio_data);
+                trace_span("audio", "dequeue", trace_start, seqnum);
+                if (telemetry) {
+                    telemetry_record(TELEMETRY_AUDIO_PROCESS, telemetry_get_nsecs() - stage_start);
+                }
+                if (logger_debug) {
+                    uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+                    int64_t latency = ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time_local); 
+                    logger_log(raop_rtp->logger, LOGGER_DEBUG,
+                               "raop_rtp audio: now = %8.6f, ntp = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
+                               (double) ntp_now / SEC, (double) audio_data.ntp_time_local / SEC, (double) latency / SEC,
+                               (uint32_t) rtp64_timestamp, seqnum);
+                }
+            }
+
+            /* Handle possible resend requests */
+            if (!udp->no_resend) {
+                trace_start = trace_begin();
+                raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
+                trace_span("audio", "resends", trace_start, TRACE_NO_ARG);
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+raop_rtp_udp_end(raop_rtp_t *raop_rtp)
+{
+    raop_rtp_udp_state_t *udp = &raop_rtp->udp;
+    if (!udp->batch) {
+        return;   /* already ended */
+    }
+    raop_rtp_batch_log_stats(raop_rtp, udp->batch);
+    raop_rtp_batch_destroy(udp->batch);
+    udp->batch = NULL;
+
+    raop_buffer_stats_t stats;
+    raop_buffer_get_stats(raop_rtp->buffer, &stats);
+    logger_log(raop_rtp->logger, LOGGER_INFO, "raop_rtp audio jitter buffer (%zu kB): depth %d packets (%.1f ms, range %d - %d),"
+               " jitter %.2f ms; packets received %llu, late %llu, lost %llu, recovered %llu; resend requests %llu"
+               " for %llu packets (%.0f%% recovered, %llu too late to request), resend rtt %.1f ms",
+               stats.footprint / 1024, stats.depth, stats.depth * stats.packet_ms, stats.min_depth, stats.max_depth, stats.jitter_ms,
+               (unsigned long long) stats.received, (unsigned long long) stats.late, (unsigned long long) stats.lost,
+               (unsigned long long) stats.recovered, (unsigned long long) stats.resend_requests,
+               (unsigned long long) stats.resend_packets,
+               (stats.resend_packets ? 100.0 * (double) stats.recovered / (double) stats.resend_packets : 0.0),
+               (unsigned long long) stats.resend_expired, stats.resend_rtt_ms);
+}
+
+static THREAD_RETVAL
+raop_rtp_thread_udp(void *arg)
+{
+    raop_rtp_t *raop_rtp = arg;
+    assert(raop_rtp);
+    thread_config_apply(THREAD_CLASS_AUDIO, "uxplay-audio", raop_rtp->logger);
+    raop_rtp_udp_begin(raop_rtp);
 
     while(1) {
         fd_set rfds;
@@ -505,231 +1034,99 @@ raop_rtp_thread_udp(void *arg)
         }
 
         if (FD_ISSET(raop_rtp->csock, &rfds)) {
-            if (got_remote_control_saddr== false) {
-                saddrlen = sizeof(saddr);
-                packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(packet), 0,
-                                     (struct sockaddr *)&saddr, &saddrlen);
-                if (packetlen > 0) {
-                    memcpy(&raop_rtp->control_saddr, &saddr, saddrlen);
-                    raop_rtp->control_saddr_len = saddrlen;
-                    got_remote_control_saddr = true;
-                }
-	    } else {
-                packetlen = recvfrom(raop_rtp->csock, (char *)packet, sizeof(packet), 0, NULL, NULL);
-            }
-            int type_c = packet[1] & ~0x80;
-            logger_log(raop_rtp->logger, LOGGER_DEBUG, "\nraop_rtp type_c 0x%02x, packetlen = %d", type_c, packetlen);
-
-            if (type_c == 0x56 && packetlen >= 8) {
-	        /* Handle resent data packet, which begins at offset 4 of these packets */
-                unsigned char *resent_packet =  &packet[4];
-                unsigned int resent_packetlen = packetlen - 4;
-                unsigned short seqnum = byteutils_get_short_be(resent_packet, 2);
-                if (resent_packetlen >= 12) {
-                    uint32_t timestamp = byteutils_get_int_be(resent_packet, 4);
-                    uint64_t rtp_time = rtp64_time(raop_rtp, &timestamp);
-		    uint64_t ntp_time = 0;
-		    if (have_synced) {
-                        ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
-		    }
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp resent audio packet: seqnum=%u", seqnum);
-                    int result = raop_buffer_enqueue(raop_rtp->buffer, resent_packet, resent_packetlen, &ntp_time, &rtp_time, 1);
-                    assert(result >= 0);
-                } else if (logger_debug) {
-                    /* type_c = 0x56 packets  with length 8 have been reported */
-                    char *str = utils_data_to_string(packet, packetlen, 16);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
-                               packetlen, seqnum, str);
-                    free (str);
-                }
-            } else if (type_c == 0x54 && packetlen >= 20) {
-                /* packet[0] = 0x90 (first sync ?) or 0x80 (subsequent ones)
-                 * packet[1] = 0xd4,  (0xd4 && ~0x80 = type 0x54)
-                 * packet[2:3] = 0x00 0x04
-                 * packet[4:7] : sync_rtp (big-endian uint32_t)
-                 * packet[8:15]: remote ntp timestamp (big-endian uint64_t)  
-                 * packet[16:20]: next_rtp (big-endian uint32_t)
-                 * next_rtp = sync_rtp + 7497 =  441 *  17 (0.17 sec) for AAC-ELD
-                 * next_rtp = sync_rtp + 77175  = 441 * 175 (1.75 sec) for ALAC */
-
-                // The unit for the rtp clock is 1 / sample rate = 1 / 44100
-                uint32_t sync_rtp = byteutils_get_int_be(packet, 4);
-                uint64_t sync_rtp64 = rtp64_time(raop_rtp, &sync_rtp);
-                if (have_synced == false) {
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "first audio rtp sync");
-                    have_synced = true;
-                }
-                uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
-                uint64_t sync_ntp_remote = raop_remote_timestamp_to_nano_seconds(raop_rtp->ntp, sync_ntp_raw);
-                if (logger_debug) {
-                    uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
-                    char *str = utils_data_to_string(packet, packetlen, 20);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG,
-                               "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f\nts_client = %8.6f sync_rtp=%u\n%s",
-                               (double) sync_ntp_remote / SEC, (double) sync_ntp_local / SEC,
-                               (double) raop_rtp->ntp_start_time / SEC, (double) sync_ntp_remote / SEC, sync_rtp, str);
-                    free(str);
-                }
-                raop_rtp_sync_clock(raop_rtp, &sync_ntp_remote, &sync_rtp64);		
-            } else if (logger_debug) {
-                char *str = utils_data_to_string(packet, packetlen, 16);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n%s", str);
-                free(str);
+            raop_rtp_udp_control(raop_rtp);
+        }
+        if (FD_ISSET(raop_rtp->dsock, &rfds)) {
+            if (raop_rtp_udp_data(raop_rtp) < 0) {
+                break;
             }
         }
+    }
 
-        /* rtp audio data packets:
-         * packet[0] 0x80
-         * packet[1] 0x60 = 96
-         * packet[2:3] seqnum (big-endian unsigned short)
-         * packet[4:7] rtp timestamp (big-endian unsigned int)
-         * packet[8:11] 0x00 0x00 0x00 0x00
-         * packet[12:packetlen - 1] encrypted audio payload
-         * For (AAC-ELD only), the payload of initial packets at the start of
-         * the stream may be replaced by a 4-byte "no_data_marker" 0x00 0x68 0x34 0x00 */
-	
-        /* consecutive AAC-ELD rtp timestamps differ by spf = 480
-         * consecutive ALAC rtp timestamps differ by spf = 352
-         * both have PCM uncompressed sampling rate = 441000 Hz */
-
-        /* clock time in microseconds advances at (rtp_timestamp * 1000000)/44100 between frames */
-
-        /* every AAC-ELD packet is sent three times:  0  0 1  0 1 2  1 2 3  2 3 4 ... 
-         * (after decoding AAC-ELD into PCM, the sound frame is three times bigger)
-         * ALAC packets are sent once only  0 1 2 3 4 5  ...  */
-
-        /* When the AAC-ELD audio stream starts, the initial packets are length-16 packets with
-         * a four-byte "no_data_marker" 0x00 0x68 0x34 0x00 replacing the payload.
-         * The 12-byte packetheader contains  a secnum and rtp_timestamp, and each  packets is sent
-         * three times; the secnum and rtp_timestamp increment according to the same pattern as 
-         * AAC-ELD packets with audio content.*/
-
-	 /* When the ALAC audio stream starts, the initial packets are length-44 packets with 
-	  * the same 32-byte encrypted payload which after decryption is the beginning of a
-          * 32-byte ALAC packet, presumably with format information, but not actual audio data.
-          * The secnum and rtp_timestamp in the packet header increment according to the same
-          * pattern as ALAC packets with audio content */	
-
-         /* The first ALAC packet with data seems to be decoded just before the first sync event
-          * so its dequeuing should be delayed until the first rtp sync has occurred */
-
-
-	if (FD_ISSET(raop_rtp->dsock, &rfds)) {
-            //logger_log(raop_rtp->logger, LOGGER_INFO, "Would have data packet in queue");
-            // Receiving audio data here
-            saddrlen = sizeof(saddr);
-            packetlen = recvfrom(raop_rtp->dsock, (char *)packet, sizeof(packet), 0, NULL, NULL);
-            // rtp payload type
-            //int type_d = packet[1] & ~0x80;
-            //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
-	    
-            if (packetlen < 12)  {
-                if (logger_debug) {
-                    char *str = utils_data_to_string(packet, packetlen, 16);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s",
-                               packet[1] & ~0x80, packetlen, str);
-                    free (str);
-                }
-                continue;
-	    }
+    raop_rtp_udp_end(raop_rtp);
 
-            uint32_t rtp_timestamp =  byteutils_get_int_be(packet, 4);
-            uint64_t rtp_time = rtp64_time(raop_rtp, &rtp_timestamp);
-	    uint64_t ntp_time = 0;
+    // Ensure running reflects the actual state
+    MUTEX_LOCK(raop_rtp->run_mutex);
+    raop_rtp->running = false;
+    MUTEX_UNLOCK(raop_rtp->run_mutex);
 
-	    if (raop_rtp->ct == 2 && packetlen == 44)  continue;   /* ignore the ALAC packets with format information only. */
+    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp exiting thread");
 
-	    if (have_synced) {
-                ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
-	    } else if (packetlen == 16 && memcmp(packet + 12, no_data_marker, 4) == 0) {
-	        /* use the special "no_data"  packet to help determine an initial offset before the first rtp sync. 
-                 * until the first rtp sync occurs, we don't know the exact client ntp timestamp that matches the client rtp timestamp */
-                if (no_data_yet) {
-	            int64_t sync_ntp =  ((int64_t) raop_ntp_get_local_time(raop_rtp->ntp)) - ((int64_t) raop_rtp->ntp_start_time) ;
-                    int64_t sync_rtp = ((int64_t) rtp_time) - ((int64_t) raop_rtp->rtp_start_time);
-                    unsigned short seqnum = byteutils_get_short_be(packet, 2);
-                    if  (rtp_count == 0) {
-                        sync_adjustment =  ((double) sync_ntp); 
-                        rtp_count = 1;
-                        seqnum1 = seqnum;
-                        seqnum2 = seqnum;
-                    }
-                    if (seqnum2 != seqnum) {  /* for AAC-ELD  only use copy 1 of the 3 copies of each  frame */
-                        rtp_count++;
-                        sync_adjustment += (((double) sync_ntp) - raop_rtp->rtp_clock_rate * sync_rtp - sync_adjustment) / rtp_count;
-                    }
-                    seqnum2 = seqnum1;
-                    seqnum1 = seqnum;
-                }
-                continue;
-	    } else {
-                no_data_yet = false;
-	    }
-            int result = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, &ntp_time, &rtp_time, 1);
-            assert(result >= 0);
+    return 0;
+}
 
-	    if (raop_rtp->ct == 2 && !have_synced) {
-                /* in ALAC Audio-only  mode wait until the first sync before dequeing */
-                continue;
-            } else {
-            // Render continuous buffer entries
-                void *payload = NULL;
-                unsigned int payload_size;
-                unsigned short seqnum;
-                uint64_t rtp64_timestamp;
-                uint64_t ntp_timestamp;
-
-                while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &ntp_timestamp, &rtp64_timestamp, &seqnum, no_resend))) {
-                    audio_decode_struct audio_data; 
-                    audio_data.rtp_time = rtp64_timestamp;
-                    audio_data.seqnum = seqnum;
-                    audio_data.data_len = payload_size;
-                    audio_data.data = payload;
-                    audio_data.ct = raop_rtp->ct;
-                    if (have_synced) {
-                        if (ntp_timestamp == 0) {
-                            ntp_timestamp = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp64_timestamp));
-                        }
-                        audio_data.ntp_time_remote = ntp_timestamp;
-                        audio_data.ntp_time_local  = raop_ntp_convert_remote_time(raop_rtp->ntp, audio_data.ntp_time_remote);
-                        audio_data.sync_status = 1;
-                    } else {
-                        double elapsed_time =  raop_rtp->rtp_clock_rate * (rtp64_timestamp - raop_rtp->rtp_start_time) + sync_adjustment
-                            + DELAY_AAC * SECOND_IN_NSECS; 
-                        audio_data.ntp_time_local = raop_rtp->ntp_start_time + (uint64_t) elapsed_time;
-                        audio_data.ntp_time_remote = raop_ntp_convert_local_time(raop_rtp->ntp, audio_data.ntp_time_local);
-                        audio_data.sync_status = 0;
-                    }
-                    raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &audio_data);
-                    free(payload);
-                    if (logger_debug) {
-                        uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
-                        int64_t latency = ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time_local); 
-                        logger_log(raop_rtp->logger, LOGGER_DEBUG,
-                                   "raop_rtp audio: now = %8.6f, ntp = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
-                                   (double) ntp_now / SEC, (double) audio_data.ntp_time_local / SEC, (double) latency / SEC,
-                                   (uint32_t) rtp64_timestamp, seqnum);
-                    }
-                }
+/* session loop callbacks: the state changes from the RTSP requests (volume, flush, metadata ...) *
+ * are processed before each socket is read, and when the events timer is armed by a setter      */
 
-                /* Handle possible resend requests */
-                if (!no_resend) {
-                    raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
-                }
-            }
-        }
+static void
+raop_rtp_loop_detach(raop_rtp_t *raop_rtp)
+{
+    session_loop_remove_socket(raop_rtp->session_loop, raop_rtp->csock);
+    session_loop_remove_socket(raop_rtp->session_loop, raop_rtp->dsock);
+    session_loop_remove_timer(raop_rtp->session_loop, raop_rtp->events_timer);
+}
+
+static void
+raop_rtp_loop_events(void *cls, int fd)
+{
+    raop_rtp_t *raop_rtp = cls;
+    raop_rtp_process_events(raop_rtp, NULL);
+}
+
+static void
+raop_rtp_loop_control(void *cls, int fd)
+{
+    raop_rtp_t *raop_rtp = cls;
+    if (!raop_rtp_process_events(raop_rtp, NULL)) {
+        raop_rtp_udp_control(raop_rtp);
     }
+}
 
-    // Ensure running reflects the actual state
+static void
+raop_rtp_loop_data(void *cls, int fd)
+{
+    raop_rtp_t *raop_rtp = cls;
+    if (raop_rtp_process_events(raop_rtp, NULL) || raop_rtp_udp_data(raop_rtp) == 0) {
+        return;
+    }
+    /* as when raop_rtp_thread_udp exits after an error */
+    raop_rtp_loop_detach(raop_rtp);
+    raop_rtp_udp_end(raop_rtp);
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->running = false;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
+    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp stopped receiving on the session loop");
+}
 
-    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp exiting thread");
-
+/* mutex locked: returns -1 if the sockets could not be added to the session loop */
+static int
+raop_rtp_loop_attach(raop_rtp_t *raop_rtp)
+{
+    session_loop_t *session_loop = raop_rtp->session_loop;
+    raop_rtp->events_timer = session_loop_add_timer(session_loop, raop_rtp_loop_events, raop_rtp);
+    if (raop_rtp->events_timer == -1) {
+        return -1;
+    }
+    raop_rtp_udp_begin(raop_rtp);
+    if (session_loop_add_socket(session_loop, raop_rtp->csock, raop_rtp_loop_control, raop_rtp) == -1 ||
+        session_loop_add_socket(session_loop, raop_rtp->dsock, raop_rtp_loop_data, raop_rtp) == -1) {
+        raop_rtp_loop_detach(raop_rtp);
+        raop_rtp_batch_destroy(raop_rtp->udp.batch);
+        raop_rtp->udp.batch = NULL;
+        return -1;
+    }
     return 0;
 }
 
+/* run-mutex locked: a state change for raop_rtp_process_events */
+static void
+raop_rtp_notify_events(raop_rtp_t *raop_rtp)
+{
+    if (raop_rtp->session_loop && raop_rtp->running) {
+        session_loop_arm_timer(raop_rtp->session_loop, raop_rtp->events_timer, 0);
+    }
+}
+
 // Start rtp service, using two udp ports
 void
 raop_rtp_start_audio(raop_rtp_t *raop_rtp,  unsigned short *control_rport, unsigned short *control_lport,
@@ -748,6 +1145,7 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp,  unsigned short *control_rport, unsig
 
     raop_rtp->ct = *ct;
     raop_rtp->rtp_clock_rate = SECOND_IN_NSECS / *sr;
+    raop_buffer_set_rtp_clock_rate(raop_rtp->buffer, raop_rtp->rtp_clock_rate);
 
     /* Initialize ports and sockets */
     raop_rtp->control_lport = *control_lport;
@@ -764,11 +1162,17 @@ raop_rtp_start_audio(raop_rtp_t *raop_rtp,  unsigned short *control_rport, unsig
     }
     *control_lport = raop_rtp->control_lport;
     *data_lport = raop_rtp->data_lport;
-    /* Create the thread and initialize running values */
+    /* Create the thread (unless using the session loop) and initialize running values */
     raop_rtp->running = 1;
     raop_rtp->joined = 0;
 
-    THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    if (raop_rtp->session_loop && raop_rtp_loop_attach(raop_rtp) < 0) {
+        logger_log(raop_rtp->logger, LOGGER_WARNING, "raop_rtp could not use the session loop, using a thread");
+        raop_rtp->session_loop = NULL;
+    }
+    if (!raop_rtp->session_loop) {
+        THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
+    }
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -787,6 +1191,7 @@ raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->volume = volume;
     raop_rtp->volume_changed = 1;
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -808,6 +1213,7 @@ raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->metadata = metadata;
     raop_rtp->metadata_len = datalen;
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -829,6 +1235,7 @@ raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen)
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->coverart = coverart;
     raop_rtp->coverart_len = datalen;
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -851,6 +1258,7 @@ raop_rtp_remote_control_id(raop_rtp_t *raop_rtp, const char *dacp_id, const char
       free(raop_rtp->active_remote_header);
     }
     raop_rtp->active_remote_header = strdup(active_remote_header);
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -865,6 +1273,7 @@ raop_rtp_set_progress(raop_rtp_t *raop_rtp, unsigned int start, unsigned int cur
     raop_rtp->progress_curr = curr;
     raop_rtp->progress_end = end;
     raop_rtp->progress_changed = 1;
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -876,6 +1285,7 @@ raop_rtp_flush(raop_rtp_t *raop_rtp, int next_seq)
     /* Call flush in thread instead */
     MUTEX_LOCK(raop_rtp->run_mutex);
     raop_rtp->flush = next_seq;
+    raop_rtp_notify_events(raop_rtp);
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 }
 
@@ -894,8 +1304,13 @@ raop_rtp_stop(raop_rtp_t *raop_rtp)
     raop_rtp->running = 0;
     MUTEX_UNLOCK(raop_rtp->run_mutex);
 
-    /* Join the thread */
-    THREAD_JOIN(raop_rtp->thread);
+    if (raop_rtp->session_loop) {
+        raop_rtp_loop_detach(raop_rtp);
+        raop_rtp_udp_end(raop_rtp);
+    } else {
+        /* Join the thread */
+        THREAD_JOIN(raop_rtp->thread);
+    }
 
     if (raop_rtp->csock != -1) closesocket(raop_rtp->csock);
     if (raop_rtp->dsock != -1) closesocket(raop_rtp->dsock);
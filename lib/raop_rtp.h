@@ -22,6 +22,8 @@
 #include "raop.h"
 #include "logger.h"
 #include "raop_ntp.h"
+#include "capture.h"
+#include "session_loop.h"
 
 #define RAOP_AESIV_LEN  16
 #define RAOP_AESKEY_LEN 16
@@ -35,6 +37,12 @@ raop_rtp_t *raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, raop_nt
 void raop_rtp_start_audio(raop_rtp_t *raop_rtp, unsigned short *control_rport, unsigned short *control_lport,
                           unsigned short *data_lport, unsigned char *ct, unsigned int *sr);
 
+void raop_rtp_set_socket_options(raop_rtp_t *raop_rtp, int rcvbuf_size, int busy_poll_usecs);
+void raop_rtp_set_capture(raop_rtp_t *raop_rtp, capture_t *capture);
+
+/* receive on session_loop instead of a thread (must be set before raop_rtp_start_audio) */
+void raop_rtp_set_session_loop(raop_rtp_t *raop_rtp, session_loop_t *session_loop);
+void raop_rtp_set_buffer_latency(raop_rtp_t *raop_rtp, int min_latency_ms, int max_latency_ms);
 void raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume);
 void raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen);
 void raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen);
@@ -23,6 +23,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <time.h>
+#include <ctype.h>
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -36,6 +38,16 @@
 #include "byteutils.h"
 #include "mirror_buffer.h"
 #include "stream.h"
+#include "nal_parser.h"
+#include "sps_parser.h"
+#include "mirror_queue.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "metrics.h"
+#include "thread_config.h"
+#include "uring_recv.h"
+#include "socket_tuning.h"
+#include "session_loop.h"
 #include "utils.h"
 #include "plist/plist.h"
 
@@ -52,6 +64,7 @@
 #endif
 
 #define SECOND_IN_NSECS 1000000000UL
+#define MIRROR_RCVBUF_MSECS 500
 #define SEC SECOND_IN_NSECS
 
 /* for MacOS, where SOL_TCP and TCP_KEEPIDLE are not defined */
@@ -76,14 +89,73 @@
 //    unsigned char version;
 //};
 
+#define MIRROR_STAGE_RECEIVE 0  /* first byte of the packet header to last byte of the payload */
+#define MIRROR_STAGE_DECRYPT 1  /* decryption and NAL rewriting */
+#define MIRROR_STAGE_QUEUE   2  /* waiting in the queue for the delivery thread */
+#define MIRROR_STAGE_DELIVER 3  /* the video_process callback (rendering) */
+#define MIRROR_STAGES 4
+
+#define MIRROR_QUEUE_DRAIN_TIMEOUT_MS 500
+
+typedef struct raop_rtp_mirror_stage_s {
+    uint64_t count;
+    uint64_t total_nsecs;
+    uint64_t max_nsecs;
+} raop_rtp_mirror_stage_t;
+
+/* mirror receive state, kept between raop_rtp_mirror_stream_receive calls */
+typedef struct raop_rtp_mirror_stream_s {
+    bool active;                       /* between raop_rtp_mirror_stream_begin and _end */
+    int stream_fd;
+    bool conn_reset;
+
+    /* the packet being received: 128-byte header, then the payload */
+    unsigned char packet[128];
+    unsigned char* payload;
+    unsigned int readstart;
+
+    /* SPS, PPS (h264) or VPS, SPS, PPS (h265) to be prepended to the next VCL payload */
+    unsigned char* sps_pps;
+    bool prepend_sps_pps;
+    int sps_pps_len;
+    nal_unit_info_t param_sets[3];
+    int n_param_sets;
+    bool h265_video;
+    uint64_t ntp_timestamp_nal;
+
+    /* zero-copy mode: receive and decrypt VCL payloads directly into a renderer-supplied buffer */
+    bool zero_copy;
+    void *video_buffer;
+    int video_buffer_offset;
+
+    uint64_t frame_start;
+    uint64_t frame_received;
+    uint64_t frame_arrival;            /* kernel receive timestamp (local wall clock) of the frame, or 0 */
+    uint64_t last_arrival_local;
+    uint64_t last_arrival_remote;
+    uint64_t frames_received;
+    double rcvbuf_bitrate_kbps;        /* client-reported bitrate SO_RCVBUF was last sized for */
+    uint64_t recv_syscalls;            /* select() and recv() calls, without io_uring */
+    uring_recv_t *uring;
+} raop_rtp_mirror_stream_t;
+
 struct raop_rtp_mirror_s {
     logger_t *logger;
     raop_callbacks_t callbacks;
     raop_ntp_t *ntp;
 
+    /* received packets are recorded here if set */
+    capture_t *capture;
+
     /* Buffer to handle all resends */
     mirror_buffer_t *buffer;
 
+    /* pooled allocator for payload buffers (owned by raop) */
+    frame_pool_t *frame_pool;
+
+    /* receive the TCP stream with io_uring (Linux), if available */
+    bool use_io_uring;
+
     /* Remote address as sockaddr */
     struct sockaddr_storage remote_saddr;
     socklen_t remote_saddr_len;
@@ -104,8 +176,31 @@ struct raop_rtp_mirror_s {
 
      /* switch for displaying client FPS data */
      uint8_t show_client_FPS_data;
+
+     /* switch for accepting h265 video */
+     uint8_t h265;
+
+    /* frames are passed from the receive thread to the delivery thread through queue *
+     * (queue_depth 0: video_process is called directly from the receive thread)      */
+    int queue_depth;
+    mirror_queue_t *queue;
+    thread_handle_t thread_delivery;
+    int delivering;                /* run_mutex locked */
+    bool drop_to_idr;              /* receive thread: queue overflowed, drop frames until the next keyframe */
+    uint64_t frames_dropped;
+    uint64_t queue_overflows;
+
+    /* per-stage latency: receive thread (RECEIVE, DECRYPT), delivery thread (QUEUE, DELIVER) */
+    raop_rtp_mirror_stage_t stages[MIRROR_STAGES];
+
+    raop_rtp_mirror_stream_t stream;
+
+    /* if set, the sockets are read on this session loop instead of raop_rtp_mirror_thread */
+    session_loop_t *session_loop;
 };
 
+static const char *mirror_stage_names[MIRROR_STAGES] = { "receive", "decrypt", "queue", "deliver" };
+
 static int
 raop_rtp_mirror_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const char *remote, int remotelen)
 {
@@ -132,12 +227,14 @@ raop_rtp_mirror_parse_remote(raop_rtp_mirror_t *raop_rtp_mirror, const char *rem
 
 #define NO_FLUSH (-42)
 raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
-                                        const char *remote, int remotelen, const unsigned char *aeskey)
+                                        const char *remote, int remotelen, const unsigned char *aeskey,
+                                        frame_pool_t *frame_pool)
 {
     raop_rtp_mirror_t *raop_rtp_mirror;
 
     assert(logger);
     assert(callbacks);
+    assert(frame_pool);
 
     raop_rtp_mirror = calloc(1, sizeof(raop_rtp_mirror_t));
     if (!raop_rtp_mirror) {
@@ -145,6 +242,7 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     }
     raop_rtp_mirror->logger = logger;
     raop_rtp_mirror->ntp = ntp;
+    raop_rtp_mirror->frame_pool = frame_pool;
 
     memcpy(&raop_rtp_mirror->callbacks, callbacks, sizeof(raop_callbacks_t));
     raop_rtp_mirror->buffer = mirror_buffer_init(logger, aeskey);
@@ -159,6 +257,7 @@ raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *call
     raop_rtp_mirror->running = 0;
     raop_rtp_mirror->joined = 1;
     raop_rtp_mirror->flush = NO_FLUSH;
+    raop_rtp_mirror->queue_depth = MIRROR_QUEUE_DEFAULT_DEPTH;
 
     MUTEX_CREATE(raop_rtp_mirror->run_mutex);
     return raop_rtp_mirror;
@@ -170,534 +269,1174 @@ raop_rtp_mirror_init_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *streamCon
     mirror_buffer_init_aes(raop_rtp_mirror->buffer, streamConnectionID);
 }
 
-#define RAOP_PACKET_LEN 32768
-/**
- * Mirror
- */
+void
+raop_rtp_mirror_set_capture(raop_rtp_mirror_t *raop_rtp_mirror, capture_t *capture)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->capture = capture;
+}
+
+void
+raop_rtp_mirror_set_session_loop(raop_rtp_mirror_t *raop_rtp_mirror, session_loop_t *session_loop)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->session_loop = session_loop;
+}
+
+void
+raop_rtp_mirror_set_io_uring(raop_rtp_mirror_t *raop_rtp_mirror, bool use_io_uring)
+{
+    assert(raop_rtp_mirror);
+    raop_rtp_mirror->use_io_uring = use_io_uring;
+}
+
+void
+raop_rtp_mirror_set_queue_depth(raop_rtp_mirror_t *raop_rtp_mirror, int queue_depth)
+{
+    assert(raop_rtp_mirror);
+    if (queue_depth < 0) {
+        queue_depth = 0;
+    } else if (queue_depth > MIRROR_QUEUE_MAX_DEPTH) {
+        queue_depth = MIRROR_QUEUE_MAX_DEPTH;
+    }
+    raop_rtp_mirror->queue_depth = queue_depth;
+}
+
+static uint64_t
+raop_rtp_mirror_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+static void
+raop_rtp_mirror_stage_add(raop_rtp_mirror_t *raop_rtp_mirror, int stage, uint64_t start, uint64_t end)
+{
+    raop_rtp_mirror_stage_t *s = &raop_rtp_mirror->stages[stage];
+    uint64_t nsecs = (end > start ? end - start : 0);
+    s->count++;
+    s->total_nsecs += nsecs;
+    if (nsecs > s->max_nsecs) {
+        s->max_nsecs = nsecs;
+    }
+}
+
+static void
+raop_rtp_mirror_log_stats(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    for (int i = 0; i < MIRROR_STAGES; i++) {
+        raop_rtp_mirror_stage_t *s = &raop_rtp_mirror->stages[i];
+        if (s->count) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror %s stage: %llu frames,"
+                       " mean latency %.3f ms, max %.3f ms", mirror_stage_names[i], s->count,
+                       (double) s->total_nsecs / (1000000.0 * s->count), (double) s->max_nsecs / 1000000.0);
+        }
+    }
+    if (raop_rtp_mirror->queue_overflows) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror video queue overflowed %llu times,"
+                   " %llu frames were dropped", raop_rtp_mirror->queue_overflows, raop_rtp_mirror->frames_dropped);
+    }
+    memset(raop_rtp_mirror->stages, 0, sizeof(raop_rtp_mirror->stages));
+    raop_rtp_mirror->queue_overflows = 0;
+    raop_rtp_mirror->frames_dropped = 0;
+}
+
+/* frees a frame that was not passed to video_process */
+static void
+raop_rtp_mirror_discard_frame(raop_rtp_mirror_t *raop_rtp_mirror, h264_decode_struct *h264_data)
+{
+    if (h264_data->buffer) {
+        raop_rtp_mirror->callbacks.video_release_buffer(raop_rtp_mirror->callbacks.cls, h264_data->buffer);
+    } else {
+        frame_pool_free(raop_rtp_mirror->frame_pool, h264_data->data);
+    }
+}
+
+static void
+raop_rtp_mirror_deliver_frame(raop_rtp_mirror_t *raop_rtp_mirror, h264_decode_struct *h264_data)
+{
+    uint64_t start = raop_rtp_mirror_get_nsecs();
+    raop_rtp_mirror->callbacks.video_resume(raop_rtp_mirror->callbacks.cls);
+    raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, h264_data);
+    if (!h264_data->buffer) {
+        frame_pool_free(raop_rtp_mirror->frame_pool, h264_data->data);
+    } /* else video_process took ownership of the zero-copy video buffer */
+    raop_rtp_mirror_stage_add(raop_rtp_mirror, MIRROR_STAGE_DELIVER, start, raop_rtp_mirror_get_nsecs());
+}
+
+/* receive thread: passes a frame to the delivery thread without blocking. If the queue is full, *
+ * the frame is dropped, and so are all following frames up to the next keyframe, which are     *
+ * not decodable without it */
+static void
+raop_rtp_mirror_queue_frame(raop_rtp_mirror_t *raop_rtp_mirror, h264_decode_struct *h264_data)
+{
+    mirror_queue_entry_t entry;
+    if (raop_rtp_mirror->drop_to_idr && !h264_data->nal_index.keyframe) {
+        raop_rtp_mirror->frames_dropped++;
+        metrics_add(METRICS_VIDEO_FRAMES_DROPPED, 1);
+        raop_rtp_mirror_discard_frame(raop_rtp_mirror, h264_data);
+        return;
+    }
+    entry.frame = *h264_data;
+    entry.queued = raop_rtp_mirror_get_nsecs();
+    if (!mirror_queue_push(raop_rtp_mirror->queue, &entry)) {
+        if (!raop_rtp_mirror->drop_to_idr) {
+            raop_rtp_mirror->queue_overflows++;
+            LOGGER_LOG(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror video queue is full: dropping"
+                       " frames until the next keyframe");
+        }
+        raop_rtp_mirror->drop_to_idr = true;
+        raop_rtp_mirror->frames_dropped++;
+        metrics_add(METRICS_VIDEO_FRAMES_DROPPED, 1);
+        raop_rtp_mirror_discard_frame(raop_rtp_mirror, h264_data);
+        return;
+    }
+    raop_rtp_mirror->drop_to_idr = false;
+    metrics_set(METRICS_VIDEO_QUEUE_DEPTH, (int64_t) mirror_queue_count(raop_rtp_mirror->queue));
+}
+
 static THREAD_RETVAL
-raop_rtp_mirror_thread(void *arg)
+raop_rtp_mirror_delivery_thread(void *arg)
 {
     raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    mirror_queue_entry_t entry;
     assert(raop_rtp_mirror);
-
-    int stream_fd = -1;
-    unsigned char packet[128];
-    memset(packet, 0 , 128);
-    unsigned char* sps_pps = NULL;
-    bool prepend_sps_pps = false;
-    int sps_pps_len = 0;
-    unsigned char* payload = NULL;
-    unsigned int readstart = 0;
-    bool conn_reset = false;
-    uint64_t ntp_timestamp_nal = 0;
-    uint64_t ntp_timestamp_raw = 0;
-    uint64_t ntp_timestamp_remote = 0;
-    uint64_t ntp_timestamp_local  = 0;
-    unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
-    bool logger_debug = (logger_get_level(raop_rtp_mirror->logger) >= LOGGER_DEBUG);
-    bool h265_video_detected = false;
+    thread_config_apply(THREAD_CLASS_VIDEO, "uxplay-vdeliver", raop_rtp_mirror->logger);
 
     while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds, ret;
+        if (mirror_queue_pop(raop_rtp_mirror->queue, &entry, 100)) {
+            uint64_t now = raop_rtp_mirror_get_nsecs();
+            raop_rtp_mirror_stage_add(raop_rtp_mirror, MIRROR_STAGE_QUEUE, entry.queued, now);
+            MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+            int delivering = raop_rtp_mirror->delivering;
+            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+            if (delivering) {
+                raop_rtp_mirror_deliver_frame(raop_rtp_mirror, &entry.frame);
+            } else {
+                raop_rtp_mirror_discard_frame(raop_rtp_mirror, &entry.frame);
+            }
+            mirror_queue_done(raop_rtp_mirror->queue);
+            continue;
+        }
         MUTEX_LOCK(raop_rtp_mirror->run_mutex);
-        if (!raop_rtp_mirror->running) {
+        if (!raop_rtp_mirror->delivering) {
             MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
-            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror->running is no longer true");
             break;
         }
         MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    }
+    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting video delivery thread");
+    return 0;
+}
 
-        /* Set timeout valu to 5ms */
-        tv.tv_sec = 0;
-        tv.tv_usec = 5000;
+static void
+raop_rtp_mirror_start_delivery(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror->drop_to_idr = false;
+    if (raop_rtp_mirror->queue_depth == 0) {
+        return;
+    }
+    raop_rtp_mirror->queue = mirror_queue_init(raop_rtp_mirror->queue_depth);
+    if (!raop_rtp_mirror->queue) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not create video queue");
+        return;
+    }
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    raop_rtp_mirror->delivering = 1;
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    THREAD_CREATE(raop_rtp_mirror->thread_delivery, raop_rtp_mirror_delivery_thread, raop_rtp_mirror);
+    if (!raop_rtp_mirror->thread_delivery) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror could not start video delivery thread");
+        mirror_queue_destroy(raop_rtp_mirror->queue);
+        raop_rtp_mirror->queue = NULL;
+        return;
+    }
+    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror video delivery thread started,"
+               " queue depth %d", raop_rtp_mirror->queue_depth);
+}
 
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (stream_fd == -1) {
-            FD_SET(raop_rtp_mirror->mirror_data_sock, &rfds);
-            nfds = raop_rtp_mirror->mirror_data_sock+1;
-        } else {
-            FD_SET(stream_fd, &rfds);
-            nfds = stream_fd+1;
+/* unprocessed frames still in the queue are discarded */
+static void
+raop_rtp_mirror_stop_delivery(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    if (!raop_rtp_mirror->queue) {
+        return;
+    }
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    raop_rtp_mirror->delivering = 0;
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    mirror_queue_wake(raop_rtp_mirror->queue);
+    THREAD_JOIN(raop_rtp_mirror->thread_delivery);
+    mirror_queue_destroy(raop_rtp_mirror->queue);
+    raop_rtp_mirror->queue = NULL;
+}
+
+#define RAOP_PACKET_LEN 32768
+/**
+ * Mirror
+ */
+/* numeric value of a client stats plist node (reals, integers, or strings such as "30.0 fps") */
+static bool
+raop_rtp_mirror_get_stats_value(plist_t node, double *value)
+{
+    switch (plist_get_node_type(node)) {
+    case PLIST_REAL:
+        plist_get_real_val(node, value);
+        return true;
+    case PLIST_UINT: {
+        uint64_t uint_val;
+        plist_get_uint_val(node, &uint_val);
+        *value = (double) (int64_t) uint_val;   /* libplist stores signed integers as PLIST_UINT */
+        return true;
+    }
+    case PLIST_STRING: {
+        char *str = NULL;
+        char *end;
+        plist_get_string_val(node, &str);
+        if (!str) {
+            return false;
         }
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
+        *value = strtod(str, &end);
+        bool valid = (end != str);
+        free(str);
+        return valid;
+    }
+    default:
+        return false;
+    }
+}
+
+/* the client stats keys that are decoded (compared ignoring case and spaces), with the factor that *
+ * converts their values to the unit of the client_video_stats_t field; other keys are ignored     *
+ * (-FPSdata shows the full report)                                                                */
+static const struct {
+    const char *name;
+    unsigned int field;
+    double scale;
+} client_stats_keys[] = {
+    { "fps",               CLIENT_STATS_FPS,            1.0 },
+    { "framerate",         CLIENT_STATS_FPS,            1.0 },
+    { "droppedframes",     CLIENT_STATS_DROPPED,        1.0 },
+    { "framesdropped",     CLIENT_STATS_DROPPED,        1.0 },
+    { "bitrate",           CLIENT_STATS_BITRATE,        0.001 },    /* bits/sec */
+    { "bitratekbps",       CLIENT_STATS_BITRATE,        1.0 },
+    { "bitratembps",       CLIENT_STATS_BITRATE,        1000.0 },
+    { "encodetime",        CLIENT_STATS_ENCODE_LATENCY, 1.0 },      /* msecs */
+    { "encodelatency",     CLIENT_STATS_ENCODE_LATENCY, 1.0 },      /* msecs */
+    { "width",             CLIENT_STATS_WIDTH,          1.0 },
+    { "height",            CLIENT_STATS_HEIGHT,         1.0 },
+};
+
+static void
+raop_rtp_mirror_add_stats_value(client_video_stats_t *stats, const char *key, double value)
+{
+    char name[64];
+    int len = 0;
+    for (const char *c = key; *c && len < (int) sizeof(name) - 1; c++) {
+        if (!isspace((unsigned char) *c)) {
+            name[len++] = (char) tolower((unsigned char) *c);
+        }
+    }
+    name[len] = '\0';
+    stats->keys++;
+    for (size_t i = 0; i < sizeof(client_stats_keys) / sizeof(client_stats_keys[0]); i++) {
+        if (strcmp(name, client_stats_keys[i].name)) {
             continue;
-        } else if (ret == -1) {
-            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in select");
+        }
+        value *= client_stats_keys[i].scale;
+        switch (client_stats_keys[i].field) {
+        case CLIENT_STATS_FPS:
+            stats->fps = value;
+            break;
+        case CLIENT_STATS_DROPPED:
+            stats->dropped = value;
+            break;
+        case CLIENT_STATS_BITRATE:
+            stats->bitrate_kbps = value;
+            break;
+        case CLIENT_STATS_ENCODE_LATENCY:
+            stats->encode_latency_ms = value;
+            break;
+        case CLIENT_STATS_WIDTH:
+            stats->width = (int) value;
+            break;
+        case CLIENT_STATS_HEIGHT:
+            stats->height = (int) value;
             break;
         }
+        stats->valid |= client_stats_keys[i].field;
+        return;
+    }
+}
 
-        if (stream_fd == -1 &&
-	    (raop_rtp_mirror && raop_rtp_mirror->mirror_data_sock >= 0) &&
-            FD_ISSET(raop_rtp_mirror->mirror_data_sock, &rfds)) {
-            struct sockaddr_storage saddr;
-            socklen_t saddrlen;
-            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
-            saddrlen = sizeof(saddr);
-            stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
-            if (stream_fd == -1) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
-                           "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
-                break;
-            }
+static void
+raop_rtp_mirror_parse_stats_dict(client_video_stats_t *stats, plist_t dict, int level)
+{
+    plist_dict_iter iter = NULL;
+    plist_dict_new_iter(dict, &iter);
+    if (!iter) {
+        return;
+    }
+    while (1) {
+        char *key = NULL;
+        plist_t node = NULL;
+        double value;
+        plist_dict_next_item(dict, iter, &key, &node);
+        if (!node) {
+            free(key);
+            break;
+        }
+        if (plist_get_node_type(node) == PLIST_DICT && level < 2) {
+            raop_rtp_mirror_parse_stats_dict(stats, node, level + 1);
+        } else if (key && raop_rtp_mirror_get_stats_value(node, &value)) {
+            raop_rtp_mirror_add_stats_value(stats, key, value);
+        }
+        free(key);
+    }
+    free(iter);
+}
 
-            // We're calling recv for a certain amount of data, so we need a timeout
-            struct timeval tv;
-            tv.tv_sec = 0;
-            tv.tv_usec = 5000;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_RCVTIMEO, CAST &tv, sizeof(tv)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
-                           "raop_rtp_mirror could not set stream socket timeout %d %s", errno, strerror(errno));
-                break;
-            }
+/* decodes the binary-plist video streaming performance report (0x05 packet) sent by the client */
+static bool
+raop_rtp_mirror_parse_client_stats(plist_t root_node, client_video_stats_t *stats)
+{
+    memset(stats, 0, sizeof(client_video_stats_t));
+    if (!root_node || plist_get_node_type(root_node) != PLIST_DICT) {
+        return false;
+    }
+    raop_rtp_mirror_parse_stats_dict(stats, root_node, 0);
+    return (stats->keys > 0);
+}
 
-            int option;
-            option = 1;
-            if (setsockopt(stream_fd, SOL_SOCKET, SO_KEEPALIVE, CAST &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
-                           "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
-            }
-            option = 60;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPIDLE, CAST &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
-                           "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
-            }
-            option = 10;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPINTVL, CAST &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
-                           "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
-            }
-            option = 6;
-            if (setsockopt(stream_fd, SOL_TCP, TCP_KEEPCNT, CAST &option, sizeof(option)) < 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
-                           "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
-            }
-            readstart = 0;
+/* the SPS arrives (in the SPS+PPS packet) before the first keyframe: its parameters let the *
+ * renderer set up its caps before decoding starts                                           */
+static void
+raop_rtp_mirror_report_sps(raop_rtp_mirror_t *raop_rtp_mirror, const unsigned char *sps, int sps_size, bool h265)
+{
+    video_sps_info_t info;
+    char str[160];
+    int ret = (h265 ? sps_parser_parse_h265(sps, sps_size, &info) : sps_parser_parse_h264(sps, sps_size, &info));
+    if (ret < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: could not parse the %s SPS (size %d)",
+                   (h265 ? "h265" : "h264"), sps_size);
+        return;
+    }
+    sps_parser_describe(&info, str, sizeof(str));
+    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "video stream: %s", str);
+    if (raop_rtp_mirror->callbacks.video_set_format) {
+        raop_rtp_mirror->callbacks.video_set_format(raop_rtp_mirror->callbacks.cls, &info);
+    }
+}
+
+/*
+ * The mirror receive logic is split into non-blocking steps, run either by raop_rtp_mirror_thread or by
+ * the callbacks of a session loop: raop_rtp_mirror_stream_begin when mirroring starts,
+ * raop_rtp_mirror_stream_accept when the listening socket is readable, raop_rtp_mirror_stream_receive
+ * when the stream socket is readable (a partially-received packet is kept in the stream state), and
+ * raop_rtp_mirror_stream_end when it stops.
+ */
+
+static void
+raop_rtp_mirror_stream_begin(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_stream_t *stream = &raop_rtp_mirror->stream;
+    memset(stream, 0, sizeof(raop_rtp_mirror_stream_t));
+    stream->active = true;
+    stream->stream_fd = -1;
+    /* zero-copy mode: receive and decrypt VCL payloads directly into a renderer-supplied buffer */
+    stream->zero_copy = (raop_rtp_mirror->callbacks.video_get_buffer && raop_rtp_mirror->callbacks.video_release_buffer);
+    if (raop_rtp_mirror->use_io_uring && !raop_rtp_mirror->session_loop) {
+        stream->uring = uring_recv_init();
+        logger_log(raop_rtp_mirror->logger, (stream->uring ? LOGGER_DEBUG : LOGGER_WARNING), "raop_rtp_mirror: %s",
+                   (stream->uring ? "using io_uring to receive the video stream" :
+                    "io_uring is not available (needs Linux >= 6.0), using recv()"));
+    } else if (raop_rtp_mirror->use_io_uring) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: io_uring is not used with the session loop");
+    }
+    raop_rtp_mirror_start_delivery(raop_rtp_mirror);
+}
+
+/* the listening socket is readable: returns 0 when a client was accepted, 1 if none was waiting, -1 on error */
+static int
+raop_rtp_mirror_stream_accept(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_stream_t *stream = &raop_rtp_mirror->stream;
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen;
+    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror accepting client");
+    saddrlen = sizeof(saddr);
+    stream->stream_fd = accept(raop_rtp_mirror->mirror_data_sock, (struct sockaddr *)&saddr, &saddrlen);
+    if (stream->stream_fd == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 1;   /* (non-blocking listening socket) */
         }
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
+                   "raop_rtp_mirror error in accept %d %s", errno, strerror(errno));
+        return -1;
+    }
+
+    // We're calling recv for a certain amount of data, so we need a timeout
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 5000;
+    if (setsockopt(stream->stream_fd, SOL_SOCKET, SO_RCVTIMEO, CAST &tv, sizeof(tv)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
+                   "raop_rtp_mirror could not set stream socket timeout %d %s", errno, strerror(errno));
+        return -1;
+    }
+
+    int option;
+    option = 1;
+    if (setsockopt(stream->stream_fd, SOL_SOCKET, SO_KEEPALIVE, CAST &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
+                   "raop_rtp_mirror could not set stream socket keepalive %d %s", errno, strerror(errno));
+    }
+    option = 60;
+    if (setsockopt(stream->stream_fd, SOL_TCP, TCP_KEEPIDLE, CAST &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
+                   "raop_rtp_mirror could not set stream socket keepalive time %d %s", errno, strerror(errno));
+    }
+    option = 10;
+    if (setsockopt(stream->stream_fd, SOL_TCP, TCP_KEEPINTVL, CAST &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
+                   "raop_rtp_mirror could not set stream socket keepalive interval %d %s", errno, strerror(errno));
+    }
+    option = 6;
+    if (setsockopt(stream->stream_fd, SOL_TCP, TCP_KEEPCNT, CAST &option, sizeof(option)) < 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING,
+                   "raop_rtp_mirror could not set stream socket keepalive probes %d %s", errno, strerror(errno));
+    }
+    socket_tuning_apply(raop_rtp_mirror->logger, stream->stream_fd, SOCKET_PROFILE_MIRROR, 0);
+    stream->rcvbuf_bitrate_kbps = 0.0;
+    stream->readstart = 0;
+    return 0;
+}
+
+#define MIRROR_RECV(fd, buf, len) (stream->uring ? uring_recv(stream->uring, fd, buf, len, 5) : \
+                                   (stream->recv_syscalls++, recv(fd, CAST (buf), len, 0)))
+
+/* the stream socket is readable: returns 0 (packet received, or waiting for more data), *
+ * 1 if the client closed the connection (between packets), or -1 on error              */
+static int
+raop_rtp_mirror_stream_receive(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_stream_t *stream = &raop_rtp_mirror->stream;
+    uint64_t ntp_timestamp_raw = 0;
+    uint64_t ntp_timestamp_remote = 0;
+    uint64_t ntp_timestamp_local  = 0;
+    unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    bool logger_debug = (logger_get_level(raop_rtp_mirror->logger) >= LOGGER_DEBUG);
+    int ret = 1;
+
 
-        if (stream_fd != -1 && FD_ISSET(stream_fd, &rfds)) {
+    if (stream->payload == NULL && stream->readstart == 0) {
+        stream->frame_start = raop_rtp_mirror_get_nsecs();
+        stream->frame_arrival = 0;
+    }
 
-            // The first 128 bytes are some kind of header for the payload that follows
-            while (payload == NULL && readstart < 128) {
-                unsigned char* pos  = packet + readstart;
-                ret = recv(stream_fd, CAST pos, 128 - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
+    // The first 128 bytes are some kind of header for the payload that follows
+    while (stream->payload == NULL && stream->readstart < 128) {
+        unsigned char* pos  = stream->packet + stream->readstart;
+        if (stream->readstart == 0 && !stream->uring) {
+            /* the kernel receive timestamp of the first header byte is the true arrival time */
+            uint64_t rx_time = 0;
+            stream->recv_syscalls++;
+            ret = socket_recv_timestamped(stream->stream_fd, pos, 128, 0, &rx_time);
+            if (ret > 0 && rx_time) {
+                uint64_t now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+                stream->frame_arrival = rx_time;
+                if (now > rx_time) {
+                    stream->frame_start = raop_rtp_mirror_get_nsecs() - (now - rx_time);
+                }
             }
+        } else {
+            ret = MIRROR_RECV(stream->stream_fd, pos, 128 - stream->readstart);
+        }
+        if (ret <= 0) break;
+        stream->readstart = stream->readstart + ret;
+    }
 
-            if (payload == NULL && ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                           "raop_rtp_mirror tcp socket was closed by client (recv returned 0); got %d bytes of 128 byte header",readstart);
-                FD_CLR(stream_fd, &rfds);
-                stream_fd = -1;
-                continue;
-            } else if (payload == NULL && ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
-                           "raop_rtp_mirror error  in header recv: %d %s", errno, strerror(errno));
-                if (errno == ECONNRESET) conn_reset = true;; 
-                break;
+    if (stream->payload == NULL && ret == 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
+                   "raop_rtp_mirror tcp socket was closed by client (recv returned 0); got %d bytes of 128 byte header",stream->readstart);
+        stream->stream_fd = -1;
+        return 1;
+    } else if (stream->payload == NULL && ret == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // Timeouts can happen even if the connection is fine
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
+                   "raop_rtp_mirror error  in header recv: %d %s", errno, strerror(errno));
+        if (errno == ECONNRESET) stream->conn_reset = true;; 
+        return -1;
+    }
+
+    /*packet[0:3] contains the payload size */
+    int payload_size = byteutils_get_int(stream->packet, 0);
+    char packet_description[13] = {0};
+    char *p = packet_description;
+    int n = sizeof(packet_description);
+    for (int i = 4; i < 8; i++) {
+        snprintf(p, n, "%2.2x ", (unsigned int) stream->packet[i]);
+        n -= 3;
+        p += 3;
+    }
+    ntp_timestamp_raw = byteutils_get_long(stream->packet, 8);
+    ntp_timestamp_remote = raop_ntp_timestamp_to_nano_seconds(ntp_timestamp_raw, false);
+
+    /* packet[4] + packet[5] identify the payload type:   values seen are:               *
+     * 0x00 0x00: encrypted packet containing a non-IDR  type 1 VCL NAL unit             *
+     * 0x00 0x10: encrypted packet containing an IDR type 5 VCL NAL unit                 *
+     * 0x01 0x00: unencrypted packet containing a type 7 SPS NAL + a type 8 PPS NAL unit *
+     * 0x02 0x00: unencrypted packet (old protocol) no payload, sent once every second    *
+     * 0x05 0x00  unencrypted packet with a "streaming report", sent once per second.    */
+
+    /* packet[6] + packet[7] may list a payload "option":    values seen are:            *
+     * 0x00 0x00 : encrypted and "streaming report" packets                              *
+     * 0x1e 0x00 : old protocol (seen in AirMyPC) no-payload once-per-second packets     *
+     * 0x16 0x01 : seen in most unencrypted SPS+PPS packets                              *
+     * 0x56 0x01 : occasionally seen in unencrypted  SPS+PPS packets (why different?)    */
+
+    /* unencrypted packets with a SPS and a PPS NAL are sent initially, and also when a  *
+     * change in video format (e.g. width, height) subsequently occurs. They seem always *
+     * to be followed by a packet with a type 5 encrypted IDR VCL NAL, with an identical *
+     * timestamp.  On M1/M2 Mac clients, this type 5 NAL is prepended with a type 6 SEI  *
+     * NAL unit.  Here we prepend the SPS+PPS NALs to the next encrypted packet, which   *
+     * always has the same timestamp, and is (almost?) always an IDR NAL unit.           */
+
+    /* Unencrypted SPS/PPS packets also have image-size data in (parts of) packet[16:127] */
+
+    /* "streaming report" packets have no timestamp in packet[8:15] */
+
+    if (stream->payload == NULL) {
+        if (stream->packet[4] == 0x00 && stream->prepend_sps_pps && (ntp_timestamp_raw != stream->ntp_timestamp_nal)) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
+                       "raop_rtp_mirror: prepended sps_pps timestamp does not match timestamp of "
+                       "video payload\n%llu\n%llu , discarding", ntp_timestamp_raw, stream->ntp_timestamp_nal);
+            frame_pool_free(raop_rtp_mirror->frame_pool, stream->sps_pps);
+            stream->sps_pps = NULL;
+            stream->prepend_sps_pps = false;
+        }
+        if (stream->zero_copy && stream->packet[4] == 0x00 && payload_size > 0) {
+            /* leave room in front of the payload for the sps_pps that will be prepended */
+            unsigned char *data = NULL;
+            stream->video_buffer_offset = (stream->prepend_sps_pps ? stream->sps_pps_len : 0);
+            stream->video_buffer = raop_rtp_mirror->callbacks.video_get_buffer(raop_rtp_mirror->callbacks.cls,
+                                                                       payload_size + stream->video_buffer_offset, &data);
+            if (stream->video_buffer) {
+                stream->payload = data + stream->video_buffer_offset;
             }
+        }
+        if (stream->payload == NULL) {
+            stream->payload = frame_pool_alloc(raop_rtp_mirror->frame_pool, payload_size);
+        }
+        stream->readstart = 0;
+    }
+
+    while (stream->readstart < payload_size) {
+        // Payload data
+        unsigned char *pos = stream->payload + stream->readstart;
+        ret = MIRROR_RECV(stream->stream_fd, pos, payload_size - stream->readstart);
+        if (ret <= 0) break;
+        stream->readstart = stream->readstart + ret;
+    }
 
-            /*packet[0:3] contains the payload size */
-            int payload_size = byteutils_get_int(packet, 0);
-            char packet_description[13] = {0};
-	    char *p = packet_description;
-            int n = sizeof(packet_description);
-	    for (int i = 4; i < 8; i++) {
-                snprintf(p, n, "%2.2x ", (unsigned int) packet[i]);
-                n -= 3;
-                p += 3;
-	    }
-            ntp_timestamp_raw = byteutils_get_long(packet, 8);
-            ntp_timestamp_remote = raop_ntp_timestamp_to_nano_seconds(ntp_timestamp_raw, false);
-
-	    /* packet[4] + packet[5] identify the payload type:   values seen are:               *
-             * 0x00 0x00: encrypted packet containing a non-IDR  type 1 VCL NAL unit             *
-             * 0x00 0x10: encrypted packet containing an IDR type 5 VCL NAL unit                 *
-             * 0x01 0x00: unencrypted packet containing a type 7 SPS NAL + a type 8 PPS NAL unit *
-             * 0x02 0x00: unencrypted packet (old protocol) no payload, sent once every second    *
-             * 0x05 0x00  unencrypted packet with a "streaming report", sent once per second.    */
-
-	    /* packet[6] + packet[7] may list a payload "option":    values seen are:            *
-             * 0x00 0x00 : encrypted and "streaming report" packets                              *
-             * 0x1e 0x00 : old protocol (seen in AirMyPC) no-payload once-per-second packets     *
-             * 0x16 0x01 : seen in most unencrypted SPS+PPS packets                              *
-             * 0x56 0x01 : occasionally seen in unencrypted  SPS+PPS packets (why different?)    */
-
-            /* unencrypted packets with a SPS and a PPS NAL are sent initially, and also when a  *
-             * change in video format (e.g. width, height) subsequently occurs. They seem always *
-             * to be followed by a packet with a type 5 encrypted IDR VCL NAL, with an identical *
-             * timestamp.  On M1/M2 Mac clients, this type 5 NAL is prepended with a type 6 SEI  *
-             * NAL unit.  Here we prepend the SPS+PPS NALs to the next encrypted packet, which   *
-             * always has the same timestamp, and is (almost?) always an IDR NAL unit.           */
-
-            /* Unencrypted SPS/PPS packets also have image-size data in (parts of) packet[16:127] */
-
-            /* "streaming report" packets have no timestamp in packet[8:15] */
-
-            if (payload == NULL) {
-                payload = malloc(payload_size);
-                readstart = 0;
+    if (ret == 0) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket was closed by client (recv returned 0)");
+        return -1;
+    } else if (ret == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // Timeouts can happen even if the connection is fine
+        logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d %s", errno, strerror(errno));
+        if (errno == ECONNRESET) stream->conn_reset = true;
+        return -1;
+    }
+    stream->frame_received = raop_rtp_mirror_get_nsecs();
+    stream->frames_received++;
+    trace_span_range("mirror", "recv", stream->frame_start, stream->frame_received, payload_size);
+    if (raop_rtp_mirror->capture) {
+        /* still encrypted: decryption is done in place below */
+        capture_write(raop_rtp_mirror->capture, CAPTURE_MIRROR, stream->packet, 128, stream->payload, payload_size);
+    }
+
+    switch (stream->packet[4]) {
+    case  0x00:
+        // Normal video data (VCL NAL)
+
+        // Conveniently, the video data is already stamped with the remote wall clock time,
+        // so no additional clock syncing needed. The only thing odd here is that the video
+        // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
+        // counting nano seconds since last boot.
+
+        ntp_timestamp_local = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
+        if (logger_debug) {
+            uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+            int64_t latency = ((int64_t) ntp_now) - ((int64_t) ntp_timestamp_local);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
+                       "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f, ts = %8.6f, %s",
+                       (double) ntp_now / SEC, (double) ntp_timestamp_local / SEC, (double) latency / SEC,
+                       (double) ntp_timestamp_remote / SEC, packet_description);
+        }
+        bool telemetry = telemetry_enabled();
+        if (telemetry) {
+            /* jitter: difference between inter-arrival and inter-timestamp intervals */
+            uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+            telemetry_record(TELEMETRY_VIDEO_NETWORK, (ntp_now > ntp_timestamp_local ? ntp_now - ntp_timestamp_local : 0));
+            uint64_t arrival = (stream->frame_arrival ? stream->frame_arrival : ntp_now);
+            if (stream->last_arrival_local) {
+                int64_t jitter = ((int64_t) (arrival - stream->last_arrival_local)) -
+                                 ((int64_t) (ntp_timestamp_remote - stream->last_arrival_remote));
+                telemetry_record(TELEMETRY_VIDEO_JITTER, (uint64_t) (jitter < 0 ? -jitter : jitter));
             }
+            stream->last_arrival_local = arrival;
+            stream->last_arrival_remote = ntp_timestamp_remote;
+        }
 
-            while (readstart < payload_size) {
-                // Payload data
-                unsigned char *pos = payload + readstart;
-                ret = recv(stream_fd, CAST pos, payload_size - readstart, 0);
-                if (ret <= 0) break;
-                readstart = readstart + ret;
+        unsigned char* payload_out;
+	unsigned char* payload_decrypted;
+        /*
+         * nal_types:1   Coded non-partitioned slice of a non-IDR picture
+         *           5   Coded non-partitioned slice of an IDR picture
+         *           6   Supplemental enhancement information (SEI)
+         *           7   Sequence parameter set (SPS)
+         *           8   Picture parameter set (PPS)
+         *
+         * if a previous unencrypted packet contains an SPS (type 7) and PPS (type 8) NAL which has not 
+         * yet been sent, it should be prepended to the current NAL.    The M1 Macs have increased the h264 level, 
+         * and now the first  encrypted packet after the  unencrypted SPS+PPS packet may also contain a SEI (type 6) NAL 
+         * prepended to its VCL NAL.
+         *
+         * The flag prepend_sps_pps = true will signal that the  previous packet contained a SPS NAL + a PPS NAL, 
+         * that has not yet been sent.   This will trigger prepending it to the current NAL, and the prepend_sps_pps 
+         * flag will be set to false after it has been prepended.  */
+
+        /* a prepended sps_pps with a non-matching timestamp was already discarded when payload was allocated */
+
+        if (stream->video_buffer) {
+            /* zero-copy: payload was received into the renderer buffer, and is decrypted in place */
+            payload_out = stream->payload - stream->video_buffer_offset;
+            payload_decrypted = stream->payload;
+            if (stream->prepend_sps_pps) {
+                assert(stream->sps_pps && stream->video_buffer_offset == stream->sps_pps_len);
+                memcpy(payload_out, stream->sps_pps, stream->sps_pps_len);
+                frame_pool_free(raop_rtp_mirror->frame_pool, stream->sps_pps);
+                stream->sps_pps = NULL;
             }
+        } else if (stream->prepend_sps_pps) {
+            assert(stream->sps_pps);
+            payload_out = (unsigned char*) frame_pool_alloc(raop_rtp_mirror->frame_pool, payload_size + stream->sps_pps_len);
+            payload_decrypted = payload_out + stream->sps_pps_len;
+            memcpy(payload_out, stream->sps_pps, stream->sps_pps_len);
+            frame_pool_free(raop_rtp_mirror->frame_pool, stream->sps_pps);
+	    stream->sps_pps = NULL;
+        } else {
+            payload_out = (unsigned char*) frame_pool_alloc(raop_rtp_mirror->frame_pool, payload_size);
+            payload_decrypted = payload_out;
+        }
+        // Decrypt data
+        uint64_t stage_start = (telemetry ? raop_rtp_mirror_get_nsecs() : 0);
+        uint64_t trace_start = trace_begin();
+        mirror_buffer_decrypt(raop_rtp_mirror->buffer, stream->payload, payload_decrypted, payload_size);
+        trace_span("mirror", "decrypt", trace_start, payload_size);
+        trace_start = trace_begin();
+        if (telemetry) {
+            uint64_t stage_end = raop_rtp_mirror_get_nsecs();
+            telemetry_record(TELEMETRY_VIDEO_DECRYPT, stage_end - stage_start);
+            stage_start = stage_end;
+        }
 
-            if (ret == 0) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket was closed by client (recv returned 0)");
+        // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
+        // start code for the NAL Byte-Stream Format.  This is done in a single pass, which also indexes the NAL units.
+        h264_decode_struct h264_data;
+        nal_index_init(&h264_data.nal_index, stream->h265_video);
+        int offset = (int) (payload_decrypted - payload_out);
+        if (stream->prepend_sps_pps) {
+            for (int i = 0; i < stream->n_param_sets; i++) {
+                nal_index_add(&h264_data.nal_index, stream->param_sets[i].offset, stream->param_sets[i].size,
+                              payload_out[stream->param_sets[i].offset]);
+            }
+        }
+        int parse_result = nal_parser_avcc_to_annexb(payload_out, offset, offset + payload_size, &h264_data.nal_index);
+        trace_span("mirror", "nal", trace_start, h264_data.nal_index.count);
+        if (telemetry) {
+            telemetry_record(TELEMETRY_VIDEO_NAL, raop_rtp_mirror_get_nsecs() - stage_start);
+        }
+        if (parse_result == NAL_PARSER_H265) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
+                       "unsupported h265 video detected (h265 support can be enabled with uxplay option -h265)");
+            if (stream->video_buffer) {
+                raop_rtp_mirror->callbacks.video_release_buffer(raop_rtp_mirror->callbacks.cls, stream->video_buffer);
+                stream->video_buffer = NULL;
+                stream->payload = NULL;
+            } else {
+                frame_pool_free(raop_rtp_mirror->frame_pool, payload_out);
+            }
+            stream->prepend_sps_pps = false;
+            break;
+        }
+        for (int i = 0; i < h264_data.nal_index.indexed && !stream->h265_video; i++) {
+            nal_unit_info_t *nal = &(h264_data.nal_index.nal[i]);
+            if (nal->offset < offset) {
+                continue;   /* prepended SPS, PPS */
+            }
+            switch (nal->type) {
+            case 14:  /* Prefix NALu , seen before all VCL Nalu's in AirMyPc */
+            case 5:   /*IDR, slice_layer_without_partitioning */
+            case 1:   /*non-IDR, slice_layer_without_partitioning */
+                break;
+            case 2:   /* slice data partition A */
+            case 3:   /* slice data partition B */
+            case 4:   /* slice data partition C */
+                logger_log(raop_rtp_mirror->logger, LOGGER_INFO,
+                           "unexpected partitioned VCL NAL unit: nalu_type = %d, ref_idc = %d, nalu_size = %d,"
+                           " payloadsize = %d nalus_count = %d",
+                           nal->type, nal->ref_idc, nal->size, payload_size, h264_data.nal_index.count);
+                break;
+            case 6:
+            case 7:
+            case 8:
+                if (logger_debug) {
+                    const char *nal_name = (nal->type == 6 ? "Supplemental Enhancement Information" :
+                                            (nal->type == 7 ? "Sequence Parameter Set" : "Picture Parameter Set"));
+                    char *str = utils_data_to_string(payload_out + nal->offset, nal->size, 16);
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror NAL type %d size = %d",
+                               nal->type, nal->size);
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 %s:\n%s", nal_name, str);
+                    free(str);
+                }
                 break;
-            } else if (ret == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) continue; // Timeouts can happen even if the connection is fine
-                logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in recv: %d %s", errno, strerror(errno));
-                if (errno == ECONNRESET) conn_reset = true;
+            default:
+                logger_log(raop_rtp_mirror->logger, LOGGER_INFO,
+                           "unexpected non-VCL NAL unit: nalu_type = %d, ref_idc = %d, nalu_size = %d,"
+                           " payloadsize = %d nalus_count = %d",
+                           nal->type, nal->ref_idc, nal->size, payload_size, h264_data.nal_index.count);
                 break;
             }
+        }
+        if (parse_result != NAL_PARSER_OK) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid");
+            payload_out[0] = 1; /* mark video data as invalid h264 (failed decryption) */
+        }
+
+        payload_decrypted = NULL;
+        h264_data.ntp_time_local = ntp_timestamp_local;
+        h264_data.ntp_time_remote = ntp_timestamp_remote;
+        h264_data.nal_count = h264_data.nal_index.count;   /*nal_count will be the number of nal units in the packet */
+        h264_data.data_len = payload_size;
+        h264_data.data = payload_out;
+        h264_data.buffer = stream->video_buffer;   /* video_process takes ownership of video_buffer */
+        if (stream->prepend_sps_pps) {
+            h264_data.data_len += stream->sps_pps_len;
+	    stream->prepend_sps_pps =  false;
+        }
+        metrics_add(METRICS_VIDEO_FRAMES, 1);
+        metrics_add(METRICS_VIDEO_BYTES, (uint64_t) h264_data.data_len);
+        raop_rtp_mirror_stage_add(raop_rtp_mirror, MIRROR_STAGE_RECEIVE, stream->frame_start, stream->frame_received);
+        raop_rtp_mirror_stage_add(raop_rtp_mirror, MIRROR_STAGE_DECRYPT, stream->frame_received,
+                                  raop_rtp_mirror_get_nsecs());
+        if (raop_rtp_mirror->queue) {
+            raop_rtp_mirror_queue_frame(raop_rtp_mirror, &h264_data);
+        } else {
+            raop_rtp_mirror_deliver_frame(raop_rtp_mirror, &h264_data);
+        }
+        if (stream->video_buffer) {
+            stream->video_buffer = NULL;
+            stream->payload = NULL;    /* was not allocated from frame_pool */
+        }
+        break;
+    case 0x01:
+        // The information in the payload contains an SPS and a PPS NAL
+        // The sps_pps is not encrypted
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived unencrypted codec packet from client:"
+                   " payload_size %d header %s ts_client = %8.6f",
+		   payload_size, packet_description, (double) ntp_timestamp_remote / SEC);
+        if (payload_size == 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror, discard type 0x01 packet with no payload");
+            break;
+        }
+        stream->ntp_timestamp_nal = ntp_timestamp_raw;
+        /* frames in the old format must reach the renderer before it is told about the new one */
+        if (raop_rtp_mirror->queue && !mirror_queue_drain(raop_rtp_mirror->queue, MIRROR_QUEUE_DRAIN_TIMEOUT_MS)) {
+            /* the renderer must not be driven from both threads: wait for the delivery thread to finish *
+             * its current frame and exit (the frames still queued are discarded), then restart it       */
+            logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: video delivery thread did not"
+                       " drain the video queue before a format change: restarting it");
+            raop_rtp_mirror_stop_delivery(raop_rtp_mirror);
+            raop_rtp_mirror_start_delivery(raop_rtp_mirror);
+        }
+        float width = byteutils_get_float(stream->packet, 16);
+        float height = byteutils_get_float(stream->packet, 20);
+        float width_source = byteutils_get_float(stream->packet, 40);
+        float height_source = byteutils_get_float(stream->packet, 44);
+        if (width != width_source || height != height_source) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: Unexpected : data  %f,"
+                   " %f != width_source = %f, height_source = %f", width, height, width_source, height_source);
+        }
+        width = byteutils_get_float(stream->packet, 48);
+        height = byteutils_get_float(stream->packet, 52);
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: unidentified extra header data  %f, %f", width, height);
+        width = byteutils_get_float(stream->packet, 56);
+        height = byteutils_get_float(stream->packet, 60);
+        if (raop_rtp_mirror->callbacks.video_report_size) {
+            raop_rtp_mirror->callbacks.video_report_size(raop_rtp_mirror->callbacks.cls, &width_source, &height_source, &width, &height);
+        }
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
+                   width_source, height_source, width, height);
 
-	    switch (packet[4]) {
-            case  0x00:
-                // Normal video data (VCL NAL)
+        if (stream->sps_pps) {
+            frame_pool_free(raop_rtp_mirror->frame_pool, stream->sps_pps);
+            stream->sps_pps = NULL;
+        }
 
-                // Conveniently, the video data is already stamped with the remote wall clock time,
-                // so no additional clock syncing needed. The only thing odd here is that the video
-                // ntp time stamps don't include the SECONDS_FROM_1900_TO_1970, so it's really just
-                // counting nano seconds since last boot.
+        /* h265 streams (only sent if the "Supports Screen Multi Codec" feature bit was set) carry an *
+         * hvcC HEVCDecoderConfigurationRecord with the VPS, SPS and PPS instead of an h264 avcC      */
+        nal_unit_info_t hvcc_nals[3];
+        stream->h265_video = (raop_rtp_mirror->h265 && !nal_parser_parse_hvcc(stream->payload, payload_size, hvcc_nals));
+        if (raop_rtp_mirror->callbacks.video_set_codec) {
+            raop_rtp_mirror->callbacks.video_set_codec(raop_rtp_mirror->callbacks.cls,
+                                                       (stream->h265_video ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264));
+        }
+        if (stream->h265_video) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: h265 VPS size = %d, SPS size = %d, PPS size = %d",
+                       hvcc_nals[0].size, hvcc_nals[1].size, hvcc_nals[2].size);
+            stream->sps_pps_len = hvcc_nals[0].size + hvcc_nals[1].size + hvcc_nals[2].size + 12;
+            stream->sps_pps = (unsigned char*) frame_pool_alloc(raop_rtp_mirror->frame_pool, stream->sps_pps_len);
+            assert(stream->sps_pps);
+            int pos = 0;
+            for (int i = 0; i < 3; i++) {
+                memcpy(stream->sps_pps + pos, nal_start_code, 4);
+                memcpy(stream->sps_pps + pos + 4, stream->payload + hvcc_nals[i].offset, hvcc_nals[i].size);
+                stream->param_sets[i].offset = pos + 4;
+                stream->param_sets[i].size = hvcc_nals[i].size;
+                pos += hvcc_nals[i].size + 4;
+            }
+            stream->n_param_sets = 3;
+            stream->prepend_sps_pps = true;
+            raop_rtp_mirror_report_sps(raop_rtp_mirror, stream->payload + hvcc_nals[1].offset, hvcc_nals[1].size, true);
+            raop_rtp_mirror->callbacks.video_pause(raop_rtp_mirror->callbacks.cls);
+            break;
+        }
 
-                ntp_timestamp_local = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
+        short sps_size = byteutils_get_short_be(stream->payload,6);
+        unsigned char *sequence_parameter_set = stream->payload + 8;
+        short pps_size = byteutils_get_short_be(stream->payload, sps_size + 9);
+        unsigned char *picture_parameter_set = stream->payload + sps_size + 11;
+        int data_size = 6;
+        if (logger_debug) {
+            char *str = utils_data_to_string(stream->payload, data_size, 16);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: SPS+PPS header size = %d", data_size);		
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 SPS+PPS header:\n%s", str);
+            free(str);
+            str = utils_data_to_string(sequence_parameter_set, sps_size,16);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror SPS NAL size = %d",  sps_size);		
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
+            free(str);
+            str = utils_data_to_string(picture_parameter_set, pps_size, 16);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror PPS NAL size = %d", pps_size);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n%s", str);
+            free(str);
+        }
+        data_size = payload_size - sps_size - pps_size - 11; 
+        if (data_size > 0 && logger_debug) {
+            char *str = utils_data_to_string (picture_parameter_set + pps_size, data_size, 16);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder size = %d", data_size);
+            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of SPS+PPS packet:\n%s", str);
+            free(str);
+        } else if (data_size < 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, " pps_sps error: packet remainder size = %d < 0", data_size);
+        }
+
+        // Copy the sps and pps into a buffer to prepend to the next NAL unit.
+	stream->sps_pps_len = sps_size + pps_size + 8;
+        stream->param_sets[0].offset = 4;
+        stream->param_sets[0].size = sps_size;
+        stream->param_sets[1].offset = sps_size + 8;
+        stream->param_sets[1].size = pps_size;
+        stream->n_param_sets = 2;
+        stream->sps_pps = (unsigned char*) frame_pool_alloc(raop_rtp_mirror->frame_pool, stream->sps_pps_len);
+        assert(stream->sps_pps);
+        memcpy(stream->sps_pps, nal_start_code, 4);
+        memcpy(stream->sps_pps + 4, sequence_parameter_set, sps_size);
+        memcpy(stream->sps_pps + sps_size + 4, nal_start_code, 4); 
+        memcpy(stream->sps_pps + sps_size + 8, stream->payload + sps_size + 11, pps_size);
+        stream->prepend_sps_pps = true;
+        raop_rtp_mirror_report_sps(raop_rtp_mirror, sequence_parameter_set, sps_size, false);
+
+        uint64_t ntp_offset = 0;
+        ntp_offset  = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_offset);
+        if (!ntp_offset) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "ntp synchronization has not yet started: synchronized video may fail");
+        }
+        // h264codec_t h264;
+        // h264.version = payload[0];
+        // h264.profile_high = payload[1];
+        // h264.compatibility = payload[2];
+        // h264.level = payload[3];
+        // h264.reserved_6_and_nal = payload[4];
+        // h264.reserved_3_and_sps = payload[5];
+        // h264.sps_size =  sps_size;
+        // h264.sequence_parameter_set = malloc(h264.sps_size);
+        // memcpy(h264.sequence_parameter_set, sequence_parameter_set, sps_size);
+        // h264.number_of_pps = payload[h264.sps_size + 8];
+        // h264.pps_size = pps_size;
+        // h264.picture_parameter_set = malloc(h264.pps_size);
+        // memcpy(h264.picture_parameter_set, picture_parameter_set, pps_size);
+        raop_rtp_mirror->callbacks.video_pause(raop_rtp_mirror->callbacks.cls);
+        break;
+    case 0x02:
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived old-protocol once-per-second packet from client:"
+                   " payload_size %d header %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
+        /* "old protocol" (used by AirMyPC), rest of 128-byte  packet is empty  */
+    case 0x05:
+        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived video streaming performance info packet from client:"
+                   " payload_size %d header %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
+        /* payloads with packet[4] = 0x05 have no timestamp, and carry video info from the client as a binary plist *
+         * Sometimes (e.g, when the client has a locked screen), there is a 25kB trailer attached to the packet.    *
+         * This 25000 Byte trailer with unidentified content seems to be the same data each time it is sent.        */
+
+        if (payload_size && (raop_rtp_mirror->show_client_FPS_data || raop_rtp_mirror->callbacks.video_report_stats ||
+                             metrics_enabled())) {
+            //char *str = utils_data_to_string(packet, 128, 16);
+            //logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "type 5 video packet header:\n%s", str);
+            //free (str);
+	    
+            int plist_size = payload_size;
+            if (payload_size > 25000) {
+	        plist_size = payload_size - 25000;
                 if (logger_debug) {
-                    uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
-                    int64_t latency = ((int64_t) ntp_now) - ((int64_t) ntp_timestamp_local);
+                    char *str = utils_data_to_string(stream->payload + plist_size, 16, 16);
                     logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                               "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f, ts = %8.6f, %s",
-                               (double) ntp_now / SEC, (double) ntp_timestamp_local / SEC, (double) latency / SEC,
-                               (double) ntp_timestamp_remote / SEC, packet_description);
-                }
-
-                unsigned char* payload_out;
-		unsigned char* payload_decrypted;
-                /*
-                 * nal_types:1   Coded non-partitioned slice of a non-IDR picture
-                 *           5   Coded non-partitioned slice of an IDR picture
-                 *           6   Supplemental enhancement information (SEI)
-                 *           7   Sequence parameter set (SPS)
-                 *           8   Picture parameter set (PPS)
-                 *
-                 * if a previous unencrypted packet contains an SPS (type 7) and PPS (type 8) NAL which has not 
-                 * yet been sent, it should be prepended to the current NAL.    The M1 Macs have increased the h264 level, 
-                 * and now the first  encrypted packet after the  unencrypted SPS+PPS packet may also contain a SEI (type 6) NAL 
-                 * prepended to its VCL NAL.
-                 *
-                 * The flag prepend_sps_pps = true will signal that the  previous packet contained a SPS NAL + a PPS NAL, 
-                 * that has not yet been sent.   This will trigger prepending it to the current NAL, and the prepend_sps_pps 
-                 * flag will be set to false after it has been prepended.  */
-
-                if (prepend_sps_pps & (ntp_timestamp_raw != ntp_timestamp_nal)) {
-                        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                                   "raop_rtp_mirror: prepended sps_pps timestamp does not match timestamp of "
-                                   "video payload\n%llu\n%llu , discarding", ntp_timestamp_raw, ntp_timestamp_nal);
-                        free (sps_pps);
-		        sps_pps = NULL;
-                        prepend_sps_pps = false;
+                               "video_info packet had 25kB trailer; first 16 bytes are:\n%s", str);
+                free(str);
                 }
-		
-                if (prepend_sps_pps) {
-                    assert(sps_pps);
-                    payload_out = (unsigned char*)  malloc(payload_size + sps_pps_len);
-                    payload_decrypted = payload_out + sps_pps_len;
-                    memcpy(payload_out, sps_pps, sps_pps_len);
-                    free (sps_pps);
-		    sps_pps = NULL;
-                } else {
-                    payload_out = (unsigned char*)  malloc(payload_size);
-                    payload_decrypted = payload_out;
+            }
+            if (plist_size) {
+                plist_t root_node = NULL;
+                client_video_stats_t stats;
+                plist_from_bin((char *) stream->payload, plist_size, &root_node);
+                if (raop_rtp_mirror->show_client_FPS_data && root_node) {
+                    char *plist_xml;
+                    uint32_t plist_len;
+                    plist_to_xml(root_node, &plist_xml, &plist_len);
+                    logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "%s", plist_xml);
+                    free(plist_xml);
                 }
-                // Decrypt data
-                mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
-
-                // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
-                // start code for the NAL Byte-Stream Format.
-                bool valid_data = true;
-                int nalu_size = 0;
-                int nalus_count = 0;
-                while (nalu_size < payload_size) {
-                    int nc_len = byteutils_get_int_be(payload_decrypted, nalu_size);
-                    if (nc_len < 0 || nalu_size + 4 > payload_size) {
-                        valid_data = false;
-                        break;
-                    }
-                    memcpy(payload_decrypted + nalu_size, nal_start_code, 4);
-                    nalu_size += 4;
-                    nalus_count++;
-                    /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
-                    if (payload_decrypted[nalu_size] & 0x80) {
-                        valid_data = false;
-                        break;
+                if (raop_rtp_mirror_parse_client_stats(root_node, &stats)) {
+                    stats.ntp_time_local = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
+                    if (stats.valid & CLIENT_STATS_FPS) {
+                        metrics_set(METRICS_CLIENT_FPS, (int64_t) (stats.fps * 1000.0));
                     }
-                    int nalu_type = payload_decrypted[nalu_size] & 0x1f;
-                    int ref_idc = (payload_decrypted[nalu_size] >> 5);
-                    /* check for unsupported h265 video (sometimes sent by macOS in high-def screen mirroring) */
-                    if (payload_decrypted[nalu_size + 1] == 0x01) {
-                        switch (payload_decrypted[nalu_size]) {
-                        case 0x28:    // h265 IDR type 20 NAL
-                        case 0x02:    // h265 non-IDR type 1 NAL
-                            ref_idc = 0;
-                            h265_video_detected = true;
-                            break;
-                        default:
-                            break;
-                        }
-                        if (h265_video_detected) {
-                            break;
+                    if (stats.valid & CLIENT_STATS_BITRATE) {
+                        metrics_set(METRICS_CLIENT_BITRATE, (int64_t) (stats.bitrate_kbps * 1000.0));
+                        /* size the receive buffer for bursts (IDR frames) of MIRROR_RCVBUF_MSECS */
+                        if (stats.bitrate_kbps > 1.25 * stream->rcvbuf_bitrate_kbps) {
+                            socket_tuning_set_rcvbuf_for_bitrate(raop_rtp_mirror->logger, stream->stream_fd,
+                                                                 stats.bitrate_kbps, MIRROR_RCVBUF_MSECS);
+                            stream->rcvbuf_bitrate_kbps = stats.bitrate_kbps;
                         }
                     }
-                    switch (nalu_type) {
-                    case 14:  /* Prefix NALu , seen before all VCL Nalu's in AirMyPc */
-                    case 5:   /*IDR, slice_layer_without_partitioning */
-                    case 1:   /*non-IDR, slice_layer_without_partitioning */
-                        break;
-	            case 2:   /* slice data partition A */
-                    case 3:   /* slice data partition B */
-                    case 4:   /* slice data partition C */
-                        logger_log(raop_rtp_mirror->logger, LOGGER_INFO,
-                                   "unexpected partitioned VCL NAL unit: nalu_type = %d, ref_idc = %d, nalu_size = %d,"
-                                   "processed bytes %d, payloadsize = %d nalus_count = %d",
-                                   nalu_type, ref_idc, nc_len, nalu_size, payload_size, nalus_count);
-                        break;
-                    case 6:
-                        if (logger_debug) {
-                            char *str = utils_data_to_string(payload_decrypted + nalu_size, nc_len, 16); 
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror SEI NAL size = %d", nc_len);		
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                                       "raop_rtp_mirror h264 Supplemental Enhancement Information:\n%s", str);
-                            free(str);
-                        }
-                        break;
-                    case 7:
-                        if (logger_debug) {
-                            char *str = utils_data_to_string(payload_decrypted + nalu_size, nc_len, 16); 
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror SPS NAL size = %d", nc_len);		
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                                       "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
-                            free(str);
-                        }
-                        break;
-                    case 8:
-                        if (logger_debug) {
-                            char *str = utils_data_to_string(payload_decrypted + nalu_size, nc_len, 16); 
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror PPS NAL size = %d", nc_len);		
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                                       "raop_rtp_mirror h264 Picture Parameter Set :\n%s", str);
-                            free(str);
-                        }
-                        break;
-                    default:
-                        logger_log(raop_rtp_mirror->logger, LOGGER_INFO,
-                                   "unexpected non-VCL NAL unit: nalu_type = %d, ref_idc = %d, nalu_size = %d,"
-                                   "processed bytes %d, payloadsize = %d nalus_count = %d",
-                                   nalu_type, ref_idc, nc_len, nalu_size, payload_size, nalus_count);
-			break;
-		    }
-                    nalu_size += nc_len;
-                }
-                if (h265_video_detected) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_ERR,
-                               "unsupported h265 video detected");
-                    free (payload_out);
-                    break;
-                }
-                if (nalu_size != payload_size) valid_data = false;
-                if(!valid_data) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid");
-                    payload_out[0] = 1; /* mark video data as invalid h264 (failed decryption) */
-                }
-
-                payload_decrypted = NULL;
-                h264_decode_struct h264_data;
-                h264_data.ntp_time_local = ntp_timestamp_local;
-                h264_data.ntp_time_remote = ntp_timestamp_remote;
-                h264_data.nal_count = nalus_count;   /*nal_count will be the number of nal units in the packet */
-                h264_data.data_len = payload_size;
-                h264_data.data = payload_out;
-                if (prepend_sps_pps) {
-                    h264_data.data_len += sps_pps_len;
-                    h264_data.nal_count += 2;
-		    prepend_sps_pps =  false;
-                }
-                raop_rtp_mirror->callbacks.video_resume(raop_rtp_mirror->callbacks.cls);
-                raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
-                free(payload_out);
-                break;
-            case 0x01:
-                // The information in the payload contains an SPS and a PPS NAL
-                // The sps_pps is not encrypted
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived unencrypted codec packet from client:"
-                           " payload_size %d header %s ts_client = %8.6f",
-			   payload_size, packet_description, (double) ntp_timestamp_remote / SEC);
-                if (payload_size == 0) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror, discard type 0x01 packet with no payload");
-                    break;
-                }
-                ntp_timestamp_nal = ntp_timestamp_raw;
-                float width = byteutils_get_float(packet, 16);
-                float height = byteutils_get_float(packet, 20);
-                float width_source = byteutils_get_float(packet, 40);
-                float height_source = byteutils_get_float(packet, 44);
-                if (width != width_source || height != height_source) {
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: Unexpected : data  %f,"
-                           " %f != width_source = %f, height_source = %f", width, height, width_source, height_source);
-                }
-                width = byteutils_get_float(packet, 48);
-                height = byteutils_get_float(packet, 52);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: unidentified extra header data  %f, %f", width, height);
-                width = byteutils_get_float(packet, 56);
-                height = byteutils_get_float(packet, 60);
-                if (raop_rtp_mirror->callbacks.video_report_size) {
-                    raop_rtp_mirror->callbacks.video_report_size(raop_rtp_mirror->callbacks.cls, &width_source, &height_source, &width, &height);
-                }
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror width_source = %f height_source = %f width = %f height = %f",
-                           width_source, height_source, width, height);
-
-                short sps_size = byteutils_get_short_be(payload,6);
-                unsigned char *sequence_parameter_set = payload + 8;
-                short pps_size = byteutils_get_short_be(payload, sps_size + 9);
-                unsigned char *picture_parameter_set = payload + sps_size + 11;
-                int data_size = 6;
-                if (logger_debug) {
-                    char *str = utils_data_to_string(payload, data_size, 16);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: SPS+PPS header size = %d", data_size);		
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 SPS+PPS header:\n%s", str);
-                    free(str);
-                    str = utils_data_to_string(sequence_parameter_set, sps_size,16);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror SPS NAL size = %d",  sps_size);		
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
-                    free(str);
-                    str = utils_data_to_string(picture_parameter_set, pps_size, 16);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror PPS NAL size = %d", pps_size);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n%s", str);
-                    free(str);
-                }
-                data_size = payload_size - sps_size - pps_size - 11; 
-                if (data_size > 0 && logger_debug) {
-                    char *str = utils_data_to_string (picture_parameter_set + pps_size, data_size, 16);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder size = %d", data_size);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of SPS+PPS packet:\n%s", str);
-                    free(str);
-                } else if (data_size < 0) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_ERR, " pps_sps error: packet remainder size = %d < 0", data_size);
-                }
-
-                // Copy the sps and pps into a buffer to prepend to the next NAL unit.
-                if (sps_pps) {
-                    free(sps_pps);
-                    sps_pps = NULL;
-                }
-		sps_pps_len = sps_size + pps_size + 8;
-                sps_pps = (unsigned char*) malloc(sps_pps_len);
-                assert(sps_pps);
-                memcpy(sps_pps, nal_start_code, 4);
-                memcpy(sps_pps + 4, sequence_parameter_set, sps_size);
-                memcpy(sps_pps + sps_size + 4, nal_start_code, 4); 
-                memcpy(sps_pps + sps_size + 8, payload + sps_size + 11, pps_size);
-                prepend_sps_pps = true;
-
-                uint64_t ntp_offset = 0;
-                ntp_offset  = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_offset);
-                if (!ntp_offset) {
-                    logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "ntp synchronization has not yet started: synchronized video may fail");
-                }
-                // h264codec_t h264;
-                // h264.version = payload[0];
-                // h264.profile_high = payload[1];
-                // h264.compatibility = payload[2];
-                // h264.level = payload[3];
-                // h264.reserved_6_and_nal = payload[4];
-                // h264.reserved_3_and_sps = payload[5];
-                // h264.sps_size =  sps_size;
-                // h264.sequence_parameter_set = malloc(h264.sps_size);
-                // memcpy(h264.sequence_parameter_set, sequence_parameter_set, sps_size);
-                // h264.number_of_pps = payload[h264.sps_size + 8];
-                // h264.pps_size = pps_size;
-                // h264.picture_parameter_set = malloc(h264.pps_size);
-                // memcpy(h264.picture_parameter_set, picture_parameter_set, pps_size);
-                raop_rtp_mirror->callbacks.video_pause(raop_rtp_mirror->callbacks.cls);
-                break;
-            case 0x02:
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived old-protocol once-per-second packet from client:"
-                           " payload_size %d header %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
-                /* "old protocol" (used by AirMyPC), rest of 128-byte  packet is empty  */
-            case 0x05:
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "\nReceived video streaming performance info packet from client:"
-                           " payload_size %d header %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
-                /* payloads with packet[4] = 0x05 have no timestamp, and carry video info from the client as a binary plist *
-                 * Sometimes (e.g, when the client has a locked screen), there is a 25kB trailer attached to the packet.    *
-                 * This 25000 Byte trailer with unidentified content seems to be the same data each time it is sent.        */
-
-                if (payload_size && raop_rtp_mirror->show_client_FPS_data) {
-                    //char *str = utils_data_to_string(packet, 128, 16);
-                    //logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "type 5 video packet header:\n%s", str);
-                    //free (str);
-		    
-                    int plist_size = payload_size;
-                    if (payload_size > 25000) {
-		        plist_size = payload_size - 25000;
-                        if (logger_debug) {
-                            char *str = utils_data_to_string(payload + plist_size, 16, 16);
-                            logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG,
-                                       "video_info packet had 25kB trailer; first 16 bytes are:\n%s", str);
-                        free(str);
-                        }
+                    if (stats.valid & CLIENT_STATS_ENCODE_LATENCY) {
+                        metrics_set(METRICS_CLIENT_ENCODE_LATENCY, (int64_t) (stats.encode_latency_ms * 1000000.0));
                     }
-                    if (plist_size) {
-                        char *plist_xml;
-                        uint32_t plist_len;
-                        plist_t root_node = NULL;
-                        plist_from_bin((char *) payload, plist_size, &root_node);
-                        plist_to_xml(root_node, &plist_xml, &plist_len);
-                        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "%s", plist_xml);
-                        free(plist_xml);
+                    if (raop_rtp_mirror->callbacks.video_report_stats) {
+                        raop_rtp_mirror->callbacks.video_report_stats(raop_rtp_mirror->callbacks.cls, &stats);
                     }
                 }
-                break;
-            default:
-                logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "\nReceived unexpected TCP packet from client, "
-                           "size %d, %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
-                break;
+                plist_free(root_node);
             }
-
-            free(payload);
-            payload = NULL;
-            memset(packet, 0, 128);
-            readstart = 0;
         }
+        break;
+    default:
+        logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "\nReceived unexpected TCP packet from client, "
+                   "size %d, %s ts_raw = %llu", payload_size, packet_description, ntp_timestamp_raw);
+        break;
     }
 
+    frame_pool_free(raop_rtp_mirror->frame_pool, stream->payload);
+    stream->payload = NULL;
+    memset(stream->packet, 0, 128);
+    stream->readstart = 0;
+    return 0;
+}
+
+#undef MIRROR_RECV
+
+static void
+raop_rtp_mirror_stream_end(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    raop_rtp_mirror_stream_t *stream = &raop_rtp_mirror->stream;
+    if (!stream->active) {
+        return;
+    }
+    stream->active = false;
+
+    /* discard any partially-received payload */
+    if (stream->video_buffer) {
+        raop_rtp_mirror->callbacks.video_release_buffer(raop_rtp_mirror->callbacks.cls, stream->video_buffer);
+    } else if (stream->payload) {
+        frame_pool_free(raop_rtp_mirror->frame_pool, stream->payload);
+    }
+    if (stream->sps_pps) {
+        frame_pool_free(raop_rtp_mirror->frame_pool, stream->sps_pps);
+    }
+    raop_rtp_mirror_stop_delivery(raop_rtp_mirror);
+    raop_rtp_mirror_log_stats(raop_rtp_mirror);
+    frame_pool_log_stats(raop_rtp_mirror->frame_pool);
+    if (stream->uring) {
+        stream->recv_syscalls = uring_recv_get_syscalls(stream->uring);
+    }
+    if (stream->frames_received) {
+        logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror receive (%s): %llu packets, %llu system calls"
+                   " (%.2f per packet)", (stream->uring ? "io_uring" : "recv"), (unsigned long long) stream->frames_received,
+                   (unsigned long long) stream->recv_syscalls, (double) stream->recv_syscalls / stream->frames_received);
+    }
+    uring_recv_destroy(stream->uring);
+    stream->uring = NULL;
+
     /* Close the stream file descriptor */
-    if (stream_fd != -1) {
-        closesocket(stream_fd);
+    if (stream->stream_fd != -1) {
+        closesocket(stream->stream_fd);
+        stream->stream_fd = -1;
+    }
+}
+
+static THREAD_RETVAL
+raop_rtp_mirror_thread(void *arg)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = arg;
+    assert(raop_rtp_mirror);
+    thread_config_apply(THREAD_CLASS_VIDEO, "uxplay-mirror", raop_rtp_mirror->logger);
+    raop_rtp_mirror_stream_t *stream = &raop_rtp_mirror->stream;
+    raop_rtp_mirror_stream_begin(raop_rtp_mirror);
+
+    while (1) {
+        fd_set rfds;
+        struct timeval tv;
+        int nfds, ret;
+        MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+        if (!raop_rtp_mirror->running) {
+            MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+            logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror->running is no longer true");
+            break;
+        }
+        MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+
+        /* Set timeout valu to 5ms */
+        tv.tv_sec = 0;
+        tv.tv_usec = 5000;
+
+        /* Get the correct nfds value and set rfds */
+        FD_ZERO(&rfds);
+        if (stream->stream_fd == -1) {
+            FD_SET(raop_rtp_mirror->mirror_data_sock, &rfds);
+            nfds = raop_rtp_mirror->mirror_data_sock+1;
+        } else {
+            FD_SET(stream->stream_fd, &rfds);
+            nfds = stream->stream_fd+1;
+        }
+        if (stream->uring && stream->stream_fd != -1) {
+            /* io_uring receives wait (with the same 5ms timeout) by themselves */
+            ret = 1;
+        } else {
+            ret = select(nfds, &rfds, NULL, NULL, &tv);
+            stream->recv_syscalls++;
+        }
+        if (ret == 0) {
+            /* Timeout happened */
+            continue;
+        } else if (ret == -1) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror error in select");
+            break;
+        }
+
+        if (stream->stream_fd == -1 &&
+	    (raop_rtp_mirror && raop_rtp_mirror->mirror_data_sock >= 0) &&
+            FD_ISSET(raop_rtp_mirror->mirror_data_sock, &rfds)) {
+            if (raop_rtp_mirror_stream_accept(raop_rtp_mirror) < 0) {
+                break;
+            }
+        } else if (stream->stream_fd != -1 && (stream->uring || FD_ISSET(stream->stream_fd, &rfds))) {
+            if (raop_rtp_mirror_stream_receive(raop_rtp_mirror) < 0) {
+                break;
+            }
+        }
     }
 
+    raop_rtp_mirror_stream_end(raop_rtp_mirror);
+
     // Ensure running reflects the actual state
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
     raop_rtp_mirror->running = false;
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 
     logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror exiting TCP thread");
-    if (conn_reset && raop_rtp_mirror->callbacks.conn_reset) {
+    if (stream->conn_reset && raop_rtp_mirror->callbacks.conn_reset) {
         const bool video_reset = false;   /* leave "frozen video" showing */
         raop_rtp_mirror->callbacks.conn_reset(raop_rtp_mirror->callbacks.cls, 0, video_reset);
     }
     return 0;
 }
 
+/* session loop callbacks */
+
+static void
+raop_rtp_mirror_loop_detach(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    session_loop_remove_socket(raop_rtp_mirror->session_loop, raop_rtp_mirror->mirror_data_sock);
+    if (raop_rtp_mirror->stream.stream_fd != -1) {
+        session_loop_remove_socket(raop_rtp_mirror->session_loop, raop_rtp_mirror->stream.stream_fd);
+    }
+}
+
+/* as when raop_rtp_mirror_thread exits after an error */
+static void
+raop_rtp_mirror_loop_end(raop_rtp_mirror_t *raop_rtp_mirror)
+{
+    bool conn_reset = raop_rtp_mirror->stream.conn_reset;
+    raop_rtp_mirror_loop_detach(raop_rtp_mirror);
+    raop_rtp_mirror_stream_end(raop_rtp_mirror);
+    MUTEX_LOCK(raop_rtp_mirror->run_mutex);
+    raop_rtp_mirror->running = false;
+    MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
+    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror stopped receiving on the session loop");
+    if (conn_reset && raop_rtp_mirror->callbacks.conn_reset) {
+        const bool video_reset = false;   /* leave "frozen video" showing */
+        raop_rtp_mirror->callbacks.conn_reset(raop_rtp_mirror->callbacks.cls, 0, video_reset);
+    }
+}
+
+static void raop_rtp_mirror_loop_accept(void *cls, int fd);
+
+static void
+raop_rtp_mirror_loop_receive(void *cls, int fd)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = cls;
+    int ret = raop_rtp_mirror_stream_receive(raop_rtp_mirror);
+    if (ret == 1) {
+        /* (stream_fd is now -1) wait for the client to connect again */
+        session_loop_remove_socket(raop_rtp_mirror->session_loop, fd);
+        ret = session_loop_add_socket(raop_rtp_mirror->session_loop, raop_rtp_mirror->mirror_data_sock,
+                                      raop_rtp_mirror_loop_accept, raop_rtp_mirror);
+    }
+    if (ret < 0) {
+        raop_rtp_mirror_loop_end(raop_rtp_mirror);
+    }
+}
+
+static void
+raop_rtp_mirror_loop_accept(void *cls, int fd)
+{
+    raop_rtp_mirror_t *raop_rtp_mirror = cls;
+    int ret = raop_rtp_mirror_stream_accept(raop_rtp_mirror);
+    if (ret == 0) {
+        /* as raop_rtp_mirror_thread, only one stream is received at a time */
+        session_loop_remove_socket(raop_rtp_mirror->session_loop, fd);
+        ret = session_loop_add_socket(raop_rtp_mirror->session_loop, raop_rtp_mirror->stream.stream_fd,
+                                      raop_rtp_mirror_loop_receive, raop_rtp_mirror);
+    }
+    if (ret < 0) {
+        raop_rtp_mirror_loop_end(raop_rtp_mirror);
+    }
+}
+
 static int
 raop_rtp_mirror_init_socket(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6)
 {
@@ -708,6 +1447,8 @@ raop_rtp_mirror_init_socket(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6)
     if (dsock == -1) {
         goto sockets_cleanup;
     }
+    /* SO_RCVBUF must be set before listen() for the TCP window scale to allow for it */
+    socket_tuning_apply(raop_rtp_mirror->logger, dsock, SOCKET_PROFILE_MIRROR, 0);
 
     /* Listen to the data socket if using TCP */
     if (listen(dsock, 1) < 0) {
@@ -730,7 +1471,7 @@ raop_rtp_mirror_init_socket(raop_rtp_mirror_t *raop_rtp_mirror, int use_ipv6)
 
 void
 raop_rtp_mirror_start(raop_rtp_mirror_t *raop_rtp_mirror, unsigned short *mirror_data_lport,
-                      uint8_t show_client_FPS_data)
+                      uint8_t show_client_FPS_data, uint8_t h265)
 {
     logger_log(raop_rtp_mirror->logger, LOGGER_INFO, "raop_rtp_mirror starting mirroring");
     int use_ipv6 = 0;
@@ -738,6 +1479,7 @@ raop_rtp_mirror_start(raop_rtp_mirror_t *raop_rtp_mirror, unsigned short *mirror
     assert(raop_rtp_mirror);
     assert(mirror_data_lport);
     raop_rtp_mirror->show_client_FPS_data = show_client_FPS_data;
+    raop_rtp_mirror->h265 = h265;
 
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
     if (raop_rtp_mirror->running || !raop_rtp_mirror->joined) {
@@ -762,7 +1504,19 @@ raop_rtp_mirror_start(raop_rtp_mirror_t *raop_rtp_mirror, unsigned short *mirror
     raop_rtp_mirror->running = 1;
     raop_rtp_mirror->joined = 0;
 
-    THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
+    if (raop_rtp_mirror->session_loop) {
+        raop_rtp_mirror_stream_begin(raop_rtp_mirror);
+        if (session_loop_add_socket(raop_rtp_mirror->session_loop, raop_rtp_mirror->mirror_data_sock,
+                                    raop_rtp_mirror_loop_accept, raop_rtp_mirror) < 0) {
+            logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror could not use the session loop,"
+                       " using a thread");
+            raop_rtp_mirror_stream_end(raop_rtp_mirror);
+            raop_rtp_mirror->session_loop = NULL;
+        }
+    }
+    if (!raop_rtp_mirror->session_loop) {
+        THREAD_CREATE(raop_rtp_mirror->thread_mirror, raop_rtp_mirror_thread, raop_rtp_mirror);
+    }
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 }
 
@@ -779,13 +1533,20 @@ void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror) {
     raop_rtp_mirror->running = 0;
     MUTEX_UNLOCK(raop_rtp_mirror->run_mutex);
 
+    if (raop_rtp_mirror->session_loop) {
+        raop_rtp_mirror_loop_detach(raop_rtp_mirror);
+        raop_rtp_mirror_stream_end(raop_rtp_mirror);
+    }
+
     if (raop_rtp_mirror->mirror_data_sock != -1) {
         closesocket(raop_rtp_mirror->mirror_data_sock);
         raop_rtp_mirror->mirror_data_sock = -1;
     }
 
     /* Join the thread */
-    THREAD_JOIN(raop_rtp_mirror->thread_mirror);
+    if (!raop_rtp_mirror->session_loop) {
+        THREAD_JOIN(raop_rtp_mirror->thread_mirror);
+    }
 
     /* Mark thread as joined */
     MUTEX_LOCK(raop_rtp_mirror->run_mutex);
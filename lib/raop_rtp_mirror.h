@@ -21,14 +21,25 @@
 #include <stdint.h>
 #include "raop.h"
 #include "logger.h"
+#include "frame_pool.h"
+#include "capture.h"
+#include "session_loop.h"
 
 typedef struct raop_rtp_mirror_s raop_rtp_mirror_t;
 typedef struct h264codec_s h264codec_t;
 
 raop_rtp_mirror_t *raop_rtp_mirror_init(logger_t *logger, raop_callbacks_t *callbacks, raop_ntp_t *ntp,
-                                        const char *remote, int remotelen, const unsigned char *aeskey);
+                                        const char *remote, int remotelen, const unsigned char *aeskey,
+                                        frame_pool_t *frame_pool);
 void raop_rtp_mirror_init_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *streamConnectionID);
-void raop_rtp_mirror_start(raop_rtp_mirror_t *raop_rtp_mirror, unsigned short *mirror_data_lport, uint8_t show_client_FPS_data);
+void raop_rtp_mirror_set_capture(raop_rtp_mirror_t *raop_rtp_mirror, capture_t *capture);
+void raop_rtp_mirror_set_io_uring(raop_rtp_mirror_t *raop_rtp_mirror, bool use_io_uring);
+
+/* receive on session_loop instead of a thread (must be set before raop_rtp_mirror_start; io_uring is not used) */
+void raop_rtp_mirror_set_session_loop(raop_rtp_mirror_t *raop_rtp_mirror, session_loop_t *session_loop);
+void raop_rtp_mirror_set_queue_depth(raop_rtp_mirror_t *raop_rtp_mirror, int queue_depth);
+void raop_rtp_mirror_start(raop_rtp_mirror_t *raop_rtp_mirror, unsigned short *mirror_data_lport, uint8_t show_client_FPS_data,
+                           uint8_t h265);
 void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror);
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror);
 #endif //RAOP_RTP_MIRROR_H
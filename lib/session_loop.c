@@ -0,0 +1,453 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+#if defined(__linux__)
+#define SESSION_LOOP_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#include "session_loop.h"
+#include "httpd_poll.h"
+#include "threads.h"
+#include "compat.h"
+#include "thread_config.h"
+
+#define SESSION_LOOP_MAX_SOCKETS 8
+#define SESSION_LOOP_MAX_TIMERS  8
+#define SESSION_LOOP_MAX_EVENTS  16
+#define SESSION_LOOP_IDLE_TIMEOUT_MS 10000  /* wakeup when no timer is armed */
+
+typedef struct session_loop_socket_s {
+    int fd;                              /* -1: unused slot */
+    session_loop_callback_t callback;
+    void *cls;
+} session_loop_socket_t;
+
+typedef struct session_loop_timer_s {
+    bool used;
+    uint64_t deadline;                   /* monotonic nsecs, 0: not armed */
+    session_loop_callback_t callback;
+    void *cls;
+} session_loop_timer_t;
+
+struct session_loop_s {
+    logger_t *logger;
+    httpd_poll_t *poll;
+
+    /* written to wake the loop thread (stop, or a timer armed without a timerfd) */
+    int wake_fds[2];
+#ifdef SESSION_LOOP_TIMERFD
+    int timer_fd;
+#endif
+
+    mutex_handle_t mutex;
+    cond_handle_t idle_cond;             /* signalled when a callback returns */
+    session_loop_socket_t sockets[SESSION_LOOP_MAX_SOCKETS];
+    session_loop_timer_t timers[SESSION_LOOP_MAX_TIMERS];
+    void *dispatching;                   /* cls of the callback being run, or NULL */
+    bool running;
+    bool destroy_pending;                /* destroyed from a callback: the loop thread frees the loop */
+
+    thread_handle_t thread;
+
+    /* statistics */
+    uint64_t wakeups;
+    uint64_t callbacks;
+};
+
+static uint64_t
+session_loop_get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+}
+
+static bool
+session_loop_on_loop_thread(session_loop_t *session_loop)
+{
+    return pthread_equal(pthread_self(), session_loop->thread);
+}
+
+static void
+session_loop_wake(session_loop_t *session_loop)
+{
+#ifndef _WIN32
+    char c = 0;
+    if (write(session_loop->wake_fds[1], &c, 1) < 0 && errno != EAGAIN) {
+        logger_log(session_loop->logger, LOGGER_ERR, "session_loop could not wake the loop thread");
+    }
+#endif
+}
+
+/* the earliest timer deadline, or 0 if none is armed (mutex locked) */
+static uint64_t
+session_loop_next_deadline(session_loop_t *session_loop)
+{
+    uint64_t deadline = 0;
+    for (int i = 0; i < SESSION_LOOP_MAX_TIMERS; i++) {
+        session_loop_timer_t *timer = &session_loop->timers[i];
+        if (timer->used && timer->deadline && (!deadline || timer->deadline < deadline)) {
+            deadline = timer->deadline;
+        }
+    }
+    return deadline;
+}
+
+/* called (mutex locked) when the timers change */
+static void
+session_loop_update_timers(session_loop_t *session_loop)
+{
+#ifdef SESSION_LOOP_TIMERFD
+    uint64_t deadline = session_loop_next_deadline(session_loop);
+    struct itimerspec spec = { 0 };
+    spec.it_value.tv_sec = (time_t) (deadline / 1000000000ull);
+    spec.it_value.tv_nsec = (long) (deadline % 1000000000ull);
+    timerfd_settime(session_loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+#else
+    /* the loop thread computes its wait timeout from the deadlines */
+    if (!session_loop_on_loop_thread(session_loop)) {
+        session_loop_wake(session_loop);
+    }
+#endif
+}
+
+/* runs a callback with the mutex released (mutex locked) */
+static void
+session_loop_dispatch(session_loop_t *session_loop, session_loop_callback_t callback, void *cls, int fd)
+{
+    session_loop->dispatching = cls;
+    session_loop->callbacks++;
+    MUTEX_UNLOCK(session_loop->mutex);
+    callback(cls, fd);
+    MUTEX_LOCK(session_loop->mutex);
+    session_loop->dispatching = NULL;
+    pthread_cond_broadcast(&session_loop->idle_cond);
+}
+
+/* waits until a callback for cls is not running, unless called from it (mutex locked) */
+static void
+session_loop_wait_idle(session_loop_t *session_loop, void *cls)
+{
+    if (session_loop_on_loop_thread(session_loop)) {
+        return;
+    }
+    while (session_loop->dispatching && session_loop->dispatching == cls) {
+        pthread_cond_wait(&session_loop->idle_cond, &session_loop->mutex);
+    }
+}
+
+static void
+session_loop_free(session_loop_t *session_loop)
+{
+    logger_log(session_loop->logger, LOGGER_DEBUG, "session_loop: %llu wakeups, %llu callbacks",
+               (unsigned long long) session_loop->wakeups, (unsigned long long) session_loop->callbacks);
+#ifdef SESSION_LOOP_TIMERFD
+    close(session_loop->timer_fd);
+#endif
+#ifndef _WIN32
+    close(session_loop->wake_fds[0]);
+    close(session_loop->wake_fds[1]);
+#endif
+    httpd_poll_destroy(session_loop->poll);
+    COND_DESTROY(session_loop->idle_cond);
+    MUTEX_DESTROY(session_loop->mutex);
+    free(session_loop);
+}
+
+static THREAD_RETVAL
+session_loop_thread(void *arg)
+{
+    session_loop_t *session_loop = arg;
+    void *tags[SESSION_LOOP_MAX_EVENTS];
+    assert(session_loop);
+    thread_config_apply(THREAD_CLASS_AUDIO, "uxplay-session", session_loop->logger);
+
+    MUTEX_LOCK(session_loop->mutex);
+    while (session_loop->running) {
+        int timeout_ms = SESSION_LOOP_IDLE_TIMEOUT_MS;
+#ifndef SESSION_LOOP_TIMERFD
+        uint64_t deadline = session_loop_next_deadline(session_loop);
+        if (deadline) {
+            uint64_t now = session_loop_get_nsecs();
+            uint64_t wait_ms = (deadline > now ? (deadline - now + 999999) / 1000000 : 0);
+            timeout_ms = (wait_ms < (uint64_t) timeout_ms ? (int) wait_ms : timeout_ms);
+        }
+#endif
+        MUTEX_UNLOCK(session_loop->mutex);
+        int count = httpd_poll_wait(session_loop->poll, tags, SESSION_LOOP_MAX_EVENTS, timeout_ms);
+        MUTEX_LOCK(session_loop->mutex);
+        if (count < 0) {
+            logger_log(session_loop->logger, LOGGER_ERR, "session_loop error %d waiting for events", errno);
+            break;
+        }
+        session_loop->wakeups++;
+
+        for (int i = 0; i < count && session_loop->running; i++) {
+            if (tags[i] == (void *) session_loop->wake_fds) {
+                char buf[16];
+                while (read(session_loop->wake_fds[0], buf, sizeof(buf)) > 0) {
+                }
+#ifdef SESSION_LOOP_TIMERFD
+            } else if (tags[i] == (void *) &session_loop->timer_fd) {
+                uint64_t expirations;
+                if (read(session_loop->timer_fd, &expirations, sizeof(expirations)) < 0) {
+                    /* the timers are checked below in any case */
+                }
+#endif
+            } else {
+                /* the socket may have been removed by an earlier callback */
+                session_loop_socket_t *socket = tags[i];
+                if (socket->fd != -1) {
+                    session_loop_dispatch(session_loop, socket->callback, socket->cls, socket->fd);
+                }
+            }
+        }
+
+        /* one-shot timers are disarmed before their callback, which may rearm them */
+        bool expired = true;
+        while (expired && session_loop->running) {
+            uint64_t now = session_loop_get_nsecs();
+            expired = false;
+            for (int i = 0; i < SESSION_LOOP_MAX_TIMERS && session_loop->running; i++) {
+                session_loop_timer_t *timer = &session_loop->timers[i];
+                if (timer->used && timer->deadline && timer->deadline <= now) {
+                    timer->deadline = 0;
+                    expired = true;
+                    session_loop_dispatch(session_loop, timer->callback, timer->cls, -1);
+                }
+            }
+        }
+        if (session_loop->running) {
+            session_loop_update_timers(session_loop);
+        }
+    }
+    bool destroy = session_loop->destroy_pending;
+    MUTEX_UNLOCK(session_loop->mutex);
+
+    logger_log(session_loop->logger, LOGGER_DEBUG, "session_loop exiting thread");
+    if (destroy) {
+        session_loop_free(session_loop);
+    }
+    return 0;
+}
+
+session_loop_t *
+session_loop_init(logger_t *logger)
+{
+#ifdef _WIN32
+    logger_log(logger, LOGGER_WARNING, "session_loop: a per-session event loop is not available on Windows");
+    return NULL;
+#else
+    session_loop_t *session_loop;
+    assert(logger);
+
+    if (!strcmp(httpd_poll_get_backend(), "select")) {
+        logger_log(logger, LOGGER_WARNING, "session_loop: a per-session event loop needs epoll or kqueue");
+        return NULL;
+    }
+    session_loop = calloc(1, sizeof(session_loop_t));
+    if (!session_loop) {
+        return NULL;
+    }
+    session_loop->logger = logger;
+    for (int i = 0; i < SESSION_LOOP_MAX_SOCKETS; i++) {
+        session_loop->sockets[i].fd = -1;
+    }
+    session_loop->wake_fds[0] = session_loop->wake_fds[1] = -1;
+#ifdef SESSION_LOOP_TIMERFD
+    session_loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+    session_loop->poll = httpd_poll_init(SESSION_LOOP_MAX_SOCKETS + 2);
+    if (!session_loop->poll || pipe(session_loop->wake_fds) == -1 ||
+        fcntl(session_loop->wake_fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+        fcntl(session_loop->wake_fds[1], F_SETFL, O_NONBLOCK) == -1 ||
+#ifdef SESSION_LOOP_TIMERFD
+        session_loop->timer_fd == -1 ||
+        httpd_poll_add(session_loop->poll, session_loop->timer_fd, &session_loop->timer_fd) == -1 ||
+#endif
+        httpd_poll_add(session_loop->poll, session_loop->wake_fds[0], session_loop->wake_fds) == -1) {
+        logger_log(logger, LOGGER_ERR, "session_loop initialization failed (%d)", errno);
+#ifdef SESSION_LOOP_TIMERFD
+        if (session_loop->timer_fd != -1) close(session_loop->timer_fd);
+#endif
+        if (session_loop->wake_fds[0] != -1) close(session_loop->wake_fds[0]);
+        if (session_loop->wake_fds[1] != -1) close(session_loop->wake_fds[1]);
+        httpd_poll_destroy(session_loop->poll);
+        free(session_loop);
+        return NULL;
+    }
+    MUTEX_CREATE(session_loop->mutex);
+    COND_CREATE(session_loop->idle_cond);
+
+    MUTEX_LOCK(session_loop->mutex);
+    session_loop->running = true;
+    if (pthread_create(&session_loop->thread, NULL, session_loop_thread, session_loop)) {
+        MUTEX_UNLOCK(session_loop->mutex);
+        logger_log(logger, LOGGER_ERR, "session_loop could not create the loop thread");
+        session_loop->running = false;
+        session_loop_free(session_loop);
+        return NULL;
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+    logger_log(logger, LOGGER_DEBUG, "session_loop started (%s%s)", httpd_poll_get_backend(),
+#ifdef SESSION_LOOP_TIMERFD
+               ", timerfd"
+#else
+               ""
+#endif
+               );
+    return session_loop;
+#endif
+}
+
+void
+session_loop_destroy(session_loop_t *session_loop)
+{
+    if (!session_loop) {
+        return;
+    }
+    MUTEX_LOCK(session_loop->mutex);
+    session_loop->running = false;
+    if (session_loop_on_loop_thread(session_loop)) {
+        session_loop->destroy_pending = true;
+        pthread_detach(session_loop->thread);
+        MUTEX_UNLOCK(session_loop->mutex);
+        return;
+    }
+    session_loop_wake(session_loop);
+    MUTEX_UNLOCK(session_loop->mutex);
+    THREAD_JOIN(session_loop->thread);
+    session_loop_free(session_loop);
+}
+
+int
+session_loop_add_socket(session_loop_t *session_loop, int fd, session_loop_callback_t callback, void *cls)
+{
+    int ret = -1;
+    assert(session_loop && callback);
+#ifndef _WIN32
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        logger_log(session_loop->logger, LOGGER_ERR, "session_loop could not make socket %d non-blocking", fd);
+        return -1;
+    }
+#endif
+    MUTEX_LOCK(session_loop->mutex);
+    for (int i = 0; i < SESSION_LOOP_MAX_SOCKETS; i++) {
+        session_loop_socket_t *socket = &session_loop->sockets[i];
+        if (socket->fd != -1) {
+            continue;
+        }
+        socket->callback = callback;
+        socket->cls = cls;
+        socket->fd = fd;
+        ret = httpd_poll_add(session_loop->poll, fd, socket);
+        if (ret == -1) {
+            socket->fd = -1;
+        }
+        break;
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+    if (ret == -1) {
+        logger_log(session_loop->logger, LOGGER_ERR, "session_loop could not add socket %d", fd);
+    }
+    return ret;
+}
+
+void
+session_loop_remove_socket(session_loop_t *session_loop, int fd)
+{
+    assert(session_loop);
+    MUTEX_LOCK(session_loop->mutex);
+    for (int i = 0; i < SESSION_LOOP_MAX_SOCKETS; i++) {
+        session_loop_socket_t *socket = &session_loop->sockets[i];
+        if (socket->fd == fd) {
+            httpd_poll_remove(session_loop->poll, fd);
+            socket->fd = -1;
+            session_loop_wait_idle(session_loop, socket->cls);
+            break;
+        }
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+}
+
+int
+session_loop_add_timer(session_loop_t *session_loop, session_loop_callback_t callback, void *cls)
+{
+    int timer = -1;
+    assert(session_loop && callback);
+    MUTEX_LOCK(session_loop->mutex);
+    for (int i = 0; i < SESSION_LOOP_MAX_TIMERS; i++) {
+        if (!session_loop->timers[i].used) {
+            session_loop->timers[i].used = true;
+            session_loop->timers[i].deadline = 0;
+            session_loop->timers[i].callback = callback;
+            session_loop->timers[i].cls = cls;
+            timer = i;
+            break;
+        }
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+    return timer;
+}
+
+void
+session_loop_arm_timer(session_loop_t *session_loop, int timer, uint64_t delay_nsecs)
+{
+    assert(session_loop && timer >= 0 && timer < SESSION_LOOP_MAX_TIMERS);
+    MUTEX_LOCK(session_loop->mutex);
+    if (session_loop->timers[timer].used) {
+        session_loop->timers[timer].deadline = session_loop_get_nsecs() + (delay_nsecs ? delay_nsecs : 1);
+        if (!session_loop_on_loop_thread(session_loop)) {
+            /* when called from a callback, the timers are updated after it returns */
+            session_loop_update_timers(session_loop);
+        }
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+}
+
+void
+session_loop_disarm_timer(session_loop_t *session_loop, int timer)
+{
+    assert(session_loop && timer >= 0 && timer < SESSION_LOOP_MAX_TIMERS);
+    MUTEX_LOCK(session_loop->mutex);
+    session_loop->timers[timer].deadline = 0;
+    MUTEX_UNLOCK(session_loop->mutex);
+}
+
+void
+session_loop_remove_timer(session_loop_t *session_loop, int timer)
+{
+    assert(session_loop && timer >= 0 && timer < SESSION_LOOP_MAX_TIMERS);
+    MUTEX_LOCK(session_loop->mutex);
+    session_loop_timer_t *entry = &session_loop->timers[timer];
+    if (entry->used) {
+        entry->used = false;
+        entry->deadline = 0;
+        session_loop_wait_idle(session_loop, entry->cls);
+    }
+    MUTEX_UNLOCK(session_loop->mutex);
+}
@@ -0,0 +1,53 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * A per-session event loop: one thread that waits (epoll on Linux, kqueue on BSD and macOS)
+ * on the sockets of a session's NTP, audio RTP and mirror streams, and runs their timers
+ * (with a timerfd on Linux).  Each registered socket or timer has a callback that is run on
+ * the loop thread; callbacks must not block, and sockets are made non-blocking when added.
+ * Sockets and timers may be added, armed and removed from any thread: once a remove function
+ * returns, the callback is not running and will not be called again.
+ */
+
+#ifndef SESSION_LOOP_H
+#define SESSION_LOOP_H
+
+#include <stdint.h>
+#include "logger.h"
+
+typedef struct session_loop_s session_loop_t;
+
+/* fd is the readable socket, or -1 for a timer */
+typedef void (*session_loop_callback_t)(void *cls, int fd);
+
+/* starts the loop thread; returns NULL if not supported (Windows) */
+session_loop_t *session_loop_init(logger_t *logger);
+
+/* may be called from a callback (the loop thread then frees the loop when it exits) */
+void session_loop_destroy(session_loop_t *session_loop);
+
+int session_loop_add_socket(session_loop_t *session_loop, int fd, session_loop_callback_t callback, void *cls);
+void session_loop_remove_socket(session_loop_t *session_loop, int fd);
+
+/* returns a timer id (>= 0) for a new timer, which is not armed, or -1 */
+int session_loop_add_timer(session_loop_t *session_loop, session_loop_callback_t callback, void *cls);
+
+/* (re)arms a one-shot timer to expire after delay_nsecs */
+void session_loop_arm_timer(session_loop_t *session_loop, int timer, uint64_t delay_nsecs);
+void session_loop_disarm_timer(session_loop_t *session_loop, int timer);
+void session_loop_remove_timer(session_loop_t *session_loop, int timer);
+
+#endif //SESSION_LOOP_H
@@ -0,0 +1,264 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "compat.h"
+#include "socket_tuning.h"
+
+#ifdef _WIN32
+#define CAST (char *)
+#else
+#include <netinet/tcp.h>
+#include <netinet/ip.h>
+#define CAST
+#endif
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#define SOCKET_TUNING_MIN_RCVBUF (256 * 1024)
+#define SOCKET_TUNING_MAX_RCVBUF (8 * 1024 * 1024)
+
+/* DSCP code points (RFC 4594), in the upper six bits of the TOS / traffic class byte */
+#define DSCP_EF   (46 << 2)   /* expedited forwarding: timing */
+#define DSCP_AF41 (34 << 2)   /* interactive real-time: audio control */
+
+typedef struct socket_tuning_s {
+    const char *name;
+    int rcvbuf;          /* bytes, 0: system default */
+    bool nodelay;
+    bool quickack;
+    int tos;             /* 0: not marked */
+    int rcvlowat;        /* bytes, 0: system default */
+    bool timestamps;     /* kernel receive timestamps */
+} socket_tuning_t;
+
+/* the mirror stream buffer starts at 0.25 secs of 32 Mbit/s video, and is later *
+ * resized from the bitrate the client reports (see raop_rtp_mirror.c)          */
+static const socket_tuning_t profiles[SOCKET_PROFILES] = {
+    /* name            rcvbuf           nodelay quickack tos        rcvlowat timestamps */
+    { "mirror",        1024 * 1024,     true,   true,    0,         128,     true },
+    { "rtsp",          0,               true,   true,    0,         0,       false },
+    { "audio data",    0,               false,  false,   0,         0,       true },
+    { "audio control", 0,               false,  false,   DSCP_AF41, 0,       false },
+    { "timing",        0,               false,  false,   DSCP_EF,   0,       true },
+};
+
+static int
+set_int_option(int fd, int level, int option, int value)
+{
+    return setsockopt(fd, level, option, CAST &value, sizeof(value));
+}
+
+static int
+get_int_option(int fd, int level, int option)
+{
+    int value = -1;
+    socklen_t len = sizeof(value);
+    if (getsockopt(fd, level, option, CAST &value, &len) == -1) {
+        return -1;
+    }
+    return value;
+}
+
+/* appends "NAME configured->effective" (or "NAME configured (failed)") to the log line */
+static int
+tune_option(char *log, size_t size, int fd, int level, int option, const char *option_name, int value)
+{
+    int len = (int) strlen(log);
+    if (set_int_option(fd, level, option, value) == -1) {
+        snprintf(log + len, size - len, " %s %d (failed)", option_name, value);
+        return -1;
+    }
+    snprintf(log + len, size - len, " %s %d->%d", option_name, value, get_int_option(fd, level, option));
+    return 0;
+}
+
+#ifdef IPV6_TCLASS
+static bool
+socket_is_ipv6(int fd)
+{
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen = sizeof(saddr);
+    if (getsockname(fd, (struct sockaddr *) &saddr, &saddrlen) == -1) {
+        return false;
+    }
+    return saddr.ss_family == AF_INET6;
+}
+#endif
+
+static void
+tune_timestamps(char *log, size_t size, int fd)
+{
+    int len = (int) strlen(log);
+#if defined(SO_TIMESTAMPING) && defined(__linux__)
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (set_int_option(fd, SOL_SOCKET, SO_TIMESTAMPING, flags) == 0) {
+        snprintf(log + len, size - len, " SO_TIMESTAMPING rx-software");
+        return;
+    }
+#endif
+#if defined(SO_TIMESTAMPNS)
+    if (set_int_option(fd, SOL_SOCKET, SO_TIMESTAMPNS, 1) == 0) {
+        snprintf(log + len, size - len, " SO_TIMESTAMPNS");
+        return;
+    }
+#endif
+#if defined(SO_TIMESTAMP)
+    if (set_int_option(fd, SOL_SOCKET, SO_TIMESTAMP, 1) == 0) {
+        snprintf(log + len, size - len, " SO_TIMESTAMP");
+        return;
+    }
+#endif
+    snprintf(log + len, size - len, " (no receive timestamps)");
+}
+
+void
+socket_tuning_apply(logger_t *logger, int fd, socket_profile_t profile, int rcvbuf)
+{
+    const socket_tuning_t *tuning = &profiles[profile];
+    char log[320];
+    snprintf(log, sizeof(log), "socket tuning (%s, socket %d):", tuning->name, fd);
+
+    if (!rcvbuf) {
+        rcvbuf = tuning->rcvbuf;
+    }
+    if (rcvbuf > 0) {
+        tune_option(log, sizeof(log), fd, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", rcvbuf);
+    }
+    if (tuning->nodelay) {
+        tune_option(log, sizeof(log), fd, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1);
+    }
+#ifdef TCP_QUICKACK
+    /* Linux may leave quickack mode again, so this mainly speeds up the start of a stream */
+    if (tuning->quickack) {
+        tune_option(log, sizeof(log), fd, IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", 1);
+    }
+#endif
+    if (tuning->tos) {
+#ifdef IPV6_TCLASS
+        if (socket_is_ipv6(fd)) {
+            tune_option(log, sizeof(log), fd, IPPROTO_IPV6, IPV6_TCLASS, "IPV6_TCLASS", tuning->tos);
+        } else
+#endif
+        {
+            tune_option(log, sizeof(log), fd, IPPROTO_IP, IP_TOS, "IP_TOS", tuning->tos);
+        }
+    }
+#ifdef SO_RCVLOWAT
+    if (tuning->rcvlowat > 0) {
+        tune_option(log, sizeof(log), fd, SOL_SOCKET, SO_RCVLOWAT, "SO_RCVLOWAT", tuning->rcvlowat);
+    }
+#endif
+    if (tuning->timestamps) {
+        tune_timestamps(log, sizeof(log), fd);
+    }
+    logger_log(logger, LOGGER_DEBUG, "%s", log);
+}
+
+int
+socket_tuning_set_rcvbuf_for_bitrate(logger_t *logger, int fd, double bitrate_kbps, int msecs)
+{
+    double bytes = bitrate_kbps * 1000.0 / 8.0 * msecs / 1000.0;
+    int rcvbuf = (bytes > SOCKET_TUNING_MAX_RCVBUF ? SOCKET_TUNING_MAX_RCVBUF :
+                  (bytes < SOCKET_TUNING_MIN_RCVBUF ? SOCKET_TUNING_MIN_RCVBUF : (int) bytes));
+    if (set_int_option(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf) == -1) {
+        logger_log(logger, LOGGER_WARNING, "socket tuning (socket %d): could not set SO_RCVBUF = %d", fd, rcvbuf);
+        return -1;
+    }
+    int effective = get_int_option(fd, SOL_SOCKET, SO_RCVBUF);
+    logger_log(logger, LOGGER_DEBUG, "socket tuning (socket %d): SO_RCVBUF %d->%d for %.0f kbit/s", fd,
+               rcvbuf, effective, bitrate_kbps);
+    return effective;
+}
+
+int
+socket_recv_timestamped(int fd, void *buf, int len, int flags, uint64_t *rx_time)
+{
+    *rx_time = 0;
+#if defined(_WIN32)
+    return recv(fd, CAST buf, len, flags);
+#else
+    union {
+        char buf[SOCKET_RX_TIME_CONTROL_LEN];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int ret = (int) recvmsg(fd, &msg, flags);
+    if (ret <= 0) {
+        return ret;
+    }
+    *rx_time = socket_msg_rx_time(&msg);
+    return ret;
+#endif
+}
+
+#ifndef _WIN32
+uint64_t
+socket_msg_rx_time(struct msghdr *msg)
+{
+    uint64_t rx_time = 0;
+    if (!msg->msg_control) {
+        return 0;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        struct timespec ts = { 0, 0 };
+        switch (cmsg->cmsg_type) {
+#if defined(SCM_TIMESTAMPING) && defined(__linux__)
+        case SCM_TIMESTAMPING:
+            /* ts[0] is the software timestamp */
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            break;
+#endif
+#if defined(SCM_TIMESTAMPNS)
+        case SCM_TIMESTAMPNS:
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            break;
+#endif
+#if defined(SCM_TIMESTAMP)
+        case SCM_TIMESTAMP: {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            ts.tv_sec = tv.tv_sec;
+            ts.tv_nsec = tv.tv_usec * 1000;
+            break;
+        }
+#endif
+        default:
+            continue;
+        }
+        if (ts.tv_sec || ts.tv_nsec) {
+            rx_time = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+        }
+    }
+    return rx_time;
+}
+#endif
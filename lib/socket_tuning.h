@@ -0,0 +1,61 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Socket tuning profiles for the mirror stream, RTSP, audio and timing sockets:
+ * receive buffer sizing, TCP_NODELAY/TCP_QUICKACK, DSCP marking of the packets
+ * UxPlay sends (NTP queries, audio resend requests), SO_RCVLOWAT and kernel receive
+ * timestamps.  The configured and the effective (read back) values are logged.
+ */
+
+#ifndef SOCKET_TUNING_H
+#define SOCKET_TUNING_H
+
+#include <stdint.h>
+#include "logger.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <time.h>
+#endif
+
+typedef enum socket_profile_e {
+    SOCKET_PROFILE_MIRROR,            /* mirror video stream (TCP) */
+    SOCKET_PROFILE_RTSP,              /* RTSP/HTTP connection (TCP) */
+    SOCKET_PROFILE_AUDIO_DATA,        /* audio data (UDP) */
+    SOCKET_PROFILE_AUDIO_CONTROL,     /* audio control: resend requests (UDP) */
+    SOCKET_PROFILE_TIMING,            /* NTP timing (UDP) */
+    SOCKET_PROFILES
+} socket_profile_t;
+
+/* rcvbuf: SO_RCVBUF in bytes, or 0 for the profile's default */
+void socket_tuning_apply(logger_t *logger, int fd, socket_profile_t profile, int rcvbuf);
+
+/* resizes SO_RCVBUF to hold msecs of a stream at bitrate_kbps; returns the effective size */
+int socket_tuning_set_rcvbuf_for_bitrate(logger_t *logger, int fd, double bitrate_kbps, int msecs);
+
+/* recv() that also returns the kernel receive timestamp (CLOCK_REALTIME nsecs) of the data, *
+ * if the socket has receive timestamps enabled (see above); *rx_time is 0 if there is none  */
+int socket_recv_timestamped(int fd, void *buf, int len, int flags, uint64_t *rx_time);
+
+#ifndef _WIN32
+/* msg_control space for the receive timestamp of one message (e.g., in each mmsghdr of a recvmmsg) */
+#define SOCKET_RX_TIME_CONTROL_LEN CMSG_SPACE(3 * sizeof(struct timespec))
+
+/* the kernel receive timestamp (CLOCK_REALTIME nsecs) in the control data of a received message, or 0 */
+uint64_t socket_msg_rx_time(struct msghdr *msg);
+#endif
+
+#endif //SOCKET_TUNING_H
@@ -0,0 +1,344 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sps_parser.h"
+
+/* reads the RBSP bits of a NAL unit, skipping the emulation prevention bytes (00 00 03) */
+typedef struct sps_bits_s {
+    const unsigned char *data;
+    int len;
+    int pos;
+    int bit;
+    int zeros;
+    int overrun;
+} sps_bits_t;
+
+static void
+sps_bits_init(sps_bits_t *bits, const unsigned char *data, int len)
+{
+    memset(bits, 0, sizeof(sps_bits_t));
+    bits->data = data;
+    bits->len = len;
+}
+
+static unsigned int
+sps_read_bit(sps_bits_t *bits)
+{
+    unsigned int value;
+    if (bits->bit == 0 && bits->zeros >= 2 && bits->pos < bits->len && bits->data[bits->pos] == 0x03) {
+        bits->pos++;
+        bits->zeros = 0;
+    }
+    if (bits->pos >= bits->len) {
+        bits->overrun = 1;
+        return 0;
+    }
+    value = (bits->data[bits->pos] >> (7 - bits->bit)) & 0x01;
+    if (++bits->bit == 8) {
+        bits->zeros = (bits->data[bits->pos] ? 0 : bits->zeros + 1);
+        bits->pos++;
+        bits->bit = 0;
+    }
+    return value;
+}
+
+static uint32_t
+sps_read_bits(sps_bits_t *bits, int n)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < n; i++) {
+        value = (value << 1) | sps_read_bit(bits);
+    }
+    return value;
+}
+
+static void
+sps_skip_bits(sps_bits_t *bits, int n)
+{
+    for (int i = 0; i < n && !bits->overrun; i++) {
+        sps_read_bit(bits);
+    }
+}
+
+/* Exp-Golomb ue(v) and se(v) */
+static uint32_t
+sps_read_ue(sps_bits_t *bits)
+{
+    int leading_zeros = 0;
+    while (!sps_read_bit(bits)) {
+        if (bits->overrun || ++leading_zeros > 31) {
+            bits->overrun = 1;
+            return 0;
+        }
+    }
+    return (uint32_t) ((1ULL << leading_zeros) - 1) + sps_read_bits(bits, leading_zeros);
+}
+
+static int32_t
+sps_read_se(sps_bits_t *bits)
+{
+    uint32_t k = sps_read_ue(bits);
+    return ((k & 0x01) ? (int32_t) ((k + 1) / 2) : -(int32_t) (k / 2));
+}
+
+static void
+sps_skip_scaling_list(sps_bits_t *bits, int size)
+{
+    int last_scale = 8;
+    int next_scale = 8;
+    for (int j = 0; j < size && !bits->overrun; j++) {
+        if (next_scale) {
+            next_scale = (last_scale + sps_read_se(bits) + 256) % 256;
+        }
+        last_scale = (next_scale ? next_scale : last_scale);
+    }
+}
+
+/* Table E-1 */
+static const unsigned char sps_sar_table[17][2] = {
+    {0, 0}, {1, 1}, {12, 11}, {10, 11}, {16, 11}, {40, 33}, {24, 11}, {20, 11}, {32, 11},
+    {80, 33}, {18, 11}, {15, 11}, {64, 33}, {160, 99}, {4, 3}, {3, 2}, {2, 1}
+};
+
+static void
+sps_parse_h264_vui(sps_bits_t *bits, video_sps_info_t *info)
+{
+    if (sps_read_bit(bits)) {                        /* aspect_ratio_info_present_flag */
+        unsigned int aspect_ratio_idc = sps_read_bits(bits, 8);
+        if (aspect_ratio_idc == 255) {               /* Extended_SAR */
+            info->sar_width = (int) sps_read_bits(bits, 16);
+            info->sar_height = (int) sps_read_bits(bits, 16);
+        } else if (aspect_ratio_idc < 17) {
+            info->sar_width = sps_sar_table[aspect_ratio_idc][0];
+            info->sar_height = sps_sar_table[aspect_ratio_idc][1];
+        }
+    }
+    if (sps_read_bit(bits)) {                        /* overscan_info_present_flag */
+        sps_skip_bits(bits, 1);
+    }
+    if (sps_read_bit(bits)) {                        /* video_signal_type_present_flag */
+        sps_skip_bits(bits, 3);                      /* video_format */
+        info->full_range = sps_read_bit(bits);
+        if (sps_read_bit(bits)) {                    /* colour_description_present_flag */
+            info->colour_description = true;
+            info->colour_primaries = (unsigned char) sps_read_bits(bits, 8);
+            info->transfer_characteristics = (unsigned char) sps_read_bits(bits, 8);
+            info->matrix_coefficients = (unsigned char) sps_read_bits(bits, 8);
+        }
+    }
+    if (sps_read_bit(bits)) {                        /* chroma_loc_info_present_flag */
+        sps_read_ue(bits);
+        sps_read_ue(bits);
+    }
+    if (sps_read_bit(bits)) {                        /* timing_info_present_flag */
+        uint32_t num_units_in_tick = sps_read_bits(bits, 32);
+        uint32_t time_scale = sps_read_bits(bits, 32);
+        info->fixed_frame_rate = sps_read_bit(bits);
+        if (num_units_in_tick && time_scale && !bits->overrun) {
+            /* a frame is two field ticks */
+            uint64_t den = 2 * (uint64_t) num_units_in_tick;
+            while (den > INT32_MAX || time_scale > INT32_MAX) {
+                den >>= 1;
+                time_scale >>= 1;
+            }
+            info->fps_num = (int) time_scale;
+            info->fps_den = (int) den;
+        }
+    }
+}
+
+int
+sps_parser_parse_h264(const unsigned char *nal, int len, video_sps_info_t *info)
+{
+    sps_bits_t bits;
+    unsigned int frame_mbs_only_flag;
+    int crop_unit_x, crop_unit_y;
+    if (len < 4 || (nal[0] & 0x1f) != 7) {
+        return -1;
+    }
+    memset(info, 0, sizeof(video_sps_info_t));
+    sps_bits_init(&bits, nal + 1, len - 1);
+    info->profile = (int) sps_read_bits(&bits, 8);
+    sps_skip_bits(&bits, 8);                         /* constraint_set flags */
+    info->level = (int) sps_read_bits(&bits, 8);
+    sps_read_ue(&bits);                              /* seq_parameter_set_id */
+    info->chroma_format = 1;
+    info->bit_depth = 8;
+    switch (info->profile) {
+    case 100: case 110: case 122: case 244: case 44: case 83:
+    case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+        info->chroma_format = (int) sps_read_ue(&bits);
+        if (info->chroma_format == 3) {
+            if (sps_read_bit(&bits)) {               /* separate_colour_plane_flag */
+                info->chroma_format = 0;             /* each colour plane is coded as monochrome */
+            }
+        }
+        info->bit_depth = 8 + (int) sps_read_ue(&bits);
+        sps_read_ue(&bits);                          /* bit_depth_chroma_minus8 */
+        sps_skip_bits(&bits, 1);                     /* qpprime_y_zero_transform_bypass_flag */
+        if (sps_read_bit(&bits)) {                   /* seq_scaling_matrix_present_flag */
+            for (int i = 0; i < (info->chroma_format != 3 ? 8 : 12); i++) {
+                if (sps_read_bit(&bits)) {
+                    sps_skip_scaling_list(&bits, (i < 6 ? 16 : 64));
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    sps_read_ue(&bits);                              /* log2_max_frame_num_minus4 */
+    switch (sps_read_ue(&bits)) {                    /* pic_order_cnt_type */
+    case 0:
+        sps_read_ue(&bits);                          /* log2_max_pic_order_cnt_lsb_minus4 */
+        break;
+    case 1: {
+        sps_skip_bits(&bits, 1);                     /* delta_pic_order_always_zero_flag */
+        sps_read_se(&bits);                          /* offset_for_non_ref_pic */
+        sps_read_se(&bits);                          /* offset_for_top_to_bottom_field */
+        uint32_t cycle = sps_read_ue(&bits);
+        for (uint32_t i = 0; i < cycle && !bits.overrun; i++) {
+            sps_read_se(&bits);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    sps_read_ue(&bits);                              /* max_num_ref_frames */
+    sps_skip_bits(&bits, 1);                         /* gaps_in_frame_num_value_allowed_flag */
+    uint32_t width_mbs = sps_read_ue(&bits) + 1;
+    uint32_t height_map_units = sps_read_ue(&bits) + 1;
+    frame_mbs_only_flag = sps_read_bit(&bits);
+    if (!frame_mbs_only_flag) {
+        sps_skip_bits(&bits, 1);                     /* mb_adaptive_frame_field_flag */
+    }
+    sps_skip_bits(&bits, 1);                         /* direct_8x8_inference_flag */
+    if (bits.overrun || width_mbs > 1024 || height_map_units > 1024) {
+        return -1;
+    }
+    info->width = (int) width_mbs * 16;
+    info->height = (int) (2 - frame_mbs_only_flag) * (int) height_map_units * 16;
+    if (info->chroma_format == 0) {
+        crop_unit_x = 1;
+        crop_unit_y = 2 - frame_mbs_only_flag;
+    } else {
+        crop_unit_x = (info->chroma_format == 3 ? 1 : 2);
+        crop_unit_y = (info->chroma_format == 1 ? 2 : 1) * (2 - frame_mbs_only_flag);
+    }
+    if (sps_read_bit(&bits)) {                       /* frame_cropping_flag */
+        uint32_t left = sps_read_ue(&bits);
+        uint32_t right = sps_read_ue(&bits);
+        uint32_t top = sps_read_ue(&bits);
+        uint32_t bottom = sps_read_ue(&bits);
+        info->width -= (int) (left + right) * crop_unit_x;
+        info->height -= (int) (top + bottom) * crop_unit_y;
+    }
+    if (sps_read_bit(&bits)) {                       /* vui_parameters_present_flag */
+        sps_parse_h264_vui(&bits, info);
+    }
+    if (bits.overrun || info->width <= 0 || info->height <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* the VUI of an h265 SPS follows the short-term reference picture sets and other fields *
+ * that are not needed here, so only the profile, level, resolution and bit depth are read */
+int
+sps_parser_parse_h265(const unsigned char *nal, int len, video_sps_info_t *info)
+{
+    sps_bits_t bits;
+    int sub_width_c, sub_height_c;
+    if (len < 4 || ((nal[0] >> 1) & 0x3f) != 33) {
+        return -1;
+    }
+    memset(info, 0, sizeof(video_sps_info_t));
+    info->h265 = true;
+    sps_bits_init(&bits, nal + 2, len - 2);
+    sps_skip_bits(&bits, 4);                         /* sps_video_parameter_set_id */
+    int max_sub_layers_minus1 = (int) sps_read_bits(&bits, 3);
+    sps_skip_bits(&bits, 1);                         /* sps_temporal_id_nesting_flag */
+
+    /* profile_tier_level(1, sps_max_sub_layers_minus1) */
+    sps_skip_bits(&bits, 3);                         /* general_profile_space, general_tier_flag */
+    info->profile = (int) sps_read_bits(&bits, 5);
+    sps_skip_bits(&bits, 32 + 48);                   /* compatibility flags, constraint flags */
+    info->level = (int) sps_read_bits(&bits, 8);
+    int sub_layer_profile_present[8], sub_layer_level_present[8];
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        sub_layer_profile_present[i] = sps_read_bit(&bits);
+        sub_layer_level_present[i] = sps_read_bit(&bits);
+    }
+    if (max_sub_layers_minus1 > 0) {
+        sps_skip_bits(&bits, 2 * (8 - max_sub_layers_minus1));
+    }
+    for (int i = 0; i < max_sub_layers_minus1; i++) {
+        if (sub_layer_profile_present[i]) {
+            sps_skip_bits(&bits, 88);
+        }
+        if (sub_layer_level_present[i]) {
+            sps_skip_bits(&bits, 8);
+        }
+    }
+
+    sps_read_ue(&bits);                              /* sps_seq_parameter_set_id */
+    info->chroma_format = (int) sps_read_ue(&bits);
+    if (info->chroma_format == 3 && sps_read_bit(&bits)) {
+        info->chroma_format = 0;                     /* separate_colour_plane_flag */
+    }
+    uint32_t width = sps_read_ue(&bits);
+    uint32_t height = sps_read_ue(&bits);
+    if (bits.overrun || width > 16888 || height > 16888) {
+        return -1;
+    }
+    info->width = (int) width;
+    info->height = (int) height;
+    sub_width_c = ((info->chroma_format == 1 || info->chroma_format == 2) ? 2 : 1);
+    sub_height_c = (info->chroma_format == 1 ? 2 : 1);
+    if (sps_read_bit(&bits)) {                       /* conformance_window_flag */
+        uint32_t left = sps_read_ue(&bits);
+        uint32_t right = sps_read_ue(&bits);
+        uint32_t top = sps_read_ue(&bits);
+        uint32_t bottom = sps_read_ue(&bits);
+        info->width -= (int) (left + right) * sub_width_c;
+        info->height -= (int) (top + bottom) * sub_height_c;
+    }
+    info->bit_depth = 8 + (int) sps_read_ue(&bits);
+    if (bits.overrun || info->width <= 0 || info->height <= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void
+sps_parser_describe(const video_sps_info_t *info, char *str, int len)
+{
+    int n = snprintf(str, len, "%s profile %d level %.1f, %dx%d, %d-bit", (info->h265 ? "h265" : "h264"), info->profile,
+                     (double) info->level / (info->h265 ? 30.0 : 10.0), info->width, info->height, info->bit_depth);
+    if (n > 0 && n < len && info->fps_num) {
+        n += snprintf(str + n, len - n, ", %.2f fps%s", (double) info->fps_num / info->fps_den,
+                      (info->fixed_frame_rate ? "" : " (max)"));
+    }
+    if (n > 0 && n < len && info->colour_description) {
+        snprintf(str + n, len - n, ", colour %d/%d/%d %s range", (int) info->colour_primaries,
+                 (int) info->transfer_characteristics, (int) info->matrix_coefficients,
+                 (info->full_range ? "full" : "limited"));
+    }
+}
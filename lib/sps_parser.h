@@ -0,0 +1,35 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Parsing of the h264 and h265 Sequence Parameter Set (SPS) NAL units sent by the client
+ * before the first keyframe: resolution, profile/level, and (h264) the VUI timing and
+ * colorimetry, so that the video pipeline can be configured before decoding starts.
+ */
+
+#ifndef SPS_PARSER_H
+#define SPS_PARSER_H
+
+#include "stream.h"
+
+/* nal (size len) is the SPS NAL unit, starting with its NAL header (no start code); *
+ * returns 0 and fills info, or -1 if the SPS is invalid or unsupported             */
+int sps_parser_parse_h264(const unsigned char *nal, int len, video_sps_info_t *info);
+int sps_parser_parse_h265(const unsigned char *nal, int len, video_sps_info_t *info);
+
+/* a one-line description of info, for logging */
+void sps_parser_describe(const video_sps_info_t *info, char *str, int len);
+
+#endif //SPS_PARSER_H
@@ -40,6 +40,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
@@ -54,6 +55,7 @@ typedef struct
 {
     BIGNUM     * N;
     BIGNUM     * g;
+    BN_MONT_CTX * mont;   /* shared Montgomery context of N (built-in groups only), or 0 */
 } NGConstant;
 
 struct NGHex
@@ -206,13 +208,65 @@ static struct NGHex global_Ng_constants[] = {
 };
 
 
+/* Montgomery contexts of the built-in group moduli, set up once and then only read, */
+/* and a BN_CTX for each thread, kept for reuse by later calls from the same thread    */
+static BN_MONT_CTX    * global_Ng_mont[ sizeof(global_Ng_constants) / sizeof(global_Ng_constants[0]) ];
+static pthread_once_t   global_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    bn_ctx_key;
+
+static void free_bn_ctx( void * ctx )
+{
+    BN_CTX_free( (BN_CTX *) ctx );
+}
+
+static void init_globals()
+{
+    BN_CTX * ctx = BN_CTX_new();
+    pthread_key_create( &bn_ctx_key, free_bn_ctx );
+    for ( int i = 0; i < (int) (sizeof(global_Ng_mont) / sizeof(global_Ng_mont[0])); i++ )
+    {
+        BIGNUM * N = 0;
+        global_Ng_mont[ i ] = BN_MONT_CTX_new();
+        if ( !ctx || !global_Ng_mont[ i ] || !BN_hex2bn( &N, global_Ng_constants[ i ].n_hex ) ||
+             !BN_MONT_CTX_set( global_Ng_mont[ i ], N, ctx ) )
+        {
+            BN_MONT_CTX_free( global_Ng_mont[ i ] );
+            global_Ng_mont[ i ] = 0;
+        }
+        BN_free( N );
+    }
+    BN_CTX_free( ctx );
+}
+
+/* the BN_CTX of the calling thread (not to be freed by the caller) */
+static BN_CTX * get_bn_ctx()
+{
+    BN_CTX * ctx;
+    pthread_once( &global_once, init_globals );
+    ctx = (BN_CTX *) pthread_getspecific( bn_ctx_key );
+    if ( !ctx )
+    {
+        ctx = BN_CTX_new();
+        if ( ctx && pthread_setspecific( bn_ctx_key, ctx ) )
+        {
+            BN_CTX_free( ctx );
+            ctx = 0;
+        }
+    }
+    return ctx;
+}
+
 static NGConstant * new_ng( SRP_NGType ng_type, const char * n_hex, const char * g_hex )
 {
     NGConstant * ng   = (NGConstant *) malloc( sizeof(NGConstant) );
+    if( !ng )
+       return 0;
+
     ng->N             = BN_new();
     ng->g             = BN_new();
+    ng->mont          = 0;
 
-    if( !ng || !ng->N || !ng->g )
+    if( !ng->N || !ng->g )
        return 0;
 
     if ( ng_type != SRP_NG_CUSTOM )
@@ -222,6 +276,8 @@ static NGConstant * new_ng( SRP_NGType ng_type, const char * n_hex, const char *
            idx -= 1;
         n_hex = global_Ng_constants[ idx ].n_hex;
         g_hex = global_Ng_constants[ idx ].g_hex;
+        pthread_once( &global_once, init_globals );
+        ng->mont = global_Ng_mont[ idx ];
     }
     BN_hex2bn( &ng->N, n_hex );
     BN_hex2bn( &ng->g, g_hex );
@@ -229,6 +285,16 @@ static NGConstant * new_ng( SRP_NGType ng_type, const char * n_hex, const char *
     return ng;
 }
 
+/* r = a^p mod N, using the precomputed Montgomery context of N if there is one */
+static int mod_exp( BIGNUM * r, const BIGNUM * a, const BIGNUM * p, const NGConstant * ng, BN_CTX * ctx )
+{
+    if ( !ng->mont )
+        return BN_mod_exp( r, a, p, ng->N, ctx );
+    if ( BN_num_bits( a ) <= BN_BITS2 && !BN_get_flags( p, BN_FLG_CONSTTIME ) )
+        return BN_mod_exp_mont_word( r, BN_get_word( a ), p, ng->N, ctx, ng->mont );
+    return BN_mod_exp_mont( r, a, p, ng->N, ctx, ng->mont );
+}
+
 static void delete_ng( NGConstant * ng )
 {
    if (ng)
@@ -629,7 +695,7 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
     BIGNUM     * s   = BN_new();
     BIGNUM     * v   = BN_new();
     BIGNUM     * x   = 0;
-    BN_CTX     * ctx = BN_CTX_new();
+    BN_CTX     * ctx = get_bn_ctx();
     NGConstant * ng  = new_ng( ng_type, n_hex, g_hex );
 
     if( !s || !v || !ctx || !ng )
@@ -647,7 +713,7 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
     if( !x )
        goto cleanup_and_exit;
 
-    BN_mod_exp(v, ng->g, x, ng->N, ctx);
+    mod_exp(v, ng->g, x, ng, ctx);
 
     *len_s   = BN_num_bytes(s);
     *len_v   = BN_num_bytes(v);
@@ -666,10 +732,35 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
     BN_free(s);
     BN_free(v);
     BN_free(x);
-    BN_CTX_free(ctx);
 }
 #ifdef APPLE_VARIANT
 
+/* Out: bytes_gb
+ * Returns 0 on success, -1 on failure
+ */
+int srp_create_server_ephemeral_base( SRP_NGType ng_type,
+                                      const unsigned char * bytes_b, int len_b,
+                                      unsigned char * bytes_gb, int len_gb,
+                                      const char * n_hex, const char * g_hex ) {
+  BIGNUM             *b    = BN_bin2bn(bytes_b, len_b, NULL);
+  BIGNUM             *gb   = BN_new();
+  BN_CTX             *ctx  = get_bn_ctx();
+  NGConstant         *ng   = new_ng( ng_type, n_hex, g_hex );
+  int                 ret  = -1;
+
+  if( !b || !gb || !ctx || !ng )
+    goto cleanup_and_exit;
+
+  if ( mod_exp(gb, ng->g, b, ng, ctx) && BN_bn2binpad(gb, bytes_gb, len_gb) == len_gb )
+    ret = 0;
+
+ cleanup_and_exit:
+  delete_ng( ng );
+  BN_clear_free(b);
+  BN_free(gb);
+  return ret;
+}
+
 /* Out: bytes_B, len_B, bytes_b, len_b 
  * On failure, bytes_B and bytes_b  will be set to NULL 
  * len_B  and len_will be set to 0
@@ -677,6 +768,7 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
 void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
                                       const unsigned char * bytes_v, int len_v,  
                                       const unsigned char * bytes_b, int len_b,
+                                      const unsigned char * bytes_gb, int len_gb,
                                       const unsigned char ** bytes_B, int * len_B,
                                       const char * n_hex, const char * g_hex,
                                       int rfc5054_compat ) {
@@ -686,7 +778,7 @@ void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
   BIGNUM             *B    = BN_new();
   BIGNUM             *b    = BN_new();
   BIGNUM             *k    = 0;
-  BN_CTX             *ctx  = BN_CTX_new();
+  BN_CTX             *ctx  = get_bn_ctx();
   NGConstant         *ng   = new_ng( ng_type, n_hex, g_hex );
 
   *len_B   = 0;
@@ -695,7 +787,7 @@ void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
   if( !v || !B || !b || !tmp1 || !tmp2 || !ctx || !ng )
     goto cleanup_and_exit;
 
-  b = BN_bin2bn(bytes_b, len_b, NULL);
+  BN_bin2bn(bytes_b, len_b, b);
   
   if (rfc5054_compat)
     k = H_nn_rfc5054(alg, ng->N, ng->N, ng->g);
@@ -705,17 +797,21 @@ void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
   if(!k)
     goto cleanup_and_exit;
 
+  /* g^b may have been computed ahead of time */
+  if (bytes_gb)
+    BN_bin2bn(bytes_gb, len_gb, tmp2);
+  else
+    mod_exp(tmp2, ng->g, b, ng, ctx);
+
   /* B = kv + g^b */
   if (rfc5054_compat)
     {
       BN_mod_mul(tmp1, k, v, ng->N, ctx);
-      BN_mod_exp(tmp2, ng->g, b, ng->N, ctx);
       BN_mod_add(B, tmp1, tmp2, ng->N, ctx);
     }
   else
     {
       BN_mul(tmp1, k, v, ctx);
-      BN_mod_exp(tmp2, ng->g, b, ng->N, ctx);
       BN_add(B, tmp1, tmp2);
     }
 
@@ -724,13 +820,13 @@ void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
    BN_bn2bin( B, (unsigned char *) *bytes_B );  
 
  cleanup_and_exit:
+   delete_ng( ng );
    BN_free(v);
    if (k) BN_free(k);
    BN_free(B);
-   BN_free(b);
+   BN_clear_free(b);
    BN_free(tmp1);
    BN_free(tmp2);
-   BN_CTX_free(ctx);
 }
 #endif
 
@@ -744,6 +840,7 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
                                         const unsigned char * bytes_A, int len_A,
 #ifdef APPLE_VARIANT
 					const unsigned char * bytes_b, int len_b,
+					const unsigned char * bytes_gb, int len_gb,
 #endif
                                         const unsigned char ** bytes_B, int * len_B,
                                         const char * n_hex, const char * g_hex,
@@ -759,7 +856,7 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
     BIGNUM             *k    = 0;
     BIGNUM             *tmp1 = BN_new();
     BIGNUM             *tmp2 = BN_new();
-    BN_CTX             *ctx  = BN_CTX_new();
+    BN_CTX             *ctx  = get_bn_ctx();
     int                 ulen = strlen(username) + 1;
     NGConstant         *ng   = new_ng( ng_type, n_hex, g_hex );
     struct SRPVerifier *ver  = 0;
@@ -803,7 +900,7 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
        BN_rand(b, 256, -1, 0);
 #ifdef APPLE_VARIANT
        } else {
-           b = BN_bin2bn(bytes_b, len_b, NULL);
+           BN_bin2bn(bytes_b, len_b, b);
        }
 #endif
 
@@ -819,17 +916,23 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
           goto cleanup_and_exit;
        }
 
+#ifdef APPLE_VARIANT
+       /* g^b may have been computed ahead of time */
+       if (bytes_b && bytes_gb)
+          BN_bin2bn(bytes_gb, len_gb, tmp2);
+       else
+#endif
+       mod_exp(tmp2, ng->g, b, ng, ctx);
+
        /* B = kv + g^b */
        if (rfc5054_compat)
        {
           BN_mod_mul(tmp1, k, v, ng->N, ctx);
-          BN_mod_exp(tmp2, ng->g, b, ng->N, ctx);
           BN_mod_add(B, tmp1, tmp2, ng->N, ctx);
        }
        else
        {
           BN_mul(tmp1, k, v, ctx);
-          BN_mod_exp(tmp2, ng->g, b, ng->N, ctx);
           BN_add(B, tmp1, tmp2);
        }
 
@@ -846,9 +949,9 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
        }
 
        /* S = (A *(v^u)) ^ b */
-       BN_mod_exp(tmp1, v, u, ng->N, ctx);
+       mod_exp(tmp1, v, u, ng, ctx);
        BN_mul(tmp2, A, tmp1, ctx);
-       BN_mod_exp(S, tmp2, b, ng->N, ctx);
+       mod_exp(S, tmp2, b, ng, ctx);
 
 #ifdef APPLE_VARIANT
        hash_session_key(alg, S, ver->session_key);
@@ -886,10 +989,9 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
     if (k) BN_free(k);
     BN_free(B);
     BN_free(S);
-    BN_free(b);
+    BN_clear_free(b);
     BN_free(tmp1);
     BN_free(tmp2);
-    BN_CTX_free(ctx);
 
     return ver;
 }
@@ -131,6 +131,18 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
 
 
 #ifdef APPLE_VARIANT
+/* Out: bytes_gb
+ * Computes g^b mod N (as len_gb bytes, zero-padded on the left), the part of the server
+ * ephemeral key B = kv + g^b that does not depend on the verifier, so it can be prepared
+ * ahead of time.  Returns 0 on success, -1 on failure.
+ *
+ * The n_hex and g_hex parameters should be 0 unless SRP_NG_CUSTOM is used for ng_type
+ */
+int srp_create_server_ephemeral_base( SRP_NGType ng_type,
+                                      const unsigned char * bytes_b, int len_b,
+                                      unsigned char * bytes_gb, int len_gb,
+                                      const char * n_hex, const char * g_hex );
+
 /* Out: bytes_B, len_B
  * On failure, bytes_B will be set to NULL and len_B will be set to 0
  *
@@ -138,10 +150,12 @@ void srp_create_salted_verification_key( SRP_HashAlgorithm alg,
  *
  * bytes_b should be a pointer to a cryptographically secure random array of length 
  * len_b bytes (for example, produced with OpenSSL's RAND_bytes(bytes_b, len_b)).
+ * bytes_gb (may be null) is g^b from srp_create_server_ephemeral_base().
  */
 void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
                                       const unsigned char * bytes_v, int len_v,  
                                       const unsigned char * bytes_b, int len_b,
+                                      const unsigned char * bytes_gb, int len_gb,
                                       const unsigned char ** bytes_B, int * len_B,
 				      const char * n_hex, const char * g_hex,
 				      int rfc5054_compat );
@@ -156,6 +170,9 @@ void srp_create_server_ephemeral_key( SRP_HashAlgorithm alg, SRP_NGType ng_type,
  * If rfc5054_compat is non-zero the resulting verifier will be RFC 5054 compaliant. This
  * breaks compatibility with previous versions of the csrp library but is recommended
  * for new code.
+ *
+ * (APPLE_VARIANT) bytes_b and bytes_gb, if not null, are the server ephemeral private key b
+ * and g^b, as for srp_create_server_ephemeral_key()
  */
 struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_type, const char * username,
                                         const unsigned char * bytes_s, int len_s, 
@@ -163,6 +180,7 @@ struct SRPVerifier *  srp_verifier_new( SRP_HashAlgorithm alg, SRP_NGType ng_typ
                                         const unsigned char * bytes_A, int len_A,
 #ifdef APPLE_VARIANT
 					const unsigned char * bytes_b, int len_b,
+					const unsigned char * bytes_gb, int len_gb,
 #endif
                                         const unsigned char ** bytes_B, int * len_B,
                                         const char * n_hex, const char * g_hex,
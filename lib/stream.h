@@ -21,12 +21,57 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+typedef enum video_codec_e {
+    VIDEO_CODEC_H264,
+    VIDEO_CODEC_H265
+} video_codec_t;
+
+/* index of the NAL units in an Annex-B (start-code-delimited) access unit */
+#define NAL_INDEX_MAX 16
+typedef struct {
+    int offset;                /* position of the NAL header byte (after the 4-byte start code) */
+    int size;                  /* NAL unit size, not including the start code */
+    unsigned char type;        /* nal_unit_type (h264 or h265) */
+    unsigned char ref_idc;     /* h264 nal_ref_idc; for h265, 0 for sub-layer non-reference pictures, 1 otherwise */
+} nal_unit_info_t;
+
+typedef struct {
+    int count;                 /* number of NAL units in the access unit */
+    int indexed;               /* number of them listed in nal[] (at most NAL_INDEX_MAX) */
+    bool keyframe;             /* true if the access unit contains an IDR (h265: IRAP) slice */
+    bool h265;
+    nal_unit_info_t nal[NAL_INDEX_MAX];
+} nal_index_t;
+
+/* stream properties parsed from the h264 (or h265) SPS, which the client sends before the first keyframe */
+typedef struct {
+    bool h265;
+    int profile;               /* profile_idc (h265: general_profile_idc) */
+    int level;                 /* level_idc (h264: 10 x level, h265: 30 x level) */
+    int width;                 /* after cropping */
+    int height;
+    int chroma_format;         /* chroma_format_idc: 1 = 4:2:0 */
+    int bit_depth;             /* luma */
+    int sar_width;             /* sample aspect ratio, 0 if not given */
+    int sar_height;
+    int fps_num;               /* from the VUI timing info: 0 if not given */
+    int fps_den;
+    bool fixed_frame_rate;
+    bool colour_description;   /* the next three are valid (ISO/IEC 23091-4 code points) */
+    unsigned char colour_primaries;
+    unsigned char transfer_characteristics;
+    unsigned char matrix_coefficients;
+    bool full_range;
+} video_sps_info_t;
+
 typedef struct {
     int nal_count;
     unsigned char *data;
     int data_len;
     uint64_t ntp_time_local;
     uint64_t ntp_time_remote;
+    void *buffer;   /* zero-copy mode: if not NULL, data belongs to this renderer buffer, which video_process must consume */
+    nal_index_t nal_index;
 } h264_decode_struct;
 
 typedef struct {
@@ -40,4 +85,25 @@ typedef struct {
     unsigned short seqnum;
 } audio_decode_struct;
 
+/* video streaming performance report sent by the client (about once per second) while mirroring; *
+ * only the fields whose key was recognized (see raop_rtp_mirror.c) have their flag in "valid"     */
+#define CLIENT_STATS_FPS            (1 << 0)
+#define CLIENT_STATS_DROPPED        (1 << 1)
+#define CLIENT_STATS_BITRATE        (1 << 2)
+#define CLIENT_STATS_ENCODE_LATENCY (1 << 3)
+#define CLIENT_STATS_WIDTH          (1 << 4)
+#define CLIENT_STATS_HEIGHT         (1 << 5)
+
+typedef struct {
+    unsigned int valid;        /* CLIENT_STATS_* flags of the fields reported */
+    double fps;                /* frames per second sent by the client */
+    double dropped;            /* frames dropped by the client */
+    double bitrate_kbps;       /* video bitrate */
+    double encode_latency_ms;  /* time spent encoding each frame */
+    int width;
+    int height;
+    int keys;                  /* number of values in the report (including unrecognized ones) */
+    uint64_t ntp_time_local;   /* when the report was received */
+} client_video_stats_t;
+
 #endif //AIRPLAYSERVER_STREAM_H
@@ -0,0 +1,250 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "telemetry.h"
+#include "threads.h"
+
+#define SECOND_IN_NSECS 1000000000UL
+
+/* values are recorded in microseconds: values below 2^SUB_BITS are exact, and each higher  *
+ * power-of-two range is split into 2^SUB_BITS equal buckets (relative error < 1/16),       *
+ * up to 2^MAX_POWER usecs (about 67 secs); larger values are counted in the last bucket    */
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_POWER 26
+#define BUCKETS (SUB_BUCKETS + (MAX_POWER - SUB_BITS) * SUB_BUCKETS)
+
+typedef struct histogram_s {
+    atomic_ullong counts[BUCKETS];
+    atomic_ullong count;
+    atomic_ullong total_usecs;
+    atomic_ullong max_usecs;
+} histogram_t;
+
+static const char *histogram_names[TELEMETRY_HISTOGRAMS] = {
+    "video_network", "video_jitter", "video_decrypt", "video_nal", "video_push", "video_render",
+    "audio_jitter", "audio_decrypt", "audio_process", "audio_lead", "pair_verify",
+    "pair_setup"
+};
+
+static histogram_t histograms[TELEMETRY_HISTOGRAMS];
+static atomic_bool enabled = false;
+
+static logger_t *telemetry_logger = NULL;
+static FILE *telemetry_file = NULL;
+static int telemetry_interval = 0;
+static int telemetry_running = 0;
+static thread_handle_t telemetry_thread;
+static mutex_handle_t telemetry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cond_handle_t telemetry_cond = PTHREAD_COND_INITIALIZER;
+
+static int
+bucket_index(uint64_t usecs)
+{
+    if (usecs < SUB_BUCKETS) {
+        return (int) usecs;
+    }
+    int power = 63 - __builtin_clzll(usecs);
+    if (power >= MAX_POWER) {
+        return BUCKETS - 1;
+    }
+    int sub = (int) (usecs >> (power - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return SUB_BUCKETS + (power - SUB_BITS) * SUB_BUCKETS + sub;
+}
+
+/* midpoint of the bucket's value range */
+static double
+bucket_value(int index)
+{
+    if (index < SUB_BUCKETS) {
+        return (double) index;
+    }
+    int power = (index - SUB_BUCKETS) / SUB_BUCKETS + SUB_BITS;
+    int sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    uint64_t width = 1ULL << (power - SUB_BITS);
+    return (double) ((SUB_BUCKETS + sub) * width) + (double) (width - 1) / 2.0;
+}
+
+uint64_t
+telemetry_get_local_time(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+uint64_t
+telemetry_get_nsecs(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+bool
+telemetry_enabled(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+void
+telemetry_record(telemetry_histogram_t histogram, uint64_t nsecs)
+{
+    if (!telemetry_enabled()) {
+        return;
+    }
+    assert(histogram < TELEMETRY_HISTOGRAMS);
+    histogram_t *h = &histograms[histogram];
+    uint64_t usecs = nsecs / 1000;
+    atomic_fetch_add_explicit(&h->counts[bucket_index(usecs)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total_usecs, usecs, memory_order_relaxed);
+    unsigned long long max = atomic_load_explicit(&h->max_usecs, memory_order_relaxed);
+    while (usecs > max && !atomic_compare_exchange_weak_explicit(&h->max_usecs, &max, usecs,
+                                                                 memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void
+telemetry_record_since(telemetry_histogram_t histogram, uint64_t local_time)
+{
+    if (!telemetry_enabled() || !local_time) {
+        return;
+    }
+    uint64_t now = telemetry_get_local_time();
+    telemetry_record(histogram, (now > local_time ? now - local_time : 0));
+}
+
+/* takes the counts accumulated since the last report, and resets them */
+static void
+telemetry_report(void)
+{
+    unsigned long long counts[BUCKETS];
+    time_t now = time(NULL);
+    for (int i = 0; i < TELEMETRY_HISTOGRAMS; i++) {
+        histogram_t *h = &histograms[i];
+        unsigned long long count = 0;
+        for (int j = 0; j < BUCKETS; j++) {
+            counts[j] = atomic_exchange_explicit(&h->counts[j], 0, memory_order_relaxed);
+            count += counts[j];
+        }
+        atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+        unsigned long long total = atomic_exchange_explicit(&h->total_usecs, 0, memory_order_relaxed);
+        unsigned long long max = atomic_exchange_explicit(&h->max_usecs, 0, memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        const double percentiles[4] = { 0.50, 0.90, 0.99, 0.999 };
+        double values[4];
+        unsigned long long seen = 0;
+        int p = 0;
+        for (int j = 0; j < BUCKETS && p < 4; j++) {
+            seen += counts[j];
+            while (p < 4 && seen >= (unsigned long long) (percentiles[p] * count + 0.5)) {
+                values[p++] = bucket_value(j) / 1000.0;
+            }
+        }
+        while (p < 4) {
+            values[p++] = (double) max / 1000.0;
+        }
+        double mean = (double) total / (1000.0 * count);
+        logger_log(telemetry_logger, LOGGER_INFO, "telemetry %-13s n=%-6llu mean %8.3f  p50 %8.3f  p90 %8.3f  p99 %8.3f"
+                   "  p99.9 %8.3f  max %8.3f ms", histogram_names[i], count, mean, values[0], values[1], values[2],
+                   values[3], (double) max / 1000.0);
+        if (telemetry_file) {
+            fprintf(telemetry_file, "%lld,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", (long long) now,
+                    histogram_names[i], count, mean, values[0], values[1], values[2], values[3], (double) max / 1000.0);
+        }
+    }
+    if (telemetry_file) {
+        fflush(telemetry_file);
+    }
+}
+
+static THREAD_RETVAL
+telemetry_thread_func(void *arg)
+{
+    MUTEX_LOCK(telemetry_mutex);
+    while (telemetry_running) {
+        struct timespec wait_time;
+        clock_gettime(CLOCK_REALTIME, &wait_time);
+        wait_time.tv_sec += telemetry_interval;
+        pthread_cond_timedwait(&telemetry_cond, &telemetry_mutex, &wait_time);
+        telemetry_report();   /* under telemetry_mutex, serialized with telemetry_flush() */
+    }
+    MUTEX_UNLOCK(telemetry_mutex);
+    return 0;
+}
+
+int
+telemetry_start(logger_t *logger, int interval_secs, const char *filename)
+{
+    assert(logger && interval_secs > 0);
+    if (telemetry_enabled()) {
+        return 0;
+    }
+    telemetry_logger = logger;
+    telemetry_interval = interval_secs;
+    if (filename) {
+        telemetry_file = fopen(filename, "a");
+        if (!telemetry_file) {
+            logger_log(logger, LOGGER_ERR, "telemetry: could not open file %s for writing", filename);
+            return -1;
+        }
+        if (ftell(telemetry_file) == 0) {
+            fprintf(telemetry_file, "time,histogram,count,mean_ms,p50_ms,p90_ms,p99_ms,p999_ms,max_ms\n");
+        }
+    }
+    telemetry_running = 1;
+    atomic_store(&enabled, true);
+    THREAD_CREATE(telemetry_thread, telemetry_thread_func, NULL);
+    return 0;
+}
+
+void
+telemetry_flush(void)
+{
+    if (!telemetry_enabled()) {
+        return;
+    }
+    MUTEX_LOCK(telemetry_mutex);
+    telemetry_report();
+    MUTEX_UNLOCK(telemetry_mutex);
+}
+
+void
+telemetry_stop(void)
+{
+    if (!telemetry_enabled()) {
+        return;
+    }
+    MUTEX_LOCK(telemetry_mutex);
+    telemetry_running = 0;
+    COND_SIGNAL(telemetry_cond);
+    MUTEX_UNLOCK(telemetry_mutex);
+    THREAD_JOIN(telemetry_thread);   /* makes a final report */
+    atomic_store(&enabled, false);
+    if (telemetry_file) {
+        fclose(telemetry_file);
+        telemetry_file = NULL;
+    }
+}
@@ -0,0 +1,71 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Process-wide latency telemetry: a fixed set of log-linear ("HDR-style") histograms that
+ * the streaming threads (and the renderers) record into without locks.  When started, a
+ * reporter thread periodically logs a summary of each histogram for the last interval,
+ * and optionally appends it to a CSV file.  Recording is a no-op unless started.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#define TELEMETRY_DEFAULT_INTERVAL 10   /* seconds between reports */
+
+typedef enum telemetry_histogram_e {
+    TELEMETRY_VIDEO_NETWORK,   /* client timestamp (as local time) to mirror frame fully received */
+    TELEMETRY_VIDEO_JITTER,    /* mirror frame inter-arrival jitter */
+    TELEMETRY_VIDEO_DECRYPT,   /* mirror frame decryption time */
+    TELEMETRY_VIDEO_NAL,       /* NAL unit rewriting and indexing time */
+    TELEMETRY_VIDEO_PUSH,      /* client timestamp to push into the GStreamer appsrc */
+    TELEMETRY_VIDEO_RENDER,    /* client timestamp to arrival at the videosink */
+    TELEMETRY_AUDIO_JITTER,    /* audio packet inter-arrival jitter */
+    TELEMETRY_AUDIO_DECRYPT,   /* audio packet decryption and buffering time */
+    TELEMETRY_AUDIO_PROCESS,   /* audio_process callback (decode and push) time */
+    TELEMETRY_AUDIO_LEAD,      /* time before its presentation time that audio is delivered */
+    TELEMETRY_PAIR_VERIFY,     /* pair-verify handshake, first request to verified signature */
+    TELEMETRY_PAIR_SETUP,      /* pair-setup-pin, server processing time of its three steps */
+    TELEMETRY_HISTOGRAMS
+} telemetry_histogram_t;
+
+int telemetry_start(logger_t *logger, int interval_secs, const char *filename);
+bool telemetry_enabled(void);
+void telemetry_record(telemetry_histogram_t histogram, uint64_t nsecs);
+
+/* records now - local_time, where local_time is in the (CLOCK_REALTIME) local clock used by raop_ntp */
+void telemetry_record_since(telemetry_histogram_t histogram, uint64_t local_time);
+uint64_t telemetry_get_local_time(void);
+
+/* monotonic clock, for timing processing stages */
+uint64_t telemetry_get_nsecs(void);
+
+/* reports (and resets) the counts accumulated since the last report, without waiting for the interval */
+void telemetry_flush(void);
+void telemetry_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TELEMETRY_H
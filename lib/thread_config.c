@@ -0,0 +1,211 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE    /* for pthread_setname_np */
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#endif
+
+#include "thread_config.h"
+#include "utils.h"
+#include "trace.h"
+
+#define THREAD_POLICY_DEFAULT 0
+#define THREAD_POLICY_FIFO    1
+#define THREAD_POLICY_RR      2
+
+typedef struct thread_config_s {
+    int policy;
+    int priority;
+    bool set_nice;
+    int nice;
+    uint64_t cpus;
+    char cpu_list[64];    /* as given, for the log */
+} thread_config_t;
+
+/* set while parsing the options, before any streaming thread starts, then read-only */
+static thread_config_t thread_configs[THREAD_CLASSES];
+static const char *thread_class_names[THREAD_CLASSES] = { "httpd", "ntp", "audio", "video" };
+
+const char *
+thread_config_class_name(thread_class_t thread_class) {
+    return thread_class_names[thread_class];
+}
+
+static int
+thread_config_parse_int(const char *str, int min, int max, int *value) {
+    char *end;
+    long val = strtol(str, &end, 10);
+    if (end == str || *end || val < min || val > max) {
+        return -1;
+    }
+    *value = (int) val;
+    return 0;
+}
+
+int
+thread_config_parse(const char *spec) {
+    char buf[128];
+    char *ptr = buf;
+    char *token;
+    int first, last;
+    thread_config_t config;
+    bool set_policy = false, set_cpus = false;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, spec);
+    token = utils_strsep(&ptr, ":");
+    if (!strcmp(token, "all")) {
+        first = 0;
+        last = THREAD_CLASSES - 1;
+    } else {
+        for (first = 0; first < THREAD_CLASSES; first++) {
+            if (!strcmp(token, thread_class_names[first])) {
+                break;
+            }
+        }
+        if (first == THREAD_CLASSES) {
+            return -1;
+        }
+        last = first;
+    }
+    if (!ptr) {
+        return -1;    /* no settings */
+    }
+
+    memset(&config, 0, sizeof(config));
+    while ((token = utils_strsep(&ptr, ":")) != NULL) {
+        char *value = strchr(token, '=');
+        if (!value) {
+            return -1;
+        }
+        *value++ = '\0';
+        if (!strcmp(token, "fifo") || !strcmp(token, "rr")) {
+            /* POSIX guarantees at least 32 realtime priorities; Linux has 1 - 99 */
+            if (thread_config_parse_int(value, 1, 99, &config.priority)) {
+                return -1;
+            }
+            config.policy = (token[0] == 'f' ? THREAD_POLICY_FIFO : THREAD_POLICY_RR);
+            set_policy = true;
+        } else if (!strcmp(token, "nice")) {
+            if (thread_config_parse_int(value, -20, 19, &config.nice)) {
+                return -1;
+            }
+            config.set_nice = true;
+        } else if (!strcmp(token, "cpus")) {
+            if (strlen(value) >= sizeof(config.cpu_list) || utils_parse_cpu_list(value, &config.cpus)) {
+                return -1;
+            }
+            strcpy(config.cpu_list, value);
+            set_cpus = true;
+        } else {
+            return -1;
+        }
+    }
+
+    /* settings not given keep any earlier values for the class */
+    for (int i = first; i <= last; i++) {
+        thread_config_t *target = &thread_configs[i];
+        if (set_policy) {
+            target->policy = config.policy;
+            target->priority = config.priority;
+        }
+        if (config.set_nice) {
+            target->set_nice = true;
+            target->nice = config.nice;
+        }
+        if (set_cpus) {
+            target->cpus = config.cpus;
+            strcpy(target->cpu_list, config.cpu_list);
+        }
+    }
+    return 0;
+}
+
+/* the nice value of the calling thread only (Linux threads have their own nice values) */
+static int
+thread_config_set_nice(int nice) {
+#if defined(__linux__)
+    return setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice);
+#else
+    return -1;
+#endif
+}
+
+void
+thread_config_apply(thread_class_t thread_class, const char *name, logger_t *logger) {
+    thread_config_t *config = &thread_configs[thread_class];
+    char applied[256];
+    int len = 0;
+    bool use_nice = config->set_nice;
+
+    /* thread names are limited to 15 characters on Linux */
+#if defined(__linux__)
+    pthread_setname_np(pthread_self(), name);
+#elif defined(__APPLE__)
+    pthread_setname_np(name);
+#endif
+    trace_set_thread_name(name);
+
+    applied[0] = '\0';
+    if (config->cpus) {
+        if (utils_set_thread_affinity(config->cpus) == 0) {
+            len += snprintf(applied + len, sizeof(applied) - len, " CPUs %s;", config->cpu_list);
+        } else {
+            len += snprintf(applied + len, sizeof(applied) - len, " CPU affinity %s failed;", config->cpu_list);
+        }
+    }
+    if (config->policy != THREAD_POLICY_DEFAULT) {
+        const char *policy_name = (config->policy == THREAD_POLICY_FIFO ? "SCHED_FIFO" : "SCHED_RR");
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        int ret = pthread_setschedparam(pthread_self(), (config->policy == THREAD_POLICY_FIFO ? SCHED_FIFO : SCHED_RR),
+                                        &param);
+        if (ret == 0) {
+            len += snprintf(applied + len, sizeof(applied) - len, " %s priority %d;", policy_name, config->priority);
+            use_nice = false;
+        } else {
+            len += snprintf(applied + len, sizeof(applied) - len, " %s priority %d failed (%s);", policy_name,
+                            config->priority, strerror(ret));
+        }
+    }
+    if (use_nice) {
+        if (thread_config_set_nice(config->nice) == 0) {
+            len += snprintf(applied + len, sizeof(applied) - len, " nice %d;", config->nice);
+        } else {
+            len += snprintf(applied + len, sizeof(applied) - len, " nice %d failed;", config->nice);
+        }
+    }
+
+    if (len) {
+        applied[len - 1] = '\0';   /* remove the final ';' */
+        logger_log(logger, LOGGER_INFO, "%s thread \"%s\":%s", thread_class_names[thread_class], name, applied);
+    } else {
+        logger_log(logger, LOGGER_DEBUG, "%s thread \"%s\" started with default scheduling",
+                   thread_class_names[thread_class], name);
+    }
+}
@@ -0,0 +1,55 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Per-class scheduling settings for the streaming threads: a thread name, CPU affinity,
+ * a realtime policy (SCHED_FIFO or SCHED_RR) and priority, and/or a nice value.  Each
+ * thread applies the settings of its class to itself when it starts, and logs what was
+ * actually applied (a realtime policy that is not permitted falls back to the nice value).
+ */
+
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum thread_class_e {
+    THREAD_CLASS_HTTPD,     /* RTSP/HTTP server */
+    THREAD_CLASS_NTP,       /* NTP or PTP timing */
+    THREAD_CLASS_AUDIO,     /* audio receive (RTP, or buffered audio) */
+    THREAD_CLASS_VIDEO,     /* mirror video receive and delivery */
+    THREAD_CLASSES
+} thread_class_t;
+
+/* parses "class:setting[:setting...]" with class httpd, ntp, audio, video (or all), and       *
+ * settings fifo=<prio>, rr=<prio>, nice=<n>, cpus=<list> (e.g.  "audio:fifo=50:cpus=2-3");    *
+ * returns 0, or -1 if invalid                                                                 */
+int thread_config_parse(const char *spec);
+const char *thread_config_class_name(thread_class_t thread_class);
+
+/* called by a new thread: applies the settings of thread_class, and sets the thread name */
+void thread_config_apply(thread_class_t thread_class, const char *name, logger_t *logger);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //THREAD_CONFIG_H
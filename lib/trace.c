@@ -0,0 +1,294 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE    /* for pthread_getname_np */
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "telemetry.h"
+#include "threads.h"
+
+#define TRACE_NAME_SIZE 32
+#define TRACE_INSTANT UINT64_MAX   /* duration of an instant */
+
+typedef struct trace_event_s {
+    uint64_t start;               /* nsecs, monotonic clock */
+    uint64_t duration;
+    const char *category;
+    int64_t arg;
+    char name[TRACE_NAME_SIZE];
+} trace_event_t;
+
+typedef struct trace_ring_s {
+    trace_event_t *events;
+    atomic_ullong head;           /* events recorded: the newest is at (head - 1) % TRACE_RING_EVENTS */
+    atomic_bool exited;           /* its thread has exited, so the ring can be reused */
+    int tid;
+    char name[16];
+    struct trace_ring_s *next;
+} trace_ring_t;
+
+static atomic_bool enabled = false;
+static logger_t *trace_logger = NULL;
+static uint64_t trace_start_time = 0;
+static trace_ring_t *rings = NULL;
+static int n_rings = 0;
+static int next_tid = 1;
+static pthread_key_t ring_key;
+static mutex_handle_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* pthread key destructor, at thread exit */
+static void
+trace_thread_exit(void *data)
+{
+    trace_ring_t *ring = (trace_ring_t *) data;
+    atomic_store(&ring->exited, true);
+}
+
+static trace_ring_t *
+trace_new_ring(void)
+{
+    trace_ring_t *ring = NULL;
+    MUTEX_LOCK(trace_mutex);
+    if (n_rings < TRACE_MAX_THREADS) {
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (ring) {
+            ring->events = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t));
+            if (!ring->events) {
+                free(ring);
+                ring = NULL;
+            }
+        }
+        if (ring) {
+            ring->next = rings;
+            rings = ring;
+            n_rings++;
+        }
+    } else {
+        for (trace_ring_t *r = rings; r; r = r->next) {
+            if (atomic_load(&r->exited)) {
+                ring = r;
+                break;
+            }
+        }
+    }
+    if (ring) {
+        atomic_store(&ring->head, 0);
+        atomic_store(&ring->exited, false);
+        ring->tid = next_tid++;
+        snprintf(ring->name, sizeof(ring->name), "thread-%d", ring->tid);
+#if defined(__linux__)
+        pthread_getname_np(pthread_self(), ring->name, sizeof(ring->name));
+#endif
+        pthread_setspecific(ring_key, ring);
+    }
+    MUTEX_UNLOCK(trace_mutex);
+    return ring;
+}
+
+static void
+trace_record(const char *category, const char *name, uint64_t start, uint64_t duration, int64_t arg)
+{
+    trace_ring_t *ring = (trace_ring_t *) pthread_getspecific(ring_key);
+    if (!ring && !(ring = trace_new_ring())) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event_t *event = &ring->events[head % TRACE_RING_EVENTS];
+    event->start = start;
+    event->duration = duration;
+    event->category = category;
+    event->arg = arg;
+    size_t len = strlen(name);
+    if (len >= TRACE_NAME_SIZE) {
+        len = TRACE_NAME_SIZE - 1;
+    }
+    memcpy(event->name, name, len);
+    event->name[len] = '\0';
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int
+trace_start(logger_t *logger)
+{
+    if (trace_enabled()) {
+        return 0;
+    }
+    if (pthread_key_create(&ring_key, trace_thread_exit)) {
+        return -1;
+    }
+    trace_logger = logger;
+    trace_start_time = telemetry_get_nsecs();
+    atomic_store(&enabled, true);
+    return 0;
+}
+
+bool
+trace_enabled(void)
+{
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+uint64_t
+trace_begin(void)
+{
+    return (trace_enabled() ? telemetry_get_nsecs() : 0);
+}
+
+void
+trace_span(const char *category, const char *name, uint64_t start, int64_t arg)
+{
+    if (!start || !trace_enabled()) {
+        return;
+    }
+    uint64_t now = telemetry_get_nsecs();
+    trace_record(category, name, start, (now > start ? now - start : 0), arg);
+}
+
+void
+trace_span_range(const char *category, const char *name, uint64_t start, uint64_t end, int64_t arg)
+{
+    if (!start || !trace_enabled()) {
+        return;
+    }
+    trace_record(category, name, start, (end > start ? end - start : 0), arg);
+}
+
+void
+trace_instant(const char *category, const char *name, int64_t arg)
+{
+    if (!trace_enabled()) {
+        return;
+    }
+    trace_record(category, name, telemetry_get_nsecs(), TRACE_INSTANT, arg);
+}
+
+void
+trace_set_thread_name(const char *name)
+{
+    if (!trace_enabled()) {
+        return;
+    }
+    trace_ring_t *ring = (trace_ring_t *) pthread_getspecific(ring_key);
+    if (!ring && !(ring = trace_new_ring())) {
+        return;
+    }
+    MUTEX_LOCK(trace_mutex);
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    MUTEX_UNLOCK(trace_mutex);
+}
+
+/* names are only copied from string constants, but keep the JSON valid anyway */
+static void
+trace_write_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++) {
+        fputc((*str == '"' || *str == '\\' || (unsigned char) *str < 0x20) ? '_' : *str, file);
+    }
+    fputc('"', file);
+}
+
+static void
+trace_write_time(FILE *file, const char *key, uint64_t nsecs)
+{
+    fprintf(file, ",\"%s\":%llu.%03llu", key, (unsigned long long) (nsecs / 1000), (unsigned long long) (nsecs % 1000));
+}
+
+int
+trace_write(const char *filename)
+{
+    if (!trace_enabled()) {
+        return -1;
+    }
+    trace_event_t *copy = malloc(TRACE_RING_EVENTS * sizeof(trace_event_t));
+    FILE *file = fopen(filename, "w");
+    if (!copy || !file) {
+        logger_log(trace_logger, LOGGER_ERR, "could not write the trace to %s: %s", filename, strerror(errno));
+        free(copy);
+        if (file) {
+            fclose(file);
+        }
+        return -1;
+    }
+    int count = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"uxplay\"}}");
+    MUTEX_LOCK(trace_mutex);
+    for (trace_ring_t *ring = rings; ring; ring = ring->next) {
+        /* events are copied while their thread may record more: those it might have overwritten *
+         * during the copy (up to "last - TRACE_RING_EVENTS") are not written                     */
+        uint64_t first = atomic_load_explicit(&ring->head, memory_order_acquire);
+        memcpy(copy, ring->events, TRACE_RING_EVENTS * sizeof(trace_event_t));
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t last = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint64_t start = (last >= TRACE_RING_EVENTS ? last - TRACE_RING_EVENTS + 1 : 0);
+        fprintf(file, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":", ring->tid);
+        trace_write_string(file, ring->name);
+        fprintf(file, "}}");
+        for (uint64_t i = start; i < first; i++) {
+            trace_event_t *event = &copy[i % TRACE_RING_EVENTS];
+            uint64_t ts = (event->start > trace_start_time ? event->start - trace_start_time : 0);
+            fprintf(file, ",\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"cat\":", (event->duration == TRACE_INSTANT ? "i" : "X"),
+                    ring->tid);
+            trace_write_string(file, event->category);
+            fprintf(file, ",\"name\":");
+            trace_write_string(file, event->name);
+            trace_write_time(file, "ts", ts);
+            if (event->duration == TRACE_INSTANT) {
+                fprintf(file, ",\"s\":\"t\"");
+            } else {
+                trace_write_time(file, "dur", event->duration);
+            }
+            if (event->arg != TRACE_NO_ARG) {
+                fprintf(file, ",\"args\":{\"arg\":%lld}", (long long) event->arg);
+            }
+            fputc('}', file);
+            count++;
+        }
+    }
+    MUTEX_UNLOCK(trace_mutex);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    free(copy);
+    logger_log(trace_logger, LOGGER_INFO, "wrote %d trace events to %s", count, filename);
+    return count;
+}
+
+/* call when the traced threads have stopped */
+void
+trace_stop(void)
+{
+    if (!trace_enabled()) {
+        return;
+    }
+    atomic_store(&enabled, false);
+    MUTEX_LOCK(trace_mutex);
+    while (rings) {
+        trace_ring_t *ring = rings;
+        rings = ring->next;
+        free(ring->events);
+        free(ring);
+    }
+    n_rings = 0;
+    MUTEX_UNLOCK(trace_mutex);
+    pthread_key_delete(ring_key);
+}
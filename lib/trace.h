@@ -0,0 +1,63 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * Timeline tracing: threads record spans (a name, a start and a duration) and instants into
+ * their own ring buffers, which keep their newest TRACE_RING_EVENTS events, with no lock shared
+ * between threads.  trace_write saves all rings as a Chrome/Perfetto JSON trace, which can be
+ * opened in ui.perfetto.dev or chrome://tracing; threads are named as in thread_config_apply.
+ * Recording is a no-op (trace_begin returns 0) unless started.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "logger.h"
+
+#define TRACE_RING_EVENTS 16384    /* per thread */
+#define TRACE_MAX_THREADS 64       /* rings of exited threads are reused beyond this */
+#define TRACE_NO_ARG      (-1)
+
+int trace_start(logger_t *logger);
+bool trace_enabled(void);
+
+/* the span start time (monotonic nsecs) for trace_span, or 0 if not tracing */
+uint64_t trace_begin(void);
+
+/* "name" is copied (up to 31 characters), "category" must be a string constant; arg (if not  *
+ * TRACE_NO_ARG) is shown with the event, e.g. a sequence number, a size or a session id      */
+void trace_span(const char *category, const char *name, uint64_t start, int64_t arg);
+/* a span that has already ended, with times from telemetry_get_nsecs */
+void trace_span_range(const char *category, const char *name, uint64_t start, uint64_t end, int64_t arg);
+void trace_instant(const char *category, const char *name, int64_t arg);
+
+/* names the calling thread in the trace (the first 15 characters) */
+void trace_set_thread_name(const char *name);
+
+/* writes the events currently in the rings (recording continues); returns their number, or -1 */
+int trace_write(const char *filename);
+void trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //TRACE_H
@@ -0,0 +1,256 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring_recv.h"
+
+#ifdef HAVE_IO_URING
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#define URING_RECV_ENTRIES 4
+#define URING_RECV_USER_DATA 1
+
+struct uring_recv_s {
+    int ring_fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uint64_t syscalls;
+};
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* a partial MSG_WAITALL receive is only reported (not lost) on cancellation since Linux 6.0, *
+ * which is also the first kernel with IORING_OP_SEND_ZC: use that as the version test       */
+static int
+uring_recv_kernel_ok(int ring_fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    int ok = 0;
+    if (!probe) {
+        return 0;
+    }
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+        probe->last_op >= IORING_OP_SEND_ZC) {
+        ok = (probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_LINK_TIMEOUT].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+uring_recv_t *
+uring_recv_init(void)
+{
+    struct io_uring_params params;
+    uring_recv_t *uring_recv = calloc(1, sizeof(uring_recv_t));
+    if (!uring_recv) {
+        return NULL;
+    }
+    memset(&params, 0, sizeof(params));
+    uring_recv->ring_fd = io_uring_setup(URING_RECV_ENTRIES, &params);
+    if (uring_recv->ring_fd < 0) {
+        free(uring_recv);
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !uring_recv_kernel_ok(uring_recv->ring_fd)) {
+        close(uring_recv->ring_fd);
+        free(uring_recv);
+        return NULL;
+    }
+
+    /* with IORING_FEAT_SINGLE_MMAP, the SQ and CQ rings share one mapping */
+    uring_recv->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring_recv->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (uring_recv->cq_ring_size > uring_recv->sq_ring_size) {
+        uring_recv->sq_ring_size = uring_recv->cq_ring_size;
+    }
+    uring_recv->sq_ring = mmap(NULL, uring_recv->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               uring_recv->ring_fd, IORING_OFF_SQ_RING);
+    if (uring_recv->sq_ring == MAP_FAILED) {
+        close(uring_recv->ring_fd);
+        free(uring_recv);
+        return NULL;
+    }
+    uring_recv->cq_ring = uring_recv->sq_ring;
+    uring_recv->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring_recv->sqes = mmap(NULL, uring_recv->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            uring_recv->ring_fd, IORING_OFF_SQES);
+    if (uring_recv->sqes == MAP_FAILED) {
+        munmap(uring_recv->sq_ring, uring_recv->sq_ring_size);
+        close(uring_recv->ring_fd);
+        free(uring_recv);
+        return NULL;
+    }
+
+    char *sq = uring_recv->sq_ring;
+    char *cq = uring_recv->cq_ring;
+    uring_recv->sq_head = (unsigned *) (sq + params.sq_off.head);
+    uring_recv->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    uring_recv->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    uring_recv->sq_array = (unsigned *) (sq + params.sq_off.array);
+    uring_recv->cq_head = (unsigned *) (cq + params.cq_off.head);
+    uring_recv->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    uring_recv->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    uring_recv->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return uring_recv;
+}
+
+static struct io_uring_sqe *
+uring_recv_get_sqe(uring_recv_t *uring_recv, unsigned *tail)
+{
+    unsigned index = *tail & *uring_recv->sq_mask;
+    struct io_uring_sqe *sqe = &uring_recv->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring_recv->sq_array[index] = index;
+    (*tail)++;
+    return sqe;
+}
+
+int
+uring_recv(uring_recv_t *uring_recv, int fd, void *buf, int len, int timeout_ms)
+{
+    struct __kernel_timespec timeout;
+    int received = -ECANCELED;
+    int completions = 0;
+
+    /* the recv, and a timeout that cancels it */
+    unsigned tail = *uring_recv->sq_tail;
+    struct io_uring_sqe *sqe = uring_recv_get_sqe(uring_recv, &tail);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->msg_flags = MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = URING_RECV_USER_DATA;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+    sqe = uring_recv_get_sqe(uring_recv, &tail);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) &timeout;
+    sqe->len = 1;
+    sqe->user_data = 0;
+    __atomic_store_n(uring_recv->sq_tail, tail, __ATOMIC_RELEASE);
+
+    /* both requests always complete: one of them is cancelled by the other */
+    unsigned to_submit = 2;
+    while (completions < 2) {
+        int ret = io_uring_enter(uring_recv->ring_fd, to_submit, 2 - completions, IORING_ENTER_GETEVENTS);
+        uring_recv->syscalls++;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        to_submit = (ret > (int) to_submit ? 0 : to_submit - ret);
+        unsigned head = *uring_recv->cq_head;
+        while (head != __atomic_load_n(uring_recv->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &uring_recv->cqes[head & *uring_recv->cq_mask];
+            if (cqe->user_data == URING_RECV_USER_DATA) {
+                received = cqe->res;
+            }
+            completions++;
+            head++;
+        }
+        __atomic_store_n(uring_recv->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (received >= 0) {
+        return received;
+    }
+    errno = (received == -ECANCELED ? EAGAIN : -received);
+    return -1;
+}
+
+uint64_t
+uring_recv_get_syscalls(uring_recv_t *uring_recv)
+{
+    return uring_recv->syscalls;
+}
+
+void
+uring_recv_destroy(uring_recv_t *uring_recv)
+{
+    if (uring_recv) {
+        munmap(uring_recv->sqes, uring_recv->sqes_size);
+        munmap(uring_recv->sq_ring, uring_recv->sq_ring_size);
+        close(uring_recv->ring_fd);
+        free(uring_recv);
+    }
+}
+
+#else
+
+uring_recv_t *
+uring_recv_init(void)
+{
+    return NULL;
+}
+
+int
+uring_recv(uring_recv_t *uring_recv, int fd, void *buf, int len, int timeout_ms)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+uint64_t
+uring_recv_get_syscalls(uring_recv_t *uring_recv)
+{
+    return 0;
+}
+
+void
+uring_recv_destroy(uring_recv_t *uring_recv)
+{
+}
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ *=================================================================
+ * agent 2026
+ */
+
+/*
+ * io_uring receive path for the mirror TCP stream (Linux): each receive is one
+ * MSG_WAITALL recv linked to a timeout, so a 128-byte header or a whole video
+ * payload normally arrives with a single io_uring_enter(), instead of a select()
+ * wakeup followed by a recv() loop.
+ */
+
+#ifndef URING_RECV_H
+#define URING_RECV_H
+
+#include <stdint.h>
+
+typedef struct uring_recv_s uring_recv_t;
+
+/* returns NULL if io_uring is unavailable (not Linux, kernel < 6.0, or disabled) */
+uring_recv_t *uring_recv_init(void);
+
+/* like recv(): waits up to timeout_ms for len bytes; returns the number received (fewer than len *
+ * only after a timeout), 0 at end of stream, or -1 with errno set (EAGAIN: timeout, nothing read) */
+int uring_recv(uring_recv_t *uring_recv, int fd, void *buf, int len, int timeout_ms);
+
+/* number of io_uring_enter() system calls made */
+uint64_t uring_recv_get_syscalls(uring_recv_t *uring_recv);
+void uring_recv_destroy(uring_recv_t *uring_recv);
+
+#endif //URING_RECV_H
@@ -15,12 +15,20 @@
  * modified by fduncanh 2021-2022
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE    /* for pthread_setaffinity_np */
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
 #define SECOND_IN_NSECS 1000000000UL
 
 char *
@@ -282,3 +290,77 @@ int utils_ipaddress_to_string(int addresslen, const unsigned char *address, unsi
     }
     return ret;
 }
+
+/* parses a CPU list such as "0-3,6" into a bit mask of CPUs 0-63; returns 0, or -1 if invalid */
+int utils_parse_cpu_list(const char *str, uint64_t *mask) {
+    const char *ptr = str;
+    *mask = 0;
+    while (*ptr) {
+        char *end;
+        long first, last;
+        if (!isdigit((unsigned char) *ptr)) {
+            return -1;
+        }
+        first = last = strtol(ptr, &end, 10);
+        ptr = end;
+        if (*ptr == '-') {
+            ptr++;
+            if (!isdigit((unsigned char) *ptr)) {
+                return -1;
+            }
+            last = strtol(ptr, &end, 10);
+            ptr = end;
+        }
+        if (first > last || last >= 64) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            *mask |= ((uint64_t) 1) << cpu;
+        }
+        if (*ptr == ',') {
+            ptr++;
+            if (!*ptr) {
+                return -1;
+            }
+        } else if (*ptr) {
+            return -1;
+        }
+    }
+    return (*mask ? 0 : -1);
+}
+
+/* the CPU affinity of the calling thread (CPUs 0-63), which is inherited by threads it creates; *
+ * returns 0, or -1 if this fails or is not supported on this platform                           */
+int utils_get_thread_affinity(uint64_t *mask) {
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) {
+        return -1;
+    }
+    *mask = 0;
+    for (int cpu = 0; cpu < 64; cpu++) {
+        if (CPU_ISSET(cpu, &cpuset)) {
+            *mask |= ((uint64_t) 1) << cpu;
+        }
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int utils_set_thread_affinity(uint64_t mask) {
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu = 0; cpu < 64; cpu++) {
+        if (mask & (((uint64_t) 1) << cpu)) {
+            CPU_SET(cpu, &cpuset);
+        }
+    }
+    return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) ? -1 : 0);
+#else
+    return -1;
+#endif
+}
@@ -33,12 +33,17 @@ extern "C" {
 #include "../lib/logger.h"
 
 bool gstreamer_init();
-void audio_renderer_init(logger_t *logger, const char* audiosink, const bool *audio_sync, const bool *video_sync);
+void audio_renderer_init(logger_t *logger, const char* audiosink, const bool *audio_sync, const bool *video_sync,
+                         const bool *shared);
+void audio_renderer_force_resample(bool force);
+void audio_renderer_set_batch(unsigned int frames);
 void audio_renderer_start(unsigned char* compression_type);
 void audio_renderer_stop();
 void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time);
 void audio_renderer_set_volume(double volume);
 void audio_renderer_flush();
+/* latency of the audio pipeline in use (including the audiosink's device buffering), false if not known */
+bool audio_renderer_get_latency(uint64_t *nsecs);
 void audio_renderer_destroy();
 
 #ifdef __cplusplus
@@ -21,9 +21,15 @@
  */
 
 #include <math.h>
+#include <string.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include "audio_renderer.h"
+#include "../lib/metrics.h"
+#include "../lib/trace.h"
+#ifdef HAVE_NATIVE_AUDIO
+#include "audio_renderer_native.h"
+#endif
 #define SECOND_IN_NSECS 1000000000UL
 
 #define NFORMATS 2     /* set to 4 to enable AAC_LD and PCM:  allowed, but  never seen in real-world use */
@@ -46,10 +52,42 @@ typedef struct audio_renderer_s {
     GstElement *pipeline;
     GstElement *volume;
     unsigned char ct;
+    const char *caps;
+    guint bus_watch;
 } audio_renderer_t ;
+
+/* -ashared: all formats share one pipeline, whose decoder is replaced when the format changes */
+static gboolean shared_pipeline = FALSE;
+static unsigned char shared_ct = 0;    /* format the shared pipeline's decoder is set up for */
 static audio_renderer_t *renderer_type[NFORMATS];
 static audio_renderer_t *renderer = NULL;
 
+/* pipeline profile: the level element is only included when metrics are exported, and *
+ * audioresample only when the audiosink may not accept 44.1 kHz audio (or -resample)    */
+static gboolean level_metering = FALSE;
+static gboolean resample = TRUE;
+static gboolean force_resample = FALSE;
+
+/* -as native[:device]: GStreamer is bypassed, see audio_renderer_native.c */
+static gboolean native_audio = FALSE;
+
+/* audio frames are copied into buffers from a pool sized for the largest frame of the current format: *
+ * ALAC 352 samples (uncompressed escape: 16-bit stereo, plus the frame header), AAC 6144 bits/channel. */
+#define AUDIO_POOL_MIN_BUFFERS 16
+#define ALAC_MAX_FRAME_SIZE (352 * 4 + 16)
+#define AAC_MAX_FRAME_SIZE (2 * 768)
+static GstBufferPool *buffer_pool = NULL;
+static guint buffer_pool_size = 0;
+
+/* -abatch n: while the audio to be rendered is at least AUDIO_BATCH_MIN_LEAD ahead of its play time       *
+ * (e.g., buffered AirPlay 2 audio), frames are pushed n at a time in a GstBufferList, taking the appsrc *
+ * lock once per batch; frames closer to their play time are pushed (with any pending batch) at once.   */
+#define AUDIO_BATCH_MIN_LEAD (500 * 1000000LL)
+#define AUDIO_BATCH_MAX 16
+static guint batch_frames = 0;
+static GstBufferList *batch = NULL;
+static GMutex batch_mutex;
+
 /* GStreamer Caps strings for Airplay-defined audio compression types (ct) */
 
 /* ct = 1; linear PCM (uncompressed): 44100/16/2, S16LE */
@@ -120,22 +158,282 @@ static gboolean check_plugin_feature (const gchar *needed_feature)
     return ret;
 }
 
+static void set_format(int i, GstCaps **caps) {
+    switch (i) {
+    case 0:
+        renderer_type[i]->caps = aac_eld_caps;
+        renderer_type[i]->ct = 8;
+        format[i] = "AAC-ELD 44100/2";
+        break;
+    case 1:
+        renderer_type[i]->caps = alac_caps;
+        renderer_type[i]->ct = 2;
+        format[i] = "ALAC 44100/16/2";
+        break;
+    case 2:
+        renderer_type[i]->caps = aac_lc_caps;
+        renderer_type[i]->ct = 4;
+        format[i] = "AAC-LC 44100/2";
+        break;
+    case 3:
+        renderer_type[i]->caps = lpcm_caps;
+        renderer_type[i]->ct = 1;
+        format[i] = "PCM 44100/16/2 S16LE";
+        break;
+    default:
+        break;
+    }
+    if (caps) {
+        *caps = gst_caps_from_string(renderer_type[i]->caps);
+    }
+}
+
+/* autoaudiosink picks its sink at run time, and the Windows sinks play at the device mix rate (48 kHz) */
+static const char *resampling_sinks[] = { "autoaudiosink", "wasapisink", "wasapi2sink", "directsoundsink", NULL };
+
+/* the sink can be linked without audioresample if its sink pad template accepts 44.1 kHz stereo */
+static gboolean audiosink_needs_resample(const char *audiosink) {
+    gboolean needs_resample = TRUE;
+    gchar *name = g_strndup(audiosink, strcspn(audiosink, " \t"));
+    for (int i = 0; resampling_sinks[i]; i++) {
+        if (!strcmp(name, resampling_sinks[i])) {
+            g_free(name);
+            return TRUE;
+        }
+    }
+    GstElementFactory *factory = gst_element_factory_find(name);
+    g_free(name);
+    if (!factory) {
+        return TRUE;
+    }
+    GstCaps *stream_caps = gst_caps_from_string("audio/x-raw, rate=(int)44100, channels=(int)2");
+    for (const GList *l = gst_element_factory_get_static_pad_templates(factory); l; l = l->next) {
+        GstStaticPadTemplate *templ = (GstStaticPadTemplate *) l->data;
+        if (templ->direction != GST_PAD_SINK) {
+            continue;
+        }
+        GstCaps *sink_caps = gst_static_pad_template_get_caps(templ);
+        needs_resample = !gst_caps_can_intersect(sink_caps, stream_caps);
+        gst_caps_unref(sink_caps);
+        break;
+    }
+    gst_caps_unref(stream_caps);
+    gst_object_unref(factory);
+    return needs_resample;
+}
+
+static void append_output_stages(GString *launch) {
+    if (resample) {
+        g_string_append (launch, "audioresample ! ");
+    }
+    g_string_append (launch, "volume name=volume ! ");
+    if (level_metering) {
+        g_string_append (launch, "level name=level interval=1000000000 ! ");
+    }
+}
+
+/* latency (usecs, -1 if not yet known) of the audio pipeline in use, from the sink's clock to the speaker, *
+ * as reported by a latency query when the pipeline starts, and again whenever its latency changes (e.g.,   *
+ * when new caps make the audiosink reconfigure its ringbuffer)                                             */
+static gint pipeline_latency = -1;
+
+static void audio_renderer_query_latency(GstElement *pipeline) {
+    GstQuery *query = gst_query_new_latency();
+    if (gst_element_query(pipeline, query)) {
+        gboolean live;
+        GstClockTime min, max;
+        gst_query_parse_latency(query, &live, &min, &max);
+        if (GST_CLOCK_TIME_IS_VALID(min)) {
+            gint usecs = (gint) (min / GST_USECOND);
+            if (g_atomic_int_get(&pipeline_latency) != usecs) {
+                logger_log(logger, LOGGER_DEBUG, "audio pipeline latency %.1f ms", (double) usecs / 1000.0);
+            }
+            g_atomic_int_set(&pipeline_latency, usecs);
+        }
+    }
+    gst_query_unref(query);
+}
+
+bool audio_renderer_get_latency(uint64_t *nsecs) {
+    gint usecs = g_atomic_int_get(&pipeline_latency);
+    if (native_audio || usecs < 0) {
+        return false;
+    }
+    *nsecs = (uint64_t) usecs * 1000;
+    return true;
+}
+
+/* level messages (one per second) update the audio_level_db metric */
+static void audio_level_message(GstMessage *message) {
+    const GstStructure *structure = gst_message_get_structure(message);
+    if (!structure || !gst_structure_has_name(structure, "level")) {
+        return;
+    }
+    const GValue *rms = gst_structure_get_value(structure, "rms");
+    GValueArray *channels = (rms ? (GValueArray *) g_value_get_boxed(rms) : NULL);
+    if (channels && channels->n_values) {
+        double loudest = g_value_get_double(&channels->values[0]);
+        for (guint i = 1; i < channels->n_values; i++) {
+            double db = g_value_get_double(&channels->values[i]);
+            loudest = (db > loudest ? db : loudest);
+        }
+        metrics_set(METRICS_AUDIO_LEVEL, (int64_t) (loudest * 100.0));
+    }
+}
+
+static gboolean audio_bus_callback(GstBus *bus, GstMessage *message, gpointer user_data) {
+    GstElement *pipeline = (GstElement *) user_data;
+    switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ELEMENT:
+        if (level_metering) {
+            audio_level_message(message);
+        }
+        break;
+    case GST_MESSAGE_LATENCY:
+        gst_bin_recalculate_latency(GST_BIN(pipeline));
+        audio_renderer_query_latency(pipeline);
+        break;
+    case GST_MESSAGE_ASYNC_DONE:
+        audio_renderer_query_latency(pipeline);
+        break;
+    default:
+        break;
+    }
+    return TRUE;
+}
+
+static guint add_bus_watch(GstElement *pipeline) {
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    guint id = gst_bus_add_watch(bus, (GstBusFunc) audio_bus_callback, pipeline);
+    gst_object_unref(bus);
+    return id;
+}
+
+void audio_renderer_force_resample(bool force) {
+    force_resample = force;
+}
+
+static void audio_renderer_init_shared(const char* audiosink, GstClock *clock) {
+    GError *error = NULL;
+    /* "identity" is a placeholder for the decoder, which is chosen in audio_renderer_start */
+    GString *launch = g_string_new("appsrc name=audio_source ! queue name=audio_queue ! identity name=audio_decoder ! ");
+    g_string_append (launch, "audioconvert name=audio_convert ! ");
+    append_output_stages(launch);
+    g_string_append (launch, audiosink);
+    g_string_append (launch, " name=audio_sink");
+    GstElement *pipeline = gst_parse_launch(launch->str, &error);
+    if (error) {
+        g_error ("gst_parse_launch error (shared audio pipeline):\n %s\n", error->message);
+        g_clear_error (&error);
+    }
+    g_assert (pipeline);
+    gst_pipeline_use_clock(GST_PIPELINE_CAST(pipeline), clock);
+    logger_log(logger, LOGGER_DEBUG, "GStreamer shared audio pipeline: \"%s\"", launch->str);
+    g_string_free(launch, TRUE);
+
+    GstElement *appsrc = gst_bin_get_by_name (GST_BIN (pipeline), "audio_source");
+    GstElement *volume = gst_bin_get_by_name (GST_BIN (pipeline), "volume");
+    g_object_set(appsrc, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    for (int i = 0; i < NFORMATS ; i++) {
+        renderer_type[i] = (audio_renderer_t *)  calloc(1,sizeof(audio_renderer_t));
+        g_assert(renderer_type[i]);
+        renderer_type[i]->pipeline = (i ? gst_object_ref(pipeline) : pipeline);
+        renderer_type[i]->appsrc = (i ? gst_object_ref(appsrc) : appsrc);
+        renderer_type[i]->volume = (i ? gst_object_ref(volume) : volume);
+        set_format(i, NULL);
+        logger_log(logger, LOGGER_DEBUG, "Audio format %d: %s",i+1,format[i]);
+    }
+    renderer_type[0]->bus_watch = add_bus_watch(pipeline);
+    shared_ct = 0;
+}
+
+/* replaces the decoder in the (stopped) shared pipeline by one for the format of renderer r */
+static void audio_renderer_switch_decoder(audio_renderer_t *r) {
+    const char *decoder_name = "identity";
+    switch (r->ct) {
+    case 8:
+    case 4:
+        decoder_name = avdec_aac;
+        break;
+    case 2:
+        decoder_name = avdec_alac;
+        break;
+    default:
+        break;
+    }
+    GstBin *bin = GST_BIN (r->pipeline);
+    GstElement *queue = gst_bin_get_by_name (bin, "audio_queue");
+    GstElement *convert = gst_bin_get_by_name (bin, "audio_convert");
+    GstElement *old_decoder = gst_bin_get_by_name (bin, "audio_decoder");
+    GstElement *sink = gst_bin_get_by_name (bin, "audio_sink");
+    g_assert(queue && convert && old_decoder && sink);
+    gst_element_unlink_many(queue, old_decoder, convert, NULL);
+    gst_bin_remove(bin, old_decoder);
+    gst_object_unref(old_decoder);
+    GstElement *decoder = gst_element_factory_make(decoder_name, "audio_decoder");
+    g_assert(decoder);
+    gst_bin_add(bin, decoder);
+    if (!gst_element_link_many(queue, decoder, convert, NULL)) {
+        logger_log(logger, LOGGER_ERR, "failed to link %s in the shared audio pipeline", decoder_name);
+    }
+    GstCaps *caps = gst_caps_from_string(r->caps);
+    g_object_set(r->appsrc, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "sync")) {
+        g_object_set(sink, "sync", (r->ct == 2 ? async : vsync), NULL);
+    }
+    gst_object_unref(queue);
+    gst_object_unref(convert);
+    gst_object_unref(sink);
+    shared_ct = r->ct;
+    logger_log(logger, LOGGER_DEBUG, "shared audio pipeline now uses decoder %s", decoder_name);
+}
+
 bool gstreamer_init(){
     gst_init(NULL,NULL);    
     return (bool) check_plugins ();
 }
 
-void audio_renderer_init(logger_t *render_logger, const char* audiosink, const bool* audio_sync, const bool* video_sync) {
+void audio_renderer_init(logger_t *render_logger, const char* audiosink, const bool* audio_sync, const bool* video_sync,
+                         const bool *shared) {
     GError *error = NULL;
     GstCaps *caps = NULL;
     GstClock *clock = gst_system_clock_obtain();
     g_object_set(clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
 
     logger = render_logger;
+
+    if (!strncmp(audiosink, "native", 6) && (audiosink[6] == '\0' || audiosink[6] == ':')) {
+#ifdef HAVE_NATIVE_AUDIO
+        if (audio_native_init(render_logger, audiosink, audio_sync, video_sync) == 0) {
+            native_audio = TRUE;
+            g_object_unref(clock);
+            return;
+        }
+        logger_log(logger, LOGGER_ERR, "native audio output failed, using autoaudiosink");
+#else
+        logger_log(logger, LOGGER_ERR, "this build has no native audio output (needs ALSA), using autoaudiosink");
+#endif
+        audiosink = "autoaudiosink";
+    }
     
     aac = check_plugin_feature (avdec_aac);
     alac = check_plugin_feature (avdec_alac);
 
+    level_metering = metrics_enabled();
+    resample = force_resample || audiosink_needs_resample(audiosink);
+    logger_log(logger, LOGGER_INFO, "audio pipeline profile: %s, %s", (resample ? "audioresample" : "no resampling"),
+               (level_metering ? "level metering" : "no level metering"));
+
+    shared_pipeline = *shared;
+    if (shared_pipeline) {
+        async = *audio_sync;
+        vsync = *video_sync;
+        audio_renderer_init_shared(audiosink, clock);
+        g_object_unref(clock);
+        return;
+    }
+
     for (int i = 0; i < NFORMATS ; i++) {
         renderer_type[i] = (audio_renderer_t *)  calloc(1,sizeof(audio_renderer_t));
         g_assert(renderer_type[i]);
@@ -155,8 +453,7 @@ void audio_renderer_init(logger_t *render_logger, const char* audiosink, const b
             break;
         }
         g_string_append (launch, "audioconvert ! ");
-        g_string_append (launch, "audioresample ! ");    /* wasapisink must resample from 44.1 kHz to 48 kHz */
-        g_string_append (launch, "volume name=volume ! level ! ");
+        append_output_stages(launch);
         g_string_append (launch, audiosink);
         switch(i) {
         case 1:  /*ALAC*/
@@ -189,30 +486,8 @@ void audio_renderer_init(logger_t *render_logger, const char* audiosink, const b
 
         renderer_type[i]->appsrc = gst_bin_get_by_name (GST_BIN (renderer_type[i]->pipeline), "audio_source");
         renderer_type[i]->volume = gst_bin_get_by_name (GST_BIN (renderer_type[i]->pipeline), "volume");
-        switch (i) {
-        case 0:
-            caps =  gst_caps_from_string(aac_eld_caps);
-            renderer_type[i]->ct = 8;
-            format[i] = "AAC-ELD 44100/2";
-            break;
-        case 1:
-            caps =  gst_caps_from_string(alac_caps);
-            renderer_type[i]->ct = 2;
-            format[i] = "ALAC 44100/16/2";
-            break;
-        case 2:
-            caps =  gst_caps_from_string(aac_lc_caps);
-            renderer_type[i]->ct = 4;
-            format[i] = "AAC-LC 44100/2";
-            break;
-        case 3:
-            caps =  gst_caps_from_string(lpcm_caps);
-            renderer_type[i]->ct = 1;
-            format[i] = "PCM 44100/16/2 S16LE";
-            break;
-        default:
-            break;
-        }
+        renderer_type[i]->bus_watch = add_bus_watch(renderer_type[i]->pipeline);
+        set_format(i, &caps);
         logger_log(logger, LOGGER_DEBUG, "Audio format %d: %s",i+1,format[i]);
         logger_log(logger, LOGGER_DEBUG, "GStreamer audio pipeline %d: \"%s\"", i+1, launch->str);
         g_string_free(launch, TRUE);
@@ -222,12 +497,75 @@ void audio_renderer_init(logger_t *render_logger, const char* audiosink, const b
     }
 }
 
+void audio_renderer_set_batch(unsigned int frames) {
+#if GST_CHECK_VERSION(1,14,0)
+    batch_frames = (frames > AUDIO_BATCH_MAX ? AUDIO_BATCH_MAX : frames);
+#else
+    if (frames > 1) {
+        logger_log(logger, LOGGER_WARNING, "audio batching needs GStreamer >= 1.14 (gst_app_src_push_buffer_list)");
+    }
+#endif
+}
+
+static guint max_frame_size(unsigned char ct) {
+    switch (ct) {
+    case 1:     /* LPCM */
+        return 352 * 4;
+    case 2:     /* ALAC */
+        return ALAC_MAX_FRAME_SIZE;
+    default:    /* AAC-LC, AAC-ELD */
+        return AAC_MAX_FRAME_SIZE;
+    }
+}
+
+/* (re)configures the buffer pool for frames of at most size bytes */
+static void audio_renderer_configure_pool(guint size) {
+    if (buffer_pool && size == buffer_pool_size) {
+        return;
+    }
+    if (buffer_pool) {
+        /* buffers still in the pipeline keep the old pool alive until they are freed */
+        gst_buffer_pool_set_active(buffer_pool, FALSE);
+        gst_object_unref(buffer_pool);
+    }
+    buffer_pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(buffer_pool);
+    gst_buffer_pool_config_set_params(config, NULL, size, AUDIO_POOL_MIN_BUFFERS, 0);
+    if (!gst_buffer_pool_set_config(buffer_pool, config) || !gst_buffer_pool_set_active(buffer_pool, TRUE)) {
+        logger_log(logger, LOGGER_WARNING, "audio buffer pool could not be configured: buffers will be allocated per frame");
+        gst_object_unref(buffer_pool);
+        buffer_pool = NULL;
+        buffer_pool_size = 0;
+        return;
+    }
+    buffer_pool_size = size;
+    logger_log(logger, LOGGER_DEBUG, "audio buffer pool: %u-byte buffers", size);
+}
+
+/* frames waiting in a batch are discarded by flush and stop */
+static void audio_renderer_drop_batch() {
+    g_mutex_lock(&batch_mutex);
+    if (batch) {
+        gst_buffer_list_unref(batch);
+        batch = NULL;
+    }
+    g_mutex_unlock(&batch_mutex);
+}
+
 void audio_renderer_stop() {
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_stop();
+        return;
+    }
+#endif
+    audio_renderer_drop_batch();
     if (renderer) {
         gst_app_src_end_of_stream(GST_APP_SRC(renderer->appsrc));
         gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
         renderer = NULL;
     }
+    g_atomic_int_set(&pipeline_latency, -1);
 }
 
 static void get_renderer_type(unsigned char *ct, int *id) {
@@ -268,19 +606,35 @@ static void get_renderer_type(unsigned char *ct, int *id) {
 
 void  audio_renderer_start(unsigned char *ct) {
     int id = -1;
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_start(ct);
+        return;
+    }
+#endif
     get_renderer_type(ct, &id);
     if (id >= 0 && renderer) {
         if(*ct != renderer->ct) {
             gst_app_src_end_of_stream(GST_APP_SRC(renderer->appsrc));
             gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
             logger_log(logger, LOGGER_INFO, "changed audio connection, format %s", format[id]);
+            audio_renderer_drop_batch();
+            g_atomic_int_set(&pipeline_latency, -1);
             renderer = renderer_type[id];
+            if (shared_pipeline && shared_ct != renderer->ct) {
+                audio_renderer_switch_decoder(renderer);
+            }
+            audio_renderer_configure_pool(max_frame_size(renderer->ct));
             gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
             gst_audio_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
         }
     } else if (id >= 0) {
         logger_log(logger, LOGGER_INFO, "start audio connection, format %s", format[id]);
         renderer = renderer_type[id];
+        if (shared_pipeline && shared_ct != renderer->ct) {
+            audio_renderer_switch_decoder(renderer);
+        }
+        audio_renderer_configure_pool(max_frame_size(renderer->ct));
         gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
         gst_audio_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
     } else {
@@ -292,6 +646,12 @@ void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned s
     GstBuffer *buffer;
     bool valid;
 
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_render_buffer(data, data_len, seqnum, ntp_time);
+        return;
+    }
+#endif
     if (!render_audio) return;    /* do nothing unless render_audio == TRUE */
 
     GstClockTime pts = (GstClockTime) *ntp_time ;    /* now in nsecs */
@@ -312,15 +672,8 @@ void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned s
      * first byte data[0] of ALAC frame is 0x20,                                                       *
      * first byte of AAC_ELD is 0x8c, 0x8d or 0x8e: 0x100011(00,01,10) in modern devices               *
      *                   but is 0x80, 0x81 or 0x82: 0x100000(00,01,10) in ios9, ios10 devices          *
-     * first byte of AAC_LC should be 0xff (ADTS) (but has never been  seen).                          */
+     * AAC_LC (AirPlay 2 buffered audio, ct = 4) frames are raw (no ADTS header), like the caps.      */
     
-    buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
-    g_assert(buffer != NULL);
-    //g_print("audio latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
-    if (sync) {
-        GST_BUFFER_PTS(buffer) = pts;
-    }
-    gst_buffer_fill(buffer, 0, data, *data_len);
     switch (renderer->ct){
     case 8: /*AAC-ELD*/
         switch (data[0]){
@@ -340,33 +693,108 @@ void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned s
     case 2: /*ALAC*/
         valid = (data[0] == 0x20);
         break;
-    case 4:  /*AAC_LC */
-        valid = (data[0] == 0xff );
- 	break;
     default:
         valid = true;
         break;
     }
-    if (valid) {
-        gst_app_src_push_buffer(GST_APP_SRC(renderer->appsrc), buffer);
-    } else {
+    if (!valid) {
         logger_log(logger, LOGGER_ERR, "*** ERROR invalid  audio frame (compression_type %d) skipped ", renderer->ct);
         logger_log(logger, LOGGER_ERR, "***       first byte of invalid frame was  0x%2.2x ", (unsigned int) data[0]);
+        return;
     }
+
+    buffer = NULL;
+    if (buffer_pool && (guint) *data_len <= buffer_pool_size &&
+        gst_buffer_pool_acquire_buffer(buffer_pool, &buffer, NULL) == GST_FLOW_OK) {
+        gst_buffer_fill(buffer, 0, data, *data_len);
+        gst_buffer_set_size(buffer, *data_len);
+    } else {
+        buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
+        g_assert(buffer != NULL);
+        gst_buffer_fill(buffer, 0, data, *data_len);
+    }
+    //g_print("audio latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
+    if (sync) {
+        GST_BUFFER_PTS(buffer) = pts;
+    }
+
+#if GST_CHECK_VERSION(1,14,0)
+    if (batch_frames > 1) {
+        gboolean batched = FALSE;
+        GstBufferList *ready = NULL;
+        g_mutex_lock(&batch_mutex);
+        if (sync && (int64_t) (*ntp_time - (uint64_t) g_get_real_time() * 1000) > AUDIO_BATCH_MIN_LEAD) {
+            if (!batch) {
+                batch = gst_buffer_list_new_sized(batch_frames);
+            }
+            gst_buffer_list_add(batch, buffer);
+            batched = TRUE;
+            if (gst_buffer_list_length(batch) >= batch_frames) {
+                ready = batch;
+                batch = NULL;
+            }
+        } else {
+            /* pending frames must precede this one */
+            ready = batch;
+            batch = NULL;
+        }
+        g_mutex_unlock(&batch_mutex);
+        if (ready) {
+            guint n = gst_buffer_list_length(ready);
+            uint64_t trace_start = trace_begin();
+            gst_app_src_push_buffer_list(GST_APP_SRC(renderer->appsrc), ready);
+            trace_span("audio", "appsrc push list", trace_start, n);
+            metrics_add(METRICS_AUDIO_FRAMES_RENDERED, n);
+        }
+        if (batched) {
+            return;
+        }
+    }
+#endif
+    uint64_t trace_start = trace_begin();
+    gst_app_src_push_buffer(GST_APP_SRC(renderer->appsrc), buffer);
+    trace_span("audio", "appsrc push", trace_start, TRACE_NO_ARG);
+    metrics_add(METRICS_AUDIO_FRAMES_RENDERED, 1);
 }
 
 void audio_renderer_set_volume(double volume) {
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_set_volume(volume);
+        return;
+    }
+#endif
+    if (renderer == NULL) {
+        return;
+    }
     volume = (volume > 10.0) ? 10.0 : volume;
     volume = (volume < 0.0) ? 0.0 : volume;
     g_object_set(renderer->volume, "volume", volume, NULL);
 }
 
 void audio_renderer_flush() {
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_flush();
+        return;
+    }
+#endif
+    audio_renderer_drop_batch();
 }
 
 void audio_renderer_destroy() {
+#ifdef HAVE_NATIVE_AUDIO
+    if (native_audio) {
+        audio_native_destroy();
+        native_audio = FALSE;
+        return;
+    }
+#endif
     audio_renderer_stop();
     for (int i = 0; i < NFORMATS ; i++ ) {
+        if (renderer_type[i]->bus_watch) {
+            g_source_remove(renderer_type[i]->bus_watch);
+        }
         gst_object_unref (renderer_type[i]->volume);
 	renderer_type[i]->volume = NULL;
         gst_object_unref (renderer_type[i]->appsrc);
@@ -374,5 +802,13 @@ void audio_renderer_destroy() {
 	gst_object_unref (renderer_type[i]->pipeline);
         renderer_type[i]->pipeline = NULL;
         free(renderer_type[i]);
+        renderer_type[i] = NULL;
+    }
+    renderer = NULL;
+    if (buffer_pool) {
+        gst_buffer_pool_set_active(buffer_pool, FALSE);
+        gst_object_unref(buffer_pool);
+        buffer_pool = NULL;
+        buffer_pool_size = 0;
     }
 }
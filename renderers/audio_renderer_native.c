@@ -0,0 +1,394 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Native audio path (-as native[:device]): frames are decoded in the thread that
+ * delivers them (ALAC by lib/alac, AAC by libfdk-aac when available) into a
+ * preallocated single-producer/single-consumer ring of PCM slots, and a playback
+ * thread writes them to an ALSA device, scheduling each slot by its ntp_time
+ * against the local realtime clock and the device delay: early audio is preceded
+ * by silence, audio that is already late is dropped.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <glib.h>
+#include <alsa/asoundlib.h>
+#ifdef HAVE_FDK_AAC
+#include <fdk-aac/aacdecoder_lib.h>
+#endif
+#include "audio_renderer.h"
+#include "audio_renderer_native.h"
+#include "../lib/alac.h"
+#include "../lib/metrics.h"
+
+#define NATIVE_RATE 44100
+#define NATIVE_CHANNELS 2
+#define NATIVE_RING_SLOTS 64                /* power of two */
+#define NATIVE_MAX_FRAMES 1024              /* AAC-LC; ALAC uses 352, AAC-ELD 480 */
+#define NATIVE_DEVICE_LATENCY_US 100000     /* ALSA buffer */
+#define NATIVE_LATE_NSECS 50000000LL        /* drop slots more than 50 msecs late */
+#define NATIVE_EARLY_NSECS 5000000LL        /* precede slots more than 5 msecs early with silence */
+#define NATIVE_SILENCE_FRAMES 4410          /* silence is written in chunks of at most 100 msecs */
+#define SECOND_IN_NSECS 1000000000LL
+
+typedef struct native_slot_s {
+    gint64 ntp_time;
+    int frames;
+    int16_t pcm[NATIVE_MAX_FRAMES * NATIVE_CHANNELS];
+} native_slot_t;
+
+static logger_t *logger = NULL;
+static snd_pcm_t *pcm = NULL;
+static char *device = NULL;
+static alac_t *alac_decoder = NULL;
+#ifdef HAVE_FDK_AAC
+static HANDLE_AACDECODER aac_decoder = NULL;
+#endif
+static unsigned char current_ct = 0;
+static gboolean audio_sync = FALSE;
+static gboolean video_sync = FALSE;
+static gboolean sync = FALSE;
+static gboolean decode = FALSE;
+
+static native_slot_t *ring = NULL;
+static guint ring_write = 0;     /* written only by the producer */
+static guint ring_read = 0;      /* written only by the playback thread */
+static gint volume_gain = 32768; /* Q15 software volume */
+static gint flush_requested = 0;
+static gint active = 0;
+static gint running = 0;
+static GThread *playback_thread = NULL;
+static GMutex wake_mutex;
+static GCond wake_cond;
+static int16_t silence[NATIVE_SILENCE_FRAMES * NATIVE_CHANNELS];
+
+static guint64 overflows = 0;
+static guint64 late_dropped = 0;
+static guint64 silence_frames = 0;
+
+static gint64 realtime_nsecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (gint64) ts.tv_sec * SECOND_IN_NSECS + ts.tv_nsec;
+}
+
+static int native_write(const int16_t *data, snd_pcm_uframes_t frames) {
+    while (frames > 0) {
+        snd_pcm_sframes_t ret = snd_pcm_writei(pcm, data, frames);
+        if (ret == -EAGAIN) {
+            continue;
+        } else if (ret < 0) {
+            if (snd_pcm_recover(pcm, (int) ret, 1) < 0) {
+                logger_log(logger, LOGGER_ERR, "native audio: ALSA write failed: %s", snd_strerror((int) ret));
+                return -1;
+            }
+            continue;
+        }
+        data += ret * NATIVE_CHANNELS;
+        frames -= ret;
+    }
+    return 0;
+}
+
+/* time at which the next frame written to the device will be heard */
+static gint64 native_play_time() {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0 || delay < 0) {
+        delay = 0;
+    }
+    return realtime_nsecs() + (gint64) delay * SECOND_IN_NSECS / NATIVE_RATE;
+}
+
+static void native_apply_volume(native_slot_t *slot) {
+    gint gain = g_atomic_int_get(&volume_gain);
+    int n = slot->frames * NATIVE_CHANNELS;
+    if (gain == 32768) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        int64_t sample = ((int64_t) slot->pcm[i] * gain) >> 15;
+        slot->pcm[i] = (int16_t) (sample > 32767 ? 32767 : (sample < -32768 ? -32768 : sample));
+    }
+}
+
+static gpointer native_playback(gpointer data) {
+    while (g_atomic_int_get(&running)) {
+        guint write = (guint) g_atomic_int_get((gint *) &ring_write);
+        if (g_atomic_int_get(&flush_requested)) {
+            g_atomic_int_set(&flush_requested, 0);
+            g_atomic_int_set((gint *) &ring_read, (gint) write);
+            snd_pcm_drop(pcm);
+            snd_pcm_prepare(pcm);
+            continue;
+        }
+        if (ring_read == write) {
+            g_mutex_lock(&wake_mutex);
+            if (ring_read == (guint) g_atomic_int_get((gint *) &ring_write) && g_atomic_int_get(&running) &&
+                !g_atomic_int_get(&flush_requested)) {
+                g_cond_wait_until(&wake_cond, &wake_mutex, g_get_monotonic_time() + 100 * G_TIME_SPAN_MILLISECOND);
+            }
+            g_mutex_unlock(&wake_mutex);
+            continue;
+        }
+        native_slot_t *slot = &ring[ring_read & (NATIVE_RING_SLOTS - 1)];
+        gboolean play = TRUE;
+        if (sync && slot->ntp_time) {
+            gint64 early;
+            while ((early = slot->ntp_time - native_play_time()) > NATIVE_EARLY_NSECS) {
+                gint64 frames = early * NATIVE_RATE / SECOND_IN_NSECS;
+                if (frames > NATIVE_SILENCE_FRAMES) frames = NATIVE_SILENCE_FRAMES;
+                if (native_write(silence, (snd_pcm_uframes_t) frames) < 0 ||
+                    g_atomic_int_get(&flush_requested) || !g_atomic_int_get(&running)) {
+                    break;
+                }
+                silence_frames += frames;
+            }
+            if (-early > NATIVE_LATE_NSECS) {
+                late_dropped++;
+                play = FALSE;
+            }
+        }
+        if (play && !g_atomic_int_get(&flush_requested)) {
+            native_apply_volume(slot);
+            native_write(slot->pcm, (snd_pcm_uframes_t) slot->frames);
+        }
+        g_atomic_int_set((gint *) &ring_read, (gint) (ring_read + 1));
+    }
+    return NULL;
+}
+
+static void native_close_decoders() {
+    if (alac_decoder) {
+        alac_destroy(alac_decoder);
+        alac_decoder = NULL;
+    }
+#ifdef HAVE_FDK_AAC
+    if (aac_decoder) {
+        aacDecoder_Close(aac_decoder);
+        aac_decoder = NULL;
+    }
+#endif
+}
+
+#ifdef HAVE_FDK_AAC
+static gboolean native_open_aac(unsigned char ct) {
+    /* AudioSpecificConfig as in the GStreamer caps: AAC-ELD 44100/2 spf 480, AAC-LC 44100/2 */
+    static UCHAR asc_eld[] = { 0xf8, 0xe8, 0x50, 0x00 };
+    static UCHAR asc_lc[] = { 0x12, 0x10 };
+    UCHAR *asc = (ct == 8 ? asc_eld : asc_lc);
+    UINT asc_len = (ct == 8 ? sizeof(asc_eld) : sizeof(asc_lc));
+    aac_decoder = aacDecoder_Open(TT_MP4_RAW, 1);
+    if (!aac_decoder) {
+        return FALSE;
+    }
+    if (aacDecoder_ConfigRaw(aac_decoder, &asc, &asc_len) != AAC_DEC_OK) {
+        aacDecoder_Close(aac_decoder);
+        aac_decoder = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+#endif
+
+int audio_native_init(logger_t *render_logger, const char *audiosink, const bool *async, const bool *vsync) {
+    int ret;
+    logger = render_logger;
+    audio_sync = *async;
+    video_sync = *vsync;
+
+    /* audiosink is "native" or "native:<ALSA device>" */
+    const char *colon = strchr(audiosink, ':');
+    device = strdup(colon && colon[1] ? colon + 1 : "default");
+    ret = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (ret < 0) {
+        logger_log(logger, LOGGER_ERR, "native audio: cannot open ALSA device \"%s\": %s", device, snd_strerror(ret));
+        free(device);
+        device = NULL;
+        return -1;
+    }
+    ret = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, NATIVE_CHANNELS,
+                             NATIVE_RATE, 1, NATIVE_DEVICE_LATENCY_US);
+    if (ret < 0) {
+        logger_log(logger, LOGGER_ERR, "native audio: cannot configure ALSA device \"%s\": %s", device, snd_strerror(ret));
+        snd_pcm_close(pcm);
+        pcm = NULL;
+        free(device);
+        device = NULL;
+        return -1;
+    }
+    ring = (native_slot_t *) calloc(NATIVE_RING_SLOTS, sizeof(native_slot_t));
+    g_assert(ring);
+    ring_read = ring_write = 0;
+    g_mutex_init(&wake_mutex);
+    g_cond_init(&wake_cond);
+    g_atomic_int_set(&running, 1);
+    playback_thread = g_thread_new("audio_native", native_playback, NULL);
+#ifdef HAVE_FDK_AAC
+    logger_log(logger, LOGGER_DEBUG, "native audio: ALSA device \"%s\", ALAC and AAC decoders", device);
+#else
+    logger_log(logger, LOGGER_DEBUG, "native audio: ALSA device \"%s\", ALAC decoder (built without libfdk-aac)", device);
+#endif
+    return 0;
+}
+
+void audio_native_start(unsigned char *ct) {
+    if (g_atomic_int_get(&active) && *ct == current_ct) {
+        return;
+    }
+    native_close_decoders();
+    decode = FALSE;
+    current_ct = *ct;
+    switch (*ct) {
+    case 2:    /* ALAC 44100/16/2 spf 352 */
+        alac_decoder = alac_init(352, 16, 40, 10, 14, 2);
+        decode = (alac_decoder != NULL);
+        sync = audio_sync;
+        break;
+    case 4:    /* AAC-LC */
+    case 8:    /* AAC-ELD */
+#ifdef HAVE_FDK_AAC
+        decode = native_open_aac(*ct);
+        if (!decode) {
+            logger_log(logger, LOGGER_ERR, "native audio: cannot open the libfdk-aac decoder");
+        }
+#else
+        logger_log(logger, LOGGER_INFO, "*** native audio was built without libfdk-aac, cannot decode AAC audio");
+#endif
+        sync = video_sync;
+        break;
+    case 1:    /* LPCM */
+        decode = TRUE;
+        sync = FALSE;
+        break;
+    default:
+        logger_log(logger, LOGGER_ERR, "unknown audio compression type ct = %d", *ct);
+        break;
+    }
+    logger_log(logger, LOGGER_INFO, "start native audio connection, compression type %d", *ct);
+    g_atomic_int_set(&active, 1);
+}
+
+void audio_native_stop() {
+    if (g_atomic_int_get(&active)) {
+        g_atomic_int_set(&active, 0);
+        audio_native_flush();
+    }
+}
+
+static int native_decode(unsigned char *data, int len, int16_t *out) {
+    switch (current_ct) {
+    case 2:
+        if (data[0] != 0x20) {
+            return -1;
+        }
+        return alac_decode_frame(alac_decoder, data, len, out, NATIVE_MAX_FRAMES);
+    case 1: {
+        int frames = len / (2 * NATIVE_CHANNELS);
+        if (frames > NATIVE_MAX_FRAMES) frames = NATIVE_MAX_FRAMES;
+        memcpy(out, data, frames * 2 * NATIVE_CHANNELS);
+        return frames;
+    }
+#ifdef HAVE_FDK_AAC
+    case 4:
+    case 8: {
+        UCHAR *in = (UCHAR *) data;
+        UINT size = (UINT) len;
+        UINT valid = (UINT) len;
+        if (aacDecoder_Fill(aac_decoder, &in, &size, &valid) != AAC_DEC_OK ||
+            aacDecoder_DecodeFrame(aac_decoder, (INT_PCM *) out, NATIVE_MAX_FRAMES * NATIVE_CHANNELS, 0) != AAC_DEC_OK) {
+            return -1;
+        }
+        CStreamInfo *info = aacDecoder_GetStreamInfo(aac_decoder);
+        if (!info || info->numChannels != NATIVE_CHANNELS) {
+            return -1;
+        }
+        return info->frameSize;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
+
+void audio_native_render_buffer(unsigned char *data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time) {
+    if (!decode || !g_atomic_int_get(&active) || *data_len <= 0) {
+        return;
+    }
+    guint read = (guint) g_atomic_int_get((gint *) &ring_read);
+    if (ring_write - read == NATIVE_RING_SLOTS) {
+        overflows++;
+        return;
+    }
+    native_slot_t *slot = &ring[ring_write & (NATIVE_RING_SLOTS - 1)];
+    int frames = native_decode(data, *data_len, slot->pcm);
+    if (frames <= 0) {
+        logger_log(logger, LOGGER_ERR, "*** ERROR invalid  audio frame (compression_type %d) skipped ", current_ct);
+        logger_log(logger, LOGGER_ERR, "***       first byte of invalid frame was  0x%2.2x ", (unsigned int) data[0]);
+        return;
+    }
+    slot->frames = frames;
+    slot->ntp_time = (gint64) *ntp_time;
+    g_atomic_int_set((gint *) &ring_write, (gint) (ring_write + 1));
+    metrics_add(METRICS_AUDIO_FRAMES_RENDERED, 1);
+    g_mutex_lock(&wake_mutex);
+    g_cond_signal(&wake_cond);
+    g_mutex_unlock(&wake_mutex);
+}
+
+void audio_native_set_volume(double volume) {
+    volume = (volume > 10.0) ? 10.0 : volume;
+    volume = (volume < 0.0) ? 0.0 : volume;
+    g_atomic_int_set(&volume_gain, (gint) lround(volume * 32768.0));
+}
+
+void audio_native_flush() {
+    g_atomic_int_set(&flush_requested, 1);
+    g_mutex_lock(&wake_mutex);
+    g_cond_signal(&wake_cond);
+    g_mutex_unlock(&wake_mutex);
+}
+
+void audio_native_destroy() {
+    if (!playback_thread) {
+        return;
+    }
+    g_atomic_int_set(&active, 0);
+    g_atomic_int_set(&running, 0);
+    g_mutex_lock(&wake_mutex);
+    g_cond_signal(&wake_cond);
+    g_mutex_unlock(&wake_mutex);
+    g_thread_join(playback_thread);
+    playback_thread = NULL;
+    logger_log(logger, LOGGER_INFO, "native audio: %" G_GUINT64_FORMAT " frames dropped late, %" G_GUINT64_FORMAT
+               " dropped on a full ring, %" G_GUINT64_FORMAT " frames of silence inserted",
+               late_dropped, overflows, silence_frames);
+    native_close_decoders();
+    snd_pcm_drop(pcm);
+    snd_pcm_close(pcm);
+    pcm = NULL;
+    free(ring);
+    ring = NULL;
+    free(device);
+    device = NULL;
+    g_mutex_clear(&wake_mutex);
+    g_cond_clear(&wake_cond);
+}
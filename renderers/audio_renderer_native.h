@@ -0,0 +1,38 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/* native (ALSA) audio output, selected with audiosink "native[:device]"; the  *
+ * audio_renderer_* functions forward to these when it is in use              */
+
+#ifndef AUDIO_RENDERER_NATIVE_H
+#define AUDIO_RENDERER_NATIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+int audio_native_init(logger_t *logger, const char *audiosink, const bool *audio_sync, const bool *video_sync);
+void audio_native_start(unsigned char *compression_type);
+void audio_native_stop();
+void audio_native_render_buffer(unsigned char *data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time);
+void audio_native_set_volume(double volume);
+void audio_native_flush();
+void audio_native_destroy();
+
+#endif //AUDIO_RENDERER_NATIVE_H
@@ -0,0 +1,195 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "display_refresh.h"
+
+#ifdef HAVE_LIBDRM
+#include <fcntl.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#define DRM_MAX_CARDS 4
+
+static int drm_fd = -1;
+static int drm_crtc_index = 0;
+
+static double drm_mode_refresh(const drmModeModeInfo *mode) {
+    double rate;
+    if (!mode->htotal || !mode->vtotal) {
+        return (double) mode->vrefresh;
+    }
+    /* clock is in kHz */
+    rate = (double) mode->clock * 1000.0 / ((double) mode->htotal * (double) mode->vtotal);
+    if (mode->flags & DRM_MODE_FLAG_INTERLACE) {
+        rate *= 2.0;
+    }
+    if (mode->flags & DRM_MODE_FLAG_DBLSCAN) {
+        rate /= 2.0;
+    }
+    if (mode->vscan > 1) {
+        rate /= (double) mode->vscan;
+    }
+    return rate;
+}
+
+static bool drm_detect(double *rate) {
+    char path[32];
+    for (int card = 0; card < DRM_MAX_CARDS; card++) {
+        snprintf(path, sizeof(path), "/dev/dri/card%d", card);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        drmModeRes *resources = drmModeGetResources(fd);
+        if (resources) {
+            for (int i = 0; i < resources->count_crtcs && *rate <= 0.0; i++) {
+                drmModeCrtc *crtc = drmModeGetCrtc(fd, resources->crtcs[i]);
+                if (crtc) {
+                    if (crtc->mode_valid) {
+                        *rate = drm_mode_refresh(&crtc->mode);
+                        drm_crtc_index = i;
+                    }
+                    drmModeFreeCrtc(crtc);
+                }
+            }
+            drmModeFreeResources(resources);
+        }
+        if (*rate > 0.0) {
+            /* kept open, for the vblank times */
+            drm_fd = fd;
+            return true;
+        }
+        close(fd);
+    }
+    return false;
+}
+#endif
+
+#ifdef HAVE_XRANDR
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+static bool xrandr_detect(double *rate) {
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        return false;
+    }
+    Window root = DefaultRootWindow(display);
+    XRRScreenResources *resources = XRRGetScreenResourcesCurrent(display, root);
+    RROutput primary = XRRGetOutputPrimary(display, root);
+    if (resources) {
+        for (int i = 0; i < resources->ncrtc && *rate <= 0.0; i++) {
+            XRRCrtcInfo *crtc = XRRGetCrtcInfo(display, resources, resources->crtcs[i]);
+            if (!crtc) {
+                continue;
+            }
+            bool use = (crtc->mode != None);
+            if (use && primary) {
+                use = false;
+                for (int j = 0; j < crtc->noutput; j++) {
+                    use = use || (crtc->outputs[j] == primary);
+                }
+            }
+            for (int j = 0; use && j < resources->nmode; j++) {
+                const XRRModeInfo *mode = &resources->modes[j];
+                if (mode->id != crtc->mode || !mode->hTotal || !mode->vTotal) {
+                    continue;
+                }
+                *rate = (double) mode->dotClock / ((double) mode->hTotal * (double) mode->vTotal);
+                if (mode->modeFlags & RR_Interlace) {
+                    *rate *= 2.0;
+                }
+                if (mode->modeFlags & RR_DoubleScan) {
+                    *rate /= 2.0;
+                }
+            }
+            XRRFreeCrtcInfo(crtc);
+        }
+        XRRFreeScreenResources(resources);
+    }
+    XCloseDisplay(display);
+    return (*rate > 0.0);
+}
+#endif
+
+bool display_refresh_detect(double *rate, const char **source) {
+    *rate = 0.0;
+#ifdef HAVE_LIBDRM
+    display_refresh_close();
+    if (drm_detect(rate)) {
+        *source = "drm";
+        return true;
+    }
+#endif
+#ifdef HAVE_XRANDR
+    if (xrandr_detect(rate)) {
+        *source = "xrandr";
+        return true;
+    }
+#endif
+    *source = NULL;
+    return false;
+}
+
+bool display_refresh_get_vblank(uint64_t *nsecs) {
+#ifdef HAVE_LIBDRM
+    drmVBlank vblank;
+    struct timespec now_mono, now_real;
+    if (drm_fd < 0) {
+        return false;
+    }
+    memset(&vblank, 0, sizeof(vblank));
+    vblank.request.type = DRM_VBLANK_RELATIVE;
+    if (drm_crtc_index == 1) {
+        vblank.request.type |= DRM_VBLANK_SECONDARY;
+    } else if (drm_crtc_index > 1) {
+        vblank.request.type |= ((drm_crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK);
+    }
+    vblank.request.sequence = 0;   /* returns at once, with the time of the latest vblank */
+    if (drmWaitVBlank(drm_fd, &vblank)) {
+        return false;
+    }
+    /* vblank times are CLOCK_MONOTONIC: convert to the realtime clock used by the pipelines */
+    clock_gettime(CLOCK_MONOTONIC, &now_mono);
+    clock_gettime(CLOCK_REALTIME, &now_real);
+    uint64_t vblank_mono = (uint64_t) vblank.reply.tval_sec * 1000000000ULL + (uint64_t) vblank.reply.tval_usec * 1000ULL;
+    uint64_t mono = (uint64_t) now_mono.tv_sec * 1000000000ULL + (uint64_t) now_mono.tv_nsec;
+    uint64_t real = (uint64_t) now_real.tv_sec * 1000000000ULL + (uint64_t) now_real.tv_nsec;
+    if (vblank_mono > mono) {
+        return false;
+    }
+    *nsecs = real - (mono - vblank_mono);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void display_refresh_close() {
+#ifdef HAVE_LIBDRM
+    if (drm_fd >= 0) {
+        close(drm_fd);
+        drm_fd = -1;
+    }
+#endif
+}
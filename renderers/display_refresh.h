@@ -0,0 +1,43 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/* refresh rate of the display (for -pace), from the mode of the first active DRM/KMS crtc (with   *
+ * libdrm), or of the primary X11 output (with XRandR); only DRM also gives the vblank times         */
+
+#ifndef DISPLAY_REFRESH_H
+#define DISPLAY_REFRESH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* rate in Hz (e.g. 59.94), computed from the mode timings; source is "drm" or "xrandr" */
+bool display_refresh_detect(double *rate, const char **source);
+/* CLOCK_REALTIME nsecs of the latest vblank, false if not known */
+bool display_refresh_get_vblank(uint64_t *nsecs);
+void display_refresh_close();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DISPLAY_REFRESH_H
@@ -0,0 +1,197 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "frame_export.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FRAME_EXPORT_PAGE 4096
+
+struct frame_export_s {
+    logger_t *logger;
+    char *name;
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    uint64_t frames;
+};
+
+static uint64_t realtime_nsecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static frame_export_header_t *get_header(frame_export_t *export) {
+    return (frame_export_header_t *) export->map;
+}
+
+static frame_export_slot_t *get_slot(frame_export_t *export, uint64_t frame) {
+    frame_export_header_t *header = get_header(export);
+    return (frame_export_slot_t *) (export->map + header->header_size + (frame % header->n_slots) * header->slot_size);
+}
+
+/* the object only grows, so that readers still mapping the old size are not faulted */
+static bool frame_export_resize(frame_export_t *export, size_t data_size) {
+    uint64_t slot_size = sizeof(frame_export_slot_t) + data_size;
+    slot_size = (slot_size + FRAME_EXPORT_PAGE - 1) / FRAME_EXPORT_PAGE * FRAME_EXPORT_PAGE;
+    size_t map_size = FRAME_EXPORT_PAGE + FRAME_EXPORT_SLOTS * slot_size;
+    uint32_t generation = 0;     /* even, once resized */
+    if (export->map) {
+        frame_export_header_t *header = get_header(export);
+        generation = header->generation + 2;
+        __atomic_store_n(&header->generation, generation - 1, __ATOMIC_RELEASE);
+        munmap(export->map, export->map_size);
+        export->map = NULL;
+    }
+    if (ftruncate(export->fd, (off_t) map_size) == -1) {
+        logger_log(export->logger, LOGGER_ERR, "-shm: could not resize %s to %zu bytes: %s", export->name, map_size,
+                   strerror(errno));
+        return false;
+    }
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, export->fd, 0);
+    if (map == MAP_FAILED) {
+        logger_log(export->logger, LOGGER_ERR, "-shm: could not map %s: %s", export->name, strerror(errno));
+        return false;
+    }
+    export->map = (uint8_t *) map;
+    export->map_size = map_size;
+    frame_export_header_t *header = get_header(export);
+    __atomic_store_n(&header->generation, generation - 1, __ATOMIC_RELEASE);
+    memset(header->reserved, 0, sizeof(header->reserved));
+    header->magic = FRAME_EXPORT_MAGIC;
+    header->version = FRAME_EXPORT_VERSION;
+    header->header_size = FRAME_EXPORT_PAGE;
+    header->n_slots = FRAME_EXPORT_SLOTS;
+    header->slot_size = slot_size;
+    header->writer_pid = (uint32_t) getpid();
+    for (int i = 0; i < FRAME_EXPORT_SLOTS; i++) {
+        memset(get_slot(export, i), 0, sizeof(frame_export_slot_t));
+    }
+    header->latest = 0;
+    __atomic_store_n(&header->generation, generation, __ATOMIC_RELEASE);
+    logger_log(export->logger, LOGGER_DEBUG, "-shm: %s has %d slots of %llu bytes", export->name, FRAME_EXPORT_SLOTS,
+               (unsigned long long) slot_size);
+    return true;
+}
+
+frame_export_t *frame_export_open(logger_t *logger, const char *name, unsigned int mode) {
+    frame_export_t *export = calloc(1, sizeof(frame_export_t));
+    if (!export) {
+        return NULL;
+    }
+    export->logger = logger;
+    export->name = strdup(name);
+    shm_unlink(name);
+    export->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, FRAME_EXPORT_MODE);
+    if (export->fd == -1) {
+        logger_log(logger, LOGGER_ERR, "-shm: could not create shared memory object %s: %s", name, strerror(errno));
+        free(export->name);
+        free(export);
+        return NULL;
+    }
+    /* (the umask does not apply to fchmod) */
+    if (mode != FRAME_EXPORT_MODE && fchmod(export->fd, (mode_t) mode) == -1) {
+        logger_log(logger, LOGGER_WARNING, "-shm: could not set the permissions of %s to %04o: %s", name, mode,
+                   strerror(errno));
+    }
+    if (!frame_export_resize(export, 0)) {
+        frame_export_close(export);
+        return NULL;
+    }
+    logger_log(logger, LOGGER_INFO, "-shm: decoded frames will be exported to shared memory object %s", name);
+    return export;
+}
+
+bool frame_export_write(frame_export_t *export, const uint8_t *data, uint32_t width, uint32_t height, uint32_t stride,
+                        uint64_t show_time) {
+    size_t data_size = (size_t) stride * height;
+    if (!export->map) {
+        return false;
+    }
+    frame_export_header_t *header = get_header(export);
+    if (sizeof(frame_export_slot_t) + data_size > header->slot_size && !frame_export_resize(export, data_size)) {
+        return false;
+    }
+    uint64_t frame = ++export->frames;
+    frame_export_slot_t *slot = get_slot(export, frame);
+    uint32_t seq = slot->seq + 1;
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->fourcc = FRAME_EXPORT_FOURCC;
+    slot->width = width;
+    slot->height = height;
+    slot->stride = stride;
+    slot->data_size = (uint32_t) data_size;
+    slot->frame = frame;
+    slot->show_time = show_time;
+    memcpy((uint8_t *) slot + sizeof(frame_export_slot_t), data, data_size);
+    slot->export_time = realtime_nsecs();
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&get_header(export)->latest, frame, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint64_t frame_export_get_frames(frame_export_t *export) {
+    return export->frames;
+}
+
+void frame_export_close(frame_export_t *export) {
+    if (!export) {
+        return;
+    }
+    if (export->map) {
+        munmap(export->map, export->map_size);
+    }
+    if (export->fd != -1) {
+        close(export->fd);
+        shm_unlink(export->name);
+    }
+    free(export->name);
+    free(export);
+}
+
+#else   /* no POSIX shared memory */
+
+frame_export_t *frame_export_open(logger_t *logger, const char *name, unsigned int mode) {
+    logger_log(logger, LOGGER_ERR, "-shm: frame export to shared memory is not available on this platform");
+    return NULL;
+}
+
+bool frame_export_write(frame_export_t *export, const uint8_t *data, uint32_t width, uint32_t height, uint32_t stride,
+                        uint64_t show_time) {
+    return false;
+}
+
+uint64_t frame_export_get_frames(frame_export_t *export) {
+    return 0;
+}
+
+void frame_export_close(frame_export_t *export) {
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/* -shm: decoded video frames are exported to local consumers (OCR, capture, ...) through a POSIX shared   *
+ * memory object (shm_open name, e.g. /dev/shm/uxplay-frames on Linux), which holds a ring of slots.  The   *
+ * writer never waits for readers: a reader that is too slow just misses frames.                          *
+ *                                                                                                        *
+ * The object is created with permissions FRAME_EXPORT_MODE (0600: only the user running UxPlay can read *
+ * it); -shmmode sets other permissions (e.g. 0640 for members of the group of the UxPlay process).  The  *
+ * mode is applied with fchmod, so it is not reduced by the umask.                                        *
+ *                                                                                                        *
+ * Layout (native byte order, all offsets from the start of the object):                                  *
+ *     frame_export_header_t                  at 0                                                         *
+ *     slot i (frame_export_slot_t + data)    at header_size + i * slot_size, 0 <= i < n_slots (slot_size  *
+ *                                            includes the 64-byte frame_export_slot_t, and the pixel data *
+ *                                            follows it)                                                  *
+ *                                                                                                        *
+ * Reading the newest frame:                                                                               *
+ *     1. g = generation (odd: being resized, retry); remap the object if its size changed (it only grows)  *
+ *     2. n = latest (0: no frame yet), slot = n % n_slots                                                 *
+ *     3. s = slot.seq (odd: being written, retry); read slot.frame (must be n), the fields and the data   *
+ *     4. the copy is good if slot.seq and generation are still s and g                                    *
+ * (with acquire ordering for the loads of generation, latest and seq).  Pixels are FRAME_EXPORT_FOURCC    *
+ * ('BGRx': 4 bytes per pixel, B G R and an unused byte), "stride" bytes per row.                          */
+
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+#define FRAME_EXPORT_MAGIC   0x45465855   /* "UXFE" */
+#define FRAME_EXPORT_VERSION 1
+#define FRAME_EXPORT_SLOTS   4
+#define FRAME_EXPORT_FOURCC  0x78524742   /* "BGRx" */
+#define FRAME_EXPORT_MODE    0600
+
+typedef struct frame_export_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;     /* offset of slot 0 */
+    uint32_t n_slots;
+    uint64_t slot_size;       /* bytes per slot */
+    uint32_t generation;      /* odd while the object is being resized */
+    uint32_t writer_pid;
+    uint64_t latest;          /* number of the newest complete frame (from 1), 0: none yet */
+    uint64_t reserved[3];
+} frame_export_header_t;      /* 64 bytes */
+
+typedef struct frame_export_slot_s {
+    uint32_t seq;             /* odd while the slot is being written */
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;          /* bytes per row */
+    uint32_t data_size;       /* bytes of pixel data */
+    uint64_t frame;           /* frame number */
+    uint64_t show_time;       /* nsecs, wall-clock (CLOCK_REALTIME) time at which the frame is shown */
+    uint64_t export_time;     /* nsecs, wall-clock time at which it was written here */
+    uint64_t reserved[2];
+} frame_export_slot_t;        /* 64 bytes */
+
+typedef struct frame_export_s frame_export_t;
+
+/* name is a shm_open name ("/name"): an existing object with that name is replaced; mode is its *
+ * permissions (e.g. FRAME_EXPORT_MODE)                                                          */
+frame_export_t *frame_export_open(logger_t *logger, const char *name, unsigned int mode);
+bool frame_export_write(frame_export_t *export, const uint8_t *data, uint32_t width, uint32_t height, uint32_t stride,
+                        uint64_t show_time);
+uint64_t frame_export_get_frames(frame_export_t *export);
+/* the shared memory object is removed */
+void frame_export_close(frame_export_t *export);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FRAME_EXPORT_H
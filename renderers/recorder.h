@@ -0,0 +1,55 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/* -record: the (still encoded) video and audio received from the client are muxed into an MP4   *
+ * (fragmented) or Matroska file, by a separate GStreamer pipeline; nothing is decoded or encoded. *
+ * The push functions never block: if the recording pipeline falls behind, frames are dropped     *
+ * (video until the next keyframe), leaving the display path unaffected.                          */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+typedef struct recorder_s recorder_t;
+
+/* true if the container for filename (by its extension: .mp4, .mkv) is supported */
+bool recorder_check_filename(const char *filename);
+
+/* audio_ct is the AirPlay audio compression type (2 ALAC, 4 AAC-LC, 8 AAC-ELD), or 0 for no audio track */
+recorder_t *recorder_start(logger_t *logger, const char *filename, bool h265, unsigned char audio_ct);
+
+/* timestamps are local ntp times in nsecs; the recording starts at the first video keyframe */
+void recorder_push_video(recorder_t *recorder, const unsigned char *data, int data_len, bool keyframe, uint64_t ntp_time);
+void recorder_push_audio(recorder_t *recorder, const unsigned char *data, int data_len, unsigned char ct, uint64_t ntp_time);
+
+/* sends end-of-stream and waits (briefly) for the file to be finalized */
+void recorder_stop(recorder_t *recorder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RECORDER_H
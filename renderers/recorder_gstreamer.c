@@ -0,0 +1,275 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include "recorder.h"
+
+#define SECOND_IN_NSECS 1000000000UL
+
+/* data queued in each appsrc beyond which frames are dropped, instead of blocking the caller */
+#define RECORDER_MAX_QUEUE_BYTES (8 * 1024 * 1024)
+/* MP4 fragment duration (ms): a recording interrupted by a crash or power loss is still playable */
+#define RECORDER_FRAGMENT_DURATION 1000
+/* time allowed for the muxer to finish writing the file when the recording is stopped */
+#define RECORDER_EOS_TIMEOUT (3 * SECOND_IN_NSECS)
+
+/* the audio caps are those of audio_renderer_gstreamer.c; the muxers need the channels and rate fields */
+static const char alac_caps[] = "audio/x-alac,channels=(int)2,rate=(int)44100,codec_data=(buffer)"
+                                "00000024""616c6163""00000000""00000160""0010280a""0e0200ff""00000000""00000000""0000ac44";
+static const char aac_lc_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,"
+                                  "codec_data=(buffer)1210";
+static const char aac_eld_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,"
+                                   "codec_data=(buffer)f8e85000";
+
+struct recorder_s {
+    logger_t *logger;
+    GstElement *pipeline;
+    GstElement *video_src;
+    GstElement *audio_src;
+    char *filename;
+    unsigned char audio_ct;
+    bool started;                /* the first keyframe has been received */
+    bool need_keyframe;          /* video frames were dropped: wait for the next keyframe */
+    bool audio_mismatch;         /* audio in another format than that of the audio track has been seen */
+    uint64_t base_time;
+    uint64_t video_frames, audio_frames;
+    uint64_t video_dropped, audio_dropped;
+};
+
+static const char *recorder_get_muxer(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    if (!ext) {
+        return NULL;
+    }
+    if (!g_ascii_strcasecmp(ext, ".mp4") || !g_ascii_strcasecmp(ext, ".m4v")) {
+        return "mp4mux";
+    }
+    if (!g_ascii_strcasecmp(ext, ".mkv")) {
+        return "matroskamux";
+    }
+    return NULL;
+}
+
+bool recorder_check_filename(const char *filename) {
+    return (recorder_get_muxer(filename) != NULL);
+}
+
+static const char *recorder_audio_caps(unsigned char ct) {
+    switch (ct) {
+    case 2:
+        return alac_caps;
+    case 4:
+        return aac_lc_caps;
+    case 8:
+        return aac_eld_caps;
+    default:
+        return NULL;
+    }
+}
+
+static void recorder_free(recorder_t *recorder) {
+    gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+    gst_object_unref(recorder->video_src);
+    if (recorder->audio_src) {
+        gst_object_unref(recorder->audio_src);
+    }
+    gst_object_unref(recorder->pipeline);
+    g_free(recorder->filename);
+    g_free(recorder);
+}
+
+recorder_t *recorder_start(logger_t *logger, const char *filename, bool h265, unsigned char audio_ct) {
+    GError *error = NULL;
+    const char *muxer = recorder_get_muxer(filename);
+    const char *audio_caps = recorder_audio_caps(audio_ct);
+    if (!muxer) {
+        logger_log(logger, LOGGER_ERR, "recording: unsupported container for \"%s\" (use .mp4 or .mkv)", filename);
+        return NULL;
+    }
+
+    GString *launch = g_string_new("appsrc name=record_video ! ");
+    g_string_append(launch, (h265 ? "h265parse" : "h264parse"));
+    g_string_append(launch, " ! mux. ");
+    if (audio_caps) {
+        g_string_append(launch, "appsrc name=record_audio ! mux. ");
+    }
+    g_string_append(launch, muxer);
+    g_string_append(launch, " name=mux");
+    if (!strcmp(muxer, "mp4mux")) {
+        g_string_append_printf(launch, " fragment-duration=%d", RECORDER_FRAGMENT_DURATION);
+    }
+    g_string_append(launch, " ! filesink name=record_sink");
+    logger_log(logger, LOGGER_DEBUG, "GStreamer recording pipeline:\n\"%s\"", launch->str);
+
+    GstElement *pipeline = gst_parse_launch(launch->str, &error);
+    g_string_free(launch, TRUE);
+    if (error) {
+        logger_log(logger, LOGGER_ERR, "recording: GStreamer gst_parse_launch failed to create the pipeline:\n"
+                   "*** error message from gst_parse_launch was:\n%s", error->message);
+        g_clear_error(&error);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        return NULL;
+    }
+
+    recorder_t *recorder = g_new0(recorder_t, 1);
+    recorder->logger = logger;
+    recorder->pipeline = pipeline;
+    recorder->filename = g_strdup(filename);
+    recorder->audio_ct = (audio_caps ? audio_ct : 0);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "record_sink");
+    g_object_set(sink, "location", filename, NULL);
+    gst_object_unref(sink);
+
+    GstCaps *caps = gst_caps_from_string(h265 ? "video/x-h265,stream-format=(string)byte-stream,alignment=(string)au" :
+                                         "video/x-h264,stream-format=(string)byte-stream,alignment=(string)au");
+    recorder->video_src = gst_bin_get_by_name(GST_BIN(pipeline), "record_video");
+    g_object_set(recorder->video_src, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    gst_caps_unref(caps);
+    if (audio_caps) {
+        caps = gst_caps_from_string(audio_caps);
+        recorder->audio_src = gst_bin_get_by_name(GST_BIN(pipeline), "record_audio");
+        g_object_set(recorder->audio_src, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+        gst_caps_unref(caps);
+    }
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        logger_log(logger, LOGGER_ERR, "recording: failed to start the pipeline writing \"%s\"", filename);
+        recorder_free(recorder);
+        return NULL;
+    }
+    logger_log(logger, LOGGER_INFO, "recording %s video%s%s to \"%s\"", (h265 ? "h265" : "h264"),
+               (audio_caps ? " and audio " : ""), (audio_caps ? (audio_ct == 2 ? "(ALAC)" : "(AAC)") : ""), filename);
+    return recorder;
+}
+
+/* the appsrc queue is bounded by a level check (its "block" property stays FALSE): "leaky-type" needs GStreamer >= 1.20 */
+static bool recorder_queue_full(GstElement *appsrc) {
+    return (gst_app_src_get_current_level_bytes(GST_APP_SRC(appsrc)) > RECORDER_MAX_QUEUE_BYTES);
+}
+
+static GstBuffer *recorder_new_buffer(const unsigned char *data, int data_len, GstClockTime pts) {
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, data_len, NULL);
+    g_assert(buffer != NULL);
+    gst_buffer_fill(buffer, 0, data, data_len);
+    GST_BUFFER_PTS(buffer) = pts;
+    GST_BUFFER_DTS(buffer) = pts;   /* AirPlay video has no B-frames */
+    return buffer;
+}
+
+void recorder_push_video(recorder_t *recorder, const unsigned char *data, int data_len, bool keyframe, uint64_t ntp_time) {
+    if (!recorder || data_len <= 0) {
+        return;
+    }
+    if (!recorder->started) {
+        if (!keyframe) {
+            return;
+        }
+        recorder->started = true;
+        recorder->base_time = ntp_time;
+    }
+    if (ntp_time < recorder->base_time) {
+        recorder->video_dropped++;
+        return;
+    }
+    if (recorder_queue_full(recorder->video_src)) {
+        recorder->need_keyframe = true;
+    }
+    if (recorder->need_keyframe) {
+        if (!keyframe || recorder_queue_full(recorder->video_src)) {
+            recorder->video_dropped++;
+            return;
+        }
+        recorder->need_keyframe = false;
+    }
+    GstBuffer *buffer = recorder_new_buffer(data, data_len, (GstClockTime) (ntp_time - recorder->base_time));
+    if (!keyframe) {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    gst_app_src_push_buffer(GST_APP_SRC(recorder->video_src), buffer);
+    recorder->video_frames++;
+}
+
+void recorder_push_audio(recorder_t *recorder, const unsigned char *data, int data_len, unsigned char ct, uint64_t ntp_time) {
+    if (!recorder || !recorder->audio_src || data_len <= 0) {
+        return;
+    }
+    if (ct != recorder->audio_ct) {
+        if (!recorder->audio_mismatch) {
+            logger_log(recorder->logger, LOGGER_INFO, "recording: audio format changed (ct = %d, was %d): not recorded",
+                       (int) ct, (int) recorder->audio_ct);
+            recorder->audio_mismatch = true;
+        }
+        return;
+    }
+    if (!recorder->started || ntp_time < recorder->base_time) {
+        return;    /* audio from before the first keyframe */
+    }
+    if (recorder_queue_full(recorder->audio_src)) {
+        recorder->audio_dropped++;
+        return;
+    }
+    GstBuffer *buffer = recorder_new_buffer(data, data_len, (GstClockTime) (ntp_time - recorder->base_time));
+    gst_app_src_push_buffer(GST_APP_SRC(recorder->audio_src), buffer);
+    recorder->audio_frames++;
+}
+
+void recorder_stop(recorder_t *recorder) {
+    if (!recorder) {
+        return;
+    }
+    if (recorder->started) {
+        gst_app_src_end_of_stream(GST_APP_SRC(recorder->video_src));
+        if (recorder->audio_src) {
+            gst_app_src_end_of_stream(GST_APP_SRC(recorder->audio_src));
+        }
+        GstBus *bus = gst_element_get_bus(recorder->pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, RECORDER_EOS_TIMEOUT,
+                                                     (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        if (!msg) {
+            logger_log(recorder->logger, LOGGER_ERR, "recording: timed out while finalizing \"%s\"", recorder->filename);
+        } else {
+            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+                GError *err;
+                gst_message_parse_error(msg, &err, NULL);
+                logger_log(recorder->logger, LOGGER_ERR, "recording: GStreamer error while writing \"%s\": %s",
+                           recorder->filename, err->message);
+                g_error_free(err);
+            }
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+    }
+    gst_element_set_state(recorder->pipeline, GST_STATE_NULL);   /* closes the file */
+    if (recorder->started) {
+        logger_log(recorder->logger, LOGGER_INFO, "recording \"%s\" closed: %llu video frames (%llu dropped), "
+                   "%llu audio frames (%llu dropped)", recorder->filename, (unsigned long long) recorder->video_frames,
+                   (unsigned long long) recorder->video_dropped, (unsigned long long) recorder->audio_frames,
+                   (unsigned long long) recorder->audio_dropped);
+    } else {
+        /* no keyframe was received: do not leave an empty file */
+        remove(recorder->filename);
+    }
+    recorder_free(recorder);
+}
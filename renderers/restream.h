@@ -0,0 +1,60 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/* -restream: the (still encoded) video and audio of a mirror session are repacketized for       *
+ * remote viewers, without decoding:                                                           *
+ *     rtp://host:port           RTP over UDP (video on port, AAC audio on port + 2)           *
+ *     srt://host:port[?opts]    MPEG-TS over SRT (AAC-LC audio only: AAC-ELD has no ADTS form) *
+ *     whip+http(s)://endpoint   WebRTC (WHIP), video only                                     *
+ * Each output has its own GStreamer pipeline fed from a bounded queue: when an output falls     *
+ * behind, its frames are dropped (video until the next keyframe), and a failed output is        *
+ * closed, without affecting local playback or the other outputs.                              */
+
+#ifndef RESTREAM_H
+#define RESTREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+#define RESTREAM_MAX_OUTPUTS 4
+
+typedef struct restream_s restream_t;
+
+bool restream_check_url(const char *url);
+
+/* audio_ct is the AirPlay audio compression type (4 AAC-LC, 8 AAC-ELD), or 0 for no audio */
+restream_t *restream_start(logger_t *logger, const char * const *urls, int n_urls, bool h265, unsigned char audio_ct);
+
+/* video_buffer, if not NULL, is the zero-copy renderer buffer holding data: it is referenced *
+ * (not copied) by the outputs, and can still be passed on to the local video renderer       */
+void restream_push_video(restream_t *restream, void *video_buffer, unsigned char *data, int data_len, bool keyframe,
+                         uint64_t ntp_time);
+void restream_push_audio(restream_t *restream, const unsigned char *data, int data_len, unsigned char ct, uint64_t ntp_time);
+void restream_stop(restream_t *restream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RESTREAM_H
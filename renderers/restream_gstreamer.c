@@ -0,0 +1,355 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include "restream.h"
+#include "video_renderer.h"
+
+/* data queued for an output beyond which its frames are dropped, instead of blocking the caller */
+#define RESTREAM_MAX_QUEUE_BYTES (4 * 1024 * 1024)
+
+static const char aac_lc_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,"
+                                  "codec_data=(buffer)1210";
+static const char aac_eld_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,"
+                                   "codec_data=(buffer)f8e85000";
+
+typedef enum restream_type_e {
+    RESTREAM_NONE,
+    RESTREAM_RTP,
+    RESTREAM_SRT,
+    RESTREAM_WHIP,
+} restream_type_t;
+
+typedef struct restream_output_s {
+    const char *url;
+    GstElement *pipeline;
+    GstElement *video_src;
+    GstElement *audio_src;
+    GstBus *bus;
+    bool failed;
+    bool need_keyframe;
+    uint64_t video_dropped, audio_dropped;
+} restream_output_t;
+
+struct restream_s {
+    logger_t *logger;
+    restream_output_t output[RESTREAM_MAX_OUTPUTS];
+    int n_outputs;
+    unsigned char audio_ct;
+    bool started;
+    uint64_t base_time;
+    uint64_t video_frames, audio_frames;
+};
+
+static restream_type_t restream_get_type(const char *url) {
+    if (!strncmp(url, "rtp://", 6)) {
+        return RESTREAM_RTP;
+    } else if (!strncmp(url, "srt://", 6)) {
+        return RESTREAM_SRT;
+    } else if (!strncmp(url, "whip+http://", 12) || !strncmp(url, "whip+https://", 13)) {
+        return RESTREAM_WHIP;
+    }
+    return RESTREAM_NONE;
+}
+
+/* rtp://host:port */
+static bool restream_get_host_port(const char *url, char **host, int *port) {
+    const char *start = url + strlen("rtp://");
+    const char *colon = strrchr(start, ':');
+    char *end;
+    if (!colon || colon == start) {
+        return false;
+    }
+    long value = strtol(colon + 1, &end, 10);
+    if (*end || value <= 0 || value > 65533) {
+        return false;
+    }
+    if (host) {
+        *host = g_strndup(start, colon - start);
+        *port = (int) value;
+    }
+    return true;
+}
+
+bool restream_check_url(const char *url) {
+    switch (restream_get_type(url)) {
+    case RESTREAM_RTP:
+        return restream_get_host_port(url, NULL, NULL);
+    case RESTREAM_SRT:
+    case RESTREAM_WHIP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void restream_close_output(restream_output_t *output) {
+    if (output->pipeline) {
+        gst_element_set_state(output->pipeline, GST_STATE_NULL);
+    }
+    if (output->video_src) {
+        gst_object_unref(output->video_src);
+    }
+    if (output->audio_src) {
+        gst_object_unref(output->audio_src);
+    }
+    if (output->bus) {
+        gst_object_unref(output->bus);
+    }
+    if (output->pipeline) {
+        gst_object_unref(output->pipeline);
+    }
+    memset(output, 0, sizeof(restream_output_t));
+}
+
+static bool restream_open_output(restream_t *restream, restream_output_t *output, const char *url, bool h265) {
+    restream_type_t type = restream_get_type(url);
+    const char *audio_caps = NULL;
+    const char *codec = (h265 ? "h265" : "h264");
+    char *host = NULL;
+    int port = 0;
+    GError *error = NULL;
+
+    GString *launch = g_string_new("appsrc name=video_source ! ");
+    g_string_append_printf(launch, "%sparse config-interval=-1 ! ", codec);
+    switch (type) {
+    case RESTREAM_RTP:
+        restream_get_host_port(url, &host, &port);
+        g_string_append_printf(launch, "rtp%spay pt=96 config-interval=-1 ! udpsink name=video_sink sync=false async=false",
+                               codec);
+        if (restream->audio_ct == 4 || restream->audio_ct == 8) {
+            audio_caps = (restream->audio_ct == 4 ? aac_lc_caps : aac_eld_caps);
+            g_string_append(launch, " appsrc name=audio_source ! rtpmp4gpay pt=97 ! udpsink name=audio_sink sync=false async=false");
+        }
+        break;
+    case RESTREAM_SRT:
+        g_string_append(launch, "mpegtsmux name=mux alignment=7 ! srtsink name=video_sink wait-for-connection=false "
+                        "sync=false async=false");
+        if (restream->audio_ct == 4) {
+            audio_caps = aac_lc_caps;
+            g_string_append(launch, " appsrc name=audio_source ! mux.");
+        }
+        break;
+    case RESTREAM_WHIP:
+        if (h265) {
+            logger_log(restream->logger, LOGGER_ERR, "restream: h265 video cannot be sent to WebRTC output %s", url);
+            g_string_free(launch, TRUE);
+            return false;
+        }
+        g_string_append(launch, "rtph264pay pt=96 config-interval=-1 ! "
+                        "application/x-rtp,media=video,encoding-name=H264,payload=96,clock-rate=90000 ! whipsink name=video_sink");
+        break;
+    default:
+        g_string_free(launch, TRUE);
+        return false;
+    }
+    logger_log(restream->logger, LOGGER_DEBUG, "GStreamer restream pipeline for %s:\n\"%s\"", url, launch->str);
+
+    output->url = url;
+    output->pipeline = gst_parse_launch(launch->str, &error);
+    g_string_free(launch, TRUE);
+    if (error) {
+        logger_log(restream->logger, LOGGER_ERR, "restream: GStreamer gst_parse_launch failed to create the pipeline for %s:\n"
+                   "*** error message from gst_parse_launch was:\n%s", url, error->message);
+        g_clear_error(&error);
+        g_free(host);
+        restream_close_output(output);
+        return false;
+    }
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(output->pipeline), "video_sink");
+    switch (type) {
+    case RESTREAM_RTP:
+        g_object_set(sink, "host", host, "port", port, NULL);
+        if (audio_caps) {
+            GstElement *audio_sink = gst_bin_get_by_name(GST_BIN(output->pipeline), "audio_sink");
+            g_object_set(audio_sink, "host", host, "port", port + 2, NULL);
+            gst_object_unref(audio_sink);
+        }
+        break;
+    case RESTREAM_SRT:
+        g_object_set(sink, "uri", url, NULL);
+        break;
+    case RESTREAM_WHIP:
+        g_object_set(sink, "whip-endpoint", url + strlen("whip+"), NULL);
+        break;
+    default:
+        break;
+    }
+    gst_object_unref(sink);
+    g_free(host);
+
+    GstCaps *caps = gst_caps_from_string(h265 ? "video/x-h265,stream-format=(string)byte-stream,alignment=(string)au" :
+                                         "video/x-h264,stream-format=(string)byte-stream,alignment=(string)au");
+    output->video_src = gst_bin_get_by_name(GST_BIN(output->pipeline), "video_source");
+    g_object_set(output->video_src, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    gst_caps_unref(caps);
+    if (audio_caps) {
+        caps = gst_caps_from_string(audio_caps);
+        output->audio_src = gst_bin_get_by_name(GST_BIN(output->pipeline), "audio_source");
+        g_object_set(output->audio_src, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+        gst_caps_unref(caps);
+    }
+    output->bus = gst_element_get_bus(output->pipeline);
+
+    if (gst_element_set_state(output->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        logger_log(restream->logger, LOGGER_ERR, "restream: failed to start the pipeline for %s", url);
+        restream_close_output(output);
+        return false;
+    }
+    logger_log(restream->logger, LOGGER_INFO, "restreaming %s video%s to %s", codec, (audio_caps ? " and AAC audio" : ""), url);
+    return true;
+}
+
+restream_t *restream_start(logger_t *logger, const char * const *urls, int n_urls, bool h265, unsigned char audio_ct) {
+    restream_t *restream = g_new0(restream_t, 1);
+    restream->logger = logger;
+    restream->audio_ct = audio_ct;
+    for (int i = 0; i < n_urls && restream->n_outputs < RESTREAM_MAX_OUTPUTS; i++) {
+        if (restream_open_output(restream, &restream->output[restream->n_outputs], urls[i], h265)) {
+            restream->n_outputs++;
+        }
+    }
+    if (!restream->n_outputs) {
+        g_free(restream);
+        return NULL;
+    }
+    return restream;
+}
+
+/* an output that reported an error is not fed any more; it is closed by restream_stop */
+static bool restream_output_failed(restream_t *restream, restream_output_t *output) {
+    if (!output->failed) {
+        GstMessage *msg = gst_bus_pop_filtered(output->bus, GST_MESSAGE_ERROR);
+        if (msg) {
+            GError *err;
+            gst_message_parse_error(msg, &err, NULL);
+            logger_log(restream->logger, LOGGER_ERR, "restream: output %s failed: %s", output->url, err->message);
+            g_error_free(err);
+            gst_message_unref(msg);
+            output->failed = true;
+        }
+    }
+    return output->failed;
+}
+
+static bool restream_queue_full(GstElement *appsrc) {
+    return (gst_app_src_get_current_level_bytes(GST_APP_SRC(appsrc)) > RESTREAM_MAX_QUEUE_BYTES);
+}
+
+void restream_push_video(restream_t *restream, void *video_buffer, unsigned char *data, int data_len, bool keyframe,
+                         uint64_t ntp_time) {
+    GstBuffer *buffer;
+    if (!restream || data_len <= 0) {
+        return;
+    }
+    if (!restream->started) {
+        if (!keyframe) {
+            return;
+        }
+        restream->started = true;
+        restream->base_time = ntp_time;
+    }
+    if (ntp_time < restream->base_time) {
+        return;
+    }
+
+    /* one GstBuffer for all outputs: the zero-copy renderer buffer is wrapped, not copied */
+    if (video_buffer) {
+        video_renderer_ref_buffer(video_buffer);
+        buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data, data_len, 0, data_len, video_buffer,
+                                             (GDestroyNotify) video_renderer_release_buffer);
+    } else {
+        buffer = gst_buffer_new_allocate(NULL, data_len, NULL);
+        gst_buffer_fill(buffer, 0, data, data_len);
+    }
+    g_assert(buffer != NULL);
+    GST_BUFFER_PTS(buffer) = (GstClockTime) (ntp_time - restream->base_time);
+    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+    if (!keyframe) {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+
+    for (int i = 0; i < restream->n_outputs; i++) {
+        restream_output_t *output = &restream->output[i];
+        if ((keyframe && restream_output_failed(restream, output)) || output->failed) {
+            continue;
+        }
+        if (restream_queue_full(output->video_src)) {
+            output->need_keyframe = true;
+        }
+        if (output->need_keyframe) {
+            if (!keyframe || restream_queue_full(output->video_src)) {
+                output->video_dropped++;
+                continue;
+            }
+            output->need_keyframe = false;
+        }
+        gst_app_src_push_buffer(GST_APP_SRC(output->video_src), gst_buffer_ref(buffer));
+    }
+    gst_buffer_unref(buffer);
+    restream->video_frames++;
+}
+
+void restream_push_audio(restream_t *restream, const unsigned char *data, int data_len, unsigned char ct, uint64_t ntp_time) {
+    GstBuffer *buffer = NULL;
+    if (!restream || !restream->started || ct != restream->audio_ct || data_len <= 0 || ntp_time < restream->base_time) {
+        return;
+    }
+    for (int i = 0; i < restream->n_outputs; i++) {
+        restream_output_t *output = &restream->output[i];
+        if (!output->audio_src || output->failed) {
+            continue;
+        }
+        if (restream_queue_full(output->audio_src)) {
+            output->audio_dropped++;
+            continue;
+        }
+        if (!buffer) {
+            buffer = gst_buffer_new_allocate(NULL, data_len, NULL);
+            g_assert(buffer != NULL);
+            gst_buffer_fill(buffer, 0, data, data_len);
+            GST_BUFFER_PTS(buffer) = (GstClockTime) (ntp_time - restream->base_time);
+        }
+        gst_app_src_push_buffer(GST_APP_SRC(output->audio_src), gst_buffer_ref(buffer));
+    }
+    if (buffer) {
+        gst_buffer_unref(buffer);
+        restream->audio_frames++;
+    }
+}
+
+void restream_stop(restream_t *restream) {
+    if (!restream) {
+        return;
+    }
+    for (int i = 0; i < restream->n_outputs; i++) {
+        restream_output_t *output = &restream->output[i];
+        logger_log(restream->logger, LOGGER_INFO, "restream to %s closed%s: %llu video frames dropped, %llu audio frames dropped",
+                   output->url, (output->failed ? " (failed)" : ""), (unsigned long long) output->video_dropped,
+                   (unsigned long long) output->audio_dropped);
+        restream_close_output(output);
+    }
+    logger_log(restream->logger, LOGGER_DEBUG, "restreamed %llu video frames, %llu audio frames",
+               (unsigned long long) restream->video_frames, (unsigned long long) restream->audio_frames);
+    g_free(restream);
+}
@@ -35,6 +35,7 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include "../lib/logger.h"
+#include "../lib/stream.h"
 
 typedef enum videoflip_e {
     NONE,
@@ -45,21 +46,63 @@ typedef enum videoflip_e {
     HFLIP,
 } videoflip_t;
 
+/* memory used between the decoder and the videosink:  system memory (with CPU-based videoconvert,  *
+ * videoscale), or GPU memory (GLMemory with GL conversion and scaling, or DMABuf) end-to-end         */
+typedef enum video_memory_e {
+    VIDEO_MEMORY_SYSTEM,
+    VIDEO_MEMORY_GL,
+    VIDEO_MEMORY_DMABUF,
+} video_memory_t;
+
 typedef struct video_renderer_s video_renderer_t;
 
-void video_renderer_init (logger_t *logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
-                          const char *decoder, const char *converter, const char *videosink, const bool *fullscreen,
-                          const bool *video_sync);
-void video_renderer_start ();
-void video_renderer_stop ();
-void video_renderer_pause ();
-void video_renderer_resume ();
-bool video_renderer_is_paused();
-void video_renderer_render_buffer (unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time);
-void video_renderer_flush ();
-unsigned int video_renderer_listen(void *loop);
-void video_renderer_destroy ();
-void video_renderer_size(float *width_source, float *height_source, float *width, float *height);
+/* largest size of decoded frames (scaled down after the decoder, in hardware if possible), set before _init (0: no limit) */
+void video_renderer_set_output_size (unsigned short width, unsigned short height);
+/* display refresh rate (Hz) for frame pacing on the vblank grid, set before _init (0: no pacing) */
+void video_renderer_set_refresh_rate (double rate);
+/* -shm: export decoded frames (at most max_fps per second) to the shared memory ring "name" (session n > 0: "name-n"), *
+ * created with permissions mode (-shmmode), see frame_export.h; set before _init (name NULL: no export)              */
+void video_renderer_set_frame_export (const char *name, unsigned int max_fps, unsigned int mode);
+/* each instance (one per client session, id = 0, 1, ...) has its own h264 and (optional) h265 pipelines */
+video_renderer_t *video_renderer_init (int id, logger_t *logger, const char *server_name, videoflip_t videoflip[2],
+                                       const char *parser, const char *decoder, const char *converter,
+                                       const char *videosink, const bool *fullscreen, const bool *video_sync,
+                                       const bool *h265_support, video_memory_t video_memory, const bool *low_latency);
+void video_renderer_start (video_renderer_t *renderer);
+void video_renderer_stop (video_renderer_t *renderer);
+void video_renderer_pause (video_renderer_t *renderer);
+void video_renderer_resume (video_renderer_t *renderer);
+bool video_renderer_is_paused(video_renderer_t *renderer);
+/* latency of the pipeline in use (decoder to display), false if not yet known */
+bool video_renderer_get_latency (video_renderer_t *renderer, uint64_t *nsecs);
+/* a pause lasting msecs releases decoder and videosink resources (0: never, the default) */
+void video_renderer_set_release_delay (video_renderer_t *renderer, unsigned int msecs);
+void video_renderer_render_buffer (video_renderer_t *renderer, unsigned char* data, int *data_len, int *nal_count,
+                                   uint64_t *ntp_time, uint64_t *ntp_time_local, const nal_index_t *nal_index);
+/* zero-copy buffers are pooled, and shared by all instances */
+void *video_renderer_get_buffer (int size, unsigned char **data);
+void video_renderer_release_buffer (void *video_buffer);
+/* a buffer that has been referenced is only returned to the pool by its last release */
+void video_renderer_ref_buffer (void *video_buffer);
+void video_renderer_free_buffers ();
+/* bytes held by free buffers in the pool */
+size_t video_renderer_get_pooled_bytes ();
+void video_renderer_render_wrapped_buffer (video_renderer_t *renderer, void *video_buffer, int *data_len, int *nal_count,
+                                           uint64_t *ntp_time, uint64_t *ntp_time_local, const nal_index_t *nal_index);
+void video_renderer_flush (video_renderer_t *renderer);
+void video_renderer_choose_codec (video_renderer_t *renderer, video_codec_t codec);
+/* announces the stream properties parsed from the SPS (before the first keyframe) in the appsrc caps */
+void video_renderer_set_format (video_renderer_t *renderer, const video_sps_info_t *info);
+unsigned int video_renderer_listen(video_renderer_t *renderer, void *loop, int id);
+void video_renderer_destroy (video_renderer_t *renderer);
+bool video_renderer_reset (video_renderer_t *renderer);
+void video_renderer_suspend (video_renderer_t *renderer);
+bool video_renderer_is_suspended (video_renderer_t *renderer);
+void video_renderer_size(video_renderer_t *renderer, float *width_source, float *height_source, float *width, float *height);
+/* drop late frames before decoding (non-reference frames, or frames up to the next keyframe if very late) */
+void video_renderer_set_late_drop(video_renderer_t *renderer, bool late_drop);
+/* frames pushed into the pipeline, and late buffers dropped (GStreamer QoS, or before decoding), since the last call */
+void video_renderer_get_load(video_renderer_t *renderer, unsigned int *frames, unsigned int *dropped);
   
   /* not implemented for gstreamer */
 void video_renderer_update_background (int type); 
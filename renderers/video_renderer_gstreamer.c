@@ -21,91 +21,215 @@
  */
 
 #include "video_renderer.h"
+#include "../lib/telemetry.h"
+#include "../lib/metrics.h"
+#include "../lib/trace.h"
+#include "display_refresh.h"
+#include "frame_export.h"
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/video/video.h>
+#include <time.h>
 
 #define SECOND_IN_NSECS 1000000000UL
 #ifdef X_DISPLAY_FIX
 #include <gst/video/navigation.h>
 #include "x_display_fix.h"
-static bool fullscreen = false;
-static bool alt_keypress = false;
 #define MAX_X11_SEARCH_ATTEMPTS 5   /*should be less than 256 */
-static unsigned char X11_search_attempts; 
 #endif
 
-static video_renderer_t *renderer = NULL;
-static GstClockTime gst_video_pipeline_base_time = GST_CLOCK_TIME_NONE;
+#define NCODECS 2    /* h264, h265 */
+#define LOW_LATENCY_QUEUE_FRAMES 2
 static logger_t *logger = NULL;
-static unsigned short width, height, width_source, height_source;  /* not currently used */
-static bool first_packet = false;
-static bool sync = false;
+static bool low_latency = false;
 
-struct video_renderer_s {
+/* -downscale: decoded frames larger than this are scaled down (keeping their aspect ratio) right after *
+ * the decoder, by the hardware converter (v4l2convert, vapostproc, ...) or GPU where there is one, so  *
+ * that full-size frames never reach the CPU-based stages (0: no limit)                                 */
+static unsigned short output_width = 0;
+static unsigned short output_height = 0;
+
+/* latency budget: local time (converted from the client NTP timestamp) of a frame to its arrival  *
+ * in video_renderer_render_buffer ("network": receive, decrypt, queue), and from there to its     *
+ * arrival at the videosink ("pipeline": parse, decode, convert).  The frame time travels with the *
+ * buffer as a GstReferenceTimestampMeta.                                                           */
+#define LATENCY_REPORT_FRAMES 300
+typedef struct latency_stats_s {
+    guint64 count;
+    guint64 total;
+    guint64 max;
+} latency_stats_t;
+static GstCaps *frame_time_caps = NULL;
+
+/* late-frame dropping (video_renderer_set_late_drop, with sync=true): the sink pad probe measures how late  *
+ * frames reach the videosink (running time minus PTS).  While they are late by more than DROP_NONREF,       *
+ * access units with only non-reference slices are dropped before decoding; beyond DROP_GOP, every frame is  *
+ * dropped until the next keyframe.  Either way, the decoder does no work for frames the sink would discard. */
+#define LATE_DROP_NONREF_NSECS  20000000ULL   /* 20 ms, the default max-lateness of GStreamer video sinks */
+#define LATE_DROP_GOP_NSECS    500000000ULL
+
+/* pause/resume (the client pauses the stream, by sending new SPS+PPS, when its screen is locked or the app is in *
+ * the background): with a release delay (video_renderer_set_release_delay), a pipeline that is still paused    *
+ * after it is set to READY, so the decoder frees its buffer pools and the videosink its surfaces; the window    *
+ * stays open.  On resume, frames are dropped until a keyframe, which gets the cached SPS+PPS if it lacks them;   *
+ * the time from resume to the first frame at the videosink is measured against RESUME_TARGET.                 */
+#define RESUME_TARGET_NSECS    250000000ULL
+
+/* -pace (video_renderer_set_refresh_rate, with sync=true): decoded frames are put on the display's vblank grid. *
+ * The clock time at which the videosink would show a frame is moved to PACE_MARGIN of a period before the    *
+ * vblank that follows it, so timing jitter cannot make the sink's clock sync put two frames on one vblank, or  *
+ * skip one; a frame landing on the same vblank as the previous frame is dropped (it would be replaced unseen). *
+ * The grid phase comes from DRM vblank times when known, and is re-read every PACE_RESYNC.  A judder event is *
+ * a frame shown for a different number of vblanks than its source duration (or dropped).                     */
+#define PACE_MARGIN_DIVISOR 4
+#define PACE_RESYNC_NSECS (2 * SECOND_IN_NSECS)
+static double refresh_rate = 0.0;
+
+/* -shm (video_renderer_set_frame_export): a tee before the videosink feeds a leaky one-frame queue, converted to *
+ * BGRx for an appsink that writes to the frame_export ring.  Frames are dropped before the queue to keep within  *
+ * export_fps, so the export branch does no conversion work for them, and never holds back the display path.     */
+static char *export_name = NULL;
+static unsigned int export_fps = 0;
+static unsigned int export_mode = FRAME_EXPORT_MODE;
+
+/* pool of reusable memory blocks that the mirror thread can decrypt into directly   *
+ * (zero-copy mode): they are wrapped by GstBuffers, and returned to the pool when the *
+ * GstBuffer is freed by the pipeline.                                                 */
+#define VIDEO_BLOCK_POOL_SIZE 8
+#define VIDEO_BLOCK_ROUNDING 65536
+typedef struct video_block_s {
+    unsigned char *data;
+    size_t size;
+    gint refcount;             /* shared with the -restream outputs */
+    struct video_block_s *next;
+} video_block_t;
+static video_block_t *block_pool = NULL;
+static int block_pool_count = 0;
+static GMutex block_pool_mutex;
+
+/* the GStreamer pipeline for one codec */
+typedef struct video_pipeline_s {
     GstElement *appsrc, *pipeline, *sink;
     GstBus *bus;
+    video_codec_t codec;
+    gulong sink_probe_id;
+    bool v4l2_decoder;               /* needs the bt709 fix with GStreamer < 1.22 */
+    gchar *format_caps;              /* appsrc caps set by video_renderer_set_format */
 #ifdef  X_DISPLAY_FIX
     const char * server_name;  
     X11_Window_t * gst_window;
 #endif
+} video_pipeline_t;
+
+/* a video renderer instance (one per client session): h264 and (optionally) h265 pipelines */
+struct video_renderer_s {
+    int id;
+    char label[16];                /* e.g. " (session 1)" in log messages, empty for session 0 */
+    video_pipeline_t *renderer_type[NCODECS];
+    int n_renderers;
+    video_pipeline_t *renderer;    /* the pipeline in use */
+    GstClockTime base_time;
+    bool first_packet;
+    bool sync;
+    unsigned short width, height, width_source, height_source;  /* not currently used */
+    gpointer loop;                 /* main loop that the bus watches run in */
+    latency_stats_t latency_network, latency_pipeline;
+    GMutex latency_mutex;
+    gint frames_pushed, qos_dropped;   /* for video_renderer_get_load */
+    bool late_drop;
+    bool late_drop_to_idr;             /* used only by the thread pushing buffers */
+    gint64 lateness;                   /* nsecs, of the last frame at the videosink (guarded by latency_mutex) */
+    guint64 late_dropped_nonref, late_dropped_gop;
+    bool suspended;                    /* pipelines set to NULL while idle, until the next video_renderer_start */
+    guint release_delay;               /* msecs a pause lasts before resources are released, 0: never */
+    GMutex pause_mutex;
+    gint paused;                       /* the next three are guarded by pause_mutex */
+    bool released;
+    guint release_source;              /* pending video_renderer_release_callback */
+    bool resume_to_keyframe;           /* used only by the thread pushing buffers: */
+    bool prepend_param_sets;
+    guint64 resume_dropped;
+    GstBuffer *param_sets;             /* last SPS+PPS (h265: VPS+SPS+PPS) pushed */
+    guint64 resume_start;              /* local time of a resume, until its first frame reaches the sink (latency_mutex) */
+    bool resume_released;
+    gint latency;                      /* usecs, of the pipeline in use (latency query), -1 if not known */
+    guint64 pace_period;               /* nsecs per vblank, 0: no pacing; the rest are used by the sink probe: */
+    guint64 pace_phase;                /* clock time of a vblank, modulo pace_period */
+    guint64 pace_resync;               /* clock time of the next phase update */
+    gint64 pace_last_slot;             /* vblank of the previous frame, -1 if none */
+    GstClockTime pace_last_pts;        /* its original PTS */
+    guint64 pace_frames, pace_dropped, pace_judder;
+    frame_export_t *export;            /* -shm, NULL if not exporting */
+    GstClockTime export_last_pts;      /* used only by the tee thread */
+#ifdef X_DISPLAY_FIX
+    bool fullscreen;
+    bool alt_keypress;
+    unsigned char X11_search_attempts;
+#endif
 };
 
-static void append_videoflip (GString *launch, const videoflip_t *flip, const videoflip_t *rot) {
-    /* videoflip image transform */
+/* image transform by the element "flipper" (videoflip, glvideoflip, vapostproc, ...)  */
+static void append_videoflip (GString *launch, const char *flipper, const videoflip_t *flip, const videoflip_t *rot) {
+    const char *direction = NULL;
     switch (*flip) {
     case INVERT:
         switch (*rot)  {
         case LEFT:
-	    g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_90R ! ");
+	    direction = "GST_VIDEO_ORIENTATION_90R";
 	    break;
         case RIGHT:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_90L ! ");
+            direction = "GST_VIDEO_ORIENTATION_90L";
             break;
         default:
-	    g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_180 ! ");
+	    direction = "GST_VIDEO_ORIENTATION_180";
 	    break;
         }
         break;
     case HFLIP:
         switch (*rot) {
         case LEFT:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_UL_LR ! ");
+            direction = "GST_VIDEO_ORIENTATION_UL_LR";
             break;
         case RIGHT: 
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_UR_LL ! ");
+            direction = "GST_VIDEO_ORIENTATION_UR_LL";
             break;
         default:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_HORIZ ! ");
+            direction = "GST_VIDEO_ORIENTATION_HORIZ";
             break;
         }
         break;
     case VFLIP:
         switch (*rot) {
         case LEFT:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_UR_LL ! ");
+            direction = "GST_VIDEO_ORIENTATION_UR_LL";
             break;
         case RIGHT: 
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_UL_LR ! ");
+            direction = "GST_VIDEO_ORIENTATION_UL_LR";
             break;
         default:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_VERT ! ");
+            direction = "GST_VIDEO_ORIENTATION_VERT";
 	  break;
 	}
         break;
     default:
         switch (*rot) {
         case LEFT:
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_90L ! ");
+            direction = "GST_VIDEO_ORIENTATION_90L";
             break;
         case RIGHT: 
-            g_string_append(launch, "videoflip video-direction=GST_VIDEO_ORIENTATION_90R ! ");
+            direction = "GST_VIDEO_ORIENTATION_90R";
             break;
         default:
             break;
         }
         break;
     }
-}	
+    if (direction) {
+        g_string_append_printf(launch, "%s video-direction=%s ! ", flipper, direction);
+    }
+}
 
 /* apple uses colorimetry=1:3:5:1                                *
  * (not recognized by v4l2 plugin in Gstreamer  < 1.20.4)        *
@@ -118,24 +242,486 @@ static void append_videoflip (GString *launch, const videoflip_t *flip, const vi
  * range = 2 -> GST_VIDEO_COLOR_RANGE_16_235 ("limited RGB")     */  
 
 static const char h264_caps[]="video/x-h264,stream-format=(string)byte-stream,alignment=(string)au";
+static const char h265_caps[]="video/x-h265,stream-format=(string)byte-stream,alignment=(string)au";
+
+/* the h265 pipeline uses the h265 versions of the chosen h264 elements (h264parse -> h265parse,  *
+ * avdec_h264 -> avdec_h265, v4l2h264dec -> v4l2h265dec, etc.); "decodebin" is unchanged.          */
+static gchar *h265_element(const char *h264_element) {
+    gchar **parts = g_strsplit(h264_element, "h264", -1);
+    gchar *element = g_strjoinv("h265", parts);
+    g_strfreev(parts);
+    return element;
+}
+
+static bool element_available(const char *name) {
+    GstElementFactory *factory = gst_element_factory_find(name);
+    if (factory) {
+        gst_object_unref(factory);
+        return true;
+    }
+    return false;
+}
+
+/* default videosink for DMABuf video: scanout by kmssink if there is no display server */
+static const char *dmabuf_videosink() {
+    if (getenv("WAYLAND_DISPLAY")) {
+        return "waylandsink";
+    } else if (getenv("DISPLAY")) {
+        return "glimagesink";
+    }
+    return "kmssink";
+}
+
+/* "-vd auto": choose the decoder by probing the GStreamer registry.  Decoders that accept the  *
+ * codec are ranked hardware-first, then by plugin rank; the first one that can be opened      *
+ * (reaches READY state, e.g. finds its device) is used (so software decoders come last), or  *
+ * else decodebin.                                                                            *
+ * The converter and (if left as autovideosink) the videosink are chosen to match it.          */
+
+typedef struct video_converter_match_s {
+    const char *prefix;      /* decoder element name prefix */
+    const char *converter;
+} video_converter_match_t;
+
+static const video_converter_match_t converter_matches[] = {
+    { "v4l2", "v4l2convert" },
+    { "vaapi", "vaapipostproc" },
+    { "va", "vapostproc" },
+    { "d3d11", "d3d11convert" },
+    { "d3d12", "d3d12convert" },
+    { NULL, NULL }
+};
+
+/* the converters chosen for hardware decoders can also scale */
+static bool converter_can_scale(const char *converter) {
+    for (const video_converter_match_t *m = converter_matches; m->prefix; m++) {
+        if (strcmp(converter, m->converter) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* caps limiting the frame size to output_width x output_height (swapped if the video is rotated after it) */
+static void append_output_size(GString *launch, const char *memory, bool rotated) {
+    g_string_append_printf(launch, "capsfilter caps=\"video/x-raw%s,width=(int)[1,%u],height=(int)[1,%u]\" ! ",
+                           memory, (rotated ? output_height : output_width), (rotated ? output_width : output_height));
+}
+
+static bool factory_is_hardware(GstElementFactory *factory) {
+    const gchar *klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    return (klass && strstr(klass, "Hardware"));
+}
+
+static gint compare_decoders(gconstpointer a, gconstpointer b) {
+    bool hw_a = factory_is_hardware(GST_ELEMENT_FACTORY(a));
+    bool hw_b = factory_is_hardware(GST_ELEMENT_FACTORY(b));
+    if (hw_a != hw_b) {
+        return (hw_a ? -1 : 1);
+    }
+    return gst_plugin_feature_rank_compare_func(a, b);
+}
+
+static bool element_can_start(GstElementFactory *factory) {
+    GstElement *element = gst_element_factory_create(factory, NULL);
+    bool ok = false;
+    if (element) {
+        ok = (gst_element_set_state(element, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE);
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_object_unref(element);
+    }
+    return ok;
+}
+
+/* the decoder's source pad caps, if they offer the given memory feature (e.g. "memory:DMABuf") */
+static GstCaps *decoder_src_caps_with_feature(GstElementFactory *factory, const char *feature) {
+    const GList *templates = gst_element_factory_get_static_pad_templates(factory);
+    for (const GList *t = templates; t; t = t->next) {
+        GstStaticPadTemplate *pad_template = (GstStaticPadTemplate *) t->data;
+        if (pad_template->direction != GST_PAD_SRC) {
+            continue;
+        }
+        GstCaps *caps = gst_static_pad_template_get_caps(pad_template);
+        for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+            GstCapsFeatures *features = gst_caps_get_features(caps, i);
+            if (features && gst_caps_features_contains(features, feature)) {
+                return caps;
+            }
+        }
+        gst_caps_unref(caps);
+    }
+    return NULL;
+}
 
-void video_renderer_size(float *f_width_source, float *f_height_source, float *f_width, float *f_height) {
-    width_source = (unsigned short) *f_width_source;
-    height_source = (unsigned short) *f_height_source;
-    width = (unsigned short) *f_width;
-    height = (unsigned short) *f_height;
-    logger_log(logger, LOGGER_DEBUG, "begin video stream wxh = %dx%d; source %dx%d", width, height, width_source, height_source);
+/* a videosink that can take the decoder's output without copying it to system memory */
+static const char *auto_videosink(GstElementFactory *decoder, GString *reason) {
+    const char *wayland = getenv("WAYLAND_DISPLAY");
+    const char *x11 = getenv("DISPLAY");
+    const struct { const char *sink; const char *feature; bool usable; } sinks[] = {
+        { "waylandsink", "memory:DMABuf", wayland != NULL },
+        { "glimagesink", "memory:GLMemory", wayland != NULL || x11 != NULL },
+        { "glimagesink", "memory:DMABuf", wayland != NULL || x11 != NULL },
+        { "kmssink", "memory:DMABuf", wayland == NULL && x11 == NULL },
+    };
+    for (size_t i = 0; i < sizeof(sinks) / sizeof(sinks[0]); i++) {
+        if (!sinks[i].usable) {
+            continue;
+        }
+        GstCaps *caps = decoder_src_caps_with_feature(decoder, sinks[i].feature);
+        if (!caps) {
+            continue;
+        }
+        GstElementFactory *sink = gst_element_factory_find(sinks[i].sink);
+        bool compatible = (sink && gst_element_factory_can_sink_any_caps(sink, caps) && element_can_start(sink));
+        gst_caps_unref(caps);
+        if (sink) {
+            gst_object_unref(sink);
+        }
+        if (compatible) {
+            g_string_append_printf(reason, "; videosink %s accepts its %s output", sinks[i].sink, sinks[i].feature);
+            return sinks[i].sink;
+        }
+    }
+    return NULL;
 }
 
-void  video_renderer_init(logger_t *render_logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
+static gchar *auto_decoder(video_codec_t codec, const char **converter, const char **videosink) {
+    const char *codec_name = (codec == VIDEO_CODEC_H265 ? "h265" : "h264");
+    GstCaps *caps = gst_caps_from_string(codec == VIDEO_CODEC_H265 ? h265_caps : h264_caps);
+    GList *factories = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODER |
+                                                             GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO, GST_RANK_MARGINAL);
+    GList *decoders = gst_element_factory_list_filter(factories, caps, GST_PAD_SINK, FALSE);
+    GString *reason = g_string_new("");
+    gchar *decoder = NULL;
+    gst_plugin_feature_list_free(factories);
+    gst_caps_unref(caps);
+    decoders = g_list_sort(decoders, compare_decoders);
+
+    for (GList *d = decoders; d; d = d->next) {
+        GstElementFactory *factory = GST_ELEMENT_FACTORY(d->data);
+        const gchar *name = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory));
+        const gchar *klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+        bool hardware = factory_is_hardware(factory);
+        if (klass && strstr(klass, "Generic")) {
+            continue;    /* decodebin etc. */
+        }
+        if (!element_can_start(factory)) {
+            logger_log(logger, LOGGER_DEBUG, "%s decoder %s (%s, rank %u) is installed but could not be started",
+                       codec_name, name, (hardware ? "hardware" : "software"),
+                       gst_plugin_feature_get_rank(GST_PLUGIN_FEATURE(factory)));
+            continue;
+        }
+        decoder = g_strdup(name);
+        g_string_append_printf(reason, "%s decoder with the highest rank (%u) that could be started",
+                               (hardware ? "hardware" : "software"),
+                               gst_plugin_feature_get_rank(GST_PLUGIN_FEATURE(factory)));
+        if (hardware && strcmp(*converter, "videoconvert") == 0) {
+            for (const video_converter_match_t *m = converter_matches; m->prefix; m++) {
+                if (strncmp(name, m->prefix, strlen(m->prefix)) == 0) {
+                    if (element_available(m->converter)) {
+                        *converter = m->converter;
+                        g_string_append_printf(reason, "; converter %s matches it", m->converter);
+                    }
+                    break;
+                }
+            }
+        }
+        if (hardware && strcmp(*videosink, "autovideosink") == 0) {
+            const char *sink = auto_videosink(factory, reason);
+            if (sink) {
+                *videosink = sink;
+            }
+        }
+        break;
+    }
+    gst_plugin_feature_list_free(decoders);
+
+    if (!decoder) {
+        decoder = g_strdup("decodebin");
+        g_string_append(reason, "no usable decoder was found in the GStreamer registry");
+    }
+    logger_log(logger, LOGGER_INFO, "auto-selected %s video decoder %s: %s", codec_name, decoder, reason->str);
+    g_string_free(reason, TRUE);
+    return decoder;
+}
+
+static void latency_stats_add(latency_stats_t *stats, guint64 latency) {
+    stats->count++;
+    stats->total += latency;
+    if (latency > stats->max) {
+        stats->max = latency;
+    }
+}
+
+static void latency_stats_log(const char *label, const char *stage, latency_stats_t *stats) {
+    if (stats->count) {
+        logger_log(logger, (low_latency ? LOGGER_INFO : LOGGER_DEBUG),
+                   "video latency%s (%s): mean %.1f ms, max %.1f ms (%llu frames)", label, stage,
+                   (double) stats->total / (1000000.0 * stats->count), (double) stats->max / 1000000.0,
+                   (unsigned long long) stats->count);
+    }
+    memset(stats, 0, sizeof(latency_stats_t));
+}
+
+static guint64 local_time_now() {
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);   /* the local clock used by raop_ntp */
+    return ((guint64) time.tv_sec) * SECOND_IN_NSECS + (guint64) time.tv_nsec;
+}
+
+/* the first frame after a resume has reached the videosink */
+static void video_renderer_resume_done(video_renderer_t *vr) {
+    guint64 elapsed;
+    bool released;
+    g_mutex_lock(&vr->latency_mutex);
+    if (!vr->resume_start) {
+        g_mutex_unlock(&vr->latency_mutex);
+        return;
+    }
+    elapsed = local_time_now() - vr->resume_start;
+    released = vr->resume_released;
+    vr->resume_start = 0;
+    g_mutex_unlock(&vr->latency_mutex);
+    if (!released) {
+        logger_log(logger, LOGGER_DEBUG, "video%s resumed: first frame displayed after %.1f ms", vr->label,
+                   (double) elapsed / 1000000.0);
+        return;
+    }
+    logger_log(logger, (elapsed > RESUME_TARGET_NSECS ? LOGGER_WARNING : LOGGER_INFO),
+               "video%s resumed with released resources: first frame displayed after %.1f ms (target %.0f ms)",
+               vr->label, (double) elapsed / 1000000.0, (double) RESUME_TARGET_NSECS / 1000000.0);
+    metrics_set(METRICS_VIDEO_RESUME_TIME, (int64_t) elapsed);
+}
+
+static GstPadProbeReturn sink_pacing_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint64 period = vr->pace_period;
+    if (!period || !vr->sync || !GST_BUFFER_PTS_IS_VALID(buffer) || vr->base_time == GST_CLOCK_TIME_NONE) {
+        return GST_PAD_PROBE_OK;
+    }
+    gint latency_usecs = g_atomic_int_get(&vr->latency);
+    guint64 offset = vr->base_time + (latency_usecs > 0 ? (guint64) latency_usecs * 1000 : 0);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    guint64 show = offset + pts;    /* clock time at which the sink shows the frame */
+    if (show >= vr->pace_resync) {
+        uint64_t vblank;
+        if (display_refresh_get_vblank(&vblank)) {
+            vr->pace_phase = vblank % period;
+        }
+        vr->pace_resync = show + PACE_RESYNC_NSECS;
+    }
+    guint64 margin = period / PACE_MARGIN_DIVISOR;
+    gint64 slot = (gint64) ((show - vr->pace_phase + period - 1) / period);
+    guint64 paced = vr->pace_phase + (guint64) slot * period - margin;
+    if (paced < offset) {
+        return GST_PAD_PROBE_OK;
+    }
+    vr->pace_frames++;
+    if (vr->pace_last_slot >= 0) {
+        gint64 shown = slot - vr->pace_last_slot;
+        gint64 source = (gint64) ((pts > vr->pace_last_pts ? pts - vr->pace_last_pts : 0) + period / 2) / (gint64) period;
+        if (shown <= 0) {
+            vr->pace_dropped++;
+            vr->pace_judder++;
+            metrics_add(METRICS_VIDEO_JUDDER, 1);
+            return GST_PAD_PROBE_DROP;
+        }
+        if (source > 0 && shown != source) {
+            vr->pace_judder++;
+            metrics_add(METRICS_VIDEO_JUDDER, 1);
+        }
+    }
+    vr->pace_last_slot = slot;
+    vr->pace_last_pts = pts;
+    buffer = gst_buffer_make_writable(buffer);
+    GST_BUFFER_PTS(buffer) = paced - offset;
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    return GST_PAD_PROBE_OK;
+}
+
+static void video_renderer_log_pacing(video_renderer_t *vr) {
+    if (vr->pace_frames) {
+        logger_log(logger, LOGGER_INFO, "video%s pacing: %llu frames on the %.3f Hz vblank grid, %llu judder events"
+                   " (%llu frames dropped)", vr->label, (unsigned long long) vr->pace_frames,
+                   (double) SECOND_IN_NSECS / (double) vr->pace_period, (unsigned long long) vr->pace_judder,
+                   (unsigned long long) vr->pace_dropped);
+    }
+    vr->pace_frames = 0;
+    vr->pace_dropped = 0;
+    vr->pace_judder = 0;
+    vr->pace_last_slot = -1;
+}
+
+/* export_queue sink pad: the rate limit of the exported frames */
+static GstPadProbeReturn export_rate_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_CLOCK_TIME_IS_VALID(vr->export_last_pts) && pts >= vr->export_last_pts &&
+        pts - vr->export_last_pts < SECOND_IN_NSECS / export_fps) {
+        return GST_PAD_PROBE_DROP;
+    }
+    vr->export_last_pts = pts;
+    return GST_PAD_PROBE_OK;
+}
+
+static GstFlowReturn export_new_sample(GstAppSink *appsink, gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    GstVideoInfo video_info;
+    GstVideoFrame frame;
+    if (!sample) {
+        return GST_FLOW_OK;
+    }
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (buffer && gst_video_info_from_caps(&video_info, gst_sample_get_caps(sample)) &&
+        gst_video_frame_map(&frame, &video_info, buffer, GST_MAP_READ)) {
+        guint64 show_time = 0;
+        if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+            /* without sync, the PTS is already the (local) frame time */
+            show_time = GST_BUFFER_PTS(buffer);
+            if (vr->sync) {
+                gint latency = g_atomic_int_get(&vr->latency);
+                show_time += vr->base_time + (latency > 0 ? (guint64) latency * 1000 : 0);
+            }
+        }
+        frame_export_write(vr->export, (const uint8_t *) GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                           GST_VIDEO_FRAME_WIDTH(&frame), GST_VIDEO_FRAME_HEIGHT(&frame),
+                           GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), show_time);
+        gst_video_frame_unmap(&frame);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+/* GstReferenceTimestampMeta needs GStreamer >= 1.14 */
+static GstPadProbeReturn sink_latency_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    video_renderer_resume_done(vr);
+#if GST_CHECK_VERSION(1,14,0)
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstReferenceTimestampMeta *meta = gst_buffer_get_reference_timestamp_meta(buffer, frame_time_caps);
+    if (meta) {
+        guint64 now = local_time_now();
+        g_mutex_lock(&vr->latency_mutex);
+        latency_stats_add(&vr->latency_pipeline, (now > meta->timestamp + meta->duration ? now - meta->timestamp - meta->duration : 0));
+        telemetry_record(TELEMETRY_VIDEO_RENDER, (now > meta->timestamp ? now - meta->timestamp : 0));
+        /* in the streaming thread: arg is the frame's age (usecs) */
+        trace_instant("video", "videosink", (int64_t) ((now > meta->timestamp ? now - meta->timestamp : 0) / 1000));
+        if (vr->sync && GST_BUFFER_PTS_IS_VALID(buffer) && vr->base_time != GST_CLOCK_TIME_NONE) {
+            /* the pipeline clock is the same realtime clock as local_time_now() */
+            vr->lateness = (gint64) (now - vr->base_time) - (gint64) GST_BUFFER_PTS(buffer);
+        }
+        if (vr->latency_pipeline.count == LATENCY_REPORT_FRAMES) {
+            latency_stats_log(vr->label, "network", &vr->latency_network);
+            latency_stats_log(vr->label, "pipeline", &vr->latency_pipeline);
+        }
+        g_mutex_unlock(&vr->latency_mutex);
+    }
+#endif
+    return GST_PAD_PROBE_OK;
+}
+
+/* -lowlatency: properties that stop decoders holding back decoded frames */
+static void set_low_delay_properties(GstElement *element) {
+    const struct { const char *property; const char *value; } properties[] = {
+        { "thread-type", "slice" },       /* avdec_*: frame threading adds a frame of delay per thread */
+        { "low-latency", "true" },        /* vaapi decoders */
+        { "max-display-delay", "0" },     /* nvh264dec etc. */
+        { "disable-dpb", "true" },        /* mppvideodec */
+    };
+    GstElementFactory *factory = gst_element_get_factory(element);
+    const gchar *klass = (factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL);
+    if (!klass || !strstr(klass, "Decoder")) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(properties) / sizeof(properties[0]); i++) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), properties[i].property)) {
+            gst_util_set_object_arg(G_OBJECT(element), properties[i].property, properties[i].value);
+            logger_log(logger, LOGGER_DEBUG, "low latency: set %s %s=%s", GST_ELEMENT_NAME(element),
+                       properties[i].property, properties[i].value);
+        }
+    }
+}
+
+/* -lowlatency: no sink-side buffering (last-sample copy, processing deadline) */
+static void set_sink_low_latency_properties(GstElement *element) {
+    if (!GST_IS_BASE_SINK(element)) {
+        return;
+    }
+    g_object_set(element, "enable-last-sample", FALSE, NULL);
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), "processing-deadline")) {
+        g_object_set(element, "processing-deadline", (guint64) 0, NULL);
+    }
+}
+
+#if GST_CHECK_VERSION(1,10,0)
+/* elements created later inside bins (e.g. by decodebin or autovideosink) */
+static void deep_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    set_low_delay_properties(element);
+    set_sink_low_latency_properties(element);
+}
+#endif
+
+static void apply_low_latency(video_pipeline_t *renderer) {
+    GstIterator *iter = gst_bin_iterate_recurse(GST_BIN(renderer->pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        set_low_delay_properties(element);
+        set_sink_low_latency_properties(element);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iter);
+#if GST_CHECK_VERSION(1,10,0)
+    g_signal_connect(renderer->pipeline, "deep-element-added", G_CALLBACK(deep_element_added), NULL);
+#endif
+
+    /* report no source latency; max-latency stays unlimited (-1), as a finite value smaller than *
+     * the decoder latency would make the pipeline latency impossible to configure               */
+    g_object_set(renderer->appsrc, "min-latency", (gint64) 0, "max-latency", (gint64) -1, NULL);
+}
+
+void video_renderer_size(video_renderer_t *vr, float *f_width_source, float *f_height_source, float *f_width, float *f_height) {
+    vr->width_source = (unsigned short) *f_width_source;
+    vr->height_source = (unsigned short) *f_height_source;
+    vr->width = (unsigned short) *f_width;
+    vr->height = (unsigned short) *f_height;
+    logger_log(logger, LOGGER_DEBUG, "begin video stream wxh = %dx%d; source %dx%d", vr->width, vr->height,
+               vr->width_source, vr->height_source);
+}
+
+video_renderer_t *video_renderer_init(int id, logger_t *render_logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
                           const char *decoder, const char *converter, const char *videosink, const bool *initial_fullscreen,
-                          const bool *video_sync) {
+                          const bool *video_sync, const bool *h265_support, video_memory_t video_memory,
+                          const bool *lowlatency) {
     GError *error = NULL;
     GstCaps *caps = NULL;
     GstClock *clock = gst_system_clock_obtain();
     g_object_set(clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
+    video_renderer_t *vr = calloc(1, sizeof(video_renderer_t));
+    g_assert(vr);
+    vr->id = id;
+    if (id) {
+        g_snprintf(vr->label, sizeof(vr->label), " (session %d)", id);
+    }
+    vr->base_time = GST_CLOCK_TIME_NONE;
+    vr->latency = -1;
+    vr->pace_period = (refresh_rate > 0.0 ? (guint64) ((double) SECOND_IN_NSECS / refresh_rate + 0.5) : 0);
+    vr->pace_last_slot = -1;
+    vr->export_last_pts = GST_CLOCK_TIME_NONE;
+    g_mutex_init(&vr->latency_mutex);
+    g_mutex_init(&vr->pause_mutex);
 
     logger = render_logger;
+    low_latency = *lowlatency;
+    if (!frame_time_caps) {
+        frame_time_caps = gst_caps_from_string("timestamp/x-uxplay-frame-time");
+    }
 
     /* this call to g_set_application_name makes server_name appear in the  X11 display window title bar, */
     /* (instead of the program name uxplay taken from (argv[0]). It is only set one time. */
@@ -144,176 +730,788 @@ void  video_renderer_init(logger_t *render_logger, const char *server_name, vide
     if (!appname || strcmp(appname,server_name))  g_set_application_name(server_name);
     appname = NULL;
 
-    renderer = calloc(1, sizeof(video_renderer_t));
-    g_assert(renderer);
-
-    GString *launch = g_string_new("appsrc name=video_source ! ");
-    g_string_append(launch, "queue ! ");
-    g_string_append(launch, parser);
-    g_string_append(launch, " ! ");
-    g_string_append(launch, decoder);
-    g_string_append(launch, " ! ");
-    append_videoflip(launch, &videoflip[0], &videoflip[1]);
-    g_string_append(launch, converter);
-    g_string_append(launch, " ! ");
-    g_string_append(launch, "videoscale ! ");
-    g_string_append(launch, videosink);
-    g_string_append(launch, " name=video_sink");
-    if (*video_sync) {
-        g_string_append(launch, " sync=true");
-        sync = true;
-    } else {
-        g_string_append(launch, " sync=false");
-        sync = false;
-    }
-    logger_log(logger, LOGGER_DEBUG, "GStreamer video pipeline will be:\n\"%s\"", launch->str);
-    renderer->pipeline = gst_parse_launch(launch->str, &error);
-    if (error) {
-        g_error ("get_parse_launch error (video) :\n %s\n",error->message);
-        g_clear_error (&error);
-    }
-    g_assert (renderer->pipeline);
-    gst_pipeline_use_clock(GST_PIPELINE_CAST(renderer->pipeline), clock);
-
-    renderer->appsrc = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_source");
-    g_assert(renderer->appsrc);
-    caps = gst_caps_from_string(h264_caps);
-    g_object_set(renderer->appsrc, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
-    g_string_free(launch, TRUE);
-    gst_caps_unref(caps);
-    gst_object_unref(clock);
+    if (export_name) {
+        if (id) {
+            gchar *name = g_strdup_printf("%s-%d", export_name, id);
+            vr->export = frame_export_open(logger, name, export_mode);
+            g_free(name);
+        } else {
+            vr->export = frame_export_open(logger, export_name, export_mode);
+        }
+    }
+
+    vr->n_renderers = (*h265_support ? NCODECS : 1);
+    for (int i = 0; i < vr->n_renderers; i++) {
+        video_pipeline_t *renderer = calloc(1, sizeof(video_pipeline_t));
+        g_assert(renderer);
+        vr->renderer_type[i] = renderer;
+        renderer->codec = (video_codec_t) i;
+        gchar *codec_parser = (i == VIDEO_CODEC_H265 ? h265_element(parser) : g_strdup(parser));
+        gchar *codec_decoder = NULL;
+        const char *codec_converter = converter;
+        const char *codec_videosink = videosink;
+        if (strcmp(decoder, "auto") == 0) {
+            codec_decoder = auto_decoder((video_codec_t) i, &codec_converter, &codec_videosink);
+        } else {
+            codec_decoder = (i == VIDEO_CODEC_H265 ? h265_element(decoder) : g_strdup(decoder));
+        }
+
+        renderer->v4l2_decoder = (strstr(codec_decoder, "v4l2") != NULL);
+        bool downscale = (output_width && output_height);
+        bool rotated = (videoflip[1] == LEFT || videoflip[1] == RIGHT);
+
+        GString *launch = g_string_new("appsrc name=video_source ! ");
+        if (low_latency) {
+            /* encoded frames cannot be dropped before the decoder, so this queue is not leaky */
+            g_string_append_printf(launch, "queue max-size-buffers=%d max-size-bytes=0 max-size-time=0 ! ",
+                                   LOW_LATENCY_QUEUE_FRAMES);
+        } else {
+            g_string_append(launch, "queue ! ");
+        }
+        if (strlen(codec_parser)) {
+            /* the parser may be omitted: appsrc provides byte-stream, au-aligned buffers with keyframe flags */
+            g_string_append(launch, codec_parser);
+            g_string_append(launch, " ! ");
+        }
+        /* with no decoder (-bench nodecode), the parsed stream goes straight to the videosink */
+        if (strlen(codec_decoder)) {
+            g_string_append(launch, codec_decoder);
+            g_string_append(launch, " ! ");
+            if (low_latency) {
+                /* decoded frames that the sink cannot keep up with are dropped, oldest first */
+                g_string_append(launch, "queue max-size-buffers=1 max-size-bytes=0 max-size-time=0 leaky=downstream ! ");
+            }
+            switch (video_memory) {
+            case VIDEO_MEMORY_GL:
+                /* glupload imports DMABuf or GLMemory decoder output without a copy */
+                g_string_append(launch, "glupload ! glcolorconvert ! ");
+                append_videoflip(launch, "glvideoflip", &videoflip[0], &videoflip[1]);
+                g_string_append(launch, "glcolorscale ! ");
+                if (downscale) {
+                    append_output_size(launch, "(memory:GLMemory)", false);
+                }
+                if (strcmp(codec_videosink, "autovideosink") == 0) {
+                    codec_videosink = "glimagesink";
+                }
+                break;
+            case VIDEO_MEMORY_DMABUF:
+                g_string_append(launch, "capsfilter caps=\"video/x-raw(memory:DMABuf)\" ! ");
+                if (videoflip[0] != NONE || videoflip[1] != NONE || downscale) {
+                    if (element_available("vapostproc")) {
+                        size_t len = launch->len;
+                        append_videoflip(launch, "vapostproc", &videoflip[0], &videoflip[1]);
+                        if (downscale) {
+                            if (launch->len == len) {
+                                g_string_append(launch, "vapostproc ! ");
+                            }
+                            append_output_size(launch, "(memory:DMABuf)", false);
+                        }
+                    } else {
+                        logger_log(logger, LOGGER_WARNING, "video flips, rotations and -downscale need vapostproc with"
+                                   " DMABuf video, and will not be applied");
+                    }
+                }
+                if (strcmp(codec_videosink, "autovideosink") == 0) {
+                    codec_videosink = dmabuf_videosink();
+                }
+                break;
+            default:
+                if (downscale && !converter_can_scale(codec_converter)) {
+                    if (strncmp(codec_decoder, "nv", 2) == 0 && element_available("cudaconvertscale") &&
+                        element_available("cudadownload")) {
+                        /* nvcodec decoders output CUDA memory if it is accepted */
+                        g_string_append(launch, "cudaconvertscale ! ");
+                        append_output_size(launch, "(memory:CUDAMemory)", false);
+                        g_string_append(launch, "cudadownload ! ");
+                    } else {
+                        /* scaled on the CPU, but before flipping and conversion */
+                        g_string_append(launch, "videoscale ! ");
+                        append_output_size(launch, "", rotated);
+                    }
+                }
+                append_videoflip(launch, "videoflip", &videoflip[0], &videoflip[1]);
+                g_string_append(launch, codec_converter);
+                g_string_append(launch, " ! ");
+                if (downscale && converter_can_scale(codec_converter)) {
+                    append_output_size(launch, "", false);
+                }
+                g_string_append(launch, "videoscale ! ");
+                break;
+            }
+        }
+        /* decoded frames in GPU memory are downloaded for the export branch only */
+        const char *export_download = NULL;
+        if (vr->export && strlen(codec_decoder)) {
+            switch (video_memory) {
+            case VIDEO_MEMORY_GL:
+                export_download = "gldownload ! ";
+                break;
+            case VIDEO_MEMORY_DMABUF:
+                if (element_available("vapostproc")) {
+                    export_download = "vapostproc ! video/x-raw ! ";
+                } else {
+                    logger_log(logger, LOGGER_WARNING, "-shm needs vapostproc with DMABuf video: no frames will be exported");
+                }
+                break;
+            default:
+                export_download = "";
+                break;
+            }
+        }
+        if (export_download) {
+            g_string_append(launch, "tee name=export_tee ! queue ! ");
+        }
+        g_string_append(launch, codec_videosink);
+        if (codec_videosink != videosink && *initial_fullscreen && strcmp(codec_videosink, "waylandsink") == 0) {
+            g_string_append(launch, " fullscreen=true");
+        }
+        g_string_append(launch, " name=video_sink");
+        if (*video_sync) {
+            g_string_append(launch, " sync=true");
+            vr->sync = true;
+        } else {
+            g_string_append(launch, " sync=false");
+            vr->sync = false;
+        }
+        if (export_download) {
+            g_string_append_printf(launch, " export_tee. ! queue name=export_queue max-size-buffers=1 max-size-bytes=0"
+                                   " max-size-time=0 leaky=downstream ! %svideoconvert ! video/x-raw,format=BGRx !"
+                                   " appsink name=export_sink sync=false async=false max-buffers=1 drop=true",
+                                   export_download);
+        }
+        g_free(codec_parser);
+        g_free(codec_decoder);
+        logger_log(logger, (strcmp(decoder, "auto") ? LOGGER_DEBUG : LOGGER_INFO), "GStreamer %s video pipeline%s will be:\n\"%s\"",
+                   (i == VIDEO_CODEC_H265 ? "h265" : "h264"), vr->label, launch->str);
+        renderer->pipeline = gst_parse_launch(launch->str, &error);
+        if (error) {
+            g_error ("get_parse_launch error (video) :\n %s\n",error->message);
+            g_clear_error (&error);
+        }
+        g_assert (renderer->pipeline);
+        gst_pipeline_use_clock(GST_PIPELINE_CAST(renderer->pipeline), clock);
+
+        renderer->appsrc = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_source");
+        g_assert(renderer->appsrc);
+        caps = gst_caps_from_string(i == VIDEO_CODEC_H265 ? h265_caps : h264_caps);
+        g_object_set(renderer->appsrc, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+        g_string_free(launch, TRUE);
+        gst_caps_unref(caps);
 
-    renderer->sink = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_sink");
-    g_assert(renderer->sink);
+        renderer->sink = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_sink");
+        g_assert(renderer->sink);
+        renderer->bus = gst_element_get_bus(renderer->pipeline);
+        if (low_latency) {
+            apply_low_latency(renderer);
+        }
+        GstPad *sink_pad = gst_element_get_static_pad(renderer->sink, "sink");
+        if (sink_pad && refresh_rate > 0.0) {
+            /* before the latency probe, which then sees the paced PTS */
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, sink_pacing_probe, vr, NULL);
+        }
+        if (sink_pad) {
+            renderer->sink_probe_id = gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, sink_latency_probe, vr, NULL);
+            gst_object_unref(sink_pad);
+        }
+        GstElement *export_sink = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "export_sink");
+        if (export_sink) {
+            GstAppSinkCallbacks callbacks = { 0 };
+            callbacks.new_sample = export_new_sample;
+            gst_app_sink_set_callbacks(GST_APP_SINK(export_sink), &callbacks, vr, NULL);
+            gst_object_unref(export_sink);
+            GstElement *export_queue = gst_bin_get_by_name(GST_BIN(renderer->pipeline), "export_queue");
+            GstPad *queue_pad = gst_element_get_static_pad(export_queue, "sink");
+            gst_pad_add_probe(queue_pad, GST_PAD_PROBE_TYPE_BUFFER, export_rate_probe, vr, NULL);
+            gst_object_unref(queue_pad);
+            gst_object_unref(export_queue);
+        }
 
 #ifdef X_DISPLAY_FIX
-    fullscreen = *initial_fullscreen;
-    renderer->server_name = server_name;
-    renderer->gst_window = NULL;
-    bool x_display_fix = false;
-    /* only include X11 videosinks that provide fullscreen mode, or need ZOOMFIX */
-    /* limit searching for X11 Windows in case autovideosink selects an incompatible videosink */
-    if (strncmp(videosink,"autovideosink", strlen("autovideosink")) == 0 ||
-        strncmp(videosink,"ximagesink", strlen("ximagesink")) ==  0 ||
-	strncmp(videosink,"xvimagesink", strlen("xvimagesink")) == 0 ||
-	strncmp(videosink,"fpsdisplaysink", strlen("fpsdisplaysink")) == 0 ) {
-        x_display_fix = true;
-    }
-    if (x_display_fix) {
-        renderer->gst_window = calloc(1, sizeof(X11_Window_t));
-        g_assert(renderer->gst_window);
-        get_X11_Display(renderer->gst_window);
-        if (!renderer->gst_window->display) {
-            free(renderer->gst_window);
-            renderer->gst_window = NULL;
+        vr->fullscreen = *initial_fullscreen;
+        renderer->server_name = server_name;
+        renderer->gst_window = NULL;
+        bool x_display_fix = false;
+        /* only include X11 videosinks that provide fullscreen mode, or need ZOOMFIX */
+        /* limit searching for X11 Windows in case autovideosink selects an incompatible videosink */
+        if (strncmp(codec_videosink,"autovideosink", strlen("autovideosink")) == 0 ||
+            strncmp(codec_videosink,"ximagesink", strlen("ximagesink")) ==  0 ||
+            strncmp(codec_videosink,"xvimagesink", strlen("xvimagesink")) == 0 ||
+            strncmp(codec_videosink,"fpsdisplaysink", strlen("fpsdisplaysink")) == 0 ) {
+            x_display_fix = true;
+        }
+        if (x_display_fix) {
+            renderer->gst_window = calloc(1, sizeof(X11_Window_t));
+            g_assert(renderer->gst_window);
+            get_X11_Display(renderer->gst_window);
+            if (!renderer->gst_window->display) {
+                free(renderer->gst_window);
+                renderer->gst_window = NULL;
+            }
         }
-    }
 #endif
-    gst_element_set_state (renderer->pipeline, GST_STATE_READY);
-    GstState state;
-    if (gst_element_get_state (renderer->pipeline, &state, NULL, 0)) {
-        if (state == GST_STATE_READY) {
-            logger_log(logger, LOGGER_DEBUG, "Initialized GStreamer video renderer");
+        gst_element_set_state (renderer->pipeline, GST_STATE_READY);
+        GstState state;
+        if (gst_element_get_state (renderer->pipeline, &state, NULL, 0)) {
+            if (state == GST_STATE_READY) {
+                logger_log(logger, LOGGER_DEBUG, "Initialized GStreamer video renderer");
+            } else {
+                logger_log(logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
+            }
         } else {
             logger_log(logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
         }
-    } else {
-        logger_log(logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
     }
+    gst_object_unref(clock);
+    vr->renderer = vr->renderer_type[VIDEO_CODEC_H264];
+    return vr;
 }
 
-void video_renderer_pause() {
-    logger_log(logger, LOGGER_DEBUG, "video renderer paused");
-    gst_element_set_state(renderer->pipeline, GST_STATE_PAUSED);
+/* runs in the main loop: the pipeline is still paused after release_delay */
+static gboolean video_renderer_release_callback(gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    g_mutex_lock(&vr->pause_mutex);
+    if (vr->release_source && vr->paused && !vr->released) {
+        gst_element_set_state(vr->renderer->pipeline, GST_STATE_READY);
+        vr->released = true;
+        logger_log(logger, LOGGER_INFO, "video%s paused by the client for %u ms: decoder and videosink resources"
+                   " released", vr->label, vr->release_delay);
+    }
+    vr->release_source = 0;
+    g_mutex_unlock(&vr->pause_mutex);
+    return G_SOURCE_REMOVE;
 }
 
-void video_renderer_resume() {
-    if (video_renderer_is_paused()) {
-        logger_log(logger, LOGGER_DEBUG, "video renderer resumed");
-        gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
-        gst_video_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
+/* call with pause_mutex held */
+static void video_renderer_cancel_release(video_renderer_t *vr) {
+    if (vr->release_source) {
+        g_source_remove(vr->release_source);
+        vr->release_source = 0;
     }
 }
 
-bool video_renderer_is_paused() {
-    GstState state;
-    gst_element_get_state(renderer->pipeline, &state, NULL, 0);
-    return (state == GST_STATE_PAUSED);
+void video_renderer_set_release_delay(video_renderer_t *vr, unsigned int msecs) {
+    vr->release_delay = msecs;
+}
+
+/* pause/resume (PAUSED <-> PLAYING) changes in GStreamer-1.24 break the pipeline: it is then kept PLAYING *
+ * while paused, and only a release (to READY) changes its state                                          */
+void video_renderer_pause(video_renderer_t *vr) {
+    g_mutex_lock(&vr->pause_mutex);
+    if (!vr->paused) {
+        logger_log(logger, LOGGER_DEBUG, "video renderer%s paused", vr->label);
+#if !GST_CHECK_VERSION(1,24,0)
+        gst_element_set_state(vr->renderer->pipeline, GST_STATE_PAUSED);
+#endif
+        g_atomic_int_set(&vr->paused, 1);
+        if (vr->release_delay && !vr->release_source) {
+            vr->release_source = g_timeout_add(vr->release_delay, video_renderer_release_callback, vr);
+        }
+    }
+    g_mutex_unlock(&vr->pause_mutex);
 }
 
-void video_renderer_start() {
-    gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
-    gst_video_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
-    renderer->bus = gst_element_get_bus(renderer->pipeline);
-    first_packet = true;
+/* called before every frame: cheap unless paused */
+void video_renderer_resume(video_renderer_t *vr) {
+    bool released;
+    if (!g_atomic_int_get(&vr->paused)) {
+        return;
+    }
+    g_mutex_lock(&vr->pause_mutex);
+    video_renderer_cancel_release(vr);
+    released = vr->released;
+#if !GST_CHECK_VERSION(1,24,0)
+    released = true;   /* PAUSED */
+#endif
+    if (released) {
+        gst_element_set_state (vr->renderer->pipeline, GST_STATE_PLAYING);
+        vr->base_time = gst_element_get_base_time(vr->renderer->appsrc);
+    }
+    g_mutex_lock(&vr->latency_mutex);
+    vr->resume_start = local_time_now();
+    vr->resume_released = vr->released;
+    g_mutex_unlock(&vr->latency_mutex);
+    if (vr->released) {
+        /* the decoder has lost its state */
+        vr->resume_to_keyframe = true;
+        vr->resume_dropped = 0;
+    }
+    vr->released = false;
+    g_atomic_int_set(&vr->paused, 0);
+    g_mutex_unlock(&vr->pause_mutex);
+    logger_log(logger, LOGGER_DEBUG, "video renderer%s resumed", vr->label);
+}
+
+bool video_renderer_is_paused(video_renderer_t *vr) {
+    return (bool) g_atomic_int_get(&vr->paused);
+}
+
+/* forget any pause, when a pipeline is (re)started or stopped */
+static void video_renderer_clear_pause(video_renderer_t *vr) {
+    g_mutex_lock(&vr->pause_mutex);
+    video_renderer_cancel_release(vr);
+    vr->released = false;
+    g_atomic_int_set(&vr->paused, 0);
+    g_mutex_unlock(&vr->pause_mutex);
+    g_mutex_lock(&vr->latency_mutex);
+    vr->resume_start = 0;
+    g_mutex_unlock(&vr->latency_mutex);
+    vr->resume_to_keyframe = false;
+    vr->prepend_param_sets = false;
+    if (vr->param_sets) {
+        gst_buffer_unref(vr->param_sets);
+        vr->param_sets = NULL;
+    }
+}
+
+/* -lowmem: while idle, all pipelines are set to NULL, releasing their buffer pools (and any hardware *
+ * decoder); the video window is closed.  The renderer is restarted by video_renderer_start.       */
+void video_renderer_suspend(video_renderer_t *vr) {
+    video_renderer_clear_pause(vr);
+    for (int i = 0; i < vr->n_renderers; i++) {
+        gst_element_set_state (vr->renderer_type[i]->pipeline, GST_STATE_NULL);
+    }
+    vr->suspended = true;
+    logger_log(logger, LOGGER_DEBUG, "video renderer%s suspended", vr->label);
+}
+
+bool video_renderer_is_suspended(video_renderer_t *vr) {
+    return vr->suspended;
+}
+
+void video_renderer_start(video_renderer_t *vr) {
+    video_renderer_clear_pause(vr);
+    g_atomic_int_set(&vr->latency, -1);
+    vr->suspended = false;
+    gst_element_set_state (vr->renderer->pipeline, GST_STATE_PLAYING);
+    vr->base_time = gst_element_get_base_time(vr->renderer->appsrc);
+    vr->first_packet = true;
+    vr->late_drop_to_idr = false;
+    vr->pace_last_slot = -1;
+    vr->pace_resync = 0;
+    vr->export_last_pts = GST_CLOCK_TIME_NONE;
+    g_mutex_lock(&vr->latency_mutex);
+    vr->lateness = 0;
+    g_mutex_unlock(&vr->latency_mutex);
 #ifdef X_DISPLAY_FIX
-    X11_search_attempts = 0;
+    vr->X11_search_attempts = 0;
 #endif
 }
 
-void video_renderer_render_buffer(unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time) {
-    GstBuffer *buffer;
-    GstClockTime pts = (GstClockTime) *ntp_time; /*now in nsecs */
-    //GstClockTimeDiff latency = GST_CLOCK_DIFF(gst_element_get_current_clock_time (renderer->appsrc), pts);
-    if (sync) {
-        if (pts >= gst_video_pipeline_base_time) {
-            pts -= gst_video_pipeline_base_time;
+static bool video_renderer_get_pts(video_renderer_t *vr, unsigned char *data, uint64_t *ntp_time, GstClockTime *pts) {
+    *pts = (GstClockTime) *ntp_time; /*now in nsecs */
+    if (vr->sync) {
+        if (*pts >= vr->base_time) {
+            *pts -= vr->base_time;
         } else {
             logger_log(logger, LOGGER_ERR, "*** invalid ntp_time < gst_video_pipeline_base_time\n%8.6f ntp_time\n%8.6f base_time",
-                       ((double) *ntp_time) / SECOND_IN_NSECS, ((double) gst_video_pipeline_base_time) / SECOND_IN_NSECS);
-            return;
+                       ((double) *ntp_time) / SECOND_IN_NSECS, ((double) vr->base_time) / SECOND_IN_NSECS);
+            return false;
         }
     }
-    g_assert(data_len != 0);
     /* first four bytes of valid  h264  video data are 0x00, 0x00, 0x00, 0x01.    *
      * nal_count is the number of NAL units in the data: short SPS, PPS, SEI NALs *
      * may  precede a VCL NAL. Each NAL starts with 0x00 0x00 0x00 0x01 and is    *
      * byte-aligned: the first byte of invalid data (decryption failed) is 0x01   */
     if (data[0]) {
         logger_log(logger, LOGGER_ERR, "*** ERROR decryption of video packet failed ");
-    } else {
-        if (first_packet) {
-            logger_log(logger, LOGGER_INFO, "Begin streaming to GStreamer video pipeline");
-            first_packet = false;
-        }
-        buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
-        g_assert(buffer != NULL);
-        //g_print("video latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
-        if (sync) {
-            GST_BUFFER_PTS(buffer) = pts;
-        }
-        gst_buffer_fill(buffer, 0, data, *data_len);
-        gst_app_src_push_buffer (GST_APP_SRC(renderer->appsrc), buffer);
+        return false;
+    }
+    if (vr->first_packet) {
+        logger_log(logger, LOGGER_INFO, "Begin streaming to GStreamer video pipeline%s", vr->label);
+        vr->first_packet = false;
+    }
+    return true;
+}
+
+/* size of the parameter sets (SPS, PPS, h265 VPS) at the start of an access unit, 0 if there are none */
+static int nal_index_param_sets_size(const nal_index_t *nal_index) {
+    int size = 0;
+    for (int i = 0; i < nal_index->indexed; i++) {
+        unsigned char type = nal_index->nal[i].type;
+        if (nal_index->h265 ? (type < 32 || type > 34) : (type != 7 && type != 8)) {
+            break;
+        }
+        size = nal_index->nal[i].offset + nal_index->nal[i].size;
+    }
+    return size;
+}
+
+/* after resources were released, the decoder needs a keyframe: frames before it are dropped */
+static bool video_renderer_drop_to_resume(video_renderer_t *vr, const nal_index_t *nal_index) {
+    if (!vr->resume_to_keyframe || !nal_index) {
+        return false;
+    }
+    if (!nal_index->keyframe) {
+        vr->resume_dropped++;
+        return true;
+    }
+    vr->resume_to_keyframe = false;
+    vr->prepend_param_sets = !nal_index_param_sets_size(nal_index);
+    if (vr->resume_dropped) {
+        logger_log(logger, LOGGER_DEBUG, "video%s: %llu frames before the first keyframe after resuming were dropped",
+                   vr->label, (unsigned long long) vr->resume_dropped);
+    }
+    return false;
+}
+
+static void video_renderer_push_buffer(video_renderer_t *vr, GstBuffer *buffer, GstClockTime pts, uint64_t *ntp_time_local,
+                                       const nal_index_t *nal_index) {
+    video_pipeline_t *renderer = vr->renderer;
+    if (vr->prepend_param_sets) {
+        vr->prepend_param_sets = false;
+        if (vr->param_sets) {
+            buffer = gst_buffer_append(gst_buffer_copy(vr->param_sets), buffer);
+        }
+    } else if (nal_index) {
+        int size = nal_index_param_sets_size(nal_index);
+        if (size) {
+            if (vr->param_sets) {
+                gst_buffer_unref(vr->param_sets);
+            }
+            vr->param_sets = gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY | GST_BUFFER_COPY_DEEP, 0, size);
+        }
+    }
+    //g_print("video latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
+    if (vr->sync) {
+        GST_BUFFER_PTS(buffer) = pts;
+    }
+#if GST_CHECK_VERSION(1,14,0)
+    if (ntp_time_local && *ntp_time_local) {
+        /* the meta duration is the time already spent before the buffer entered the pipeline */
+        guint64 now = local_time_now();
+        guint64 network = (now > *ntp_time_local ? now - *ntp_time_local : 0);
+        gst_buffer_add_reference_timestamp_meta(buffer, frame_time_caps, *ntp_time_local, network);
+        g_mutex_lock(&vr->latency_mutex);
+        latency_stats_add(&vr->latency_network, network);
+        g_mutex_unlock(&vr->latency_mutex);
+        telemetry_record(TELEMETRY_VIDEO_PUSH, network);
+    }
+#endif
+    /* the NAL index was made by the mirror thread: no need for the parser to rescan for IDR frames */
+    if (nal_index && !nal_index->keyframe) {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    uint64_t trace_start = trace_begin();
+    gsize size = (trace_start ? gst_buffer_get_size(buffer) : 0);
+    gst_app_src_push_buffer (GST_APP_SRC(renderer->appsrc), buffer);
+    trace_span("video", "appsrc push", trace_start, (int64_t) size);
+    g_atomic_int_inc(&vr->frames_pushed);
 #ifdef X_DISPLAY_FIX
-        if (renderer->gst_window && !(renderer->gst_window->window) && X11_search_attempts < MAX_X11_SEARCH_ATTEMPTS) {
-            X11_search_attempts++;
-            logger_log(logger, LOGGER_DEBUG, "Looking for X11 UxPlay Window, attempt %d", (int) X11_search_attempts);
-            get_x_window(renderer->gst_window, renderer->server_name);
-	    if (renderer->gst_window->window) {
-                logger_log(logger, LOGGER_INFO, "\n*** X11 Windows: Use key F11 or (left Alt)+Enter to toggle full-screen mode\n");
-                if (fullscreen) {
-                    set_fullscreen(renderer->gst_window, &fullscreen);
-                }
-            } else if (X11_search_attempts == MAX_X11_SEARCH_ATTEMPTS) {
-	      logger_log(logger, LOGGER_DEBUG, "X11 UxPlay Window not found in %d search attempts", MAX_X11_SEARCH_ATTEMPTS);
+    if (renderer->gst_window && !(renderer->gst_window->window) && vr->X11_search_attempts < MAX_X11_SEARCH_ATTEMPTS) {
+        vr->X11_search_attempts++;
+        logger_log(logger, LOGGER_DEBUG, "Looking for X11 UxPlay Window, attempt %d", (int) vr->X11_search_attempts);
+        get_x_window(renderer->gst_window, renderer->server_name);
+        if (renderer->gst_window->window) {
+            logger_log(logger, LOGGER_INFO, "\n*** X11 Windows: Use key F11 or (left Alt)+Enter to toggle full-screen mode\n");
+            if (vr->fullscreen) {
+                set_fullscreen(renderer->gst_window, &vr->fullscreen);
             }
+        } else if (vr->X11_search_attempts == MAX_X11_SEARCH_ATTEMPTS) {
+            logger_log(logger, LOGGER_DEBUG, "X11 UxPlay Window not found in %d search attempts", MAX_X11_SEARCH_ATTEMPTS);
         }
+    }
 #endif
+}
+
+/* true if every slice of the access unit is a non-reference picture, so no other frame depends on it */
+static bool nal_index_is_droppable(const nal_index_t *nal_index) {
+    bool vcl = false;
+    if (nal_index->keyframe || nal_index->indexed < nal_index->count) {
+        return false;
+    }
+    for (int i = 0; i < nal_index->indexed; i++) {
+        const nal_unit_info_t *nal = &nal_index->nal[i];
+        if (nal_index->h265 ? (nal->type < 32) : (nal->type >= 1 && nal->type <= 5)) {
+            if (nal->ref_idc) {
+                return false;
+            }
+            vcl = true;
+        }
+    }
+    return vcl;
+}
+
+static bool video_renderer_drop_late(video_renderer_t *vr, const nal_index_t *nal_index) {
+    gint64 lateness;
+    if (!vr->late_drop || !vr->sync || !nal_index) {
+        return false;
     }
+    if (nal_index->keyframe) {
+        if (vr->late_drop_to_idr) {
+            vr->late_drop_to_idr = false;
+            g_mutex_lock(&vr->latency_mutex);
+            vr->lateness = 0;   /* the measurement is stale until frames reach the sink again */
+            g_mutex_unlock(&vr->latency_mutex);
+        }
+        return false;
+    }
+    g_mutex_lock(&vr->latency_mutex);
+    lateness = vr->lateness;
+    g_mutex_unlock(&vr->latency_mutex);
+    if (!vr->late_drop_to_idr && lateness > (gint64) LATE_DROP_GOP_NSECS) {
+        logger_log(logger, LOGGER_DEBUG, "video%s is %.0f ms late: dropping frames until the next keyframe",
+                   vr->label, (double) lateness / 1000000.0);
+        vr->late_drop_to_idr = true;
+    }
+    if (vr->late_drop_to_idr) {
+        vr->late_dropped_gop++;
+    } else if (lateness > (gint64) LATE_DROP_NONREF_NSECS && nal_index_is_droppable(nal_index)) {
+        vr->late_dropped_nonref++;
+    } else {
+        return false;
+    }
+    g_atomic_int_inc(&vr->qos_dropped);   /* counts as overload for video_renderer_get_load */
+    metrics_add(METRICS_VIDEO_LATE_DROPPED, 1);
+    return true;
 }
 
-void video_renderer_flush() {
+static void video_renderer_log_late_drops(video_renderer_t *vr) {
+    if (vr->late_dropped_nonref || vr->late_dropped_gop) {
+        logger_log(logger, LOGGER_INFO, "video%s: %llu late non-reference frames and %llu frames before keyframes"
+                   " were dropped before decoding", vr->label, (unsigned long long) vr->late_dropped_nonref,
+                   (unsigned long long) vr->late_dropped_gop);
+    }
+    vr->late_dropped_nonref = 0;
+    vr->late_dropped_gop = 0;
+    vr->late_drop_to_idr = false;
+    vr->lateness = 0;
 }
 
-void video_renderer_stop() {
-  if (renderer) {
-            gst_app_src_end_of_stream (GST_APP_SRC(renderer->appsrc));
-	    gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
+void video_renderer_set_frame_export(const char *name, unsigned int max_fps, unsigned int mode) {
+    g_free(export_name);
+    export_name = (name ? g_strdup(name) : NULL);
+    export_fps = (max_fps ? max_fps : 1);
+    export_mode = mode;
+}
+
+void video_renderer_set_refresh_rate(double rate) {
+    refresh_rate = rate;
+}
+
+void video_renderer_set_output_size(unsigned short width, unsigned short height) {
+    output_width = width;
+    output_height = height;
+}
+
+void video_renderer_set_late_drop(video_renderer_t *vr, bool late_drop) {
+    vr->late_drop = late_drop;
+    if (late_drop && !vr->sync) {
+        logger_log(logger, LOGGER_WARNING, "late-frame dropping needs video sync, and has no effect with -vsync no");
+    }
+}
+
+void video_renderer_render_buffer(video_renderer_t *vr, unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time,
+                                  uint64_t *ntp_time_local, const nal_index_t *nal_index) {
+    GstBuffer *buffer;
+    GstClockTime pts;
+    g_assert(data_len != 0);
+    if (!video_renderer_get_pts(vr, data, ntp_time, &pts) || video_renderer_drop_to_resume(vr, nal_index) ||
+        video_renderer_drop_late(vr, nal_index)) {
+        return;
+    }
+    buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
+    g_assert(buffer != NULL);
+    gst_buffer_fill(buffer, 0, data, *data_len);
+    video_renderer_push_buffer(vr, buffer, pts, ntp_time_local, nal_index);
+}
+
+/* zero-copy mode: hand out a pooled memory block of at least "size" bytes,  *
+ * which is later wrapped (not copied) into a GstBuffer                      */
+void *video_renderer_get_buffer(int size, unsigned char **data) {
+    video_block_t *block = NULL;
+    video_block_t **prev;
+    g_assert(size > 0);
+    g_mutex_lock(&block_pool_mutex);
+    for (prev = &block_pool; *prev; prev = &((*prev)->next)) {
+        if ((*prev)->size >= (size_t) size) {
+            block = *prev;
+            *prev = block->next;
+            block_pool_count--;
+            break;
+        }
+    }
+    g_mutex_unlock(&block_pool_mutex);
+    if (!block) {
+        block = (video_block_t *) calloc(1, sizeof(video_block_t));
+        g_assert(block);
+        block->size = ((size + VIDEO_BLOCK_ROUNDING - 1) / VIDEO_BLOCK_ROUNDING) * VIDEO_BLOCK_ROUNDING;
+        block->data = (unsigned char *) malloc(block->size);
+        g_assert(block->data);
+    }
+    block->next = NULL;
+    block->refcount = 1;
+    *data = block->data;
+    return (void *) block;
+}
+
+void video_renderer_ref_buffer(void *video_buffer) {
+    video_block_t *block = (video_block_t *) video_buffer;
+    g_atomic_int_inc(&block->refcount);
+}
+
+/* return a block to the pool; called by GStreamer when the wrapping buffer is freed */
+void video_renderer_release_buffer(void *video_buffer) {
+    video_block_t *block = (video_block_t *) video_buffer;
+    if (!block || !g_atomic_int_dec_and_test(&block->refcount)) {
+        return;
+    }
+    g_mutex_lock(&block_pool_mutex);
+    if (block_pool_count < VIDEO_BLOCK_POOL_SIZE) {
+        block->next = block_pool;
+        block_pool = block;
+        block_pool_count++;
+        block = NULL;
+    }
+    g_mutex_unlock(&block_pool_mutex);
+    if (block) {
+        free(block->data);
+        free(block);
+    }
+}
+
+void video_renderer_render_wrapped_buffer(video_renderer_t *vr, void *video_buffer, int *data_len, int *nal_count, uint64_t *ntp_time,
+                                          uint64_t *ntp_time_local, const nal_index_t *nal_index) {
+    video_block_t *block = (video_block_t *) video_buffer;
+    GstBuffer *buffer;
+    GstClockTime pts;
+    g_assert(block && *data_len <= (int) block->size);
+    if (!video_renderer_get_pts(vr, block->data, ntp_time, &pts) || video_renderer_drop_to_resume(vr, nal_index) ||
+        video_renderer_drop_late(vr, nal_index)) {
+        video_renderer_release_buffer(video_buffer);
+        return;
+    }
+    buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, block->data, block->size, 0, *data_len,
+                                         video_buffer, (GDestroyNotify) video_renderer_release_buffer);
+    g_assert(buffer != NULL);
+    video_renderer_push_buffer(vr, buffer, pts, ntp_time_local, nal_index);
+}
+
+/* switch to the h264 or h265 pipeline, when the client starts a stream with a different codec */
+void video_renderer_choose_codec(video_renderer_t *vr, video_codec_t codec) {
+    int id = (int) codec;
+    if (id >= vr->n_renderers) {
+        logger_log(logger, LOGGER_ERR, "*** h265 video was received, but h265 support was not enabled (use option -h265)");
+        return;
+    }
+    if (vr->renderer == vr->renderer_type[id]) {
+        return;
+    }
+    logger_log(logger, LOGGER_INFO, "switching GStreamer video pipeline%s to %s video", vr->label,
+               (id == VIDEO_CODEC_H265 ? "h265" : "h264"));
+    if (vr->renderer) {
+        gst_app_src_end_of_stream (GST_APP_SRC(vr->renderer->appsrc));
+        gst_element_set_state (vr->renderer->pipeline, GST_STATE_NULL);
+    }
+    vr->renderer = vr->renderer_type[id];
+    video_renderer_start(vr);
+}
+
+/* the stream properties from the SPS are added to the appsrc caps before the first keyframe, so the  *
+ * decoder (which may follow appsrc directly, with no parser) can size its output pool once, without   *
+ * renegotiating when decoding starts.  Older v4l2 decoders (GStreamer < 1.22) reject the full-range    *
+ * bt709 colorimetry used by Apple clients: limited-range bt709 is then announced (as with -bt709).     */
+void video_renderer_set_format(video_renderer_t *vr, const video_sps_info_t *info) {
+    video_pipeline_t *renderer = vr->renderer_type[info->h265 ? VIDEO_CODEC_H265 : VIDEO_CODEC_H264];
+    if (!renderer || (info->h265 && vr->n_renderers < NCODECS)) {
+        return;
+    }
+    guint major, minor, micro, nano;
+    gst_version(&major, &minor, &micro, &nano);
+    GstCaps *caps = gst_caps_from_string(info->h265 ? h265_caps : h264_caps);
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, info->width, "height", G_TYPE_INT, info->height, NULL);
+    if (info->sar_width && info->sar_height) {
+        gst_caps_set_simple(caps, "pixel-aspect-ratio", GST_TYPE_FRACTION, info->sar_width, info->sar_height, NULL);
+    }
+    /* AirPlay mirroring has a variable framerate: VUI timing gives the maximum unless fixed_frame_rate is set */
+    if (info->fps_num && info->fixed_frame_rate) {
+        gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, info->fps_num, info->fps_den, NULL);
+    } else {
+        gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+    }
+    if (info->colour_description) {
+        if (renderer->v4l2_decoder && info->full_range && info->matrix_coefficients == 1 &&
+            major == 1 && minor < 22) {
+            gst_caps_set_simple(caps, "colorimetry", G_TYPE_STRING, "bt709", NULL);
+            logger_log(logger, LOGGER_INFO, "full-range bt709 video: applying the bt709 fix for the v4l2 decoder");
+        } else {
+#if GST_CHECK_VERSION(1,18,0)
+            GstVideoColorimetry colorimetry;
+            colorimetry.range = (info->full_range ? GST_VIDEO_COLOR_RANGE_0_255 : GST_VIDEO_COLOR_RANGE_16_235);
+            colorimetry.matrix = gst_video_color_matrix_from_iso(info->matrix_coefficients);
+            colorimetry.transfer = gst_video_transfer_function_from_iso(info->transfer_characteristics);
+            colorimetry.primaries = gst_video_color_primaries_from_iso(info->colour_primaries);
+            gchar *str = gst_video_colorimetry_to_string(&colorimetry);
+            if (str) {
+                gst_caps_set_simple(caps, "colorimetry", G_TYPE_STRING, str, NULL);
+                g_free(str);
+            }
+#endif
+        }
+    }
+    gchar *str = gst_caps_to_string(caps);
+    if (g_strcmp0(str, renderer->format_caps)) {
+        logger_log(logger, LOGGER_DEBUG, "video caps%s from the SPS: %s", vr->label, str);
+        g_object_set(renderer->appsrc, "caps", caps, NULL);
+        g_free(renderer->format_caps);
+        renderer->format_caps = str;
+    } else {
+        g_free(str);
+    }
+    gst_caps_unref(caps);
+}
+
+void video_renderer_flush(video_renderer_t *vr) {
+}
+
+void video_renderer_stop(video_renderer_t *vr) {
+  video_renderer_clear_pause(vr);
+  if (vr->renderer) {
+            gst_app_src_end_of_stream (GST_APP_SRC(vr->renderer->appsrc));
+	    gst_element_set_state (vr->renderer->pipeline, GST_STATE_NULL);
   }   
 }
 
-void video_renderer_destroy() {
-    if (renderer) {
+/* prepares the existing pipelines for a new connection, instead of destroying and rebuilding *
+ * them (which is slow with hardware decoders, and with -vd auto): the pipelines are stopped  *
+ * (closing the video window) and brought back to READY; returns false if this fails         */
+bool video_renderer_reset(video_renderer_t *vr) {
+    video_renderer_clear_pause(vr);
+    for (int i = 0; i < vr->n_renderers; i++) {
+        video_pipeline_t *r = vr->renderer_type[i];
+        GstState state;
+        gst_element_get_state(r->pipeline, &state, NULL, 0);
+        if (state != GST_STATE_NULL) {
+            gst_app_src_end_of_stream (GST_APP_SRC(r->appsrc));
+            gst_element_set_state (r->pipeline, GST_STATE_NULL);
+        }
+        if (gst_element_set_state (r->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+            logger_log(logger, LOGGER_ERR, "failed to reset GStreamer video pipeline");
+            return false;
+        }
+        /* discard any messages from the previous connection */
+        gst_bus_set_flushing(r->bus, TRUE);
+        gst_bus_set_flushing(r->bus, FALSE);
+#ifdef X_DISPLAY_FIX
+        if (r->gst_window) {
+            r->gst_window->window = (Window) NULL;   /* the videosink will open a new window */
+        }
+#endif
+    }
+    vr->renderer = vr->renderer_type[VIDEO_CODEC_H264];
+    g_mutex_lock(&vr->latency_mutex);
+    video_renderer_log_late_drops(vr);
+    video_renderer_log_pacing(vr);
+    memset(&vr->latency_network, 0, sizeof(latency_stats_t));
+    memset(&vr->latency_pipeline, 0, sizeof(latency_stats_t));
+    g_mutex_unlock(&vr->latency_mutex);
+    logger_log(logger, LOGGER_DEBUG, "GStreamer video renderer was reset for reuse");
+    return true;
+}
+
+void video_renderer_destroy(video_renderer_t *vr) {
+    video_renderer_clear_pause(vr);
+    for (int i = 0; i < vr->n_renderers; i++) {
+        video_pipeline_t *renderer = vr->renderer_type[i];
         GstState state;
         gst_element_get_state(renderer->pipeline, &state, NULL, 0);
         if (state != GST_STATE_NULL) {
@@ -330,16 +1528,58 @@ void video_renderer_destroy() {
             renderer->gst_window = NULL;
         }
 #endif    
+        g_free(renderer->format_caps);
         free (renderer);
-        renderer = NULL;
+        vr->renderer_type[i] = NULL;
+    }
+    video_renderer_log_late_drops(vr);
+    video_renderer_log_pacing(vr);
+    if (vr->export) {
+        logger_log(logger, LOGGER_INFO, "video%s: %llu frames were exported to shared memory (-shm)", vr->label,
+                   (unsigned long long) frame_export_get_frames(vr->export));
+        frame_export_close(vr->export);
     }
+    g_mutex_clear(&vr->latency_mutex);
+    g_mutex_clear(&vr->pause_mutex);
+    free(vr);
+}
+
+/* frees the pooled zero-copy blocks: all video pipelines must first have been destroyed *
+ * (NULL state), so that all wrapped blocks have been returned                            */
+void video_renderer_free_buffers() {
+    g_mutex_lock(&block_pool_mutex);
+    while (block_pool) {
+        video_block_t *block = block_pool;
+        block_pool = block->next;
+        free(block->data);
+        free(block);
+    }
+    block_pool_count = 0;
+    g_mutex_unlock(&block_pool_mutex);
+}
+
+size_t video_renderer_get_pooled_bytes() {
+    size_t bytes = 0;
+    g_mutex_lock(&block_pool_mutex);
+    for (video_block_t *block = block_pool; block; block = block->next) {
+        bytes += block->size;
+    }
+    g_mutex_unlock(&block_pool_mutex);
+    return bytes;
+}
+
+void video_renderer_get_load(video_renderer_t *vr, unsigned int *frames, unsigned int *dropped) {
+    *frames = (unsigned int) g_atomic_int_and((guint *) &vr->frames_pushed, 0);
+    *dropped = (unsigned int) g_atomic_int_and((guint *) &vr->qos_dropped, 0);
 }
 
 /* not implemented for gstreamer */
 void video_renderer_update_background(int type) {
 }
 
-gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpointer loop) {
+static gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpointer user_data) {
+    video_renderer_t *vr = (video_renderer_t *) user_data;
+    video_pipeline_t *renderer = vr->renderer;
     switch (GST_MESSAGE_TYPE (message)) {
     case GST_MESSAGE_ERROR: {
         GError *err;
@@ -363,9 +1603,21 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
 	flushing = TRUE;
         gst_bus_set_flushing(bus, flushing);
  	gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
-	g_main_loop_quit( (GMainLoop *) loop);
+	g_main_loop_quit( (GMainLoop *) vr->loop);
         break;
     }
+    case GST_MESSAGE_QOS:
+        /* posted by an element (e.g. the videosink) each time it drops a late buffer */
+        metrics_add(METRICS_VIDEO_QOS_DROPPED, 1);
+        g_atomic_int_inc(&vr->qos_dropped);
+        break;
+    case GST_MESSAGE_LATENCY:
+        gst_bin_recalculate_latency(GST_BIN(renderer->pipeline));
+        video_renderer_query_latency(vr, renderer->pipeline);
+        break;
+    case GST_MESSAGE_ASYNC_DONE:
+        video_renderer_query_latency(vr, renderer->pipeline);
+        break;
     case GST_MESSAGE_EOS:
       /* end-of-stream */
          logger_log(logger, LOGGER_INFO, "GStreamer: End-Of-Stream");
@@ -383,18 +1635,18 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
                     switch (event_type) {
                     case GST_NAVIGATION_EVENT_KEY_PRESS:
                         if (gst_navigation_event_parse_key_event (event, &key)) {
-                            if ((strcmp (key, "F11") == 0) || (alt_keypress && strcmp (key, "Return") == 0)) {
-                                fullscreen = !(fullscreen);
-                                set_fullscreen(renderer->gst_window, &fullscreen);
+                            if ((strcmp (key, "F11") == 0) || (vr->alt_keypress && strcmp (key, "Return") == 0)) {
+                                vr->fullscreen = !(vr->fullscreen);
+                                set_fullscreen(renderer->gst_window, &vr->fullscreen);
                             } else if (strcmp (key, "Alt_L") == 0) {
-                                alt_keypress = true;
+                                vr->alt_keypress = true;
                             }
                         }
                         break;
                     case GST_NAVIGATION_EVENT_KEY_RELEASE:
                         if (gst_navigation_event_parse_key_event (event, &key)) {
                             if (strcmp (key, "Alt_L") == 0) {
-                                alt_keypress = false;
+                                vr->alt_keypress = false;
                             }
                         }
                     default:
@@ -415,7 +1667,39 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
     return TRUE;
 }
 
-unsigned int video_renderer_listen(void *loop) {
-    return (unsigned int) gst_bus_add_watch(renderer->bus, (GstBusFunc)
-                                            gstreamer_pipeline_bus_callback, (gpointer) loop);    
+/* the pipeline latency (decoder, converter and videosink), computed by GStreamer when the pipeline  *
+ * starts playing and again when an element reports a change (e.g., the decoder after new caps)     */
+static void video_renderer_query_latency(video_renderer_t *vr, GstElement *pipeline) {
+    GstQuery *query = gst_query_new_latency();
+    if (gst_element_query(pipeline, query)) {
+        gboolean live;
+        GstClockTime min, max;
+        gst_query_parse_latency(query, &live, &min, &max);
+        if (GST_CLOCK_TIME_IS_VALID(min)) {
+            gint usecs = (gint) (min / GST_USECOND);
+            if (g_atomic_int_get(&vr->latency) != usecs) {
+                logger_log(logger, LOGGER_DEBUG, "video pipeline%s latency %.1f ms", vr->label, (double) usecs / 1000.0);
+            }
+            g_atomic_int_set(&vr->latency, usecs);
+        }
+    }
+    gst_query_unref(query);
+}
+
+bool video_renderer_get_latency(video_renderer_t *vr, uint64_t *nsecs) {
+    gint usecs = g_atomic_int_get(&vr->latency);
+    if (usecs < 0) {
+        return false;
+    }
+    *nsecs = (uint64_t) usecs * 1000;
+    return true;
+}
+
+unsigned int video_renderer_listen(video_renderer_t *vr, void *loop, int id) {
+    if (id < 0 || id >= vr->n_renderers) {
+        return 0;
+    }
+    vr->loop = (gpointer) loop;
+    return (unsigned int) gst_bus_add_watch(vr->renderer_type[id]->bus, (GstBusFunc)
+                                            gstreamer_pipeline_bus_callback, (gpointer) vr);    
 }  
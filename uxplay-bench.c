@@ -0,0 +1,832 @@
+/**
+ * UxPlay - An open-souce AirPlay mirroring server.
+ * uxplay-bench: microbenchmarks of the receiver code in lib/
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * Each benchmark times a fixed number of operations on synthetic data, and the best of
+ * several runs is reported (in nsecs per operation, and MB/s where data is processed).
+ * Results can be written as JSON (-json), and compared with per-benchmark limits read
+ * from a thresholds file (-thresholds): the exit status is 2 if any benchmark is slower
+ * than its limit.  A thresholds file for the board in use can be made from a run with
+ * -baseline, and then edited.  Thresholds file lines are "<benchmark> <max nsecs/op>",
+ * with "#" comments.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "lib/raop_buffer.h"
+#include "lib/mirror_buffer.h"
+#include "lib/nal_parser.h"
+#include "lib/http_request.h"
+#include "lib/byteutils.h"
+#include "lib/raop.h"
+#include "lib/raop_ntp.h"
+#include "lib/fairplay.h"
+#include "lib/logger.h"
+#include "lib/stream.h"
+#include "lib/crypto.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define LOCALHOST "127.0.0.1"
+#define DEFAULT_RUNS 5
+#define BASELINE_MARGIN 1.25      /* -baseline limits: measured nsecs/op + 25% */
+#define MAX_BENCHMARKS 16
+
+#define AUDIO_PAYLOAD_SIZE 368    /* typical AAC-ELD packet (with 12-byte RTP header) */
+#define MIRROR_FRAME_SIZE (64 * 1024)
+#define NAL_SLICES 4
+#define NAL_SLICE_SIZE 8192
+#define CBC_ALAC_SIZE 352         /* ALAC audio payload */
+#define CBC_AAC_ELD_SIZE 460      /* large AAC-ELD audio payload */
+#define CTR_FRAME_SIZE (200 * 1024)   /* mirror keyframe */
+#define AEAD_FRAME_SIZE 768       /* buffered (AirPlay 2) AAC audio frame */
+
+typedef struct benchmark_s {
+    const char *name;
+    const char *description;
+    int (*setup)(void);
+    /* performs n operations, returns the number of bytes processed (0 if not meaningful) */
+    uint64_t (*run)(uint64_t n);
+    void (*teardown)(void);
+    uint64_t ops;             /* operations per run (before -scale) */
+} benchmark_t;
+
+typedef struct result_s {
+    const benchmark_t *benchmark;
+    uint64_t ops;
+    double nsecs_per_op;
+    double mbytes_per_sec;
+    double threshold;         /* 0: none */
+    bool pass;
+} result_t;
+
+static logger_t *logger = NULL;
+static unsigned char aes_key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                     0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static unsigned char aes_iv[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+static volatile uint64_t sink;   /* keeps results of the timed code live */
+
+static uint64_t
+get_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+/* xorshift32: the same pseudo-random sequence on every board */
+static uint32_t random_state = 2463534242U;
+static uint32_t
+bench_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void
+fill_random(unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (unsigned char) bench_random();
+    }
+}
+
+/* ---- raop_buffer: audio packets in order, and with reordering and loss ---- */
+
+static raop_buffer_t *audio_buffer = NULL;
+static unsigned char audio_packet[AUDIO_PAYLOAD_SIZE];
+static unsigned short audio_seqnum = 0;
+static uint64_t audio_resends = 0;
+
+static int
+audio_resend_cb(void *opaque, unsigned short seqnum, unsigned short count)
+{
+    audio_resends += count;
+    return 0;
+}
+
+static int
+raop_buffer_setup()
+{
+    audio_buffer = raop_buffer_init(logger, aes_key, aes_iv);
+    if (!audio_buffer) {
+        return -1;
+    }
+    raop_buffer_set_rtp_clock_rate(audio_buffer, (double) SECOND_IN_NSECS / 44100.0);
+    fill_random(audio_packet, sizeof(audio_packet));
+    audio_packet[0] = 0x80;
+    audio_packet[1] = 0x60;
+    audio_seqnum = 0;
+    audio_resends = 0;
+    return 0;
+}
+
+static void
+raop_buffer_teardown()
+{
+    raop_buffer_destroy(audio_buffer);
+    audio_buffer = NULL;
+}
+
+static void
+audio_enqueue(unsigned short seqnum)
+{
+    uint64_t ntp_timestamp = 0;
+    uint64_t rtp_timestamp = (uint64_t) seqnum * 480;
+    audio_packet[2] = (unsigned char) (seqnum >> 8);
+    audio_packet[3] = (unsigned char) seqnum;
+    raop_buffer_enqueue(audio_buffer, audio_packet, sizeof(audio_packet), &ntp_timestamp, &rtp_timestamp, 1);
+}
+
+static void
+audio_dequeue_all()
+{
+    unsigned int length;
+    uint64_t ntp_timestamp, rtp_timestamp;
+    unsigned short seqnum;
+    void *payload;
+    while ((payload = raop_buffer_dequeue(audio_buffer, &length, &ntp_timestamp, &rtp_timestamp, &seqnum, 0))) {
+        sink += length;
+    }
+}
+
+static uint64_t
+raop_buffer_inorder_run(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        audio_enqueue(audio_seqnum++);
+        audio_dequeue_all();
+    }
+    return n * (sizeof(audio_packet) - 12);
+}
+
+/* 1% of packets are lost, and 5% arrive after the next two packets; resend requests are */
+/* scheduled after each packet, as in raop_rtp                                            */
+static uint64_t
+raop_buffer_reorder_run(uint64_t n)
+{
+    int held = -1;
+    int held_for = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        unsigned short seqnum = audio_seqnum++;
+        uint32_t r = bench_random() % 100;
+        if (r == 0) {
+            /* lost */
+        } else if (r < 6 && held < 0) {
+            held = seqnum;
+            held_for = 2;
+        } else {
+            audio_enqueue(seqnum);
+        }
+        if (held >= 0 && --held_for < 0) {
+            audio_enqueue((unsigned short) held);
+            held = -1;
+        }
+        audio_dequeue_all();
+        raop_buffer_handle_resends(audio_buffer, audio_resend_cb, NULL);
+    }
+    sink += audio_resends;
+    return n * (sizeof(audio_packet) - 12);
+}
+
+/* ---- mirror_buffer_decrypt: AES-CTR decryption of mirror video frames ---- */
+
+static mirror_buffer_t *mirror_buffer = NULL;
+static unsigned char *mirror_input = NULL;
+static unsigned char *mirror_output = NULL;
+
+static int
+mirror_decrypt_setup()
+{
+    uint64_t stream_connection_id = 0x1122334455667788ULL;
+    mirror_buffer = mirror_buffer_init(logger, aes_key);
+    mirror_input = malloc(MIRROR_FRAME_SIZE);
+    mirror_output = malloc(MIRROR_FRAME_SIZE);
+    if (!mirror_buffer || !mirror_input || !mirror_output) {
+        return -1;
+    }
+    mirror_buffer_init_aes(mirror_buffer, &stream_connection_id);
+    fill_random(mirror_input, MIRROR_FRAME_SIZE);
+    return 0;
+}
+
+static void
+mirror_decrypt_teardown()
+{
+    if (mirror_buffer) {
+        mirror_buffer_destroy(mirror_buffer);
+        mirror_buffer = NULL;
+    }
+    free(mirror_input);
+    free(mirror_output);
+    mirror_input = mirror_output = NULL;
+}
+
+static uint64_t
+mirror_decrypt_run(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        mirror_buffer_decrypt(mirror_buffer, mirror_input, mirror_output, MIRROR_FRAME_SIZE);
+    }
+    sink += mirror_output[MIRROR_FRAME_SIZE - 1];
+    return n * MIRROR_FRAME_SIZE;
+}
+
+/* ---- crypto: the ciphers of the audio and video streams, called directly ---- */
+
+static aes_ctx_t *aes_ctx = NULL;
+static aead_ctx_t *aead_ctx = NULL;
+static unsigned char *crypto_input = NULL;
+static unsigned char *crypto_output = NULL;
+static unsigned char aead_key[CHACHA_KEY_SIZE];
+static unsigned char aead_nonce[CHACHA_NONCE_SIZE];
+static unsigned char aead_aad[8];
+static unsigned char aead_tag[AEAD_TAG_SIZE];
+
+static int
+crypto_buffers_setup(int size)
+{
+    crypto_input = malloc(size);
+    crypto_output = malloc(size);
+    if (!crypto_input || !crypto_output) {
+        return -1;
+    }
+    fill_random(crypto_input, size);
+    return 0;
+}
+
+static void
+crypto_teardown()
+{
+    if (aes_ctx) {
+        aes_cbc_destroy(aes_ctx);    /* (the same for both modes) */
+        aes_ctx = NULL;
+    }
+    if (aead_ctx) {
+        aead_destroy(aead_ctx);
+        aead_ctx = NULL;
+    }
+    free(crypto_input);
+    free(crypto_output);
+    crypto_input = crypto_output = NULL;
+}
+
+static int
+aes_cbc_setup()
+{
+    aes_ctx = aes_cbc_init(aes_key, aes_iv, AES_DECRYPT);
+    return (aes_ctx ? crypto_buffers_setup(CBC_AAC_ELD_SIZE) : -1);
+}
+
+/* as in raop_buffer: only whole 16-byte blocks are encrypted, and the iv is reset for each packet */
+static uint64_t
+aes_cbc_run(uint64_t n, int size)
+{
+    int encrypted = size & ~(AES_128_BLOCK_SIZE - 1);
+    for (uint64_t i = 0; i < n; i++) {
+        aes_cbc_decrypt(aes_ctx, crypto_input, crypto_output, encrypted);
+        aes_cbc_reset(aes_ctx);
+    }
+    sink += crypto_output[0];
+    return n * (uint64_t) size;
+}
+
+static uint64_t
+aes_cbc_alac_run(uint64_t n)
+{
+    return aes_cbc_run(n, CBC_ALAC_SIZE);
+}
+
+static uint64_t
+aes_cbc_aac_eld_run(uint64_t n)
+{
+    return aes_cbc_run(n, CBC_AAC_ELD_SIZE);
+}
+
+static int
+aes_ctr_setup()
+{
+    aes_ctx = aes_ctr_init(aes_key, aes_iv);
+    return (aes_ctx ? crypto_buffers_setup(CTR_FRAME_SIZE) : -1);
+}
+
+static uint64_t
+aes_ctr_run(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        aes_ctr_decrypt(aes_ctx, crypto_input, crypto_output, CTR_FRAME_SIZE);
+    }
+    sink += crypto_output[CTR_FRAME_SIZE - 1];
+    return n * CTR_FRAME_SIZE;
+}
+
+/* the input is a valid ciphertext, so that each decryption is authenticated (as in raop_buffered) */
+static int
+aead_setup()
+{
+    fill_random(aead_key, sizeof(aead_key));
+    fill_random(aead_nonce, sizeof(aead_nonce));
+    fill_random(aead_aad, sizeof(aead_aad));
+    if (crypto_buffers_setup(AEAD_FRAME_SIZE) < 0) {
+        return -1;
+    }
+    aead_ctx_t *encrypt_ctx = aead_init(AEAD_CHACHA20_POLY1305, aead_key, AES_ENCRYPT);
+    fill_random(crypto_output, AEAD_FRAME_SIZE);
+    aead_encrypt(encrypt_ctx, aead_nonce, aead_aad, sizeof(aead_aad), crypto_output, AEAD_FRAME_SIZE,
+                 crypto_input, aead_tag);
+    aead_destroy(encrypt_ctx);
+    aead_ctx = aead_init(AEAD_CHACHA20_POLY1305, aead_key, AES_DECRYPT);
+    return 0;
+}
+
+static uint64_t
+aead_run(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        if (aead_decrypt(aead_ctx, aead_nonce, aead_aad, sizeof(aead_aad), crypto_input, AEAD_FRAME_SIZE,
+                         crypto_output, aead_tag) != AEAD_FRAME_SIZE) {
+            fprintf(stderr, "aead_decrypt failed\n");
+            exit(1);
+        }
+    }
+    sink += crypto_output[0];
+    return n * AEAD_FRAME_SIZE;
+}
+
+/* ---- nal_parser_avcc_to_annexb: length-prefixed NAL units to Annex-B (in place) ---- */
+
+static unsigned char *nal_template = NULL;
+static unsigned char *nal_frame = NULL;
+static int nal_frame_len = 0;
+
+static int
+nal_append(unsigned char *data, int offset, unsigned char header, int size)
+{
+    data[offset] = (unsigned char) (size >> 24);
+    data[offset + 1] = (unsigned char) (size >> 16);
+    data[offset + 2] = (unsigned char) (size >> 8);
+    data[offset + 3] = (unsigned char) size;
+    fill_random(data + offset + 5, size - 1);
+    data[offset + 4] = header;
+    return offset + 4 + size;
+}
+
+static int
+nal_setup()
+{
+    int len = 2 * (4 + 32) + NAL_SLICES * (4 + NAL_SLICE_SIZE);
+    nal_template = malloc(len);
+    nal_frame = malloc(len);
+    if (!nal_template || !nal_frame) {
+        return -1;
+    }
+    /* an h264 keyframe: SPS, PPS and NAL_SLICES IDR slices */
+    int offset = nal_append(nal_template, 0, 0x67, 32);
+    offset = nal_append(nal_template, offset, 0x68, 32);
+    for (int i = 0; i < NAL_SLICES; i++) {
+        offset = nal_append(nal_template, offset, 0x65, NAL_SLICE_SIZE);
+    }
+    nal_frame_len = offset;
+    return 0;
+}
+
+static void
+nal_teardown()
+{
+    free(nal_template);
+    free(nal_frame);
+    nal_template = nal_frame = NULL;
+}
+
+/* the conversion is in place, so each operation includes a copy of the frame */
+static uint64_t
+nal_run(uint64_t n)
+{
+    nal_index_t nal_index;
+    for (uint64_t i = 0; i < n; i++) {
+        memcpy(nal_frame, nal_template, nal_frame_len);
+        nal_index_init(&nal_index, false);
+        if (nal_parser_avcc_to_annexb(nal_frame, 0, nal_frame_len, &nal_index) != NAL_PARSER_OK) {
+            fprintf(stderr, "nal_parser_avcc_to_annexb failed\n");
+            exit(1);
+        }
+        sink += nal_index.count;
+    }
+    return n * (uint64_t) nal_frame_len;
+}
+
+/* ---- http_request_add_data: parsing of a typical RTSP request with a body ---- */
+
+static const char rtsp_request[] =
+    "SETUP rtsp://192.168.1.100/2182745467221657149 RTSP/1.0\r\n"
+    "Content-Length: 64\r\n"
+    "Content-Type: application/x-apple-binary-plist\r\n"
+    "CSeq: 6\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "X-Apple-ProtocolVersion: 1\r\n"
+    "\r\n"
+    "bplist00" "0123456789abcdef0123456789abcdef0123456789abcdef" "01234567";   /* 64-byte body */
+
+static int
+http_setup()
+{
+    return 0;
+}
+
+static uint64_t
+http_run(uint64_t n)
+{
+    int len = (int) strlen(rtsp_request);
+    for (uint64_t i = 0; i < n; i++) {
+        http_request_t *request = http_request_init();
+        /* as received by httpd, in two reads */
+        http_request_add_data(request, rtsp_request, len / 2);
+        http_request_add_data(request, rtsp_request + len / 2, len - len / 2);
+        if (!http_request_is_complete(request) || http_request_has_error(request)) {
+            fprintf(stderr, "http_request parsing failed\n");
+            exit(1);
+        }
+        sink += (uintptr_t) http_request_get_header(request, "CSeq");
+        http_request_destroy(request);
+    }
+    return n * (uint64_t) len;
+}
+
+/* ---- byteutils: header field accessors ---- */
+
+static unsigned char byteutils_data[256];
+
+static int
+byteutils_setup()
+{
+    fill_random(byteutils_data, sizeof(byteutils_data));
+    return 0;
+}
+
+/* one operation reads one field of each type (as when parsing a mirror packet header) */
+static uint64_t
+byteutils_run(uint64_t n)
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        int offset = (int) (i & 0x7f);
+        sum += byteutils_get_short(byteutils_data, offset);
+        sum += byteutils_get_int(byteutils_data, offset + 2);
+        sum += byteutils_get_long(byteutils_data, offset + 6);
+        sum += byteutils_get_short_be(byteutils_data, offset + 14);
+        sum += byteutils_get_int_be(byteutils_data, offset + 16);
+        sum += byteutils_get_long_be(byteutils_data, offset + 20);
+        sum += byteutils_get_ntp_timestamp(byteutils_data, offset + 28);
+    }
+    sink += sum;
+    return 0;
+}
+
+/* ---- raop_ntp: conversion between client and local clock times ---- */
+
+static raop_ntp_t *ntp = NULL;
+
+static int
+ntp_setup()
+{
+    raop_callbacks_t callbacks;
+    timing_protocol_t time_protocol = NTP;
+    memset(&callbacks, 0, sizeof(callbacks));
+    ntp = raop_ntp_init(logger, &callbacks, LOCALHOST, 4, 7010, &time_protocol);
+    return (ntp ? 0 : -1);
+}
+
+static void
+ntp_teardown()
+{
+    raop_ntp_destroy(ntp);
+    ntp = NULL;
+}
+
+/* one operation converts a time in each direction */
+static uint64_t
+ntp_run(uint64_t n)
+{
+    uint64_t time = raop_ntp_get_local_time(ntp);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t remote = raop_ntp_convert_local_time(ntp, time + i * 1000);
+        sink += raop_ntp_convert_remote_time(ntp, remote);
+    }
+    return 0;
+}
+
+/* ---- fairplay: decryption of the stream key (ekey) at SETUP ---- */
+
+static unsigned char fairplay_keymsg[164];
+static unsigned char fairplay_ekey[72];
+static fairplay_t *fairplay = NULL;
+
+static int
+fairplay_bench_setup()
+{
+    unsigned char response[32];
+    fill_random(fairplay_keymsg, sizeof(fairplay_keymsg));
+    fill_random(fairplay_ekey, sizeof(fairplay_ekey));
+    fairplay_keymsg[4] = 0x03;     /* fairplay version */
+    fairplay_keymsg[12] = 0x01;    /* mode */
+    fairplay = fairplay_init(logger);
+    if (!fairplay || fairplay_handshake(fairplay, fairplay_keymsg, response) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void
+fairplay_bench_teardown()
+{
+    fairplay_destroy(fairplay);
+    fairplay = NULL;
+}
+
+/* the first SETUP of a connection: fp-setup message 3, then the ekey */
+static uint64_t
+fairplay_first_run(uint64_t n)
+{
+    unsigned char response[32];
+    unsigned char aeskey[16];
+    for (uint64_t i = 0; i < n; i++) {
+        fairplay_t *fp = fairplay_init(logger);
+        fairplay_handshake(fp, fairplay_keymsg, response);
+        fairplay_decrypt(fp, fairplay_ekey, aeskey);
+        sink += aeskey[0];
+        fairplay_destroy(fp);
+    }
+    return 0;
+}
+
+/* later SETUPs of the same connection */
+static uint64_t
+fairplay_repeat_run(uint64_t n)
+{
+    unsigned char aeskey[16];
+    for (uint64_t i = 0; i < n; i++) {
+        fairplay_decrypt(fairplay, fairplay_ekey, aeskey);
+        sink += aeskey[0];
+    }
+    return 0;
+}
+
+static const benchmark_t benchmarks[] = {
+    { "raop_buffer_inorder", "audio jitter buffer: enqueue (with decryption) + dequeue, in order",
+      raop_buffer_setup, raop_buffer_inorder_run, raop_buffer_teardown, 200000 },
+    { "raop_buffer_reorder_loss", "audio jitter buffer: 5% reordered, 1% lost, resend scheduling",
+      raop_buffer_setup, raop_buffer_reorder_run, raop_buffer_teardown, 200000 },
+    { "mirror_buffer_decrypt", "mirror video decryption, 64 kB frame",
+      mirror_decrypt_setup, mirror_decrypt_run, mirror_decrypt_teardown, 2000 },
+    { "aes_cbc_alac", "AES-CBC audio decryption, 352-byte ALAC packet",
+      aes_cbc_setup, aes_cbc_alac_run, crypto_teardown, 500000 },
+    { "aes_cbc_aac_eld", "AES-CBC audio decryption, 460-byte AAC-ELD packet",
+      aes_cbc_setup, aes_cbc_aac_eld_run, crypto_teardown, 500000 },
+    { "aes_ctr_200k", "AES-CTR video decryption, 200 kB keyframe",
+      aes_ctr_setup, aes_ctr_run, crypto_teardown, 1000 },
+    { "chacha20_poly1305", "ChaCha20-Poly1305 decryption, 768-byte buffered audio frame",
+      aead_setup, aead_run, crypto_teardown, 200000 },
+    { "nal_avcc_to_annexb", "AVCC -> Annex-B rewrite + NAL index, 33 kB keyframe (includes a copy)",
+      nal_setup, nal_run, nal_teardown, 20000 },
+    { "http_request_parse", "RTSP SETUP request parsing (headers + plist body)",
+      http_setup, http_run, NULL, 200000 },
+    { "byteutils", "one read of each byteutils accessor",
+      byteutils_setup, byteutils_run, NULL, 5000000 },
+    { "raop_ntp_convert", "local -> remote -> local time conversion",
+      ntp_setup, ntp_run, ntp_teardown, 2000000 },
+    { "fairplay_decrypt", "FairPlay ekey decryption at the first SETUP of a connection",
+      fairplay_bench_setup, fairplay_first_run, fairplay_bench_teardown, 5000 },
+    { "fairplay_decrypt_repeat", "FairPlay ekey decryption at a later SETUP (cached session key)",
+      fairplay_bench_setup, fairplay_repeat_run, fairplay_bench_teardown, 500000 },
+};
+#define N_BENCHMARKS ((int) (sizeof(benchmarks) / sizeof(benchmarks[0])))
+
+/* returns the limit for name (0 if none is given) */
+static double
+read_threshold(const char *filename, const char *name)
+{
+    char line[256];
+    double limit = 0.0;
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        return 0.0;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        char key[128];
+        double value;
+        if (line[0] == '#' || sscanf(line, "%127s %lf", key, &value) != 2) {
+            continue;
+        }
+        if (!strcmp(key, name)) {
+            limit = value;
+        }
+    }
+    fclose(fp);
+    return limit;
+}
+
+static int
+run_benchmark(const benchmark_t *benchmark, double scale, int runs, result_t *result)
+{
+    uint64_t n = (uint64_t) (benchmark->ops * scale);
+    double best = 0.0;
+    uint64_t bytes = 0;
+    if (n < 1) {
+        n = 1;
+    }
+    for (int run = 0; run <= runs; run++) {
+        if (benchmark->setup && benchmark->setup() < 0) {
+            fprintf(stderr, "%s: setup failed\n", benchmark->name);
+            return -1;
+        }
+        uint64_t start = get_nsecs();
+        bytes = benchmark->run(n);
+        double nsecs = (double) (get_nsecs() - start);
+        if (benchmark->teardown) {
+            benchmark->teardown();
+        }
+        /* run 0 warms up the caches and the allocator */
+        if (run > 0 && (best == 0.0 || nsecs < best)) {
+            best = nsecs;
+        }
+    }
+    result->benchmark = benchmark;
+    result->ops = n;
+    result->nsecs_per_op = best / (double) n;
+    result->mbytes_per_sec = (bytes && best > 0.0 ? (double) bytes * 1000.0 / best : 0.0);
+    return 0;
+}
+
+static void
+write_json(FILE *fp, const result_t *results, int count, double scale, int runs)
+{
+    fprintf(fp, "{\n  \"scale\": %g,\n  \"runs\": %d,\n  \"benchmarks\": [\n", scale, runs);
+    for (int i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        fprintf(fp, "    { \"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f", r->benchmark->name,
+                (unsigned long long) r->ops, r->nsecs_per_op);
+        if (r->mbytes_per_sec > 0.0) {
+            fprintf(fp, ", \"mb_per_sec\": %.2f", r->mbytes_per_sec);
+        }
+        if (r->threshold > 0.0) {
+            fprintf(fp, ", \"threshold_ns\": %.3f, \"pass\": %s", r->threshold, (r->pass ? "true" : "false"));
+        }
+        fprintf(fp, " }%s\n", (i < count - 1 ? "," : ""));
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void
+print_usage(const char *name)
+{
+    printf("Usage: %s [-list] [-only name] [-scale x] [-runs n] [-json file] [-thresholds file] [-baseline file]\n",
+           name);
+    printf("Runs microbenchmarks of the uxplay receiver code (best of n runs, in nsecs per operation)\n");
+    printf("-list     list the benchmarks\n");
+    printf("-only s   run only benchmarks whose name contains s\n");
+    printf("-scale x  multiply the number of operations per run by x (default 1.0)\n");
+    printf("-runs n   timed runs of each benchmark (default %d)\n", DEFAULT_RUNS);
+    printf("-json f   write the results as JSON to file f (\"-\": stdout)\n");
+    printf("-thresholds f  compare with the limits in f; exit status 2 if any is exceeded\n");
+    printf("-baseline f    write a thresholds file f from this run (limits %.0f%% above the results)\n",
+           (BASELINE_MARGIN - 1.0) * 100.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *only = NULL;
+    const char *json_filename = NULL;
+    const char *thresholds_filename = NULL;
+    const char *baseline_filename = NULL;
+    double scale = 1.0;
+    int runs = DEFAULT_RUNS;
+    result_t results[MAX_BENCHMARKS];
+    int count = 0;
+    int failed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-list")) {
+            for (int j = 0; j < N_BENCHMARKS; j++) {
+                printf("%-26s %s\n", benchmarks[j].name, benchmarks[j].description);
+            }
+            return 0;
+        } else if (!strcmp(argv[i], "-only") && i + 1 < argc) {
+            only = argv[++i];
+        } else if (!strcmp(argv[i], "-scale") && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-runs") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-json") && i + 1 < argc) {
+            json_filename = argv[++i];
+        } else if (!strcmp(argv[i], "-thresholds") && i + 1 < argc) {
+            thresholds_filename = argv[++i];
+        } else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+            baseline_filename = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (scale <= 0.0 || runs < 1) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+    if (thresholds_filename) {
+        FILE *fp = fopen(thresholds_filename, "r");
+        if (!fp) {
+            fprintf(stderr, "cannot read thresholds file %s\n", thresholds_filename);
+            exit(1);
+        }
+        fclose(fp);
+    }
+
+    logger = logger_init();
+    logger_set_level(logger, LOGGER_ERR);
+
+    printf("%-26s %12s %12s %12s\n", "benchmark", "ns/op", "MB/s", "limit ns/op");
+    for (int i = 0; i < N_BENCHMARKS && count < MAX_BENCHMARKS; i++) {
+        if (only && !strstr(benchmarks[i].name, only)) {
+            continue;
+        }
+        result_t *result = &results[count];
+        if (run_benchmark(&benchmarks[i], scale, runs, result) < 0) {
+            exit(1);
+        }
+        result->threshold = (thresholds_filename ? read_threshold(thresholds_filename, benchmarks[i].name) : 0.0);
+        result->pass = (result->threshold <= 0.0 || result->nsecs_per_op <= result->threshold);
+        if (!result->pass) {
+            failed++;
+        }
+        printf("%-26s %12.1f ", benchmarks[i].name, result->nsecs_per_op);
+        if (result->mbytes_per_sec > 0.0) {
+            printf("%12.1f ", result->mbytes_per_sec);
+        } else {
+            printf("%12s ", "-");
+        }
+        if (result->threshold > 0.0) {
+            printf("%12.1f%s\n", result->threshold, (result->pass ? "" : "  REGRESSION"));
+        } else {
+            printf("%12s\n", "-");
+        }
+        count++;
+    }
+
+    if (json_filename) {
+        FILE *fp = (strcmp(json_filename, "-") ? fopen(json_filename, "w") : stdout);
+        if (!fp) {
+            fprintf(stderr, "cannot write %s\n", json_filename);
+            exit(1);
+        }
+        write_json(fp, results, count, scale, runs);
+        if (fp != stdout) {
+            fclose(fp);
+        }
+    }
+    if (baseline_filename) {
+        FILE *fp = fopen(baseline_filename, "w");
+        if (!fp) {
+            fprintf(stderr, "cannot write %s\n", baseline_filename);
+            exit(1);
+        }
+        fprintf(fp, "# uxplay-bench thresholds: <benchmark> <max nsecs/op>\n");
+        for (int i = 0; i < count; i++) {
+            fprintf(fp, "%s %.1f\n", results[i].benchmark->name, results[i].nsecs_per_op * BASELINE_MARGIN);
+        }
+        fclose(fp);
+    }
+    logger_destroy(logger);
+
+    if (failed) {
+        fprintf(stderr, "%d benchmark%s slower than the limits in %s\n", failed, (failed > 1 ? "s" : ""),
+                thresholds_filename);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,497 @@
+/**
+ * UxPlay - An open-souce AirPlay mirroring server.
+ * uxplay-replay: offline replay of session captures made with "uxplay -capture <dir>"
+ * Copyright (C) 2026 agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * The captured (encrypted) packets are sent through local sockets to the same receiver
+ * code used by uxplay (raop_rtp_mirror, raop_rtp, raop_ntp), either at the pace they
+ * were received, or as fast as possible (-fast).  A local timing responder plays the part
+ * of the client clock, using the captured timing responses.  Decoded frames are counted
+ * (no rendering), and throughput and latency are reported at the end.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "lib/capture.h"
+#include "lib/raop.h"
+#include "lib/raop_ntp.h"
+#include "lib/raop_rtp.h"
+#include "lib/raop_rtp_mirror.h"
+#include "lib/frame_pool.h"
+#include "lib/logger.h"
+#include "lib/threads.h"
+#include "lib/stream.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define LOCALHOST "127.0.0.1"
+#define WARMUP_MSECS 500
+#define DRAIN_MSECS 500
+
+typedef struct timing_sample_s {
+    uint64_t time;             /* local capture time of the response */
+    uint64_t remote;           /* client transmit timestamp (NTP 32.32 format) */
+} timing_sample_t;
+
+static timing_sample_t *timing_samples = NULL;
+static int n_timing_samples = 0;
+static bool fast_mode = false;
+static atomic_uint_fast64_t capture_now;   /* the capture time being replayed */
+static int64_t clock_shift = 0;            /* realtime mode: replay local time - capture local time */
+static atomic_bool responder_running;
+
+typedef struct replay_stats_s {
+    atomic_uint_fast64_t video_frames;
+    atomic_uint_fast64_t video_bytes;
+    atomic_uint_fast64_t video_latency_sum;
+    atomic_uint_fast64_t video_latency_max;
+    atomic_uint_fast64_t audio_frames;
+    atomic_uint_fast64_t audio_bytes;
+} replay_stats_t;
+
+static replay_stats_t stats;
+
+static uint64_t
+get_local_time()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+static uint64_t
+get_cpu_nsecs()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
+
+static void
+sleep_until(uint64_t local_time)
+{
+    uint64_t now = get_local_time();
+    if (local_time > now) {
+        struct timespec wait;
+        wait.tv_sec = (time_t) ((local_time - now) / SECOND_IN_NSECS);
+        wait.tv_nsec = (long) ((local_time - now) % SECOND_IN_NSECS);
+        nanosleep(&wait, NULL);
+    }
+}
+
+/* client clock (NTP format) at a given capture time, extrapolated from the last timing response */
+static uint64_t
+remote_time_at(uint64_t time)
+{
+    int lo = 0, hi = n_timing_samples - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (timing_samples[mid].time <= time) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    int64_t delta = (int64_t) (time - timing_samples[lo].time);
+    return timing_samples[lo].remote + (uint64_t) (int64_t) ((double) delta * 4.294967296);
+}
+
+static void
+put_uint64_be(unsigned char *b, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--) {
+        b[i] = (unsigned char) (value & 0xff);
+        value >>= 8;
+    }
+}
+
+/* answers the timing requests of raop_ntp as the client would have */
+static THREAD_RETVAL
+timing_responder_thread(void *arg)
+{
+    int sock = *(int *) arg;
+    unsigned char request[128];
+    unsigned char response[32];
+    struct sockaddr_storage saddr;
+    socklen_t saddr_len;
+    while (atomic_load(&responder_running)) {
+        saddr_len = sizeof(saddr);
+        int len = recvfrom(sock, (char *) request, sizeof(request), 0, (struct sockaddr *) &saddr, &saddr_len);
+        if (len < 32) {
+            continue;
+        }
+        uint64_t time = (fast_mode ? atomic_load(&capture_now) : (uint64_t) ((int64_t) get_local_time() - clock_shift));
+        uint64_t remote = remote_time_at(time);
+        memset(response, 0, sizeof(response));
+        response[0] = 0x80;
+        response[1] = 0xd3;
+        response[3] = 0x07;
+        memcpy(response + 8, request + 24, 8);
+        put_uint64_be(response + 16, remote);
+        put_uint64_be(response + 24, remote);
+        sendto(sock, (char *) response, sizeof(response), 0, (struct sockaddr *) &saddr, saddr_len);
+    }
+    return 0;
+}
+
+static void
+video_process(void *cls, raop_ntp_t *ntp, h264_decode_struct *data)
+{
+    atomic_fetch_add(&stats.video_frames, 1);
+    atomic_fetch_add(&stats.video_bytes, (uint64_t) data->data_len);
+    uint64_t now = raop_ntp_get_local_time(ntp);
+    if (!fast_mode && now > data->ntp_time_local) {
+        uint64_t latency = now - data->ntp_time_local;
+        atomic_fetch_add(&stats.video_latency_sum, latency);
+        if (latency > atomic_load(&stats.video_latency_max)) {
+            atomic_store(&stats.video_latency_max, latency);
+        }
+    }
+}
+
+static void
+audio_process(void *cls, raop_ntp_t *ntp, audio_decode_struct *data)
+{
+    atomic_fetch_add(&stats.audio_frames, 1);
+    atomic_fetch_add(&stats.audio_bytes, (uint64_t) data->data_len);
+}
+
+static void
+video_pause(void *cls)
+{
+}
+
+static void
+video_resume(void *cls)
+{
+}
+
+static void
+video_report_size(void *cls, float *width_source, float *height_source, float *width, float *height)
+{
+    printf("video size %.0f x %.0f\n", *width_source, *height_source);
+}
+
+static void
+conn_reset(void *cls, int timeouts, bool reset_video)
+{
+    printf("receiver requested a connection reset (%d timing timeouts)\n", timeouts);
+}
+
+static int
+udp_socket(unsigned short *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        getsockname(sock, (struct sockaddr *) &addr, &addr_len) < 0) {
+        close(sock);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+static void
+set_loopback_addr(struct sockaddr_in *addr, unsigned short port)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = htons(port);
+}
+
+static int
+send_all(int sock, const unsigned char *data, int len)
+{
+    while (len > 0) {
+        int ret = send(sock, (const char *) data, len, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void
+print_usage(const char *name)
+{
+    printf("Usage: %s [-fast] [-d] [-q n] capture%s\n", name, CAPTURE_SUFFIX);
+    printf("Replays a session captured with \"uxplay -capture <dir>\" through the uxplay receiver code\n");
+    printf("-fast     send packets as fast as possible (default: at the captured pace)\n");
+    printf("-q n      mirror video receive queue depth n (default 0: no queue)\n");
+    printf("-d        enable debug logging\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *filename = NULL;
+    int log_level = LOGGER_INFO;
+    int queue_depth = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-fast")) {
+            fast_mode = true;
+        } else if (!strcmp(argv[i], "-d")) {
+            log_level = LOGGER_DEBUG;
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            queue_depth = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (!filename) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    capture_reader_t *reader = capture_reader_open(filename);
+    if (!reader) {
+        fprintf(stderr, "%s is not a readable capture file\n", filename);
+        exit(1);
+    }
+    int count = capture_reader_get_count(reader);
+    const capture_mirror_setup_t *mirror_setup = NULL;
+    const capture_audio_setup_t *audio_setup = NULL;
+    timing_samples = calloc(count ? count : 1, sizeof(timing_sample_t));
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data;
+        const capture_record_t *record = capture_reader_get(reader, i, &data);
+        if (!record) {
+            count = i;
+            break;
+        }
+        if (record->type == CAPTURE_MIRROR_SETUP && !mirror_setup && record->len >= sizeof(capture_mirror_setup_t)) {
+            mirror_setup = (const capture_mirror_setup_t *) data;
+        } else if (record->type == CAPTURE_AUDIO_SETUP && !audio_setup && record->len >= sizeof(capture_audio_setup_t)) {
+            audio_setup = (const capture_audio_setup_t *) data;
+        } else if (record->type == CAPTURE_TIMING && record->len >= 32) {
+            timing_samples[n_timing_samples].time = record->time;
+            uint64_t remote = 0;
+            for (int j = 24; j < 32; j++) {
+                remote = (remote << 8) | data[j];
+            }
+            timing_samples[n_timing_samples++].remote = remote;
+        }
+    }
+    if (!count || !n_timing_samples || (!mirror_setup && !audio_setup)) {
+        fprintf(stderr, "%s: capture has no %s\n", filename, (n_timing_samples ? "audio or mirror stream" : "timing data"));
+        exit(1);
+    }
+    printf("%s: %d records, %s%s%s\n", filename, count, (mirror_setup ? "mirror video" : ""),
+           (mirror_setup && audio_setup ? " + " : ""), (audio_setup ? "audio" : ""));
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, log_level);
+
+    raop_callbacks_t callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.video_process = video_process;
+    callbacks.audio_process = audio_process;
+    callbacks.video_pause = video_pause;
+    callbacks.video_resume = video_resume;
+    callbacks.video_report_size = video_report_size;
+    callbacks.conn_reset = conn_reset;
+
+    /* the (captured) client clock */
+    unsigned short timing_rport = 0;
+    int timing_sock = udp_socket(&timing_rport);
+    if (timing_sock < 0) {
+        fprintf(stderr, "could not create the timing responder socket\n");
+        exit(1);
+    }
+    struct timeval tv = { 0, 100000 };
+    setsockopt(timing_sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(tv));
+    /* the replay starts (the first record is sent) after a warm-up for timing sync and stream setup */
+    const capture_record_t *first = capture_reader_get(reader, 0, NULL);
+    atomic_store(&capture_now, first->time);
+    clock_shift = (int64_t) (get_local_time() + WARMUP_MSECS * 1000000ULL) - (int64_t) first->time;
+    atomic_store(&responder_running, true);
+    thread_handle_t responder;
+    THREAD_CREATE(responder, timing_responder_thread, &timing_sock);
+
+    timing_protocol_t time_protocol = NTP;
+    unsigned short timing_lport = 0;
+    raop_ntp_t *ntp = raop_ntp_init(logger, &callbacks, LOCALHOST, 4, timing_rport, &time_protocol);
+    if (!ntp) {
+        fprintf(stderr, "could not initialize raop_ntp\n");
+        exit(1);
+    }
+    raop_ntp_start(ntp, &timing_lport, 5);
+
+    frame_pool_t *frame_pool = NULL;
+    raop_rtp_mirror_t *mirror = NULL;
+    int mirror_sock = -1;
+    if (mirror_setup) {
+        uint64_t stream_connection_id = mirror_setup->stream_connection_id;
+        unsigned short mirror_port = 0;
+        struct sockaddr_in addr;
+        frame_pool = frame_pool_init(logger);
+        mirror = raop_rtp_mirror_init(logger, &callbacks, ntp, LOCALHOST, 4, mirror_setup->aeskey, frame_pool);
+        if (mirror) {
+            raop_rtp_mirror_init_aes(mirror, &stream_connection_id);
+            raop_rtp_mirror_set_queue_depth(mirror, queue_depth);
+            raop_rtp_mirror_start(mirror, &mirror_port, 0, mirror_setup->h265);
+            set_loopback_addr(&addr, mirror_port);
+            mirror_sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (mirror_sock >= 0 && connect(mirror_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+                close(mirror_sock);
+                mirror_sock = -1;
+            }
+            if (mirror_sock >= 0) {
+                int option = 1;
+                setsockopt(mirror_sock, IPPROTO_TCP, TCP_NODELAY, (char *) &option, sizeof(option));
+            }
+        }
+        if (mirror_sock < 0) {
+            fprintf(stderr, "could not start mirror video replay\n");
+            exit(1);
+        }
+    }
+
+    raop_rtp_t *rtp = NULL;
+    int audio_sock = -1;
+    struct sockaddr_in audio_data_addr, audio_control_addr;
+    if (audio_setup) {
+        unsigned short remote_cport = 0, cport = 0, dport = 0;
+        unsigned char ct = audio_setup->ct;
+        unsigned int sr = audio_setup->sr;
+        rtp = raop_rtp_init(logger, &callbacks, ntp, LOCALHOST, 4, audio_setup->aeskey, audio_setup->aesiv);
+        if (rtp) {
+            raop_rtp_start_audio(rtp, &remote_cport, &cport, &dport, &ct, &sr);
+            set_loopback_addr(&audio_data_addr, dport);
+            set_loopback_addr(&audio_control_addr, cport);
+            audio_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        }
+        if (audio_sock < 0) {
+            fprintf(stderr, "could not start audio replay\n");
+            exit(1);
+        }
+    }
+
+    uint64_t bytes = 0;
+    if (!fast_mode) {
+        sleep_until((uint64_t) ((int64_t) first->time + clock_shift));
+    }
+    uint64_t start = get_local_time();
+    uint64_t cpu_start = get_cpu_nsecs();
+    for (int i = 0; i < count; i++) {
+        const unsigned char *data;
+        const capture_record_t *record = capture_reader_get(reader, i, &data);
+        if (!fast_mode) {
+            sleep_until((uint64_t) ((int64_t) record->time + clock_shift));
+        }
+        atomic_store(&capture_now, record->time);
+        switch (record->type) {
+        case CAPTURE_MIRROR:
+            if (mirror_sock >= 0 && send_all(mirror_sock, data, (int) record->len) < 0) {
+                fprintf(stderr, "mirror video connection closed by the receiver\n");
+                close(mirror_sock);
+                mirror_sock = -1;
+            }
+            break;
+        case CAPTURE_AUDIO:
+            if (audio_sock >= 0) {
+                sendto(audio_sock, (const char *) data, record->len, 0, (struct sockaddr *) &audio_data_addr,
+                       sizeof(audio_data_addr));
+            }
+            break;
+        case CAPTURE_AUDIO_CONTROL:
+            if (audio_sock >= 0) {
+                sendto(audio_sock, (const char *) data, record->len, 0, (struct sockaddr *) &audio_control_addr,
+                       sizeof(audio_control_addr));
+            }
+            break;
+        default:
+            continue;
+        }
+        bytes += record->len;
+    }
+    uint64_t sent = get_local_time();
+    sleepms(DRAIN_MSECS);
+
+    if (mirror_sock >= 0) {
+        close(mirror_sock);
+    }
+    if (audio_sock >= 0) {
+        close(audio_sock);
+    }
+    raop_rtp_mirror_destroy(mirror);
+    raop_rtp_destroy(rtp);
+    uint64_t cpu_nsecs = get_cpu_nsecs() - cpu_start;
+    raop_ntp_destroy(ntp);
+    atomic_store(&responder_running, false);
+    THREAD_JOIN(responder);
+    close(timing_sock);
+    if (frame_pool) {
+        frame_pool_destroy(frame_pool);
+    }
+
+    const capture_record_t *last = capture_reader_get(reader, count - 1, NULL);
+    double duration = (double) (last->time - first->time) / SECOND_IN_NSECS;
+    double elapsed = (double) (sent - start) / SECOND_IN_NSECS;
+    uint64_t video_frames = atomic_load(&stats.video_frames);
+    uint64_t audio_frames = atomic_load(&stats.audio_frames);
+    printf("replayed %.3f secs of capture in %.3f secs (%s): %.2f MB/s received\n", duration, elapsed,
+           (fast_mode ? "fast" : "realtime"), (elapsed > 0 ? (double) bytes / elapsed / 1e6 : 0.0));
+    if (mirror_setup) {
+        printf("video: %llu frames, %.1f frames/s, %.2f MB/s decrypted, %.1f usecs cpu/frame",
+               (unsigned long long) video_frames, (elapsed > 0 ? video_frames / elapsed : 0.0),
+               (elapsed > 0 ? atomic_load(&stats.video_bytes) / elapsed / 1e6 : 0.0),
+               (video_frames ? (double) cpu_nsecs / video_frames / 1000.0 : 0.0));
+        if (!fast_mode && video_frames) {
+            printf(", latency mean %.3f max %.3f msecs",
+                   (double) atomic_load(&stats.video_latency_sum) / video_frames / 1e6,
+                   (double) atomic_load(&stats.video_latency_max) / 1e6);
+        }
+        printf("\n");
+    }
+    if (audio_setup) {
+        printf("audio: %llu frames, %.1f frames/s\n", (unsigned long long) audio_frames,
+               (elapsed > 0 ? audio_frames / elapsed : 0.0));
+    }
+    capture_reader_close(reader);
+    free(timing_samples);
+    logger_destroy(logger);
+    return 0;
+}
@@ -35,6 +35,15 @@
 #include <cstdio>
 #include <stdarg.h>
 #include <math.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #ifdef _WIN32  /*modifications for Windows compilation */
 #include <glib.h>
@@ -59,7 +68,16 @@
 #include "lib/stream.h"
 #include "lib/logger.h"
 #include "lib/dnssd.h"
+#include "lib/telemetry.h"
+#include "lib/trace.h"
+#include "lib/av_sync.h"
+#include "lib/metrics.h"
+#include "lib/utils.h"
+#include "lib/thread_config.h"
 #include "renderers/video_renderer.h"
+#include "renderers/display_refresh.h"
+#include "renderers/recorder.h"
+#include "renderers/restream.h"
 #include "renderers/audio_renderer.h"
 
 #define VERSION "1.68"
@@ -71,6 +89,7 @@
 #define LOWEST_ALLOWED_PORT 1024
 #define HIGHEST_PORT 65535
 #define NTP_TIMEOUT_LIMIT 5
+#define LOW_LATENCY_VIDEO_QUEUE_DEPTH 2
 #define BT709_FIX "capssetter caps=\"video/x-h264, colorimetry=bt709\""
 
 static std::string server_name = DEFAULT_NAME;
@@ -83,29 +102,111 @@ static int64_t audio_delay_alac = 0;
 static int64_t audio_delay_aac = 0;
 static bool relaunch_video = false;
 static bool reset_loop = false;
-static unsigned int open_connections= 0;
+static bool warm_reset = false;                 /* -warmreset */
+static std::atomic<uint64_t> reset_time{0};     /* steady_clock nsecs of the last connection reset */
+static std::atomic<unsigned int> open_connections{0};   /* changed under renderer_mutex (see low_memory_trim) */
 static std::string videosink = "autovideosink";
 static videoflip_t videoflip[2] = { NONE , NONE };
 static bool use_video = true;
 static unsigned char compression_type = 0;
 static std::string audiosink = "autoaudiosink";
 static int  audiodelay = -1;
+static bool autosync = false;
+static unsigned int autosync_bound = 20;            /* msecs */
+static std::atomic<int64_t> audio_delay_auto{0};    /* nsecs, -autosync offset added to audio_delay_aac */
+static int autosync_advertised = -1;                /* usecs */
+static unsigned int audio_buffer_ms[2] = { 0, 0 };
+static unsigned int audio_rcvbuf_kb = 0;
+static unsigned int audio_busy_poll = 0;
+static bool mirror_io_uring = false;
+static bool session_loop = false;
 static bool use_audio = true;
 static bool new_window_closing_behavior = true;
 static bool close_window;
 static std::string video_parser = "h264parse";
 static std::string video_decoder = "decodebin";
 static std::string video_converter = "videoconvert";
+static bool video_converter_option = false;   /* set by -vc (not by -avdec, -v4l2) */
 static bool show_client_FPS_data = false;
+static bool zero_copy = false;
+static bool h265_support = false;
+static bool ptp_timing = false;
+static bool buffered_audio = false;
+static video_memory_t video_memory = VIDEO_MEMORY_SYSTEM;
+static bool low_latency = false;
+static bool late_drop = false;
+static unsigned int video_release = 0;   /* secs, -vrelease */
+static std::string shm_name = "";        /* -shm */
+static unsigned int shm_fps = 10;
+static unsigned int shm_mode = 0600;       /* -shmmode */
+static bool downscale = false;
+static bool pace = false;
+static double refresh_rate = 0.0;   /* Hz, -pace */
+static unsigned short downscale_size[2] = {0};
+static std::atomic<uint64_t> connect_time{0};   /* steady_clock nsecs: first connection of a client session */
+static bool adaptive = false;
+static bool audio_shared = false;
+static bool low_memory = false;
+static unsigned int low_memory_idle = 60;   /* seconds */
+static bool audio_resample = false;
+static unsigned int audio_batch = 0;
+static bool lazy_renderers = false;
+static bool lazy_prewarm = false;
+static uint64_t startup_time = 0;
+static std::thread prewarm_thread;
+static std::mutex renderer_mutex;   /* guards the next three, and the session video renderers, for -lazy */
+static bool audio_renderer_ready = false;
+static GMainLoop *gst_loop = NULL;
+
+/* client sessions (-sessions n): each session has its own video renderer (and window or videosink);   *
+ * the audio renderer is shared, and plays the audio of the session that most recently set up audio   */
+typedef struct session_s {
+    int id;
+    video_renderer_t *video_renderer;
+    guint gst_bus_watch_id[2];
+    av_sync_t *av_sync;                     /* maps client timestamps of audio and video to local time */
+    uint64_t bench_start, bench_last, bench_cpu_start;   /* -bench: first and last frame times */
+    uint64_t bench_frames, bench_bytes;
+    recorder_t *recorder;                   /* -record: guarded by recorder_mutex */
+    unsigned char record_audio_ct;          /* audio format set up by the client (0 if none yet) */
+    int adaptive_level;                     /* -adaptive level offered when video was set up (renderer_mutex) */
+} session_t;
+static session_t sessions[RAOP_MAX_SESSIONS];
+static unsigned int max_sessions = 1;
+static uint64_t session_cpus[RAOP_MAX_SESSIONS] = { 0 };
+static std::atomic<int> audio_session{0};
+static std::atomic<int> adaptive_level{0};   /* read by video_setup */
+static int adaptive_overloaded = 0;
+static int adaptive_idle = 0;
+static unsigned int telemetry_interval = 0;
+static std::string telemetry_filename = "";
+static std::string trace_filename = "";       /* -trace */
+static std::string capture_dir = "";
+static bool bench_mode = false;
+static bool bench_decode = true;
+static unsigned short metrics_port = 0;
+static std::string statsd_host = "";
+static unsigned short statsd_port = 8125;
+static unsigned int statsd_interval = METRICS_DEFAULT_INTERVAL;
+static unsigned int max_connections = 0;
+static unsigned int httpd_workers = 0;
+static int video_queue_depth = -1;
 static unsigned int max_ntp_timeouts = NTP_TIMEOUT_LIMIT;
-static FILE *video_dumpfile = NULL;
+static bool video_dump_open = false;
 static std::string video_dumpfile_name = "videodump";
 static int video_dump_limit = 0;
 static int video_dumpfile_count = 0;
 static int video_dump_count = 0;
 static bool dump_video = false;
+static std::string record_filename = "";
+static unsigned int record_count = 0;
+static bool record_failed = false;
+static std::vector<std::string> restream_urls;
+static restream_t *restreamer = NULL;      /* -restream: guarded by recorder_mutex */
+static int restream_session = -1;          /* the session being restreamed */
+static std::mutex recorder_mutex;
 static unsigned char mark[] = { 0x00, 0x00, 0x00, 0x01 };
-static FILE *audio_dumpfile = NULL;
+static bool audio_dump_open = false;
 static std::string audio_dumpfile_name = "audiodump";
 static int audio_dump_limit = 0;
 static int audio_dumpfile_count = 0;
@@ -113,18 +214,19 @@ static int audio_dump_count = 0;
 static bool dump_audio = false;
 static unsigned char audio_type = 0x00;
 static unsigned char previous_audio_type = 0x00;
+static std::mutex audio_format_mutex;   /* audio SETUPs of different sessions (-sessions) may run in parallel */
 static bool fullscreen = false;
 static std::string coverart_filename = "";
 static bool do_append_hostname = true;
 static bool use_random_hw_addr = false;
 static unsigned short display[5] = {0}, tcp[3] = {0}, udp[3] = {0};
 static bool debug_log = DEFAULT_DEBUG_LOG;
+static bool log_async = false;
 static int log_level = LOGGER_INFO;
 static bool bt709_fix = false;
 static int nohold = 0;
 static unsigned short raop_port;
 static unsigned short airplay_port;
-static uint64_t remote_clock_offset = 0;
 static std::vector<std::string> allowed_clients;
 static std::vector<std::string> blocked_clients;
 static bool restrict_clients;
@@ -134,9 +236,11 @@ static unsigned short pin = 0;
 static std::string keyfile = "";
 static std::string mac_address = "";
 static std::string dacpfile = "";
+static std::mutex dacp_mutex;   /* export_dacp may be called for several sessions at once */
 static bool registration_list = false;
 static std::string pairing_register = "";
 static std::vector <std::string> registered_keys;
+static std::mutex registration_mutex;   /* guards registered_keys and the pairing register file (-reg) */
 static double db_low = -30.0;
 static double db_high = 0.0;
 static bool taper_volume = false;
@@ -202,11 +306,30 @@ static const unsigned char empty_image[] = {
     0x0a, 0x49, 0x44, 0x41, 0x54, 0x08, 0xd7, 0x63,  0x60, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01, 0xe2,
     0x21, 0xbc, 0x33, 0x00, 0x00, 0x00, 0x00, 0x49,  0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82 };
 
-static size_t write_coverart(const char *filename, const void *image, size_t len) {
-    FILE *fp = fopen(filename, "wb");
+/* the image is written to a temporary file which then replaces the cover-art file, *
+ * so a reader of the cover-art file never sees a partially-written image           */
+static bool write_coverart(const char *filename, const void *image, size_t len) {
+    std::string tmpname = std::string(filename) + ".tmp";
+    FILE *fp = fopen(tmpname.c_str(), "wb");
+    if (fp == NULL) {
+        LOGE("could not open %s for writing cover-art", tmpname.c_str());
+        return false;
+    }
     size_t count = fwrite(image, 1, len, fp);
-    fclose(fp);
-    return count;
+    if (fclose(fp) != 0 || count != len) {
+        LOGE("failed to write cover-art to %s", tmpname.c_str());
+        remove(tmpname.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(filename);   /* rename does not replace an existing file on Windows */
+#endif
+    if (rename(tmpname.c_str(), filename) != 0) {
+        LOGE("could not rename %s to %s", tmpname.c_str(), filename);
+        remove(tmpname.c_str());
+        return false;
+    }
+    return true;
 }
 
 static char *create_pin_display(char *pin_str, int margin, int gap) {
@@ -281,8 +404,323 @@ static char *create_pin_display(char *pin_str, int margin, int gap) {
     return pin_image;
 }
 
+/* Stream dumps (-vdmp, -admp) are written by a dedicated thread, so that slow storage  *
+ * (e.g. an SD card) cannot stall the mirror and audio receive threads: the receive     *
+ * thread copies each frame into a single-producer single-consumer byte ring, and the   *
+ * writer thread drains it, coalescing frames into large writes. When the ring is full, *
+ * frames are dropped (and counted) rather than blocking the receive thread             */
+
+#define DUMP_RECORD_OPEN  1
+#define DUMP_RECORD_DATA  2
+#define DUMP_RECORD_CLOSE 3
+#define DUMP_CONTROL_RESERVE 4096
+#define DUMP_WRITE_SIZE (1 << 20)
+#define VIDEO_DUMP_RING_SIZE (1 << 24)
+#define AUDIO_DUMP_RING_SIZE (1 << 20)
+
+typedef struct dump_record_s {
+    uint32_t type;
+    uint32_t len;
+} dump_record_t;
+
+typedef struct dump_writer_s {
+    const char *name;
+    std::vector<unsigned char> ring;
+    size_t mask;
+    std::atomic<size_t> head;  /* written only by the producer */
+    std::atomic<size_t> tail;  /* written only by the writer thread */
+    std::atomic<bool> running;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    /* producer-side statistics */
+    uint64_t frames;
+    uint64_t dropped_frames;
+    uint64_t dropped_bytes;
+} dump_writer_t;
+
+static dump_writer_t *video_dump_writer = NULL;
+static dump_writer_t *audio_dump_writer = NULL;
+
+static void dump_ring_copy_in(dump_writer_t *writer, size_t pos, const void *src, size_t len) {
+    size_t index = pos & writer->mask;
+    size_t first = std::min(len, writer->ring.size() - index);
+    memcpy(&writer->ring[index], src, first);
+    if (len > first) {
+        memcpy(&writer->ring[0], (const unsigned char *) src + first, len - first);
+    }
+}
+
+static void dump_ring_copy_out(dump_writer_t *writer, size_t pos, void *dst, size_t len) {
+    size_t index = pos & writer->mask;
+    size_t first = std::min(len, writer->ring.size() - index);
+    memcpy(dst, &writer->ring[index], first);
+    if (len > first) {
+        memcpy((unsigned char *) dst + first, &writer->ring[0], len - first);
+    }
+}
+
+/* called from the receive thread: never blocks. A data record is only queued if it leaves *
+ * DUMP_CONTROL_RESERVE bytes free, so that the following open/close records will fit       */
+static bool dump_writer_push(dump_writer_t *writer, uint32_t type, const void *data, size_t len) {
+    size_t head = writer->head.load(std::memory_order_relaxed);
+    size_t tail = writer->tail.load(std::memory_order_acquire);
+    size_t available = writer->ring.size() - (head - tail);
+    size_t needed = sizeof(dump_record_t) + len + (type == DUMP_RECORD_DATA ? DUMP_CONTROL_RESERVE : 0);
+    if (needed > available) {
+        if (type == DUMP_RECORD_DATA) {
+            writer->dropped_frames++;
+            writer->dropped_bytes += len;
+        } else {
+            LOGE("%s dump: no space to queue a file %s request", writer->name,
+                 (type == DUMP_RECORD_OPEN ? "open" : "close"));
+        }
+        return false;
+    }
+    dump_record_t record = { type, (uint32_t) len };
+    dump_ring_copy_in(writer, head, &record, sizeof(record));
+    if (len) {
+        dump_ring_copy_in(writer, head + sizeof(record), data, len);
+    }
+    writer->head.store(head + sizeof(record) + len, std::memory_order_release);
+    if (type == DUMP_RECORD_DATA) {
+        writer->frames++;
+    }
+    writer->wake.notify_one();
+    return true;
+}
+
+static void dump_writer_flush(FILE *file, std::vector<unsigned char> &buf, size_t *count) {
+    if (file && *count) {
+        fwrite(buf.data(), 1, *count, file);
+    }
+    *count = 0;
+}
+
+static void dump_writer_thread(dump_writer_t *writer) {
+    std::vector<unsigned char> buf(DUMP_WRITE_SIZE);
+    std::string filename;
+    size_t count = 0;
+    FILE *file = NULL;
+    while (true) {
+        size_t tail = writer->tail.load(std::memory_order_relaxed);
+        size_t head = writer->head.load(std::memory_order_acquire);
+        if (tail == head) {
+            /* ring is empty: write out what has been collected, then sleep */
+            dump_writer_flush(file, buf, &count);
+            if (!writer->running.load()) {
+                break;
+            }
+            std::unique_lock<std::mutex> lock(writer->wake_mutex);
+            writer->wake.wait_for(lock, std::chrono::milliseconds(50));
+            continue;
+        }
+        dump_record_t record;
+        dump_ring_copy_out(writer, tail, &record, sizeof(record));
+        tail += sizeof(record);
+        switch (record.type) {
+        case DUMP_RECORD_OPEN:
+            filename.resize(record.len);
+            dump_ring_copy_out(writer, tail, &filename[0], record.len);
+            file = fopen(filename.c_str(), "wb");
+            if (file == NULL) {
+                LOGE("could not open file %s for dumping %s frames", filename.c_str(), writer->name);
+            } else {
+                /* all writes are made in large blocks from buf */
+                setvbuf(file, NULL, _IONBF, 0);
+            }
+            break;
+        case DUMP_RECORD_DATA:
+            if (count + record.len > buf.size()) {
+                dump_writer_flush(file, buf, &count);
+            }
+            if (record.len > buf.size()) {
+                std::vector<unsigned char> frame(record.len);
+                dump_ring_copy_out(writer, tail, frame.data(), record.len);
+                if (file) {
+                    fwrite(frame.data(), 1, record.len, file);
+                }
+            } else {
+                dump_ring_copy_out(writer, tail, &buf[count], record.len);
+                count += record.len;
+            }
+            break;
+        case DUMP_RECORD_CLOSE:
+            dump_writer_flush(file, buf, &count);
+            if (file) {
+                fclose(file);
+                file = NULL;
+            }
+            break;
+        default:
+            break;
+        }
+        writer->tail.store(tail + record.len, std::memory_order_release);
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+static dump_writer_t *dump_writer_start(const char *name, size_t ring_size) {
+    dump_writer_t *writer = new dump_writer_t;
+    writer->name = name;
+    writer->ring.resize(ring_size);  /* ring_size must be a power of 2 */
+    writer->mask = ring_size - 1;
+    writer->head = 0;
+    writer->tail = 0;
+    writer->running = true;
+    writer->frames = 0;
+    writer->dropped_frames = 0;
+    writer->dropped_bytes = 0;
+    writer->thread = std::thread(dump_writer_thread, writer);
+    return writer;
+}
+
+static void dump_writer_stop(dump_writer_t *writer) {
+    if (!writer) {
+        return;
+    }
+    writer->running = false;
+    writer->wake.notify_one();
+    writer->thread.join();
+    if (writer->dropped_frames) {
+        LOGW("%s dump: %llu of %llu frames (%llu bytes) were dropped because the writer fell behind",
+             writer->name, (unsigned long long) writer->dropped_frames,
+             (unsigned long long) (writer->frames + writer->dropped_frames),
+             (unsigned long long) writer->dropped_bytes);
+    }
+    delete writer;
+}
+
+static void dump_writer_open(dump_writer_t *writer, const std::string &filename) {
+    dump_writer_push(writer, DUMP_RECORD_OPEN, filename.c_str(), filename.length());
+}
+
+static bool dump_writer_write(dump_writer_t *writer, const unsigned char *data, int datalen) {
+    return dump_writer_push(writer, DUMP_RECORD_DATA, data, (size_t) datalen);
+}
+
+static void dump_writer_close(dump_writer_t *writer) {
+    dump_writer_push(writer, DUMP_RECORD_CLOSE, NULL, 0);
+}
+
+/* Cover art and DMAP metadata received from the client are handed to a background worker, so  *
+ * that writing images to (possibly slow) storage does not hold up the thread that received  *
+ * them.  Only the latest cover-art image waiting to be written is kept, and an image with the *
+ * same content as the last one written is skipped.                                           */
+typedef struct artwork_writer_s {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool running;
+    bool coverart_pending;
+    std::vector<unsigned char> coverart;
+    std::vector<std::vector<unsigned char>> metadata;
+    bool have_hash;
+    uint64_t last_hash;    /* of the last image written */
+} artwork_writer_t;
+
+static artwork_writer_t *artwork_writer = NULL;
+
+static void process_metadata_listing(const unsigned char *metadata, int buflen);
+
+/* FNV-1a */
+static uint64_t artwork_hash(const std::vector<unsigned char> &data) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void artwork_writer_thread(artwork_writer_t *writer) {
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    while (true) {
+        if (!writer->metadata.empty()) {
+            std::vector<std::vector<unsigned char>> metadata;
+            metadata.swap(writer->metadata);
+            lock.unlock();
+            for (const std::vector<unsigned char> &listing : metadata) {
+                process_metadata_listing(listing.data(), (int) listing.size());
+            }
+            lock.lock();
+            continue;
+        }
+        if (writer->coverart_pending) {
+            std::vector<unsigned char> image;
+            image.swap(writer->coverart);
+            writer->coverart_pending = false;
+            uint64_t hash = artwork_hash(image);
+            bool written = false;
+            lock.unlock();
+            if (writer->have_hash && hash == writer->last_hash) {
+                LOGD("coverart size %d is unchanged, not rewritten", (int) image.size());
+            } else if (write_coverart(coverart_filename.c_str(), image.data(), image.size())) {
+                if (image.size() != sizeof(empty_image) || memcmp(image.data(), empty_image, sizeof(empty_image))) {
+                    LOGI("coverart size %d written to %s", (int) image.size(), coverart_filename.c_str());
+                }
+                written = true;
+            }
+            lock.lock();
+            if (written) {
+                writer->have_hash = true;
+                writer->last_hash = hash;
+            }
+            continue;
+        }
+        if (!writer->running) {
+            break;
+        }
+        writer->wake.wait(lock);
+    }
+}
+
+static artwork_writer_t *artwork_writer_start() {
+    artwork_writer_t *writer = new artwork_writer_t;
+    writer->running = true;
+    writer->coverart_pending = false;
+    writer->have_hash = false;
+    writer->last_hash = 0;
+    writer->thread = std::thread(artwork_writer_thread, writer);
+    return writer;
+}
+
+/* pending metadata and cover art are processed before the worker exits */
+static void artwork_writer_stop(artwork_writer_t *writer) {
+    if (!writer) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->running = false;
+    }
+    writer->wake.notify_one();
+    writer->thread.join();
+    delete writer;
+}
+
+static void artwork_writer_coverart(artwork_writer_t *writer, const void *image, size_t len) {
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        const unsigned char *data = (const unsigned char *) image;
+        writer->coverart.assign(data, data + len);
+        writer->coverart_pending = true;
+    }
+    writer->wake.notify_one();
+}
+
+static void artwork_writer_metadata(artwork_writer_t *writer, const void *buffer, size_t len) {
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        const unsigned char *data = (const unsigned char *) buffer;
+        writer->metadata.emplace_back(data, data + len);
+    }
+    writer->wake.notify_one();
+}
+
 static void dump_audio_to_file(unsigned char *data, int datalen, unsigned char type) {
-    if (!audio_dumpfile && audio_type != previous_audio_type) {
+    if (!audio_dump_open && audio_type != previous_audio_type) {
         char suffix[20];
         std::string fn = audio_dumpfile_name;
         previous_audio_type = audio_type;
@@ -297,19 +735,17 @@ static void dump_audio_to_file(unsigned char *data, int datalen, unsigned char t
             snprintf(suffix, sizeof(suffix), ".%d.aud", audio_dumpfile_count);
         }
         fn.append(suffix);
-        audio_dumpfile = fopen(fn.c_str(),"w");
-        if (audio_dumpfile == NULL) {
-            LOGE("could not open file %s for dumping audio frames",fn.c_str());
-        }
+        dump_writer_open(audio_dump_writer, fn);
+        audio_dump_open = true;
     }
 
-    if (audio_dumpfile) {
-        fwrite(data, 1, datalen, audio_dumpfile);
-        if (audio_dump_limit) {
+    if (audio_dump_open) {
+        /* frames dropped by the writer do not count towards the limit */
+        if (dump_writer_write(audio_dump_writer, data, datalen) && audio_dump_limit) {
             audio_dump_count++;
             if (audio_dump_count == audio_dump_limit) {
-                fclose(audio_dumpfile);
-                audio_dumpfile = NULL;
+                dump_writer_close(audio_dump_writer);
+                audio_dump_open = false;
             }          
         }
     }
@@ -317,14 +753,14 @@ static void dump_audio_to_file(unsigned char *data, int datalen, unsigned char t
 
 static void dump_video_to_file(unsigned char *data, int datalen) {
     /*  SPS NAL has (data[4] & 0x1f) = 0x07  */
-    if ((data[4] & 0x1f) == 0x07  && video_dumpfile && video_dump_limit) {
-        fwrite(mark, 1, sizeof(mark), video_dumpfile);
-        fclose(video_dumpfile);
-        video_dumpfile = NULL;
+    if ((data[4] & 0x1f) == 0x07  && video_dump_open && video_dump_limit) {
+        dump_writer_write(video_dump_writer, mark, sizeof(mark));
+        dump_writer_close(video_dump_writer);
+        video_dump_open = false;
         video_dump_count = 0;                     
     }
 
-    if (!video_dumpfile) {
+    if (!video_dump_open) {
         std::string fn = video_dumpfile_name;
         if (video_dump_limit) {
             char suffix[20];
@@ -333,22 +769,358 @@ static void dump_video_to_file(unsigned char *data, int datalen) {
             fn.append(suffix);
 	}
         fn.append(".h264");
-        video_dumpfile = fopen (fn.c_str(),"w");
-        if (video_dumpfile == NULL) {
-            LOGE("could not open file %s for dumping h264 frames",fn.c_str());
-        }
+        dump_writer_open(video_dump_writer, fn);
+        video_dump_open = true;
     }
 
-    if (video_dumpfile) {
-        if (video_dump_limit == 0) {
-            fwrite(data, 1, datalen, video_dumpfile);
-        } else if (video_dump_count < video_dump_limit) {
+    if (video_dump_limit == 0) {
+        dump_writer_write(video_dump_writer, data, datalen);
+    } else if (video_dump_count < video_dump_limit) {
+        if (dump_writer_write(video_dump_writer, data, datalen)) {
             video_dump_count++;
-            fwrite(data, 1, datalen, video_dumpfile);
         }
     }
 }
 
+static uint64_t steady_time_nsecs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* CPU time used by all threads of the process (0 if not available) */
+static uint64_t process_cpu_nsecs() {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0) {
+        return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/* resident set size in kB (0 if not available) */
+static long get_rss_kb() {
+#if defined(__linux__)
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return 0;
+#endif
+}
+
+static void ensure_audio_renderer() {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    if (audio_renderer_ready) {
+        return;
+    }
+    uint64_t start = steady_time_nsecs();
+    long rss = get_rss_kb();
+    audio_renderer_force_resample(audio_resample);
+    audio_renderer_set_batch(audio_batch);
+    audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync, &audio_shared);
+    audio_renderer_ready = true;
+    LOGI("audio renderer (%s) initialized in %.1f ms, RSS %+ld kB", (audio_shared ? "one shared pipeline" :
+         "one pipeline per format"), (double) (steady_time_nsecs() - start) / 1000000.0, get_rss_kb() - rss);
+}
+
+/* the session passed as cls by the raop callbacks (session 0 if none) */
+static session_t *get_session(void *cls) {
+    return (cls ? (session_t *) cls : &sessions[0]);
+}
+
+/* "%d" in the videosink is replaced by the session number (e.g., for a  connector or display id) */
+static std::string session_videosink(int id) {
+    std::string sink = videosink;
+    size_t pos = sink.find("%d");
+    if (pos != std::string::npos) {
+        sink.replace(pos, 2, std::to_string(id));
+    }
+    return sink;
+}
+
+static video_renderer_t *video_renderer_create(int id) {
+    std::string sink = session_videosink(id);
+    video_renderer_set_output_size(downscale_size[0], downscale_size[1]);
+    video_renderer_set_frame_export(shm_name.length() ? shm_name.c_str() : NULL, shm_fps, shm_mode);
+    video_renderer_set_refresh_rate(refresh_rate);
+    video_renderer_t *renderer = video_renderer_init(id, render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
+                                                     video_decoder.c_str(), video_converter.c_str(), sink.c_str(),
+                                                     &fullscreen, &video_sync, &h265_support, video_memory, &low_latency);
+    if (late_drop) {
+        video_renderer_set_late_drop(renderer, true);
+    }
+    if (video_release) {
+        video_renderer_set_release_delay(renderer, video_release * 1000);
+    }
+    return renderer;
+}
+
+static void ensure_video_renderer(session_t *session) {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    if (session->video_renderer) {
+        return;
+    }
+    uint64_t start = steady_time_nsecs();
+    long rss = get_rss_kb();
+    session->video_renderer = video_renderer_create(session->id);
+    video_renderer_start(session->video_renderer);
+    if (gst_loop) {
+        for (int i = 0; i < 2; i++) {
+            session->gst_bus_watch_id[i] = (guint) video_renderer_listen(session->video_renderer, (void *) gst_loop, i);
+        }
+    }
+    if (max_sessions > 1) {
+        LOGI("video renderer for session %d initialized in %.1f ms, RSS %+ld kB", session->id,
+             (double) (steady_time_nsecs() - start) / 1000000.0, get_rss_kb() - rss);
+    } else {
+        LOGI("video renderer initialized in %.1f ms, RSS %+ld kB", (double) (steady_time_nsecs() - start) / 1000000.0,
+             get_rss_kb() - rss);
+    }
+}
+
+/* -lazy prewarm: build the renderers in the background once UxPlay is ready for connections */
+static void prewarm_renderers() {
+    if (use_audio) {
+        ensure_audio_renderer();
+    }
+    if (use_video) {
+        ensure_video_renderer(&sessions[0]);
+    }
+}
+
+/* -adaptive: steps in the video resolution (scale) and framerate offered to clients, relative to the *
+ * -s/-fps settings; the receiver moves down a level when its video pipeline falls behind (GStreamer     *
+ * QoS drops), and back up when it has headroom.  AirPlay clients only read these at connection time.   */
+#define ADAPTIVE_INTERVAL 5          /* seconds between load checks */
+#define ADAPTIVE_DOWN_CHECKS 2       /* consecutive overloaded checks before stepping down */
+#define ADAPTIVE_UP_CHECKS 24        /* consecutive idle checks at full load before stepping up */
+#define ADAPTIVE_FULL_LOAD 90        /* full load: percent of the offered frame rate actually streamed */
+#define ADAPTIVE_DROP_HIGH 50        /* overloaded: dropped frames per 1000 */
+#define ADAPTIVE_DROP_LOW 5          /* idle: dropped frames per 1000 */
+static const struct { double scale; double fps; } adaptive_levels[] = {
+    { 1.0, 1.0 }, { 1.0, 0.8 }, { 0.75, 0.8 }, { 0.75, 0.5 }, { 0.5, 0.5 }
+};
+#define ADAPTIVE_LEVELS ((int) (sizeof(adaptive_levels) / sizeof(adaptive_levels[0])))
+
+/* -autosync: instead of hand-tuned -al and -vsync offsets, the latencies that GStreamer reports for the audio *
+ * and video pipelines (queried when they start and whenever they change, e.g. after new caps) set the audio *
+ * latency advertised to clients, and the audio offset that keeps mirror audio in step with the video.        *
+ * Changes within the lip-sync bound are not applied, so the offset does not follow every small fluctuation. */
+#define AUTOSYNC_INTERVAL 1          /* seconds between checks */
+#define AUTOSYNC_MAX_OFFSET 500      /* msecs */
+
+static gboolean autosync_callback(gpointer loop) {
+    uint64_t audio_latency, video_latency;
+    int64_t bound = (int64_t) autosync_bound * 1000000;
+    if (!raop || !use_audio || !audio_renderer_get_latency(&audio_latency)) {
+        return TRUE;
+    }
+    if (audiodelay < 0) {
+        /* the client delays its own video (audio-only ALAC streams) by the advertised audio latency */
+        int micros = (int) (audio_latency / 1000);
+        int64_t change = (int64_t) (micros - autosync_advertised) * 1000;
+        if (autosync_advertised < 0 || change > bound || change < -bound) {
+            autosync_advertised = micros;
+            raop_set_plist(raop, "audio_delay_micros", micros);
+            LOGI("autosync: audio latency %.1f ms will be reported to clients", (double) micros / 1000.0);
+        }
+    }
+    if (!use_video || !video_sync) {
+        return TRUE;
+    }
+    bool have_video = false;
+    renderer_mutex.lock();
+    session_t *session = &sessions[audio_session];
+    if (session->video_renderer) {
+        have_video = video_renderer_get_latency(session->video_renderer, &video_latency);
+    }
+    renderer_mutex.unlock();
+    if (!have_video) {
+        return TRUE;
+    }
+    int64_t max_offset = (int64_t) AUTOSYNC_MAX_OFFSET * 1000000;
+    int64_t offset = (int64_t) video_latency - (int64_t) audio_latency;
+    offset = (offset > max_offset ? max_offset : (offset < -max_offset ? -max_offset : offset));
+    int64_t change = offset - audio_delay_auto.load();
+    if (change > bound || change < -bound) {
+        audio_delay_auto = offset;
+        LOGI("autosync: mirror audio offset %+.1f ms (pipeline latencies: video %.1f ms, audio %.1f ms)",
+             (double) offset / 1000000.0, (double) video_latency / 1000000.0, (double) audio_latency / 1000000.0);
+    }
+    return TRUE;
+}
+
+static void adaptive_get_offer(int level, int *width, int *height, int *fps) {
+    *width = (display[0] ? display[0] : 1920);
+    *height = (display[1] ? display[1] : 1080);
+    *fps = (display[3] ? display[3] : 30);
+    /* keep dimensions multiples of 16 (macroblocks) */
+    *width = ((int) (*width * adaptive_levels[level].scale) / 16) * 16;
+    *height = ((int) (*height * adaptive_levels[level].scale) / 16) * 16;
+    *fps = (int) (*fps * adaptive_levels[level].fps + 0.5);
+    if (*fps < 1) {
+        *fps = 1;
+    }
+}
+
+static void adaptive_apply_level() {
+    int width, height, fps;
+    adaptive_get_offer(adaptive_level, &width, &height, &fps);
+    raop_set_video_offer(raop, width, height, fps);
+    if (adaptive_level) {
+        LOGI("adaptive: offering %dx%d at up to %d fps to clients (level %d of %d)", width, height, fps,
+             adaptive_level.load(), ADAPTIVE_LEVELS - 1);
+    } else {
+        LOGI("adaptive: offering the full %dx%d at up to %d fps to clients", width, height, fps);
+    }
+}
+
+/* only intervals in which every mirroring session streamed at (nearly) the frame rate it was offered are *
+ * evidence of headroom: a static screen, or a session running at a reduced offer well below its limit, *
+ * says nothing about the load of a higher offer                                                          */
+static gboolean adaptive_callback(gpointer loop) {
+    unsigned int frames = 0, dropped = 0;
+    bool full_load = true;
+    renderer_mutex.lock();
+    for (unsigned int i = 0; i < max_sessions; i++) {
+        if (sessions[i].video_renderer) {
+            unsigned int session_frames, session_dropped;
+            video_renderer_get_load(sessions[i].video_renderer, &session_frames, &session_dropped);
+            frames += session_frames;
+            dropped += session_dropped;
+            if (session_frames) {
+                int width, height, fps;
+                adaptive_get_offer(sessions[i].adaptive_level, &width, &height, &fps);
+                if (session_frames * 100 < (unsigned int) (fps * ADAPTIVE_INTERVAL * ADAPTIVE_FULL_LOAD)) {
+                    full_load = false;
+                }
+            }
+        }
+    }
+    renderer_mutex.unlock();
+    if (!raop || frames < ADAPTIVE_INTERVAL) {
+        adaptive_idle = 0;
+        return TRUE;   /* not mirroring */
+    }
+    int level = adaptive_level;
+    if (dropped * 1000 > frames * ADAPTIVE_DROP_HIGH) {
+        adaptive_idle = 0;
+        if (++adaptive_overloaded >= ADAPTIVE_DOWN_CHECKS && level < ADAPTIVE_LEVELS - 1) {
+            LOGI("adaptive: video renderer is falling behind (%u of %u frames dropped in %d secs)",
+                 dropped, frames, ADAPTIVE_INTERVAL);
+            level++;
+        }
+    } else if (dropped * 1000 < frames * ADAPTIVE_DROP_LOW && full_load) {
+        adaptive_overloaded = 0;
+        if (++adaptive_idle >= ADAPTIVE_UP_CHECKS && level > 0) {
+            level--;
+        }
+    } else {
+        adaptive_overloaded = 0;
+        adaptive_idle = 0;   /* some drops, or not at full load: the idle checks must be consecutive */
+    }
+    if (level != adaptive_level) {
+        adaptive_level = level;
+        adaptive_overloaded = 0;
+        adaptive_idle = 0;
+        adaptive_apply_level();
+        LOGI("adaptive: the new settings will be used when the client next connects");
+    }
+    return TRUE;
+}
+
+/* -lowmem: the RSS is sampled while clients are connected (the peak is reported when the last one *
+ * leaves); after low_memory_idle seconds without connections, the renderers release their        *
+ * GStreamer pipelines and buffer pools, the mirror frame pool is emptied, and freed heap memory is  *
+ * returned to the system.  The renderers are rebuilt or restarted by the next connection.        */
+#define LOW_MEMORY_INTERVAL 2       /* seconds between checks */
+static long session_peak_rss = 0;
+static unsigned int low_memory_idle_secs = 0;
+static bool low_memory_trimmed = false;
+
+static void log_memory_footprint(const char *when) {
+    raop_memory_t memory = { 0 };
+    std::string video_states;
+    if (raop) {
+        raop_get_memory(raop, &memory);
+    }
+    renderer_mutex.lock();
+    for (unsigned int i = 0; i < max_sessions; i++) {
+        video_states += (!sessions[i].video_renderer ? " none" :
+                         (video_renderer_is_suspended(sessions[i].video_renderer) ? " suspended" : " ready"));
+    }
+    bool audio_ready = audio_renderer_ready;
+    renderer_mutex.unlock();
+    LOGI("memory %s: RSS %ld kB; mirror frames %zu kB in use, %zu kB cached; video buffer pool %zu kB;"
+         " httpd %zu kB (largest request %zu kB); audio renderer %s; video renderers:%s", when, get_rss_kb(),
+         memory.frame_pool_in_use / 1024, memory.frame_pool_cached / 1024, video_renderer_get_pooled_bytes() / 1024,
+         memory.httpd / 1024, memory.httpd_request_peak / 1024, (audio_ready ? "built" : "released"),
+         video_states.c_str());
+}
+
+/* returns false (nothing trimmed) if a client connected since the idle check */
+static bool low_memory_trim() {
+    long rss = get_rss_kb();
+    size_t released = 0;
+    renderer_mutex.lock();
+    if (open_connections) {
+        renderer_mutex.unlock();
+        return false;
+    }
+    if (audio_renderer_ready) {
+        audio_renderer_destroy();
+        audio_renderer_ready = false;
+    }
+    for (unsigned int i = 0; i < max_sessions; i++) {
+        if (sessions[i].video_renderer && !video_renderer_is_suspended(sessions[i].video_renderer)) {
+            video_renderer_suspend(sessions[i].video_renderer);
+        }
+    }
+    /* (a new connection waits in conn_init until the buffers are released) */
+    released += video_renderer_get_pooled_bytes();
+    video_renderer_free_buffers();
+    if (raop) {
+        released += raop_trim_memory(raop);
+    }
+    renderer_mutex.unlock();
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    LOGI("low-memory mode: idle for %u secs, released pipelines and %zu kB of buffers; RSS %ld kB -> %ld kB",
+         low_memory_idle, released / 1024, rss, get_rss_kb());
+    log_memory_footprint("while idle");
+    return true;
+}
+
+static gboolean low_memory_callback(gpointer loop) {
+    if (open_connections) {
+        long rss = get_rss_kb();
+        if (rss > session_peak_rss) {
+            session_peak_rss = rss;
+        }
+        low_memory_idle_secs = 0;
+        low_memory_trimmed = false;
+        return TRUE;
+    }
+    if (session_peak_rss) {
+        LOGI("low-memory mode: peak RSS during the session was %ld kB", session_peak_rss);
+        log_memory_footprint("after the session");
+        session_peak_rss = 0;
+    }
+    low_memory_idle_secs += LOW_MEMORY_INTERVAL;
+    if (!low_memory_trimmed && low_memory_idle_secs >= low_memory_idle) {
+        low_memory_trimmed = low_memory_trim();
+    }
+    return TRUE;
+}
+
 static gboolean reset_callback(gpointer loop) {
     if (reset_loop) {
         g_main_loop_quit((GMainLoop *) loop);
@@ -368,6 +1140,12 @@ static gboolean  sigterm_callback(gpointer loop) {
     return TRUE;
 }
 
+/* -trace: SIGUSR1 writes the trace so far (recording continues) */
+static gboolean  sigusr1_callback(gpointer loop) {
+    trace_write(trace_filename.c_str());
+    return TRUE;
+}
+
 #ifdef _WIN32
 struct signal_handler {
     GSourceFunc handler;
@@ -390,22 +1168,60 @@ static guint g_unix_signal_add(gint signum, GSourceFunc handler, gpointer user_d
 #endif
 
 static void main_loop()  {
-    guint gst_bus_watch_id = 0;
     GMainLoop *loop = g_main_loop_new(NULL,FALSE);
     relaunch_video = false;
     if (use_video) {
         relaunch_video = true;
-        gst_bus_watch_id = (guint) video_renderer_listen((void *)loop);
     }
+    renderer_mutex.lock();
+    gst_loop = loop;
+    for (unsigned int n = 0; n < max_sessions; n++) {
+        if (sessions[n].video_renderer) {
+            for (int i = 0; i < 2; i++) {
+                sessions[n].gst_bus_watch_id[i] = (guint) video_renderer_listen(sessions[n].video_renderer, (void *)loop, i);
+            }
+        }
+    }
+    renderer_mutex.unlock();
     guint reset_watch_id = g_timeout_add(100, (GSourceFunc) reset_callback, (gpointer) loop);
+    guint adaptive_watch_id = 0;
+    if (adaptive && use_video) {
+        adaptive_watch_id = g_timeout_add_seconds(ADAPTIVE_INTERVAL, (GSourceFunc) adaptive_callback, (gpointer) loop);
+    }
+    guint autosync_watch_id = 0;
+    if (autosync) {
+        autosync_watch_id = g_timeout_add_seconds(AUTOSYNC_INTERVAL, (GSourceFunc) autosync_callback, (gpointer) loop);
+    }
+    guint low_memory_watch_id = 0;
+    if (low_memory) {
+        low_memory_watch_id = g_timeout_add_seconds(LOW_MEMORY_INTERVAL, (GSourceFunc) low_memory_callback, (gpointer) loop);
+    }
     guint sigterm_watch_id = g_unix_signal_add(SIGTERM, (GSourceFunc) sigterm_callback, (gpointer) loop);
     guint sigint_watch_id = g_unix_signal_add(SIGINT, (GSourceFunc) sigint_callback, (gpointer) loop);
+    guint sigusr1_watch_id = 0;
+#ifndef _WIN32
+    if (trace_filename.length()) {
+        sigusr1_watch_id = g_unix_signal_add(SIGUSR1, (GSourceFunc) sigusr1_callback, (gpointer) loop);
+    }
+#endif
     g_main_loop_run(loop);
 
-    if (gst_bus_watch_id > 0) g_source_remove(gst_bus_watch_id);
+    renderer_mutex.lock();
+    for (unsigned int n = 0; n < max_sessions; n++) {
+        for (int i = 0; i < 2; i++) {
+            if (sessions[n].gst_bus_watch_id[i] > 0) g_source_remove(sessions[n].gst_bus_watch_id[i]);
+            sessions[n].gst_bus_watch_id[i] = 0;
+        }
+    }
+    gst_loop = NULL;
+    renderer_mutex.unlock();
     if (sigint_watch_id > 0) g_source_remove(sigint_watch_id);
     if (sigterm_watch_id > 0) g_source_remove(sigterm_watch_id);
+    if (sigusr1_watch_id > 0) g_source_remove(sigusr1_watch_id);
     if (reset_watch_id > 0) g_source_remove(reset_watch_id);
+    if (adaptive_watch_id > 0) g_source_remove(adaptive_watch_id);
+    if (autosync_watch_id > 0) g_source_remove(autosync_watch_id);
+    if (low_memory_watch_id > 0) g_source_remove(low_memory_watch_id);
     g_main_loop_unref(loop);
 }    
 
@@ -582,6 +1398,8 @@ static void print_info (char *name) {
     printf("          optional: set maximum to h dB (+ or -) default: -30.0:0.0 dB\n");
     printf("-taper    Use a \"tapered\" AirPlay volume-control profile\n"); 
     printf("-s wxh[@r]Set display resolution [refresh_rate] default 1920x1080[@60]\n");
+    printf("-downscale [wxh] Decode to at most wxh (default: -s size, or 1280x720), asking the\n");
+    printf("          client for it, and scaling in hardware right after the decoder if possible\n");
     printf("-o        Set display \"overscanned\" mode on (not usually needed)\n");
     printf("-fs       Full-screen (only works with X11, Wayland, VAAPI, D3D11)\n");
     printf("-p        Use legacy ports UDP 6000:6001:7011 TCP 7000:7001:7100\n");
@@ -590,25 +1408,43 @@ static void print_info (char *name) {
     printf("          \"-p tcp n\" or \"-p udp n\" sets TCP or UDP ports separately\n");
     printf("-avdec    Force software h264 video decoding with libav decoder\n"); 
     printf("-vp ...   Choose the GSteamer h264 parser: default \"h264parse\"\n");
+    printf("-vp 0     Use no h264 parser (can reduce CPU load with some decoders)\n");
     printf("-vd ...   Choose the GStreamer h264 decoder; default \"decodebin\"\n");
     printf("          choices: (software) avdec_h264; (hardware) v4l2h264dec,\n");
     printf("          nvdec, nvh264dec, vaapih64dec, vtdec,etc.\n");
     printf("          choices: avdec_h264,vaapih264dec,nvdec,nvh264dec,v4l2h264dec\n");
+    printf("          \"auto\": probe for the best working (hardware) decoder\n");
     printf("-vc ...   Choose the GStreamer videoconverter; default \"videoconvert\"\n");
     printf("          another choice when using v4l2h264dec: v4l2convert\n");
     printf("-vs ...   Choose the GStreamer videosink; default \"autovideosink\"\n");
     printf("          some choices: ximagesink,xvimagesink,vaapisink,glimagesink,\n");
     printf("          gtksink,waylandsink,osxvideosink,kmssink,d3d11videosink etc.\n");
     printf("-vs 0     Streamed audio only, with no video display window\n");
+    printf("-vmem gl  Keep decoded video in GPU memory: GL conversion and scaling\n");
+    printf("-vmem dmabuf   ... or DMABuf memory end-to-end (default: -vmem sys)\n");
     printf("-v4l2     Use Video4Linux2 for GPU hardware h264 decoding\n");
     printf("-bt709    Sometimes needed for Raspberry Pi with GStreamer < 1.22 \n"); 
     printf("-as ...   Choose the GStreamer audiosink; default \"autoaudiosink\"\n");
     printf("          some choices:pulsesink,alsasink,pipewiresink,jackaudiosink,\n");
     printf("          osssink,oss4sink,osxaudiosink,wasapisink,directsoundsink.\n");
+    printf("-resample Always resample audio (default: only if the audiosink may need it)\n");
+    printf("-abatch n Push buffered (AirPlay 2) audio to GStreamer n frames at a time (2-16)\n");
+    printf("-as native[:dev] Bypass GStreamer: decode audio internally, play on ALSA\n");
+    printf("          device dev (default \"default\"); AAC needs libfdk-aac at build time\n");
     printf("-as 0     (or -a)  Turn audio off, streamed video only\n");
     printf("-al x     Audio latency in seconds (default 0.25) reported to client.\n");
+    printf("-autosync [b] Calibrate the reported audio latency and mirror audio offset\n");
+    printf("          from measured GStreamer pipeline latencies (lip-sync bound b ms, default 20)\n");
+    printf("-jb m:M   Audio jitter buffer: minimum, maximum latency m, M in msecs\n");
+    printf("          (0: default limit)\n");
+    printf("-rcvbuf n Set receive buffer of audio data socket to n kB\n");
+    printf("-busypoll n (Linux) Busy-poll audio data socket for n usecs\n");
+    printf("-uring    (Linux >= 6.0) Receive the mirror video stream with io_uring\n");
+    printf("-sessionloop Receive a session's NTP, audio and mirror streams on one thread\n");
     printf("-ca <fn>  In Airplay Audio (ALAC) mode, write cover-art to file <fn>\n");
     printf("-reset n  Reset after 3n seconds client silence (default %d, 0=never)\n", NTP_TIMEOUT_LIMIT);
+    printf("-warmreset Keep mDNS registration and listening sockets across connection\n");
+    printf("          resets: only the client sessions are ended, so clients reconnect at once\n");
     printf("-nc       do Not Close video window when client stops mirroring\n");
     printf("-nohold   Drop current connection when new client connects.\n");
     printf("-restrict Restrict clients to those specified by \"-allow <deviceID>\"\n");
@@ -617,7 +1453,48 @@ static void print_info (char *name) {
     printf("-allow <i>Permit deviceID = <i> to connect if restrictions are imposed\n");
     printf("-block <i>Always block connections from deviceID = <i>\n");
     printf("-FPSdata  Show video-streaming performance reports sent by client.\n");
+    printf("-zc       Zero-copy video: decrypt directly into GStreamer buffers\n");
+    printf("-h265     Support h265 (4K) video (with h265 versions of h264 plugins)\n");
+    printf("-ptp      Offer PTP (AirPlay 2) timing to clients (uses UDP ports 319, 320)\n");
+    printf("-buffered Offer buffered AirPlay 2 audio (TCP) to clients (implies -ptp)\n");
+    printf("-maxconn n Allow up to n simultaneous client connections (default 12)\n");
+    printf("-httpdworkers n Handle RTSP requests on n worker threads (0-8, default 0)\n");
+    printf("-sessions n [c0:c1:..] Serve up to n (max %d) clients at once, each with its\n", RAOP_MAX_SESSIONS);
+    printf("          own video renderer (\"%%d\" in -vs videosink is the session number);\n");
+    printf("          optionally pin session i media threads to CPUs ci (e.g. 0-1:2-3)\n");
+    printf("-thread c:s[:s..] Scheduling of httpd, ntp, audio, video (or all) threads c:\n");
+    printf("          s = fifo=<prio>, rr=<prio>, nice=<n>, cpus=<list> (may be repeated)\n");
+    printf("          e.g. \"-thread audio:fifo=50:nice=-10:cpus=2-3\"\n");
+    printf("-vqueue n Queue up to n video frames for rendering (default 0: no queue)\n");
+    printf("-lowlatency Minimize mirror video latency (at the cost of smoothness)\n");
+    printf("-latedrop Drop late video frames before decoding when the decoder falls behind\n");
+    printf("-vrelease [n] Release decoder and videosink resources when the client pauses\n");
+    printf("          video (screen locked, app in background) for n secs (default 2)\n");
+    printf("-shm [/name][:n] Export up to n (default 10) decoded frames/sec to local\n");
+    printf("          programs, in POSIX shared memory /name (default /uxplay-frames)\n");
+    printf("-shmmode m Permissions (octal) of the -shm object (default 0600: owner only)\n");
+    printf("-lazy [prewarm] Build GStreamer pipelines only when first needed (or\n");
+    printf("          in the background after startup, with \"prewarm\")\n");
+    printf("-ashared  Use one audio pipeline for all formats (decoder swapped as needed)\n");
+    printf("-lowmem [n] Low-memory mode (implies -ashared): release GStreamer pipelines\n");
+    printf("          and buffer pools after n secs (default 60) without connections\n");
+    printf("-adaptive Offer lower resolution/framerate to clients if video falls behind\n");
+    printf("-telemetry [n] [fn] Show latency/jitter percentiles every n secs\n");
+    printf("          (default 10); also append them to csv file \"fn\" if given\n");
+    printf("-trace [fn] Record a timeline of RTSP, mirror, audio, NTP and GStreamer push\n");
+    printf("          events; write it (Chrome/Perfetto JSON) to fn (default\n");
+    printf("          uxplay-trace.json) on signal SIGUSR1 and at exit\n");
+    printf("-bench [nodecode] Headless benchmark: video/audio sinks are fakesink, and\n");
+    printf("          frames/s, MB/s and CPU per frame are reported as each session\n");
+    printf("          ends (\"nodecode\": video is not decoded, only parsed)\n");
+    printf("-capture d Record each client session (encrypted packets and keys) to a\n");
+    printf("          file in directory d, for offline replay with uxplay-replay\n");
+    printf("-metrics p Serve Prometheus metrics at http://<host>:p/metrics\n");
+    printf("-statsd host[:port] [n] Push metrics to StatsD every n secs (default\n");
+    printf("          port 8125, n = 10)\n");
     printf("-fps n    Set maximum allowed streaming framerate, default 30\n");
+    printf("-pace     Detect the display refresh rate, offer clients a matching framerate,\n");
+    printf("          and align decoded frames to its vblanks (counting judder events)\n");
     printf("-f {H|V|I}Horizontal|Vertical flip, or both=Inversion=rotate 180 deg\n");
     printf("-r {R|L}  Rotate 90 degrees Right (cw) or Left (ccw)\n");
     printf("-m [mac]  Set MAC address (also Device ID);use for concurrent UxPlays\n");
@@ -633,7 +1510,14 @@ static void print_info (char *name) {
     printf("          =1,2,..; fn=\"audiodump\"; change with \"-admp [n] filename\".\n");
     printf("          x increases when audio format changes. If n is given, <= n\n");
     printf("          audio packets are dumped. \"aud\"= unknown format.\n");
-    printf("-d        Enable debug logging\n");
+    printf("-record fn Record mirror sessions (video and audio, as received, with\n");
+    printf("          no re-encoding) to file fn.mp4 (fragmented) or fn.mkv; later\n");
+    printf("          sessions are recorded to fn-2.mp4, fn-3.mp4, ...\n");
+    printf("-restream url Send mirror sessions (as received, with no decoding) to\n");
+    printf("          url = rtp://host:port, srt://host:port or whip+https://...;\n");
+    printf("          may be used up to %d times, for more than one output\n", RESTREAM_MAX_OUTPUTS);
+    printf("-d [async] Enable debug logging (\"async\": log output is written by a\n");
+    printf("          background thread, not by the streaming threads)\n");
     printf("-v        Displays version information\n");
     printf("-h        Displays this help\n");
     printf("Startup options in $UXPLAYRC, ~/.uxplayrc, or ~/.config/uxplayrc are\n");
@@ -847,6 +1731,16 @@ static void parse_arguments (int argc, char *argv[]) {
                         argv[i]);
                 exit(1);
             }
+        } else if (arg == "-downscale") {
+            downscale = true;
+            if (i < argc - 1 && isdigit((unsigned char) argv[i+1][0])) {
+                std::string value(argv[++i]);
+                unsigned short r = 0;
+                if (!get_display_settings(value, &downscale_size[0], &downscale_size[1], &r) || r) {
+                    fprintf(stderr, "invalid \"-downscale %s\"; -downscale wxh : max w,h=9999\n", argv[i]);
+                    exit(1);
+                }
+            }
         } else if (arg == "-fps") {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             unsigned int n = 255;
@@ -855,6 +1749,8 @@ static void parse_arguments (int argc, char *argv[]) {
                 exit(1);
             }
             display[3] = (unsigned short) n;
+        } else if (arg == "-pace") {
+            pace = true;
         } else if (arg == "-o") {
             display[4] = 1;
         } else if (arg == "-f") {
@@ -906,6 +1802,10 @@ static void parse_arguments (int argc, char *argv[]) {
             use_audio = false;
         } else if (arg == "-d") {
             debug_log = !debug_log;
+            if (i < argc - 1 && strcmp(argv[i+1], "async") == 0) {
+                log_async = true;
+                i++;
+            }
         } else if (arg == "-h"  || arg == "--help" || arg == "-?" || arg == "-help") {
             print_info(argv[0]);
             exit(0);
@@ -916,6 +1816,9 @@ static void parse_arguments (int argc, char *argv[]) {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             video_parser.erase();
             video_parser.append(argv[++i]);
+            if (video_parser == "0") {
+                video_parser.erase();    /* no h264 parser */
+            }
         } else if (arg == "-vd") {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             video_decoder.erase();
@@ -924,14 +1827,36 @@ static void parse_arguments (int argc, char *argv[]) {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             video_converter.erase();
             video_converter.append(argv[++i]);
+            video_converter_option = true;
         } else if (arg == "-vs") {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             videosink.erase();
             videosink.append(argv[++i]);
+        } else if (arg == "-vmem") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            std::string value(argv[++i]);
+            if (value == "sys") {
+                video_memory = VIDEO_MEMORY_SYSTEM;
+            } else if (value == "gl") {
+                video_memory = VIDEO_MEMORY_GL;
+            } else if (value == "dmabuf") {
+                video_memory = VIDEO_MEMORY_DMABUF;
+            } else {
+                fprintf(stderr, "invalid \"-vmem %s\"; allowed values are sys, gl, dmabuf\n", argv[i]);
+                exit(1);
+            }
         } else if (arg == "-as") {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             audiosink.erase();
             audiosink.append(argv[++i]);
+        } else if (arg == "-resample") {
+            audio_resample = true;
+        } else if (arg == "-abatch") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &audio_batch) || audio_batch < 2 || audio_batch > 16) {
+                fprintf(stderr, "invalid \"-abatch %s\": n must be an integer 2-16\n", argv[i]);
+                exit(1);
+            }
         } else if (arg == "-t") {
             fprintf(stderr,"The uxplay option \"-t\" has been removed: it was a workaround for an  Avahi issue.\n");
             fprintf(stderr,"The correct solution is to open network port UDP 5353 in the firewall for mDNS queries\n");
@@ -963,12 +1888,206 @@ static void parse_arguments (int argc, char *argv[]) {
             fullscreen = true;
 	} else if (arg == "-FPSdata") {
             show_client_FPS_data = true;
+        } else if (arg == "-zc") {
+            zero_copy = true;
+        } else if (arg == "-h265") {
+            h265_support = true;
+        } else if (arg == "-ptp") {
+            ptp_timing = true;
+        } else if (arg == "-buffered") {
+            buffered_audio = true;
+            ptp_timing = true;
+        } else if (arg == "-sessions") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &max_sessions) || max_sessions < 1 || max_sessions > RAOP_MAX_SESSIONS) {
+                fprintf(stderr, "invalid \"-sessions %s\"; values 1 - %d are allowed\n", argv[i], RAOP_MAX_SESSIONS);
+                exit(1);
+            }
+            if (i < argc - 1 && isdigit((unsigned char) argv[i+1][0])) {
+                std::string cpu_lists = argv[++i];
+                std::stringstream ss(cpu_lists);
+                std::string cpu_list;
+                unsigned int n = 0;
+                while (std::getline(ss, cpu_list, ':')) {
+                    if (n == max_sessions || utils_parse_cpu_list(cpu_list.c_str(), &session_cpus[n])) {
+                        fprintf(stderr, "invalid CPU lists \"%s\" for %u sessions: use (e.g.) \"0-1:2-3\"\n",
+                                cpu_lists.c_str(), max_sessions);
+                        exit(1);
+                    }
+                    n++;
+                }
+            }
+        } else if (arg == "-thread") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (thread_config_parse(argv[++i])) {
+                fprintf(stderr, "invalid \"-thread %s\": use class:setting[:setting...] with class httpd, ntp,\n"
+                        "audio, video or all, and settings fifo=<1-99>, rr=<1-99>, nice=<-20-19>, cpus=<list>\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-maxconn") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &max_connections) || max_connections < 2 || max_connections > 256) {
+                fprintf(stderr, "invalid \"-maxconn %s\"; values 2 - 256 are allowed\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-httpdworkers") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &httpd_workers) || httpd_workers > 8) {
+                fprintf(stderr, "invalid \"-httpdworkers %s\"; values 0 - 8 are allowed\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-lazy") {
+            lazy_renderers = true;
+            if (i < argc - 1 && strcmp(argv[i+1], "prewarm") == 0) {
+                lazy_prewarm = true;
+                i++;
+            }
+        } else if (arg == "-ashared") {
+            audio_shared = true;
+        } else if (arg == "-lowmem") {
+            low_memory = true;
+            audio_shared = true;
+            if (i < argc - 1 && isdigit((unsigned char) argv[i+1][0])) {
+                if (!get_value(argv[++i], &low_memory_idle) || low_memory_idle < LOW_MEMORY_INTERVAL) {
+                    fprintf(stderr, "invalid \"-lowmem %s\": n must be an integer >= %d\n", argv[i], LOW_MEMORY_INTERVAL);
+                    exit(1);
+                }
+            }
+        } else if (arg == "-adaptive") {
+            adaptive = true;
+        } else if (arg == "-lowlatency") {
+            low_latency = true;
+        } else if (arg == "-latedrop") {
+            late_drop = true;
+        } else if (arg == "-vrelease") {
+            video_release = 2;
+            if (i < argc - 1 && isdigit((unsigned char) argv[i+1][0])) {
+                if (!get_value(argv[++i], &video_release) || video_release < 1 || video_release > 60) {
+                    fprintf(stderr, "invalid \"-vrelease %s\"; -vrelease n must have 1 <= n <= 60 (secs)\n", argv[i]);
+                    exit(1);
+                }
+            }
+        } else if (arg == "-shm") {
+            shm_name = "/uxplay-frames";
+            if (i < argc - 1 && (argv[i+1][0] == '/' || argv[i+1][0] == ':')) {
+                std::string value = argv[++i];
+                size_t pos = value.find(':');
+                if (pos != std::string::npos) {
+                    shm_fps = 0;
+                    if (!get_value(value.substr(pos + 1).c_str(), &shm_fps) || shm_fps < 1 || shm_fps > 60) {
+                        fprintf(stderr, "invalid \"-shm %s\"; -shm [/name][:n] must have 1 <= n <= 60 (frames/sec)\n",
+                                argv[i]);
+                        exit(1);
+                    }
+                    value.erase(pos);
+                }
+                if (value.length()) {
+                    if (value.length() < 2 || value.length() > 200 || value.find('/', 1) != std::string::npos) {
+                        fprintf(stderr, "invalid \"-shm %s\"; the name must be \"/name\", with no other '/'\n", argv[i]);
+                        exit(1);
+                    }
+                    shm_name = value;
+                }
+            }
+        } else if (arg == "-shmmode") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            char *end = NULL;
+            unsigned long mode = strtoul(argv[++i], &end, 8);
+            if (!end || *end || (mode & ~0666UL) || (mode & 0600) != 0600) {
+                fprintf(stderr, "invalid \"-shmmode %s\"; an octal mode 0600 - 0666 (e.g., 0640) is required\n", argv[i]);
+                exit(1);
+            }
+            shm_mode = (unsigned int) mode;
+        } else if (arg == "-metrics") {
+            unsigned int n = 0;
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &n) || n == 0 || n > 65535) {
+                fprintf(stderr, "invalid \"-metrics %s\"; a TCP port 1 - 65535 is required\n", argv[i]);
+                exit(1);
+            }
+            metrics_port = (unsigned short) n;
+        } else if (arg == "-statsd") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            statsd_host = argv[++i];
+            size_t pos = statsd_host.rfind(':');
+            if (pos != std::string::npos && statsd_host.find(':') == pos) {
+                /* host:port (an IPv6 address has more than one ':', and uses the default port) */
+                unsigned int n = 0;
+                if (!get_value(statsd_host.substr(pos + 1).c_str(), &n) || n == 0 || n > 65535) {
+                    fprintf(stderr, "invalid \"-statsd %s\"; port must be 1 - 65535\n", argv[i]);
+                    exit(1);
+                }
+                statsd_port = (unsigned short) n;
+                statsd_host.erase(pos);
+            }
+            if (i < argc - 1 && *argv[i+1] != '-') {
+                if (!get_value(argv[++i], &statsd_interval) || statsd_interval == 0 || statsd_interval > 3600) {
+                    fprintf(stderr, "invalid \"-statsd %s %s\"; values 1 - 3600 secs are allowed\n", argv[i-1], argv[i]);
+                    exit(1);
+                }
+            }
+        } else if (arg == "-telemetry") {
+            telemetry_interval = TELEMETRY_DEFAULT_INTERVAL;
+            if (i < argc - 1 && *argv[i+1] != '-') {
+                unsigned int n = 0;
+                if (get_value (argv[++i], &n)) {
+                    if (n == 0 || n > 3600) {
+                        fprintf(stderr, "invalid \"-telemetry %s\"; values 1 - 3600 secs are allowed\n", argv[i]);
+                        exit(1);
+                    }
+                    telemetry_interval = n;
+                    if (i < argc - 1 && *argv[i+1] != '-') {
+                        telemetry_filename = argv[++i];
+                    }
+                } else {
+                    telemetry_filename = argv[i];
+                }
+                if (telemetry_filename.length() && !file_has_write_access(telemetry_filename.c_str())) {
+                    fprintf(stderr, "%s cannot be written to:\noption \"-telemetry [n] <fn>\" must be to a file with write access\n",
+                            telemetry_filename.c_str());
+                    exit(1);
+                }
+            }
+        } else if (arg == "-trace") {
+            trace_filename = "uxplay-trace.json";
+            if (i < argc - 1 && *argv[i+1] != '-') {
+                trace_filename = argv[++i];
+            }
+            if (!file_has_write_access(trace_filename.c_str())) {
+                fprintf(stderr, "%s cannot be written to:\noption \"-trace <fn>\" must be to a file with write access\n",
+                        trace_filename.c_str());
+                exit(1);
+            }
+        } else if (arg == "-bench") {
+            bench_mode = true;
+            if (i < argc - 1 && strcmp(argv[i+1], "nodecode") == 0) {
+                bench_decode = false;
+                i++;
+            }
+        } else if (arg == "-capture") {
+            struct stat sb;
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            capture_dir = argv[++i];
+            if (stat(capture_dir.c_str(), &sb) || !S_ISDIR(sb.st_mode) || access(capture_dir.c_str(), W_OK)) {
+                fprintf(stderr, "invalid \"-capture %s\": must be a directory with write access\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-vqueue") {
+            unsigned int n = 0;
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &n) || n > 64) {
+                fprintf(stderr, "invalid \"-vqueue %s\"; values 0 - 64 are allowed\n", argv[i]);
+                exit(1);
+            }
+            video_queue_depth = (int) n;
         } else if (arg == "-reset") {
             max_ntp_timeouts = 0;
             if (!get_value(argv[++i], &max_ntp_timeouts)) {
                 fprintf(stderr, "invalid \"-reset %s\"; -reset n must have n >= 0,  default n = %d\n", argv[i], NTP_TIMEOUT_LIMIT);
                 exit(1);
             }
+        } else if (arg == "-warmreset") {
+            warm_reset = true;
         } else if (arg == "-vdmp") {
             dump_video = true;
             if (i < argc - 1 && *argv[i+1] != '-') {
@@ -1017,6 +2136,31 @@ static void parse_arguments (int argc, char *argv[]) {
                     exit(1);
                 }   		
             }
+        } else if (arg == "-record") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            record_filename.erase();
+            record_filename.append(argv[++i]);
+            const char *fn = record_filename.c_str();
+            if (!recorder_check_filename(fn)) {
+                fprintf(stderr, "invalid \"-record %s\": the filename extension must be .mp4 or .mkv\n", fn);
+                exit(1);
+            }
+            if (!file_has_write_access(fn)) {
+                fprintf(stderr, "%s cannot be written to:\noption \"-record <fn>\" must be to a file with write access\n", fn);
+                exit(1);
+            }
+        } else if (arg == "-restream") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!restream_check_url(argv[++i])) {
+                fprintf(stderr, "invalid \"-restream %s\": use rtp://host:port, srt://host:port[?options] "
+                        "or whip+http[s]://endpoint\n", argv[i]);
+                exit(1);
+            }
+            if (restream_urls.size() == RESTREAM_MAX_OUTPUTS) {
+                fprintf(stderr, "too many \"-restream\" outputs (maximum %d)\n", RESTREAM_MAX_OUTPUTS);
+                exit(1);
+            }
+            restream_urls.push_back(argv[i]);
         } else if (arg  == "-ca" ) {
             if (option_has_value(i, argc, arg, argv[i+1])) {
                 coverart_filename.erase();
@@ -1034,6 +2178,46 @@ static void parse_arguments (int argc, char *argv[]) {
             bt709_fix = true;
         } else if (arg == "-nohold") {
             nohold = 1;
+        } else if (arg == "-jb") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            std::string value(argv[++i]);
+            size_t pos = value.find(':');
+            bool valid = (pos != std::string::npos);
+            if (valid) {
+                valid = (get_value(value.substr(0, pos).c_str(), &audio_buffer_ms[0]) &&
+                         get_value(value.substr(pos + 1).c_str(), &audio_buffer_ms[1]) &&
+                         audio_buffer_ms[0] <= 3000 && audio_buffer_ms[1] <= 3000 &&
+                         (audio_buffer_ms[0] <= audio_buffer_ms[1] || audio_buffer_ms[1] == 0));
+            }
+            if (!valid) {
+                fprintf(stderr, "invalid \"-jb %s\"; must be \"-jb m:M\" with minimum, maximum latencies"
+                        " 0 <= m <= M <= 3000 (msecs; 0 keeps the default limit)\n", argv[i]);
+                exit(1);
+            }
+        } else if (arg == "-rcvbuf" || arg == "-busypoll") {
+            unsigned int n = 0;
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            if (!get_value(argv[++i], &n) || n == 0 || n > 65536) {
+                fprintf(stderr, "invalid \"%s %s\": n must be a positive integer <= 65536\n", arg.c_str(), argv[i]);
+                exit(1);
+            }
+            if (arg == "-rcvbuf") {
+                audio_rcvbuf_kb = n;
+            } else {
+                audio_busy_poll = n;
+            }
+        } else if (arg == "-uring") {
+            mirror_io_uring = true;
+        } else if (arg == "-sessionloop") {
+            session_loop = true;
+        } else if (arg == "-autosync") {
+            autosync = true;
+            if (i < argc - 1 && isdigit((unsigned char) argv[i+1][0])) {
+                if (!get_value(argv[++i], &autosync_bound) || autosync_bound < 1 || autosync_bound > 100) {
+                    fprintf(stderr, "invalid \"-autosync %s\"; -autosync b must have 1 <= b <= 100 (msecs)\n", argv[i]);
+                    exit(1);
+                }
+            }
         } else if (arg == "-al") {
 	    int n;
             char *end;
@@ -1421,6 +2605,15 @@ static int start_dnssd(std::vector<char> hw_addr, std::string name) {
 
     /* bit 27 of Features determines whether the AirPlay2 client-pairing protocol will be used (1) or not (0) */
     dnssd_set_airplay_features(dnssd, 27, (int) setup_legacy_pairing);
+
+    /* bit 42 of Features ("Supports Screen Multi Codec") allows the client to send h265 mirror video */
+    dnssd_set_airplay_features(dnssd, 42, (int) h265_support);
+
+    /* bit 41 of Features ("Supports PTP") lets the client choose PTP instead of NTP timing */
+    dnssd_set_airplay_features(dnssd, 41, (int) ptp_timing);
+
+    /* bit 40 of Features ("Supports Buffered Audio") lets the client send AAC audio ahead of time over TCP */
+    dnssd_set_airplay_features(dnssd, 40, (int) buffered_audio);
     return 0;
 }
 
@@ -1464,6 +2657,7 @@ extern "C" void display_pin(void *cls, char *pin) {
 
 extern "C" void export_dacp(void *cls, const char *active_remote, const char *dacp_id) {
       if (dacpfile.length()) {
+        std::lock_guard<std::mutex> lock(dacp_mutex);
         FILE *fp = fopen(dacpfile.c_str(), "w");
         if (fp) {
             fprintf(fp,"%s\n%s\n", dacp_id, active_remote);
@@ -1475,17 +2669,34 @@ extern "C" void export_dacp(void *cls, const char *active_remote, const char *da
 }
 
 extern "C" void conn_init (void *cls) {
+    if (open_connections == 0) {
+        connect_time = steady_time_nsecs();
+        uint64_t reset = reset_time.exchange(0);
+        if (reset) {
+            uint64_t reconnect = connect_time - reset;
+            LOGI("client reconnected %.0f ms after the connection reset", (double) reconnect / 1000000.0);
+            metrics_set(METRICS_RECONNECT_TIME, (int64_t) reconnect);
+        }
+    }
+    renderer_mutex.lock();
     open_connections++;
-    LOGD("Open connections: %i", open_connections);
+    renderer_mutex.unlock();
+    LOGD("Open connections: %u", open_connections.load());
     //video_renderer_update_background(1);
 }
 
 extern "C" void conn_destroy (void *cls) {
     //video_renderer_update_background(-1);
+    renderer_mutex.lock();
     open_connections--;
-    LOGD("Open connections: %i", open_connections);
+    renderer_mutex.unlock();
+    LOGD("Open connections: %u", open_connections.load());
     if (open_connections == 0) {
-        remote_clock_offset = 0;
+        connect_time = 0;
+        for (unsigned int i = 0; i < max_sessions; i++) {
+            av_sync_reset(sessions[i].av_sync);
+            record_stop(&sessions[i]);
+        }
         if (use_audio) {
             audio_renderer_stop();
         }
@@ -1495,22 +2706,127 @@ extern "C" void conn_destroy (void *cls) {
     }
 }
 
+/* -record: the n-th recording (n > 1) of "fn.ext" is written to "fn-n.ext" */
+static std::string record_next_filename() {
+    std::string fn = record_filename;
+    if (++record_count > 1) {
+        fn.insert(fn.rfind('.'), "-" + std::to_string(record_count));
+    }
+    return fn;
+}
+
+static void record_stop(session_t *session) {
+    recorder_t *recorder;
+    restream_t *restream = NULL;
+    {
+        std::lock_guard<std::mutex> lock(recorder_mutex);
+        recorder = session->recorder;
+        session->recorder = NULL;
+        if (restream_session == session->id) {
+            restream = restreamer;
+            restreamer = NULL;
+            restream_session = -1;
+        }
+    }
+    /* waits for the muxer to write out the file: not called from the streaming threads */
+    recorder_stop(recorder);
+    restream_stop(restream);
+}
+
+/* -restream: the first session to send video is restreamed, until it ends */
+static void restream_video(session_t *session, h264_decode_struct *data) {
+    std::lock_guard<std::mutex> lock(recorder_mutex);
+    if (restream_session == -1 && data->nal_index.keyframe) {
+        std::vector<const char *> urls;
+        for (const auto &url : restream_urls) {
+            urls.push_back(url.c_str());
+        }
+        restreamer = restream_start(render_logger, urls.data(), (int) urls.size(), data->nal_index.h265,
+                                    session->record_audio_ct);
+        restream_session = session->id;   /* also if restream_start failed: do not retry at every keyframe */
+    }
+    if (restreamer && restream_session == session->id) {
+        restream_push_video(restreamer, data->buffer, data->data, data->data_len, data->nal_index.keyframe,
+                            data->ntp_time_remote);
+    }
+}
+
+/* with -sessions n > 1, a session ending does not reset the other sessions: its own video renderer *
+ * is reset (closing its window), ready for its next client                                          */
+static void session_reset(session_t *session) {
+    std::lock_guard<std::mutex> lock(renderer_mutex);
+    if (session->video_renderer && !video_renderer_reset(session->video_renderer)) {
+        LOGE("failed to reset the video renderer of session %d", session->id);
+    }
+}
+
+/* -bench: throughput of the session that is ending; the telemetry report gives the per-stage latencies.   *
+ * CPU time is that of the whole process (all sessions, and audio) while the session was streaming video */
+static void bench_report(session_t *session) {
+    if (session->bench_frames > 1) {
+        double secs = (double) (session->bench_last - session->bench_start) / 1000000000.0;
+        uint64_t cpu = process_cpu_nsecs() - session->bench_cpu_start;
+        LOGI("benchmark (session %d, %s, %s): %llu frames in %.1f secs, %.1f frames/s, %.2f MB/s, "
+             "CPU %.0f usecs/frame", session->id, video_parser.length() ? video_parser.c_str() : "no parser",
+             bench_decode ? video_decoder.c_str() : "no decoder", (unsigned long long) session->bench_frames, secs,
+             (secs > 0 ? (double) (session->bench_frames - 1) / secs : 0.0),
+             (secs > 0 ? (double) session->bench_bytes / (1000000.0 * secs) : 0.0),
+             (double) cpu / (1000.0 * session->bench_frames));
+    }
+    telemetry_flush();
+    session->bench_frames = 0;
+    session->bench_bytes = 0;
+}
+
+extern "C" void *session_init (void *cls, int session_id) {
+    session_t *session = &sessions[session_id];
+    av_sync_reset(session->av_sync);
+    return (void *) session;
+}
+
+extern "C" void session_destroy (void *cls, int session_id) {
+    session_t *session = &sessions[session_id];
+    if (bench_mode) {
+        bench_report(session);
+    }
+    if (max_sessions > 1) {
+        session_reset(session);
+        LOGI("session %d ended", session_id);
+    }
+    record_stop(session);
+    session->record_audio_ct = 0;
+    av_sync_reset(session->av_sync);
+}
+
 extern "C" void conn_reset (void *cls, int timeouts, bool reset_video) {
+    session_t *session = get_session(cls);
     LOGI("***ERROR lost connection with client (network problem?)");
     if (timeouts) {
         LOGI("   Client no-response limit of %d timeouts (%d seconds) reached:", timeouts, 3*timeouts);
         LOGI("   Sometimes the network connection may recover after a longer delay:\n"
              "   the default timeout limit n = %d can be changed with the \"-reset n\" option", NTP_TIMEOUT_LIMIT);
     }
+    if (max_sessions > 1) {
+        if (reset_video) {
+            session_reset(session);
+        }
+        return;
+    }
     printf("reset_video %d\n",(int) reset_video);
     close_window = reset_video;    /* leave "frozen" window open if reset_video is false */
-    raop_stop(raop);
+    if (!warm_reset) {
+        raop_stop(raop);
+    }   /* else the main thread drops the connections, but keeps the server running */
     reset_loop = true;
 }
 
 extern "C" void conn_teardown(void *cls, bool *teardown_96, bool *teardown_110) {
     if (*teardown_110 && close_window) {
-        reset_loop = true;
+        if (max_sessions > 1) {
+            session_reset(get_session(cls));
+        } else {
+            reset_loop = true;
+        }
     }
 }
 
@@ -1532,14 +2848,23 @@ extern "C" void report_client_request(void *cls, char *deviceid, char * model, c
 }
 
 extern "C" void audio_process (void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
+    session_t *session = get_session(cls);
+    if (session->id != audio_session) {
+        return;   /* another session has the audio renderer */
+    }
     if (dump_audio) {
         dump_audio_to_file(data->data, data->data_len, (data->data)[0] & 0xf0);
     }
-    if (use_audio) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
+    /* from here on, ntp_time_remote is the (slewed) local time at which the audio is played */
+    data->ntp_time_remote = av_sync_convert(session->av_sync, data->ntp_time_local, data->ntp_time_remote);
+    if (record_filename.length() || restream_urls.size()) {
+        std::lock_guard<std::mutex> lock(recorder_mutex);
+        recorder_push_audio(session->recorder, data->data, data->data_len, data->ct, data->ntp_time_remote);
+        if (restreamer && restream_session == session->id) {
+            restream_push_audio(restreamer, data->data, data->data_len, data->ct, data->ntp_time_remote);
         }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
+    }
+    if (use_audio) {
         switch (data->ct) {
         case 2:
             if (audio_delay_alac) {
@@ -1548,8 +2873,9 @@ extern "C" void audio_process (void *cls, raop_ntp_t *ntp, audio_decode_struct *
             break;
         case 4:
         case 8:
-            if (audio_delay_aac) {
-                data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote + audio_delay_aac);
+            if (audio_delay_aac || autosync) {
+                int64_t delay = audio_delay_aac + audio_delay_auto.load(std::memory_order_relaxed);
+                data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote + delay);
             }
             break;
         default:
@@ -1560,33 +2886,85 @@ extern "C" void audio_process (void *cls, raop_ntp_t *ntp, audio_decode_struct *
 }
 
 extern "C" void video_process (void *cls, raop_ntp_t *ntp, h264_decode_struct *data) {
+    session_t *session = get_session(cls);
+    uint64_t connected = connect_time.exchange(0);
+    if (connected) {
+        uint64_t latency = steady_time_nsecs() - connected;
+        LOGI("first video frame received %.0f ms after the client connected", (double) latency / 1000000.0);
+        metrics_set(METRICS_FIRST_FRAME_LATENCY, (int64_t) latency);
+    }
     if (dump_video) {
         dump_video_to_file(data->data, data->data_len);
     }
-    if (use_video) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
+    if (bench_mode) {
+        session->bench_last = steady_time_nsecs();
+        if (!session->bench_frames) {
+            session->bench_start = session->bench_last;
+            session->bench_cpu_start = process_cpu_nsecs();
+        }
+        session->bench_frames++;
+        session->bench_bytes += data->data_len;
+    }
+    data->ntp_time_remote = av_sync_convert(session->av_sync, data->ntp_time_local, data->ntp_time_remote);
+    if (record_filename.length()) {
+        std::lock_guard<std::mutex> lock(recorder_mutex);
+        if (!session->recorder && !record_failed && data->nal_index.keyframe) {
+            std::string fn = record_next_filename();
+            session->recorder = recorder_start(render_logger, fn.c_str(), data->nal_index.h265, session->record_audio_ct);
+            record_failed = !session->recorder;   /* do not retry at every keyframe */
         }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
-        video_renderer_render_buffer(data->data, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
+        recorder_push_video(session->recorder, data->data, data->data_len, data->nal_index.keyframe,
+                            data->ntp_time_remote);
+    }
+    if (restream_urls.size()) {
+        restream_video(session, data);
+    }
+    if (use_video && session->video_renderer) {
+        if (data->buffer) {
+            video_renderer_render_wrapped_buffer(session->video_renderer, data->buffer, &(data->data_len), &(data->nal_count),
+                                                 &(data->ntp_time_remote), &(data->ntp_time_local), &(data->nal_index));
+        } else {
+            video_renderer_render_buffer(session->video_renderer, data->data, &(data->data_len), &(data->nal_count),
+                                         &(data->ntp_time_remote), &(data->ntp_time_local), &(data->nal_index));
+        }
+    } else if (data->buffer) {
+        video_renderer_release_buffer(data->buffer);
+    }
+}
+
+extern "C" void *video_get_buffer (void *cls, int size, unsigned char **data) {
+    return video_renderer_get_buffer(size, data);
+}
+
+extern "C" void video_release_buffer (void *cls, void *buffer) {
+    video_renderer_release_buffer(buffer);
+}
+
+extern "C" void video_set_codec (void *cls, video_codec_t codec) {
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_choose_codec(session->video_renderer, codec);
+    }
+}
+
+extern "C" void video_set_format (void *cls, const video_sps_info_t *info) {
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_set_format(session->video_renderer, info);
     }
 }
 
 extern "C" void video_pause (void *cls) {
-#ifdef GST_124
-    return;  //pause/resume changes in GStreamer-1.24 break this code
-#endif
-    if (use_video) {
-        video_renderer_pause();
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_pause(session->video_renderer);
     }
 }
 
 extern "C" void video_resume (void *cls) {
-#ifdef GST_124
-    return;  //pause/resume changes in GStreamer-1.24 break this code
-#endif
-    if (use_video) {
-        video_renderer_resume();
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_resume(session->video_renderer);
     }
 }
 
@@ -1598,8 +2976,9 @@ extern "C" void audio_flush (void *cls) {
 }
 
 extern "C" void video_flush (void *cls) {
-    if (use_video) {
-        video_renderer_flush();
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_flush(session->video_renderer);
     }
 }
 
@@ -1662,31 +3041,75 @@ extern "C" void audio_get_format (void *cls, unsigned char *ct, unsigned short *
         type = 0x10;
         break;
     }
-    if (audio_dumpfile && type != audio_type) {
-        fclose(audio_dumpfile);
-        audio_dumpfile = NULL;
+    std::lock_guard<std::mutex> lock(audio_format_mutex);
+    if (audio_dump_open && type != audio_type) {
+        dump_writer_close(audio_dump_writer);
+        audio_dump_open = false;
     }
     audio_type = type;
+    audio_session = get_session(cls)->id;
+    get_session(cls)->record_audio_ct = *ct;
     
     if (use_audio) {
-      audio_renderer_start(ct);
+        ensure_audio_renderer();
+        audio_renderer_start(ct);
     }
 
     if (coverart_filename.length()) {
-        write_coverart(coverart_filename.c_str(), (const void *) empty_image, sizeof(empty_image));
+        artwork_writer_coverart(artwork_writer, empty_image, sizeof(empty_image));
     }
 }
 
-extern "C" void video_report_size(void *cls, float *width_source, float *height_source, float *width, float *height) {
+extern "C" void video_setup(void *cls) {
+    session_t *session = get_session(cls);
     if (use_video) {
-        video_renderer_size(width_source, height_source, width, height);
+        ensure_video_renderer(session);
+        renderer_mutex.lock();
+        session->adaptive_level = adaptive_level;   /* the offer the client read when it connected */
+        renderer_mutex.unlock();
+        if (max_sessions > 1 || video_renderer_is_suspended(session->video_renderer)) {
+            /* restart a reset pipeline: its streaming threads are created here, on the session's CPUs */
+            std::lock_guard<std::mutex> lock(renderer_mutex);
+            video_renderer_start(session->video_renderer);
+        }
+    }
+}
+
+extern "C" void video_report_size(void *cls, float *width_source, float *height_source, float *width, float *height) {
+    session_t *session = get_session(cls);
+    if (use_video && session->video_renderer) {
+        video_renderer_size(session->video_renderer, width_source, height_source, width, height);
+    }
+}
+
+extern "C" void video_report_stats(void *cls, const client_video_stats_t *stats) {
+    char summary[256];
+    int len = 0;
+    if (stats->valid & CLIENT_STATS_FPS) {
+        len += snprintf(summary + len, sizeof(summary) - len, " fps %.1f", stats->fps);
+    }
+    if (stats->valid & CLIENT_STATS_DROPPED) {
+        len += snprintf(summary + len, sizeof(summary) - len, " dropped %.0f", stats->dropped);
+    }
+    if (stats->valid & CLIENT_STATS_BITRATE) {
+        len += snprintf(summary + len, sizeof(summary) - len, " bitrate %.0f kbps", stats->bitrate_kbps);
+    }
+    if (stats->valid & CLIENT_STATS_ENCODE_LATENCY) {
+        len += snprintf(summary + len, sizeof(summary) - len, " encode %.1f ms", stats->encode_latency_ms);
+    }
+    if ((stats->valid & CLIENT_STATS_WIDTH) && (stats->valid & CLIENT_STATS_HEIGHT)) {
+        len += snprintf(summary + len, sizeof(summary) - len, " size %dx%d", stats->width, stats->height);
+    }
+    if (show_client_FPS_data) {
+        LOGI("client video stats:%s (%d values)", (len ? summary : " (none recognized)"), stats->keys);
+    } else {
+        LOGD("client video stats:%s (%d values)", (len ? summary : " (none recognized)"), stats->keys);
     }
 }
 
 extern "C" void audio_set_coverart(void *cls, const void *buffer, int buflen) {
-    if (buffer && coverart_filename.length()) {
-        write_coverart(coverart_filename.c_str(), buffer, buflen);
-        LOGI("coverart size %d written to %s", buflen,  coverart_filename.c_str());
+    if (buffer && buflen > 0 && coverart_filename.length()) {
+        artwork_writer_coverart(artwork_writer, buffer, (size_t) buflen);
     }
 }
 
@@ -1699,8 +3122,14 @@ extern "C" void audio_set_progress(void *cls, unsigned int start, unsigned int c
 }
 
 extern "C" void audio_set_metadata(void *cls, const void *buffer, int buflen) {
+    if (buffer && buflen > 0) {
+        artwork_writer_metadata(artwork_writer, buffer, (size_t) buflen);
+    }
+}
+
+/* runs on the artwork writer thread */
+static void process_metadata_listing(const unsigned char *metadata, int buflen) {
     char dmap_tag[5] = {0x0};
-    const unsigned char *metadata = (const  unsigned char *) buffer;
     int datalen;
     int count = 0;
 
@@ -1744,6 +3173,7 @@ extern "C" void register_client(void *cls, const char *device_id, const char *cl
         return;
     }
     LOGI("registered new client: %s DeviceID = %s PK = \n%s", client_name, device_id, client_pk);
+    std::lock_guard<std::mutex> lock(registration_mutex);
     registered_keys.push_back(client_pk);
     if (strlen(pairing_register.c_str())) {
         FILE *fp = fopen(pairing_register.c_str(), "a");
@@ -1761,7 +3191,10 @@ extern "C" bool check_register(void *cls, const char *client_pk) {
     }
     LOGD("check returning client's pairing registration");
     std::string pk = client_pk;
-    if (std::find(registered_keys.rbegin(), registered_keys.rend(), pk) != registered_keys.rend()) {
+    registration_mutex.lock();
+    bool found = (std::find(registered_keys.rbegin(), registered_keys.rend(), pk) != registered_keys.rend());
+    registration_mutex.unlock();
+    if (found) {
         LOGD("registration found: PK=%s", client_pk);
         return true;
     } else {
@@ -1809,6 +3242,8 @@ static int start_raop_server (unsigned short display[5], unsigned short tcp[3],
     raop_cbs.audio_set_volume = audio_set_volume;
     raop_cbs.audio_get_format = audio_get_format;
     raop_cbs.video_report_size = video_report_size;
+    raop_cbs.video_report_stats = video_report_stats;
+    raop_cbs.video_setup = video_setup;
     raop_cbs.audio_set_metadata = audio_set_metadata;
     raop_cbs.audio_set_coverart = audio_set_coverart;
     raop_cbs.audio_set_progress = audio_set_progress;
@@ -1817,6 +3252,14 @@ static int start_raop_server (unsigned short display[5], unsigned short tcp[3],
     raop_cbs.register_client = register_client;
     raop_cbs.check_register = check_register;
     raop_cbs.export_dacp = export_dacp;
+    raop_cbs.video_set_codec = video_set_codec;
+    raop_cbs.video_set_format = video_set_format;
+    raop_cbs.session_init = session_init;
+    raop_cbs.session_destroy = session_destroy;
+    if (zero_copy && use_video) {
+        raop_cbs.video_get_buffer = video_get_buffer;
+        raop_cbs.video_release_buffer = video_release_buffer;
+    }
 
     raop = raop_init(&raop_cbs);
     if (raop == NULL) {
@@ -1825,6 +3268,9 @@ static int start_raop_server (unsigned short display[5], unsigned short tcp[3],
     }
     raop_set_log_callback(raop, log_callback, NULL);
     raop_set_log_level(raop, log_level);
+    if (log_async && raop_set_log_async(raop, true) < 0) {
+        LOGW("asynchronous logging could not be started");
+    }
     /* set nohold = 1 to allow  capture by new client */
     if (raop_init2(raop, nohold, mac_address.c_str(), keyfile.c_str())){
         LOGE("Error initializing raop (2)!");
@@ -1840,10 +3286,31 @@ static int start_raop_server (unsigned short display[5], unsigned short tcp[3],
     if (display[2]) raop_set_plist(raop, "refreshRate", (int) display[2]);
     if (display[3]) raop_set_plist(raop, "maxFPS", (int) display[3]);
     if (display[4]) raop_set_plist(raop, "overscanned", (int) display[4]);
+    if (adaptive && use_video && adaptive_level) adaptive_apply_level();
 
     if (show_client_FPS_data) raop_set_plist(raop, "clientFPSdata", 1);
+    if (h265_support) raop_set_plist(raop, "h265", 1);
+    if (ptp_timing) raop_set_plist(raop, "ptp", 1);
+    if (buffered_audio) raop_set_plist(raop, "buffered_audio", 1);
+    if (max_connections) raop_set_plist(raop, "max_connections", (int) max_connections);
+    if (httpd_workers) raop_set_plist(raop, "httpd_workers", (int) httpd_workers);
+    if (max_sessions > 1) raop_set_plist(raop, "max_sessions", (int) max_sessions);
+    if (capture_dir.length()) raop_set_capture_dir(raop, capture_dir.c_str());
+    for (unsigned int i = 0; i < max_sessions; i++) {
+        if (session_cpus[i]) raop_set_session_cpus(raop, (int) i, session_cpus[i]);
+    }
+    if (video_queue_depth < 0 && low_latency) {
+        video_queue_depth = LOW_LATENCY_VIDEO_QUEUE_DEPTH;
+    }
+    if (video_queue_depth >= 0) raop_set_plist(raop, "video_queue_depth", video_queue_depth);
     raop_set_plist(raop, "max_ntp_timeouts", max_ntp_timeouts);
     if (audiodelay >= 0) raop_set_plist(raop, "audio_delay_micros", audiodelay);
+    if (audio_buffer_ms[0]) raop_set_plist(raop, "audio_buffer_min_ms", (int) audio_buffer_ms[0]);
+    if (audio_buffer_ms[1]) raop_set_plist(raop, "audio_buffer_max_ms", (int) audio_buffer_ms[1]);
+    if (audio_rcvbuf_kb) raop_set_plist(raop, "audio_rcvbuf", (int) (audio_rcvbuf_kb * 1024));
+    if (audio_busy_poll) raop_set_plist(raop, "audio_busy_poll", (int) audio_busy_poll);
+    if (mirror_io_uring) raop_set_plist(raop, "mirror_io_uring", 1);
+    if (session_loop) raop_set_plist(raop, "session_loop", 1);
     if (require_password) raop_set_plist(raop, "pin", (int) pin);
 
     /* network port selection (ports listed as "0" will be dynamically assigned) */
@@ -1970,6 +3437,11 @@ int main (int argc, char *argv[]) {
     std::vector<char> server_hw_addr;
     std::string config_file = "";
 
+    startup_time = steady_time_nsecs();
+    for (int i = 0; i < RAOP_MAX_SESSIONS; i++) {
+        sessions[i].id = i;
+    }
+
 #ifdef SUPPRESS_AVAHI_COMPAT_WARNING
     // suppress avahi_compat nag message.  avahi emits a "nag" warning (once)
     // if  getenv("AVAHI_COMPAT_NOWARN") returns null.
@@ -1994,16 +3466,40 @@ int main (int argc, char *argv[]) {
 
     LOGI("UxPlay %s: An Open-Source AirPlay mirroring and audio-streaming server.", VERSION);
 
+    if (bench_mode) {
+        /* headless: frames are discarded as soon as they are decoded (or parsed, with "nodecode") */
+        if (videosink != "0") {
+            videosink = "fakesink";
+        }
+        if (audiosink != "0") {
+            audiosink = "fakesink";
+        }
+        video_sync = false;
+        audio_sync = false;
+        if (!bench_decode) {
+            video_decoder.erase();
+        }
+        if (!telemetry_interval) {
+            telemetry_interval = 3600;   /* reported when each session ends */
+        }
+        LOGI("benchmark mode: video and audio go to fakesink; throughput is reported when each session ends");
+    }
     if (audiosink == "0") {
         use_audio = false;
         dump_audio = false;
     }
+    if (video_converter_option && video_memory != VIDEO_MEMORY_SYSTEM) {
+        LOGW("\"-vc %s\" is not used with \"-vmem %s\": the video is converted by %s", video_converter.c_str(),
+             (video_memory == VIDEO_MEMORY_GL ? "gl" : "dmabuf"),
+             (video_memory == VIDEO_MEMORY_GL ? "glcolorconvert" : "the decoder and videosink (DMABuf)"));
+    }
     if (dump_video) {
         if (video_dump_limit > 0) {
              printf("dump video using \"-vdmp %d %s\"\n", video_dump_limit, video_dumpfile_name.c_str());
 	} else {
              printf("dump video using \"-vdmp %s\"\n", video_dumpfile_name.c_str());
         }
+        video_dump_writer = dump_writer_start("video", VIDEO_DUMP_RING_SIZE);
     }
     if (dump_audio) {
         if (audio_dump_limit > 0) {
@@ -2011,6 +3507,7 @@ int main (int argc, char *argv[]) {
         } else {
             printf("dump audio using \"-admp %s\"\n",  audio_dumpfile_name.c_str());
         }
+        audio_dump_writer = dump_writer_start("audio", AUDIO_DUMP_RING_SIZE);
     }
 
 #if __APPLE__
@@ -2019,6 +3516,42 @@ int main (int argc, char *argv[]) {
     new_window_closing_behavior = false;
 #endif
 
+    if (downscale) {
+        if (!downscale_size[0]) {
+            downscale_size[0] = (display[0] ? display[0] : 1280);
+            downscale_size[1] = (display[1] ? display[1] : 720);
+        }
+        if (!display[0]) {
+            /* ask the client to stream at (at most) this size */
+            display[0] = downscale_size[0];
+            display[1] = downscale_size[1];
+        }
+        LOGI("-downscale: decoded video will be at most %ux%u", downscale_size[0], downscale_size[1]);
+    }
+
+    if (pace && videosink != "0") {
+        const char *source = NULL;
+        if (display_refresh_detect(&refresh_rate, &source)) {
+            LOGI("-pace: display refresh rate %.3f Hz (from %s)", refresh_rate, source);
+        } else if (display[2]) {
+            refresh_rate = (double) display[2];
+            LOGI("-pace: display refresh rate not detected, using %u Hz from -s", display[2]);
+        } else {
+            LOGW("-pace: the display refresh rate could not be detected (use -s wxh@r): no frame pacing");
+        }
+        if (refresh_rate > 0.0) {
+            /* offer the highest rate refresh/n within the -fps limit, so each frame lasts n vblanks */
+            unsigned short limit = (display[3] ? display[3] : 30);
+            int n = 1;
+            while (refresh_rate / n > limit + 0.5) {
+                n++;
+            }
+            display[2] = (unsigned short) (refresh_rate + 0.5);
+            display[3] = (unsigned short) (refresh_rate / n + 0.5);
+            LOGI("-pace: offering clients up to %u fps (%d vblank%s per frame)", display[3], n, (n > 1 ? "s" : ""));
+        }
+    }
+
     if (videosink == "0") {
         use_video = false;
 	videosink.erase();
@@ -2044,7 +3577,9 @@ int main (int argc, char *argv[]) {
     }
 
     if (bt709_fix && use_video) {
-        video_parser.append(" ! ");
+        if (video_parser.length()) {
+            video_parser.append(" ! ");
+        }
         video_parser.append(BT709_FIX);
     }
 
@@ -2107,17 +3642,61 @@ int main (int argc, char *argv[]) {
     render_logger = logger_init();
     logger_set_callback(render_logger, log_callback, NULL);
     logger_set_level(render_logger, log_level);
+    if (log_async && logger_set_async(render_logger, true) < 0) {
+        LOGW("asynchronous logging could not be started");
+    }
+    for (int i = 0; i < RAOP_MAX_SESSIONS; i++) {
+        sessions[i].av_sync = av_sync_init(render_logger);
+    }
 
-    if (use_audio) {
-      audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync);
-    } else {
+    if (metrics_port || statsd_host.length()) {
+        if (metrics_start(render_logger, metrics_port, (statsd_host.length() ? statsd_host.c_str() : NULL),
+                          statsd_port, (int) statsd_interval) < 0) {
+            exit(1);
+        }
+    }
+    if (telemetry_interval) {
+        if (telemetry_start(render_logger, (int) telemetry_interval,
+                            (telemetry_filename.length() ? telemetry_filename.c_str() : NULL)) < 0) {
+            exit(1);
+        }
+    }
+    if (trace_filename.length()) {
+        if (trace_start(render_logger) < 0) {
+            exit(1);
+        }
+#ifndef _WIN32
+        LOGI("-trace: the event timeline will be written to %s at exit, and when signal SIGUSR1 is received (kill -USR1 %d)",
+             trace_filename.c_str(), (int) getpid());
+#else
+        LOGI("-trace: the event timeline will be written to %s at exit", trace_filename.c_str());
+#endif
+    }
+
+    if (!use_audio) {
         LOGI("audio_disabled");
     }
+    if (low_memory) {
+        LOGI("low-memory mode: pipelines and buffer pools are released after %u secs without connections",
+             low_memory_idle);
+    }
+    if (lazy_renderers) {
+        LOGI("lazy mode: GStreamer pipelines will be built when first needed%s",
+             (lazy_prewarm ? " (or in the background, once ready for connections)" : ""));
+    } else {
+        if (use_audio) {
+            ensure_audio_renderer();
+        }
+        if (use_video) {
+            ensure_video_renderer(&sessions[0]);
+        }
+    }
 
-    if (use_video) {
-        video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
-                            video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen, &video_sync);
-        video_renderer_start();
+    if (max_sessions > 1 && (udp[0] || tcp[0])) {
+        /* each session needs its own timing, control, data and mirror ports */
+        LOGI("-sessions %u: the UDP ports and the TCP mirror port will be dynamically assigned", max_sessions);
+        udp[0] = udp[1] = udp[2] = 0;
+        tcp[0] = 0;
     }
 
     if (udp[0]) {
@@ -2139,6 +3718,7 @@ int main (int argc, char *argv[]) {
     }
     parse_hw_addr(mac_address, server_hw_addr);
 
+    artwork_writer = artwork_writer_start();
     if (coverart_filename.length()) {
         LOGI("any AirPlay audio cover-art will be written to file  %s",coverart_filename.c_str());
         write_coverart(coverart_filename.c_str(), (const void *) empty_image, sizeof(empty_image));
@@ -2157,29 +3737,62 @@ int main (int argc, char *argv[]) {
         stop_dnssd();
         goto cleanup;
     }
+    if (startup_time) {
+        LOGI("ready for connections %.0f ms after startup, RSS %ld kB", (double) (steady_time_nsecs() - startup_time) / 1000000.0,
+             get_rss_kb());
+        startup_time = 0;
+        if (lazy_prewarm) {
+            prewarm_thread = std::thread(prewarm_renderers);
+        }
+    }
     reconnect:
     compression_type = 0;
     close_window = new_window_closing_behavior; 
     main_loop();
     if (relaunch_video || reset_loop) {
+        bool warm = false;
         if(reset_loop) {
             reset_loop = false;
+            reset_time = steady_time_nsecs();
+            /* -warmreset: end the sessions before their renderers are reset; on failure, do a full restart */
+            if (warm_reset && raop_is_running(raop)) {
+                warm = (raop_drop_connections(raop) == 0);
+                if (!warm) {
+                    LOGW("client sessions did not end in time: restarting the RAOP server");
+                }
+            }
         } else {
             raop_stop(raop);
         }
         if (use_audio) audio_renderer_stop();
-        if (use_video && close_window) {
-            video_renderer_destroy();
-            video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
-                                video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen,
-                                &video_sync);
-            video_renderer_start();
+        renderer_mutex.lock();
+        for (unsigned int n = 0; n < max_sessions; n++) {
+            session_t *session = &sessions[n];
+            if (!use_video || !close_window || !session->video_renderer) {
+                continue;
+            }
+            /* reuse the existing video pipelines; rebuild them only if that fails */
+            uint64_t start = steady_time_nsecs();
+            bool reused = video_renderer_reset(session->video_renderer);
+            if (!reused) {
+                video_renderer_destroy(session->video_renderer);
+                session->video_renderer = video_renderer_create(session->id);
+            }
+            video_renderer_start(session->video_renderer);
+            uint64_t relaunch = steady_time_nsecs() - start;
+            LOGI("video renderer %s for the next connection in %.1f ms", (reused ? "reset" : "rebuilt"),
+                 (double) relaunch / 1000000.0);
+            metrics_set(METRICS_VIDEO_RELAUNCH_TIME, (int64_t) relaunch);
         }
+        renderer_mutex.unlock();
         if (relaunch_video) {
             unsigned short port = raop_get_port(raop);
             raop_start(raop, &port);
             raop_set_port(raop, port);
             goto reconnect;
+        } else if (warm) {
+            LOGI("Connection reset: keeping the RAOP server, its listening sockets and mDNS registration");
+            goto reconnect;
         } else {
             LOGI("Re-launching RAOP server...");
             stop_raop_server();
@@ -2192,21 +3805,48 @@ int main (int argc, char *argv[]) {
         stop_dnssd();
     }
     cleanup:
-    if (use_audio) {
+    if (prewarm_thread.joinable()) {
+        prewarm_thread.join();
+    }
+    if (audio_renderer_ready) {
         audio_renderer_destroy();
     }
-    if (use_video)  {
-        video_renderer_destroy();
+    for (unsigned int n = 0; n < max_sessions; n++) {
+        record_stop(&sessions[n]);
+        if (sessions[n].video_renderer)  {
+            video_renderer_destroy(sessions[n].video_renderer);
+            sessions[n].video_renderer = NULL;
+        }
     }
-    logger_destroy(render_logger);
-    render_logger = NULL;
-    if(audio_dumpfile) {
-        fclose(audio_dumpfile);
+    video_renderer_free_buffers();
+    display_refresh_close();
+    telemetry_stop();
+    if (trace_filename.length()) {
+        trace_write(trace_filename.c_str());
+        trace_stop();
     }
-    if (video_dumpfile) {
-        fwrite(mark, 1, sizeof(mark), video_dumpfile);
-        fclose(video_dumpfile);
+    metrics_stop();
+    for (int i = 0; i < RAOP_MAX_SESSIONS; i++) {
+        av_sync_destroy(sessions[i].av_sync);
+        sessions[i].av_sync = NULL;
     }
+    logger_destroy(render_logger);
+    render_logger = NULL;
+    if (audio_dump_open) {
+        dump_writer_close(audio_dump_writer);
+        audio_dump_open = false;
+    }
+    if (video_dump_open) {
+        dump_writer_write(video_dump_writer, mark, sizeof(mark));
+        dump_writer_close(video_dump_writer);
+        video_dump_open = false;
+    }
+    dump_writer_stop(audio_dump_writer);
+    audio_dump_writer = NULL;
+    dump_writer_stop(video_dump_writer);
+    video_dump_writer = NULL;
+    artwork_writer_stop(artwork_writer);
+    artwork_writer = NULL;
     if (coverart_filename.length()) {
 	remove (coverart_filename.c_str());
     }